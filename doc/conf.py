@@ -18,7 +18,7 @@ import re
 def parse_build_version(fname):
   with open(fname, 'r') as fh:
     for ln in fh.readlines():
-      m = re.match(r'^#define\s+\w+_VERSION\s+"(.*)"', ln)
+      m = re.match(r'^project\(\w+\s+VERSION\s+([\w.]+)', ln)
       if(m):
         return m.group(1)
 
@@ -32,7 +32,7 @@ copyright = '2020, Kevin Thibedeau'
 author = 'Kevin Thibedeau'
 
 # The full version, including alpha/beta/rc tags
-release = parse_build_version('../include/evfs/evfs_build_config.h')
+release = parse_build_version('../CMakeLists.txt')
 print('BUILD RELEASE:', release)
 
 # -- General configuration ---------------------------------------------------
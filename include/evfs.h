@@ -44,6 +44,8 @@ typedef struct Evfs Evfs;
 typedef struct EvfsFile EvfsFile;
 typedef struct EvfsDir EvfsDir;
 typedef struct EvfsInfo EvfsInfo;
+typedef struct EvfsBatchOp EvfsBatchOp;
+typedef struct EvfsHandlePool EvfsHandlePool;
 
 
 // Type for working with file sizes and offsets
@@ -63,6 +65,16 @@ typedef struct Evfs {
   size_t vfs_dir_size;
   void *fs_data;
 
+  // Optional preallocated handles. See evfs_vfs_pool_init()
+  EvfsHandlePool *file_pool;
+  EvfsHandlePool *dir_pool;
+
+  // Optional allocator for heap allocated handles. See evfs_vfs_set_allocator()
+  const struct EvfsAllocator *allocator;
+
+  // Defined at compile time and registered with evfs_register_static()
+  bool is_static;
+
   // Required methods
   int (*m_open)(Evfs *vfs, const char *path, EvfsFile *fh, int flags);
   int (*m_stat)(Evfs *vfs, const char *path, EvfsInfo *info);
@@ -81,6 +93,14 @@ typedef struct Evfs {
 
   bool (*m_path_root_component)(Evfs *vfs, const char *path, StringRange *root);
 
+  // Copy from the current position of src into dest opened on this VFS
+  // Return EVFS_ERR_NO_SUPPORT to use the generic copy
+  int (*m_copy)(Evfs *vfs, EvfsFile *dest, EvfsFile *src, evfs_off_t size);
+
+  // Run an array of metadata operations. See evfs_batch_ex()
+  // Return EVFS_ERR_NO_SUPPORT before running any of them to use the generic batch
+  int (*m_batch)(Evfs *vfs, EvfsBatchOp *ops, size_t num_ops);
+
 } Evfs;
 
 
@@ -91,6 +111,31 @@ typedef enum {
 } EvfsSeekDir;
 
 
+// Buffer descriptor for vectored I/O
+typedef struct EvfsIOVec {
+  void   *base;
+  size_t  len;
+} EvfsIOVec;
+
+
+// Byte range for EVFS_CMD_PREFETCH
+typedef struct EvfsFileRange {
+  evfs_off_t  offset;
+  evfs_off_t  size;   // 0 for the rest of the file
+} EvfsFileRange;
+
+
+// Read-only view of file data returned by evfs_file_map()
+typedef struct EvfsMapping {
+  const uint8_t *data;  // Start of mapped data
+  size_t  size;         // Bytes mapped
+
+  // Private data for the backend
+  void   *map_base;
+  size_t  map_len;
+} EvfsMapping;
+
+
 // Virtual methods for EvfsFile
 typedef struct EvfsFileMethods {
   int       (*m_ctrl)(EvfsFile *fh, int cmd, void *arg);
@@ -103,12 +148,50 @@ typedef struct EvfsFileMethods {
   int       (*m_seek)(EvfsFile *fh, evfs_off_t offset, EvfsSeekDir origin);
   evfs_off_t (*m_tell)(EvfsFile *fh);
   bool      (*m_eof)(EvfsFile *fh);
+
+  // Optional methods. The library emulates these when they are NULL
+  ptrdiff_t (*m_read_at)(EvfsFile *fh, void *buf, size_t size, evfs_off_t offset);
+  ptrdiff_t (*m_write_at)(EvfsFile *fh, const void *buf, size_t size, evfs_off_t offset);
+  ptrdiff_t (*m_readv)(EvfsFile *fh, const EvfsIOVec *iov, int iovcnt);
+  ptrdiff_t (*m_writev)(EvfsFile *fh, const EvfsIOVec *iov, int iovcnt);
+  int       (*m_map)(EvfsFile *fh, evfs_off_t offset, size_t size, EvfsMapping *map);
+  int       (*m_unmap)(EvfsFile *fh, EvfsMapping *map);
+  int       (*m_discard)(EvfsFile *fh, evfs_off_t offset, evfs_off_t size);
 } EvfsFileMethods;
 
 
+// Per-handle counters kept by the file API when EVFS_USE_IO_STATS is enabled
+typedef struct EvfsIOCounters {
+  uint32_t  reads;      // Calls to read, read_at, and readv
+  uint32_t  writes;     // Calls to write, write_at, and writev
+  uint32_t  seeks;
+  uint32_t  syncs;
+  uint32_t  errors;     // Calls above that returned an error
+  uint64_t  bytes_read;
+  uint64_t  bytes_written;
+} EvfsIOCounters;
+
+// Statistics reported by EVFS_CMD_GET_IO_STATS
+// Shims and filesystems add their own counts to the fields after io.
+typedef struct EvfsIOStats {
+  EvfsIOCounters io;
+  uint32_t  chunk_activations;  // Rotate shim chunk files opened
+  uint32_t  chunk_evictions;    // Rotate shim chunks deleted from the container
+  uint32_t  cache_hits;         // Reads served from a shim buffer
+  uint32_t  cache_misses;       // Reads that went to the base file
+  uint32_t  header_reads;       // Tar headers scanned to index the archive
+} EvfsIOStats;
+
+
 // Base class for file objects
 struct EvfsFile {
   const EvfsFileMethods *methods;
+#ifdef EVFS_USE_IO_STATS
+  EvfsIOCounters io;
+#endif
+#ifdef EVFS_USE_LATENCY_HOOKS
+  Evfs *vfs;  // VFS that opened the handle. NULL for handles embedded in a shim.
+#endif
 };
 
 
@@ -126,11 +209,57 @@ typedef struct EvfsInfo {
 #define EVFS_FILE_SYM_LINK    0x02
 
 
+// Visitor callback for evfs_walk()
+// Return EVFS_OK to continue, EVFS_DONE from a pre-visit to skip a directory,
+// or an error code to stop the walk.
+typedef int (*EvfsWalkVisitor)(const char *path, const EvfsInfo *info, unsigned depth, void *ctx);
+
+typedef struct EvfsWalkConfig {
+  EvfsWalkVisitor pre_visit;    // Called for each entry before a directory's contents
+  EvfsWalkVisitor post_visit;   // Called for directories after their contents
+  const char     *pattern;      // Glob filter for non-directory entries. NULL for all
+  int             max_depth;    // Levels of subdirectories to descend into. Negative for no limit
+  unsigned        num_threads;  // Threads for a parallel walk. 0 or 1 for a serial walk
+  void           *ctx;          // User data passed to the visitors
+} EvfsWalkConfig;
+
+
+// Settings for evfs_copy_tree() and evfs_delete_tree()
+typedef struct EvfsTreeConfig {
+  unsigned        num_threads;  // Threads for scanning and file transfers. 0 or 1 for serial
+  size_t          buf_size;     // Transfer buffer for each thread. 0 for the default
+  const char     *pattern;      // Glob filter for non-directory entries. NULL for all
+} EvfsTreeConfig;
+
+
+// Operations for evfs_batch()
+typedef enum {
+  EVFS_BATCH_STAT = 1,
+  EVFS_BATCH_DELETE,
+  EVFS_BATCH_RENAME,
+  EVFS_BATCH_MAKE_DIR,
+  EVFS_BATCH_MAKE_PATH
+} EvfsBatchCode;
+
+// One entry in an evfs_batch() array
+struct EvfsBatchOp {
+  EvfsBatchCode op;
+  const char   *path;
+  const char   *new_path;   // Destination for EVFS_BATCH_RENAME
+  EvfsInfo     *info;       // Result of EVFS_BATCH_STAT. The name isn't reported
+  int           status;     // Result of the operation
+};
+
+
 // Virtual methods for directory objects
 typedef struct EvfsDirMethods {
   int    (*m_close)(EvfsDir *dh);
   int    (*m_read)(EvfsDir *dh, EvfsInfo *info);
   int    (*m_rewind)(EvfsDir *dh);
+
+  // Optional methods
+  int    (*m_read_many)(EvfsDir *dh, EvfsInfo *entries, int max_entries, char *name_buf,
+                        size_t name_buf_size);
 } EvfsDirMethods;
 
 
@@ -170,7 +299,8 @@ struct EvfsDir {
   M(EVFS_ERR_DISABLED, -19) \
   M(EVFS_ERR_INVALID, -20) \
   M(EVFS_ERR_REPAIRED, -21) \
-  M(EVFS_ERR_NOT_OPEN, -22)
+  M(EVFS_ERR_NOT_OPEN, -22) \
+  M(EVFS_ERR_BUSY, -23)
 
 
 #define EVFS_ENUM_ITEM(E, V) E = V,
@@ -197,9 +327,27 @@ enum EvfsErrors {
   M(EVFS_CMD_SET_NO_DIR_DOTS, EV_CMD_DEF(12, CMD_WR, unsigned)) \
   M(EVFS_CMD_GET_STAT_FIELDS, EV_CMD_DEF(13, CMD_RD, unsigned)) \
   M(EVFS_CMD_GET_DIR_FIELDS,  EV_CMD_DEF(14, CMD_RD, unsigned)) \
+  M(EVFS_CMD_SET_DIR_STAT,    EV_CMD_DEF(15, CMD_WR, unsigned)) \
+  M(EVFS_CMD_STATIC_INIT,     EV_CMD_DEF(16, CMD_WR, void)) \
+  M(EVFS_CMD_GET_CONCURRENT_WRITES, EV_CMD_DEF(17, CMD_RD, unsigned)) \
   M(EVFS_CMD_SET_ROTATE_CFG,  EV_CMD_DEF(101, CMD_WR, RotateConfig)) \
+  M(EVFS_CMD_SET_BUFFER_SIZE, EV_CMD_DEF(102, CMD_WR, size_t)) \
+  M(EVFS_CMD_GET_METRICS,     EV_CMD_DEF(103, CMD_RD, EvfsMetrics)) \
+  M(EVFS_CMD_RESET_METRICS,   EV_CMD_DEF(104, CMD_RW, EvfsMetrics)) \
+  M(EVFS_CMD_GET_INDEX_STATS, EV_CMD_DEF(105, CMD_RD, EvfsIndexStats)) \
+  M(EVFS_CMD_RUN_MAINTENANCE, EV_CMD_DEF(106, CMD_WR, unsigned)) \
+  M(EVFS_CMD_SET_MAINT_INTERVAL, EV_CMD_DEF(107, CMD_WR, unsigned)) \
+  M(EVFS_CMD_CLEAR_LOOKUP_CACHE, EV_CMD_DEF(108, CMD_WR, void)) \
+  M(EVFS_CMD_BEGIN_TXN,       EV_CMD_DEF(109, CMD_WR, void)) \
+  M(EVFS_CMD_COMMIT_TXN,      EV_CMD_DEF(110, CMD_WR, void)) \
+  M(EVFS_CMD_GET_DEDUP_STATS, EV_CMD_DEF(111, CMD_RD, DedupStats)) \
   M(EVFS_CMD_SET_ROTATE_TRIM, EV_CMD_DEF(201, CMD_WR, evfs_off_t)) \
-  M(EVFS_CMD_GET_RSRC_ADDR,   EV_CMD_DEF(202, CMD_RD, uint8_t *))
+  M(EVFS_CMD_GET_RSRC_ADDR,   EV_CMD_DEF(202, CMD_RD, uint8_t *)) \
+  M(EVFS_CMD_SET_ROTATE_NOTIFY, EV_CMD_DEF(203, CMD_WR, RotateNotify)) \
+  M(EVFS_CMD_SET_FILE_ADVICE, EV_CMD_DEF(204, CMD_WR, unsigned)) \
+  M(EVFS_CMD_PREFETCH,        EV_CMD_DEF(205, CMD_WR, EvfsFileRange)) \
+  M(EVFS_CMD_SET_FAST_SEEK,   EV_CMD_DEF(206, CMD_WR, unsigned)) \
+  M(EVFS_CMD_GET_IO_STATS,    EV_CMD_DEF(207, CMD_RD, EvfsIOStats))
 
 // Offset for external user defined commands
 #define EVFS_CMD_USER_DEFINED  1000
@@ -225,6 +373,23 @@ enum EvfsCommands {
 #define EVFS_OVERWRITE     0x10
 #define EVFS_APPEND        0x20
 
+// Access pattern hints for evfs_open(). Only one can be used. The hint is
+// passed to the opened file with EVFS_CMD_SET_FILE_ADVICE.
+#define EVFS_SEQUENTIAL    (EVFS_ADVICE_SEQUENTIAL << 8)
+#define EVFS_RANDOM        (EVFS_ADVICE_RANDOM << 8)
+#define EVFS_WILL_NEED     (EVFS_ADVICE_WILL_NEED << 8)
+#define EVFS_WRITE_ONCE    (EVFS_ADVICE_WRITE_ONCE << 8)
+#define EVFS_ADVICE_MASK   0xF00
+
+
+// Access patterns for EVFS_CMD_SET_FILE_ADVICE
+#define EVFS_ADVICE_NORMAL      0
+#define EVFS_ADVICE_SEQUENTIAL  1   // Read from start to end
+#define EVFS_ADVICE_RANDOM      2   // Small reads at scattered offsets
+#define EVFS_ADVICE_WILL_NEED   3   // Whole file will be read soon
+#define EVFS_ADVICE_DONT_NEED   4   // Cached data can be dropped
+#define EVFS_ADVICE_WRITE_ONCE  5   // Written data won't be read back
+
 
 
 #ifndef COUNT_OF
@@ -232,8 +397,113 @@ enum EvfsCommands {
 #endif
 
 
-#define evfs_malloc(b)  malloc(b)
-#define evfs_free(p)    free(p)
+// Cached VFS lookup for evfs_vfs_ref_resolve()
+typedef struct EvfsVfsRef {
+  const char *vfs_name;   // NULL for the default VFS
+  Evfs       *vfs;
+  unsigned    generation;
+} EvfsVfsRef;
+
+#define EVFS_VFS_REF(name)  {.vfs_name = (name), .vfs = NULL, .generation = 0}
+
+
+// ******************** Memory allocation ********************
+
+// Allocation classes for evfs_set_allocator()
+enum EvfsAllocClass {
+  EVFS_ALLOC_GENERAL = 0, // Anything not covered below
+  EVFS_ALLOC_HANDLE,      // EvfsFile and EvfsDir objects
+  EVFS_ALLOC_PATH,        // Temporary path buffers
+  EVFS_ALLOC_INDEX,       // Filesystem indices kept for the life of a mount
+  EVFS_ALLOC_FORMAT,      // Formatted output buffers
+
+  EVFS_ALLOC_NUM_CLASSES
+};
+
+// Runtime allocator
+typedef struct EvfsAllocator {
+  void *(*m_alloc)(void *ctx, size_t size);
+  void  (*m_free)(void *ctx, void *ptr);
+  void   *ctx;
+} EvfsAllocator;
+
+// Counters reported by evfs_get_alloc_stats()
+typedef struct EvfsAllocStats {
+  size_t alloc_calls;
+  size_t free_calls;
+  size_t alloc_bytes;   // Cumulative bytes requested
+  size_t failed_allocs;
+} EvfsAllocStats;
+
+// Mount time index summary from EVFS_CMD_GET_INDEX_STATS
+typedef struct EvfsIndexStats {
+  size_t    files;        // Entries added to the index
+  size_t    key_bytes;    // Storage used for path keys
+  uint64_t  build_usec;   // Time to build or load the index. 0 if no clock is available.
+  bool      from_sidecar; // Index was loaded from a saved copy
+} EvfsIndexStats;
+
+// Caller owned buffers for a mount index that is never heap allocated
+typedef struct EvfsIndexStorage {
+  void     *index;        // Hash buckets. Must be pointer aligned.
+  size_t    index_size;
+  char     *keys;         // Path keys and any directory listing. Must be pointer aligned.
+  size_t    keys_size;
+} EvfsIndexStorage;
+
+// Bump allocator for mount lifetime data. See evfs_arena_init()
+typedef struct EvfsArena {
+  EvfsAllocator alloc;
+  uint8_t      *buf;
+  size_t        size;
+  size_t        used;
+  size_t        high_water;
+  size_t        live_allocs;
+} EvfsArena;
+
+
+// Operations timed by the latency hook
+#define EVFS_OP_LIST(M) \
+  M(EVFS_OP_OPEN,       "open") \
+  M(EVFS_OP_STAT,       "stat") \
+  M(EVFS_OP_DELETE,     "delete") \
+  M(EVFS_OP_RENAME,     "rename") \
+  M(EVFS_OP_MAKE_DIR,   "make_dir") \
+  M(EVFS_OP_OPEN_DIR,   "open_dir") \
+  M(EVFS_OP_CLOSE,      "close") \
+  M(EVFS_OP_READ,       "read") \
+  M(EVFS_OP_WRITE,      "write") \
+  M(EVFS_OP_READ_AT,    "read_at") \
+  M(EVFS_OP_WRITE_AT,   "write_at") \
+  M(EVFS_OP_READV,      "readv") \
+  M(EVFS_OP_WRITEV,     "writev") \
+  M(EVFS_OP_TRUNCATE,   "truncate") \
+  M(EVFS_OP_SYNC,       "sync") \
+  M(EVFS_OP_SEEK,       "seek") \
+  M(EVFS_OP_BATCH,      "batch")
+
+#define EVFS_OP_ENUM_ITEM(E, S)  E,
+
+typedef enum {
+  EVFS_OP_LIST(EVFS_OP_ENUM_ITEM)
+  EVFS_OP_COUNT
+} EvfsOpId;
+
+// Sampled call passed to an EvfsLatencyHook
+typedef struct EvfsLatencyEvent {
+  const char *vfs_name;   // VFS that handled the call
+  EvfsOpId    op;
+  ptrdiff_t   result;     // Value returned by the call
+  uint64_t    start_ns;   // Clock reading when the call began
+  uint64_t    elapsed_ns;
+} EvfsLatencyEvent;
+
+// Callback for evfs_set_latency_hook()
+typedef void (*EvfsLatencyHook)(const EvfsLatencyEvent *event, void *ctx);
+
+
+#define evfs_malloc(b)  evfs_class_malloc(EVFS_ALLOC_GENERAL, (b))
+#define evfs_free(p)    evfs_class_free(EVFS_ALLOC_GENERAL, (p))
 
 
 #ifdef __cplusplus
@@ -242,19 +512,58 @@ extern "C" {
 
 const char *evfs_err_name(int err);
 const char *evfs_cmd_name(int cmd);
+const char *evfs_op_name(EvfsOpId op);
 
 
 void evfs_init(void);
 
+// ******************** Memory allocation ********************
+int evfs_set_allocator(int alloc_class, const EvfsAllocator *alloc);
+const EvfsAllocator *evfs_get_allocator(int alloc_class);
+int evfs_vfs_set_allocator(Evfs *vfs, const EvfsAllocator *alloc);
+
+void *evfs_class_malloc(int alloc_class, size_t size);
+void evfs_class_free(int alloc_class, void *ptr);
+void *evfs_alloc_with(const EvfsAllocator *alloc, int alloc_class, size_t size);
+void evfs_free_with(const EvfsAllocator *alloc, int alloc_class, void *ptr);
+
+int evfs_get_alloc_stats(int alloc_class, EvfsAllocStats *stats);
+void evfs_reset_alloc_stats(void);
+
+const EvfsAllocator *evfs_arena_init(EvfsArena *arena, void *buf, size_t size);
+void evfs_arena_reset(EvfsArena *arena);
+
+// ******************** Latency sampling ********************
+int evfs_set_latency_hook(EvfsLatencyHook hook, void *ctx, unsigned sample_every);
+
 // ******************** VFS registration ********************
 Evfs *evfs_find_vfs(const char *vfs_name);
 const char *evfs_vfs_name(Evfs *vfs);
 const char *evfs_default_vfs_name(void);
+Evfs *evfs_vfs_ref_resolve(EvfsVfsRef *ref);
 
 int evfs_register(Evfs *vfs, bool make_default);
+int evfs_register_static(Evfs * const vfs_table[], size_t num_vfs, size_t default_ix);
 int evfs_unregister(Evfs *vfs);
 void evfs_unregister_all(void);
 
+// Default optional methods for VFSs defined at compile time
+int evfs_default_delete(Evfs *vfs, const char *path);
+int evfs_default_rename(Evfs *vfs, const char *old_path, const char *new_path);
+int evfs_default_make_dir(Evfs *vfs, const char *path);
+int evfs_default_open_dir(Evfs *vfs, const char *path, EvfsDir *dh);
+int evfs_default_get_cur_dir(Evfs *vfs, StringRange *cur_dir);
+int evfs_default_set_cur_dir(Evfs *vfs, const char *path);
+int evfs_default_vfs_ctrl(Evfs *vfs, int cmd, void *arg);
+bool evfs_default_path_root_component(Evfs *vfs, const char *path, StringRange *root);
+int evfs_default_copy(Evfs *vfs, EvfsFile *dest, EvfsFile *src, evfs_off_t size);
+int evfs_default_batch(Evfs *vfs, EvfsBatchOp *ops, size_t num_ops);
+int evfs_batch_generic(Evfs *vfs, EvfsBatchOp *ops, size_t num_ops);
+
+int evfs_vfs_pool_init(Evfs *vfs, unsigned file_handles, unsigned dir_handles);
+void evfs_vfs_pool_free(Evfs *vfs);
+unsigned evfs_pool_available(EvfsHandlePool *pool);
+
 
 // ******************** FS access methods ********************
 int evfs_open_ex(const char *path, EvfsFile **fh, int flags, const char *vfs_name);
@@ -317,6 +626,13 @@ static inline int evfs_make_path_range(StringRange *path) {
 }
 
 
+int evfs_batch_ex(EvfsBatchOp *ops, size_t num_ops, const char *vfs_name);
+
+static inline int evfs_batch(EvfsBatchOp *ops, size_t num_ops) {
+  return evfs_batch_ex(ops, num_ops, NULL);
+}
+
+
 int evfs_open_dir_ex(const char *path, EvfsDir **dh, const char *vfs_name);
 
 static inline int evfs_open_dir(const char *path, EvfsDir **dh) {
@@ -348,7 +664,7 @@ static inline int evfs_vfs_ctrl(int op, void *arg) {
 int evfs_copy_to_file_ex(const char *dest_path, EvfsFile *fh, char *buf, size_t buf_size, const char *vfs_name);
 
 static inline int evfs_copy_to_file(const char *dest_path, EvfsFile *fh, char *buf, size_t buf_size) {
-  return evfs_copy_to_file_ex(dest_path, fh, NULL, 0, NULL);
+  return evfs_copy_to_file_ex(dest_path, fh, buf, buf_size, NULL);
 }
 
 
@@ -426,6 +742,13 @@ int evfs_file_ctrl(EvfsFile *fh, int cmd, void *arg);
 int evfs_file_close(EvfsFile *fh);
 ptrdiff_t evfs_file_read(EvfsFile *fh, void *buf, size_t size);
 ptrdiff_t evfs_file_write(EvfsFile *fh, const void *buf, size_t size);
+ptrdiff_t evfs_file_read_at(EvfsFile *fh, void *buf, size_t size, evfs_off_t offset);
+ptrdiff_t evfs_file_write_at(EvfsFile *fh, const void *buf, size_t size, evfs_off_t offset);
+ptrdiff_t evfs_file_readv(EvfsFile *fh, const EvfsIOVec *iov, int iovcnt);
+ptrdiff_t evfs_file_writev(EvfsFile *fh, const EvfsIOVec *iov, int iovcnt);
+int evfs_file_map(EvfsFile *fh, evfs_off_t offset, size_t size, EvfsMapping *map);
+int evfs_file_unmap(EvfsFile *fh, EvfsMapping *map);
+int evfs_file_discard(EvfsFile *fh, evfs_off_t offset, evfs_off_t size);
 int evfs_file_truncate(EvfsFile *fh, evfs_off_t size);
 int evfs_file_sync(EvfsFile *fh);
 evfs_off_t evfs_file_size(EvfsFile *fh);
@@ -440,16 +763,51 @@ bool evfs_file_eof(EvfsFile *fh);
 
 
 // ******************** Directory access methods ********************
+struct GlobPattern;
+
 int evfs_dir_close(EvfsDir *dh);
 int evfs_dir_read(EvfsDir *dh, EvfsInfo *info);
+int evfs_dir_read_many(EvfsDir *dh, EvfsInfo *entries, int max_entries, char *name_buf,
+                       size_t name_buf_size);
 int evfs_dir_rewind(EvfsDir *dh);
 int evfs_dir_find(EvfsDir *dh, const char *pattern, EvfsInfo *info);
+int evfs_dir_find_compiled(EvfsDir *dh, const struct GlobPattern *pattern, EvfsInfo *info);
+
+int evfs_walk_ex(const char *path, const EvfsWalkConfig *cfg, const char *vfs_name);
+static inline int evfs_walk(const char *path, const EvfsWalkConfig *cfg) {
+  return evfs_walk_ex(path, cfg, NULL);
+}
+
+int evfs_copy_tree_ex(const char *src_path, const char *dest_path, const EvfsTreeConfig *cfg,
+                      const char *src_vfs, const char *dest_vfs);
+static inline int evfs_copy_tree(const char *src_path, const char *dest_path, const EvfsTreeConfig *cfg) {
+  return evfs_copy_tree_ex(src_path, dest_path, cfg, NULL, NULL);
+}
+
+int evfs_delete_tree_ex(const char *path, const EvfsTreeConfig *cfg, const char *vfs_name);
+static inline int evfs_delete_tree(const char *path, const EvfsTreeConfig *cfg) {
+  return evfs_delete_tree_ex(path, cfg, NULL);
+}
 
 
 // ******************** String output ********************
+
+// Batches formatted output into one write
+typedef struct EvfsPrintBuf {
+  EvfsFile   *fh;
+  char       *start;
+  AppendRange free;   // Unused part of the buffer
+  int         status; // First write error
+} EvfsPrintBuf;
+
 int evfs_file_printf(EvfsFile *fh, const char *fmt, ...);
+int evfs_file_vprintf(EvfsFile *fh, const char *fmt, va_list args);
 int evfs_file_puts(EvfsFile *fh, const char *str);
 
+void evfs_print_buf_init(EvfsPrintBuf *pb, EvfsFile *fh, char *buf, size_t buf_size);
+int evfs_print_buf_printf(EvfsPrintBuf *pb, const char *fmt, ...);
+int evfs_print_buf_flush(EvfsPrintBuf *pb);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,665 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  C++ binding
+
+  This wraps the C API with move-only File and Dir handles that close
+  themselves. I/O takes spans or any contiguous container of trivially
+  copyable elements. Paths are passed through without copying when they are
+  already NUL terminated.
+
+  VfsAdapter, FileAdapter, and DirAdapter generate the C method tables for
+  backends and shims written as C++ classes. Backends derive from VfsBase,
+  FileBase, and DirBase with CRTP. Methods they don't define fall back to the
+  library defaults. Dispatch is a direct call from the generated trampoline
+  so there is no virtual call overhead in each layer.
+
+  Requires C++17. Spans use std::span with C++20 and a minimal substitute
+  otherwise. Errors are reported with the EVFS status codes.
+------------------------------------------------------------------------------
+*/
+
+#ifndef EVFS_HPP
+#define EVFS_HPP
+
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <new>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#if __cplusplus >= 202002L && __has_include(<span>)
+#  include <span>
+#endif
+
+#include "evfs.h"
+
+
+namespace evfs {
+
+// ******************** Spans ********************
+
+#if defined __cpp_lib_span
+template<class T>
+using Span = std::span<T>;
+
+#else
+// Subset of std::span for C++17
+template<class T>
+class Span {
+public:
+  constexpr Span() noexcept = default;
+  constexpr Span(T *data, size_t size) noexcept : m_data(data), m_size(size) {}
+
+  template<size_t N>
+  constexpr Span(T (&arr)[N]) noexcept : m_data(arr), m_size(N) {}
+
+  template<class C, class = decltype(std::data(std::declval<C &>()))>
+  constexpr Span(C &cont) noexcept : m_data(std::data(cont)), m_size(std::size(cont)) {}
+
+  constexpr T *data() const noexcept { return m_data; }
+  constexpr size_t size() const noexcept { return m_size; }
+  constexpr size_t size_bytes() const noexcept { return m_size * sizeof(T); }
+  constexpr bool empty() const noexcept { return m_size == 0; }
+
+  constexpr T *begin() const noexcept { return m_data; }
+  constexpr T *end() const noexcept { return m_data + m_size; }
+
+private:
+  T     *m_data = nullptr;
+  size_t m_size = 0;
+};
+#endif
+
+
+namespace detail {
+
+// Element type of a contiguous container or span
+template<class C>
+using ElementOf = std::remove_reference_t<decltype(*std::data(std::declval<C &>()))>;
+
+template<class C>
+inline void *bytes_of(C &buf) {
+  using T = ElementOf<C>;
+  static_assert(std::is_trivially_copyable_v<T>, "Buffer elements must be trivially copyable");
+  static_assert(!std::is_const_v<T>, "Read buffer is const");
+  return (void *)std::data(buf);
+}
+
+template<class C>
+inline const void *cbytes_of(const C &buf) {
+  static_assert(std::is_trivially_copyable_v<ElementOf<const C>>,
+                "Buffer elements must be trivially copyable");
+  return (const void *)std::data(buf);
+}
+
+template<class C>
+inline size_t size_of(const C &buf) {
+  return std::size(buf) * sizeof(ElementOf<const C>);
+}
+
+} // namespace detail
+
+
+// ******************** Paths ********************
+
+/*
+Path argument for the C API
+
+C strings and std::string are passed through. A std::string_view is copied
+into an internal buffer to add a NUL. Views longer than EVFS_MAX_PATH give a
+NULL c_str() that fails with EVFS_ERR_TOO_LONG.
+*/
+class CPath {
+public:
+  CPath(const char *path) noexcept : m_str(path) {}
+  CPath(const std::string &path) noexcept : m_str(path.c_str()) {}
+
+  CPath(std::string_view path) noexcept {
+    if(path.size() < sizeof(m_buf)) {
+      std::memcpy(m_buf, path.data(), path.size());
+      m_buf[path.size()] = '\0';
+      m_str = m_buf;
+    }
+  }
+
+  CPath(const CPath &) = delete;
+  CPath &operator=(const CPath &) = delete;
+
+  const char *c_str() const noexcept { return m_str; }
+
+private:
+  const char *m_str = nullptr;
+  char m_buf[EVFS_MAX_PATH];
+};
+
+
+inline int stat(const CPath &path, EvfsInfo &info, const char *vfs_name = nullptr) {
+  if(!path.c_str()) return EVFS_ERR_TOO_LONG;
+  return evfs_stat_ex(path.c_str(), &info, vfs_name);
+}
+
+inline bool existing_file(const CPath &path, const char *vfs_name = nullptr) {
+  return path.c_str() && evfs_existing_file_ex(path.c_str(), vfs_name);
+}
+
+inline bool existing_dir(const CPath &path, const char *vfs_name = nullptr) {
+  return path.c_str() && evfs_existing_dir_ex(path.c_str(), vfs_name);
+}
+
+inline int remove(const CPath &path, const char *vfs_name = nullptr) {
+  if(!path.c_str()) return EVFS_ERR_TOO_LONG;
+  return evfs_delete_ex(path.c_str(), vfs_name);
+}
+
+inline int rename(const CPath &old_path, const CPath &new_path, const char *vfs_name = nullptr) {
+  if(!old_path.c_str() || !new_path.c_str()) return EVFS_ERR_TOO_LONG;
+  return evfs_rename_ex(old_path.c_str(), new_path.c_str(), vfs_name);
+}
+
+inline int make_dir(const CPath &path, const char *vfs_name = nullptr) {
+  if(!path.c_str()) return EVFS_ERR_TOO_LONG;
+  return evfs_make_dir_ex(path.c_str(), vfs_name);
+}
+
+inline int make_path(const CPath &path, const char *vfs_name = nullptr) {
+  if(!path.c_str()) return EVFS_ERR_TOO_LONG;
+  return evfs_make_path_ex(path.c_str(), vfs_name);
+}
+
+inline int batch(EvfsBatchOp *ops, size_t num_ops, const char *vfs_name = nullptr) {
+  return evfs_batch_ex(ops, num_ops, vfs_name);
+}
+
+
+// ******************** Files ********************
+
+// Owning handle for an open file
+class File {
+public:
+  File() noexcept = default;
+  explicit File(EvfsFile *fh) noexcept : m_fh(fh) {}
+
+  File(File &&other) noexcept : m_fh(std::exchange(other.m_fh, nullptr)) {}
+
+  File &operator=(File &&other) noexcept {
+    if(this != &other) {
+      close();
+      m_fh = std::exchange(other.m_fh, nullptr);
+    }
+    return *this;
+  }
+
+  File(const File &) = delete;
+  File &operator=(const File &) = delete;
+
+  ~File() { close(); }
+
+
+  int open(const CPath &path, int flags, const char *vfs_name = nullptr) {
+    if(!path.c_str()) return EVFS_ERR_TOO_LONG;
+    close();
+    return evfs_open_ex(path.c_str(), &m_fh, flags, vfs_name);
+  }
+
+  int open(Evfs *vfs, const CPath &path, int flags) {
+    if(!path.c_str()) return EVFS_ERR_TOO_LONG;
+    close();
+    return evfs_vfs_open(vfs, path.c_str(), &m_fh, flags);
+  }
+
+  int close() noexcept {
+    if(!m_fh) return EVFS_OK;
+    return evfs_file_close(std::exchange(m_fh, nullptr));
+  }
+
+  bool is_open() const noexcept { return m_fh != nullptr; }
+  explicit operator bool() const noexcept { return is_open(); }
+
+  EvfsFile *get() const noexcept { return m_fh; }
+  EvfsFile *release() noexcept { return std::exchange(m_fh, nullptr); }
+
+
+  ptrdiff_t read(void *buf, size_t size) { return evfs_file_read(m_fh, buf, size); }
+  ptrdiff_t write(const void *buf, size_t size) { return evfs_file_write(m_fh, buf, size); }
+
+  ptrdiff_t read_at(void *buf, size_t size, evfs_off_t offset) {
+    return evfs_file_read_at(m_fh, buf, size, offset);
+  }
+
+  ptrdiff_t write_at(const void *buf, size_t size, evfs_off_t offset) {
+    return evfs_file_write_at(m_fh, buf, size, offset);
+  }
+
+  // Spans and contiguous containers
+  template<class Buf>
+  ptrdiff_t read(Buf &&buf) { return read(detail::bytes_of(buf), detail::size_of(buf)); }
+
+  template<class Buf>
+  ptrdiff_t write(const Buf &buf) { return write(detail::cbytes_of(buf), detail::size_of(buf)); }
+
+  template<class Buf>
+  ptrdiff_t read_at(Buf &&buf, evfs_off_t offset) {
+    return read_at(detail::bytes_of(buf), detail::size_of(buf), offset);
+  }
+
+  template<class Buf>
+  ptrdiff_t write_at(const Buf &buf, evfs_off_t offset) {
+    return write_at(detail::cbytes_of(buf), detail::size_of(buf), offset);
+  }
+
+  ptrdiff_t write(std::string_view str) { return write(str.data(), str.size()); }
+  ptrdiff_t write(const char *str) { return write(std::string_view(str)); }
+
+
+  int seek(evfs_off_t offset, EvfsSeekDir origin = EVFS_SEEK_TO) {
+    return evfs_file_seek(m_fh, offset, origin);
+  }
+
+  int rewind() { return evfs_file_rewind(m_fh); }
+  evfs_off_t tell() { return evfs_file_tell(m_fh); }
+  evfs_off_t size() { return evfs_file_size(m_fh); }
+  bool eof() { return evfs_file_eof(m_fh); }
+  int truncate(evfs_off_t size) { return evfs_file_truncate(m_fh, size); }
+  int sync() { return evfs_file_sync(m_fh); }
+  int ctrl(int cmd, void *arg) { return evfs_file_ctrl(m_fh, cmd, arg); }
+
+private:
+  EvfsFile *m_fh = nullptr;
+};
+
+
+// ******************** Directories ********************
+
+// Owning handle for an open directory
+class Dir {
+public:
+  Dir() noexcept = default;
+  explicit Dir(EvfsDir *dh) noexcept : m_dh(dh) {}
+
+  Dir(Dir &&other) noexcept : m_dh(std::exchange(other.m_dh, nullptr)),
+                              m_status(other.m_status) {}
+
+  Dir &operator=(Dir &&other) noexcept {
+    if(this != &other) {
+      close();
+      m_dh = std::exchange(other.m_dh, nullptr);
+      m_status = other.m_status;
+    }
+    return *this;
+  }
+
+  Dir(const Dir &) = delete;
+  Dir &operator=(const Dir &) = delete;
+
+  ~Dir() { close(); }
+
+
+  int open(const CPath &path, const char *vfs_name = nullptr) {
+    if(!path.c_str()) return EVFS_ERR_TOO_LONG;
+    close();
+    return m_status = evfs_open_dir_ex(path.c_str(), &m_dh, vfs_name);
+  }
+
+  int open(Evfs *vfs, const CPath &path) {
+    if(!path.c_str()) return EVFS_ERR_TOO_LONG;
+    close();
+    return m_status = evfs_vfs_open_dir(vfs, path.c_str(), &m_dh);
+  }
+
+  int close() noexcept {
+    if(!m_dh) return EVFS_OK;
+    return evfs_dir_close(std::exchange(m_dh, nullptr));
+  }
+
+  bool is_open() const noexcept { return m_dh != nullptr; }
+  explicit operator bool() const noexcept { return is_open(); }
+
+  EvfsDir *get() const noexcept { return m_dh; }
+  EvfsDir *release() noexcept { return std::exchange(m_dh, nullptr); }
+
+  int read(EvfsInfo &info) { return m_status = evfs_dir_read(m_dh, &info); }
+  int rewind() { return m_status = evfs_dir_rewind(m_dh); }
+
+  // Result of the last operation. EVFS_DONE after iterating to the end.
+  int status() const noexcept { return m_status; }
+
+
+  // Input iterator over the remaining entries
+  // The entry name is only valid until the next increment.
+  class iterator {
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type        = EvfsInfo;
+    using difference_type   = ptrdiff_t;
+    using pointer           = const EvfsInfo *;
+    using reference         = const EvfsInfo &;
+
+    iterator() noexcept = default;
+    explicit iterator(Dir *dir) : m_dir(dir) { ++*this; }
+
+    reference operator*() const noexcept { return m_info; }
+    pointer operator->() const noexcept { return &m_info; }
+
+    iterator &operator++() {
+      if(m_dir && m_dir->read(m_info) != EVFS_OK)
+        m_dir = nullptr;
+      return *this;
+    }
+
+    bool operator==(const iterator &other) const noexcept { return m_dir == other.m_dir; }
+    bool operator!=(const iterator &other) const noexcept { return m_dir != other.m_dir; }
+
+  private:
+    Dir     *m_dir = nullptr;
+    EvfsInfo m_info = {};
+  };
+
+  iterator begin() { return m_dh ? iterator(this) : iterator(); }
+  iterator end() noexcept { return iterator(); }
+
+private:
+  EvfsDir *m_dh = nullptr;
+  int      m_status = EVFS_OK;
+};
+
+
+// ******************** Backend adapters ********************
+
+/*
+Backends derive from these with CRTP and hide the methods they implement.
+A method is detected as implemented when the derived class declares it.
+*/
+
+template<class Derived>
+class FileBase : public EvfsFile {
+public:
+  // Required
+  int close() { return EVFS_OK; }
+  ptrdiff_t read(void */*buf*/, size_t /*size*/) { return EVFS_ERR_NO_SUPPORT; }
+  ptrdiff_t write(const void */*buf*/, size_t /*size*/) { return EVFS_ERR_NO_SUPPORT; }
+  int truncate(evfs_off_t /*size*/) { return EVFS_ERR_NO_SUPPORT; }
+  int sync() { return EVFS_OK; }
+  evfs_off_t size() { return 0; }
+  int seek(evfs_off_t /*offset*/, EvfsSeekDir /*origin*/) { return EVFS_ERR_NO_SUPPORT; }
+  evfs_off_t tell() { return 0; }
+  bool eof() { return true; }
+  int ctrl(int /*cmd*/, void */*arg*/) { return EVFS_ERR_NO_SUPPORT; }
+
+  // Optional. The library emulates these when they aren't implemented.
+  ptrdiff_t read_at(void */*buf*/, size_t /*size*/, evfs_off_t /*offset*/) { return EVFS_ERR_NO_SUPPORT; }
+  ptrdiff_t write_at(const void */*buf*/, size_t /*size*/, evfs_off_t /*offset*/) { return EVFS_ERR_NO_SUPPORT; }
+  ptrdiff_t readv(const EvfsIOVec */*iov*/, int /*iovcnt*/) { return EVFS_ERR_NO_SUPPORT; }
+  ptrdiff_t writev(const EvfsIOVec */*iov*/, int /*iovcnt*/) { return EVFS_ERR_NO_SUPPORT; }
+  int map(evfs_off_t /*offset*/, size_t /*size*/, EvfsMapping */*map*/) { return EVFS_ERR_NO_SUPPORT; }
+  int unmap(EvfsMapping */*map*/) { return EVFS_ERR_NO_SUPPORT; }
+  int discard(evfs_off_t /*offset*/, evfs_off_t /*size*/) { return EVFS_ERR_NO_SUPPORT; }
+};
+
+
+template<class Derived>
+class DirBase : public EvfsDir {
+public:
+  int close() { return EVFS_OK; }
+  int read(EvfsInfo */*info*/) { return EVFS_DONE; }
+  int rewind() { return EVFS_ERR_NO_SUPPORT; }
+
+  // Optional
+  int read_many(EvfsInfo */*entries*/, int /*max_entries*/, char */*name_buf*/,
+                size_t /*name_buf_size*/) {
+    return EVFS_ERR_NO_SUPPORT;
+  }
+};
+
+
+/*
+VFS backends supply File and Dir types derived from FileBase and DirBase.
+Use EmptyDir when directories aren't supported.
+*/
+template<class Derived>
+class VfsBase {
+public:
+  // Required
+  int open(const char */*path*/, EvfsFile */*fh*/, int /*flags*/) { return EVFS_ERR_NO_SUPPORT; }
+  int stat(const char */*path*/, EvfsInfo */*info*/) { return EVFS_ERR_NO_SUPPORT; }
+
+  // Optional
+  int remove(const char */*path*/) { return EVFS_ERR_NO_SUPPORT; }
+  int rename(const char */*old_path*/, const char */*new_path*/) { return EVFS_ERR_NO_SUPPORT; }
+  int make_dir(const char */*path*/) { return EVFS_ERR_NO_SUPPORT; }
+  int open_dir(const char */*path*/, EvfsDir */*dh*/) { return EVFS_ERR_NO_SUPPORT; }
+  int get_cur_dir(StringRange */*cur_dir*/) { return EVFS_ERR_NO_SUPPORT; }
+  int set_cur_dir(const char */*path*/) { return EVFS_ERR_NO_SUPPORT; }
+  int ctrl(int /*cmd*/, void */*arg*/) { return EVFS_ERR_NO_SUPPORT; }
+  bool path_root_component(const char */*path*/, StringRange */*root*/) { return false; }
+  int copy(EvfsFile */*dest*/, EvfsFile */*src*/, evfs_off_t /*size*/) { return EVFS_ERR_NO_SUPPORT; }
+  int batch(EvfsBatchOp */*ops*/, size_t /*num_ops*/) { return EVFS_ERR_NO_SUPPORT; }
+};
+
+
+class EmptyDir : public DirBase<EmptyDir> {};
+
+
+// True when Derived declares its own version of a method from Base
+#define EVFS_HPP_OVERRIDES(Derived, Base, method) \
+  (!std::is_same_v<decltype(&Derived::method), decltype(&Base::method)>)
+
+
+// Method table for a FileBase derived type
+template<class F>
+struct FileAdapter {
+  static F *self(EvfsFile *fh) { return static_cast<F *>(fh); }
+
+  static int m_ctrl(EvfsFile *fh, int cmd, void *arg) { return self(fh)->ctrl(cmd, arg); }
+
+  static int m_close(EvfsFile *fh) {
+    int rval = self(fh)->close();
+    self(fh)->~F(); // Memory is owned by the library
+    return rval;
+  }
+
+  static ptrdiff_t m_read(EvfsFile *fh, void *buf, size_t size) { return self(fh)->read(buf, size); }
+  static ptrdiff_t m_write(EvfsFile *fh, const void *buf, size_t size) { return self(fh)->write(buf, size); }
+  static int m_truncate(EvfsFile *fh, evfs_off_t size) { return self(fh)->truncate(size); }
+  static int m_sync(EvfsFile *fh) { return self(fh)->sync(); }
+  static evfs_off_t m_size(EvfsFile *fh) { return self(fh)->size(); }
+  static int m_seek(EvfsFile *fh, evfs_off_t offset, EvfsSeekDir origin) { return self(fh)->seek(offset, origin); }
+  static evfs_off_t m_tell(EvfsFile *fh) { return self(fh)->tell(); }
+  static bool m_eof(EvfsFile *fh) { return self(fh)->eof(); }
+
+  static ptrdiff_t m_read_at(EvfsFile *fh, void *buf, size_t size, evfs_off_t offset) {
+    return self(fh)->read_at(buf, size, offset);
+  }
+  static ptrdiff_t m_write_at(EvfsFile *fh, const void *buf, size_t size, evfs_off_t offset) {
+    return self(fh)->write_at(buf, size, offset);
+  }
+  static ptrdiff_t m_readv(EvfsFile *fh, const EvfsIOVec *iov, int iovcnt) { return self(fh)->readv(iov, iovcnt); }
+  static ptrdiff_t m_writev(EvfsFile *fh, const EvfsIOVec *iov, int iovcnt) { return self(fh)->writev(iov, iovcnt); }
+  static int m_map(EvfsFile *fh, evfs_off_t offset, size_t size, EvfsMapping *map) {
+    return self(fh)->map(offset, size, map);
+  }
+  static int m_unmap(EvfsFile *fh, EvfsMapping *map) { return self(fh)->unmap(map); }
+  static int m_discard(EvfsFile *fh, evfs_off_t offset, evfs_off_t size) { return self(fh)->discard(offset, size); }
+
+  static constexpr EvfsFileMethods make_methods() {
+    using B = FileBase<F>;
+    EvfsFileMethods m = {};
+    m.m_ctrl     = m_ctrl;
+    m.m_close    = m_close;
+    m.m_read     = m_read;
+    m.m_write    = m_write;
+    m.m_truncate = m_truncate;
+    m.m_sync     = m_sync;
+    m.m_size     = m_size;
+    m.m_seek     = m_seek;
+    m.m_tell     = m_tell;
+    m.m_eof      = m_eof;
+
+    // Leave unimplemented optional methods NULL so the library emulates them
+    if constexpr(EVFS_HPP_OVERRIDES(F, B, read_at))  m.m_read_at  = m_read_at;
+    if constexpr(EVFS_HPP_OVERRIDES(F, B, write_at)) m.m_write_at = m_write_at;
+    if constexpr(EVFS_HPP_OVERRIDES(F, B, readv))    m.m_readv    = m_readv;
+    if constexpr(EVFS_HPP_OVERRIDES(F, B, writev))   m.m_writev   = m_writev;
+    if constexpr(EVFS_HPP_OVERRIDES(F, B, map))      m.m_map      = m_map;
+    if constexpr(EVFS_HPP_OVERRIDES(F, B, unmap))    m.m_unmap    = m_unmap;
+    if constexpr(EVFS_HPP_OVERRIDES(F, B, discard))  m.m_discard  = m_discard;
+    return m;
+  }
+
+  static constexpr EvfsFileMethods methods = make_methods();
+};
+
+
+// Method table for a DirBase derived type
+template<class D>
+struct DirAdapter {
+  static D *self(EvfsDir *dh) { return static_cast<D *>(dh); }
+
+  static int m_close(EvfsDir *dh) {
+    int rval = self(dh)->close();
+    self(dh)->~D();
+    return rval;
+  }
+
+  static int m_read(EvfsDir *dh, EvfsInfo *info) { return self(dh)->read(info); }
+  static int m_rewind(EvfsDir *dh) { return self(dh)->rewind(); }
+  static int m_read_many(EvfsDir *dh, EvfsInfo *entries, int max_entries, char *name_buf,
+                         size_t name_buf_size) {
+    return self(dh)->read_many(entries, max_entries, name_buf, name_buf_size);
+  }
+
+  static constexpr EvfsDirMethods make_methods() {
+    EvfsDirMethods m = {};
+    m.m_close  = m_close;
+    m.m_read   = m_read;
+    m.m_rewind = m_rewind;
+    if constexpr(EVFS_HPP_OVERRIDES(D, DirBase<D>, read_many)) m.m_read_many = m_read_many;
+    return m;
+  }
+
+  static constexpr EvfsDirMethods methods = make_methods();
+};
+
+
+/*
+Generate the Evfs method table for a VfsBase derived backend
+
+The backend object is the fs_data. File and directory objects are
+constructed in the handles allocated by the library and destroyed when they
+are closed. Shims are backends that forward to another Evfs.
+
+  MyFs fs;
+  Evfs vfs = VfsAdapter<MyFs>::make_vfs("myfs", &fs);
+  evfs_register(&vfs, false);
+
+The Evfs object is owned by the caller and isn't freed when unregistered.
+*/
+template<class V>
+struct VfsAdapter {
+  using File = typename V::File;
+  using Dir  = typename V::Dir;
+  using B    = VfsBase<V>;
+
+  static V *self(Evfs *vfs) { return static_cast<V *>(vfs->fs_data); }
+
+  static int m_open(Evfs *vfs, const char *path, EvfsFile *fh, int flags) {
+    EvfsFile hdr = *fh;  // Fields the library set before m_open()
+    File *fil = new(fh) File();
+    static_cast<EvfsFile &>(*fil) = hdr;
+    fil->methods = &FileAdapter<File>::methods;
+
+    int rval = self(vfs)->open(path, fil, flags);
+    if(rval != EVFS_OK)
+      fil->~File();
+    return rval;
+  }
+
+  static int m_stat(Evfs *vfs, const char *path, EvfsInfo *info) { return self(vfs)->stat(path, info); }
+  static int m_delete(Evfs *vfs, const char *path) { return self(vfs)->remove(path); }
+  static int m_rename(Evfs *vfs, const char *old_path, const char *new_path) {
+    return self(vfs)->rename(old_path, new_path);
+  }
+  static int m_make_dir(Evfs *vfs, const char *path) { return self(vfs)->make_dir(path); }
+
+  static int m_open_dir(Evfs *vfs, const char *path, EvfsDir *dh) {
+    Dir *dir = new(dh) Dir();
+    dir->methods = &DirAdapter<Dir>::methods;
+
+    int rval = self(vfs)->open_dir(path, dir);
+    if(rval != EVFS_OK)
+      dir->~Dir();
+    return rval;
+  }
+
+  static int m_get_cur_dir(Evfs *vfs, StringRange *cur_dir) { return self(vfs)->get_cur_dir(cur_dir); }
+  static int m_set_cur_dir(Evfs *vfs, const char *path) { return self(vfs)->set_cur_dir(path); }
+  static int m_vfs_ctrl(Evfs *vfs, int cmd, void *arg) { return self(vfs)->ctrl(cmd, arg); }
+  static bool m_path_root_component(Evfs *vfs, const char *path, StringRange *root) {
+    return self(vfs)->path_root_component(path, root);
+  }
+  static int m_copy(Evfs *vfs, EvfsFile *dest, EvfsFile *src, evfs_off_t size) {
+    return self(vfs)->copy(dest, src, size);
+  }
+  static int m_batch(Evfs *vfs, EvfsBatchOp *ops, size_t num_ops) {
+    return self(vfs)->batch(ops, num_ops);
+  }
+
+  // Methods not implemented by V use the library defaults
+  static constexpr Evfs make_vfs(const char *vfs_name = nullptr, V *backend = nullptr) {
+    static_assert(std::is_base_of_v<FileBase<File>, File>, "File must derive from FileBase");
+    static_assert(std::is_base_of_v<DirBase<Dir>, Dir>, "Dir must derive from DirBase");
+    static_assert(EVFS_HPP_OVERRIDES(V, B, open) && EVFS_HPP_OVERRIDES(V, B, stat),
+                  "Backends must implement open() and stat()");
+
+    Evfs vfs = {};
+    vfs.vfs_name      = vfs_name;
+    vfs.vfs_file_size = sizeof(File);
+    vfs.vfs_dir_size  = sizeof(Dir);
+    vfs.fs_data       = backend;
+
+    vfs.m_open = m_open;
+    vfs.m_stat = m_stat;
+
+    vfs.m_delete = evfs_default_delete;
+    vfs.m_rename = evfs_default_rename;
+    vfs.m_make_dir = evfs_default_make_dir;
+    vfs.m_open_dir = evfs_default_open_dir;
+    vfs.m_get_cur_dir = evfs_default_get_cur_dir;
+    vfs.m_set_cur_dir = evfs_default_set_cur_dir;
+    vfs.m_vfs_ctrl = evfs_default_vfs_ctrl;
+    vfs.m_path_root_component = evfs_default_path_root_component;
+    vfs.m_copy = evfs_default_copy;
+    vfs.m_batch = evfs_default_batch;
+
+    if constexpr(EVFS_HPP_OVERRIDES(V, B, remove))      vfs.m_delete = m_delete;
+    if constexpr(EVFS_HPP_OVERRIDES(V, B, rename))      vfs.m_rename = m_rename;
+    if constexpr(EVFS_HPP_OVERRIDES(V, B, make_dir))    vfs.m_make_dir = m_make_dir;
+    if constexpr(EVFS_HPP_OVERRIDES(V, B, open_dir))    vfs.m_open_dir = m_open_dir;
+    if constexpr(EVFS_HPP_OVERRIDES(V, B, get_cur_dir)) vfs.m_get_cur_dir = m_get_cur_dir;
+    if constexpr(EVFS_HPP_OVERRIDES(V, B, set_cur_dir)) vfs.m_set_cur_dir = m_set_cur_dir;
+    if constexpr(EVFS_HPP_OVERRIDES(V, B, ctrl))        vfs.m_vfs_ctrl = m_vfs_ctrl;
+    if constexpr(EVFS_HPP_OVERRIDES(V, B, path_root_component))
+      vfs.m_path_root_component = m_path_root_component;
+    if constexpr(EVFS_HPP_OVERRIDES(V, B, copy))        vfs.m_copy = m_copy;
+    if constexpr(EVFS_HPP_OVERRIDES(V, B, batch))       vfs.m_batch = m_batch;
+
+    return vfs;
+  }
+};
+
+#undef EVFS_HPP_OVERRIDES
+
+} // namespace evfs
+
+#endif // EVFS_HPP
@@ -0,0 +1,83 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Asynchronous I/O queue
+
+  Reads and writes are submitted to a queue and their results are collected
+  later from its completion list. Operations run on a pool of worker threads
+  using the synchronous file methods. A VFS can attach a native engine that
+  handles operations on its own files without using the pool.
+------------------------------------------------------------------------------
+*/
+
+#ifndef ASYNC_IO_H
+#define ASYNC_IO_H
+
+typedef struct EvfsAsyncQueue EvfsAsyncQueue;
+
+// Result of a finished operation returned by evfs_async_reap()
+typedef struct EvfsCompletion {
+  EvfsFile  *fh;
+  void      *user_data;
+  ptrdiff_t  result;      // Bytes transferred or negative error code
+} EvfsCompletion;
+
+
+#define EVFS_ASYNC_READ   0
+#define EVFS_ASYNC_WRITE  1
+
+// Operation in flight. Owned by the queue.
+typedef struct EvfsAsyncOp {
+  struct EvfsAsyncOp *next;
+  EvfsAsyncQueue *queue;
+  EvfsFile   *fh;
+  void       *buf;
+  size_t      size;
+  evfs_off_t  offset;
+  void       *user_data;
+  ptrdiff_t   result;
+  int         kind;       // EVFS_ASYNC_READ or EVFS_ASYNC_WRITE
+} EvfsAsyncOp;
+
+
+// Interface for native async engines
+typedef struct EvfsAsyncEngine {
+  // Start an operation and call evfs_async_complete() when it finishes.
+  // Return EVFS_ERR_NO_SUPPORT to run the operation on the thread pool.
+  int   (*m_submit)(struct EvfsAsyncEngine *engine, EvfsAsyncOp *op);
+
+  // Wait for all outstanding operations to complete and release the engine
+  void  (*m_free)(struct EvfsAsyncEngine *engine);
+} EvfsAsyncEngine;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int evfs_async_new(unsigned depth, unsigned num_threads, EvfsAsyncQueue **queue);
+int evfs_async_free(EvfsAsyncQueue *queue);
+int evfs_async_set_engine(EvfsAsyncQueue *queue, EvfsAsyncEngine *engine);
+
+int evfs_file_submit_read(EvfsAsyncQueue *queue, EvfsFile *fh, void *buf, size_t size,
+                          evfs_off_t offset, void *user_data);
+int evfs_file_submit_write(EvfsAsyncQueue *queue, EvfsFile *fh, const void *buf, size_t size,
+                           evfs_off_t offset, void *user_data);
+int evfs_async_reap(EvfsAsyncQueue *queue, EvfsCompletion *events, int max_events, bool wait);
+
+// For use by engines
+void evfs_async_complete(EvfsAsyncOp *op, ptrdiff_t result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ASYNC_IO_H
@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2021 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Evpak archive format
+
+  An evpak image is laid out so that it can be used in place from memory
+  without building an index at mount. All integers are little-endian and all
+  offsets are from the start of the image.
+
+    Header      Fixed size with a CRC32C over its other fields
+    Entries     One record per file or directory. Entry 0 is the root.
+    Hash table  Power of 2 buckets of entry indices + 1 (0 is empty)
+    Children    Entry indices for each directory, sorted by name
+    Names       NUL terminated paths relative to the root without a leading "/"
+    Data        File payloads aligned to 1 << align_bits
+
+  Everything before data_off is metadata. Paths are found by hashing them
+  with FNV-1a and probing the hash table linearly. Directories list their
+  children as a range in the children table.
+------------------------------------------------------------------------------
+*/
+
+#ifndef EVPAK_COMMON_H
+#define EVPAK_COMMON_H
+
+#define EVPAK_MAGIC           "EVPAK\0"
+#define EVPAK_MAGIC_LEN       6
+#define EVPAK_VERSION         1
+
+#define EVPAK_HEADER_SIZE     64
+#define EVPAK_ENTRY_SIZE      24
+
+// Header field offsets
+#define EVPAK_HDR_MAGIC         0
+#define EVPAK_HDR_VERSION       6   // u16
+#define EVPAK_HDR_HEADER_SIZE   8
+#define EVPAK_HDR_FLAGS         12
+#define EVPAK_HDR_IMAGE_SIZE    16
+#define EVPAK_HDR_NUM_ENTRIES   20
+#define EVPAK_HDR_ENTRIES_OFF   24
+#define EVPAK_HDR_HASH_OFF      28
+#define EVPAK_HDR_HASH_BITS     32
+#define EVPAK_HDR_CHILDREN_OFF  36
+#define EVPAK_HDR_NUM_CHILDREN  40
+#define EVPAK_HDR_NAMES_OFF     44
+#define EVPAK_HDR_NAMES_SIZE    48
+#define EVPAK_HDR_DATA_OFF      52
+#define EVPAK_HDR_ALIGN_BITS    56
+#define EVPAK_HDR_CRC           60  // CRC32C of the preceding bytes
+
+// Entry field offsets
+#define EVPAK_ENT_PATH_OFF      0   // Offset of path in names
+#define EVPAK_ENT_PATH_LEN      4   // u16
+#define EVPAK_ENT_NAME_POS      6   // u16 Start of the base name in the path
+#define EVPAK_ENT_FLAGS         8
+#define EVPAK_ENT_OFFSET        12  // Data offset or first child index of directories
+#define EVPAK_ENT_SIZE          16  // Data size or number of children of directories
+#define EVPAK_ENT_MTIME         20  // Seconds since the epoch. 0 if unknown.
+
+// Entry flags
+#define EVPAK_FLAG_DIR          0x01
+
+#define EVPAK_MAX_HASH_BITS     30
+
+
+// FNV-1a hash of a path
+static inline uint32_t evpak_hash(const char *path, size_t len) {
+  uint32_t hash = 2166136261u;
+  for(size_t i = 0; i < len; i++) {
+    hash ^= (uint8_t)path[i];
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+#endif // EVPAK_COMMON_H
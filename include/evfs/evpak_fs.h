@@ -0,0 +1,33 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2021 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Evpak VFS
+  A read-only VFS for evpak archives. Images are used in place with no index
+  built at mount.
+------------------------------------------------------------------------------
+*/
+
+#ifndef EVPAK_FS_H
+#define EVPAK_FS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int evfs_register_evpak(const char *vfs_name, EvfsFile *image, bool default_vfs);
+int evfs_register_rsrc_evpak(const char *vfs_name, const uint8_t *resource, size_t resource_len,
+                             bool default_vfs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // EVPAK_FS_H
@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2021 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Evpak image builder
+  Create evpak archives from a directory tree on any VFS.
+------------------------------------------------------------------------------
+*/
+
+#ifndef EVPAK_IMAGE_H
+#define EVPAK_IMAGE_H
+
+typedef struct EvpakBuildConfig {
+  size_t      data_align;   // Alignment of file data in the image. Power of 2. 0 for 4096 bytes.
+  const char *src_vfs;      // VFS for the source tree. Use default VFS if NULL
+} EvpakBuildConfig;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int evpak_build_image(const char *src_dir, EvfsFile *image, const EvpakBuildConfig *cfg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // EVPAK_IMAGE_H
@@ -17,12 +17,24 @@ Embedded Virtual Filesystem
 #ifndef FATFS_FS_H
 #define FATFS_FS_H
 
+// disk_ioctl() commands sent around an evfs_batch() on a FatFs volume.
+// Drivers can hold back CTRL_SYNC until the batch ends to commit it once.
+// Drivers that don't support them should return RES_PARERR.
+#define EVFS_FATFS_CTRL_BATCH_BEGIN   200
+#define EVFS_FATFS_CTRL_BATCH_END     201
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 int evfs_register_fatfs(const char *vfs_name, uint8_t pdrv, bool default_vfs);
 
+// VFS objects from EVFS_FATFS_STATIC_LIST for evfs_register_static()
+#ifdef EVFS_FATFS_STATIC_LIST
+#  define EVFS_FATFS_STATIC_DECL(id, name, drv)  extern Evfs evfs_fatfs_##id;
+EVFS_FATFS_STATIC_LIST(EVFS_FATFS_STATIC_DECL)
+#endif
+
 #ifdef __cplusplus
 }
 #endif
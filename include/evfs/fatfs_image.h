@@ -17,9 +17,13 @@ Embedded Virtual Filesystem
 #ifndef FATFS_IMAGE_H
 #define FATFS_IMAGE_H
 
+#include "evfs/image_cache.h"
+
 typedef struct FatfsImage_s {
   EvfsFile *fh; // Opened file handle for lfs image
   FATFS fs;
+  unsigned cache_sectors;   // Sectors to cache. Set with fatfs_image_set_cache()
+  EvfsImageCache cache;
 } FatfsImage;
 
 #ifdef __cplusplus
@@ -29,6 +33,8 @@ extern "C" {
 int fatfs_make_image(const char *img_path, uint8_t pdrv, evfs_off_t img_size);
 int fatfs_mount_image(const char *img_path, uint8_t pdrv);
 void fatfs_unmount_image(uint8_t pdrv);
+int fatfs_image_set_cache(uint8_t pdrv, unsigned cache_sectors);
+int fatfs_image_cache_stats(uint8_t pdrv, EvfsCacheStats *stats);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2021 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Gzip file
+  Seekable read only view of gzip compressed data. Random access is supported
+  by a checkpoint index of decompressor state. Requires zlib.
+------------------------------------------------------------------------------
+*/
+
+#ifndef GZIP_FILE_H
+#define GZIP_FILE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int evfs_open_gzip_file(EvfsFile *gz_file, EvfsFile **fh, size_t checkpoint_span);
+int evfs_register_tar_gz_fs(const char *vfs_name, EvfsFile *gz_file, bool default_vfs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // GZIP_FILE_H
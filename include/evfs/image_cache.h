@@ -0,0 +1,67 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Write-back block cache for filesystem images hosted on another filesystem
+  Caches can have private storage or share a global memory budget.
+------------------------------------------------------------------------------
+*/
+
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+
+// Counters for cache activity
+typedef struct EvfsCacheStats {
+  size_t hits;        // Block accesses served from the cache
+  size_t misses;      // Block accesses that needed a read from the image
+  size_t writebacks;  // Dirty blocks written to the image
+  size_t bypasses;    // Large transfers sent straight to the image
+  size_t cached_bytes; // Memory held by cached blocks
+} EvfsCacheStats;
+
+// Pass as num_blocks to evfs_image_cache_init() to use the shared cache
+#define EVFS_CACHE_SHARED   (~0u)
+
+typedef struct EvfsCacheBlock EvfsCacheBlock;
+typedef struct EvfsSharedBlock EvfsSharedBlock;
+
+typedef struct EvfsImageCache {
+  EvfsFile       *fh;           // Image file
+  size_t          block_size;
+  unsigned        num_blocks;
+  EvfsCacheBlock *blocks;
+  uint8_t        *data;         // Storage for all blocks
+  unsigned        use_count;    // Clock for LRU tracking
+  EvfsCacheStats  stats;
+  bool            shared;       // Blocks are held in the shared cache
+  EvfsSharedBlock *shared_blocks; // Blocks owned in the shared cache
+} EvfsImageCache;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int evfs_image_cache_init(EvfsImageCache *cache, EvfsFile *fh, size_t block_size, unsigned num_blocks);
+int evfs_image_cache_free(EvfsImageCache *cache);
+ptrdiff_t evfs_image_cache_read(EvfsImageCache *cache, evfs_off_t offset, void *buf, size_t size);
+ptrdiff_t evfs_image_cache_write(EvfsImageCache *cache, evfs_off_t offset, const void *buf, size_t size);
+int evfs_image_cache_sync(EvfsImageCache *cache);
+int evfs_image_cache_discard(EvfsImageCache *cache, evfs_off_t offset, evfs_off_t size);
+
+int evfs_shared_cache_init(size_t budget);
+int evfs_shared_cache_free(void);
+int evfs_shared_cache_sync(void);
+int evfs_shared_cache_stats(EvfsCacheStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IMAGE_CACHE_H
@@ -23,6 +23,12 @@ extern "C" {
 
 int evfs_register_littlefs(const char *vfs_name, lfs_t *lfs, bool default_vfs);
 
+// VFS objects from EVFS_LITTLEFS_STATIC_LIST for evfs_register_static()
+#ifdef EVFS_LITTLEFS_STATIC_LIST
+#  define EVFS_LITTLEFS_STATIC_DECL(id, name, lfs_obj)  extern Evfs evfs_littlefs_##id;
+EVFS_LITTLEFS_STATIC_LIST(EVFS_LITTLEFS_STATIC_DECL)
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -18,8 +18,20 @@ Embedded Virtual Filesystem
 #ifndef LITTLEFS_IMAGE_H
 #define LITTLEFS_IMAGE_H
 
+#include "evfs/image_cache.h"
+
 typedef struct LittlefsImage_s {
   EvfsFile *fh; // Opened file handle for lfs image
+  unsigned cache_lines;   // Number of cfg->cache_size lines to cache. 0 to disable
+                          // Use EVFS_CACHE_SHARED for the shared cache
+  bool block_buffer;      // Buffer one block so the image sees block sized I/O
+  EvfsImageCache cache;
+
+  // Block buffer state
+  uint8_t    *buf;
+  lfs_block_t buf_block;
+  bool        buf_valid;
+  bool        buf_dirty;
 } LittlefsImage;
 
 #ifdef __cplusplus
@@ -0,0 +1,38 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  POSIX VFS
+  A VFS wrapper for POSIX file descriptors.
+------------------------------------------------------------------------------
+*/
+
+#ifndef POSIX_FS_H
+#define POSIX_FS_H
+
+typedef struct PosixConfig {
+  // Open files with O_DIRECT. Transfers with a buffer, size, and offset aligned
+  // to direct_align bypass the page cache. Others use a normal descriptor.
+  bool      direct_io;
+  uint32_t  direct_align;   // Power of 2. 0 for the default of 4096
+  unsigned  advice;         // Hint applied to every opened file. EVFS_ADVICE_*
+} PosixConfig;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int evfs_register_posix(PosixConfig *cfg, bool default_vfs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // POSIX_FS_H
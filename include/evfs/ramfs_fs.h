@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  RAM FS VFS
+  A writable filesystem kept entirely in memory
+------------------------------------------------------------------------------
+*/
+
+#ifndef RAMFS_FS_H
+#define RAMFS_FS_H
+
+typedef struct RamfsConfig {
+  size_t  chunk_size;   // Bytes of file data per chunk. 0 for a default size
+  size_t  max_size;     // Limit on file data in bytes. 0 for no limit
+  const EvfsAllocator *alloc; // Allocator for nodes and file data. NULL for the class allocators
+} RamfsConfig;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int evfs_register_ramfs(const char *vfs_name, const RamfsConfig *cfg, bool default_vfs);
+
+int evfs_ramfs_load(const char *vfs_name, const char *src_dir, const char *src_vfs);
+int evfs_ramfs_save(const char *vfs_name, const char *dest_dir, const char *dest_vfs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RAMFS_FS_H
@@ -37,15 +37,47 @@ typedef struct RomfsFileHead {
 
 
 
+// The lazy index is grown as paths are resolved so it needs an updatable hash
+#if defined EVFS_USE_ROMFS_FAST_INDEX && defined EVFS_USE_ROMFS_LAZY_INDEX && \
+    !defined EVFS_USE_PERFECT_HASH_INDEX
+#  define ROMFS_USE_LAZY_INDEX
+#endif
+
+
 #ifdef EVFS_USE_ROMFS_FAST_INDEX
+struct RomfsKeyChunk;
+
 typedef struct RomfsIndex {
+#  ifdef EVFS_USE_PERFECT_HASH_INDEX
+  mphash hash_table; // Immutable index of hashed key/value pairs
+#  else
   dhash hash_table; // Manages index of hashed key/value pairs
+#  endif
 
   // Storage for file path keys
   char *keys;
+  const EvfsAllocator *keys_alloc;
+  size_t num_keys;      // Entries in the index
+  size_t keys_size;     // Bytes used for keys
+  bool   static_storage; // Buckets and keys are caller owned
+
+#  ifdef ROMFS_USE_LAZY_INDEX
+  struct RomfsKeyChunk *key_chunks; // Keys added as directories are indexed
+#    ifdef EVFS_USE_THREADING
+  EvfsRwLock index_lock;
+#    endif
+#  endif
 } RomfsIndex;
 #endif
 
+#if EVFS_ROMFS_HEADER_CACHE_SIZE > 0
+// Decoded header from a previous read
+typedef struct RomfsHeaderCacheEntry {
+  evfs_off_t    pos; // Image offset of header. 0 when unused.
+  RomfsFileHead hdr;
+} RomfsHeaderCacheEntry;
+#endif
+
 struct Romfs;
 
 typedef ptrdiff_t (*ReadMethod)(struct Romfs *fs, evfs_off_t offset, void *buf, size_t size);
@@ -62,6 +94,8 @@ typedef struct RomfsConfig {
 
   ReadMethod    read_data;
   UnmountMethod unmount;
+
+  const EvfsIndexStorage *index_storage; // Optional caller owned index buffers
 } RomfsConfig;
 
 
@@ -77,6 +111,17 @@ typedef struct Romfs {
   ReadMethod      read_data;
   UnmountMethod   unmount;
   LookupMethod    lookup_abs_path;
+
+#if EVFS_ROMFS_HEADER_CACHE_SIZE > 0
+  RomfsHeaderCacheEntry hdr_cache[EVFS_ROMFS_HEADER_CACHE_SIZE];
+#  ifdef EVFS_USE_THREADING
+  EvfsLock hdr_cache_lock;
+#  endif
+#endif
+
+#ifdef EVFS_USE_ROMFS_TRUSTED_HEADERS
+  bool trusted; // All headers were verified at mount
+#endif
 } Romfs;
 
 
@@ -23,6 +23,12 @@ extern "C" {
 
 int evfs_register_romfs(const char *vfs_name, EvfsFile *image, bool default_vfs);
 int evfs_register_rsrc_romfs(const char *vfs_name, const uint8_t *resource, size_t resource_len, bool default_vfs);
+int evfs_register_rsrc_romfs_static(const char *vfs_name, const uint8_t *resource, size_t resource_len,
+                                    const EvfsIndexStorage *storage, bool default_vfs);
+int evfs_romfs_rsrc_index_size(const uint8_t *resource, size_t resource_len, EvfsIndexStorage *storage);
+
+int evfs_remount_romfs(const char *vfs_name, EvfsFile *image);
+int evfs_remount_rsrc_romfs(const char *vfs_name, const uint8_t *resource, size_t resource_len);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2021 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Romfs image builder
+  Create Romfs images from a directory tree on any VFS. Directory entries are
+  sorted by name and file data can be aligned beyond the 16-byte minimum.
+------------------------------------------------------------------------------
+*/
+
+#ifndef ROMFS_IMAGE_H
+#define ROMFS_IMAGE_H
+
+typedef struct RomfsBuildConfig {
+  const char *volume_name;  // Name in the superblock. Defaults to "evfs" if NULL
+  size_t      data_align;   // Alignment of file data in the image. Power of 2. 0 for 16 bytes.
+  const char *src_vfs;      // VFS for the source tree. Use default VFS if NULL
+} RomfsBuildConfig;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int romfs_build_image(const char *src_dir, EvfsFile *image, const RomfsBuildConfig *cfg);
+int romfs_image_to_c_array(EvfsFile *image, EvfsFile *c_file, const char *array_name, size_t align);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ROMFS_IMAGE_H
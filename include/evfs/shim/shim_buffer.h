@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Buffer shim VFS
+
+  This adds a buffer to each open file of an underlying VFS. Small sequential
+  writes are combined into larger writes and sequential reads are served from
+  a read-ahead buffer that grows as long as the access pattern stays
+  sequential.
+------------------------------------------------------------------------------
+*/
+
+#ifndef SHIM_BUFFER_H
+#define SHIM_BUFFER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int evfs_register_buffer(const char *vfs_name, const char *old_vfs_name, size_t buf_size, bool default_vfs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SHIM_BUFFER_H
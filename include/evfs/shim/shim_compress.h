@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Compression shim VFS
+
+  This stores files on an underlying VFS as a sequence of independently
+  compressed blocks followed by an index of their sizes. Reads only
+  decompress the blocks they touch so files stay randomly accessible.
+------------------------------------------------------------------------------
+*/
+
+#ifndef SHIM_COMPRESS_H
+#define SHIM_COMPRESS_H
+
+// Block codec used by the shim
+typedef struct CompressCodec {
+  size_t    work_size;  // Bytes of scratch memory passed to compress()
+
+  // Return the compressed size or 0 if the result doesn't fit in dest_size
+  size_t    (*compress)(const uint8_t *src, size_t src_len, uint8_t *dest, size_t dest_size,
+                        void *work);
+  // Return the decompressed size or a negative value for corrupt data
+  ptrdiff_t (*decompress)(const uint8_t *src, size_t src_len, uint8_t *dest, size_t dest_size);
+} CompressCodec;
+
+typedef struct CompressConfig {
+  size_t    block_size;         // Uncompressed bytes per block. 0 for a default size
+  const CompressCodec *codec;   // NULL for the built in LZ4 codec. Must stay valid while registered.
+} CompressConfig;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int evfs_register_compress(const char *vfs_name, const char *old_vfs_name, CompressConfig *cfg,
+                           bool default_vfs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SHIM_COMPRESS_H
@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Deduplication shim VFS
+
+  This splits file data into content-defined chunks that are kept once in a
+  chunk store on the underlying VFS. Files are stored as manifests listing
+  their chunks so nearly identical files share most of their storage.
+------------------------------------------------------------------------------
+*/
+
+#ifndef SHIM_DEDUP_H
+#define SHIM_DEDUP_H
+
+typedef struct DedupConfig {
+  const char *store_path;   // Directory on the base VFS for the chunk store
+  size_t      avg_chunk;    // Target chunk size. Rounded down to a power of 2. 0 for a default size
+  size_t      min_chunk;    // 0 for avg_chunk / 4
+  size_t      max_chunk;    // 0 for avg_chunk * 4
+  size_t      cache_chunks; // Chunks kept in the shared read cache. 0 for a default count
+} DedupConfig;
+
+// Counters from EVFS_CMD_GET_DEDUP_STATS
+typedef struct DedupStats {
+  uint64_t  chunks_stored;    // New chunks added to the store
+  uint64_t  chunks_shared;    // Chunks that were already in the store
+  uint64_t  bytes_stored;
+  uint64_t  bytes_shared;     // File data that didn't need to be stored
+  uint64_t  cache_hits;
+  uint64_t  cache_misses;
+} DedupStats;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int evfs_register_dedup(const char *vfs_name, const char *old_vfs_name, DedupConfig *cfg,
+                        bool default_vfs);
+int evfs_dedup_collect(const char *vfs_name, const char *root, size_t *collected);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SHIM_DEDUP_H
@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Integrity shim VFS
+
+  This keeps a CRC32C for each block of a file in a sidecar file and verifies
+  data as it is read. Blocks that don't match their checksum are reported as
+  EVFS_ERR_CORRUPTION.
+------------------------------------------------------------------------------
+*/
+
+#ifndef SHIM_INTEGRITY_H
+#define SHIM_INTEGRITY_H
+
+// Suffix added to a file name for its checksum sidecar
+#define EVFS_INTEGRITY_SUFFIX  ".crc"
+
+typedef struct IntegrityConfig {
+  size_t  block_size;         // Bytes covered by each checksum. 0 for a default size
+  bool    require_checksums;  // Files without a sidecar can't be opened for reading
+} IntegrityConfig;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int evfs_register_integrity(const char *vfs_name, const char *old_vfs_name, IntegrityConfig *cfg,
+                            bool default_vfs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SHIM_INTEGRITY_H
@@ -0,0 +1,42 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Journal shim VFS
+
+  This appends small writes to a log file instead of updating files in place.
+  Logged writes are checkpointed into their files in batches and the log is
+  replayed when the shim is registered. Writes grouped in a transaction are
+  applied together or not at all after a crash.
+------------------------------------------------------------------------------
+*/
+
+#ifndef SHIM_JOURNAL_H
+#define SHIM_JOURNAL_H
+
+typedef struct JournalConfig {
+  uint32_t  checkpoint_size;  // Log size that triggers a checkpoint. 0 for a default size
+  uint32_t  max_record;       // Largest write that is logged outside a transaction. 0 for a default size
+  bool      no_sync;          // Don't sync the log after each commit
+} JournalConfig;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int evfs_register_journal(const char *vfs_name, const char *old_vfs_name, const char *log_path,
+                          JournalConfig *cfg, bool default_vfs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SHIM_JOURNAL_H
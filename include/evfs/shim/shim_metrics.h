@@ -0,0 +1,95 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Metrics shim VFS
+
+  This counts calls, errors, and transferred bytes for each method of the
+  underlying VFS and keeps a histogram of their latencies. Nothing is
+  formatted or allocated while the counters are updated so it can stay
+  installed in production builds.
+------------------------------------------------------------------------------
+*/
+
+#ifndef SHIM_METRICS_H
+#define SHIM_METRICS_H
+
+// Methods with their own counters
+#define EVFS_METRIC_LIST(M) \
+  M(EVFS_METRIC_OPEN,          "m_open") \
+  M(EVFS_METRIC_STAT,          "m_stat") \
+  M(EVFS_METRIC_DELETE,        "m_delete") \
+  M(EVFS_METRIC_RENAME,        "m_rename") \
+  M(EVFS_METRIC_MAKE_DIR,      "m_make_dir") \
+  M(EVFS_METRIC_OPEN_DIR,      "m_open_dir") \
+  M(EVFS_METRIC_SET_CUR_DIR,   "m_set_cur_dir") \
+  M(EVFS_METRIC_CLOSE,         "m_close") \
+  M(EVFS_METRIC_READ,          "m_read") \
+  M(EVFS_METRIC_WRITE,         "m_write") \
+  M(EVFS_METRIC_READ_AT,       "m_read_at") \
+  M(EVFS_METRIC_WRITE_AT,      "m_write_at") \
+  M(EVFS_METRIC_READV,         "m_readv") \
+  M(EVFS_METRIC_WRITEV,        "m_writev") \
+  M(EVFS_METRIC_TRUNCATE,      "m_truncate") \
+  M(EVFS_METRIC_SYNC,          "m_sync") \
+  M(EVFS_METRIC_SIZE,          "m_size") \
+  M(EVFS_METRIC_SEEK,          "m_seek") \
+  M(EVFS_METRIC_DIR_CLOSE,     "m_dir_close") \
+  M(EVFS_METRIC_DIR_READ,      "m_dir_read") \
+  M(EVFS_METRIC_DIR_READ_MANY, "m_dir_read_many")
+
+#define EVFS_METRIC_ENUM_ITEM(E, S)  E,
+
+typedef enum {
+  EVFS_METRIC_LIST(EVFS_METRIC_ENUM_ITEM)
+  EVFS_METRIC_COUNT
+} EvfsMetricId;
+
+
+// Latency histogram bucket i counts calls taking [2^(i-1), 2^i) clock ticks.
+// Bucket 0 is for calls under one tick and the last bucket collects the rest.
+#define EVFS_METRICS_BUCKETS  32
+
+typedef struct EvfsMethodMetrics {
+  uint32_t  calls;
+  uint32_t  errors;   // Calls that returned a negative error code
+  uint64_t  bytes;    // Data transferred by read and write methods
+  uint32_t  latency[EVFS_METRICS_BUCKETS];
+} EvfsMethodMetrics;
+
+// Snapshot returned by EVFS_CMD_GET_METRICS
+typedef struct EvfsMetrics {
+  EvfsMethodMetrics methods[EVFS_METRIC_COUNT];
+  uint64_t  bytes_read;     // Sum over all read methods
+  uint64_t  bytes_written;  // Sum over all write methods
+} EvfsMetrics;
+
+
+// Monotonic time source for latency measurement
+typedef uint64_t (*EvfsMetricsClock)(void);
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int evfs_register_metrics(const char *vfs_name, const char *old_vfs_name, EvfsMetricsClock clock,
+                          bool default_vfs);
+
+int evfs_metrics_snapshot(const char *vfs_name, EvfsMetrics *metrics);
+int evfs_metrics_reset(const char *vfs_name, EvfsMetrics *metrics);
+
+const char *evfs_metric_name(EvfsMetricId id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SHIM_METRICS_H
@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Mirror shim VFS
+
+  This keeps a copy of every file on each member VFS. Changes are made on all
+  members and succeed when a quorum of them complete. Reads are balanced
+  across the members and copies that fall behind are resynced later.
+------------------------------------------------------------------------------
+*/
+
+#ifndef SHIM_MIRROR_H
+#define SHIM_MIRROR_H
+
+// Most member VFSs a mirror shim can span
+#define EVFS_MIRROR_MAX_MEMBERS  8
+
+typedef struct MirrorConfig {
+  unsigned  write_quorum; // Members that must complete a change. 0 for all of them
+  unsigned  io_threads;   // Workers for parallel writes. Needs threading. 0 to disable
+} MirrorConfig;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int evfs_register_mirror(const char *vfs_name, const char **member_vfs_names, unsigned num_members,
+                         MirrorConfig *cfg, bool default_vfs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SHIM_MIRROR_H
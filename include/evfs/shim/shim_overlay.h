@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Overlay shim VFS
+
+  This merges a writable upper VFS over a lower VFS. Lookups check the upper
+  VFS first and fall back to the lower VFS. All changes are made on the upper
+  VFS with lower files copied up when they are opened for writing.
+------------------------------------------------------------------------------
+*/
+
+#ifndef SHIM_OVERLAY_H
+#define SHIM_OVERLAY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int evfs_register_overlay(const char *vfs_name, const char *upper_vfs_name, const char *lower_vfs_name,
+                          size_t cache_entries, bool default_vfs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SHIM_OVERLAY_H
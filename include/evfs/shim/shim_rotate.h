@@ -14,8 +14,26 @@ typedef struct RotateConfig_s {
   // Total capacity = max_chunks * chunk_size
   uint32_t      chunk_size;     // Must be at least MULTIPART_MIN_CHUNK_SIZE (32)
   uint32_t      max_chunks;     // Must be between 2 and MULTIPART_MAX_CHUNK (99999)
+
+  // Options
+  bool          recycle_chunks; // Rename evicted chunks into the next slot instead of delete+create
+
+  // Sync policy
+  // Syncs requested by multiple handles are combined into one sync of the base VFS
+  uint32_t      sync_bytes;     // Sync after this many bytes are written. 0 to disable
+  uint32_t      sync_ms;        // Background sync interval. Needs threading. 0 to disable
+  bool          sync_on_chunk;  // Sync when a chunk is filled
 } RotateConfig;
 
+// Callback for EVFS_CMD_SET_ROTATE_NOTIFY
+// This is called with the container locked. Don't access the container from the callback.
+typedef void (*RotateNotifyCallback)(EvfsFile *fh, evfs_off_t total_size, void *ctx);
+
+typedef struct RotateNotify {
+  RotateNotifyCallback  callback; // NULL to disable
+  void                 *ctx;
+} RotateNotify;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Stat cache shim VFS
+
+  This remembers the result of stat calls on an underlying VFS, including
+  paths that don't exist. Entries are invalidated by changes made through the
+  shim and can optionally expire to pick up changes made outside of EVFS.
+------------------------------------------------------------------------------
+*/
+
+#ifndef SHIM_STAT_CACHE_H
+#define SHIM_STAT_CACHE_H
+
+// Monotonic time source for expiring entries
+typedef uint64_t (*EvfsStatCacheClock)(void);
+
+typedef struct StatCacheConfig {
+  size_t    max_entries;    // Paths cached before the cache is cleared. 0 for a default size
+  uint64_t  ttl;            // Clock ticks an entry stays valid. 0 to keep until invalidated
+  EvfsStatCacheClock clock; // Required when ttl is non-zero
+} StatCacheConfig;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int evfs_register_stat_cache(const char *vfs_name, const char *old_vfs_name, StatCacheConfig *cfg,
+                             bool default_vfs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SHIM_STAT_CACHE_H
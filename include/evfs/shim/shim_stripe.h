@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Striping shim VFS
+
+  This spreads the data of each file across multiple member VFSs in fixed
+  size stripes assigned round-robin. Large transfers can run on all members
+  in parallel.
+------------------------------------------------------------------------------
+*/
+
+#ifndef SHIM_STRIPE_H
+#define SHIM_STRIPE_H
+
+// Most member VFSs a stripe shim can span
+#define EVFS_STRIPE_MAX_MEMBERS  16
+
+typedef struct StripeConfig {
+  uint32_t  stripe_size;  // Bytes per stripe for new files. 0 for a default size
+  unsigned  io_threads;   // Workers for parallel transfers. Needs threading. 0 to disable
+} StripeConfig;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int evfs_register_stripe(const char *vfs_name, const char **member_vfs_names, unsigned num_members,
+                         StripeConfig *cfg, bool default_vfs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SHIM_STRIPE_H
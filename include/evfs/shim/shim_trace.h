@@ -11,13 +11,113 @@ See LICENSE in the EVFS project root for details
 Embedded Virtual Filesystem
 
   Tracing shim VFS
-  This adds debugging traces for calls to the underlying VFS.
+  This adds debugging traces for calls to the underlying VFS. Traces are
+  either formatted as text for each call, stored as fixed size binary
+  records in a ring buffer that is decoded later, or captured to a file
+  with full paths for replay.
 ------------------------------------------------------------------------------
 */
 
 #ifndef SHIM_TRACE_H
 #define SHIM_TRACE_H
 
+// Methods recorded in binary traces
+#define EVFS_TRACE_OP_LIST(M) \
+  M(EVFS_TRACE_OPEN,          "m_open") \
+  M(EVFS_TRACE_STAT,          "m_stat") \
+  M(EVFS_TRACE_DELETE,        "m_delete") \
+  M(EVFS_TRACE_RENAME,        "m_rename") \
+  M(EVFS_TRACE_MAKE_DIR,      "m_make_dir") \
+  M(EVFS_TRACE_OPEN_DIR,      "m_open_dir") \
+  M(EVFS_TRACE_GET_CUR_DIR,   "m_get_cur_dir") \
+  M(EVFS_TRACE_SET_CUR_DIR,   "m_set_cur_dir") \
+  M(EVFS_TRACE_VFS_CTRL,      "m_vfs_ctrl") \
+  M(EVFS_TRACE_CTRL,          "m_ctrl") \
+  M(EVFS_TRACE_CLOSE,         "m_close") \
+  M(EVFS_TRACE_READ,          "m_read") \
+  M(EVFS_TRACE_WRITE,         "m_write") \
+  M(EVFS_TRACE_READ_AT,       "m_read_at") \
+  M(EVFS_TRACE_WRITE_AT,      "m_write_at") \
+  M(EVFS_TRACE_READV,         "m_readv") \
+  M(EVFS_TRACE_WRITEV,        "m_writev") \
+  M(EVFS_TRACE_MAP,           "m_map") \
+  M(EVFS_TRACE_UNMAP,         "m_unmap") \
+  M(EVFS_TRACE_DISCARD,       "m_discard") \
+  M(EVFS_TRACE_TRUNCATE,      "m_truncate") \
+  M(EVFS_TRACE_SYNC,          "m_sync") \
+  M(EVFS_TRACE_SIZE,          "m_size") \
+  M(EVFS_TRACE_SEEK,          "m_seek") \
+  M(EVFS_TRACE_TELL,          "m_tell") \
+  M(EVFS_TRACE_EOF,           "m_eof") \
+  M(EVFS_TRACE_DIR_CLOSE,     "m_dir_close") \
+  M(EVFS_TRACE_DIR_READ,      "m_dir_read") \
+  M(EVFS_TRACE_DIR_READ_MANY, "m_dir_read_many") \
+  M(EVFS_TRACE_DIR_REWIND,    "m_dir_rewind")
+
+#define EVFS_TRACE_ENUM_ITEM(E, S)  E,
+
+typedef enum {
+  EVFS_TRACE_OP_LIST(EVFS_TRACE_ENUM_ITEM)
+  EVFS_TRACE_NUM_OPS
+} EvfsTraceOp;
+
+
+// Binary trace record
+typedef struct EvfsTraceRecord {
+  uint64_t  timestamp;  // Clock at the start of the call
+  uint32_t  elapsed;    // Clock ticks spent in the call
+  uint32_t  handle;     // Serial number of the file or dir handle. 0 for VFS methods
+  uint32_t  name_hash;  // Hash of the path from evfs_trace_name_hash()
+  int32_t   size;       // Transfer size or other primary argument
+  int32_t   offset;     // File offset or other secondary argument
+  int32_t   result;     // Return value
+  uint16_t  op;         // EvfsTraceOp
+  uint16_t  layer;      // Order the shim was attached to the ring
+} EvfsTraceRecord;
+
+
+// Monotonic time source for binary traces
+typedef uint64_t (*EvfsTraceClock)(void);
+
+typedef struct EvfsTraceRing EvfsTraceRing;
+
+// Settings for evfs_trace_format()
+typedef struct EvfsTraceDecoder {
+  const char * const *layer_names;  // Shim names indexed by layer. NULL to print layer numbers
+  unsigned num_layers;
+  // Optional callback to convert a name hash back into a path
+  const char *(*lookup_name)(uint32_t name_hash, void *ctx);
+  void *ctx;
+} EvfsTraceDecoder;
+
+
+// Capture files start with a header followed by variable length records.
+// Each record has a fixed part followed by path_len bytes of NUL terminated
+// paths. All fields are little-endian.
+//
+//  Header:  magic[6] "EVCAP\0", u16 version
+//  Record:  u64 timestamp, u32 elapsed, u32 handle, i64 size, i64 offset,
+//           i64 result, u16 op, u16 path_len, char paths[path_len]
+
+#define EVFS_CAPTURE_MAGIC        "EVCAP"
+#define EVFS_CAPTURE_VERSION      1
+#define EVFS_CAPTURE_HEADER_SIZE  8
+#define EVFS_CAPTURE_RECORD_SIZE  44
+
+// Decoded capture record
+typedef struct EvfsCaptureRecord {
+  uint64_t    timestamp;  // Clock at the start of the call
+  uint32_t    elapsed;    // Clock ticks spent in the call
+  uint32_t    handle;     // Serial number of the file or dir handle. 0 for VFS methods
+  int64_t     size;       // Transfer size or other primary argument
+  int64_t     offset;     // File offset or other secondary argument
+  int64_t     result;     // Return value
+  uint16_t    op;         // EvfsTraceOp
+  const char *path;       // Path for opens and VFS methods. NULL for others
+  const char *new_path;   // New path for renames. NULL for others
+} EvfsCaptureRecord;
+
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -25,6 +125,22 @@ extern "C" {
 int evfs_register_trace(const char *vfs_name, const char *old_vfs_name,
     int (*report)(const char *buf, void *ctx), void *ctx, bool default_vfs);
 
+int evfs_trace_ring_new(size_t num_records, EvfsTraceClock clock, EvfsTraceRing **ring);
+void evfs_trace_ring_free(EvfsTraceRing *ring);
+int evfs_register_trace_ring(const char *vfs_name, const char *old_vfs_name, EvfsTraceRing *ring,
+                             bool default_vfs);
+size_t evfs_trace_ring_read(EvfsTraceRing *ring, EvfsTraceRecord *records, size_t max_records,
+                            size_t *dropped);
+
+int evfs_register_trace_capture(const char *vfs_name, const char *old_vfs_name, EvfsFile *capture,
+                                EvfsTraceClock clock, bool default_vfs);
+int evfs_capture_decode(const uint8_t *buf, size_t buf_size, size_t *pos, EvfsCaptureRecord *rec);
+
+uint32_t evfs_trace_name_hash(const char *name);
+const char *evfs_trace_op_name(EvfsTraceOp op);
+int evfs_trace_format(const EvfsTraceRecord *rec, const EvfsTraceDecoder *decoder, char *buf,
+                      size_t buf_size);
+
 #ifdef __cplusplus
 }
 #endif
@@ -17,11 +17,14 @@ Embedded Virtual Filesystem
 #ifndef STDIO_FS_H
 #define STDIO_FS_H
 
+#include "evfs/async_io.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 int evfs_register_stdio(bool default_vfs);
+int evfs_stdio_attach_uring(EvfsAsyncQueue *queue, unsigned entries);
 
 #ifdef __cplusplus
 }
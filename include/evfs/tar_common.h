@@ -1,6 +1,10 @@
 #ifndef TAR_COMMON_H
 #define TAR_COMMON_H
 
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
 #define TAR_BLOCK_SIZE 512
 #define TAR_HEADER_SIZE 500
 
@@ -43,6 +47,36 @@ typedef struct TarHeader
 #define TAR_TYPE_EXT         'x'
 
 
+// Compute the header checksum with the checksum field counted as spaces
+// Bytes are summed eight at a time into four 16-bit lanes
+static inline uint32_t tar_header_checksum(const TarHeader *header) {
+  const uint8_t *raw_header = (const uint8_t *)header;
+  uint64_t lanes = 0;
+  size_t i;
+
+  // Each lane gains at most 2*255 per word so 62 words can't overflow 16 bits
+  for(i = 0; i + sizeof(uint64_t) <= TAR_HEADER_SIZE; i += sizeof(uint64_t)) {
+    uint64_t w;
+    memcpy(&w, &raw_header[i], sizeof w);
+    lanes += (w & 0x00FF00FF00FF00FFULL) + ((w >> 8) & 0x00FF00FF00FF00FFULL);
+  }
+
+  uint32_t checksum = (uint32_t)(lanes & 0xFFFF) + (uint32_t)((lanes >> 16) & 0xFFFF) +
+                      (uint32_t)((lanes >> 32) & 0xFFFF) + (uint32_t)(lanes >> 48);
+
+  for(; i < TAR_HEADER_SIZE; i++) {
+    checksum += raw_header[i];
+  }
+
+  // Replace checksum with spaces
+  for(i = 0; i < sizeof header->checksum; i++) {
+    checksum += (uint32_t)' ' - header->checksum[i];
+  }
+
+  return checksum;
+}
+
+
 
 #endif // TAR_COMMON_H
 
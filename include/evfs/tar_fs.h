@@ -22,6 +22,12 @@ extern "C" {
 #endif
 
 int evfs_register_tar_fs(const char *vfs_name, EvfsFile *tar_file, bool default_vfs);
+int evfs_register_tar_fs_with_index(const char *vfs_name, EvfsFile *tar_file, EvfsFile *index_file,
+                                    bool default_vfs);
+int evfs_register_tar_fs_writable(const char *vfs_name, EvfsFile *tar_file, bool default_vfs);
+
+int evfs_remount_tar_fs(const char *vfs_name, EvfsFile *tar_file);
+int evfs_remount_tar_fs_with_index(const char *vfs_name, EvfsFile *tar_file, EvfsFile *index_file);
 
 #ifdef __cplusplus
 }
@@ -13,6 +13,13 @@ typedef struct TarFileIterator {
   evfs_off_t header_offset;  // Offset within tar file
   evfs_off_t file_size;      // Size of current archived file
 
+  // Optional read-ahead for scanning headers. See tar_iter_set_buffer()
+  uint8_t   *buf;
+  size_t     buf_size;
+  evfs_off_t buf_offset;     // File offset of buf[0]
+  size_t     buf_len;        // Bytes of valid data in buf
+  bool       buf_mapped;     // buf holds the whole archive. See tar_iter_set_mapping()
+
 } TarFileIterator;
 
 #ifdef __cplusplus
@@ -21,6 +28,8 @@ extern "C" {
 
 void tar_iter_init(TarFileIterator *tar_it, EvfsFile *fd);
 void tar_iter_close(TarFileIterator *tar_it);
+void tar_iter_set_buffer(TarFileIterator *tar_it, uint8_t *buf, size_t buf_size);
+void tar_iter_set_mapping(TarFileIterator *tar_it, const uint8_t *data, size_t size);
 bool tar_iter_seek(TarFileIterator *tar_it, evfs_off_t offset);
 #define tar_iter_begin(r)  tar_iter_seek(r, 0)
 bool tar_iter_next(TarFileIterator *tar_it);
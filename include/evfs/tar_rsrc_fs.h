@@ -23,6 +23,9 @@ extern "C" {
 
 int evfs_register_tar_rsrc_fs(const char *vfs_name, uint8_t *resource, size_t resource_len,
                               bool default_vfs);
+int evfs_register_tar_rsrc_fs_static(const char *vfs_name, uint8_t *resource, size_t resource_len,
+                                     const EvfsIndexStorage *storage, bool default_vfs);
+int evfs_tar_rsrc_index_size(uint8_t *resource, size_t resource_len, EvfsIndexStorage *storage);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,90 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2021 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Streaming TAR reader
+  Forward only access to tar data from pipes, sockets, and other files that
+  can't seek.
+------------------------------------------------------------------------------
+*/
+
+#ifndef TAR_STREAM_H
+#define TAR_STREAM_H
+
+#include "tar_common.h"
+
+// Member paths are built from the ustar prefix and name fields
+#define TAR_STREAM_MAX_PATH  (TAR_FILE_PREFIX_LEN + 1 + TAR_FILE_NAME_LEN + 1)
+
+
+typedef struct TarStreamIterator {
+  EvfsFile *fd;
+
+  TarHeader cur_header;
+  char      cur_path[TAR_STREAM_MAX_PATH];
+
+  evfs_off_t stream_pos;     // Bytes consumed from the stream
+  evfs_off_t file_size;      // Size of current archived file
+  evfs_off_t data_remaining; // Unread file data in current member
+  size_t     pad_remaining;  // Padding after the file data
+  int        status;         // Error that ended iteration
+} TarStreamIterator;
+
+
+typedef struct TarStreamMember {
+  const char      *path;      // Path within the archive
+  evfs_off_t       size;      // Size of file data
+  uint8_t          type_flag; // TAR_TYPE_* value from header
+  const TarHeader *header;
+} TarStreamMember;
+
+
+/*
+Callback for tar_stream_each()
+
+Each member is passed to the visitor in one or more chunks of data. Members
+without data get one call with size 0. The last chunk of a member has
+offset + size == member->size.
+
+Args:
+  member: Member being read
+  data:   Chunk of member data
+  size:   Size of data
+  offset: Offset of data within the member
+  ctx:    User context passed to tar_stream_each()
+
+Returns:
+  EVFS_OK to continue, EVFS_DONE to stop iteration, or a negative error to abort
+*/
+typedef int (*TarStreamVisitor)(const TarStreamMember *member, const uint8_t *data, size_t size,
+                                evfs_off_t offset, void *ctx);
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void tar_stream_init(TarStreamIterator *tar_it, EvfsFile *fd);
+bool tar_stream_next(TarStreamIterator *tar_it);
+ptrdiff_t tar_stream_read(TarStreamIterator *tar_it, void *buf, size_t size);
+
+int tar_stream_each(EvfsFile *fd, uint8_t *buf, size_t buf_size, TarStreamVisitor visitor, void *ctx);
+int tar_stream_extract_ex(EvfsFile *fd, const char *dest_dir, uint8_t *buf, size_t buf_size,
+                          const char *vfs_name);
+
+static inline int tar_stream_extract(EvfsFile *fd, const char *dest_dir, uint8_t *buf, size_t buf_size) {
+  return tar_stream_extract_ex(fd, dest_dir, buf, buf_size, NULL);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TAR_STREAM_H
@@ -0,0 +1,60 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Workload replay
+  Replay a capture from the capture tracing shim on any VFS.
+------------------------------------------------------------------------------
+*/
+
+#ifndef TRACE_REPLAY_H
+#define TRACE_REPLAY_H
+
+#include "evfs/shim/shim_trace.h"
+
+// Settings for evfs_replay()
+typedef struct EvfsReplayConfig {
+  const char     *vfs_name;     // VFS to replay on. NULL for the default VFS
+  const char     *path_prefix;  // Prepended to captured paths. NULL to use them unchanged
+  EvfsTraceClock  clock;        // Time source in the units of the capture. NULL to skip timing
+  void          (*delay)(uint64_t ticks); // Wait for clock ticks. Needed for timed replay
+  unsigned        speed;        // Speedup over the captured timing. 0 to replay without delays
+  unsigned        num_streams;  // Concurrent copies of the workload. 0 or 1 for one
+  bool            prepare;      // Create files and directories the workload expects to exist
+} EvfsReplayConfig;
+
+// Results from evfs_replay()
+typedef struct EvfsReplayStats {
+  size_t    ops;            // Calls replayed
+  size_t    skipped;        // Captured calls that can't be replayed
+  size_t    mismatches;     // Calls that failed in only one of the capture and the replay
+  uint64_t  bytes_read;
+  uint64_t  bytes_written;
+  uint64_t  elapsed;        // Clock ticks for the replay
+  uint64_t  captured;       // Clock ticks spanned by the capture
+  uint32_t  latency_p50;    // Call latency percentiles in clock ticks
+  uint32_t  latency_p90;
+  uint32_t  latency_p99;
+  uint32_t  latency_p999;
+  uint32_t  latency_max;
+} EvfsReplayStats;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int evfs_replay(EvfsFile *capture, const EvfsReplayConfig *cfg, EvfsReplayStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TRACE_REPLAY_H
@@ -0,0 +1,73 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2021 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice (including the next
+paragraph) shall be included in all copies or substantial portions of the
+Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+
+/*
+------------------------------------------------------------------------------
+checksum
+
+Data checksums. CRC32C (Castagnoli) uses the SSE4.2 or ARMv8 CRC
+instructions when they are available and slicing-by-8 tables otherwise. On
+x86 with GCC or Clang the instructions are selected at run time. On ARM they
+are used when the compiler targets a CPU with the CRC extension.
+
+sum32_be() is the sum of big-endian 32-bit words used by Romfs.
+------------------------------------------------------------------------------
+*/
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void crc32c_init(void);
+uint32_t crc32c_update(uint32_t crc, const void *data, size_t len);
+
+/*
+Compute the CRC32C of a buffer
+
+Args:
+  data: Data to checksum
+  len:  Length of data
+
+Returns:
+  CRC of the data
+*/
+static inline uint32_t crc32c(const void *data, size_t len) {
+  return crc32c_update(0, data, len);
+}
+
+uint32_t sum32_be(uint32_t sum, const void *data, size_t words);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHECKSUM_H
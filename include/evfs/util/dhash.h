@@ -42,6 +42,31 @@ for the bucket array size.
 
 //#define DH_USE_2X_GROWTH
 
+// Keep a separate array of one byte fingerprints for the buckets and probe it
+// 16 buckets at a time (Swiss table layout). The key and value entries are only
+// touched on a fingerprint match so lookups in large tables cost one or two
+// cache misses. Groups are scanned with SSE2 or NEON when available. Leave this
+// disabled on small MCUs to use Robin Hood probing with no extra array.
+//#define DH_USE_SWISS_TABLE
+
+// Support hashes that are read by many threads while one thread at a time
+// changes them. Hashes created with dhConfig.concurrent set take lookups
+// without a lock under a sequence counter and serialize their writers
+// internally. This needs C11 atomics.
+//#define DH_USE_CONCURRENT
+
+#ifdef DH_USE_CONCURRENT
+#  include <stdatomic.h>
+#endif
+
+// Move entries into a grown bucket array a few buckets at a time on later
+// insertions and removals rather than all at once in the insert that triggers
+// the grow. Lookups search both arrays until the move is done. This bounds the
+// latency of an insert at the cost of keeping the old array around a while
+// longer. Use dh_reserve_capacity() to presize a hash when the number of
+// entries is known ahead of time.
+//#define DH_USE_INCREMENTAL_GROW
+
 
 // Set the largest number of hash entries to support.
 // This is primarily to help 8 and 16-bit platforms use a smaller data type
@@ -94,9 +119,14 @@ typedef struct dhConfig {
   EqualKeys       is_equal;     // Required callback to test if two dhKeys match (on ikey collision)
   ItemReplace     replace_item; // Optional callback for replaced entries
   GrowHash        grow_hash;    // Optional callback to notify increase in hash size
+
+  bool            concurrent;   // Allow lookups concurrent with writes. Needs DH_USE_CONCURRENT.
 } dhConfig;
 
 
+struct dhRetired;
+
+
 typedef struct dhash {
   // Bucket handling
   void           *buckets;      // Dynamic array of struct dhPair
@@ -106,6 +136,10 @@ typedef struct dhash {
 #ifndef DH_USE_2X_GROWTH
   dhBucketIndex   prime_ix;     // Index into table or primes for bucket array sizes
 #endif
+#ifdef DH_USE_SWISS_TABLE
+  uint8_t        *ctrl;         // Fingerprints for each bucket. Stored after the buckets.
+  dhBucketIndex   deleted_buckets; // Tombstones that still lengthen probes
+#endif
 
   // Configuration
   size_t          value_size;   // Bytes per entry value
@@ -121,6 +155,28 @@ typedef struct dhash {
 
   bool            static_buckets; // Buckets array is from ext_storage
 
+#ifdef DH_USE_INCREMENTAL_GROW
+  // Previous bucket array while its entries are moved into the new one
+  void           *old_buckets;
+  dhBucketIndex   old_num_buckets;
+#  ifndef DH_USE_2X_GROWTH
+  dhBucketIndex   old_prime_ix;
+#  endif
+#  ifdef DH_USE_SWISS_TABLE
+  uint8_t        *old_ctrl;
+#  endif
+  dhBucketIndex   old_used;     // Entries left to move
+  dhBucketIndex   migrate_pos;  // Next old bucket to move
+  dhBucketIndex   migrate_step; // Old buckets moved on each write
+  struct dhRetired *old_node;   // Retires old_buckets on a concurrent hash
+#endif
+
+#ifdef DH_USE_CONCURRENT
+  bool              concurrent;
+  atomic_uint       seq;        // Odd while a writer is changing the table
+  atomic_bool       write_lock; // Serialize writers
+  struct dhRetired *retired;    // Items and bucket arrays kept until dh_reclaim()
+#endif
 } dhash;
 
 
@@ -140,6 +196,7 @@ extern "C" {
 // ******************** Resource management ********************
 bool dh_init(dhash *hash, dhConfig *config, void *ctx);
 void dh_free(dhash *hash);
+void dh_reclaim(dhash *hash);
 
 // ******************** Retrieval ********************
 bool dh_lookup(dhash *hash, dhKey key, void *value);
@@ -160,11 +217,13 @@ size_t dh_num_items(dhash *hash);
 size_t dh_cur_capacity(dhash *hash);
 int dh_load_factor(dhash *hash);
 bool dh_reserve_capacity(dhash *hash, size_t add_capacity);
+size_t dh_storage_size(size_t num_items, size_t value_size);
 
 
 // ******************** Utility ********************
 int dh_mean_probe_count(dhash *hash);
 int dh_max_probe_count(dhash *hash);
+size_t dh_probe_histogram(dhash *hash, size_t *histogram, size_t num_bins);
 
 void dh_dump(dhash *hash, HashVisitor print_item, void *ctx);
 
@@ -33,6 +33,8 @@ String globbing
 #ifndef GLOB_H
 #define GLOB_H
 
+typedef struct GlobPattern GlobPattern;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -41,6 +43,10 @@ bool char_match(char ch, const char *match_set);
 bool glob_match(const char *pattern, const char *str, const char *dir_separators);
 bool is_glob(const char *str);
 
+GlobPattern *glob_compile(const char *pattern, const char *dir_separators);
+void glob_free(GlobPattern *gp);
+bool glob_match_compiled(const GlobPattern *gp, const char *str);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,70 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2021 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice (including the next
+paragraph) shall be included in all copies or substantial portions of the
+Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+
+/*
+------------------------------------------------------------------------------
+lz4_block
+
+This is a small codec for the LZ4 block format. Output can be decoded by the
+reference LZ4 library and vice versa. Only independent blocks are supported
+with no frame header or dictionary.
+
+The compressor is a single pass greedy matcher with a hash table of recent
+positions supplied by the caller. Blocks are limited to LZ4_MAX_BLOCK_SIZE so
+that positions fit in 16 bits. The decompressor validates all lengths and
+offsets so corrupt input can't write outside the destination buffer.
+------------------------------------------------------------------------------
+*/
+
+#ifndef LZ4_BLOCK_H
+#define LZ4_BLOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Size of the compressor hash table as a power of 2. Each entry is 2 bytes.
+#ifndef LZ4_HASH_LOG
+#  define LZ4_HASH_LOG  12
+#endif
+
+#define LZ4_MAX_BLOCK_SIZE  65535
+
+// Bytes needed for the hash table passed to lz4_compress_block()
+#define LZ4_WORK_SIZE   (sizeof(uint16_t) << LZ4_HASH_LOG)
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+size_t lz4_compress_block(const uint8_t *src, size_t src_len, uint8_t *dest, size_t dest_size,
+                          void *work);
+ptrdiff_t lz4_decompress_block(const uint8_t *src, size_t src_len, uint8_t *dest, size_t dest_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LZ4_BLOCK_H
@@ -0,0 +1,111 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2021 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice (including the next
+paragraph) shall be included in all copies or substantial portions of the
+Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+
+/*
+------------------------------------------------------------------------------
+mphash
+
+This implements a static minimal perfect hash using hash and displace (CHD).
+Keys are split into buckets of about four keys each and every bucket gets a
+seed that moves its keys into free slots of a table sized exactly to the
+number of keys. Lookups hash the key, read one seed, and compare against the
+single key in the selected slot.
+
+All keys are added before calling mph_build(). The table can't be modified
+afterward.
+------------------------------------------------------------------------------
+*/
+
+#ifndef MPHASH_H
+#define MPHASH_H
+
+#include <inttypes.h>
+#include "util/dhash.h"
+
+
+typedef uint64_t (*ComputeHash64)(dhKey key);
+
+// Configuration settings passed to mph_init()
+typedef struct mphConfig {
+  size_t          num_keys;     // Expected number of keys. More can be added.
+  size_t          value_size;   // Bytes per entry value
+
+  // Callbacks
+  ComputeHash64   gen_hash;     // Required callback to convert dhKey into a 64-bit hash
+  EqualKeys       is_equal;     // Required callback to test if two dhKeys match
+} mphConfig;
+
+
+typedef struct mphash {
+  dhKey          *keys;         // Key for each slot
+  uint8_t        *values;       // Value for each slot
+  uint64_t       *key_hashes;   // Hashes of added keys. Only present until mph_build()
+  uint32_t       *seeds;        // Displacement seed for each bucket
+
+  size_t          num_keys;     // Number of keys in the table
+  size_t          max_keys;     // Slots allocated for staging
+  size_t          num_buckets;
+  size_t          value_size;   // Bytes per entry value
+  size_t          value_stride; // Value size rounded up for alignment
+
+  // Callbacks
+  void           *ctx;          // User context for callbacks
+  ComputeHash64   gen_hash;
+  EqualKeys       is_equal;
+
+  bool            built;        // Table is ready for lookup
+} mphash;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ******************** Resource management ********************
+bool mph_init(mphash *mph, mphConfig *config, void *ctx);
+void mph_free(mphash *mph);
+
+// ******************** Storage ********************
+bool mph_add(mphash *mph, dhKey key, void *value);
+bool mph_build(mphash *mph);
+
+// ******************** Retrieval ********************
+bool mph_lookup(mphash *mph, dhKey key, void *value);
+#define mph_exists(h, k)  mph_lookup(h, k, NULL)
+bool mph_lookup_in_place(mphash *mph, dhKey key, void **value);
+
+// ******************** Resource utilization ********************
+size_t mph_num_items(mphash *mph);
+size_t mph_storage_size(mphash *mph);
+
+// ******************** Utility ********************
+uint64_t mph_gen_hash_string(dhKey key);
+uint64_t mph_gen_hash_int(dhKey key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MPHASH_H
@@ -131,6 +131,7 @@ bool range_eq_range(StringRange *rng, StringRange *rng2);
 bool range_is_int(StringRange *rng);
 
 // ******************** Tokenizing ********************
+size_t str_cspan(const char *str, const char *delim);
 bool range_token(const char *str, const char *delim, StringRange *token);
 bool range_token_limit(const char *str, const char *delim, StringRange *token, size_t *limit);
 
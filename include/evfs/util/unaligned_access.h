@@ -268,7 +268,7 @@ static inline void set_unaligned_s32le(int32_t value, void *dest) {
 
 // ******************** uint64_t ********************
 
-static inline uint32_t get_unaligned_u64(const void *data) {
+static inline uint64_t get_unaligned_u64(const void *data) {
   const uint8_t *bdata = (const uint8_t *)data; // Don't allow any assumed alignment 
   uint64_t val;
 
@@ -57,6 +57,37 @@ Embedded Virtual Filesystem
 // Color output for trace shim messages and error diagnostics
 #define EVFS_USE_ANSI_COLOR
 
+// Count calls and bytes for each allocation class. See evfs_get_alloc_stats()
+#define EVFS_USE_ALLOC_STATS
+
+// Count reads, writes, and bytes transferred on each file handle.
+// See EVFS_CMD_GET_IO_STATS
+//#define EVFS_USE_IO_STATS
+
+// Time a sample of the calls made through the public API and report them to
+// the callback set with evfs_set_latency_hook()
+//#define EVFS_USE_LATENCY_HOOKS
+
+// Monotonic clock in nanoseconds for latency sampling. The default uses
+// clock_gettime(CLOCK_MONOTONIC) where it's available.
+//#define EVFS_LATENCY_CLOCK_NS()  my_cycle_count_ns()
+
+// Also fire a USDT probe "evfs:op" for each sampled call. Requires <sys/sdt.h>
+//#define EVFS_USE_USDT
+
+// Support preallocated pools of file and directory handles with evfs_vfs_pool_init().
+// Each handle carries a small header identifying its pool when this is enabled.
+#define EVFS_USE_HANDLE_POOL
+
+// When threading is enabled, the rotate and jail shims use per-thread scratch
+// buffers in place of their shared path buffers so that path translation
+// doesn't need a lock. This requires C11 _Thread_local support.
+//#define EVFS_USE_THREAD_LOCAL_PATHS
+
+// Number of scratch path buffers for each thread. Every stacked shim or filesystem
+// that translates a path takes one. Paths are allocated when these run out.
+#define EVFS_THREAD_LOCAL_PATH_DEPTH  4
+
 
 // ******************** VFS options ********************
 
@@ -64,27 +95,74 @@ Embedded Virtual Filesystem
 // If this is not defined some of the EVFS API will be non-functional on Stdio.
 #define EVFS_USE_STDIO_POSIX
 
+// Allow async I/O on Stdio files to use io_uring on Linux. This requires
+// EVFS_USE_STDIO_POSIX and threading. See evfs_stdio_attach_uring().
+#define EVFS_USE_STDIO_IO_URING
 
-// The Littlefs driver constructs absolute paths before passing them into the
-// lfs API. Define this to use a common shared buffer in place of malloc.
-#define EVFS_USE_LITTLEFS_SHARED_BUFFER
 
 // The log rotate shim supports a common shared buffer for path operations.
 #define EVFS_USE_ROTATE_SHARED_BUFFER
 
-// Shared buffers for the tar FS and tar resource FS
-#define EVFS_USE_TARFS_SHARED_BUFFER
+// Keep a cursor file in rotate containers recording the chunk sequence so
+// that opening doesn't need to scan every chunk.
+//#define EVFS_USE_ROTATE_CURSOR
+
+// Map read-only tar and Romfs image files into memory when their VFS supports
+// evfs_file_map(). Members are then read in place rather than through the image
+// file. Images must not be truncated while mounted.
+#define EVFS_USE_IMAGE_MAPPING
 
+// Size of the temporary buffer used to read ahead through tar headers when
+// the tar FS builds its index. Runs of small files are then scanned from
+// memory. Set to 0 to read each header separately.
+#define EVFS_TARFS_READ_AHEAD_SIZE  (64 * 1024)
+
+// Size of the stack buffer used by evfs_file_printf() and the trace shim.
+// Longer output is formatted into an allocated buffer.
+#define EVFS_PRINTF_STACK_SIZE      128
+
+// Uncompressed distance between checkpoints in files opened with evfs_open_gzip_file().
+// Each checkpoint keeps a 32KiB window so random reads only decompress from the
+// nearest one. Requires the USE_ZLIB build option.
+#define EVFS_GZIP_CHECKPOINT_SPAN   (1024 * 1024)
 
-// Shared buffers for Romfs
-#define EVFS_USE_ROMFS_SHARED_BUFFER
 
 // When fast indexing is enabled, Romfs will look up file paths directly
 // by building a hash table index. If this option is disabled, files are
 // retrieved by walking the directory structures.
 #define EVFS_USE_ROMFS_FAST_INDEX
 
+// Build the Romfs fast index one directory at a time as paths are first
+// resolved rather than walking the whole image at mount. Not used with the
+// perfect hash index.
+//#define EVFS_USE_ROMFS_LAZY_INDEX
+
+// Build the tar and Romfs path indices as minimal perfect hash tables. They
+// have exactly one slot per path and every lookup takes one probe. The default
+// is a growable Robin Hood dhash index.
+//#define EVFS_USE_PERFECT_HASH_INDEX
+
 // Maximum length of a Romfs file or directory name. Must be a multiple of 16.
 #define EVFS_ROMFS_MAX_NAME_LEN   32
 
+// Number of decoded Romfs file headers kept to avoid re-reading them during
+// path lookups and directory listings. Set to 0 to disable.
+#define EVFS_ROMFS_HEADER_CACHE_SIZE  8
+
+// Romfs images have directory entries sorted by name as written by
+// romfs_build_image(). Path lookups stop scanning a directory early.
+//#define EVFS_USE_ROMFS_SORTED_DIRS
+
+// Verify every Romfs header checksum once at mount and skip the checksum on
+// later reads. Mounting walks the whole image.
+//#define EVFS_USE_ROMFS_TRUSTED_HEADERS
+
+
+// FatFs and littlefs VFSs defined at compile time. Each entry gives an identifier,
+// the VFS name, and the FatFs volume number or a global lfs_t object. The VFSs
+// are named evfs_fatfs_<id> and evfs_littlefs_<id> and are registered without
+// allocation by passing them to evfs_register_static().
+//#define EVFS_FATFS_STATIC_LIST(M)     M(sd, "sd", 0)
+//#define EVFS_LITTLEFS_STATIC_LIST(M)  M(flash, "flash", g_flash_lfs)
+
 #endif // EVFS_CONFIG_H
@@ -24,20 +24,44 @@ Embedded Virtual Filesystem
 #  include <threads.h>
 
 typedef mtx_t EvfsLock;
+typedef cnd_t EvfsCond;
+typedef thrd_t EvfsThread;
 
 // This is just a placeholder C11 threads require dynamic init
 #  define LOCK_INITIALIZER   {0}
 
+#  ifndef EVFS_RWLOCK_USE_MUTEX
+// C11 has no reader/writer lock so we build one that favors writers
+typedef struct EvfsRwLock {
+  mtx_t     lock;
+  cnd_t     readers_ok;
+  cnd_t     writer_ok;
+  unsigned  readers;          // Active readers
+  unsigned  writers_waiting;
+  unsigned  writer;           // Writer is active
+} EvfsRwLock;
+
+#    define RWLOCK_INITIALIZER {0}
+#  endif
+
 
 // ******************** pthreads ********************
 #elif defined USE_PTHREADS
 #  include <pthread.h>
 
 typedef pthread_mutex_t EvfsLock;
+typedef pthread_cond_t EvfsCond;
+typedef pthread_t EvfsThread;
 
 #  define LOCK_INITIALIZER   PTHREAD_MUTEX_INITIALIZER
 #  define HAVE_STATIC_LOCK_INIT
 
+#  ifndef EVFS_RWLOCK_USE_MUTEX
+typedef pthread_rwlock_t EvfsRwLock;
+
+#    define RWLOCK_INITIALIZER PTHREAD_RWLOCK_INITIALIZER
+#  endif
+
 
 // ******************** Default ********************
 #else
@@ -45,4 +69,15 @@ typedef pthread_mutex_t EvfsLock;
 #endif
 
 
+// ******************** Custom reader/writer locks ********************
+
+// Ports to thread libraries without reader/writer locks can define this to
+// make shared locks exclusive. Only the EvfsLock functions are then needed.
+#ifdef EVFS_RWLOCK_USE_MUTEX
+typedef EvfsLock EvfsRwLock;
+
+#  define RWLOCK_INITIALIZER LOCK_INITIALIZER
+#endif
+
+
 #endif // EVFS_CUSTOM_THREADING_H
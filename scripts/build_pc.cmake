@@ -40,7 +40,7 @@ add_compile_options(
   -Wpedantic
 #  -pedantic-errors
   -Wredundant-decls
-  -Wmissing-prototypes
+  $<$<COMPILE_LANGUAGE:C>:-Wmissing-prototypes>
   -Wdouble-promotion
   -Wundef
 )
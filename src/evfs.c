@@ -21,26 +21,87 @@ Embedded Virtual Filesystem
 #include "evfs_internal.h"
 
 #include "evfs/util/glob.h"
+#include "evfs/util/dhash.h"
+
+#define NEXT_OBJ(o) (&(o)[1])
+
 
 // List of registered VFSs
 static Evfs *s_vfs_list = NULL;
 static Evfs *s_default_vfs = NULL;
 
 
+// Hashed index of the VFS list for name lookups.
+// Snapshots are immutable once published so readers never need the lock.
+// Replaced snapshots are retired rather than freed because a concurrent
+// reader may still be searching them. They are reclaimed on a later update once
+// no readers are active and by evfs_unregister_all().
+typedef struct VfsIndex {
+  dhash hash;
+  struct VfsIndex *next_retired;
+} VfsIndex;
+
+
 // ******************** Threading support ********************
 #ifdef EVFS_USE_THREADING
 
 // Library-wide lock controlling updates to VFS linked list
-static EvfsLock s_evfs_lock = LOCK_INITIALIZER;
-
-#  define LOCK()    evfs__lock(&s_evfs_lock)
-#  define UNLOCK()  evfs__unlock(&s_evfs_lock)
+// Searches of the list only need a shared lock
+static EvfsRwLock s_evfs_lock = RWLOCK_INITIALIZER;
+
+#  define LOCK()          evfs__lock_exclusive(&s_evfs_lock)
+#  define UNLOCK()        evfs__unlock_exclusive(&s_evfs_lock)
+#  define LOCK_SHARED()   evfs__lock_shared(&s_evfs_lock)
+#  define UNLOCK_SHARED() evfs__unlock_shared(&s_evfs_lock)
+
+// Serialize emulated positional I/O on each file
+// Handles are spread over a small set of locks so unrelated files rarely contend.
+#  define PIO_NUM_LOCKS   16
+static EvfsLock s_pio_locks[PIO_NUM_LOCKS];
+
+#  define PIO_LOCK_FOR(fh)  (&s_pio_locks[((uintptr_t)(fh) >> 4) % PIO_NUM_LOCKS])
+#  define PIO_LOCK(fh)      evfs__lock(PIO_LOCK_FOR(fh))
+#  define PIO_UNLOCK(fh)    evfs__unlock(PIO_LOCK_FOR(fh))
+
+#  include <stdatomic.h>
+
+static _Atomic(VfsIndex *) s_vfs_index = NULL;
+static atomic_uint s_vfs_generation = 0;
+static atomic_uint s_index_readers = 0;
+
+// Readers are counted before loading the index. With everything sequentially
+// consistent, an updater that sees no readers after publishing a new index
+// knows any later reader will get the new one.
+#  define INDEX_LOAD()        atomic_load_explicit(&s_vfs_index, memory_order_seq_cst)
+#  define INDEX_STORE(idx)    atomic_store_explicit(&s_vfs_index, (idx), memory_order_seq_cst)
+#  define READER_ENTER()      atomic_fetch_add_explicit(&s_index_readers, 1, memory_order_seq_cst)
+#  define READER_EXIT()       atomic_fetch_sub_explicit(&s_index_readers, 1, memory_order_release)
+#  define READERS_IDLE()      (atomic_load_explicit(&s_index_readers, memory_order_seq_cst) == 0)
+#  define GENERATION_LOAD()   atomic_load_explicit(&s_vfs_generation, memory_order_acquire)
+#  define GENERATION_BUMP()   atomic_fetch_add_explicit(&s_vfs_generation, 1, memory_order_release)
 
 #else
 #  define LOCK()
 #  define UNLOCK()
+#  define LOCK_SHARED()
+#  define UNLOCK_SHARED()
+#  define PIO_LOCK(fh)
+#  define PIO_UNLOCK(fh)
+
+static VfsIndex *s_vfs_index = NULL;
+static unsigned s_vfs_generation = 0;
+
+#  define INDEX_LOAD()        (s_vfs_index)
+#  define INDEX_STORE(idx)    (s_vfs_index = (idx))
+#  define READER_ENTER()
+#  define READER_EXIT()
+#  define READERS_IDLE()      true
+#  define GENERATION_LOAD()   (s_vfs_generation)
+#  define GENERATION_BUMP()   (s_vfs_generation++)
 #endif
 
+static VfsIndex *s_retired_index = NULL;
+
 // ******************** Initialization ********************
 
 static bool s_evfs_initialized = false;
@@ -49,7 +110,10 @@ static bool s_evfs_initialized = false;
 static void evfs__lib_shutdown(void) {
   evfs_unregister_all();
 #  ifdef EVFS_USE_THREADING
-  evfs__lock_destroy(&s_evfs_lock);
+  evfs__rwlock_destroy(&s_evfs_lock);
+  for(int i = 0; i < PIO_NUM_LOCKS; i++) {
+    evfs__lock_destroy(&s_pio_locks[i]);
+  }
 #  endif
 }
 #endif
@@ -58,7 +122,10 @@ static void evfs__lib_shutdown(void) {
 // This is called by the thread library specific implementation of evfs__init_once().
 void evfs__lib_init(void) {
 #ifdef EVFS_USE_THREADING
-  evfs__lock_init(&s_evfs_lock);
+  evfs__rwlock_init(&s_evfs_lock);
+  for(int i = 0; i < PIO_NUM_LOCKS; i++) {
+    evfs__lock_init(&s_pio_locks[i]);
+  }
 #endif
 #ifdef EVFS_USE_ATEXIT
   atexit(evfs__lib_shutdown);
@@ -154,6 +221,146 @@ const char *evfs_cmd_name(int cmd) {
 }
 
 
+/*
+Translate an operation code from an EvfsLatencyEvent into a string
+
+Args:
+  op: EVFS operation code
+
+Returns:
+  The corresponding string or "<unknown>"
+*/
+const char *evfs_op_name(EvfsOpId op) {
+#define EVFS_OP_NAME_CASE(E, S)  case E: return S; break;
+  switch(op) {
+    EVFS_OP_LIST(EVFS_OP_NAME_CASE);
+    default: break;
+  }
+#undef EVFS_OP_NAME_CASE
+
+  return "<unknown>";
+}
+
+
+// ******************** Latency sampling ********************
+
+#ifdef EVFS_USE_LATENCY_HOOKS
+#  include <time.h>
+
+#  ifdef EVFS_USE_USDT
+#    include <sys/sdt.h>
+#  endif
+
+#  ifndef EVFS_LATENCY_CLOCK_NS
+static uint64_t evfs__clock_ns(void) {
+  struct timespec ts;
+#    if defined CLOCK_MONOTONIC
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+#    elif defined TIME_UTC
+  timespec_get(&ts, TIME_UTC);  // Not monotonic but better than nothing
+#    else
+  return 0;
+#    endif
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+#    define EVFS_LATENCY_CLOCK_NS()  evfs__clock_ns()
+#  endif
+
+static EvfsLatencyHook s_latency_hook = NULL;
+static void *s_latency_ctx = NULL;
+static unsigned s_sample_every = 1;
+
+#  ifdef EVFS_USE_THREADING
+static atomic_uint s_sample_count = 0;
+#    define SAMPLE_NEXT()   atomic_fetch_add_explicit(&s_sample_count, 1, memory_order_relaxed)
+#  else
+static unsigned s_sample_count = 0;
+#    define SAMPLE_NEXT()   (s_sample_count++)
+#  endif
+
+// Start time of a sampled call or 0 when it isn't timed
+static inline uint64_t evfs__latency_begin(void) {
+#  ifndef EVFS_USE_USDT
+  if(!s_latency_hook) return 0;
+#  endif
+
+  unsigned every = s_sample_every;
+  if(every > 1 && SAMPLE_NEXT() % every != 0)
+    return 0;
+
+  uint64_t now = EVFS_LATENCY_CLOCK_NS();
+  return now ? now : 1;
+}
+
+static void evfs__latency_end(Evfs *vfs, EvfsOpId op, ptrdiff_t result, uint64_t start) {
+  EvfsLatencyEvent event = {
+    .vfs_name   = vfs->vfs_name,
+    .op         = op,
+    .result     = result,
+    .start_ns   = start,
+    .elapsed_ns = EVFS_LATENCY_CLOCK_NS() - start
+  };
+
+#  ifdef EVFS_USE_USDT
+  DTRACE_PROBE4(evfs, op, event.vfs_name, (int)op, (long)result, event.elapsed_ns);
+#  endif
+
+  EvfsLatencyHook hook = s_latency_hook;
+  if(hook)
+    hook(&event, s_latency_ctx);
+}
+
+#  define LATENCY_BEGIN()   uint64_t latency_start = evfs__latency_begin()
+#  define LATENCY_END(vfs, op, rval)  do { \
+    if(latency_start) evfs__latency_end((vfs), (op), (rval), latency_start); \
+  } while(0)
+// Handles embedded in shims have no VFS and aren't reported
+#  define LATENCY_END_FILE(fh, op, rval)  do { \
+    if(latency_start && (fh)->vfs) evfs__latency_end((fh)->vfs, (op), (rval), latency_start); \
+  } while(0)
+
+#else
+#  define LATENCY_BEGIN()
+#  define LATENCY_END(vfs, op, rval)
+#  define LATENCY_END_FILE(fh, op, rval)
+#endif
+
+
+/*
+Set a callback to receive the latency of calls through the EVFS API
+
+The file and filesystem functions that dispatch to a VFS time one of every
+sample_every calls and pass the result to hook. Calls made by shims on the
+files they wrap aren't reported. Member files opened by the mirror and stripe
+shims are reported under their own VFS. Set the hook before other threads
+start using the library.
+
+This is only available when EVFS_USE_LATENCY_HOOKS is defined. When
+EVFS_USE_USDT is also defined the sampled calls fire the "evfs:op" USDT
+probe whether or not a hook is set.
+
+Args:
+  hook:         Callback for sampled calls. NULL to disable
+  ctx:          User data passed to hook
+  sample_every: Report 1 in this many calls. 0 and 1 report every call
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_set_latency_hook(EvfsLatencyHook hook, void *ctx, unsigned sample_every) {
+#ifdef EVFS_USE_LATENCY_HOOKS
+  s_latency_hook = NULL;  // Don't pair the new ctx with the old hook
+  s_latency_ctx = ctx;
+  s_sample_every = sample_every;
+  s_latency_hook = hook;
+  return EVFS_OK;
+
+#else
+  return EVFS_ERR_DISABLED;
+#endif
+}
+
+
 // ******************** Internal use ********************
 
 
@@ -196,38 +403,46 @@ evfs_off_t evfs__absolute_offset(EvfsFile *fh, evfs_off_t offset, EvfsSeekDir or
 
 // ******************** Defaults for optional VFS methods ********************
 
-static int default__delete(Evfs *vfs, const char *path) {
+int evfs_default_delete(Evfs *vfs, const char *path) {
   return EVFS_ERR_NO_SUPPORT;
 }
 
-static int default__rename(Evfs *vfs, const char *old_path, const char *new_path) {
+int evfs_default_rename(Evfs *vfs, const char *old_path, const char *new_path) {
   return EVFS_ERR_NO_SUPPORT;
 }
 
-static int default__make_dir(Evfs *vfs, const char *path) {
+int evfs_default_make_dir(Evfs *vfs, const char *path) {
   return EVFS_ERR_NO_SUPPORT;
 }
 
-static int default__open_dir(Evfs *vfs, const char *path, EvfsDir *dh) {
+int evfs_default_open_dir(Evfs *vfs, const char *path, EvfsDir *dh) {
   return EVFS_ERR_NO_SUPPORT;
 }
 
 
 
-static int default__get_cur_dir(Evfs *vfs, StringRange *cur_dir) {
+int evfs_default_get_cur_dir(Evfs *vfs, StringRange *cur_dir) {
+  return EVFS_ERR_NO_SUPPORT;
+}
+
+int evfs_default_set_cur_dir(Evfs *vfs, const char *path) {
+  return EVFS_ERR_NO_SUPPORT;
+}
+
+int evfs_default_vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
   return EVFS_ERR_NO_SUPPORT;
 }
 
-static int default__set_cur_dir(Evfs *vfs, const char *path) {
+int evfs_default_copy(Evfs *vfs, EvfsFile *dest, EvfsFile *src, evfs_off_t size) {
   return EVFS_ERR_NO_SUPPORT;
 }
 
-static int default__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
+int evfs_default_batch(Evfs *vfs, EvfsBatchOp *ops, size_t num_ops) {
   return EVFS_ERR_NO_SUPPORT;
 }
 
 
-static bool default__path_root_component(Evfs *vfs, const char *path, StringRange *root) {
+bool evfs_default_path_root_component(Evfs *vfs, const char *path, StringRange *root) {
   // Only handles paths with one or more separators in the root position
   // Does not deal with DOS-style drive letters
 
@@ -239,10 +454,138 @@ static bool default__path_root_component(Evfs *vfs, const char *path, StringRang
 }
 
 
+// Fill in any missing optional methods
+static void evfs__set_default_methods(Evfs *vfs) {
+  if(!vfs->m_delete)   vfs->m_delete = evfs_default_delete;
+  if(!vfs->m_rename)   vfs->m_rename = evfs_default_rename;
+  if(!vfs->m_make_dir) vfs->m_make_dir = evfs_default_make_dir;
+  if(!vfs->m_open_dir) vfs->m_open_dir = evfs_default_open_dir;
+
+  if(!vfs->m_get_cur_dir)  vfs->m_get_cur_dir = evfs_default_get_cur_dir;
+  if(!vfs->m_set_cur_dir)  vfs->m_set_cur_dir = evfs_default_set_cur_dir;
+
+  if(!vfs->m_vfs_ctrl)     vfs->m_vfs_ctrl = evfs_default_vfs_ctrl;
+
+  if(!vfs->m_path_root_component) vfs->m_path_root_component = evfs_default_path_root_component;
+
+  if(!vfs->m_copy)         vfs->m_copy = evfs_default_copy;
+  if(!vfs->m_batch)        vfs->m_batch = evfs_default_batch;
+}
+
+
 
 // ******************** VFS registration ********************
 
 
+static void destroy_vfs_entry(dhKey key, void *value, void *ctx) {
+}
+
+
+// Build a new index snapshot from the VFS list
+// Must be called with the lock held
+static VfsIndex *evfs__build_index(void) {
+  size_t num_vfs = 0;
+  size_t names_len = 0;
+  for(Evfs *cur_vfs = s_vfs_list; cur_vfs; cur_vfs = cur_vfs->next) {
+    num_vfs++;
+    names_len += strlen(cur_vfs->vfs_name) + 1;
+  }
+
+  if(num_vfs == 0)
+    return NULL;
+
+  dhConfig hash_cfg = {
+    .init_buckets = num_vfs * 2,
+    .value_size   = sizeof(Evfs *),
+
+    .destroy_item = destroy_vfs_entry,
+    .gen_hash     = dh_gen_hash_string,
+    .is_equal     = dh_equal_hash_keys_string
+  };
+
+  // Keys are copied into the snapshot since retired snapshots can outlive
+  // the VFS objects they were built from.
+  VfsIndex *idx = evfs_malloc(sizeof(*idx) + names_len);
+  if(MEM_CHECK(idx)) return NULL;
+
+  idx->next_retired = NULL;
+  char *names = (char *)NEXT_OBJ(idx);
+
+  if(!dh_init(&idx->hash, &hash_cfg, NULL)) {
+    evfs_free(idx);
+    return NULL;
+  }
+
+  for(Evfs *cur_vfs = s_vfs_list; cur_vfs; cur_vfs = cur_vfs->next) {
+    size_t name_len = strlen(cur_vfs->vfs_name);
+    memcpy(names, cur_vfs->vfs_name, name_len+1);
+    dhKey key = {.data = names, .length = name_len};
+    names += name_len+1;
+
+    // Robin Hood insertion swaps values through the argument so pass a copy
+    Evfs *value = cur_vfs;
+    if(!dh_insert(&idx->hash, key, &value)) {
+      dh_free(&idx->hash);
+      evfs_free(idx);
+      return NULL;
+    }
+  }
+
+  return idx;
+}
+
+
+// Free retired snapshots
+// Must be called with the lock held after the current index has been published
+static void evfs__reclaim_index(void) {
+  // Readers that arrive after this check can only see the current index
+  if(!READERS_IDLE())
+    return; // Try again on the next update
+
+  while(s_retired_index) {
+    VfsIndex *idx = s_retired_index;
+    s_retired_index = idx->next_retired;
+    dh_free(&idx->hash);
+    evfs_free(idx);
+  }
+}
+
+
+// Publish a fresh index after the VFS list or default VFS has changed
+// Must be called with the lock held
+static void evfs__update_index(void) {
+  VfsIndex *old_idx = INDEX_LOAD();
+
+  // On alloc failure a NULL index sends lookups to the locked list search
+  INDEX_STORE(evfs__build_index());
+
+  if(old_idx) {
+    old_idx->next_retired = s_retired_index;
+    s_retired_index = old_idx;
+  }
+
+  GENERATION_BUMP();
+  evfs__reclaim_index();
+}
+
+
+// Free all index snapshots
+static void evfs__free_index(void) {
+  LOCK();
+  VfsIndex *idx = INDEX_LOAD();
+  INDEX_STORE(NULL);
+
+  if(idx) {
+    idx->next_retired = s_retired_index;
+    s_retired_index = idx;
+  }
+
+  GENERATION_BUMP();
+  evfs__reclaim_index();
+  UNLOCK();
+}
+
+
 /*
 Search for a VFS by name
 
@@ -256,16 +599,28 @@ Evfs *evfs_find_vfs(const char *vfs_name) {
   if(PTR_CHECK(vfs_name)) return NULL;
   Evfs *rval = NULL;
 
-  LOCK();
+  READER_ENTER();
+  VfsIndex *idx = INDEX_LOAD();
+  if(idx) { // Fast path without locking
+    dhKey key = {.data = vfs_name, .length = strlen(vfs_name)};
+    dh_lookup(&idx->hash, key, &rval);
+    READER_EXIT();
+    return rval;
+  }
+  READER_EXIT();
+
+  LOCK_SHARED();
   Evfs *cur_vfs = s_vfs_list;
 
   while(cur_vfs) {
-    if(!strcmp(cur_vfs->vfs_name, vfs_name))
+    if(!strcmp(cur_vfs->vfs_name, vfs_name)) {
       rval = cur_vfs;
+      break;
+    }
 
     cur_vfs = cur_vfs->next;
   }
-  UNLOCK();
+  UNLOCK_SHARED();
 
   return rval;
 }
@@ -285,6 +640,34 @@ static Evfs *evfs__get_vfs(const char *vfs_name) {
 }
 
 
+/*
+Resolve a VFS reference
+
+The reference caches the result of a name lookup. It is only searched again
+after a VFS has been registered or unregistered. Initialize references with
+EVFS_VFS_REF(). A NULL name or a name that doesn't match a registered VFS
+resolves to the default VFS just as with the ``*_ex()`` functions.
+
+Args:
+  ref: Reference to resolve
+
+Returns:
+  The referenced VFS object or NULL if no VFS is registered
+*/
+Evfs *evfs_vfs_ref_resolve(EvfsVfsRef *ref) {
+  if(PTR_CHECK(ref)) return NULL;
+
+  unsigned generation = GENERATION_LOAD();
+
+  if(!ref->vfs || ref->generation != generation) {
+    ref->vfs = evfs__get_vfs(ref->vfs_name);
+    ref->generation = generation;
+  }
+
+  return ref->vfs;
+}
+
+
 /*
 Get the name of a VFS object
 
@@ -368,6 +751,7 @@ int evfs_register(Evfs *vfs, bool make_default) {
     }
 
     if(!new_vfs) {
+      GENERATION_BUMP(); // Default may have changed
       UNLOCK();
     }
 
@@ -381,21 +765,77 @@ int evfs_register(Evfs *vfs, bool make_default) {
 
 
   if(new_vfs) {
-    // Fill in any missing optional methods
-    if(!vfs->m_delete)   vfs->m_delete = default__delete;
-    if(!vfs->m_rename)   vfs->m_rename = default__rename;
-    if(!vfs->m_make_dir) vfs->m_make_dir = default__make_dir;
-    if(!vfs->m_open_dir) vfs->m_open_dir = default__open_dir;
+    evfs__set_default_methods(vfs);
+    evfs__update_index();
+    UNLOCK();
+  }
 
-    if(!vfs->m_get_cur_dir)  vfs->m_get_cur_dir = default__get_cur_dir;
-    if(!vfs->m_set_cur_dir)  vfs->m_set_cur_dir = default__set_cur_dir;
+  return EVFS_OK;
+}
 
-    if(!vfs->m_vfs_ctrl)     vfs->m_vfs_ctrl = default__vfs_ctrl;
 
-    if(!vfs->m_path_root_component) vfs->m_path_root_component = default__path_root_component;
-    UNLOCK();
+/*
+Register a table of VFS objects defined at compile time
+
+Backends with static definitions fill in all of their methods in the
+initializers so nothing is allocated or patched here. The table entries are
+linked into the VFS list in order and sent EVFS_CMD_STATIC_INIT to set up any
+runtime state. When the table is the first thing registered, no lookup index
+is built and VFS names are found by scanning the short list.
+
+Static VFSs are sent EVFS_CMD_UNREGISTER when they are removed but their
+memory isn't freed.
+
+This will fail if evfs_init() hasn't been called.
+
+Args:
+  vfs_table:   Array of static VFSs
+  num_vfs:     Number of VFSs in vfs_table
+  default_ix:  Index of the VFS to make default
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_register_static(Evfs * const vfs_table[], size_t num_vfs, size_t default_ix) {
+  if(PTR_CHECK(vfs_table) || num_vfs == 0 || default_ix >= num_vfs) return EVFS_ERR_BAD_ARG;
+
+  // Check if evfs_init() was called
+  if(!s_evfs_initialized) THROW(EVFS_ERR_INIT);
+
+  for(size_t i = 0; i < num_vfs; i++) {
+    Evfs *vfs = vfs_table[i];
+    if(PTR_CHECK(vfs) || PTR_CHECK(vfs->m_open) || PTR_CHECK(vfs->m_stat)) return EVFS_ERR_BAD_ARG;
+
+    vfs->is_static = true;
+    evfs__set_default_methods(vfs);
+
+    int status = vfs->m_vfs_ctrl(vfs, EVFS_CMD_STATIC_INIT, NULL);
+    if(status != EVFS_OK && status != EVFS_ERR_NO_SUPPORT) {
+      // Release any VFSs already initialized
+      while(i-- > 0) {
+        vfs_table[i]->m_vfs_ctrl(vfs_table[i], EVFS_CMD_UNREGISTER, NULL);
+      }
+      THROW(status);
+    }
+  }
+
+  LOCK();
+  for(size_t i = 0; i < num_vfs-1; i++) {
+    vfs_table[i]->next = vfs_table[i+1];
   }
 
+  bool had_vfs = s_vfs_list != NULL;
+
+  vfs_table[num_vfs-1]->next = s_vfs_list;
+  s_vfs_list = vfs_table[0];
+  s_default_vfs = vfs_table[default_ix];
+
+  if(had_vfs) // Keep the existing index current
+    evfs__update_index();
+  else
+    GENERATION_BUMP();
+  UNLOCK();
+
   return EVFS_OK;
 }
 
@@ -429,12 +869,16 @@ int evfs_unregister(Evfs *vfs) {
 
       cur_vfs->next = NULL;
 
+      evfs_vfs_pool_free(vfs);
+
       // Notify the VFS it is unregistered
       vfs->m_vfs_ctrl(vfs, EVFS_CMD_UNREGISTER, NULL);
 
       if(s_default_vfs == vfs) // Set new default if needed
         s_default_vfs = s_vfs_list;
 
+      evfs__update_index();
+
       rval = EVFS_OK;
       break;
     }
@@ -454,6 +898,9 @@ int evfs_unregister(Evfs *vfs) {
 
 /*
 Unregister all registered VFS objects
+
+This also releases the retired VFS lookup indices. No other threads should
+be accessing the library when this is called.
 */
 void evfs_unregister_all(void) {
   Evfs *cur_vfs = s_vfs_list;
@@ -464,6 +911,8 @@ void evfs_unregister_all(void) {
     evfs_unregister(cur_vfs);
     cur_vfs = next_vfs;
   }
+
+  evfs__free_index();
 }
 
 
@@ -473,6 +922,10 @@ void evfs_unregister_all(void) {
 /*
 Open a file
 
+The mode flags can include one access pattern hint: EVFS_SEQUENTIAL,
+EVFS_RANDOM, EVFS_WILL_NEED, or EVFS_WRITE_ONCE. It is applied to the new
+file with EVFS_CMD_SET_FILE_ADVICE.
+
 Args:
   path:     Filesystem path to the file
   fh:       Handle for successfully opened file
@@ -504,14 +957,29 @@ Returns:
   EVFS_OK on success
 */
 int evfs_vfs_open(Evfs *vfs, const char *path, EvfsFile **fh, int flags) {
-  *fh = (EvfsFile *)evfs_malloc(vfs->vfs_file_size);
+  *fh = (EvfsFile *)evfs__alloc_handle(vfs, vfs->file_pool, vfs->vfs_file_size);
   if(MEM_CHECK(*fh)) return EVFS_ERR_ALLOC;
 
-  int rval = vfs->m_open(vfs, path, *fh, flags);
+#if defined EVFS_USE_IO_STATS || defined EVFS_USE_LATENCY_HOOKS
+  // Clears the fields of base files embedded in shim handles too
+  memset(*fh, 0, vfs->vfs_file_size);
+#endif
+#ifdef EVFS_USE_LATENCY_HOOKS
+  (*fh)->vfs = vfs;
+#endif
+
+  // Access hints aren't passed to m_open()
+  unsigned advice = (flags & EVFS_ADVICE_MASK) >> 8;
+  LATENCY_BEGIN();
+  int rval = vfs->m_open(vfs, path, *fh, flags & ~EVFS_ADVICE_MASK);
+  LATENCY_END(vfs, EVFS_OP_OPEN, rval);
 
   if(rval != EVFS_OK) {
-    evfs_free(*fh);
+    evfs__free_handle(*fh);
     *fh = NULL;
+
+  } else if(advice != EVFS_ADVICE_NORMAL) { // Hints are advisory so failures are ignored
+    (*fh)->methods->m_ctrl(*fh, EVFS_CMD_SET_FILE_ADVICE, &advice);
   }
 
   return rval;
@@ -537,7 +1005,11 @@ int evfs_stat_ex(const char *path, EvfsInfo *info, const char *vfs_name) {
   Evfs *vfs = evfs__get_vfs(vfs_name);
   if(!vfs) THROW(EVFS_ERR_NO_VFS);
 
-  return vfs->m_stat(vfs, path, info);
+  LATENCY_BEGIN();
+  int rval = vfs->m_stat(vfs, path, info);
+  LATENCY_END(vfs, EVFS_OP_STAT, rval);
+
+  return rval;
 }
 
 
@@ -599,7 +1071,11 @@ int evfs_delete_ex(const char *path, const char *vfs_name) {
   Evfs *vfs = evfs__get_vfs(vfs_name);
   if(!vfs) THROW(EVFS_ERR_NO_VFS);
 
-  return vfs->m_delete(vfs, path);
+  LATENCY_BEGIN();
+  int rval = vfs->m_delete(vfs, path);
+  LATENCY_END(vfs, EVFS_OP_DELETE, rval);
+
+  return rval;
 }
 
 /*
@@ -621,7 +1097,11 @@ int evfs_rename_ex(const char *old_path, const char *new_path, const char *vfs_n
   Evfs *vfs = evfs__get_vfs(vfs_name);
   if(!vfs) THROW(EVFS_ERR_NO_VFS);
 
-  return vfs->m_rename(vfs, old_path, new_path);
+  LATENCY_BEGIN();
+  int rval = vfs->m_rename(vfs, old_path, new_path);
+  LATENCY_END(vfs, EVFS_OP_RENAME, rval);
+
+  return rval;
 }
 
 /*
@@ -639,57 +1119,38 @@ int evfs_make_dir_ex(const char *path, const char *vfs_name) {
   Evfs *vfs = evfs__get_vfs(vfs_name);
   if(!vfs) THROW(EVFS_ERR_NO_VFS);
 
-  return vfs->m_make_dir(vfs, path);
-}
-
-
-/*
-Make a complete path to a nested directory
+  LATENCY_BEGIN();
+  int rval = vfs->m_make_dir(vfs, path);
+  LATENCY_END(vfs, EVFS_OP_MAKE_DIR, rval);
 
-Any missing directories in the path will be created.
+  return rval;
+}
 
-Args:
-  path:     Filesystem path to a directory
-  vfs_name: VFS to work on. Use default VFS if NULL
 
-Returns:
-  EVFS_OK on success
-*/
-int evfs_make_path_ex(const char *path, const char *vfs_name) {
-  if(PTR_CHECK(path)) return EVFS_ERR_BAD_ARG;
+// True when every directory in path is also in known_dirs
+static bool evfs__known_dir(const char *known_dirs, const char *path) {
+  if(!known_dirs) return false;
 
-  StringRange path_r;
-  range_init(&path_r, (char *)path, strlen(path)+1);
-  return evfs_make_path_range_ex(&path_r, vfs_name);
+  size_t len = strlen(path);
+  return strncmp(known_dirs, path, len) == 0
+    && (known_dirs[len] == '\0' || strchr(EVFS_PATH_SEPS, known_dirs[len]));
 }
 
 
 /*
-Make a complete path to a nested directory
-
-Any missing directories in the path will be created.
-
-This variant takes a StringRange object as the path. This allows the directory
-portion of a file path as generated by evfs_path_dirname() to be referenced as
-a substring without making a copy.
+Create any missing directories in path
 
 Args:
-  path:     Filesystem path to a directory
-  vfs_name: VFS to work on. Use default VFS if NULL
+  vfs:        VFS to work on
+  path:       Filesystem path to a directory
+  cur_path:   Buffer for sub-paths. Must be one larger than path
+  known_dirs: Path to a directory known to exist. Use NULL if there is none
 
 Returns:
-  EVFS_OK on success
+  EVFS_OK on success. The full path is left in cur_path.
 */
-int evfs_make_path_range_ex(StringRange *path, const char *vfs_name) {
-  if(PTR_CHECK(path)) return EVFS_ERR_BAD_ARG;
-  Evfs *vfs = evfs__get_vfs(vfs_name);
-  if(!vfs) THROW(EVFS_ERR_NO_VFS);
-
+static int evfs__make_path(Evfs *vfs, StringRange *path, char *cur_path, const char *known_dirs) {
   size_t path_len = range_size(path);
-  int rval = EVFS_OK;
-
-  char *cur_path = evfs_malloc(path_len+1); // Buffer to hold sub-paths
-  if(MEM_CHECK(cur_path)) return EVFS_ERR_ALLOC;
 
   // Use string range to concatenate each path segment
   AppendRange cur_path_r;
@@ -713,61 +1174,234 @@ int evfs_make_path_range_ex(StringRange *path, const char *vfs_name) {
   bool new_tok = range_token_limit(path->start, EVFS_PATH_SEPS, &token, &limit);
   while(new_tok) {
     range_cat_range(&cur_path_r, &token); // Append new token
-    EvfsInfo info;
-    int err = vfs->m_stat(vfs, cur_path, &info);
-
-    if(err == EVFS_ERR_NO_FILE) { // Path segment missing
-      err = vfs->m_make_dir(vfs, cur_path);
-      if(err != EVFS_OK) { // New segment not made
-        rval = err;
-        goto cleanup;
+
+    if(!evfs__known_dir(known_dirs, cur_path)) {
+      EvfsInfo info;
+      int err = vfs->m_stat(vfs, cur_path, &info);
+
+      if(err == EVFS_ERR_NO_FILE) { // Path segment missing
+        err = vfs->m_make_dir(vfs, cur_path);
+        if(err != EVFS_OK) // New segment not made
+          return err;
+      } else if(err != EVFS_OK) { // Can't get status of segment
+        return err;
       }
-    } else if(err != EVFS_OK) { // Can't get status of segment
-      rval = err;
-      goto cleanup;
     }
 
     range_cat_char(&cur_path_r, EVFS_DIR_SEP);
     new_tok = range_token_limit(NULL, EVFS_PATH_SEPS, &token, &limit);
   }
 
-cleanup:
-  evfs_free(cur_path);
-  return rval;
+  return EVFS_OK;
 }
 
 
 /*
-Open a directory
+Make a complete path to a nested directory
+
+Any missing directories in the path will be created.
 
 Args:
-  path:     Filesystem path to the directory
-  dh:       Handle for successfully opened directory
+  path:     Filesystem path to a directory
   vfs_name: VFS to work on. Use default VFS if NULL
 
 Returns:
   EVFS_OK on success
 */
-int evfs_open_dir_ex(const char *path, EvfsDir **dh, const char *vfs_name) {
-  if(PTR_CHECK(path) || PTR_CHECK(dh)) return EVFS_ERR_BAD_ARG;
-  Evfs *vfs = evfs__get_vfs(vfs_name);
-  if(!vfs) THROW(EVFS_ERR_NO_VFS);
+int evfs_make_path_ex(const char *path, const char *vfs_name) {
+  if(PTR_CHECK(path)) return EVFS_ERR_BAD_ARG;
 
-  if(vfs->m_open_dir == default__open_dir) return EVFS_ERR_NO_SUPPORT; // Avoid wasted malloc()
+  StringRange path_r;
+  range_init(&path_r, (char *)path, strlen(path)+1);
+  return evfs_make_path_range_ex(&path_r, vfs_name);
+}
 
 
-  *dh = (EvfsDir *)evfs_malloc(vfs->vfs_dir_size);
-  if(MEM_CHECK(*dh)) return EVFS_ERR_ALLOC;
+/*
+Make a complete path to a nested directory
 
-  int rval = vfs->m_open_dir(vfs, path, *dh);
+Any missing directories in the path will be created.
 
-  if(rval != EVFS_OK) {
-    evfs_free(*dh);
-    *dh = NULL;
-  }
+This variant takes a StringRange object as the path. This allows the directory
+portion of a file path as generated by evfs_path_dirname() to be referenced as
+a substring without making a copy.
 
-  return rval;
-}
+Args:
+  path:     Filesystem path to a directory
+  vfs_name: VFS to work on. Use default VFS if NULL
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_make_path_range_ex(StringRange *path, const char *vfs_name) {
+  if(PTR_CHECK(path)) return EVFS_ERR_BAD_ARG;
+  Evfs *vfs = evfs__get_vfs(vfs_name);
+  if(!vfs) THROW(EVFS_ERR_NO_VFS);
+
+  char *cur_path = evfs_class_malloc(EVFS_ALLOC_PATH, range_size(path)+1); // Buffer to hold sub-paths
+  if(MEM_CHECK(cur_path)) return EVFS_ERR_ALLOC;
+
+  int rval = evfs__make_path(vfs, path, cur_path, NULL);
+
+  evfs_class_free(EVFS_ALLOC_PATH, cur_path);
+  return rval;
+}
+
+
+/*
+Run batch operations one at a time with the methods of a VFS
+
+This is used for VFSs without an m_batch method. Backends can also call it from
+their own m_batch after setting up a common context for the operations.
+Parent directories created or found by EVFS_BATCH_MAKE_PATH are not checked
+again by the next one until a delete or rename intervenes.
+
+Args:
+  vfs:      VFS to work on
+  ops:      Array of operations
+  num_ops:  Number of operations in ops
+
+Returns:
+  Number of failed operations on success or a negative error code
+*/
+int evfs_batch_generic(Evfs *vfs, EvfsBatchOp *ops, size_t num_ops) {
+  if(PTR_CHECK(vfs) || (num_ops > 0 && PTR_CHECK(ops))) return EVFS_ERR_BAD_ARG;
+
+  // One pair of buffers serves every EVFS_BATCH_MAKE_PATH
+  size_t max_len = 0;
+  for(size_t i = 0; i < num_ops; i++) {
+    if(ops[i].op == EVFS_BATCH_MAKE_PATH && ops[i].path)
+      max_len = MAX(max_len, strlen(ops[i].path)+1);
+  }
+
+  char *cur_path = NULL;
+  char *known_dirs = NULL;
+  if(max_len > 0) {
+    cur_path = evfs_class_malloc(EVFS_ALLOC_PATH, 2*(max_len+1));
+    if(MEM_CHECK(cur_path)) return EVFS_ERR_ALLOC;
+    known_dirs = cur_path + max_len+1;
+    known_dirs[0] = '\0';
+  }
+
+  int failed = 0;
+
+  for(size_t i = 0; i < num_ops; i++) {
+    EvfsBatchOp *op = &ops[i];
+    int status = EVFS_ERR_BAD_ARG;
+
+    if(op->path) {
+      switch(op->op) {
+      case EVFS_BATCH_STAT:
+        if(!op->info) break;
+        status = vfs->m_stat(vfs, op->path, op->info);
+        op->info->name = NULL; // Not stable across operations
+        break;
+
+      case EVFS_BATCH_DELETE:
+        status = vfs->m_delete(vfs, op->path);
+        if(known_dirs) known_dirs[0] = '\0';
+        break;
+
+      case EVFS_BATCH_RENAME:
+        if(!op->new_path) break;
+        status = vfs->m_rename(vfs, op->path, op->new_path);
+        if(known_dirs) known_dirs[0] = '\0';
+        break;
+
+      case EVFS_BATCH_MAKE_DIR:
+        status = vfs->m_make_dir(vfs, op->path);
+        break;
+
+      case EVFS_BATCH_MAKE_PATH:
+        {
+          StringRange path_r;
+          range_init(&path_r, (char *)op->path, strlen(op->path)+1);
+          status = evfs__make_path(vfs, &path_r, cur_path, known_dirs);
+          if(status == EVFS_OK)
+            strcpy(known_dirs, cur_path);
+        }
+        break;
+
+      default:
+        break;
+      }
+    }
+
+    op->status = status;
+    if(status != EVFS_OK)
+      failed++;
+  }
+
+  evfs_class_free(EVFS_ALLOC_PATH, cur_path);
+  return failed;
+}
+
+
+/*
+Run an array of metadata operations
+
+The operations are run in order and the result of each is stored in its status
+field. A failed operation doesn't stop the ones after it. VFSs can run the whole
+batch under one lock and commit their metadata once at the end. Others run each
+operation in turn. Shims run the batch through their own methods.
+
+Args:
+  ops:      Array of operations
+  num_ops:  Number of operations in ops
+  vfs_name: VFS to work on. Use default VFS if NULL
+
+Returns:
+  Number of failed operations on success or a negative error code when the
+  batch couldn't be run or committed
+*/
+int evfs_batch_ex(EvfsBatchOp *ops, size_t num_ops, const char *vfs_name) {
+  if(num_ops > 0 && PTR_CHECK(ops)) return EVFS_ERR_BAD_ARG;
+  Evfs *vfs = evfs__get_vfs(vfs_name);
+  if(!vfs) THROW(EVFS_ERR_NO_VFS);
+
+  LATENCY_BEGIN();
+  int rval = vfs->m_batch(vfs, ops, num_ops);
+  if(rval == EVFS_ERR_NO_SUPPORT)
+    rval = evfs_batch_generic(vfs, ops, num_ops);
+  LATENCY_END(vfs, EVFS_OP_BATCH, rval < 0 ? rval : EVFS_OK);
+
+  return rval;
+}
+
+
+/*
+Open a directory
+
+Args:
+  path:     Filesystem path to the directory
+  dh:       Handle for successfully opened directory
+  vfs_name: VFS to work on. Use default VFS if NULL
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_open_dir_ex(const char *path, EvfsDir **dh, const char *vfs_name) {
+  if(PTR_CHECK(path) || PTR_CHECK(dh)) return EVFS_ERR_BAD_ARG;
+  Evfs *vfs = evfs__get_vfs(vfs_name);
+  if(!vfs) THROW(EVFS_ERR_NO_VFS);
+
+  if(vfs->m_open_dir == evfs_default_open_dir) return EVFS_ERR_NO_SUPPORT; // Avoid wasted malloc()
+
+
+  *dh = (EvfsDir *)evfs__alloc_handle(vfs, vfs->dir_pool, vfs->vfs_dir_size);
+  if(MEM_CHECK(*dh)) return EVFS_ERR_ALLOC;
+
+  LATENCY_BEGIN();
+  int rval = vfs->m_open_dir(vfs, path, *dh);
+  LATENCY_END(vfs, EVFS_OP_OPEN_DIR, rval);
+
+  if(rval != EVFS_OK) {
+    evfs__free_handle(*dh);
+    *dh = NULL;
+  }
+
+  return rval;
+}
 
 
 /*
@@ -782,16 +1416,18 @@ Returns:
   EVFS_OK on success
 */
 int evfs_vfs_open_dir(Evfs *vfs, const char *path, EvfsDir **dh) {
-  if(vfs->m_open_dir == default__open_dir) return EVFS_ERR_NO_SUPPORT; // Avoid wasted malloc()
+  if(vfs->m_open_dir == evfs_default_open_dir) return EVFS_ERR_NO_SUPPORT; // Avoid wasted malloc()
 
 
-  *dh = (EvfsDir *)evfs_malloc(vfs->vfs_dir_size);
+  *dh = (EvfsDir *)evfs__alloc_handle(vfs, vfs->dir_pool, vfs->vfs_dir_size);
   if(MEM_CHECK(*dh)) return EVFS_ERR_ALLOC;
 
+  LATENCY_BEGIN();
   int rval = vfs->m_open_dir(vfs, path, *dh);
+  LATENCY_END(vfs, EVFS_OP_OPEN_DIR, rval);
 
   if(rval != EVFS_OK) {
-    evfs_free(*dh);
+    evfs__free_handle(*dh);
     *dh = NULL;
   }
 
@@ -866,19 +1502,25 @@ int evfs_vfs_ctrl_ex(int cmd, void *arg, const char *vfs_name) {
 }
 
 
-// Minimum size of internal transfer buffer for copied data
+// Size of internal transfer buffer for copied data
+// This is a whole sector for FatFs and littlefs images.
 #define MIN_COPY_BUF_SIZE 64
+#define DEFAULT_COPY_BUF_SIZE 512
 
 /*
 Copy contents of an open file to a new file
 
-This allows you to transfer files across different VFSs.
+This allows you to transfer files across different VFSs. Data is copied from
+the current position of fh to its end. The destination VFS can offload the copy
+when it supports it. Sources that can be mapped with evfs_file_map() are written
+directly without an intermediate buffer.
 
 Args:
   dest_path:  Path to the new copy
   fh:         Open file to copy from
   buf:        Buffer to use for transfers. Use NULL to malloc a temp buffer.
   buf_size:   Size of buf array. When buf is NULL this is the size to allocate.
+              Use 0 to allocate a default size.
   vfs_name:   VFS to work on. Use default VFS if NULL
 
 Returns:
@@ -896,11 +1538,39 @@ int evfs_copy_to_file_ex(const char *dest_path, EvfsFile *fh, char *buf, size_t
   int rval = evfs_vfs_open(vfs, dest_path, &dest_fh, flags);
   if(rval != EVFS_OK) return rval;
 
+  evfs_off_t src_pos = evfs_file_tell(fh);
+  evfs_off_t copy_size = evfs_file_size(fh) - src_pos;
+  if(src_pos < 0 || copy_size < 0) {
+    rval = EVFS_ERR_IO;
+    goto cleanup;
+  }
+
+  // Let the destination offload the copy
+  rval = vfs->m_copy(vfs, dest_fh, fh, copy_size);
+  if(rval != EVFS_ERR_NO_SUPPORT)
+    goto cleanup;
+
+  // Write straight from mapped source data
+  EvfsMapping map;
+  if(evfs_file_map(fh, src_pos, copy_size, &map) == EVFS_OK) {
+    ptrdiff_t wrote = 0;
+    if(map.size > 0)
+      wrote = evfs_file_write(dest_fh, map.data, map.size);
+
+    rval = wrote == (ptrdiff_t)map.size ? EVFS_OK : (wrote < 0 ? wrote : EVFS_ERR_IO);
+    evfs_file_unmap(fh, &map);
+
+    if(rval == EVFS_OK)
+      evfs_file_seek(fh, src_pos + wrote, EVFS_SEEK_TO);
+    goto cleanup;
+  }
+
 
   bool alloc_buf = false;
+  rval = EVFS_OK;
 
   if(!buf) { // Allocate a buffer
-    buf_size = MAX(buf_size, MIN_COPY_BUF_SIZE);
+    buf_size = buf_size > 0 ? MAX(buf_size, MIN_COPY_BUF_SIZE) : DEFAULT_COPY_BUF_SIZE;
     buf = evfs_malloc(buf_size);
     if(MEM_CHECK(buf)) {
       rval = EVFS_ERR_ALLOC;
@@ -910,17 +1580,15 @@ int evfs_copy_to_file_ex(const char *dest_path, EvfsFile *fh, char *buf, size_t
     alloc_buf = true;
   }
 
-  size_t copy_size = evfs_file_size(fh);
-
   while(copy_size > 0) {
-    size_t read_size = MIN(copy_size, buf_size);
-    int read = evfs_file_read(fh, buf, read_size);
+    size_t read_size = MIN((size_t)copy_size, buf_size);
+    ptrdiff_t read = evfs_file_read(fh, buf, read_size);
     if(read <= 0) {
       rval = read < 0 ? read : EVFS_ERR_IO;
       break;
     }
 
-    int wrote = evfs_file_write(dest_fh, buf, read);
+    ptrdiff_t wrote = evfs_file_write(dest_fh, buf, read);
     if(wrote != read) {
       rval = wrote < 0 ? wrote : EVFS_ERR_IO;
       break;
@@ -1127,11 +1795,56 @@ bool evfs_vfs_path_is_absolute(Evfs *vfs, const char *path) {
 
 // ******************** File access methods ********************
 
+// ******************** I/O statistics ********************
+
+#ifdef EVFS_USE_IO_STATS
+static inline ptrdiff_t evfs__count_read(EvfsFile *fh, ptrdiff_t rval) {
+  fh->io.reads++;
+  if(rval < 0)
+    fh->io.errors++;
+  else
+    fh->io.bytes_read += rval;
+
+  return rval;
+}
+
+static inline ptrdiff_t evfs__count_write(EvfsFile *fh, ptrdiff_t rval) {
+  fh->io.writes++;
+  if(rval < 0)
+    fh->io.errors++;
+  else
+    fh->io.bytes_written += rval;
+
+  return rval;
+}
+
+static inline int evfs__count_op(EvfsFile *fh, uint32_t *counter, int rval) {
+  (*counter)++;
+  if(rval < 0)
+    fh->io.errors++;
+
+  return rval;
+}
+
+#  define COUNT_READ(fh, rval)      evfs__count_read((fh), (rval))
+#  define COUNT_WRITE(fh, rval)     evfs__count_write((fh), (rval))
+#  define COUNT_OP(fh, ctr, rval)   evfs__count_op((fh), &(fh)->io.ctr, (rval))
+#else
+#  define COUNT_READ(fh, rval)      (rval)
+#  define COUNT_WRITE(fh, rval)     (rval)
+#  define COUNT_OP(fh, ctr, rval)   (rval)
+#endif
+
+
 /*
 Generic configuration control for a file object
 
 See the definition of commands in evfs.h for the expected type to pass as arg
 
+The EVFS_CMD_GET_IO_STATS command is answered here with the counters kept for
+fh when EVFS_USE_IO_STATS is enabled. It is then passed down through any shims
+so they can add their own counts to the EvfsIOStats fields that follow io.
+
 Args:
   fh:  The file to receive the command
   cmd: Command number for the operation to perform
@@ -1141,6 +1854,20 @@ Returns:
   EVFS_OK on success
 */
 int evfs_file_ctrl(EvfsFile *fh, int cmd, void *arg) {
+#ifdef EVFS_USE_IO_STATS
+  if(cmd == EVFS_CMD_GET_IO_STATS) {
+    if(PTR_CHECK(fh) || PTR_CHECK(arg)) return EVFS_ERR_BAD_ARG;
+
+    EvfsIOStats *stats = (EvfsIOStats *)arg;
+    memset(stats, 0, sizeof(*stats));
+    stats->io = fh->io;
+
+    // Filesystems without extra counts return EVFS_ERR_NO_SUPPORT
+    fh->methods->m_ctrl(fh, cmd, arg);
+    return EVFS_OK;
+  }
+#endif
+
   return fh->methods->m_ctrl(fh, cmd, arg);
 }
 
@@ -1156,9 +1883,11 @@ Returns:
 */
 int evfs_file_close(EvfsFile *fh) {
   if(PTR_CHECK(fh)) return EVFS_ERR_BAD_ARG;
+  LATENCY_BEGIN();
   int rval = fh->methods->m_close(fh);
+  LATENCY_END_FILE(fh, EVFS_OP_CLOSE, rval);
 
-  evfs_free(fh);
+  evfs__free_handle(fh);
 
   return rval;
 }
@@ -1177,7 +1906,11 @@ Returns:
 */
 ptrdiff_t evfs_file_read(EvfsFile *fh, void *buf, size_t size) {
   if(PTR_CHECK(fh) || PTR_CHECK(buf)) return EVFS_ERR_BAD_ARG;
-  return fh->methods->m_read(fh, buf, size);
+  LATENCY_BEGIN();
+  ptrdiff_t rval = fh->methods->m_read(fh, buf, size);
+  LATENCY_END_FILE(fh, EVFS_OP_READ, rval);
+
+  return COUNT_READ(fh, rval);
 }
 
 /*
@@ -1193,7 +1926,266 @@ Returns:
 */
 ptrdiff_t evfs_file_write(EvfsFile *fh, const void *buf, size_t size) {
   if(PTR_CHECK(fh) || PTR_CHECK(buf)) return EVFS_ERR_BAD_ARG;
-  return fh->methods->m_write(fh, buf, size);
+  LATENCY_BEGIN();
+  ptrdiff_t rval = fh->methods->m_write(fh, buf, size);
+  LATENCY_END_FILE(fh, EVFS_OP_WRITE, rval);
+
+  return COUNT_WRITE(fh, rval);
+}
+
+
+// Emulate positional I/O with seek, read or write, and restore of the file position
+// All emulated access is serialized so that files only accessed this way are
+// safe to share between threads.
+static ptrdiff_t evfs__transfer_at(EvfsFile *fh, void *buf, size_t size, evfs_off_t offset, bool write) {
+  ptrdiff_t rval;
+
+  PIO_LOCK(fh);
+  evfs_off_t prev_pos = fh->methods->m_tell(fh);
+
+  rval = fh->methods->m_seek(fh, offset, EVFS_SEEK_TO);
+  if(rval == EVFS_OK) {
+    if(write)
+      rval = fh->methods->m_write(fh, buf, size);
+    else
+      rval = fh->methods->m_read(fh, buf, size);
+
+    fh->methods->m_seek(fh, prev_pos, EVFS_SEEK_TO);
+  }
+  PIO_UNLOCK(fh);
+
+  return rval;
+}
+
+
+/*
+Read data from a file at a specific offset
+
+The current file position is not changed. This is emulated with seek and
+read operations on files that don't support it natively.
+
+Args:
+  fh:     The file to read
+  buf:    Buffer for read data
+  size:   Size of buf
+  offset: Absolute position in the file to read from
+
+Returns:
+  Number of bytes read on success or negative error code on failure
+*/
+ptrdiff_t evfs_file_read_at(EvfsFile *fh, void *buf, size_t size, evfs_off_t offset) {
+  if(PTR_CHECK(fh) || PTR_CHECK(buf)) return EVFS_ERR_BAD_ARG;
+  if(offset < 0) THROW(EVFS_ERR_INVALID);
+
+  LATENCY_BEGIN();
+  ptrdiff_t rval;
+  if(fh->methods->m_read_at)
+    rval = fh->methods->m_read_at(fh, buf, size, offset);
+  else
+    rval = evfs__transfer_at(fh, buf, size, offset, /*write*/ false);
+  LATENCY_END_FILE(fh, EVFS_OP_READ_AT, rval);
+
+  return COUNT_READ(fh, rval);
+}
+
+
+/*
+Write data to a file at a specific offset
+
+The current file position is not changed. This is emulated with seek and
+write operations on files that don't support it natively.
+
+Args:
+  fh:     The file to write
+  buf:    Buffer for write data
+  size:   Size of buf
+  offset: Absolute position in the file to write to
+
+Returns:
+  Number of bytes written on success or negative error code on failure
+*/
+ptrdiff_t evfs_file_write_at(EvfsFile *fh, const void *buf, size_t size, evfs_off_t offset) {
+  if(PTR_CHECK(fh) || PTR_CHECK(buf)) return EVFS_ERR_BAD_ARG;
+  if(offset < 0) THROW(EVFS_ERR_INVALID);
+
+  LATENCY_BEGIN();
+  ptrdiff_t rval;
+  if(fh->methods->m_write_at)
+    rval = fh->methods->m_write_at(fh, buf, size, offset);
+  else
+    rval = evfs__transfer_at(fh, (void *)buf, size, offset, /*write*/ true);
+  LATENCY_END_FILE(fh, EVFS_OP_WRITE_AT, rval);
+
+  return COUNT_WRITE(fh, rval);
+}
+
+
+// Emulate vectored I/O with a sequence of reads or writes
+// Transfer stops at the first short or failed operation.
+static ptrdiff_t evfs__transfer_vec(EvfsFile *fh, const EvfsIOVec *iov, int iovcnt, bool write) {
+  ptrdiff_t total = 0;
+
+  for(int i = 0; i < iovcnt; i++) {
+    if(iov[i].len == 0) continue;
+
+    ptrdiff_t rval;
+    if(write)
+      rval = fh->methods->m_write(fh, iov[i].base, iov[i].len);
+    else
+      rval = fh->methods->m_read(fh, iov[i].base, iov[i].len);
+
+    if(rval < 0) // Report errors only when nothing was transferred
+      return total > 0 ? total : rval;
+
+    total += rval;
+    if((size_t)rval < iov[i].len)
+      break;
+  }
+
+  return total;
+}
+
+
+/*
+Read data from a file into multiple buffers
+
+Buffers are filled in order as if by a single read of their combined size.
+This is emulated with a sequence of reads on files that don't support it
+natively.
+
+Args:
+  fh:     The file to read
+  iov:    Array of buffers to fill
+  iovcnt: Number of entries in iov
+
+Returns:
+  Number of bytes read on success or negative error code on failure
+*/
+ptrdiff_t evfs_file_readv(EvfsFile *fh, const EvfsIOVec *iov, int iovcnt) {
+  if(PTR_CHECK(fh) || PTR_CHECK(iov)) return EVFS_ERR_BAD_ARG;
+  if(iovcnt < 0) THROW(EVFS_ERR_INVALID);
+
+  LATENCY_BEGIN();
+  ptrdiff_t rval;
+  if(fh->methods->m_readv)
+    rval = fh->methods->m_readv(fh, iov, iovcnt);
+  else
+    rval = evfs__transfer_vec(fh, iov, iovcnt, /*write*/ false);
+  LATENCY_END_FILE(fh, EVFS_OP_READV, rval);
+
+  return COUNT_READ(fh, rval);
+}
+
+
+/*
+Write data to a file from multiple buffers
+
+Buffers are written in order as if by a single write of their combined size.
+This is emulated with a sequence of writes on files that don't support it
+natively.
+
+Args:
+  fh:     The file to write
+  iov:    Array of buffers to write
+  iovcnt: Number of entries in iov
+
+Returns:
+  Number of bytes written on success or negative error code on failure
+*/
+ptrdiff_t evfs_file_writev(EvfsFile *fh, const EvfsIOVec *iov, int iovcnt) {
+  if(PTR_CHECK(fh) || PTR_CHECK(iov)) return EVFS_ERR_BAD_ARG;
+  if(iovcnt < 0) THROW(EVFS_ERR_INVALID);
+
+  LATENCY_BEGIN();
+  ptrdiff_t rval;
+  if(fh->methods->m_writev)
+    rval = fh->methods->m_writev(fh, iov, iovcnt);
+  else
+    rval = evfs__transfer_vec(fh, iov, iovcnt, /*write*/ true);
+  LATENCY_END_FILE(fh, EVFS_OP_WRITEV, rval);
+
+  return COUNT_WRITE(fh, rval);
+}
+
+/*
+Map file data into memory
+
+This gives direct read-only access to file data without copying it into a
+buffer. In-memory resources are mapped in place. Stdio files are mapped with
+mmap() when EVFS_USE_STDIO_POSIX is enabled, as are POSIX VFS files. Tar and
+Romfs images on these filesystems are mapped once at mount. Files that can't be mapped return
+EVFS_ERR_NO_SUPPORT and should be accessed with evfs_file_read() instead.
+
+Args:
+  fh:     The file to map
+  offset: Start of the mapped region
+  size:   Size of the mapped region. Use 0 to map to the end of the file
+  map:    Mapping for the file data
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_file_map(EvfsFile *fh, evfs_off_t offset, size_t size, EvfsMapping *map) {
+  if(PTR_CHECK(fh) || PTR_CHECK(map)) return EVFS_ERR_BAD_ARG;
+  if(offset < 0) THROW(EVFS_ERR_INVALID);
+
+  memset(map, 0, sizeof(*map));
+
+  if(!fh->methods->m_map)
+    return EVFS_ERR_NO_SUPPORT;
+
+  return fh->methods->m_map(fh, offset, size, map);
+}
+
+
+/*
+Release a mapping created by evfs_file_map()
+
+Args:
+  fh:   The file that was mapped
+  map:  Mapping to release
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_file_unmap(EvfsFile *fh, EvfsMapping *map) {
+  if(PTR_CHECK(fh) || PTR_CHECK(map)) return EVFS_ERR_BAD_ARG;
+
+  int status = EVFS_OK;
+  if(map->data && fh->methods->m_unmap)
+    status = fh->methods->m_unmap(fh, map);
+
+  memset(map, 0, sizeof(*map));
+  return status;
+}
+
+
+/*
+Release the storage behind a range of a file
+
+The range reads back as zeros and the file size is unchanged. Stdio and POSIX
+files on Linux punch a hole in the host file. Files that can't release
+storage return EVFS_ERR_NO_SUPPORT with their data left as is.
+
+Args:
+  fh:     The file to modify
+  offset: Start of the range
+  size:   Size of the range
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_file_discard(EvfsFile *fh, evfs_off_t offset, evfs_off_t size) {
+  if(PTR_CHECK(fh)) return EVFS_ERR_BAD_ARG;
+  if(offset < 0 || size < 0) THROW(EVFS_ERR_INVALID);
+
+  if(!fh->methods->m_discard)
+    return EVFS_ERR_NO_SUPPORT;
+
+  if(size == 0)
+    return EVFS_OK;
+
+  return fh->methods->m_discard(fh, offset, size);
 }
 
 /*
@@ -1208,7 +2200,11 @@ Returns:
 */
 int evfs_file_truncate(EvfsFile *fh, evfs_off_t size) {
   if(PTR_CHECK(fh)) return EVFS_ERR_BAD_ARG;
-  return fh->methods->m_truncate(fh, size);
+  LATENCY_BEGIN();
+  int rval = fh->methods->m_truncate(fh, size);
+  LATENCY_END_FILE(fh, EVFS_OP_TRUNCATE, rval);
+
+  return rval;
 }
 
 /*
@@ -1222,7 +2218,11 @@ Returns:
 */
 int evfs_file_sync(EvfsFile *fh) {
   if(PTR_CHECK(fh)) return EVFS_ERR_BAD_ARG;
-  return fh->methods->m_sync(fh);
+  LATENCY_BEGIN();
+  int rval = fh->methods->m_sync(fh);
+  LATENCY_END_FILE(fh, EVFS_OP_SYNC, rval);
+
+  return COUNT_OP(fh, syncs, rval);
 }
 
 /*
@@ -1267,7 +2267,11 @@ Returns:
 */
 int evfs_file_seek(EvfsFile *fh, evfs_off_t offset, EvfsSeekDir origin) {
   if(PTR_CHECK(fh)) return EVFS_ERR_BAD_ARG;
-  return fh->methods->m_seek(fh, offset, origin);
+  LATENCY_BEGIN();
+  int rval = fh->methods->m_seek(fh, offset, origin);
+  LATENCY_END_FILE(fh, EVFS_OP_SEEK, rval);
+
+  return COUNT_OP(fh, seeks, rval);
 }
 
 /*
@@ -1314,7 +2318,7 @@ int evfs_dir_close(EvfsDir *dh) {
   if(PTR_CHECK(dh)) return EVFS_ERR_BAD_ARG;
   int rval = dh->methods->m_close(dh);
 
-  evfs_free(dh);
+  evfs__free_handle(dh);
 
   return rval;
 }
@@ -1339,6 +2343,67 @@ int evfs_dir_read(EvfsDir *dh, EvfsInfo *info) {
 }
 
 
+// Emulate batched directory reads with a sequence of m_read calls
+// Entries can't be pushed back so reading stops when the next name may not fit.
+static int evfs__dir_read_many(EvfsDir *dh, EvfsInfo *entries, int max_entries, char *name_buf,
+                               size_t name_buf_size) {
+  int count = 0;
+
+  while(count < max_entries && name_buf_size >= EVFS_MAX_PATH) {
+    EvfsInfo *info = &entries[count];
+
+    int status = dh->methods->m_read(dh, info);
+    if(status == EVFS_DONE)
+      break;
+    if(status != EVFS_OK) // Report errors only when nothing was read
+      return count > 0 ? count : status;
+
+    size_t name_len = strlen(info->name) + 1;
+    if(name_len > name_buf_size)
+      return count > 0 ? count : EVFS_ERR_TOO_LONG;
+
+    memcpy(name_buf, info->name, name_len);
+    info->name = name_buf;
+    name_buf += name_len;
+    name_buf_size -= name_len;
+    count++;
+  }
+
+  return count;
+}
+
+
+/*
+Read multiple directory entries
+
+Names for the entries are packed into name_buf so they remain valid after the
+next read. The same set of EvfsInfo fields as evfs_dir_read() are filled in.
+Fewer than max_entries may be returned before the end of the directory when
+name_buf fills up.
+
+Args:
+  dh:             The directory to read from
+  entries:        Array of information for each entry
+  max_entries:    Size of entries array
+  name_buf:       Storage for entry names
+  name_buf_size:  Size of name_buf. Must be at least EVFS_MAX_PATH
+
+Returns:
+  Number of entries read on success or negative error code on failure.
+  Returns 0 when iteration is complete.
+*/
+int evfs_dir_read_many(EvfsDir *dh, EvfsInfo *entries, int max_entries, char *name_buf,
+                       size_t name_buf_size) {
+  if(PTR_CHECK(dh) || PTR_CHECK(entries) || PTR_CHECK(name_buf)) return EVFS_ERR_BAD_ARG;
+  if(max_entries <= 0 || name_buf_size < EVFS_MAX_PATH) THROW(EVFS_ERR_INVALID);
+
+  if(dh->methods->m_read_many)
+    return dh->methods->m_read_many(dh, entries, max_entries, name_buf, name_buf_size);
+
+  return evfs__dir_read_many(dh, entries, max_entries, name_buf, name_buf_size);
+}
+
+
 /*
 Rewind a directory iterator to the beginning
 
@@ -1383,6 +2448,36 @@ int evfs_dir_find(EvfsDir *dh, const char *pattern, EvfsInfo *info) {
 }
 
 
+/*
+Find a file matching a compiled glob pattern
+
+This is the same as evfs_dir_find() but avoids parsing the pattern
+for every entry. Compile the pattern with glob_compile() using EVFS_PATH_SEPS
+as the separators.
+
+Args:
+  dh:      The directory to search
+  pattern: Compiled glob pattern to be matched
+  info:    Information reported on the file
+
+Returns:
+  EVFS_OK on success. EVFS_DONE when iteration is complete.
+*/
+int evfs_dir_find_compiled(EvfsDir *dh, const GlobPattern *pattern, EvfsInfo *info) {
+  if(PTR_CHECK(dh) || PTR_CHECK(pattern) || PTR_CHECK(info)) return EVFS_ERR_BAD_ARG;
+  int rval = evfs_dir_read(dh, info);
+  while(rval == EVFS_OK) {
+    if(glob_match_compiled(pattern, info->name))
+      return EVFS_OK;
+    rval = evfs_dir_read(dh, info);
+  }
+
+  info->type = 0;
+  info->name = NULL;
+  return rval;
+}
+
+
 // ******************** String output ********************
 
 
@@ -1407,7 +2502,7 @@ char *evfs__vmprintf(const char *fmt, va_list args) {
   char *buf = NULL;
 
   if(size > 0)
-    buf = evfs_malloc(size);
+    buf = evfs_class_malloc(EVFS_ALLOC_FORMAT, size);
 
   if(buf)
     vsprintf(buf, fmt, args);
@@ -1416,6 +2511,39 @@ char *evfs__vmprintf(const char *fmt, va_list args) {
 }
 
 
+/*
+Print formatted string into a caller's buffer when it fits
+
+Output is formatted once into buf. Oversized output is formatted again into
+an allocated buffer. Release the result with evfs__printf_buf_free().
+
+Args:
+  buf:      Buffer to try first
+  buf_size: Size of buf
+  len:      Length of the formatted string
+  fmt:      Format string
+  args:     Variable argument list
+
+Returns:
+  buf or a new string buffer on success. NULL on failure
+*/
+char *evfs__vprintf_buf(char *buf, size_t buf_size, int *len, const char *fmt, va_list args) {
+  va_list args_retry;
+
+  va_copy(args_retry, args);
+  *len = vsnprintf(buf, buf_size, fmt, args);
+
+  if(*len >= 0 && (size_t)*len >= buf_size) { // Too big for the buffer
+    buf = evfs_class_malloc(EVFS_ALLOC_FORMAT, *len + 1);
+    if(buf)
+      vsnprintf(buf, *len + 1, fmt, args_retry);
+  }
+  va_end(args_retry);
+
+  return *len >= 0 ? buf : NULL;
+}
+
+
 /*
 Print a formatted string to a file
 
@@ -1424,24 +2552,43 @@ Args:
   fmt:  Format string
   args: Variable argument list
 
+Returns:
+  Number of bytes written on success or negative error code on failure
+*/
+int evfs_file_vprintf(EvfsFile *fh, const char *fmt, va_list args) {
+  char stack_buf[EVFS_PRINTF_STACK_SIZE];
+  int len;
+
+  // Print into stack buffer or malloc'ed buffer for long output
+  char *buf = evfs__vprintf_buf(stack_buf, sizeof(stack_buf), &len, fmt, args);
+  if(!buf)
+    return EVFS_ERR_ALLOC;
+
+  int status = evfs_file_write(fh, buf, len);
+  evfs__printf_buf_free(buf, stack_buf);
+
+  return status;
+}
+
+
+/*
+Print a formatted string to a file
+
+Args:
+  fh:       Open file to print into
+  fmt:      Format string
+  var_args: Additional arguments for the `fmt` string
+
 Returns:
   Number of bytes written on success or negative error code on failure
 */
 int evfs_file_printf(EvfsFile *fh, const char *fmt, ...) {
   va_list args;
-  char *buf;
 
-  // Print into malloc'ed buffer
   va_start(args, fmt);
-  buf = evfs__vmprintf(fmt, args);
+  int status = evfs_file_vprintf(fh, fmt, args);
   va_end(args);
 
-  int status = EVFS_ERR_ALLOC;
-  if(buf) {
-    status = evfs_file_write(fh, buf, strlen(buf));
-    evfs_free(buf);
-  }
-
   return status;
 }
 
@@ -1461,3 +2608,94 @@ int evfs_file_puts(EvfsFile *fh, const char *str) {
 }
 
 
+/*
+Start batching formatted output for a file
+
+Output from evfs_print_buf_printf() is collected in buf and written to the
+file with one call when the buffer fills or evfs_print_buf_flush() is called.
+
+Args:
+  pb:       Print buffer to initialize
+  fh:       Open file to print into
+  buf:      Storage for the batched output
+  buf_size: Size of buf
+*/
+void evfs_print_buf_init(EvfsPrintBuf *pb, EvfsFile *fh, char *buf, size_t buf_size) {
+  pb->fh = fh;
+  pb->start = buf;
+  range_init(&pb->free, buf, buf_size);
+  pb->status = EVFS_OK;
+}
+
+
+/*
+Write batched output to the file
+
+Args:
+  pb: Print buffer to flush
+
+Returns:
+  EVFS_OK on success or the first error from writing the batched output
+*/
+int evfs_print_buf_flush(EvfsPrintBuf *pb) {
+  size_t len = pb->free.start - pb->start;
+
+  if(len > 0 && pb->status == EVFS_OK) {
+    ptrdiff_t wrote = evfs_file_write(pb->fh, pb->start, len);
+    if(wrote != (ptrdiff_t)len)
+      pb->status = wrote < 0 ? wrote : EVFS_ERR_IO;
+  }
+
+  // Reclaim the space
+  pb->free.start = pb->start;
+
+  return pb->status;
+}
+
+
+/*
+Append a formatted string to a print buffer
+
+Output that doesn't fit in the remaining space flushes the buffer first.
+Output larger than the whole buffer is written directly. After an error
+further output is dropped and the error is returned.
+
+Args:
+  pb:       Print buffer to append to
+  fmt:      Format string
+  var_args: Additional arguments for the `fmt` string
+
+Returns:
+  Number of bytes added on success or negative error code on failure
+*/
+int evfs_print_buf_printf(EvfsPrintBuf *pb, const char *fmt, ...) {
+  va_list args, args_retry;
+
+  if(pb->status != EVFS_OK)
+    return pb->status;
+
+  va_start(args, fmt);
+  va_copy(args_retry, args);
+
+  int len = range_cat_vfmt(&pb->free, fmt, args);
+  if(len < 0) { // Didn't fit
+    len = -len;
+
+    if(evfs_print_buf_flush(pb) != EVFS_OK) {
+      len = pb->status;
+    } else if(len < range_size(&pb->free)) { // Fits in the empty buffer
+      range_cat_vfmt(&pb->free, fmt, args_retry);
+    } else { // Oversized
+      int status = evfs_file_vprintf(pb->fh, fmt, args_retry);
+      if(status < 0)
+        len = pb->status = status;
+    }
+  }
+
+  va_end(args_retry);
+  va_end(args);
+
+  return len;
+}
+
+
@@ -0,0 +1,396 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Runtime allocator hooks
+
+  All memory allocated by the library is routed through an EvfsAllocator
+  selected by an allocation class. Each class defaults to malloc() and free()
+  and can be replaced at runtime with evfs_set_allocator(). A bump allocator
+  is provided for data that lives as long as a mounted filesystem.
+------------------------------------------------------------------------------
+*/
+
+#include <string.h>
+
+#include "evfs.h"
+#include "evfs_internal.h"
+
+
+static void *default__alloc(void *ctx, size_t size) {
+  return malloc(size);
+}
+
+static void default__free(void *ctx, void *ptr) {
+  free(ptr);
+}
+
+static const EvfsAllocator s_default_allocator = {
+  .m_alloc  = default__alloc,
+  .m_free   = default__free,
+  .ctx      = NULL
+};
+
+
+#ifdef EVFS_USE_THREADING
+#  include <stdatomic.h>
+
+static _Atomic(const EvfsAllocator *) s_allocators[EVFS_ALLOC_NUM_CLASSES];
+
+#  define ALLOC_LOAD(cls)       atomic_load_explicit(&s_allocators[cls], memory_order_acquire)
+#  define ALLOC_STORE(cls, a)   atomic_store_explicit(&s_allocators[cls], (a), memory_order_release)
+#else
+static const EvfsAllocator *s_allocators[EVFS_ALLOC_NUM_CLASSES];
+
+#  define ALLOC_LOAD(cls)       (s_allocators[cls])
+#  define ALLOC_STORE(cls, a)   (s_allocators[cls] = (a))
+#endif
+
+
+// ******************** Statistics ********************
+
+#ifdef EVFS_USE_ALLOC_STATS
+#  ifdef EVFS_USE_THREADING
+typedef struct AllocCounters {
+  atomic_size_t alloc_calls;
+  atomic_size_t free_calls;
+  atomic_size_t alloc_bytes;
+  atomic_size_t failed_allocs;
+} AllocCounters;
+
+#    define COUNT(c, n)   atomic_fetch_add_explicit(&(c), (n), memory_order_relaxed)
+#    define READ(c)       atomic_load_explicit(&(c), memory_order_relaxed)
+#    define CLEAR(c)      atomic_store_explicit(&(c), 0, memory_order_relaxed)
+#  else
+typedef struct AllocCounters {
+  size_t alloc_calls;
+  size_t free_calls;
+  size_t alloc_bytes;
+  size_t failed_allocs;
+} AllocCounters;
+
+#    define COUNT(c, n)   ((c) += (n))
+#    define READ(c)       (c)
+#    define CLEAR(c)      ((c) = 0)
+#  endif
+
+static AllocCounters s_alloc_stats[EVFS_ALLOC_NUM_CLASSES];
+
+#else
+#  define COUNT(c, n)
+#endif
+
+
+#define VALID_CLASS(cls)  ((unsigned)(cls) < EVFS_ALLOC_NUM_CLASSES)
+
+
+/*
+Set the allocator for an allocation class
+
+The allocator should be set before any VFS allocates memory from the class.
+Memory from the EVFS_ALLOC_INDEX class is returned to the allocator it was
+taken from so that class can be changed between mounts.
+
+Args:
+  alloc_class:  Class to change
+  alloc:        New allocator. Use NULL to restore malloc() and free()
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_set_allocator(int alloc_class, const EvfsAllocator *alloc) {
+  if(ASSERT(VALID_CLASS(alloc_class), "Invalid allocation class %d", alloc_class))
+    return EVFS_ERR_BAD_ARG;
+
+  if(alloc && (PTR_CHECK(alloc->m_alloc) || PTR_CHECK(alloc->m_free)))
+    return EVFS_ERR_BAD_ARG;
+
+  ALLOC_STORE(alloc_class, alloc);
+  return EVFS_OK;
+}
+
+
+/*
+Get the allocator for an allocation class
+
+Args:
+  alloc_class:  Class to retrieve
+
+Returns:
+  The active allocator for the class
+*/
+const EvfsAllocator *evfs_get_allocator(int alloc_class) {
+  const EvfsAllocator *alloc = VALID_CLASS(alloc_class) ? ALLOC_LOAD(alloc_class) : NULL;
+
+  return alloc ? alloc : &s_default_allocator;
+}
+
+
+/*
+Allocate memory from a specific allocator
+
+Args:
+  alloc:        Allocator to use. NULL selects the allocator for the class
+  alloc_class:  Class for allocation statistics
+  size:         Bytes to allocate
+
+Returns:
+  Allocated memory or NULL on failure
+*/
+void *evfs_alloc_with(const EvfsAllocator *alloc, int alloc_class, size_t size) {
+  if(!VALID_CLASS(alloc_class))
+    alloc_class = EVFS_ALLOC_GENERAL;
+
+  if(!alloc)
+    alloc = evfs_get_allocator(alloc_class);
+
+  void *mem = alloc->m_alloc(alloc->ctx, size);
+
+  COUNT(s_alloc_stats[alloc_class].alloc_calls, 1);
+  if(mem) {
+    COUNT(s_alloc_stats[alloc_class].alloc_bytes, size);
+  } else {
+    COUNT(s_alloc_stats[alloc_class].failed_allocs, 1);
+  }
+
+  return mem;
+}
+
+
+/*
+Free memory to a specific allocator
+
+Args:
+  alloc:        Allocator the memory came from. NULL selects the allocator for the class
+  alloc_class:  Class for allocation statistics
+  ptr:          Memory to free
+*/
+void evfs_free_with(const EvfsAllocator *alloc, int alloc_class, void *ptr) {
+  if(!ptr) return;
+
+  if(!VALID_CLASS(alloc_class))
+    alloc_class = EVFS_ALLOC_GENERAL;
+
+  if(!alloc)
+    alloc = evfs_get_allocator(alloc_class);
+
+  COUNT(s_alloc_stats[alloc_class].free_calls, 1);
+  alloc->m_free(alloc->ctx, ptr);
+}
+
+
+/*
+Allocate memory from an allocation class
+
+Args:
+  alloc_class:  Class to allocate from
+  size:         Bytes to allocate
+
+Returns:
+  Allocated memory or NULL on failure
+*/
+void *evfs_class_malloc(int alloc_class, size_t size) {
+  return evfs_alloc_with(NULL, alloc_class, size);
+}
+
+
+/*
+Free memory to an allocation class
+
+Args:
+  alloc_class:  Class the memory was allocated from
+  ptr:          Memory to free
+*/
+void evfs_class_free(int alloc_class, void *ptr) {
+  evfs_free_with(NULL, alloc_class, ptr);
+}
+
+
+/*
+Retrieve allocation statistics for a class
+
+Statistics are only collected when EVFS_USE_ALLOC_STATS is defined.
+
+Args:
+  alloc_class:  Class to query
+  stats:        Current statistics for the class
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_get_alloc_stats(int alloc_class, EvfsAllocStats *stats) {
+  if(PTR_CHECK(stats)) return EVFS_ERR_BAD_ARG;
+  if(ASSERT(VALID_CLASS(alloc_class), "Invalid allocation class %d", alloc_class))
+    return EVFS_ERR_BAD_ARG;
+
+#ifdef EVFS_USE_ALLOC_STATS
+  AllocCounters *ac = &s_alloc_stats[alloc_class];
+  stats->alloc_calls    = READ(ac->alloc_calls);
+  stats->free_calls     = READ(ac->free_calls);
+  stats->alloc_bytes    = READ(ac->alloc_bytes);
+  stats->failed_allocs  = READ(ac->failed_allocs);
+  return EVFS_OK;
+
+#else
+  memset(stats, 0, sizeof(*stats));
+  return EVFS_ERR_DISABLED;
+#endif
+}
+
+
+/*
+Clear allocation statistics for all classes
+*/
+void evfs_reset_alloc_stats(void) {
+#ifdef EVFS_USE_ALLOC_STATS
+  for(int i = 0; i < EVFS_ALLOC_NUM_CLASSES; i++) {
+    AllocCounters *ac = &s_alloc_stats[i];
+    CLEAR(ac->alloc_calls);
+    CLEAR(ac->free_calls);
+    CLEAR(ac->alloc_bytes);
+    CLEAR(ac->failed_allocs);
+  }
+#endif
+}
+
+
+
+// ******************** Scratch path buffers ********************
+
+#ifdef EVFS_USE_SCRATCH_PATHS
+typedef struct ScratchPaths {
+  unsigned  used;
+  char      paths[EVFS_THREAD_LOCAL_PATH_DEPTH][EVFS_MAX_PATH];
+} ScratchPaths;
+
+static _Thread_local ScratchPaths s_scratch;
+
+
+/*
+Get a path buffer for the current thread
+
+Buffers are taken from a small per-thread stack and must be released in
+reverse order with evfs__scratch_path_put(). A buffer is allocated when the
+stack is exhausted.
+
+Returns:
+  A buffer of EVFS_MAX_PATH chars or NULL on allocation failure
+*/
+char *evfs__scratch_path_get(void) {
+  if(s_scratch.used < EVFS_THREAD_LOCAL_PATH_DEPTH)
+    return s_scratch.paths[s_scratch.used++];
+
+  return evfs_class_malloc(EVFS_ALLOC_PATH, EVFS_MAX_PATH);
+}
+
+
+/*
+Release a buffer from evfs__scratch_path_get()
+
+Args:
+  path:  Buffer to release
+*/
+void evfs__scratch_path_put(char *path) {
+  if(!path) return;
+
+  if(s_scratch.used > 0 && path == s_scratch.paths[s_scratch.used-1]) {
+    s_scratch.used--;
+    return;
+  }
+
+  ASSERT(path < s_scratch.paths[0] || path > s_scratch.paths[EVFS_THREAD_LOCAL_PATH_DEPTH-1],
+        "Scratch path released out of order");
+  evfs_class_free(EVFS_ALLOC_PATH, path);
+}
+#endif
+
+
+// ******************** Arena allocator ********************
+
+// Round up object size to match alignment of a type
+#define ROUND_UP_ALIGN(n, T)  ((n) + _Alignof(T)-1 - ((n) + _Alignof(T)-1) % _Alignof(T))
+
+
+static void *arena__alloc(void *ctx, size_t size) {
+  EvfsArena *arena = (EvfsArena *)ctx;
+
+  size_t start = ROUND_UP_ALIGN(arena->used, max_align_t);
+  if(start > arena->size || size > arena->size - start)
+    return NULL;
+
+  arena->used = start + size;
+  arena->high_water = MAX(arena->high_water, arena->used);
+  arena->live_allocs++;
+
+  return &arena->buf[start];
+}
+
+
+static void arena__free(void *ctx, void *ptr) {
+  EvfsArena *arena = (EvfsArena *)ctx;
+
+  // Space is only reclaimed once every allocation has been freed
+  if(arena->live_allocs > 0 && --arena->live_allocs == 0)
+    arena->used = 0;
+}
+
+
+/*
+Initialize a bump allocator over a fixed buffer
+
+Allocations are taken sequentially from the buffer. Freed memory is only
+reclaimed when all outstanding allocations have been released or by calling
+evfs_arena_reset(). The arena is not thread safe. It is meant for data with
+the lifetime of a mounted filesystem such as the tar and Romfs indices.
+
+Allocations are aligned for any type. If buf isn't, the start is moved up
+to the next aligned address and the skipped bytes are lost from size.
+
+Args:
+  arena:  Arena to initialize
+  buf:    Backing storage for the arena
+  size:   Size of buf
+
+Returns:
+  The allocator for the arena
+*/
+const EvfsAllocator *evfs_arena_init(EvfsArena *arena, void *buf, size_t size) {
+  if(PTR_CHECK(arena) || PTR_CHECK(buf)) return NULL;
+
+  // Offsets are rounded up in arena__alloc() so the base must be aligned too
+  size_t pad = ROUND_UP_ALIGN((uintptr_t)buf, max_align_t) - (uintptr_t)buf;
+  pad = MIN(pad, size);
+
+  *arena = (EvfsArena){
+    .alloc = {
+      .m_alloc  = arena__alloc,
+      .m_free   = arena__free,
+      .ctx      = arena
+    },
+    .buf  = (uint8_t *)buf + pad,
+    .size = size - pad
+  };
+
+  return &arena->alloc;
+}
+
+
+/*
+Release all memory in an arena
+
+Args:
+  arena:  Arena to reset
+*/
+void evfs_arena_reset(EvfsArena *arena) {
+  if(PTR_CHECK(arena)) return;
+
+  arena->used = 0;
+  arena->live_allocs = 0;
+}
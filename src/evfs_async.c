@@ -0,0 +1,408 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Asynchronous I/O queue
+
+  Submitted operations are taken from a fixed set of slots allocated with the
+  queue so that no allocation happens per operation. Without a native engine,
+  operations are passed to a pool of worker threads that perform them with
+  evfs_file_read_at() and evfs_file_write_at(). When threading is disabled or
+  the pool has no threads, operations run immediately in evfs_file_submit_*()
+  and their completions are queued for evfs_async_reap().
+------------------------------------------------------------------------------
+*/
+
+#include <string.h>
+
+#include "evfs.h"
+#include "evfs_internal.h"
+#include "evfs/async_io.h"
+
+
+typedef struct OpList {
+  EvfsAsyncOp *head;
+  EvfsAsyncOp *tail;
+} OpList;
+
+struct EvfsAsyncQueue {
+  EvfsLock      lock;
+#ifdef EVFS_USE_THREADING
+  EvfsCond      work_ready; // Signaled when pending ops are added or on shutdown
+  EvfsCond      done_ready; // Signaled when ops complete
+  EvfsThread   *threads;
+#endif
+  unsigned      num_threads;
+  bool          shutdown;
+
+  EvfsAsyncOp  *ops;        // Storage for all op slots
+  EvfsAsyncOp  *free_ops;
+  OpList        pending;    // Waiting for a worker thread
+  OpList        done;       // Waiting for evfs_async_reap()
+  unsigned      active;     // Ops not in the free list
+
+  EvfsAsyncEngine *engine;
+};
+
+
+static void op_list_push(OpList *list, EvfsAsyncOp *op) {
+  op->next = NULL;
+  if(list->tail)
+    list->tail->next = op;
+  else
+    list->head = op;
+  list->tail = op;
+}
+
+static EvfsAsyncOp *op_list_pop(OpList *list) {
+  EvfsAsyncOp *op = list->head;
+  if(op) {
+    list->head = op->next;
+    if(!list->head)
+      list->tail = NULL;
+  }
+  return op;
+}
+
+
+static void run_op(EvfsAsyncOp *op) {
+  ptrdiff_t result;
+
+  if(op->kind == EVFS_ASYNC_WRITE)
+    result = evfs_file_write_at(op->fh, op->buf, op->size, op->offset);
+  else
+    result = evfs_file_read_at(op->fh, op->buf, op->size, op->offset);
+
+  evfs_async_complete(op, result);
+}
+
+
+#ifdef EVFS_USE_THREADING
+static void async_worker(void *arg) {
+  EvfsAsyncQueue *queue = (EvfsAsyncQueue *)arg;
+
+  while(1) {
+    evfs__lock(&queue->lock);
+    while(!queue->pending.head && !queue->shutdown)
+      evfs__cond_wait(&queue->work_ready, &queue->lock);
+
+    // Pending ops are drained before shutting down
+    EvfsAsyncOp *op = op_list_pop(&queue->pending);
+    evfs__unlock(&queue->lock);
+
+    if(!op)
+      break;
+
+    run_op(op);
+  }
+}
+#endif
+
+
+/*
+Finish an async operation
+
+This is called by the thread pool and by native engines to post the result
+of an operation to the completion list.
+
+Args:
+  op:     Completed operation
+  result: Bytes transferred or negative error code
+*/
+void evfs_async_complete(EvfsAsyncOp *op, ptrdiff_t result) {
+  EvfsAsyncQueue *queue = op->queue;
+
+  op->result = result;
+
+  evfs__lock(&queue->lock);
+  op_list_push(&queue->done, op);
+#ifdef EVFS_USE_THREADING
+  evfs__cond_broadcast(&queue->done_ready);
+#endif
+  evfs__unlock(&queue->lock);
+}
+
+
+/*
+Create an async I/O queue
+
+Args:
+  depth:        Maximum number of operations that can be submitted and not yet reaped
+  num_threads:  Number of worker threads. Use 0 to run operations synchronously on submit
+  queue:        New queue object
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_async_new(unsigned depth, unsigned num_threads, EvfsAsyncQueue **queue) {
+  if(PTR_CHECK(queue) || depth == 0) return EVFS_ERR_BAD_ARG;
+
+  *queue = NULL;
+
+  // We have two objects allocated together [EvfsAsyncQueue][EvfsAsyncOp[]]
+  EvfsAsyncQueue *new_queue = evfs_malloc(sizeof(*new_queue) + depth * sizeof(EvfsAsyncOp));
+  if(MEM_CHECK(new_queue)) return EVFS_ERR_ALLOC;
+
+  memset(new_queue, 0, sizeof(*new_queue));
+  new_queue->ops = (EvfsAsyncOp *)(new_queue + 1);
+
+  for(unsigned i = 0; i < depth; i++) {
+    new_queue->ops[i].queue = new_queue;
+    new_queue->ops[i].next = new_queue->free_ops;
+    new_queue->free_ops = &new_queue->ops[i];
+  }
+
+  evfs__lock_init(&new_queue->lock);
+
+#ifdef EVFS_USE_THREADING
+  evfs__cond_init(&new_queue->work_ready);
+  evfs__cond_init(&new_queue->done_ready);
+
+  if(num_threads > 0) {
+    new_queue->threads = evfs_malloc(num_threads * sizeof(EvfsThread));
+    if(MEM_CHECK(new_queue->threads)) {
+      evfs_async_free(new_queue);
+      return EVFS_ERR_ALLOC;
+    }
+
+    for(unsigned i = 0; i < num_threads; i++) {
+      int status = evfs__thread_create(&new_queue->threads[i], async_worker, new_queue);
+      if(status != EVFS_OK) {
+        evfs_async_free(new_queue);
+        return status;
+      }
+      new_queue->num_threads++;
+    }
+  }
+#endif
+
+  *queue = new_queue;
+  return EVFS_OK;
+}
+
+
+/*
+Free an async I/O queue
+
+All submitted operations are allowed to finish. Completions that have not
+been reaped are discarded. Any attached engine is released.
+
+Args:
+  queue:  Queue to free
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_async_free(EvfsAsyncQueue *queue) {
+  if(PTR_CHECK(queue)) return EVFS_ERR_BAD_ARG;
+
+  if(queue->engine)
+    queue->engine->m_free(queue->engine);
+
+  evfs__lock(&queue->lock);
+  queue->shutdown = true;
+#ifdef EVFS_USE_THREADING
+  evfs__cond_broadcast(&queue->work_ready);
+#endif
+  evfs__unlock(&queue->lock);
+
+#ifdef EVFS_USE_THREADING
+  for(unsigned i = 0; i < queue->num_threads; i++) {
+    evfs__thread_join(queue->threads[i]);
+  }
+  evfs_free(queue->threads);
+
+  evfs__cond_destroy(&queue->work_ready);
+  evfs__cond_destroy(&queue->done_ready);
+#endif
+
+  evfs__lock_destroy(&queue->lock);
+  evfs_free(queue);
+
+  return EVFS_OK;
+}
+
+
+/*
+Attach a native engine to an async queue
+
+The engine is given the first chance to run each submitted operation. It
+is freed along with the queue. This must be called before any operations
+are submitted.
+
+Args:
+  queue:  Queue to attach to
+  engine: Engine for native async operations
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_async_set_engine(EvfsAsyncQueue *queue, EvfsAsyncEngine *engine) {
+  if(PTR_CHECK(queue) || PTR_CHECK(engine)) return EVFS_ERR_BAD_ARG;
+
+  evfs__lock(&queue->lock);
+  int status = EVFS_OK;
+  if(queue->engine || queue->active > 0)
+    status = EVFS_ERR_INVALID;
+  else
+    queue->engine = engine;
+  evfs__unlock(&queue->lock);
+
+  return status;
+}
+
+
+static int async_submit(EvfsAsyncQueue *queue, EvfsFile *fh, void *buf, size_t size,
+                        evfs_off_t offset, void *user_data, int kind) {
+  if(PTR_CHECK(queue) || PTR_CHECK(fh) || PTR_CHECK(buf)) return EVFS_ERR_BAD_ARG;
+  if(offset < 0) THROW(EVFS_ERR_INVALID);
+
+  evfs__lock(&queue->lock);
+  EvfsAsyncOp *op = queue->free_ops;
+  if(op) {
+    queue->free_ops = op->next;
+    queue->active++;
+  }
+  evfs__unlock(&queue->lock);
+
+  if(!op) // Caller must reap completions first
+    return EVFS_ERR_OVERFLOW;
+
+  op->fh = fh;
+  op->buf = buf;
+  op->size = size;
+  op->offset = offset;
+  op->user_data = user_data;
+  op->result = 0;
+  op->kind = kind;
+
+  if(queue->engine) {
+    int status = queue->engine->m_submit(queue->engine, op);
+    if(status == EVFS_OK)
+      return EVFS_OK;
+
+    if(status != EVFS_ERR_NO_SUPPORT) { // Op was rejected
+      evfs__lock(&queue->lock);
+      op->next = queue->free_ops;
+      queue->free_ops = op;
+      queue->active--;
+      evfs__unlock(&queue->lock);
+      return status;
+    }
+  }
+
+#ifdef EVFS_USE_THREADING
+  if(queue->num_threads > 0) {
+    evfs__lock(&queue->lock);
+    op_list_push(&queue->pending, op);
+    evfs__cond_signal(&queue->work_ready);
+    evfs__unlock(&queue->lock);
+    return EVFS_OK;
+  }
+#endif
+
+  run_op(op);
+  return EVFS_OK;
+}
+
+
+/*
+Submit a read operation to an async queue
+
+The file position is not used or changed. The buffer must remain valid until
+the operation is reaped.
+
+Args:
+  queue:      Queue for the operation
+  fh:         The file to read
+  buf:        Buffer for read data
+  size:       Size of buf
+  offset:     Absolute position in the file to read from
+  user_data:  Pointer returned with the completion
+
+Returns:
+  EVFS_OK on success. EVFS_ERR_OVERFLOW if the queue is full.
+*/
+int evfs_file_submit_read(EvfsAsyncQueue *queue, EvfsFile *fh, void *buf, size_t size,
+                          evfs_off_t offset, void *user_data) {
+  return async_submit(queue, fh, buf, size, offset, user_data, EVFS_ASYNC_READ);
+}
+
+
+/*
+Submit a write operation to an async queue
+
+The file position is not used or changed. The buffer must remain valid until
+the operation is reaped.
+
+Args:
+  queue:      Queue for the operation
+  fh:         The file to write
+  buf:        Buffer for write data
+  size:       Size of buf
+  offset:     Absolute position in the file to write to
+  user_data:  Pointer returned with the completion
+
+Returns:
+  EVFS_OK on success. EVFS_ERR_OVERFLOW if the queue is full.
+*/
+int evfs_file_submit_write(EvfsAsyncQueue *queue, EvfsFile *fh, const void *buf, size_t size,
+                           evfs_off_t offset, void *user_data) {
+  return async_submit(queue, fh, (void *)buf, size, offset, user_data, EVFS_ASYNC_WRITE);
+}
+
+
+/*
+Collect completed operations from an async queue
+
+Completions are returned in the order they finished.
+
+Args:
+  queue:      Queue to reap from
+  events:     Array of completion results
+  max_events: Size of the events array
+  wait:       Block until at least one operation completes when true
+
+Returns:
+  Number of completions in events on success or negative error code on failure.
+  Returns 0 when wait is true and there are no operations outstanding.
+*/
+int evfs_async_reap(EvfsAsyncQueue *queue, EvfsCompletion *events, int max_events, bool wait) {
+  if(PTR_CHECK(queue) || PTR_CHECK(events)) return EVFS_ERR_BAD_ARG;
+  if(max_events <= 0) THROW(EVFS_ERR_INVALID);
+
+  int count = 0;
+
+  evfs__lock(&queue->lock);
+
+#ifdef EVFS_USE_THREADING
+  // Ops in the done list are also active so nothing is in flight when they're equal
+  if(wait) {
+    while(!queue->done.head && queue->active > 0)
+      evfs__cond_wait(&queue->done_ready, &queue->lock);
+  }
+#endif
+
+  EvfsAsyncOp *op;
+  while(count < max_events && (op = op_list_pop(&queue->done)) != NULL) {
+    events[count].fh = op->fh;
+    events[count].user_data = op->user_data;
+    events[count].result = op->result;
+    count++;
+
+    op->next = queue->free_ops;
+    queue->free_ops = op;
+    queue->active--;
+  }
+
+  evfs__unlock(&queue->lock);
+
+  return count;
+}
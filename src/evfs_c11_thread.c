@@ -46,4 +46,169 @@ int evfs__unlock(EvfsLock *lock) {
   return err == thrd_success ? EVFS_OK : EVFS_ERR;
 }
 
+
+// ******************** Reader/writer lock API ********************
+
+#ifndef EVFS_RWLOCK_USE_MUTEX
+int evfs__rwlock_init(EvfsRwLock *lock) {
+  lock->readers = 0;
+  lock->writers_waiting = 0;
+  lock->writer = 0;
+
+  if(mtx_init(&lock->lock, mtx_plain) != thrd_success)
+    return EVFS_ERR;
+
+  if(cnd_init(&lock->readers_ok) != thrd_success) {
+    mtx_destroy(&lock->lock);
+    return EVFS_ERR;
+  }
+
+  if(cnd_init(&lock->writer_ok) != thrd_success) {
+    cnd_destroy(&lock->readers_ok);
+    mtx_destroy(&lock->lock);
+    return EVFS_ERR;
+  }
+
+  return EVFS_OK;
+}
+
+int evfs__rwlock_destroy(EvfsRwLock *lock) {
+  cnd_destroy(&lock->writer_ok);
+  cnd_destroy(&lock->readers_ok);
+  mtx_destroy(&lock->lock);
+  return EVFS_OK;
+}
+
+
+int evfs__lock_shared(EvfsRwLock *lock) {
+  if(mtx_lock(&lock->lock) != thrd_success) return EVFS_ERR;
+
+  // Waiting writers block new readers so they can't be starved
+  while(lock->writer || lock->writers_waiting > 0)
+    cnd_wait(&lock->readers_ok, &lock->lock);
+
+  lock->readers++;
+  mtx_unlock(&lock->lock);
+  return EVFS_OK;
+}
+
+int evfs__unlock_shared(EvfsRwLock *lock) {
+  if(mtx_lock(&lock->lock) != thrd_success) return EVFS_ERR;
+
+  if(--lock->readers == 0 && lock->writers_waiting > 0)
+    cnd_signal(&lock->writer_ok);
+
+  mtx_unlock(&lock->lock);
+  return EVFS_OK;
+}
+
+
+int evfs__lock_exclusive(EvfsRwLock *lock) {
+  if(mtx_lock(&lock->lock) != thrd_success) return EVFS_ERR;
+
+  lock->writers_waiting++;
+  while(lock->writer || lock->readers > 0)
+    cnd_wait(&lock->writer_ok, &lock->lock);
+  lock->writers_waiting--;
+
+  lock->writer = 1;
+  mtx_unlock(&lock->lock);
+  return EVFS_OK;
+}
+
+int evfs__unlock_exclusive(EvfsRwLock *lock) {
+  if(mtx_lock(&lock->lock) != thrd_success) return EVFS_ERR;
+
+  lock->writer = 0;
+  if(lock->writers_waiting > 0)
+    cnd_signal(&lock->writer_ok);
+  else
+    cnd_broadcast(&lock->readers_ok);
+
+  mtx_unlock(&lock->lock);
+  return EVFS_OK;
+}
+#endif
+
+
+// ******************** Condition variable API ********************
+
+int evfs__cond_init(EvfsCond *cond) {
+  int err = cnd_init(cond);
+  return err == thrd_success ? EVFS_OK : EVFS_ERR;
+}
+
+int evfs__cond_destroy(EvfsCond *cond) {
+  cnd_destroy(cond);
+  return EVFS_OK;
+}
+
+int evfs__cond_wait(EvfsCond *cond, EvfsLock *lock) {
+  int err = cnd_wait(cond, lock);
+  return err == thrd_success ? EVFS_OK : EVFS_ERR;
+}
+
+// Returns EVFS_OK when signaled or after timeout_ms has elapsed
+int evfs__cond_timedwait(EvfsCond *cond, EvfsLock *lock, unsigned timeout_ms) {
+  struct timespec deadline;
+  timespec_get(&deadline, TIME_UTC);
+  deadline.tv_sec  += timeout_ms / 1000;
+  deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+  if(deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+
+  int err = cnd_timedwait(cond, lock, &deadline);
+  return (err == thrd_success || err == thrd_timedout) ? EVFS_OK : EVFS_ERR;
+}
+
+int evfs__cond_signal(EvfsCond *cond) {
+  int err = cnd_signal(cond);
+  return err == thrd_success ? EVFS_OK : EVFS_ERR;
+}
+
+int evfs__cond_broadcast(EvfsCond *cond) {
+  int err = cnd_broadcast(cond);
+  return err == thrd_success ? EVFS_OK : EVFS_ERR;
+}
+
+
+// ******************** Thread API ********************
+
+typedef struct ThreadStart {
+  EvfsThreadFunc func;
+  void *arg;
+} ThreadStart;
+
+// Adapt EvfsThreadFunc to the C11 thread start signature
+static int thread_trampoline(void *arg) {
+  ThreadStart start = *(ThreadStart *)arg;
+  evfs_free(arg);
+
+  start.func(start.arg);
+  return 0;
+}
+
+int evfs__thread_create(EvfsThread *thread, EvfsThreadFunc func, void *arg) {
+  ThreadStart *start = evfs_malloc(sizeof(*start));
+  if(MEM_CHECK(start)) return EVFS_ERR_ALLOC;
+
+  start->func = func;
+  start->arg = arg;
+
+  int err = thrd_create(thread, thread_trampoline, start);
+  if(err != thrd_success) {
+    evfs_free(start);
+    return EVFS_ERR;
+  }
+
+  return EVFS_OK;
+}
+
+int evfs__thread_join(EvfsThread thread) {
+  int err = thrd_join(thread, NULL);
+  return err == thrd_success ? EVFS_OK : EVFS_ERR;
+}
+
 #endif
@@ -137,10 +137,42 @@ int evfs__lock_destroy(EvfsLock *lock);
 int evfs__lock(EvfsLock *lock);
 int evfs__unlock(EvfsLock *lock);
 
+// Reader/writer locks allow concurrent readers with exclusive writers
+#ifdef EVFS_RWLOCK_USE_MUTEX
+#  define evfs__rwlock_init(l)       evfs__lock_init(l)
+#  define evfs__rwlock_destroy(l)    evfs__lock_destroy(l)
+#  define evfs__lock_shared(l)       evfs__lock(l)
+#  define evfs__unlock_shared(l)     evfs__unlock(l)
+#  define evfs__lock_exclusive(l)    evfs__lock(l)
+#  define evfs__unlock_exclusive(l)  evfs__unlock(l)
+#else
+int evfs__rwlock_init(EvfsRwLock *lock);
+int evfs__rwlock_destroy(EvfsRwLock *lock);
+int evfs__lock_shared(EvfsRwLock *lock);
+int evfs__unlock_shared(EvfsRwLock *lock);
+int evfs__lock_exclusive(EvfsRwLock *lock);
+int evfs__unlock_exclusive(EvfsRwLock *lock);
+#endif
+
+// Condition variables and worker threads are only needed by the async I/O queue
+// and the rotate shim's background sync
+typedef void (*EvfsThreadFunc)(void *arg);
+
+int evfs__cond_init(EvfsCond *cond);
+int evfs__cond_destroy(EvfsCond *cond);
+int evfs__cond_wait(EvfsCond *cond, EvfsLock *lock);
+int evfs__cond_timedwait(EvfsCond *cond, EvfsLock *lock, unsigned timeout_ms);
+int evfs__cond_signal(EvfsCond *cond);
+int evfs__cond_broadcast(EvfsCond *cond);
+
+int evfs__thread_create(EvfsThread *thread, EvfsThreadFunc func, void *arg);
+int evfs__thread_join(EvfsThread thread);
+
 void evfs__init_once(void); // Must be provided by threading wrapper
 #else // Disable locking API
 
 typedef unsigned EvfsLock;
+typedef unsigned EvfsRwLock;
 
 static inline int evfs__nop(EvfsLock *(l)) { return 0; }
 
@@ -149,6 +181,13 @@ static inline int evfs__nop(EvfsLock *(l)) { return 0; }
 #define evfs__lock(l)          evfs__nop(l)
 #define evfs__unlock(l)        evfs__nop(l)
 
+#define evfs__rwlock_init(l)       evfs__nop(l)
+#define evfs__rwlock_destroy(l)    evfs__nop(l)
+#define evfs__lock_shared(l)       evfs__nop(l)
+#define evfs__unlock_shared(l)     evfs__nop(l)
+#define evfs__lock_exclusive(l)    evfs__nop(l)
+#define evfs__unlock_exclusive(l)  evfs__nop(l)
+
 #endif
 
 
@@ -157,6 +196,57 @@ void evfs__lib_init(void);  // Called by evfs__init_once()
 bool evfs__vfs_existing_dir(Evfs *vfs, const char *path);
 evfs_off_t evfs__absolute_offset(EvfsFile *fh, evfs_off_t offset, EvfsSeekDir origin);
 char *evfs__vmprintf(const char *fmt, va_list args);
+char *evfs__vprintf_buf(char *buf, size_t buf_size, int *len, const char *fmt, va_list args);
+
+// Release output from evfs__vprintf_buf() when it didn't fit in the caller's buffer
+static inline void evfs__printf_buf_free(char *buf, char *caller_buf) {
+  if(buf != caller_buf)
+    evfs_class_free(EVFS_ALLOC_FORMAT, buf);
+}
+
+// Handle allocation for EvfsFile and EvfsDir objects
+#ifdef EVFS_USE_HANDLE_POOL
+void *evfs__alloc_handle(Evfs *vfs, EvfsHandlePool *pool, size_t size);
+void evfs__free_handle(void *handle);
+#else
+#  define evfs__alloc_handle(vfs, pool, size)  evfs_class_malloc(EVFS_ALLOC_HANDLE, (size))
+#  define evfs__free_handle(handle)            evfs_class_free(EVFS_ALLOC_HANDLE, (handle))
+#endif
+
+// Per-thread path buffers that replace the shared buffers and their locks
+#if defined EVFS_USE_THREAD_LOCAL_PATHS && defined EVFS_USE_THREADING
+#  define EVFS_USE_SCRATCH_PATHS
+char *evfs__scratch_path_get(void);
+void evfs__scratch_path_put(char *path);
+#endif
+
+// Absolute paths for VFS drivers that need them to access their filesystem
+typedef struct EvfsAbsPath {
+  const char *path;   // Resolved path. This may be the original path.
+#ifdef ALLOW_LONG_PATHS
+  char       *long_path;  // Allocated when the path doesn't fit in buf
+#endif
+  char        buf[EVFS_MAX_PATH];
+} EvfsAbsPath;
+
+bool evfs__path_is_normalized_subpath(const char *path);
+int evfs__path_resolve(Evfs *vfs, const char *path, EvfsAbsPath *abs);
+#ifdef ALLOW_LONG_PATHS
+void evfs__path_release(EvfsAbsPath *abs);
+#else
+#  define evfs__path_release(abs)
+#endif
+
+// Resolve a path into abs_path for the duration of a VFS method
+// Returns from the method on error. Release with FREE_ABS().
+#define MAKE_ABS(rel_path, abs_path) EvfsAbsPath abs_path##_r; const char *abs_path; do { \
+  int status_ma = evfs__path_resolve(vfs, rel_path, &abs_path##_r); \
+  if(status_ma != EVFS_OK) \
+    return status_ma; \
+  abs_path = abs_path##_r.path; \
+} while(0)
+
+#define FREE_ABS(abs_path)  evfs__path_release(&abs_path##_r)
 
 #endif // EVFS_INTERNAL_H
 
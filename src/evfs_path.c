@@ -58,7 +58,7 @@ static bool append_normalized_root(Evfs *vfs, AppendRange *dest, StringRange *ro
       truncated = true;
 
   } else { // Fallback to malloc
-    char *root_norm = evfs_malloc(range_size(root)+1);
+    char *root_norm = evfs_class_malloc(EVFS_ALLOC_PATH, range_size(root)+1);
     if(MEM_CHECK(root_norm)) { // Failed malloc
       // Just append the root without normalization
       if(range_cat_range_no_nul(dest, root) < 0)
@@ -72,7 +72,7 @@ static bool append_normalized_root(Evfs *vfs, AppendRange *dest, StringRange *ro
       if(range_cat_range_no_nul(dest, root) < 0)
         truncated = true;
 
-      evfs_free(root_norm);
+      evfs_class_free(EVFS_ALLOC_PATH, root_norm);
     }
   }
 
@@ -411,7 +411,7 @@ static int path_normalize_long(Evfs *vfs, const char *path, AppendRange *normali
 
 
   // Create a stack to track tokens
-  StringRange *tok_stack = evfs_malloc(tok_count * sizeof(StringRange));
+  StringRange *tok_stack = evfs_class_malloc(EVFS_ALLOC_PATH, tok_count * sizeof(StringRange));
   if(MEM_CHECK(tok_stack)) return EVFS_ERR_ALLOC;
 
   int stack_head = 0;
@@ -464,7 +464,7 @@ static int path_normalize_long(Evfs *vfs, const char *path, AppendRange *normali
   // Add NUL
   *normalized->start = '\0';
 
-  evfs_free(tok_stack);
+  evfs_class_free(EVFS_ALLOC_PATH, tok_stack);
 
   if(truncated)
     THROW(EVFS_ERR_OVERFLOW);
@@ -602,7 +602,7 @@ int evfs_vfs_path_absolute(Evfs *vfs, const char *path, StringRange *absolute) {
 
   } else { // Need temp string
     size_t joined_len = root_len + cwd_len + 1 + path_len + 1;
-    joined = evfs_malloc(joined_len);
+    joined = evfs_class_malloc(EVFS_ALLOC_PATH, joined_len);
     if(MEM_CHECK(joined)) return EVFS_ERR_ALLOC;
 
     range_init(&joined_r, joined, joined_len); // Joining into new temp buf
@@ -616,7 +616,7 @@ int evfs_vfs_path_absolute(Evfs *vfs, const char *path, StringRange *absolute) {
       rval = evfs_vfs_path_normalize(vfs, joined, absolute);
     }
 
-    evfs_free(joined);
+    evfs_class_free(EVFS_ALLOC_PATH, joined);
   }
 
   return rval;
@@ -725,3 +725,128 @@ int evfs_vfs_scan_path(Evfs *vfs, const char *path, StringRange *element) {
 }
 
 
+
+
+// ******************** Path resolution for VFS drivers ********************
+
+/*
+Check if the portion of a path after its root component is already normalized
+
+Args:
+  path:  Path following the root component
+
+Returns:
+  true when there are no dot segments or redundant separators
+*/
+bool evfs__path_is_normalized_subpath(const char *path) {
+  if(*path == '\0')
+    return true;
+
+  const char *seg = path;
+  while(1) {
+    const char *seg_end = seg + str_cspan(seg, EVFS_PATH_SEPS);
+
+    if(seg_end == seg) // Repeated or trailing separator
+      return false;
+
+    if(seg[0] == '.' && (seg_end - seg == 1 || seg[1] == '.')) // Dot segments
+      return false;
+
+    if(*seg_end == '\0')
+      return true;
+
+    if(*seg_end != EVFS_DIR_SEP)
+      return false;
+
+    seg = seg_end + 1;
+  }
+}
+
+
+// A normalized root ends in a single EVFS_DIR_SEP
+static bool is_normalized_root(StringRange *root) {
+  size_t root_len = range_size(root);
+  if(root->end[-1] != EVFS_DIR_SEP)
+    return false;
+
+  return root_len == 1 || !char_match(root->end[-2], EVFS_PATH_SEPS);
+}
+
+
+/*
+Resolve a path into a normalized absolute path for a VFS driver
+
+Paths that are already normalized and absolute are returned unchanged.
+Others are resolved into the EVFS_MAX_PATH buffer in abs. When
+ALLOW_LONG_PATHS is defined, paths that don't fit are allocated and must be
+released with evfs__path_release().
+
+Args:
+  vfs:   VFS the path belongs to
+  path:  Path to resolve
+  abs:   Resolved path in abs->path
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs__path_resolve(Evfs *vfs, const char *path, EvfsAbsPath *abs) {
+  abs->path = NULL;
+#ifdef ALLOW_LONG_PATHS
+  abs->long_path = NULL;
+#endif
+
+  StringRange root;
+  if(vfs->m_path_root_component(vfs, path, &root) && is_normalized_root(&root) &&
+      evfs__path_is_normalized_subpath(root.end)) {
+    abs->path = path;
+    return EVFS_OK;
+  }
+
+  StringRange abs_r = RANGE_FROM_ARRAY(abs->buf);
+  int status = evfs_vfs_path_absolute(vfs, path, &abs_r);
+
+#ifdef ALLOW_LONG_PATHS
+  if(status == EVFS_ERR_OVERFLOW) { // Retry with space for the path joined to the CWD
+    size_t abs_size = strlen(path) + 1;
+
+    if(!evfs_vfs_path_is_absolute(vfs, path)) {
+      status = vfs->m_get_cur_dir(vfs, &abs_r);
+      if(status != EVFS_OK)
+        return status;
+      abs_size += strlen(abs->buf) + 1;
+    }
+
+    abs->long_path = evfs_class_malloc(EVFS_ALLOC_PATH, abs_size);
+    if(MEM_CHECK(abs->long_path)) return EVFS_ERR_ALLOC;
+
+    range_init(&abs_r, abs->long_path, abs_size);
+    status = evfs_vfs_path_absolute(vfs, path, &abs_r);
+    if(status != EVFS_OK) {
+      evfs__path_release(abs);
+      return status;
+    }
+
+    abs->path = abs->long_path;
+    return EVFS_OK;
+  }
+#endif
+
+  if(status == EVFS_OK)
+    abs->path = abs->buf;
+
+  return status;
+}
+
+
+#ifdef ALLOW_LONG_PATHS
+/*
+Release a path from evfs__path_resolve()
+
+Args:
+  abs:  Resolved path
+*/
+void evfs__path_release(EvfsAbsPath *abs) {
+  evfs_class_free(EVFS_ALLOC_PATH, abs->long_path);
+  abs->long_path = NULL;
+}
+#endif
@@ -0,0 +1,436 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Handle pools for EvfsFile and EvfsDir objects
+
+  A pool is a single slab of fixed size slots carved out when it is created.
+  Every handle allocated by the core library is prefixed with a small header
+  identifying the pool or allocator it came from so that evfs_file_close() and
+  evfs_dir_close() can return it without knowing the owning VFS. When a pool
+  is exhausted, handles fall back to the VFS allocator or the EVFS_ALLOC_HANDLE
+  class allocator.
+
+  With threading enabled, each thread keeps a few recently freed slots in a
+  thread local cache so that repeated open/close cycles avoid the pool lock.
+  Cached slots are flagged in their header and claimed atomically. A pool that
+  runs out of free slots reclaims cached ones from any thread. Slots left in the
+  cache of an exited thread or evicted from a full cache are never lost.
+------------------------------------------------------------------------------
+*/
+
+#include "evfs.h"
+#include "evfs_internal.h"
+
+
+#ifdef EVFS_USE_HANDLE_POOL
+
+#ifdef EVFS_USE_THREADING
+#  include <stdatomic.h>
+#endif
+
+// Prefix for all core allocated handles
+typedef union HandleHeader {
+  struct {
+    EvfsHandlePool      *pool;  // NULL when allocated from the heap
+    const EvfsAllocator *alloc; // Heap allocator for this handle
+#ifdef EVFS_USE_THREADING
+    atomic_bool          cached; // Free pool slot held in a thread cache
+#endif
+  };
+  max_align_t     align;
+} HandleHeader;
+
+
+// Unused slots are kept in a singly linked list
+typedef struct PoolSlot {
+  HandleHeader      hdr;
+  struct PoolSlot  *next;
+} PoolSlot;
+
+
+struct EvfsHandlePool {
+  size_t    slot_size;
+  unsigned  num_slots;
+  uint8_t  *slab;
+  uint8_t  *slab_end;
+  PoolSlot *free_list;
+  unsigned  serial;     // Distinguishes pools that reuse the same address
+#ifdef EVFS_USE_THREADING
+  EvfsLock  pool_lock;
+  atomic_uint cached;   // Slots flagged as cached
+#endif
+};
+
+
+// Round up object size to match alignment of a type
+#define ROUND_UP_ALIGN(n, T)  ((n) + _Alignof(T)-1 - ((n) + _Alignof(T)-1) % _Alignof(T))
+
+
+#ifdef EVFS_USE_THREADING
+#  define LOCK(p)    evfs__lock(&(p)->pool_lock)
+#  define UNLOCK(p)  evfs__unlock(&(p)->pool_lock)
+
+static atomic_uint s_pool_serial = 1;
+#  define NEXT_SERIAL()  atomic_fetch_add_explicit(&s_pool_serial, 1, memory_order_relaxed)
+
+
+// Per-thread cache of free slots
+#  ifndef EVFS_POOL_TLS_SLOTS
+#    define EVFS_POOL_TLS_SLOTS  4
+#  endif
+
+// Entries are only dereferenced when they match a live pool. Entries for
+// deleted pools are never touched and get replaced by later puts.
+typedef struct TlsSlot {
+  EvfsHandlePool *pool;
+  unsigned        serial;
+  PoolSlot       *slot;
+} TlsSlot;
+
+static _Thread_local TlsSlot s_tls_cache[EVFS_POOL_TLS_SLOTS];
+static _Thread_local unsigned s_tls_evict;
+
+
+// Take ownership of a cached slot. Fails if another thread reclaimed it first.
+static bool claim_cached(EvfsHandlePool *pool, PoolSlot *slot) {
+  bool expected = true;
+  if(!atomic_compare_exchange_strong_explicit(&slot->hdr.cached, &expected, false,
+                                              memory_order_acq_rel, memory_order_relaxed))
+    return false;
+
+  atomic_fetch_sub_explicit(&pool->cached, 1, memory_order_relaxed);
+  return true;
+}
+
+
+// Take a cached slot belonging to pool
+static PoolSlot *tls_cache_get(EvfsHandlePool *pool) {
+  for(int i = 0; i < EVFS_POOL_TLS_SLOTS; i++) {
+    TlsSlot *ts = &s_tls_cache[i];
+    if(ts->pool != pool) continue;
+
+    PoolSlot *slot = ts->slot;
+    bool stale = ts->serial != pool->serial; // Pool was recreated at the same address
+    *ts = (TlsSlot){0};
+
+    if(!stale && claim_cached(pool, slot))
+      return slot;
+  }
+
+  return NULL;
+}
+
+// Store a free slot in the cache
+static bool tls_cache_put(EvfsHandlePool *pool, PoolSlot *slot) {
+  TlsSlot *dest = NULL;
+  int others = 0;
+
+  for(int i = 0; i < EVFS_POOL_TLS_SLOTS; i++) {
+    TlsSlot *ts = &s_tls_cache[i];
+    if(!ts->pool || (ts->pool == pool && ts->serial != pool->serial)) { // Unused or stale
+      dest = ts;
+      break;
+    }
+
+    if(ts->pool != pool)
+      others++;
+  }
+
+  if(!dest) {
+    // A cache full of this pool's slots sends the rest back to the free list
+    if(others == 0)
+      return false;
+
+    // Evict an entry for another pool. Its slot stays flagged so the pool can
+    // still reclaim it if it's alive.
+    do {
+      dest = &s_tls_cache[s_tls_evict++ % EVFS_POOL_TLS_SLOTS];
+    } while(dest->pool == pool);
+  }
+
+  atomic_fetch_add_explicit(&pool->cached, 1, memory_order_relaxed);
+  atomic_store_explicit(&slot->hdr.cached, true, memory_order_release);
+  *dest = (TlsSlot){.pool = pool, .serial = pool->serial, .slot = slot};
+  return true;
+}
+
+
+// Reclaim a slot cached by any thread
+// Must be called with the pool lock held
+static PoolSlot *reclaim_cached(EvfsHandlePool *pool) {
+  if(atomic_load_explicit(&pool->cached, memory_order_relaxed) == 0)
+    return NULL;
+
+  for(uint8_t *pos = pool->slab; pos < pool->slab_end; pos += pool->slot_size) {
+    PoolSlot *slot = (PoolSlot *)pos;
+    if(atomic_load_explicit(&slot->hdr.cached, memory_order_relaxed) && claim_cached(pool, slot))
+      return slot;
+  }
+
+  return NULL;
+}
+
+#else
+#  define LOCK(p)
+#  define UNLOCK(p)
+
+static unsigned s_pool_serial = 1;
+#  define NEXT_SERIAL()  (s_pool_serial++)
+
+#  define tls_cache_get(p)     NULL
+#  define tls_cache_put(p, s)  false
+#  define reclaim_cached(p)    NULL
+#endif
+
+
+
+// Create a new pool with num_slots handles of handle_size bytes
+static EvfsHandlePool *evfs__pool_new(size_t handle_size, unsigned num_slots) {
+  size_t slot_size = ROUND_UP_ALIGN(sizeof(HandleHeader) + handle_size, max_align_t);
+  slot_size = MAX(slot_size, sizeof(PoolSlot));
+
+  size_t pool_size = ROUND_UP_ALIGN(sizeof(EvfsHandlePool), max_align_t);
+  size_t slab_size = slot_size * num_slots;
+  if(slab_size / slot_size != num_slots) // Overflow
+    return NULL;
+
+  EvfsHandlePool *pool = evfs_class_malloc(EVFS_ALLOC_HANDLE, pool_size + slab_size);
+  if(MEM_CHECK(pool)) return NULL;
+
+  pool->slot_size = slot_size;
+  pool->num_slots = num_slots;
+  pool->slab      = (uint8_t *)pool + pool_size;
+  pool->slab_end  = pool->slab + slab_size;
+  pool->free_list = NULL;
+  pool->serial    = NEXT_SERIAL();
+
+#ifdef EVFS_USE_THREADING
+  evfs__lock_init(&pool->pool_lock);
+  atomic_init(&pool->cached, 0);
+#endif
+
+  // Link all slots into the free list
+  for(unsigned i = num_slots; i > 0; i--) {
+    PoolSlot *slot = (PoolSlot *)(pool->slab + (i-1) * slot_size);
+#ifdef EVFS_USE_THREADING
+    atomic_init(&slot->hdr.cached, false);
+#endif
+    slot->next = pool->free_list;
+    pool->free_list = slot;
+  }
+
+  return pool;
+}
+
+
+static void evfs__pool_delete(EvfsHandlePool *pool) {
+  if(!pool) return;
+
+#ifdef EVFS_USE_THREADING
+  evfs__lock_destroy(&pool->pool_lock);
+#endif
+  evfs_class_free(EVFS_ALLOC_HANDLE, pool);
+}
+
+
+/*
+Preallocate handle pools for a VFS
+
+Open file and directory handles will be taken from the pools until they are
+exhausted. Any further handles come from the heap. This should be called after
+the VFS is registered and before any files or directories are opened on it.
+Calling this again replaces the existing pools.
+
+Args:
+  vfs:          The VFS to add pools to
+  file_handles: Number of EvfsFile handles to preallocate
+  dir_handles:  Number of EvfsDir handles to preallocate
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_vfs_pool_init(Evfs *vfs, unsigned file_handles, unsigned dir_handles) {
+  if(PTR_CHECK(vfs)) return EVFS_ERR_BAD_ARG;
+
+  EvfsHandlePool *file_pool = NULL;
+  EvfsHandlePool *dir_pool = NULL;
+
+  if(file_handles > 0 && vfs->vfs_file_size > 0) {
+    file_pool = evfs__pool_new(vfs->vfs_file_size, file_handles);
+    if(!file_pool) return EVFS_ERR_ALLOC;
+  }
+
+  if(dir_handles > 0 && vfs->vfs_dir_size > 0) {
+    dir_pool = evfs__pool_new(vfs->vfs_dir_size, dir_handles);
+    if(!dir_pool) {
+      evfs__pool_delete(file_pool);
+      return EVFS_ERR_ALLOC;
+    }
+  }
+
+  evfs_vfs_pool_free(vfs);
+  vfs->file_pool = file_pool;
+  vfs->dir_pool = dir_pool;
+
+  return EVFS_OK;
+}
+
+
+/*
+Release the handle pools for a VFS
+
+All handles opened on the VFS must be closed before this is called. This is
+done automatically by evfs_unregister().
+
+Args:
+  vfs:  The VFS to remove pools from
+*/
+void evfs_vfs_pool_free(Evfs *vfs) {
+  if(PTR_CHECK(vfs)) return;
+
+  evfs__pool_delete(vfs->file_pool);
+  evfs__pool_delete(vfs->dir_pool);
+  vfs->file_pool = NULL;
+  vfs->dir_pool = NULL;
+}
+
+
+/*
+Get the number of unused slots in a pool
+
+This includes free slots held in thread local caches since any thread can
+reclaim them.
+
+Args:
+  pool: The pool to check
+
+Returns:
+  Number of available slots
+*/
+unsigned evfs_pool_available(EvfsHandlePool *pool) {
+  if(!pool) return 0;
+
+  unsigned avail = 0;
+  LOCK(pool);
+  for(PoolSlot *slot = pool->free_list; slot; slot = slot->next) {
+    avail++;
+  }
+  UNLOCK(pool);
+
+#ifdef EVFS_USE_THREADING
+  avail += atomic_load_explicit(&pool->cached, memory_order_relaxed);
+#endif
+
+  return avail;
+}
+
+
+
+/*
+Set the allocator used for handles of a VFS
+
+This allocator is used for handles that don't come from a pool. If it is
+NULL the EVFS_ALLOC_HANDLE class allocator is used.
+
+Args:
+  vfs:    The VFS to modify
+  alloc:  Allocator for new handles
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_vfs_set_allocator(Evfs *vfs, const EvfsAllocator *alloc) {
+  if(PTR_CHECK(vfs)) return EVFS_ERR_BAD_ARG;
+
+  vfs->allocator = alloc;
+  return EVFS_OK;
+}
+
+
+// Allocate a handle from a pool or the heap if pool is NULL or empty
+// vfs can be NULL for file objects that wrap another file
+void *evfs__alloc_handle(Evfs *vfs, EvfsHandlePool *pool, size_t size) {
+  HandleHeader *hdr = NULL;
+
+  if(pool) {
+    PoolSlot *slot = tls_cache_get(pool);
+
+    if(!slot) {
+      LOCK(pool);
+      slot = pool->free_list;
+      if(slot)
+        pool->free_list = slot->next;
+      else
+        slot = reclaim_cached(pool);
+      UNLOCK(pool);
+    }
+
+    if(slot) {
+      hdr = &slot->hdr;
+      hdr->pool = pool;
+      hdr->alloc = NULL;
+    }
+  }
+
+  if(!hdr) { // Fall back to heap
+    // Files that don't belong to a VFS use the default allocator
+    const EvfsAllocator *alloc = vfs && vfs->allocator ? vfs->allocator :
+                                                         evfs_get_allocator(EVFS_ALLOC_HANDLE);
+    hdr = evfs_alloc_with(alloc, EVFS_ALLOC_HANDLE, sizeof(HandleHeader) + size);
+    if(!hdr) return NULL;
+    hdr->pool = NULL;
+    hdr->alloc = alloc;
+  }
+
+  return &hdr[1];
+}
+
+
+// Return a handle to its pool or the heap
+void evfs__free_handle(void *handle) {
+  if(!handle) return;
+
+  HandleHeader *hdr = &((HandleHeader *)handle)[-1];
+  EvfsHandlePool *pool = hdr->pool;
+
+  if(!pool) {
+    evfs_free_with(hdr->alloc, EVFS_ALLOC_HANDLE, hdr);
+    return;
+  }
+
+  PoolSlot *slot = (PoolSlot *)hdr;
+  if(tls_cache_put(pool, slot))
+    return;
+
+  LOCK(pool);
+  slot->next = pool->free_list;
+  pool->free_list = slot;
+  UNLOCK(pool);
+}
+
+#else // Pools disabled
+
+int evfs_vfs_set_allocator(Evfs *vfs, const EvfsAllocator *alloc) {
+  return EVFS_ERR_DISABLED;
+}
+
+int evfs_vfs_pool_init(Evfs *vfs, unsigned file_handles, unsigned dir_handles) {
+  return EVFS_ERR_DISABLED;
+}
+
+void evfs_vfs_pool_free(Evfs *vfs) {
+}
+
+unsigned evfs_pool_available(EvfsHandlePool *pool) {
+  return 0;
+}
+
+#endif // EVFS_USE_HANDLE_POOL
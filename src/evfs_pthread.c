@@ -17,6 +17,9 @@ Embedded Virtual Filesystem
 
 #if defined EVFS_USE_THREADING && defined USE_PTHREADS
 
+#include <errno.h>
+#include <time.h>
+
 
 static pthread_once_t s_evfs_init_flag = PTHREAD_ONCE_INIT;
 void evfs__init_once(void) {
@@ -46,4 +49,122 @@ int evfs__unlock(EvfsLock *lock) {
   return err == 0 ? EVFS_OK : EVFS_ERR;
 }
 
+
+// ******************** Reader/writer lock API ********************
+
+#ifndef EVFS_RWLOCK_USE_MUTEX
+int evfs__rwlock_init(EvfsRwLock *lock) {
+  int err = pthread_rwlock_init(lock, NULL);
+  return err == 0 ? EVFS_OK : EVFS_ERR;
+}
+
+int evfs__rwlock_destroy(EvfsRwLock *lock) {
+  int err = pthread_rwlock_destroy(lock);
+  return err == 0 ? EVFS_OK : EVFS_ERR;
+}
+
+
+int evfs__lock_shared(EvfsRwLock *lock) {
+  int err = pthread_rwlock_rdlock(lock);
+  return err == 0 ? EVFS_OK : EVFS_ERR;
+}
+
+int evfs__unlock_shared(EvfsRwLock *lock) {
+  int err = pthread_rwlock_unlock(lock);
+  return err == 0 ? EVFS_OK : EVFS_ERR;
+}
+
+
+int evfs__lock_exclusive(EvfsRwLock *lock) {
+  int err = pthread_rwlock_wrlock(lock);
+  return err == 0 ? EVFS_OK : EVFS_ERR;
+}
+
+int evfs__unlock_exclusive(EvfsRwLock *lock) {
+  int err = pthread_rwlock_unlock(lock);
+  return err == 0 ? EVFS_OK : EVFS_ERR;
+}
+#endif
+
+
+// ******************** Condition variable API ********************
+
+int evfs__cond_init(EvfsCond *cond) {
+  int err = pthread_cond_init(cond, NULL);
+  return err == 0 ? EVFS_OK : EVFS_ERR;
+}
+
+int evfs__cond_destroy(EvfsCond *cond) {
+  int err = pthread_cond_destroy(cond);
+  return err == 0 ? EVFS_OK : EVFS_ERR;
+}
+
+int evfs__cond_wait(EvfsCond *cond, EvfsLock *lock) {
+  int err = pthread_cond_wait(cond, lock);
+  return err == 0 ? EVFS_OK : EVFS_ERR;
+}
+
+// Returns EVFS_OK when signaled or after timeout_ms has elapsed
+int evfs__cond_timedwait(EvfsCond *cond, EvfsLock *lock, unsigned timeout_ms) {
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec  += timeout_ms / 1000;
+  deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+  if(deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+
+  int err = pthread_cond_timedwait(cond, lock, &deadline);
+  return (err == 0 || err == ETIMEDOUT) ? EVFS_OK : EVFS_ERR;
+}
+
+int evfs__cond_signal(EvfsCond *cond) {
+  int err = pthread_cond_signal(cond);
+  return err == 0 ? EVFS_OK : EVFS_ERR;
+}
+
+int evfs__cond_broadcast(EvfsCond *cond) {
+  int err = pthread_cond_broadcast(cond);
+  return err == 0 ? EVFS_OK : EVFS_ERR;
+}
+
+
+// ******************** Thread API ********************
+
+typedef struct ThreadStart {
+  EvfsThreadFunc func;
+  void *arg;
+} ThreadStart;
+
+// Adapt EvfsThreadFunc to the pthreads start routine signature
+static void *thread_trampoline(void *arg) {
+  ThreadStart start = *(ThreadStart *)arg;
+  evfs_free(arg);
+
+  start.func(start.arg);
+  return NULL;
+}
+
+int evfs__thread_create(EvfsThread *thread, EvfsThreadFunc func, void *arg) {
+  ThreadStart *start = evfs_malloc(sizeof(*start));
+  if(MEM_CHECK(start)) return EVFS_ERR_ALLOC;
+
+  start->func = func;
+  start->arg = arg;
+
+  int err = pthread_create(thread, NULL, thread_trampoline, start);
+  if(err != 0) {
+    evfs_free(start);
+    return EVFS_ERR;
+  }
+
+  return EVFS_OK;
+}
+
+int evfs__thread_join(EvfsThread thread) {
+  int err = pthread_join(thread, NULL);
+  return err == 0 ? EVFS_OK : EVFS_ERR;
+}
+
 #endif
@@ -0,0 +1,525 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Recursive tree copy and delete
+
+  Both operations run in three phases. The source tree is scanned with
+  evfs_walk() into lists of directories and files. Directories are created
+  in one batch before any file is copied, or removed in one batch after all
+  files are deleted. Files are processed by a pool of workers that take the
+  next entry from a shared list.
+
+  Backends that don't report EVFS_CMD_GET_CONCURRENT_WRITES have all file
+  operations serialized by a lock. The source and destination have separate
+  locks so one worker's reads overlap the writes of another.
+------------------------------------------------------------------------------
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "evfs.h"
+#include "evfs_internal.h"
+#include "evfs/util/glob.h"
+
+
+#define DEFAULT_TREE_BUF_SIZE  4096
+#define MIN_TREE_BUF_SIZE      64
+
+
+// Entry found by the scan
+typedef struct TreeEntry {
+  struct TreeEntry *next;
+  unsigned  depth;
+  char      path[]; // Relative to the tree root
+} TreeEntry;
+
+typedef struct TreeList {
+  TreeEntry *head;
+  size_t     count;
+} TreeList;
+
+
+struct TreeOp;
+typedef int (*TreeJob)(struct TreeOp *op, const TreeEntry *entry, char *buf);
+
+typedef struct TreeOp {
+  Evfs       *src_vfs;
+  Evfs       *dest_vfs;
+  const char *src_root;
+  const char *dest_root;
+  const EvfsTreeConfig *cfg;
+  size_t      buf_size;
+
+  EvfsLock    lock;         // Protects everything below
+  TreeList    dirs;
+  TreeList    files;
+  size_t      root_len;     // Length of the walk root for making relative paths
+  TreeEntry **items;        // Entries for the workers
+  size_t      num_items;
+  size_t      next_item;
+  int         status;       // First error encountered
+
+  EvfsLock   *read_lock;    // Serializes source access. NULL if not needed
+  EvfsLock   *write_lock;   // Serializes destination access. NULL if not needed
+  EvfsLock    src_lock;
+  EvfsLock    dest_lock;
+  TreeJob     job;
+} TreeOp;
+
+
+#define TREE_LOCK(lock)   do { if(lock) evfs__lock(lock); } while(0)
+#define TREE_UNLOCK(lock) do { if(lock) evfs__unlock(lock); } while(0)
+
+
+static void tree_list_free(TreeList *list) {
+  TreeEntry *entry = list->head;
+  while(entry) {
+    TreeEntry *next = entry->next;
+    evfs_class_free(EVFS_ALLOC_PATH, entry);
+    entry = next;
+  }
+
+  list->head = NULL;
+  list->count = 0;
+}
+
+
+// Build a full path from a root and a path relative to it
+static int tree_join(char *path, const char *root, const char *rel_path) {
+  size_t root_len = strlen(root);
+  size_t rel_len = strlen(rel_path);
+  bool add_sep = root_len > 0 && rel_len > 0 && !char_match(root[root_len-1], EVFS_PATH_SEPS);
+
+  if(root_len + add_sep + rel_len + 1 > EVFS_MAX_PATH)
+    return EVFS_ERR_TOO_LONG;
+
+  memcpy(path, root, root_len);
+  if(add_sep)
+    path[root_len++] = EVFS_DIR_SEP;
+  memcpy(&path[root_len], rel_path, rel_len + 1);
+
+  return EVFS_OK;
+}
+
+
+// ******************** Scan ********************
+
+// Walk visitor that records each entry
+static int tree_scan_visit(const char *path, const EvfsInfo *info, unsigned depth, void *ctx) {
+  TreeOp *op = (TreeOp *)ctx;
+
+  const char *rel_path = &path[op->root_len];
+  while(char_match(*rel_path, EVFS_PATH_SEPS)) {
+    rel_path++;
+  }
+
+  size_t rel_len = strlen(rel_path);
+  TreeEntry *entry = evfs_class_malloc(EVFS_ALLOC_PATH, sizeof(*entry) + rel_len + 1);
+  if(MEM_CHECK(entry)) return EVFS_ERR_ALLOC;
+
+  entry->depth = depth;
+  memcpy(entry->path, rel_path, rel_len + 1);
+
+  TreeList *list = (info->type & EVFS_FILE_DIR) ? &op->dirs : &op->files;
+
+  evfs__lock(&op->lock);
+  entry->next = list->head;
+  list->head = entry;
+  list->count++;
+  evfs__unlock(&op->lock);
+
+  return EVFS_OK;
+}
+
+
+static int tree_scan(TreeOp *op, const char *vfs_name, bool parallel) {
+  EvfsWalkConfig walk_cfg = {
+    .pre_visit    = tree_scan_visit,
+    .pattern      = op->cfg->pattern,
+    .max_depth    = -1,
+    .num_threads  = parallel ? op->cfg->num_threads : 1,
+    .ctx          = op
+  };
+
+  op->root_len = strlen(op->src_root);
+  return evfs_walk_ex(op->src_root, &walk_cfg, vfs_name);
+}
+
+
+// Order directories so parents come before their children
+static int compare_depth(const void *pa, const void *pb) {
+  const TreeEntry *a = *(const TreeEntry **)pa;
+  const TreeEntry *b = *(const TreeEntry **)pb;
+
+  return (a->depth > b->depth) - (a->depth < b->depth);
+}
+
+
+// Prepare an array of entries for the workers
+static int tree_set_items(TreeOp *op, TreeList *list, bool sort_depth) {
+  evfs_free(op->items);
+  op->items = NULL;
+  op->num_items = list->count;
+  op->next_item = 0;
+
+  if(list->count == 0) return EVFS_OK;
+
+  op->items = evfs_malloc(list->count * sizeof(*op->items));
+  if(MEM_CHECK(op->items)) return EVFS_ERR_ALLOC;
+
+  size_t i = 0;
+  for(TreeEntry *entry = list->head; entry; entry = entry->next) {
+    op->items[i++] = entry;
+  }
+
+  if(sort_depth)
+    qsort(op->items, op->num_items, sizeof(*op->items), compare_depth);
+
+  return EVFS_OK;
+}
+
+
+// ******************** Workers ********************
+
+static void tree_worker(void *arg) {
+  TreeOp *op = (TreeOp *)arg;
+
+  char *buf = NULL;
+  if(op->buf_size > 0) {
+    buf = evfs_malloc(op->buf_size);
+    if(MEM_CHECK(buf)) {
+      evfs__lock(&op->lock);
+      if(op->status == EVFS_OK)
+        op->status = EVFS_ERR_ALLOC;
+      evfs__unlock(&op->lock);
+      return;
+    }
+  }
+
+  while(1) {
+    evfs__lock(&op->lock);
+    TreeEntry *entry = NULL;
+    if(op->status == EVFS_OK && op->next_item < op->num_items)
+      entry = op->items[op->next_item++];
+    evfs__unlock(&op->lock);
+
+    if(!entry)
+      break;
+
+    int status = op->job(op, entry, buf);
+    if(status != EVFS_OK) {
+      evfs__lock(&op->lock);
+      if(op->status == EVFS_OK)
+        op->status = status;
+      evfs__unlock(&op->lock);
+    }
+  }
+
+  evfs_free(buf);
+}
+
+
+// Run the job on all items with the configured number of threads
+static int tree_run(TreeOp *op, TreeJob job, bool parallel) {
+  op->job = job;
+
+#ifdef EVFS_USE_THREADING
+  unsigned num_threads = parallel ? op->cfg->num_threads : 1;
+  if(num_threads > op->num_items)
+    num_threads = op->num_items;
+
+  if(num_threads > 1) {
+    EvfsThread *threads = evfs_malloc((num_threads-1) * sizeof(*threads));
+    if(MEM_CHECK(threads)) return EVFS_ERR_ALLOC;
+
+    // The calling thread is also a worker. Fewer workers are used if any
+    // threads can't be started.
+    unsigned started = 0;
+    for(unsigned i = 1; i < num_threads; i++) {
+      if(evfs__thread_create(&threads[started], tree_worker, op) == EVFS_OK)
+        started++;
+    }
+
+    tree_worker(op);
+
+    for(unsigned i = 0; i < started; i++) {
+      evfs__thread_join(threads[i]);
+    }
+
+    evfs_free(threads);
+    return op->status;
+  }
+#endif
+
+  tree_worker(op);
+  return op->status;
+}
+
+
+// Access to backends without EVFS_CMD_GET_CONCURRENT_WRITES is serialized
+static bool tree_concurrent_writes(Evfs *vfs) {
+  unsigned concurrent = 0;
+  if(vfs->m_vfs_ctrl(vfs, EVFS_CMD_GET_CONCURRENT_WRITES, &concurrent) != EVFS_OK)
+    return false;
+
+  return concurrent != 0;
+}
+
+
+static int tree_op_init(TreeOp *op, const EvfsTreeConfig *cfg) {
+  static const EvfsTreeConfig s_default_cfg = {0};
+
+  memset(op, 0, sizeof(*op));
+  op->cfg = cfg ? cfg : &s_default_cfg;
+  op->status = EVFS_OK;
+
+  if(evfs__lock_init(&op->lock) != EVFS_OK)
+    THROW(EVFS_ERR_INIT);
+
+  if(evfs__lock_init(&op->src_lock) != EVFS_OK) {
+    evfs__lock_destroy(&op->lock);
+    THROW(EVFS_ERR_INIT);
+  }
+
+  if(evfs__lock_init(&op->dest_lock) != EVFS_OK) {
+    evfs__lock_destroy(&op->src_lock);
+    evfs__lock_destroy(&op->lock);
+    THROW(EVFS_ERR_INIT);
+  }
+
+  return EVFS_OK;
+}
+
+
+static void tree_op_free(TreeOp *op) {
+  tree_list_free(&op->dirs);
+  tree_list_free(&op->files);
+  evfs_free(op->items);
+  evfs__lock_destroy(&op->dest_lock);
+  evfs__lock_destroy(&op->src_lock);
+  evfs__lock_destroy(&op->lock);
+}
+
+
+// ******************** Copy ********************
+
+static int tree_make_dir(TreeOp *op, const TreeEntry *entry, char *buf) {
+  char dest_path[EVFS_MAX_PATH];
+  int status = tree_join(dest_path, op->dest_root, entry->path);
+  if(status != EVFS_OK) return status;
+
+  status = op->dest_vfs->m_make_dir(op->dest_vfs, dest_path);
+  return status == EVFS_ERR_EXISTS ? EVFS_OK : status;
+}
+
+
+static int tree_copy_file(TreeOp *op, const TreeEntry *entry, char *buf) {
+  char path[EVFS_MAX_PATH];
+  EvfsFile *src_fh;
+  EvfsFile *dest_fh;
+
+  int status = tree_join(path, op->src_root, entry->path);
+  if(status != EVFS_OK) return status;
+
+  TREE_LOCK(op->read_lock);
+  status = evfs_vfs_open(op->src_vfs, path, &src_fh, EVFS_READ | EVFS_SEQUENTIAL);
+  TREE_UNLOCK(op->read_lock);
+  if(status != EVFS_OK) return status;
+
+  status = tree_join(path, op->dest_root, entry->path);
+  if(status != EVFS_OK)
+    goto close_src;
+
+  TREE_LOCK(op->write_lock);
+  status = evfs_vfs_open(op->dest_vfs, path, &dest_fh, EVFS_WRITE | EVFS_OVERWRITE);
+  TREE_UNLOCK(op->write_lock);
+  if(status != EVFS_OK)
+    goto close_src;
+
+  while(1) {
+    TREE_LOCK(op->read_lock);
+    ptrdiff_t read = evfs_file_read(src_fh, buf, op->buf_size);
+    TREE_UNLOCK(op->read_lock);
+    if(read <= 0) {
+      if(read < 0) status = read;
+      break;
+    }
+
+    TREE_LOCK(op->write_lock);
+    ptrdiff_t wrote = evfs_file_write(dest_fh, buf, read);
+    TREE_UNLOCK(op->write_lock);
+
+    if(wrote != read) {
+      status = wrote < 0 ? wrote : EVFS_ERR_IO;
+      break;
+    }
+  }
+
+  TREE_LOCK(op->write_lock);
+  int close_status = evfs_file_close(dest_fh);
+  TREE_UNLOCK(op->write_lock);
+  if(status == EVFS_OK)
+    status = close_status;
+
+close_src:
+  TREE_LOCK(op->read_lock);
+  evfs_file_close(src_fh);
+  TREE_UNLOCK(op->read_lock);
+
+  return status;
+}
+
+
+/*
+Copy a directory tree
+
+Everything below src_path is copied into dest_path which is created if it
+doesn't exist. Existing files in the destination are overwritten. The whole
+source tree is scanned first and all directories are created before any
+files are copied.
+
+With threading enabled and more than one thread in cfg, the scan and the file
+copies are done in parallel. Each thread has its own transfer buffer. Access
+to a VFS that doesn't report EVFS_CMD_GET_CONCURRENT_WRITES is serialized but
+reads from the source still overlap writes to a different destination VFS.
+
+Args:
+  src_path:   Root of the tree to copy
+  dest_path:  Directory to copy into
+  cfg:        Configuration for the copy. Use NULL for a serial copy of all files.
+  src_vfs:    VFS to copy from. Use default VFS if NULL
+  dest_vfs:   VFS to copy to. Use default VFS if NULL
+
+Returns:
+  EVFS_OK on success or the first error encountered
+*/
+int evfs_copy_tree_ex(const char *src_path, const char *dest_path, const EvfsTreeConfig *cfg,
+                      const char *src_vfs, const char *dest_vfs) {
+  if(PTR_CHECK(src_path) || PTR_CHECK(dest_path)) return EVFS_ERR_BAD_ARG;
+
+  TreeOp op;
+  int status = tree_op_init(&op, cfg);
+  if(status != EVFS_OK) return status;
+
+  EvfsVfsRef src_ref = EVFS_VFS_REF(src_vfs);
+  EvfsVfsRef dest_ref = EVFS_VFS_REF(dest_vfs);
+  op.src_vfs = evfs_vfs_ref_resolve(&src_ref);
+  op.dest_vfs = evfs_vfs_ref_resolve(&dest_ref);
+  if(!op.src_vfs || !op.dest_vfs) {
+    tree_op_free(&op);
+    THROW(EVFS_ERR_NO_VFS);
+  }
+
+  op.src_root = src_path;
+  op.dest_root = dest_path;
+
+  // A backend shared by both sides uses one lock for all access
+  if(!tree_concurrent_writes(op.dest_vfs))
+    op.write_lock = &op.dest_lock;
+  if(!tree_concurrent_writes(op.src_vfs))
+    op.read_lock = op.src_vfs == op.dest_vfs ? op.write_lock : &op.src_lock;
+
+  size_t buf_size = op.cfg->buf_size;
+  op.buf_size = buf_size > 0 ? MAX(buf_size, MIN_TREE_BUF_SIZE) : DEFAULT_TREE_BUF_SIZE;
+
+  status = tree_scan(&op, op.src_vfs->vfs_name, /*parallel*/ !op.read_lock);
+
+  if(status == EVFS_OK)
+    status = evfs_make_path_ex(dest_path, op.dest_vfs->vfs_name);
+
+  // Parents are made first so directories are created serially
+  if(status == EVFS_OK)
+    status = tree_set_items(&op, &op.dirs, /*sort_depth*/ true);
+  if(status == EVFS_OK)
+    status = tree_run(&op, tree_make_dir, /*parallel*/ false);
+
+  if(status == EVFS_OK)
+    status = tree_set_items(&op, &op.files, /*sort_depth*/ false);
+  if(status == EVFS_OK)
+    status = tree_run(&op, tree_copy_file, /*parallel*/ true);
+
+  tree_op_free(&op);
+  return status;
+}
+
+
+// ******************** Delete ********************
+
+static int tree_delete_entry(TreeOp *op, const TreeEntry *entry, char *buf) {
+  char path[EVFS_MAX_PATH];
+  int status = tree_join(path, op->src_root, entry->path);
+  if(status != EVFS_OK) return status;
+
+  TREE_LOCK(op->write_lock);
+  status = op->src_vfs->m_delete(op->src_vfs, path);
+  TREE_UNLOCK(op->write_lock);
+
+  return status;
+}
+
+
+/*
+Delete a directory tree
+
+All files below path are deleted in parallel when more than one thread is
+configured. The directories are then removed deepest first, finishing with
+path itself. When cfg has a pattern only the matching files are deleted and
+directories are left in place.
+
+Args:
+  path:     Root of the tree to delete
+  cfg:      Configuration for the delete. Use NULL for a serial delete.
+  vfs_name: VFS to work on. Use default VFS if NULL
+
+Returns:
+  EVFS_OK on success or the first error encountered
+*/
+int evfs_delete_tree_ex(const char *path, const EvfsTreeConfig *cfg, const char *vfs_name) {
+  if(PTR_CHECK(path)) return EVFS_ERR_BAD_ARG;
+
+  TreeOp op;
+  int status = tree_op_init(&op, cfg);
+  if(status != EVFS_OK) return status;
+
+  EvfsVfsRef ref = EVFS_VFS_REF(vfs_name);
+  op.src_vfs = evfs_vfs_ref_resolve(&ref);
+  if(!op.src_vfs) {
+    tree_op_free(&op);
+    THROW(EVFS_ERR_NO_VFS);
+  }
+
+  op.src_root = path;
+  if(!tree_concurrent_writes(op.src_vfs))
+    op.write_lock = &op.dest_lock;
+
+  status = tree_scan(&op, op.src_vfs->vfs_name, /*parallel*/ !op.write_lock);
+
+  if(status == EVFS_OK)
+    status = tree_set_items(&op, &op.files, /*sort_depth*/ false);
+  if(status == EVFS_OK)
+    status = tree_run(&op, tree_delete_entry, /*parallel*/ true);
+
+  if(status == EVFS_OK && !op.cfg->pattern) {
+    status = tree_set_items(&op, &op.dirs, /*sort_depth*/ true);
+
+    // Children come after their parents so the items are taken from the end
+    for(size_t i = op.num_items; status == EVFS_OK && i > 0; i--) {
+      status = tree_delete_entry(&op, op.items[i-1], NULL);
+    }
+
+    if(status == EVFS_OK)
+      status = op.src_vfs->m_delete(op.src_vfs, path);
+  }
+
+  tree_op_free(&op);
+  return status;
+}
@@ -0,0 +1,519 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Recursive directory tree walker
+
+  The serial walker is a depth first recursion that visits entries in the
+  order the filesystem returns them and uses a single path buffer.
+
+  The parallel walker turns each directory into a task. Every worker thread,
+  including the caller, has its own deque of tasks. Workers take tasks from
+  the head of their own deque and steal from the tail of the others when
+  they run dry. Each task counts itself and its unfinished subdirectories
+  so that post visits happen after everything beneath a directory is done.
+------------------------------------------------------------------------------
+*/
+
+#include <string.h>
+
+#include "evfs.h"
+#include "evfs_internal.h"
+#include "evfs/util/glob.h"
+
+
+typedef struct WalkState {
+  Evfs *vfs;
+  const EvfsWalkConfig *cfg;
+  GlobPattern *pattern;   // Compiled cfg->pattern
+  bool match_path;        // Pattern has separators and is matched against relative paths
+  size_t root_len;
+  int status;             // First error encountered
+} WalkState;
+
+
+// Directories are descended into when their contents are within the depth limit
+static inline bool can_descend(const EvfsWalkConfig *cfg, unsigned depth) {
+  return cfg->max_depth < 0 || depth < (unsigned)cfg->max_depth;
+}
+
+static inline bool is_dir_dots(const char *name) {
+  return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+
+// Append a name to a directory path
+static int append_name(char *path, size_t path_len, const char *name, size_t *new_len) {
+  size_t name_len = strlen(name);
+  bool add_sep = path_len > 0 && !char_match(path[path_len-1], EVFS_PATH_SEPS);
+
+  if(path_len + add_sep + name_len + 1 > EVFS_MAX_PATH)
+    return EVFS_ERR_TOO_LONG;
+
+  if(add_sep)
+    path[path_len++] = EVFS_DIR_SEP;
+  memcpy(&path[path_len], name, name_len + 1);
+
+  *new_len = path_len + name_len;
+  return EVFS_OK;
+}
+
+
+// Decide if an entry is passed to the visitors
+static bool entry_selected(const WalkState *ws, const EvfsInfo *info, const char *path) {
+  if((info->type & EVFS_FILE_DIR) || !ws->pattern)
+    return true;
+
+  if(!ws->match_path)
+    return glob_match_compiled(ws->pattern, info->name);
+
+  const char *rel_path = &path[ws->root_len];
+  while(char_match(*rel_path, EVFS_PATH_SEPS)) {
+    rel_path++;
+  }
+  return glob_match_compiled(ws->pattern, rel_path);
+}
+
+
+// ******************** Serial walk ********************
+
+static int walk_serial(WalkState *ws, char *path, size_t path_len, unsigned depth) {
+  const EvfsWalkConfig *cfg = ws->cfg;
+  EvfsDir *dh;
+
+  int status = evfs_vfs_open_dir(ws->vfs, path, &dh);
+  if(status != EVFS_OK)
+    return status;
+
+  EvfsInfo info;
+  while(evfs_dir_read(dh, &info) == EVFS_OK) {
+    if(is_dir_dots(info.name))
+      continue;
+
+    size_t child_len;
+    status = append_name(path, path_len, info.name, &child_len);
+    if(status != EVFS_OK)
+      break;
+
+    if(!entry_selected(ws, &info, path)) {
+      path[path_len] = '\0';
+      continue;
+    }
+
+    status = cfg->pre_visit ? cfg->pre_visit(path, &info, depth, cfg->ctx) : EVFS_OK;
+
+    if(status == EVFS_OK && (info.type & EVFS_FILE_DIR)) {
+      EvfsInfo dir_info = info;
+
+      if(can_descend(cfg, depth))
+        status = walk_serial(ws, path, child_len, depth+1);
+
+      if(status == EVFS_OK && cfg->post_visit) {
+        path[child_len] = '\0'; // Restore path from the recursive walk
+        status = cfg->post_visit(path, &dir_info, depth, cfg->ctx);
+      }
+    }
+
+    path[path_len] = '\0';
+
+    if(status == EVFS_DONE) // Skipped directory
+      status = EVFS_OK;
+    if(status != EVFS_OK)
+      break;
+  }
+
+  evfs_dir_close(dh);
+  return status;
+}
+
+
+// ******************** Parallel walk ********************
+
+#ifdef EVFS_USE_THREADING
+#  include <stdatomic.h>
+
+typedef struct WalkTask {
+  struct WalkTask *prev;  // Deque links
+  struct WalkTask *next;
+  struct WalkTask *parent;
+  unsigned  pending;      // This task plus unfinished child tasks
+  unsigned  depth;        // Depth of entries in this directory
+  EvfsInfo  info;         // Info for the post visit
+  char      path[];
+} WalkTask;
+
+typedef struct WalkDeque {
+  EvfsLock  lock;
+  WalkTask *head;
+  WalkTask *tail;
+} WalkDeque;
+
+typedef struct ParallelWalk {
+  WalkState   ws;
+  EvfsLock    lock;         // Protects everything below and task pending counts
+  EvfsCond    work_ready;
+  unsigned    outstanding;  // Tasks queued or being processed
+  unsigned    generation;   // Incremented on each push so idle workers can detect new work
+  atomic_bool abort;        // Checked by workers without the lock
+
+  unsigned    num_workers;
+  WalkDeque  *deques;
+} ParallelWalk;
+
+#  define WALK_ABORTED(pw)  atomic_load_explicit(&(pw)->abort, memory_order_relaxed)
+
+typedef struct WalkWorker {
+  ParallelWalk *pw;
+  unsigned id;
+} WalkWorker;
+
+
+static void deque_push_head(WalkDeque *dq, WalkTask *task) {
+  evfs__lock(&dq->lock);
+  task->prev = NULL;
+  task->next = dq->head;
+  if(dq->head)
+    dq->head->prev = task;
+  else
+    dq->tail = task;
+  dq->head = task;
+  evfs__unlock(&dq->lock);
+}
+
+static WalkTask *deque_pop_head(WalkDeque *dq) {
+  evfs__lock(&dq->lock);
+  WalkTask *task = dq->head;
+  if(task) {
+    dq->head = task->next;
+    if(dq->head)
+      dq->head->prev = NULL;
+    else
+      dq->tail = NULL;
+  }
+  evfs__unlock(&dq->lock);
+  return task;
+}
+
+static WalkTask *deque_pop_tail(WalkDeque *dq) {
+  evfs__lock(&dq->lock);
+  WalkTask *task = dq->tail;
+  if(task) {
+    dq->tail = task->prev;
+    if(dq->tail)
+      dq->tail->next = NULL;
+    else
+      dq->head = NULL;
+  }
+  evfs__unlock(&dq->lock);
+  return task;
+}
+
+
+static void walk_abort(ParallelWalk *pw, int status) {
+  evfs__lock(&pw->lock);
+  if(!atomic_load(&pw->abort)) {
+    atomic_store(&pw->abort, true);
+    pw->ws.status = status;
+  }
+  evfs__cond_broadcast(&pw->work_ready);
+  evfs__unlock(&pw->lock);
+}
+
+
+static WalkTask *new_task(WalkTask *parent, const char *path, size_t path_len, unsigned depth) {
+  WalkTask *task = evfs_class_malloc(EVFS_ALLOC_PATH, sizeof(*task) + path_len + 1);
+  if(MEM_CHECK(task)) return NULL;
+
+  memset(task, 0, sizeof(*task));
+  task->parent = parent;
+  task->pending = 1;
+  task->depth = depth;
+  memcpy(task->path, path, path_len + 1);
+
+  return task;
+}
+
+
+// Release a task's own reference and finish any directories left with nothing pending
+static void finish_task(ParallelWalk *pw, WalkTask *task) {
+  const EvfsWalkConfig *cfg = pw->ws.cfg;
+
+  while(task) {
+    evfs__lock(&pw->lock);
+    unsigned pending = --task->pending;
+    evfs__unlock(&pw->lock);
+
+    if(pending > 0)
+      break;
+
+    if(task->parent && cfg->post_visit && !WALK_ABORTED(pw)) { // Root has no post visit
+      int status = cfg->post_visit(task->path, &task->info, task->depth-1, cfg->ctx);
+      if(status != EVFS_OK && status != EVFS_DONE)
+        walk_abort(pw, status);
+    }
+
+    WalkTask *parent = task->parent;
+    evfs_class_free(EVFS_ALLOC_PATH, task);
+    task = parent;
+  }
+}
+
+
+static int process_task(ParallelWalk *pw, WalkDeque *own_dq, WalkTask *task) {
+  const EvfsWalkConfig *cfg = pw->ws.cfg;
+  char path[EVFS_MAX_PATH];
+  size_t path_len = strlen(task->path);
+  EvfsDir *dh;
+
+  memcpy(path, task->path, path_len + 1);
+
+  int status = evfs_vfs_open_dir(pw->ws.vfs, path, &dh);
+  if(status != EVFS_OK)
+    return status;
+
+  EvfsInfo info;
+  while(!WALK_ABORTED(pw) && evfs_dir_read(dh, &info) == EVFS_OK) {
+    if(is_dir_dots(info.name))
+      continue;
+
+    size_t child_len;
+    status = append_name(path, path_len, info.name, &child_len);
+    if(status != EVFS_OK)
+      break;
+
+    if(!entry_selected(&pw->ws, &info, path)) {
+      path[path_len] = '\0';
+      continue;
+    }
+
+    status = cfg->pre_visit ? cfg->pre_visit(path, &info, task->depth, cfg->ctx) : EVFS_OK;
+
+    if(status == EVFS_OK && (info.type & EVFS_FILE_DIR)) {
+      if(can_descend(cfg, task->depth)) { // Queue the subdirectory
+        WalkTask *child = new_task(task, path, child_len, task->depth+1);
+        if(!child) {
+          status = EVFS_ERR_ALLOC;
+          break;
+        }
+
+        child->info = info;
+        child->info.name = &child->path[child_len - strlen(info.name)];
+
+        evfs__lock(&pw->lock);
+        task->pending++;
+        pw->outstanding++;
+        pw->generation++;
+        evfs__unlock(&pw->lock);
+
+        deque_push_head(own_dq, child);
+
+        evfs__lock(&pw->lock);
+        evfs__cond_signal(&pw->work_ready);
+        evfs__unlock(&pw->lock);
+
+      } else if(cfg->post_visit) { // Depth limit reached
+        status = cfg->post_visit(path, &info, task->depth, cfg->ctx);
+      }
+    }
+
+    path[path_len] = '\0';
+
+    if(status == EVFS_DONE)
+      status = EVFS_OK;
+    if(status != EVFS_OK)
+      break;
+  }
+
+  evfs_dir_close(dh);
+  return status;
+}
+
+
+static WalkTask *find_task(ParallelWalk *pw, unsigned id) {
+  WalkTask *task = deque_pop_head(&pw->deques[id]);
+
+  // Steal the oldest task from another worker. These tend to be closer to
+  // the root with more work beneath them.
+  for(unsigned i = 1; !task && i < pw->num_workers; i++) {
+    task = deque_pop_tail(&pw->deques[(id + i) % pw->num_workers]);
+  }
+
+  return task;
+}
+
+
+static void walk_worker(void *arg) {
+  WalkWorker *worker = (WalkWorker *)arg;
+  ParallelWalk *pw = worker->pw;
+
+  while(1) {
+    evfs__lock(&pw->lock);
+    unsigned generation = pw->generation;
+    evfs__unlock(&pw->lock);
+
+    WalkTask *task = find_task(pw, worker->id);
+
+    if(!task) {
+      evfs__lock(&pw->lock);
+      bool done = pw->outstanding == 0;
+      if(!done && generation == pw->generation)
+        evfs__cond_wait(&pw->work_ready, &pw->lock);
+      evfs__unlock(&pw->lock);
+
+      if(done)
+        break;
+      continue;
+    }
+
+    if(!WALK_ABORTED(pw)) {
+      int status = process_task(pw, &pw->deques[worker->id], task);
+      if(status != EVFS_OK)
+        walk_abort(pw, status);
+    }
+
+    finish_task(pw, task);
+
+    // Wake everyone when the last task is finished so they can exit
+    evfs__lock(&pw->lock);
+    if(--pw->outstanding == 0)
+      evfs__cond_broadcast(&pw->work_ready);
+    evfs__unlock(&pw->lock);
+  }
+}
+
+
+static int walk_parallel(WalkState *ws, const char *path) {
+  unsigned num_workers = ws->cfg->num_threads;
+
+  ParallelWalk pw = {
+    .ws = *ws,
+    .outstanding = 1,
+    .num_workers = num_workers
+  };
+  atomic_init(&pw.abort, false);
+
+  WalkTask *root = new_task(NULL, path, strlen(path), 0);
+  if(!root) return EVFS_ERR_ALLOC;
+
+  // We have three arrays allocated together [WalkDeque[]][WalkWorker[]][EvfsThread[]]
+  pw.deques = evfs_malloc(num_workers * (sizeof(WalkDeque) + sizeof(WalkWorker) + sizeof(EvfsThread)));
+  if(MEM_CHECK(pw.deques)) {
+    evfs_class_free(EVFS_ALLOC_PATH, root);
+    return EVFS_ERR_ALLOC;
+  }
+  WalkWorker *workers = (WalkWorker *)&pw.deques[num_workers];
+  EvfsThread *threads = (EvfsThread *)&workers[num_workers];
+
+  evfs__lock_init(&pw.lock);
+  evfs__cond_init(&pw.work_ready);
+
+  for(unsigned i = 0; i < num_workers; i++) {
+    evfs__lock_init(&pw.deques[i].lock);
+    pw.deques[i].head = NULL;
+    pw.deques[i].tail = NULL;
+    workers[i].pw = &pw;
+    workers[i].id = i;
+  }
+
+  deque_push_head(&pw.deques[0], root);
+
+  // The calling thread is worker 0. The walk proceeds with fewer workers if
+  // any threads can't be started.
+  unsigned started = 0;
+  for(unsigned i = 1; i < num_workers; i++) {
+    if(evfs__thread_create(&threads[started], walk_worker, &workers[i]) == EVFS_OK)
+      started++;
+  }
+
+  walk_worker(&workers[0]);
+
+  for(unsigned i = 0; i < started; i++) {
+    evfs__thread_join(threads[i]);
+  }
+
+  for(unsigned i = 0; i < num_workers; i++) {
+    evfs__lock_destroy(&pw.deques[i].lock);
+  }
+  evfs__cond_destroy(&pw.work_ready);
+  evfs__lock_destroy(&pw.lock);
+  evfs_free(pw.deques);
+
+  return pw.ws.status;
+}
+#endif // EVFS_USE_THREADING
+
+
+/*
+Walk a directory tree
+
+The pre-visit callback sees every entry below path before the contents of
+directories. The post-visit callback sees directories after their contents.
+Either callback may be NULL. A pre-visit returning EVFS_DONE skips the
+contents and post-visit of a directory. Any error code stops the walk.
+
+The pattern only filters entries that aren't directories. It is matched
+against their names unless it contains a directory separator. It is then
+matched against the path relative to the walk root so that "**" can select
+entries at any depth.
+
+The serial walk visits entries in the order they are stored. A parallel walk
+with more than one thread calls the visitors concurrently from different
+threads with no particular ordering between directories. A directory's post
+visit still follows everything beneath it. Without threading support all
+walks are serial.
+
+Args:
+  path:     Root of the tree to walk
+  cfg:      Configuration for the walk
+  vfs_name: VFS to walk on. Use default VFS if NULL
+
+Returns:
+  EVFS_OK on success or the first error returned from a visitor
+*/
+int evfs_walk_ex(const char *path, const EvfsWalkConfig *cfg, const char *vfs_name) {
+  if(PTR_CHECK(path) || PTR_CHECK(cfg)) return EVFS_ERR_BAD_ARG;
+
+  EvfsVfsRef ref = EVFS_VFS_REF(vfs_name);
+  Evfs *vfs = evfs_vfs_ref_resolve(&ref);
+  if(!vfs) THROW(EVFS_ERR_NO_VFS);
+
+  size_t path_len = strlen(path);
+  if(path_len >= EVFS_MAX_PATH) THROW(EVFS_ERR_TOO_LONG);
+
+  WalkState ws = {
+    .vfs = vfs,
+    .cfg = cfg,
+    .root_len = path_len,
+    .status = EVFS_OK
+  };
+
+  if(cfg->pattern) {
+    ws.pattern = glob_compile(cfg->pattern, EVFS_PATH_SEPS);
+    if(MEM_CHECK(ws.pattern)) return EVFS_ERR_ALLOC;
+    ws.match_path = strpbrk(cfg->pattern, EVFS_PATH_SEPS) != NULL;
+  }
+
+  int status;
+
+#ifdef EVFS_USE_THREADING
+  if(cfg->num_threads > 1) {
+    status = walk_parallel(&ws, path);
+  } else
+#endif
+  {
+    char walk_path[EVFS_MAX_PATH];
+    memcpy(walk_path, path, path_len + 1);
+
+    status = walk_serial(&ws, walk_path, path_len, 0);
+  }
+
+  glob_free(ws.pattern);
+  return status;
+}
@@ -0,0 +1,791 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2021 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Evpak VFS
+
+  Mounting only validates the header. Lookups and directory listings read the
+  tables in place from the image. In-memory resources and mapped image files
+  are used directly. Image files that can't be mapped have their metadata
+  read into one heap buffer and file data is read from the image on demand.
+
+  Table entries are bounds checked as they are used so a corrupt image
+  produces errors rather than out of range accesses.
+------------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "evfs.h"
+#include "evfs_internal.h"
+
+#include "evfs/evpak_common.h"
+#include "evfs/evpak_fs.h"
+#include "evfs/util/unaligned_access.h"
+#include "evfs/util/checksum.h"
+
+
+#ifdef EVFS_USE_THREADING
+#  define DIR_LOCK_SHARED()     evfs__lock_shared(&fs_data->dir_lock)
+#  define DIR_UNLOCK_SHARED()   evfs__unlock_shared(&fs_data->dir_lock)
+#  define DIR_LOCK_EXCL()       evfs__lock_exclusive(&fs_data->dir_lock)
+#  define DIR_UNLOCK_EXCL()     evfs__unlock_exclusive(&fs_data->dir_lock)
+#else
+#  define DIR_LOCK_SHARED()
+#  define DIR_UNLOCK_SHARED()
+#  define DIR_LOCK_EXCL()
+#  define DIR_UNLOCK_EXCL()
+#endif
+
+
+typedef struct EvpakData {
+  Evfs       *vfs;
+
+  char      cur_dir[EVFS_MAX_PATH];
+#ifdef EVFS_USE_THREADING
+  EvfsRwLock dir_lock; // Protects cur_dir
+#endif
+
+  const uint8_t *meta;    // Header and tables
+  const uint8_t *data;    // Whole image when it is in memory. NULL if read from image.
+  evfs_off_t    image_size;
+
+  EvfsFile     *image;    // Image file. NULL for resources.
+  EvfsMapping   image_map;
+  uint8_t      *meta_buf; // Heap copy of the metadata for unmapped images
+
+  // Decoded header
+  uint32_t  num_entries;
+  uint32_t  entries_off;
+  uint32_t  hash_off;
+  uint32_t  hash_mask;
+  uint32_t  children_off;
+  uint32_t  num_children;
+  uint32_t  names_off;
+  uint32_t  names_size;
+  uint32_t  data_off;
+} EvpakData;
+
+
+// Decoded table entry
+typedef struct EvpakEntry {
+  const char *path;
+  const char *name;
+  size_t      path_len;
+  uint32_t    flags;
+  uint32_t    offset;
+  uint32_t    size;
+  uint32_t    mtime;
+} EvpakEntry;
+
+
+typedef struct EvpakFile {
+  EvfsFile    base;
+  EvpakData  *fs_data;
+
+  evfs_off_t  data_offset;
+  evfs_off_t  size;
+  evfs_off_t  read_pos;
+} EvpakFile;
+
+
+typedef struct EvpakDir {
+  EvfsDir     base;
+  EvpakData  *fs_data;
+
+  uint32_t    first_child;
+  uint32_t    num_children;
+  uint32_t    cur_child; // Iterator position
+} EvpakDir;
+
+
+
+// ******************** Tables ********************
+
+// Decode entry at index. Returns false if it lies outside the tables.
+static bool evpak__get_entry(EvpakData *fs_data, uint32_t index, EvpakEntry *entry) {
+  if(index >= fs_data->num_entries) return false;
+
+  const uint8_t *ent = fs_data->meta + fs_data->entries_off + (size_t)index * EVPAK_ENTRY_SIZE;
+
+  uint32_t path_off = get_unaligned_u32le(&ent[EVPAK_ENT_PATH_OFF]);
+  entry->path_len   = get_unaligned_u16le(&ent[EVPAK_ENT_PATH_LEN]);
+  uint16_t name_pos = get_unaligned_u16le(&ent[EVPAK_ENT_NAME_POS]);
+  entry->flags      = get_unaligned_u32le(&ent[EVPAK_ENT_FLAGS]);
+  entry->offset     = get_unaligned_u32le(&ent[EVPAK_ENT_OFFSET]);
+  entry->size       = get_unaligned_u32le(&ent[EVPAK_ENT_SIZE]);
+  entry->mtime      = get_unaligned_u32le(&ent[EVPAK_ENT_MTIME]);
+
+  // Path with its NUL must be inside the names
+  if(path_off >= fs_data->names_size || entry->path_len >= fs_data->names_size - path_off ||
+     name_pos > entry->path_len)
+    return false;
+
+  entry->path = (const char *)fs_data->meta + fs_data->names_off + path_off;
+  if(entry->path[entry->path_len] != '\0')
+    return false;
+  entry->name = entry->path + name_pos;
+
+  if(entry->flags & EVPAK_FLAG_DIR) {
+    if(entry->offset > fs_data->num_children || entry->size > fs_data->num_children - entry->offset)
+      return false;
+  } else {
+    uint32_t image_size = fs_data->image_size;
+    if(entry->offset < fs_data->data_off || entry->offset > image_size ||
+       entry->size > image_size - entry->offset)
+      return false;
+  }
+
+  return true;
+}
+
+
+// Find the entry for an absolute path
+static int evpak__lookup_abs_path(EvpakData *fs_data, const char *path, EvpakEntry *entry) {
+  while(*path == '/')
+    path++;
+
+  size_t path_len = strlen(path);
+  while(path_len > 0 && path[path_len-1] == '/')
+    path_len--;
+
+  uint32_t hash = evpak_hash(path, path_len);
+  const uint8_t *buckets = fs_data->meta + fs_data->hash_off;
+
+  for(uint32_t i = 0; i <= fs_data->hash_mask; i++) {
+    uint32_t bucket = (hash + i) & fs_data->hash_mask;
+    uint32_t index = get_unaligned_u32le(&buckets[bucket * 4]);
+    if(index == 0) // Empty bucket ends the probe
+      break;
+
+    if(!evpak__get_entry(fs_data, index-1, entry))
+      return EVFS_ERR_CORRUPTION;
+
+    if(entry->path_len == path_len && !memcmp(entry->path, path, path_len))
+      return EVFS_OK;
+  }
+
+  return EVFS_ERR_NO_PATH;
+}
+
+
+static inline int evpak__lookup_path(Evfs *vfs, const char *path, EvpakEntry *entry) {
+  EvpakData *fs_data = (EvpakData *)vfs->fs_data;
+  int status;
+
+  MAKE_ABS(path, abs_path);
+  status = evpak__lookup_abs_path(fs_data, abs_path, entry);
+  FREE_ABS(abs_path);
+
+  return status;
+}
+
+
+static void evpak__set_info(const EvpakEntry *entry, EvfsInfo *info) {
+  memset(info, 0, sizeof(*info));
+
+  info->name = (char *)entry->name;
+  info->mtime = entry->mtime;
+
+  if(entry->flags & EVPAK_FLAG_DIR)
+    info->type |= EVFS_FILE_DIR;
+  else
+    info->size = entry->size;
+}
+
+
+
+// ******************** File access methods ********************
+
+static int evpak__file_ctrl(EvfsFile *fh, int cmd, void *arg) {
+  EvpakFile *fil = (EvpakFile *)fh;
+  EvpakData *fs_data = fil->fs_data;
+
+  switch(cmd) {
+    case EVFS_CMD_GET_RSRC_ADDR:
+      {
+        if(!fs_data->data) // Only valid for in-memory images
+          return EVFS_ERR_NO_SUPPORT;
+
+        uint8_t **v = (uint8_t **)arg;
+        *v = (uint8_t *)fs_data->data + fil->data_offset;
+      }
+      return EVFS_OK; break;
+
+    case EVFS_CMD_PREFETCH:
+      {
+        if(fs_data->data) // Already in memory
+          return EVFS_OK;
+
+        EvfsFileRange range = *(EvfsFileRange *)arg;
+        if(range.offset >= fil->size) return EVFS_OK;
+
+        evfs_off_t remaining = fil->size - range.offset;
+        if(range.size == 0 || range.size > remaining)
+          range.size = remaining;
+        range.offset += fil->data_offset;
+
+        return evfs_file_ctrl(fs_data->image, EVFS_CMD_PREFETCH, &range);
+      }
+      break;
+
+    default: return EVFS_ERR_NO_SUPPORT; break;
+  }
+}
+
+static int evpak__file_close(EvfsFile *fh) {
+  EvpakFile *fil = (EvpakFile *)fh;
+
+  fil->size = 0;
+  fil->read_pos = 0;
+  return EVFS_OK;
+}
+
+static ptrdiff_t evpak__file_read_at(EvfsFile *fh, void *buf, size_t size, evfs_off_t offset) {
+  EvpakFile *fil = (EvpakFile *)fh;
+  EvpakData *fs_data = fil->fs_data;
+
+  evfs_off_t remaining = fil->size - offset;
+  if(remaining <= 0) return 0;
+
+  if((evfs_off_t)size > remaining)
+    size = remaining;
+
+  evfs_off_t data_offset = fil->data_offset + offset;
+
+  if(fs_data->data) {
+    memcpy(buf, fs_data->data + data_offset, size);
+    return size;
+  }
+
+  // Image reads are positional so no lock is needed
+  return evfs_file_read_at(fs_data->image, buf, size, data_offset);
+}
+
+static ptrdiff_t evpak__file_read(EvfsFile *fh, void *buf, size_t size) {
+  EvpakFile *fil = (EvpakFile *)fh;
+
+  ptrdiff_t rval = evpak__file_read_at(fh, buf, size, fil->read_pos);
+  if(rval > 0)
+    fil->read_pos += rval;
+
+  return rval;
+}
+
+static int evpak__file_map(EvfsFile *fh, evfs_off_t offset, size_t size, EvfsMapping *map) {
+  EvpakFile *fil = (EvpakFile *)fh;
+  EvpakData *fs_data = fil->fs_data;
+
+  if(offset > fil->size) return EVFS_ERR_OVERFLOW;
+
+  evfs_off_t remaining = fil->size - offset;
+  if(remaining == 0) return EVFS_OK; // Empty mapping
+
+  if(size == 0 || (evfs_off_t)size > remaining)
+    size = remaining;
+
+  evfs_off_t data_offset = fil->data_offset + offset;
+
+  if(fs_data->data) { // Mapped in place
+    map->data = fs_data->data + data_offset;
+    map->size = size;
+    return EVFS_OK;
+  }
+
+  return evfs_file_map(fs_data->image, data_offset, size, map);
+}
+
+static int evpak__file_unmap(EvfsFile *fh, EvfsMapping *map) {
+  EvpakFile *fil = (EvpakFile *)fh;
+  EvpakData *fs_data = fil->fs_data;
+
+  if(!fs_data->data)
+    return evfs_file_unmap(fs_data->image, map);
+
+  return EVFS_OK;
+}
+
+static ptrdiff_t evpak__file_write(EvfsFile *fh, const void *buf, size_t size) {
+  return EVFS_ERR_NO_SUPPORT;
+}
+
+static int evpak__file_truncate(EvfsFile *fh, evfs_off_t size) {
+  return EVFS_ERR_NO_SUPPORT;
+}
+
+static int evpak__file_sync(EvfsFile *fh) {
+  return EVFS_OK;
+}
+
+static evfs_off_t evpak__file_size(EvfsFile *fh) {
+  EvpakFile *fil = (EvpakFile *)fh;
+  return fil->size;
+}
+
+static int evpak__file_seek(EvfsFile *fh, evfs_off_t offset, EvfsSeekDir origin) {
+  EvpakFile *fil = (EvpakFile *)fh;
+
+  offset = evfs__absolute_offset(fh, offset, origin);
+  if(ASSERT(offset >= 0, "Invalid offset")) return EVFS_ERR_INVALID;
+
+  if(offset > fil->size)
+    offset = fil->size;
+
+  fil->read_pos = offset;
+
+  return EVFS_OK;
+}
+
+static evfs_off_t evpak__file_tell(EvfsFile *fh) {
+  EvpakFile *fil = (EvpakFile *)fh;
+  return fil->read_pos;
+}
+
+static bool evpak__file_eof(EvfsFile *fh) {
+  EvpakFile *fil = (EvpakFile *)fh;
+  return fil->read_pos >= fil->size;
+}
+
+
+
+static EvfsFileMethods s_evpak_methods = {
+  .m_ctrl     = evpak__file_ctrl,
+  .m_close    = evpak__file_close,
+  .m_read     = evpak__file_read,
+  .m_write    = evpak__file_write,
+  .m_truncate = evpak__file_truncate,
+  .m_sync     = evpak__file_sync,
+  .m_size     = evpak__file_size,
+  .m_seek     = evpak__file_seek,
+  .m_tell     = evpak__file_tell,
+  .m_eof      = evpak__file_eof,
+  .m_read_at  = evpak__file_read_at,
+  .m_map      = evpak__file_map,
+  .m_unmap    = evpak__file_unmap
+};
+
+
+
+// ******************** Directory access methods ********************
+
+static int evpak__dir_close(EvfsDir *dh) {
+  EvpakDir *dir = (EvpakDir *)dh;
+
+  dir->num_children = 0;
+  return EVFS_OK;
+}
+
+
+static int evpak__dir_read(EvfsDir *dh, EvfsInfo *info) {
+  EvpakDir *dir = (EvpakDir *)dh;
+  EvpakData *fs_data = dir->fs_data;
+
+  memset(info, 0, sizeof(*info));
+
+  if(dir->cur_child >= dir->num_children)
+    return EVFS_DONE;
+
+  const uint8_t *children = fs_data->meta + fs_data->children_off;
+  uint32_t index = get_unaligned_u32le(&children[(size_t)(dir->first_child + dir->cur_child) * 4]);
+
+  EvpakEntry entry;
+  if(!evpak__get_entry(fs_data, index, &entry))
+    return EVFS_ERR_CORRUPTION;
+
+  dir->cur_child++;
+  evpak__set_info(&entry, info);
+
+  return EVFS_OK;
+}
+
+
+static int evpak__dir_rewind(EvfsDir *dh) {
+  EvpakDir *dir = (EvpakDir *)dh;
+
+  dir->cur_child = 0;
+  return EVFS_OK;
+}
+
+
+static EvfsDirMethods s_evpak_dir_methods = {
+  .m_close    = evpak__dir_close,
+  .m_read     = evpak__dir_read,
+  .m_rewind   = evpak__dir_rewind
+};
+
+
+
+// ******************** FS access methods ********************
+
+static int evpak__open(Evfs *vfs, const char *path, EvfsFile *fh, int flags) {
+  EvpakData *fs_data = (EvpakData *)vfs->fs_data;
+  EvpakFile *fil = (EvpakFile *)fh;
+
+  memset(fil, 0, sizeof(*fil));
+  fh->methods = &s_evpak_methods;
+
+  if(flags & (EVFS_WRITE | EVFS_OPEN_OR_NEW | EVFS_OVERWRITE | EVFS_APPEND))
+    return EVFS_ERR_NO_SUPPORT;
+
+  fil->fs_data = fs_data;
+
+  EvpakEntry entry;
+  int status = evpak__lookup_path(vfs, path, &entry);
+  if(status != EVFS_OK) return status;
+
+  if(entry.flags & EVPAK_FLAG_DIR)
+    return EVFS_ERR_IS_DIR;
+
+  fil->data_offset = entry.offset;
+  fil->size = entry.size;
+
+  return EVFS_OK;
+}
+
+
+static int evpak__stat(Evfs *vfs, const char *path, EvfsInfo *info) {
+  EvpakEntry entry;
+  int status = evpak__lookup_path(vfs, path, &entry);
+
+  if(status == EVFS_OK) {
+    evpak__set_info(&entry, info);
+    info->name = NULL;
+  } else {
+    memset(info, 0, sizeof(*info));
+  }
+
+  return status;
+}
+
+
+static int evpak__open_dir(Evfs *vfs, const char *path, EvfsDir *dh) {
+  EvpakData *fs_data = (EvpakData *)vfs->fs_data;
+  EvpakDir  *dir = (EvpakDir *)dh;
+
+  memset(dir, 0, sizeof(*dir));
+  dh->methods = &s_evpak_dir_methods;
+  dir->fs_data = fs_data;
+
+  EvpakEntry entry;
+  int status = evpak__lookup_path(vfs, path, &entry);
+  if(status != EVFS_OK) return status;
+
+  if(!(entry.flags & EVPAK_FLAG_DIR))
+    return EVFS_ERR_NO_PATH;
+
+  dir->first_child = entry.offset;
+  dir->num_children = entry.size;
+
+  return EVFS_OK;
+}
+
+
+static int evpak__get_cur_dir(Evfs *vfs, StringRange *cur_dir) {
+  EvpakData *fs_data = (EvpakData *)vfs->fs_data;
+  AppendRange r = *(AppendRange *)cur_dir;
+
+  DIR_LOCK_SHARED();
+  range_cat_str(&r, fs_data->cur_dir);
+  DIR_UNLOCK_SHARED();
+  range_terminate(&r);
+  return EVFS_OK;
+}
+
+
+static int evpak__set_cur_dir(Evfs *vfs, const char *path) {
+  EvpakData *fs_data = (EvpakData *)vfs->fs_data;
+
+  MAKE_ABS(path, abs_path);
+
+  // Confirm the path exists
+  int status = EVFS_OK;
+  if(evfs__vfs_existing_dir(vfs, abs_path)) {
+    DIR_LOCK_EXCL();
+    strncpy(fs_data->cur_dir, abs_path, EVFS_MAX_PATH-1);
+    fs_data->cur_dir[EVFS_MAX_PATH-1] = '\0';
+    DIR_UNLOCK_EXCL();
+  } else {
+    status = EVFS_ERR_NO_PATH;
+  }
+
+  FREE_ABS(abs_path);
+  return status;
+}
+
+
+static void evpak__unmount(EvpakData *fs_data) {
+  if(fs_data->image) {
+    if(fs_data->image_map.data)
+      evfs_file_unmap(fs_data->image, &fs_data->image_map);
+    evfs_file_close(fs_data->image);
+    fs_data->image = NULL;
+  }
+
+  if(fs_data->meta_buf) {
+    evfs_free(fs_data->meta_buf);
+    fs_data->meta_buf = NULL;
+  }
+}
+
+
+static int evpak__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
+  EvpakData *fs_data = (EvpakData *)vfs->fs_data;
+
+  switch(cmd) {
+    case EVFS_CMD_UNREGISTER:
+      evpak__unmount(fs_data);
+#ifdef EVFS_USE_THREADING
+      evfs__rwlock_destroy(&fs_data->dir_lock);
+#endif
+      evfs_free(vfs);
+      return EVFS_OK; break;
+
+    case EVFS_CMD_GET_STAT_FIELDS:
+      {
+        unsigned *v = (unsigned *)arg;
+        *v = EVFS_INFO_SIZE | EVFS_INFO_MTIME | EVFS_INFO_TYPE;
+      }
+      return EVFS_OK; break;
+
+    case EVFS_CMD_GET_DIR_FIELDS:
+      {
+        unsigned *v = (unsigned *)arg;
+        *v = EVFS_INFO_NAME | EVFS_INFO_SIZE | EVFS_INFO_MTIME | EVFS_INFO_TYPE;
+      }
+      return EVFS_OK; break;
+
+    case EVFS_CMD_GET_CONCURRENT_WRITES: // In-memory images have no shared state
+      {
+        unsigned *v = (unsigned *)arg;
+        *v = fs_data->data ? 1 : 0;
+      }
+      return EVFS_OK; break;
+
+    default: return EVFS_ERR_NO_SUPPORT; break;
+  }
+}
+
+
+
+// ******************** Mounting ********************
+
+// Check the header and decode the table locations
+static int evpak__read_header(EvpakData *fs_data, const uint8_t *hdr, evfs_off_t total_size) {
+  if(total_size < EVPAK_HEADER_SIZE || memcmp(&hdr[EVPAK_HDR_MAGIC], EVPAK_MAGIC, EVPAK_MAGIC_LEN))
+    return EVFS_ERR_INVALID;
+
+  if(get_unaligned_u16le(&hdr[EVPAK_HDR_VERSION]) != EVPAK_VERSION)
+    return EVFS_ERR_NO_SUPPORT;
+
+  if(crc32c(hdr, EVPAK_HDR_CRC) != get_unaligned_u32le(&hdr[EVPAK_HDR_CRC]))
+    return EVFS_ERR_CORRUPTION;
+
+  uint32_t header_size = get_unaligned_u32le(&hdr[EVPAK_HDR_HEADER_SIZE]);
+  uint32_t image_size  = get_unaligned_u32le(&hdr[EVPAK_HDR_IMAGE_SIZE]);
+  uint32_t hash_bits   = get_unaligned_u32le(&hdr[EVPAK_HDR_HASH_BITS]);
+
+  fs_data->num_entries  = get_unaligned_u32le(&hdr[EVPAK_HDR_NUM_ENTRIES]);
+  fs_data->entries_off  = get_unaligned_u32le(&hdr[EVPAK_HDR_ENTRIES_OFF]);
+  fs_data->hash_off     = get_unaligned_u32le(&hdr[EVPAK_HDR_HASH_OFF]);
+  fs_data->children_off = get_unaligned_u32le(&hdr[EVPAK_HDR_CHILDREN_OFF]);
+  fs_data->num_children = get_unaligned_u32le(&hdr[EVPAK_HDR_NUM_CHILDREN]);
+  fs_data->names_off    = get_unaligned_u32le(&hdr[EVPAK_HDR_NAMES_OFF]);
+  fs_data->names_size   = get_unaligned_u32le(&hdr[EVPAK_HDR_NAMES_SIZE]);
+  fs_data->data_off     = get_unaligned_u32le(&hdr[EVPAK_HDR_DATA_OFF]);
+
+  if(image_size > (uint64_t)total_size) // Truncated image
+    return EVFS_ERR_CORRUPTION;
+  fs_data->image_size = image_size;
+
+  // All tables must be in the metadata before the file data
+  uint64_t data_off = fs_data->data_off;
+  if(header_size < EVPAK_HEADER_SIZE || data_off > image_size || hash_bits > EVPAK_MAX_HASH_BITS ||
+     fs_data->num_entries == 0 ||
+     fs_data->entries_off < header_size ||
+     fs_data->entries_off + (uint64_t)fs_data->num_entries * EVPAK_ENTRY_SIZE > data_off ||
+     fs_data->hash_off < header_size ||
+     fs_data->hash_off + ((uint64_t)4 << hash_bits) > data_off ||
+     fs_data->children_off < header_size ||
+     fs_data->children_off + (uint64_t)fs_data->num_children * 4 > data_off ||
+     fs_data->names_off < header_size ||
+     fs_data->names_off + (uint64_t)fs_data->names_size > data_off)
+    return EVFS_ERR_CORRUPTION;
+
+  fs_data->hash_mask = ((uint32_t)1 << hash_bits) - 1;
+
+  return EVFS_OK;
+}
+
+
+static int evpak__mount(EvpakData *fs_data, const uint8_t *resource, size_t resource_len,
+                        EvfsFile *image) {
+  int status;
+
+  crc32c_init();
+
+  if(resource) {
+    fs_data->meta = resource;
+    fs_data->data = resource;
+    status = evpak__read_header(fs_data, resource, resource_len);
+    if(status != EVFS_OK) return status;
+
+#ifdef EVFS_USE_IMAGE_MAPPING
+  // Mapped images are used like resources
+  } else if(evfs_file_map(image, 0, 0, &fs_data->image_map) == EVFS_OK && fs_data->image_map.data) {
+    fs_data->meta = fs_data->image_map.data;
+    fs_data->data = fs_data->image_map.data;
+    status = evpak__read_header(fs_data, fs_data->meta, fs_data->image_map.size);
+    if(status != EVFS_OK) {
+      evfs_file_unmap(image, &fs_data->image_map);
+      return status;
+    }
+#endif
+
+  } else {
+    uint8_t hdr[EVPAK_HEADER_SIZE];
+    ptrdiff_t rval = evfs_file_read_at(image, hdr, sizeof hdr, 0);
+    if(rval < 0) return rval;
+    if(rval != sizeof hdr) return EVFS_ERR_INVALID;
+
+    status = evpak__read_header(fs_data, hdr, evfs_file_size(image));
+    if(status != EVFS_OK) return status;
+
+    // Metadata is kept in memory. File data is read from the image.
+    fs_data->meta_buf = evfs_malloc(fs_data->data_off);
+    if(MEM_CHECK(fs_data->meta_buf)) return EVFS_ERR_ALLOC;
+    fs_data->meta = fs_data->meta_buf;
+
+    rval = evfs_file_read_at(image, fs_data->meta_buf, fs_data->data_off, 0);
+    if(rval != (ptrdiff_t)fs_data->data_off)
+      status = rval < 0 ? rval : EVFS_ERR_IO;
+  }
+
+  // The root must be a directory
+  EvpakEntry root;
+  if(status == EVFS_OK && (!evpak__get_entry(fs_data, 0, &root) || !(root.flags & EVPAK_FLAG_DIR)))
+    status = EVFS_ERR_CORRUPTION;
+
+  if(status != EVFS_OK) { // Caller still owns the image
+    if(fs_data->image_map.data)
+      evfs_file_unmap(image, &fs_data->image_map);
+    evfs_free(fs_data->meta_buf);
+    fs_data->meta_buf = NULL;
+    return status;
+  }
+
+  fs_data->image = image;
+  return EVFS_OK;
+}
+
+
+
+// Access objects allocated in a single block of memory
+#define NEXT_OBJ(o) (&(o)[1])
+
+
+static int evpak__register(const char *vfs_name, const uint8_t *resource, size_t resource_len,
+                           EvfsFile *image, bool default_vfs) {
+  Evfs      *new_vfs;
+  EvpakData *fs_data;
+
+  // Construct a new VFS
+  // We have three objects allocated together [Evfs][EvpakData][char[]]
+  size_t alloc_size = sizeof(*new_vfs) + sizeof(*fs_data) + strlen(vfs_name)+1;
+  new_vfs = evfs_malloc(alloc_size);
+  if(MEM_CHECK(new_vfs)) return EVFS_ERR_ALLOC;
+  memset(new_vfs, 0, alloc_size);
+
+  // Prepare new objects
+  fs_data = (EvpakData *)NEXT_OBJ(new_vfs);
+
+  new_vfs->vfs_name = (char *)NEXT_OBJ(fs_data);
+  strcpy((char *)new_vfs->vfs_name, vfs_name);
+
+  // Init FS data
+  fs_data->vfs = new_vfs;
+
+  strncpy(fs_data->cur_dir, "/", 2); // Start in root dir
+
+  // Init VFS
+  new_vfs->vfs_file_size = sizeof(EvpakFile);
+  new_vfs->vfs_dir_size = sizeof(EvpakDir);
+  new_vfs->fs_data = fs_data;
+
+  // Required methods
+  new_vfs->m_open = evpak__open;
+  new_vfs->m_stat = evpak__stat;
+
+  // Optional methods
+  new_vfs->m_open_dir = evpak__open_dir;
+  new_vfs->m_get_cur_dir = evpak__get_cur_dir;
+  new_vfs->m_set_cur_dir = evpak__set_cur_dir;
+  new_vfs->m_vfs_ctrl = evpak__vfs_ctrl;
+
+#ifdef EVFS_USE_THREADING
+  if(evfs__rwlock_init(&fs_data->dir_lock) != EVFS_OK) {
+    evfs_free(new_vfs);
+    THROW(EVFS_ERR_INIT);
+  }
+#endif
+
+  int status = evpak__mount(fs_data, resource, resource_len, image);
+  if(status != EVFS_OK) {
+#ifdef EVFS_USE_THREADING
+    evfs__rwlock_destroy(&fs_data->dir_lock);
+#endif
+    evfs_free(new_vfs);
+    return status;
+  }
+
+  return evfs_register(new_vfs, default_vfs);
+}
+
+
+/*
+Register an evpak instance using an image file
+
+The image is mapped into memory when its VFS supports evfs_file_map().
+Otherwise the metadata is read into memory and file data is read from the
+image. The image is closed when the VFS is unregistered.
+
+Args:
+  vfs_name:      Name of new VFS
+  image:         Opened evpak image. Left open on failure.
+  default_vfs:   Make this the default VFS when true
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_register_evpak(const char *vfs_name, EvfsFile *image, bool default_vfs) {
+  if(PTR_CHECK(vfs_name) || PTR_CHECK(image)) return EVFS_ERR_BAD_ARG;
+
+  return evpak__register(vfs_name, NULL, 0, image, default_vfs);
+}
+
+
+/*
+Register an evpak instance using an in-memory resource array
+
+Args:
+  vfs_name:      Name of new VFS
+  resource:      Array of evpak resource data
+  resource_len:  Length of the resource array
+  default_vfs:   Make this the default VFS when true
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_register_rsrc_evpak(const char *vfs_name, const uint8_t *resource, size_t resource_len,
+                             bool default_vfs) {
+  if(PTR_CHECK(vfs_name) || PTR_CHECK(resource)) return EVFS_ERR_BAD_ARG;
+
+  return evpak__register(vfs_name, resource, resource_len, NULL, default_vfs);
+}
@@ -0,0 +1,463 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2021 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Evpak image builder
+
+  The source tree is scanned into a flat list of entries with the root first.
+  Each directory's children are added together in name order before any of
+  them are descended into. The metadata tables are then built in memory and
+  written in one piece followed by the aligned file data. The image is
+  written sequentially with no seeks.
+------------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "evfs.h"
+#include "evfs_internal.h"
+
+#include "evfs/evpak_common.h"
+#include "evfs/evpak_image.h"
+#include "evfs/util/unaligned_access.h"
+#include "evfs/util/checksum.h"
+
+
+#define EVPAK_DEFAULT_ALIGN   4096
+#define EVPAK_COPY_BUF_SIZE   4096
+
+
+typedef struct EvpakNode {
+  char       *path;         // Relative to the root
+  uint16_t    name_pos;
+  bool        is_dir;
+  evfs_off_t  size;
+  uint32_t    mtime;
+
+  uint32_t    first_child;  // Index into the children table
+  uint32_t    num_children;
+  uint64_t    data_off;
+  uint32_t    path_off;     // Offset in names
+} EvpakNode;
+
+
+typedef struct EvpakBuilder {
+  const EvpakBuildConfig *cfg;
+  EvfsFile   *image;
+  uint64_t    pos;          // Write position
+  size_t      data_align;
+
+  EvpakNode  *nodes;
+  size_t      num_nodes;
+  size_t      alloc_nodes;
+
+  char        path[EVFS_MAX_PATH];  // Source path
+  uint8_t     copy_buf[EVPAK_COPY_BUF_SIZE];
+} EvpakBuilder;
+
+
+// Sections of the image
+enum {SEC_ENTRIES, SEC_HASH, SEC_CHILDREN, SEC_NAMES, SEC_DATA, SEC_IMAGE_END};
+
+
+static inline uint64_t align_up(uint64_t value, size_t align) {
+  return (value + align-1) & ~(uint64_t)(align-1);
+}
+
+
+// ******************** Source tree ********************
+
+// Append a name to the source path. Restore with b->path[path_len] = '\0'.
+static bool evpak__push_path(EvpakBuilder *b, size_t path_len, const char *name) {
+  const char *sep = path_len > 0 && b->path[path_len-1] != '/' ? "/" : "";
+  int len = snprintf(&b->path[path_len], sizeof b->path - path_len, "%s%s", sep, name);
+
+  if(len < 0 || (size_t)len >= sizeof b->path - path_len) {
+    b->path[path_len] = '\0';
+    return false;
+  }
+
+  return true;
+}
+
+
+static void evpak__free_nodes(EvpakBuilder *b) {
+  for(size_t i = 0; i < b->num_nodes; i++) {
+    evfs_free(b->nodes[i].path);
+  }
+
+  evfs_free(b->nodes);
+  b->nodes = NULL;
+  b->num_nodes = 0;
+}
+
+
+static int evpak__add_node(EvpakBuilder *b, const char *parent_path, const char *name, bool is_dir) {
+  if(b->num_nodes == b->alloc_nodes) { // Grow node array
+    size_t new_alloc = b->alloc_nodes ? b->alloc_nodes * 2 : 32;
+    EvpakNode *nodes = evfs_malloc(new_alloc * sizeof(*nodes));
+    if(MEM_CHECK(nodes)) return EVFS_ERR_ALLOC;
+
+    if(b->nodes) {
+      memcpy(nodes, b->nodes, b->num_nodes * sizeof(*nodes));
+      evfs_free(b->nodes);
+    }
+    b->nodes = nodes;
+    b->alloc_nodes = new_alloc;
+  }
+
+  size_t parent_len = strlen(parent_path);
+  size_t name_pos = parent_len > 0 ? parent_len + 1 : 0;
+  size_t path_len = name_pos + strlen(name);
+  if(path_len > UINT16_MAX) return EVFS_ERR_TOO_LONG;
+
+  EvpakNode *node = &b->nodes[b->num_nodes];
+  memset(node, 0, sizeof(*node));
+
+  node->path = evfs_malloc(path_len + 1);
+  if(MEM_CHECK(node->path)) return EVFS_ERR_ALLOC;
+
+  if(parent_len > 0)
+    snprintf(node->path, path_len + 1, "%s/%s", parent_path, name);
+  else
+    strcpy(node->path, name);
+
+  node->name_pos = name_pos;
+  node->is_dir = is_dir;
+  b->num_nodes++;
+
+  return EVFS_OK;
+}
+
+
+static int evpak__compare_nodes(const void *a, const void *b) {
+  const EvpakNode *na = (const EvpakNode *)a;
+  const EvpakNode *nb = (const EvpakNode *)b;
+  return strcmp(&na->path[na->name_pos], &nb->path[nb->name_pos]);
+}
+
+
+// Read a directory and its subdirectories. The current path is in b->path.
+static int evpak__scan_dir(EvpakBuilder *b, size_t dir_index) {
+  EvfsDir *dh;
+  EvfsInfo info;
+
+  int status = evfs_open_dir_ex(b->path, &dh, b->cfg->src_vfs);
+  if(status != EVFS_OK) return status;
+
+  size_t first_child = b->num_nodes;
+
+  while((status = evfs_dir_read(dh, &info)) == EVFS_OK) {
+    if(!strcmp(info.name, ".") || !strcmp(info.name, ".."))
+      continue;
+
+    if(info.type & EVFS_FILE_SYM_LINK)
+      continue;
+
+    status = evpak__add_node(b, b->nodes[dir_index].path, info.name, info.type & EVFS_FILE_DIR);
+    if(status != EVFS_OK) break;
+  }
+
+  evfs_dir_close(dh);
+
+  if(status != EVFS_DONE)
+    return status;
+
+  size_t num_children = b->num_nodes - first_child;
+  if(num_children > 1)
+    qsort(&b->nodes[first_child], num_children, sizeof(*b->nodes), evpak__compare_nodes);
+
+  // Children are contiguous in the node list so their table entries are too.
+  // Every node but the root has a table entry at its index - 1.
+  b->nodes[dir_index].first_child = first_child - 1;
+  b->nodes[dir_index].num_children = num_children;
+
+  // Get sizes and times and descend into subdirectories
+  // Not every VFS reports them from evfs_dir_read()
+  size_t path_len = strlen(b->path);
+  for(size_t i = first_child; i < first_child + num_children; i++) {
+    EvpakNode *node = &b->nodes[i];
+
+    if(!evpak__push_path(b, path_len, &node->path[node->name_pos]))
+      return EVFS_ERR_TOO_LONG;
+
+    status = evfs_stat_ex(b->path, &info, b->cfg->src_vfs);
+    if(status == EVFS_OK) {
+      node->size = node->is_dir ? 0 : info.size;
+      node->mtime = info.mtime > 0 ? (uint32_t)info.mtime : 0;
+
+      if(node->is_dir)
+        status = evpak__scan_dir(b, i);
+    }
+
+    b->path[path_len] = '\0';
+    if(status != EVFS_OK) return status;
+  }
+
+  return EVFS_OK;
+}
+
+
+// ******************** Image output ********************
+
+static int evpak__write(EvpakBuilder *b, const void *buf, size_t size) {
+  ptrdiff_t wrote = evfs_file_write(b->image, buf, size);
+  if(wrote < 0) return wrote;
+  if((size_t)wrote != size) return EVFS_ERR_IO;
+
+  b->pos += size;
+  return EVFS_OK;
+}
+
+
+static int evpak__pad_to(EvpakBuilder *b, uint64_t pos) {
+  memset(b->copy_buf, 0, sizeof b->copy_buf);
+
+  while(b->pos < pos) {
+    size_t size = MIN(sizeof b->copy_buf, pos - b->pos);
+    int status = evpak__write(b, b->copy_buf, size);
+    if(status != EVFS_OK) return status;
+  }
+
+  return EVFS_OK;
+}
+
+
+static int evpak__write_file_data(EvpakBuilder *b, EvpakNode *node) {
+  EvfsFile *fh;
+  evfs_off_t remaining = node->size;
+
+  int status = evfs_open_ex(b->path, &fh, EVFS_READ | EVFS_SEQUENTIAL, b->cfg->src_vfs);
+  if(status != EVFS_OK) return status;
+
+  while(remaining > 0) {
+    size_t size = MIN((evfs_off_t)sizeof b->copy_buf, remaining);
+    ptrdiff_t rval = evfs_file_read(fh, b->copy_buf, size);
+    if(rval <= 0) { // File shrank since the tree was scanned
+      status = rval < 0 ? rval : EVFS_ERR_IO;
+      break;
+    }
+
+    status = evpak__write(b, b->copy_buf, rval);
+    if(status != EVFS_OK) break;
+    remaining -= rval;
+  }
+
+  evfs_file_close(fh);
+  return status;
+}
+
+
+// Build the header and tables. Returns NULL on allocation failure.
+static uint8_t *evpak__build_meta(EvpakBuilder *b, uint32_t hash_bits, uint32_t *offsets) {
+  uint32_t num_buckets = (uint32_t)1 << hash_bits;
+
+  uint8_t *meta = evfs_malloc(offsets[SEC_DATA]);
+  if(MEM_CHECK(meta)) return NULL;
+  memset(meta, 0, offsets[SEC_DATA]);
+
+  uint8_t *hdr = meta;
+  memcpy(&hdr[EVPAK_HDR_MAGIC], EVPAK_MAGIC, EVPAK_MAGIC_LEN);
+  set_unaligned_u16le(EVPAK_VERSION, &hdr[EVPAK_HDR_VERSION]);
+  set_unaligned_u32le(EVPAK_HEADER_SIZE,  &hdr[EVPAK_HDR_HEADER_SIZE]);
+  set_unaligned_u32le(offsets[SEC_IMAGE_END], &hdr[EVPAK_HDR_IMAGE_SIZE]);
+  set_unaligned_u32le(b->num_nodes,       &hdr[EVPAK_HDR_NUM_ENTRIES]);
+  set_unaligned_u32le(offsets[SEC_ENTRIES],   &hdr[EVPAK_HDR_ENTRIES_OFF]);
+  set_unaligned_u32le(offsets[SEC_HASH],      &hdr[EVPAK_HDR_HASH_OFF]);
+  set_unaligned_u32le(hash_bits,          &hdr[EVPAK_HDR_HASH_BITS]);
+  set_unaligned_u32le(offsets[SEC_CHILDREN],  &hdr[EVPAK_HDR_CHILDREN_OFF]);
+  set_unaligned_u32le(b->num_nodes - 1,   &hdr[EVPAK_HDR_NUM_CHILDREN]);
+  set_unaligned_u32le(offsets[SEC_NAMES],     &hdr[EVPAK_HDR_NAMES_OFF]);
+  set_unaligned_u32le(offsets[SEC_DATA] - offsets[SEC_NAMES], &hdr[EVPAK_HDR_NAMES_SIZE]);
+  set_unaligned_u32le(offsets[SEC_DATA],      &hdr[EVPAK_HDR_DATA_OFF]);
+
+  uint32_t align_bits = 0;
+  while(((size_t)1 << align_bits) < b->data_align) {
+    align_bits++;
+  }
+  set_unaligned_u32le(align_bits, &hdr[EVPAK_HDR_ALIGN_BITS]);
+  set_unaligned_u32le(crc32c(hdr, EVPAK_HDR_CRC), &hdr[EVPAK_HDR_CRC]);
+
+  uint8_t *hash_table = &meta[offsets[SEC_HASH]];
+
+  for(size_t i = 0; i < b->num_nodes; i++) {
+    EvpakNode *node = &b->nodes[i];
+    uint8_t *ent = &meta[offsets[SEC_ENTRIES] + i * EVPAK_ENTRY_SIZE];
+    size_t path_len = strlen(node->path);
+
+    set_unaligned_u32le(node->path_off, &ent[EVPAK_ENT_PATH_OFF]);
+    set_unaligned_u16le(path_len,       &ent[EVPAK_ENT_PATH_LEN]);
+    set_unaligned_u16le(node->name_pos, &ent[EVPAK_ENT_NAME_POS]);
+    set_unaligned_u32le(node->is_dir ? EVPAK_FLAG_DIR : 0, &ent[EVPAK_ENT_FLAGS]);
+    if(node->is_dir) {
+      set_unaligned_u32le(node->first_child,  &ent[EVPAK_ENT_OFFSET]);
+      set_unaligned_u32le(node->num_children, &ent[EVPAK_ENT_SIZE]);
+    } else {
+      set_unaligned_u32le(node->data_off, &ent[EVPAK_ENT_OFFSET]);
+      set_unaligned_u32le(node->size,     &ent[EVPAK_ENT_SIZE]);
+    }
+    set_unaligned_u32le(node->mtime, &ent[EVPAK_ENT_MTIME]);
+
+    // Child indices are in node order after the root
+    if(i > 0)
+      set_unaligned_u32le(i, &meta[offsets[SEC_CHILDREN] + (i-1) * 4]);
+
+    memcpy(&meta[offsets[SEC_NAMES] + node->path_off], node->path, path_len+1);
+
+    // Linear probing for a free bucket
+    uint32_t hash = evpak_hash(node->path, path_len);
+    for(uint32_t j = 0; j < num_buckets; j++) {
+      uint8_t *bucket = &hash_table[((hash + j) & (num_buckets-1)) * 4];
+      if(get_unaligned_u32le(bucket) == 0) {
+        set_unaligned_u32le(i+1, bucket);
+        break;
+      }
+    }
+  }
+
+  return meta;
+}
+
+
+/*
+Build an evpak image from a directory tree
+
+Directory entries are sorted by name. File data starts on a multiple of
+cfg->data_align bytes from the start of the image. Symbolic links are skipped.
+Images are limited to 4GiB.
+
+Args:
+  src_dir:  Root of the tree to copy into the image
+  image:    Opened file to write the image into
+  cfg:      Build options. Use NULL for defaults
+
+Returns:
+  EVFS_OK on success
+*/
+int evpak_build_image(const char *src_dir, EvfsFile *image, const EvpakBuildConfig *cfg) {
+  if(PTR_CHECK(src_dir) || PTR_CHECK(image)) return EVFS_ERR_BAD_ARG;
+
+  EvpakBuildConfig default_cfg = {0};
+  if(!cfg)
+    cfg = &default_cfg;
+
+  size_t data_align = cfg->data_align ? cfg->data_align : EVPAK_DEFAULT_ALIGN;
+  if(data_align < 4 || (data_align & (data_align-1)) != 0)
+    THROW(EVFS_ERR_BAD_ARG);
+
+  EvpakBuilder *b = evfs_malloc(sizeof(*b));
+  if(MEM_CHECK(b)) return EVFS_ERR_ALLOC;
+  memset(b, 0, sizeof(*b));
+
+  b->cfg = cfg;
+  b->image = image;
+  b->data_align = data_align;
+
+  int status = EVFS_OK;
+
+  if(strlen(src_dir) >= sizeof b->path)
+    status = EVFS_ERR_TOO_LONG;
+  else
+    strcpy(b->path, src_dir);
+
+  if(status == EVFS_OK) { // Root entry
+    status = evpak__add_node(b, "", "", /*is_dir*/ true);
+    if(status == EVFS_OK) {
+      EvfsInfo info;
+      if(evfs_stat_ex(src_dir, &info, cfg->src_vfs) == EVFS_OK && info.mtime > 0)
+        b->nodes[0].mtime = info.mtime;
+      status = evpak__scan_dir(b, 0);
+    }
+  }
+
+  if(status == EVFS_OK && b->num_nodes > UINT32_MAX / EVPAK_ENTRY_SIZE)
+    status = EVFS_ERR_OVERFLOW;
+
+  uint8_t *meta = NULL;
+
+  if(status == EVFS_OK) {
+    // Hash table is at most half full
+    uint32_t hash_bits = 1;
+    while(((uint64_t)1 << hash_bits) < (uint64_t)b->num_nodes * 2) {
+      hash_bits++;
+    }
+
+    // Layout
+    uint64_t offsets[SEC_IMAGE_END+1];
+
+    offsets[SEC_ENTRIES]  = EVPAK_HEADER_SIZE;
+    offsets[SEC_HASH]     = offsets[SEC_ENTRIES] + (uint64_t)b->num_nodes * EVPAK_ENTRY_SIZE;
+    offsets[SEC_CHILDREN] = offsets[SEC_HASH] + ((uint64_t)4 << hash_bits);
+    offsets[SEC_NAMES]    = offsets[SEC_CHILDREN] + (uint64_t)(b->num_nodes - 1) * 4;
+
+    uint64_t names_size = 0;
+    for(size_t i = 0; i < b->num_nodes; i++) {
+      b->nodes[i].path_off = names_size;
+      names_size += strlen(b->nodes[i].path) + 1;
+    }
+
+    offsets[SEC_DATA] = align_up(offsets[SEC_NAMES] + names_size, data_align);
+
+    uint64_t pos = offsets[SEC_DATA];
+    for(size_t i = 0; i < b->num_nodes; i++) {
+      EvpakNode *node = &b->nodes[i];
+      if(node->is_dir) continue;
+
+      pos = align_up(pos, data_align);
+      node->data_off = pos;
+      pos += node->size;
+    }
+    offsets[SEC_IMAGE_END] = pos;
+
+    if(hash_bits > EVPAK_MAX_HASH_BITS || offsets[SEC_IMAGE_END] > UINT32_MAX)
+      status = EVFS_ERR_OVERFLOW;
+
+    uint32_t offsets32[SEC_IMAGE_END+1];
+    for(int i = 0; i <= SEC_IMAGE_END; i++) {
+      offsets32[i] = offsets[i];
+    }
+
+    if(status == EVFS_OK) {
+      meta = evpak__build_meta(b, hash_bits, offsets32);
+      if(!meta)
+        status = EVFS_ERR_ALLOC;
+    }
+
+    if(status == EVFS_OK)
+      status = evpak__write(b, meta, offsets32[SEC_DATA]);
+  }
+
+  // File data follows in node order
+  size_t root_len = strlen(b->path);
+  for(size_t i = 0; status == EVFS_OK && i < b->num_nodes; i++) {
+    EvpakNode *node = &b->nodes[i];
+    if(node->is_dir) continue;
+
+    status = evpak__pad_to(b, node->data_off);
+    if(status != EVFS_OK) break;
+
+    if(!evpak__push_path(b, root_len, node->path)) {
+      status = EVFS_ERR_TOO_LONG;
+      break;
+    }
+    status = evpak__write_file_data(b, node);
+    b->path[root_len] = '\0';
+  }
+
+  evfs_free(meta);
+  evpak__free_nodes(b);
+  evfs_free(b);
+
+  return status;
+}
@@ -24,6 +24,7 @@ Embedded Virtual Filesystem
 #include "evfs_internal.h"
 #include "evfs/fatfs_fs.h"
 #include "ff.h"
+#include "diskio.h"
 
 ///////////////////////////////////////////////////////////////////////////////////
 
@@ -43,6 +44,9 @@ typedef struct FatfsFile_s {
   FatfsData *fs_data;
   uint8_t pdrv;
   FIL fil;
+#if FF_USE_FASTSEEK
+  DWORD *link_map;  // Cluster link map for fast seek mode
+#endif
 } FatfsFile;
 
 
@@ -85,6 +89,53 @@ static int translate_error(int err) {
 #define simple_error(e)  ((e) == FR_OK ? EVFS_OK : EVFS_ERR)
 
 
+#if FF_VOLUMES >= 2
+#  define VOL_PATH_SIZE  (EVFS_MAX_PATH + 3)
+#else
+#  define VOL_PATH_SIZE  1
+#endif
+
+// FatFs resolves paths without a drive prefix on its current drive which is
+// shared by all volumes. Prefix them with the volume for this VFS instead.
+static const char *fatfs__vol_path(FatfsData *fs_data, const char *path, char *vol_path) {
+#if FF_VOLUMES >= 2
+  if(isalnum((unsigned char)path[0]) && path[1] == ':') // Drive already given
+    return path;
+
+  int len = snprintf(vol_path, VOL_PATH_SIZE, "%u:%s", fs_data->pdrv, path);
+  return len < VOL_PATH_SIZE ? vol_path : NULL;
+#else
+  return path;
+#endif
+}
+
+
+#if defined EVFS_USE_THREADING && FF_VOLUMES >= 2
+// The current drive is changed to get the current directory of a volume
+static EvfsLock s_drive_lock = LOCK_INITIALIZER;
+#  ifndef HAVE_STATIC_LOCK_INIT
+static bool s_drive_lock_ready = false;
+#  endif
+
+#  define DRIVE_LOCK()    evfs__lock(&s_drive_lock)
+#  define DRIVE_UNLOCK()  evfs__unlock(&s_drive_lock)
+#else
+#  define DRIVE_LOCK()
+#  define DRIVE_UNLOCK()
+#endif
+
+
+// VFSs are registered before other threads use them
+static void fatfs__init_drive_lock(void) {
+#if defined EVFS_USE_THREADING && FF_VOLUMES >= 2 && !defined HAVE_STATIC_LOCK_INIT
+  if(!s_drive_lock_ready) {
+    evfs__lock_init(&s_drive_lock);
+    s_drive_lock_ready = true;
+  }
+#endif
+}
+
+
 static bool fatfs__path_root_component(Evfs *vfs, const char *path, StringRange *root) {
   // Handle DOS style drive paths
   const char *pos = path;
@@ -104,8 +155,83 @@ static bool fatfs__path_root_component(Evfs *vfs, const char *path, StringRange
 
 // ******************** File access methods ********************
 
+#if FF_USE_FASTSEEK
+static void fatfs_disable_fast_seek(FatfsFile *fil) {
+  fil->fil.cltbl = NULL;
+  evfs_free(fil->link_map);
+  fil->link_map = NULL;
+}
+
+// Build a cluster link map so random seeks don't walk the FAT chain.
+// FatFs can't grow a file in fast seek mode so only read only files use it.
+static int fatfs_enable_fast_seek(FatfsFile *fil) {
+  if(fil->fil.flag & FA_WRITE)
+    return EVFS_ERR_NO_SUPPORT;
+
+  if(fil->link_map)
+    return EVFS_OK;
+
+  DWORD map_len = 32; // Enough for a file in a few fragments
+
+  while(1) {
+    fil->link_map = evfs_malloc(map_len * sizeof(DWORD));
+    if(MEM_CHECK(fil->link_map)) return EVFS_ERR_ALLOC;
+
+    fil->link_map[0] = map_len;
+    fil->fil.cltbl = fil->link_map;
+
+    FRESULT status = f_lseek(&fil->fil, CREATE_LINKMAP);
+    if(status == FR_OK)
+      return EVFS_OK;
+
+    map_len = fil->link_map[0]; // Required size is returned on FR_NOT_ENOUGH_CORE
+    fatfs_disable_fast_seek(fil);
+
+    if(status != FR_NOT_ENOUGH_CORE)
+      return translate_error(status);
+  }
+}
+#endif
+
 static int fatfs__file_ctrl(EvfsFile *fh, int cmd, void *arg) {
-  //FatfsFile *fil = (FatfsFile *)fh;
+  FatfsFile *fil = (FatfsFile *)fh;
+
+  switch(cmd) {
+    case EVFS_CMD_SET_FILE_ADVICE:
+      {
+        unsigned *v = (unsigned *)arg;
+#if FF_USE_FASTSEEK
+        if(*v == EVFS_ADVICE_RANDOM) {
+          int status = fatfs_enable_fast_seek(fil);
+          if(status != EVFS_ERR_NO_SUPPORT) // Writable files just skip the hint
+            return status;
+        } else if(*v == EVFS_ADVICE_NORMAL || *v == EVFS_ADVICE_SEQUENTIAL) {
+          fatfs_disable_fast_seek(fil);
+        }
+#else
+        (void)v;
+        (void)fil;
+#endif
+      }
+      break;
+
+    case EVFS_CMD_SET_FAST_SEEK:
+      {
+#if FF_USE_FASTSEEK
+        unsigned *v = (unsigned *)arg;
+        if(*v)
+          return fatfs_enable_fast_seek(fil);
+
+        fatfs_disable_fast_seek(fil);
+#else
+        return EVFS_ERR_NO_SUPPORT;
+#endif
+      }
+      break;
+
+    default:
+      break;
+  }
 
   return EVFS_OK;
 }
@@ -113,6 +239,9 @@ static int fatfs__file_ctrl(EvfsFile *fh, int cmd, void *arg) {
 static int fatfs__file_close(EvfsFile *fh) {
   FatfsFile *fil = (FatfsFile *)fh;
   f_close(&fil->fil);
+#if FF_USE_FASTSEEK
+  fatfs_disable_fast_seek(fil);
+#endif
   return EVFS_OK;
 }
 
@@ -345,6 +474,10 @@ static int fatfs__open(Evfs *vfs, const char *path, EvfsFile *fh, int flags) {
   if((flags & (EVFS_WRITE | EVFS_OPEN_OR_NEW | EVFS_OVERWRITE | EVFS_APPEND)) && fs_data->cfg_readonly)
     return EVFS_ERR_DISABLED;
 
+  char vol_path[VOL_PATH_SIZE];
+  path = fatfs__vol_path(fs_data, path, vol_path);
+  if(!path) return EVFS_ERR_TOO_LONG;
+
   BYTE fs_flags = 0;
 
   if(flags & EVFS_READ)        fs_flags |= FA_READ;
@@ -367,6 +500,10 @@ static int fatfs__open(Evfs *vfs, const char *path, EvfsFile *fh, int flags) {
 static int fatfs__stat(Evfs *vfs, const char *path, EvfsInfo *info) {
   FatfsData *fs_data = (FatfsData *)vfs->fs_data;
 
+  char vol_path[VOL_PATH_SIZE];
+  path = fatfs__vol_path(fs_data, path, vol_path);
+  if(!path) return EVFS_ERR_TOO_LONG;
+
   FRESULT status;
 
   status = f_stat(path, &fs_data->info);
@@ -393,6 +530,10 @@ static int fatfs__delete(Evfs *vfs, const char *path) {
 
   if(fs_data->cfg_readonly) return EVFS_ERR_DISABLED;
 
+  char vol_path[VOL_PATH_SIZE];
+  path = fatfs__vol_path(fs_data, path, vol_path);
+  if(!path) return EVFS_ERR_TOO_LONG;
+
   status = f_unlink(path);
   return translate_error(status);
 #else
@@ -408,6 +549,11 @@ static int fatfs__rename(Evfs *vfs, const char *old_path, const char *new_path)
 
   if(fs_data->cfg_readonly) return EVFS_ERR_DISABLED;
 
+  // Any drive on the new path is ignored
+  char vol_path[VOL_PATH_SIZE];
+  old_path = fatfs__vol_path(fs_data, old_path, vol_path);
+  if(!old_path) return EVFS_ERR_TOO_LONG;
+
   status = f_rename(old_path, new_path);
   return translate_error(status);
 #else
@@ -424,6 +570,10 @@ static int fatfs__make_dir(Evfs *vfs, const char *path) {
 
   if(fs_data->cfg_readonly) return EVFS_ERR_DISABLED;
 
+  char vol_path[VOL_PATH_SIZE];
+  path = fatfs__vol_path(fs_data, path, vol_path);
+  if(!path) return EVFS_ERR_TOO_LONG;
+
   status = f_mkdir(path);
   return translate_error(status);
 #else
@@ -434,6 +584,10 @@ static int fatfs__make_dir(Evfs *vfs, const char *path) {
 static int fatfs__open_dir(Evfs *vfs, const char *path, EvfsDir *dh) {
   FatfsData *fs_data = (FatfsData *)vfs->fs_data;
 
+  char vol_path[VOL_PATH_SIZE];
+  path = fatfs__vol_path(fs_data, path, vol_path);
+  if(!path) return EVFS_ERR_TOO_LONG;
+
   FatfsDir *dir = (FatfsDir *)dh;
 
   memset(dir, 0, sizeof(*dir));
@@ -451,11 +605,34 @@ static int fatfs__open_dir(Evfs *vfs, const char *path, EvfsDir *dh) {
 
 
 static int fatfs__get_cur_dir(Evfs *vfs, StringRange *cur_dir) {
-  FRESULT status = f_getcwd((char *)cur_dir->start, range_size(cur_dir));
+  FRESULT status;
+
+#if FF_VOLUMES >= 2
+  // f_getcwd() only reports on the current drive
+  FatfsData *fs_data = (FatfsData *)vfs->fs_data;
+  char drive[5];
+  snprintf(drive, sizeof(drive), "%hhu:", fs_data->pdrv);
+
+  DRIVE_LOCK();
+  status = f_chdrive(drive);
+  if(status == FR_OK)
+    status = f_getcwd((char *)cur_dir->start, range_size(cur_dir));
+  DRIVE_UNLOCK();
+#else
+  status = f_getcwd((char *)cur_dir->start, range_size(cur_dir));
+#endif
+
   return translate_error(status);
 }
 
 static int fatfs__set_cur_dir(Evfs *vfs, const char *path) {
+  FatfsData *fs_data = (FatfsData *)vfs->fs_data;
+
+  // Each volume has its own current directory
+  char vol_path[VOL_PATH_SIZE];
+  path = fatfs__vol_path(fs_data, path, vol_path);
+  if(!path) return EVFS_ERR_TOO_LONG;
+
   FRESULT status = f_chdir(path);
   return translate_error(status);
 }
@@ -466,7 +643,13 @@ static int fatfs__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
 
   switch(cmd) {
     case EVFS_CMD_UNREGISTER:
-      evfs_free(vfs);
+      if(!vfs->is_static)
+        evfs_free(vfs);
+      return EVFS_OK; break;
+
+    case EVFS_CMD_STATIC_INIT:
+      if(fs_data->pdrv >= FF_VOLUMES) return EVFS_ERR_BAD_ARG;
+      fatfs__init_drive_lock();
       return EVFS_OK; break;
 
     case EVFS_CMD_SET_READONLY:
@@ -483,6 +666,9 @@ static int fatfs__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
       }
       return EVFS_OK; break;
 
+    case EVFS_CMD_SET_DIR_STAT: // Directory entries always carry their metadata
+      return EVFS_OK; break;
+
     case EVFS_CMD_GET_DIR_FIELDS:
       {
         unsigned *v = (unsigned *)arg;
@@ -495,6 +681,57 @@ static int fatfs__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
 }
 
 
+static int fatfs__batch(Evfs *vfs, EvfsBatchOp *ops, size_t num_ops) {
+#if FF_FS_READONLY == 0
+  FatfsData *fs_data = (FatfsData *)vfs->fs_data;
+
+  // FatFs syncs the volume after every change. Drivers that understand the batch
+  // commands defer that to the end so the whole batch is committed once.
+  bool deferred = disk_ioctl(fs_data->pdrv, EVFS_FATFS_CTRL_BATCH_BEGIN, NULL) == RES_OK;
+
+  int rval = evfs_batch_generic(vfs, ops, num_ops);
+
+  if(deferred && disk_ioctl(fs_data->pdrv, EVFS_FATFS_CTRL_BATCH_END, NULL) != RES_OK && rval >= 0)
+    rval = EVFS_ERR_IO;
+
+  return rval;
+#else
+  return EVFS_ERR_NO_SUPPORT;
+#endif
+}
+
+
+// ******************** Static VFSs ********************
+
+#ifdef EVFS_FATFS_STATIC_LIST
+#  define FATFS_STATIC_DATA(id, name, drv) \
+  static FatfsData s_fatfs_data_##id = {.pdrv = (drv)};
+
+#  define FATFS_STATIC_VFS(id, name, drv) \
+  Evfs evfs_fatfs_##id = { \
+    .vfs_name       = (name), \
+    .vfs_file_size  = sizeof(FatfsFile), \
+    .vfs_dir_size   = sizeof(FatfsDir), \
+    .fs_data        = &s_fatfs_data_##id, \
+    .m_open         = fatfs__open, \
+    .m_stat         = fatfs__stat, \
+    .m_delete       = fatfs__delete, \
+    .m_rename       = fatfs__rename, \
+    .m_make_dir     = fatfs__make_dir, \
+    .m_open_dir     = fatfs__open_dir, \
+    .m_get_cur_dir  = fatfs__get_cur_dir, \
+    .m_set_cur_dir  = fatfs__set_cur_dir, \
+    .m_vfs_ctrl     = fatfs__vfs_ctrl, \
+    .m_path_root_component = fatfs__path_root_component, \
+    .m_copy         = evfs_default_copy, \
+    .m_batch        = fatfs__batch \
+  };
+
+EVFS_FATFS_STATIC_LIST(FATFS_STATIC_DATA)
+EVFS_FATFS_STATIC_LIST(FATFS_STATIC_VFS)
+#endif
+
+
 // Access objects allocated in a single block of memory
 #define NEXT_OBJ(o) (&(o)[1])
 
@@ -511,7 +748,7 @@ Returns:
   EVFS_OK on success
 */
 int evfs_register_fatfs(const char *vfs_name, uint8_t pdrv, bool default_vfs) {
-  if(PTR_CHECK(vfs_name)) return EVFS_ERR_BAD_ARG;
+  if(PTR_CHECK(vfs_name) || pdrv >= FF_VOLUMES) return EVFS_ERR_BAD_ARG;
   Evfs *new_vfs;
   FatfsData *fs_data;
 
@@ -532,6 +769,8 @@ int evfs_register_fatfs(const char *vfs_name, uint8_t pdrv, bool default_vfs) {
   // Init FS data
   fs_data->pdrv = pdrv;
 
+  fatfs__init_drive_lock();
+
   // Init VFS
   new_vfs->vfs_file_size = sizeof(FatfsFile);
   new_vfs->vfs_dir_size = sizeof(FatfsDir);
@@ -551,6 +790,7 @@ int evfs_register_fatfs(const char *vfs_name, uint8_t pdrv, bool default_vfs) {
   new_vfs->m_vfs_ctrl = fatfs__vfs_ctrl;
   
   new_vfs->m_path_root_component = fatfs__path_root_component;
+  new_vfs->m_batch = fatfs__batch;
 
   return evfs_register(new_vfs, default_vfs);
 }
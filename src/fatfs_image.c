@@ -18,18 +18,82 @@ Embedded Virtual Filesystem
 #include <time.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "ff.h"
 #include "diskio.h"
 
 #include "evfs.h"
 #include "evfs_internal.h"
+#include "evfs/fatfs_fs.h"
 #include "evfs/fatfs_image.h"
 
-static FatfsImage s_fatfs_image_data[FF_VOLUMES] = {0};
+// Image contexts are allocated when a volume is first configured and freed on unmount
+static FatfsImage *s_fatfs_image_data[FF_VOLUMES] = {0};
 
 static inline FatfsImage *get_image_data(BYTE pdrv) {
-  return &s_fatfs_image_data[pdrv];
+  return pdrv < FF_VOLUMES ? s_fatfs_image_data[pdrv] : NULL;
+}
+
+// Private state kept with each image
+typedef struct {
+  FatfsImage  img;
+  unsigned    batch_depth;  // Active batches deferring CTRL_SYNC
+  bool        sync_pending; // CTRL_SYNC was deferred by a batch
+#ifdef EVFS_USE_THREADING
+  EvfsLock    lock;         // Serialize sector access with the sync at the end of a batch
+#endif
+} FatfsImageCtx;
+
+#define IMG_CTX(img)  ((FatfsImageCtx *)(img))
+
+#ifdef EVFS_USE_THREADING
+#  define IMG_LOCK(img)    evfs__lock(&IMG_CTX(img)->lock)
+#  define IMG_UNLOCK(img)  evfs__unlock(&IMG_CTX(img)->lock)
+#else
+#  define IMG_LOCK(img)
+#  define IMG_UNLOCK(img)
+#endif
+
+static FatfsImage *fatfs__image_new(BYTE pdrv) {
+  if(pdrv >= FF_VOLUMES) return NULL;
+
+  FatfsImage *img = s_fatfs_image_data[pdrv];
+  if(!img) {
+    FatfsImageCtx *ctx = evfs_malloc(sizeof(*ctx));
+    if(MEM_CHECK(ctx)) return NULL;
+    memset(ctx, 0, sizeof(*ctx));
+
+#ifdef EVFS_USE_THREADING
+    if(evfs__lock_init(&ctx->lock) != EVFS_OK) {
+      evfs_free(ctx);
+      return NULL;
+    }
+#endif
+    img = &ctx->img;
+    s_fatfs_image_data[pdrv] = img;
+  }
+
+  return img;
+}
+
+static void fatfs__image_free(BYTE pdrv) {
+#ifdef EVFS_USE_THREADING
+  if(s_fatfs_image_data[pdrv])
+    evfs__lock_destroy(&IMG_CTX(s_fatfs_image_data[pdrv])->lock);
+#endif
+  evfs_free(s_fatfs_image_data[pdrv]);
+  s_fatfs_image_data[pdrv] = NULL;
+}
+
+
+// Write back the cache and sync the image file
+static DRESULT fatfs__image_sync(FatfsImage *img) {
+  IMG_CTX(img)->sync_pending = false;
+
+  if(evfs_image_cache_sync(&img->cache) != EVFS_OK)
+    return RES_ERROR;
+  return evfs_file_sync(img->fh) == EVFS_OK ? RES_OK : RES_ERROR;
 }
 
 
@@ -50,9 +114,11 @@ int fatfs_make_image(const char *img_path, uint8_t pdrv, evfs_off_t img_size) {
   if(PTR_CHECK(img_path)) return EVFS_ERR_BAD_ARG;
 
   // We need to use a FatFs volume entry for formatting
-  FatfsImage *img = get_image_data(pdrv);
+  bool new_img = !get_image_data(pdrv);
+  FatfsImage *img = fatfs__image_new(pdrv);
 
-  if(PTR_CHECK(img)) return EVFS_ERR;
+  if(!img) return pdrv < FF_VOLUMES ? EVFS_ERR_ALLOC : EVFS_ERR_BAD_ARG;
+  if(img->fh) return EVFS_ERR_BUSY; // Volume is in use
 
   int status = evfs_open(img_path, &img->fh, EVFS_WRITE | EVFS_NO_EXIST);
 
@@ -67,15 +133,21 @@ int fatfs_make_image(const char *img_path, uint8_t pdrv, evfs_off_t img_size) {
       // Reopen for formatting
       evfs_file_close(img->fh);
       evfs_open(img_path, &img->fh, EVFS_READ | EVFS_WRITE);
+      status = evfs_image_cache_init(&img->cache, img->fh, FF_MAX_SS, img->cache_sectors);
 
+      if(status == EVFS_OK) {
+        char drive_path[5];
+        char buf[FF_MAX_SS*4];
 
-      char drive_path[3];
-      char buf[FF_MAX_SS*4];
+        snprintf(drive_path, sizeof(drive_path), "%hhu:", pdrv);
 
-      snprintf(drive_path, 2, "%hhu", pdrv);
+        FRESULT err = f_mkfs(drive_path, NULL, buf, COUNT_OF(buf));
+        status = (err == FR_OK) ? EVFS_OK : EVFS_ERR;
 
-      FRESULT err = f_mkfs(drive_path, NULL, buf, COUNT_OF(buf));
-      status = (err == FR_OK) ? EVFS_OK : EVFS_ERR;
+        int cache_status = evfs_image_cache_free(&img->cache);
+        if(status == EVFS_OK)
+          status = cache_status;
+      }
 #else
       status = EVFS_ERR_NO_SUPPORT;
 #endif
@@ -85,6 +157,9 @@ int fatfs_make_image(const char *img_path, uint8_t pdrv, evfs_off_t img_size) {
   }
 
   img->fh = NULL;
+  if(new_img)
+    fatfs__image_free(pdrv);
+
   return status;
 }
 
@@ -101,23 +176,38 @@ Returns:
   EVFS_OK on success
 */
 int fatfs_mount_image(const char *img_path, uint8_t pdrv) {
-  if(PTR_CHECK(img_path)) return EVFS_ERR_BAD_ARG;
-  FatfsImage *img = get_image_data(pdrv);
+  if(PTR_CHECK(img_path) || pdrv >= FF_VOLUMES) return EVFS_ERR_BAD_ARG;
+  FatfsImage *img = fatfs__image_new(pdrv);
+  if(!img) return EVFS_ERR_ALLOC;
+  if(img->fh) return EVFS_ERR_BUSY; // Already mounted
 
   // Open the image
   int status = evfs_open(img_path, &img->fh, EVFS_READ | EVFS_WRITE);
-  if(status != EVFS_OK)
+  if(status != EVFS_OK) {
+    fatfs__image_free(pdrv);
     return status;
+  }
 
+  status = evfs_image_cache_init(&img->cache, img->fh, FF_MAX_SS, img->cache_sectors);
+  if(status != EVFS_OK) {
+    evfs_file_close(img->fh);
+    fatfs__image_free(pdrv);
+    return status;
+  }
 
-  char drive_path[3];
-  snprintf(drive_path, 2, "%hhu", pdrv);
+
+  char drive_path[5];
+  snprintf(drive_path, sizeof(drive_path), "%hhu:", pdrv);
 
   FRESULT err = f_mount(&img->fs, drive_path, 1);
   status = (err == FR_OK) ? EVFS_OK : EVFS_ERR;
 
-  if(status != EVFS_OK)
+  if(status != EVFS_OK) {
+    f_unmount(drive_path); // Release the sync object
+    evfs_image_cache_free(&img->cache);
     evfs_file_close(img->fh);
+    fatfs__image_free(pdrv);
+  }
 
   return status;
 }
@@ -133,12 +223,64 @@ Args:
 */
 void fatfs_unmount_image(uint8_t pdrv) {
   FatfsImage *img = get_image_data(pdrv);
+  if(!img || !img->fh) return;
 
-  char drive_path[3];
-  snprintf(drive_path, 2, "%hhu", pdrv);
+  char drive_path[5];
+  snprintf(drive_path, sizeof(drive_path), "%hhu:", pdrv);
   f_unmount(drive_path);
 
+  evfs_image_cache_free(&img->cache);
   evfs_file_close(img->fh);
+  fatfs__image_free(pdrv);
+}
+
+
+/*
+Set the size of the sector cache for a FatFs image
+
+This takes effect the next time the image is mounted and is cleared when it
+is unmounted. Dirty sectors are written back on CTRL_SYNC, eviction, and
+unmount.
+
+Args:
+  pdrv:           FatFs volume number for the image
+  cache_sectors:  Number of sectors to cache. Use 0 to disable the cache or
+                  EVFS_CACHE_SHARED to use the shared cache
+
+Returns:
+  EVFS_OK on success
+*/
+int fatfs_image_set_cache(uint8_t pdrv, unsigned cache_sectors) {
+  if(pdrv >= FF_VOLUMES) return EVFS_ERR_BAD_ARG;
+
+  FatfsImage *img = fatfs__image_new(pdrv);
+  if(!img) return EVFS_ERR_ALLOC;
+
+  img->cache_sectors = cache_sectors;
+
+  return EVFS_OK;
+}
+
+
+/*
+Get sector cache statistics for a FatFs image
+
+Args:
+  pdrv:   FatFs volume number for the image
+  stats:  Current cache statistics
+
+Returns:
+  EVFS_OK on success
+*/
+int fatfs_image_cache_stats(uint8_t pdrv, EvfsCacheStats *stats) {
+  if(PTR_CHECK(stats) || pdrv >= FF_VOLUMES) return EVFS_ERR_BAD_ARG;
+
+  FatfsImage *img = get_image_data(pdrv);
+  if(!img) return EVFS_ERR_NOT_OPEN;
+
+  *stats = img->cache.stats;
+
+  return EVFS_OK;
 }
 
 
@@ -160,18 +302,24 @@ DSTATUS disk_status(BYTE pdrv) {
 
 DRESULT disk_read(BYTE pdrv, BYTE* buff, LBA_t sector, UINT count) {
   FatfsImage *img = get_image_data(pdrv);
+  if(!img)
+    return RES_PARERR;
 
-  evfs_file_seek(img->fh, sector * FF_MAX_SS, EVFS_SEEK_TO);
-  ptrdiff_t read = evfs_file_read(img->fh, buff, count * FF_MAX_SS);
+  IMG_LOCK(img);
+  ptrdiff_t read = evfs_image_cache_read(&img->cache, sector * FF_MAX_SS, buff, count * FF_MAX_SS);
+  IMG_UNLOCK(img);
 
   return read == (count * FF_MAX_SS) ? RES_OK : RES_ERROR;
 }
 
 DRESULT disk_write(BYTE pdrv, const BYTE* buff, LBA_t sector, UINT count) {
   FatfsImage *img = get_image_data(pdrv);
+  if(!img)
+    return RES_PARERR;
 
-  evfs_file_seek(img->fh, sector * FF_MAX_SS, EVFS_SEEK_TO);
-  ptrdiff_t wrote = evfs_file_write(img->fh, buff, count * FF_MAX_SS);
+  IMG_LOCK(img);
+  ptrdiff_t wrote = evfs_image_cache_write(&img->cache, sector * FF_MAX_SS, buff, count * FF_MAX_SS);
+  IMG_UNLOCK(img);
 
   return wrote == (count * FF_MAX_SS) ? RES_OK : RES_ERROR;
 }
@@ -182,9 +330,52 @@ DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void* buff) {
   if(!img)
     return RES_PARERR;
 
+  DRESULT rval;
+
   switch(cmd) {
   case CTRL_SYNC:         // Complete pending write process (needed at FF_FS_READONLY == 0)
-    return evfs_file_sync(img->fh) == EVFS_OK ? RES_OK : RES_ERROR;
+    IMG_LOCK(img);
+    if(IMG_CTX(img)->batch_depth > 0) { // Commit at the end of the batch
+      IMG_CTX(img)->sync_pending = true;
+      rval = RES_OK;
+    } else {
+      rval = fatfs__image_sync(img);
+    }
+    IMG_UNLOCK(img);
+    return rval;
+    break;
+
+  case CTRL_TRIM:         // Release freed sectors (needed at FF_USE_TRIM == 1)
+    {
+      LBA_t *range = (LBA_t *)buff; // First and last sector
+      evfs_off_t offset = (evfs_off_t)range[0] * FF_MAX_SS;
+      evfs_off_t size = (evfs_off_t)(range[1] - range[0] + 1) * FF_MAX_SS;
+
+      // The image keeps its data when the host can't punch holes
+      IMG_LOCK(img);
+      int status = evfs_image_cache_discard(&img->cache, offset, size);
+      IMG_UNLOCK(img);
+      return (status == EVFS_OK || status == EVFS_ERR_NO_SUPPORT) ? RES_OK : RES_ERROR;
+    }
+    break;
+
+  case EVFS_FATFS_CTRL_BATCH_BEGIN:
+    IMG_LOCK(img);
+    IMG_CTX(img)->batch_depth++;
+    IMG_UNLOCK(img);
+    return RES_OK;
+    break;
+
+  case EVFS_FATFS_CTRL_BATCH_END:
+    {
+      FatfsImageCtx *ctx = IMG_CTX(img);
+      rval = RES_OK;
+      IMG_LOCK(img);
+      if(ctx->batch_depth > 0 && --ctx->batch_depth == 0 && ctx->sync_pending)
+        rval = fatfs__image_sync(img);
+      IMG_UNLOCK(img);
+    }
+    return rval;
     break;
 
   case GET_SECTOR_COUNT:  // Get media size (needed at FF_USE_MKFS == 1)
@@ -218,6 +409,41 @@ DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void* buff) {
 }
 
 
+#if FF_FS_REENTRANT
+// Each mounted volume is serialized by its own lock so different
+// volumes can be accessed in parallel
+
+int ff_cre_syncobj(BYTE vol, FF_SYNC_t *sobj) {
+  EvfsLock *lock = evfs_malloc(sizeof(*lock));
+  if(MEM_CHECK(lock)) return 0;
+
+  if(evfs__lock_init(lock) != EVFS_OK) {
+    evfs_free(lock);
+    return 0;
+  }
+
+  *sobj = lock;
+  return 1;
+}
+
+int ff_del_syncobj(FF_SYNC_t sobj) {
+  EvfsLock *lock = (EvfsLock *)sobj;
+
+  evfs__lock_destroy(lock);
+  evfs_free(lock);
+  return 1;
+}
+
+int ff_req_grant(FF_SYNC_t sobj) {
+  return evfs__lock((EvfsLock *)sobj) == EVFS_OK;
+}
+
+void ff_rel_grant(FF_SYNC_t sobj) {
+  evfs__unlock((EvfsLock *)sobj);
+}
+#endif
+
+
 void *ff_memalloc(UINT msize) {
   return evfs_malloc(msize);
 }
@@ -0,0 +1,529 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2021 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Gzip file
+
+  Compressed data is scanned once when opened to build an index of checkpoints
+  spaced roughly every checkpoint_span bytes of uncompressed output. Each one
+  records the position of a deflate block boundary along with the preceding
+  32KiB of output needed as a dictionary. Reads restart decompression from the
+  nearest checkpoint at or before the requested offset. Sequential reads
+  continue the active stream without restarting.
+
+  Only the first gzip member is used. Data after it is ignored.
+------------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#include "evfs.h"
+#include "evfs_internal.h"
+#include "evfs/gzip_file.h"
+#include "evfs/tar_fs.h"
+
+
+#define GZIP_WINDOW_SIZE    32768 // Maximum deflate back reference distance
+#define GZIP_IN_BUF_SIZE    16384
+#define GZIP_SKIP_BUF_SIZE  16384
+
+// Let inflate() detect and decode a gzip header
+#define GZIP_WBITS_AUTO     (15 + 32)
+// Raw deflate data used when restarting from a checkpoint
+#define GZIP_WBITS_RAW      (-15)
+
+
+typedef struct GzipCheckpoint {
+  evfs_off_t out;  // Uncompressed offset
+  evfs_off_t in;   // Offset of the first full byte of compressed data
+  int        bits; // Unused bits in the byte before in
+  uint8_t    window[GZIP_WINDOW_SIZE]; // Output preceding this checkpoint
+} GzipCheckpoint;
+
+
+typedef struct GzipFile {
+  EvfsFile base;
+  EvfsFile *src;
+
+  GzipCheckpoint *checkpoints;
+  size_t          num_checkpoints;
+
+  evfs_off_t size;      // Uncompressed size
+  evfs_off_t read_pos;
+
+  // Active decompressor
+  z_stream   strm;
+  bool       strm_active;
+  evfs_off_t strm_out;  // Uncompressed offset of next output
+  evfs_off_t strm_in;   // Compressed offset of next input read
+
+  uint8_t in_buf[GZIP_IN_BUF_SIZE];
+  uint8_t skip_buf[GZIP_SKIP_BUF_SIZE];
+
+#ifdef EVFS_USE_THREADING
+  EvfsLock gz_lock;
+#endif
+} GzipFile;
+
+
+#ifdef EVFS_USE_THREADING
+#  define LOCK()    evfs__lock(&fil->gz_lock)
+#  define UNLOCK()  evfs__unlock(&fil->gz_lock)
+#else
+#  define LOCK()
+#  define UNLOCK()
+#endif
+
+
+// zlib allocations go through the EVFS allocator
+static voidpf gz__zalloc(voidpf opaque, uInt items, uInt size) {
+  return evfs_malloc((size_t)items * size);
+}
+
+static void gz__zfree(voidpf opaque, voidpf ptr) {
+  evfs_free(ptr);
+}
+
+
+// ******************** Checkpoint index ********************
+
+static int gz__add_checkpoint(GzipFile *fil, size_t *max_checkpoints, int bits, evfs_off_t in,
+                              evfs_off_t out, size_t left, const uint8_t *window) {
+  if(fil->num_checkpoints >= *max_checkpoints) {
+    size_t new_max = *max_checkpoints == 0 ? 8 : *max_checkpoints * 2;
+    GzipCheckpoint *new_cps = evfs_malloc(new_max * sizeof(GzipCheckpoint));
+    if(MEM_CHECK(new_cps)) return EVFS_ERR_ALLOC;
+
+    if(fil->checkpoints) {
+      memcpy(new_cps, fil->checkpoints, fil->num_checkpoints * sizeof(GzipCheckpoint));
+      evfs_free(fil->checkpoints);
+    }
+
+    fil->checkpoints = new_cps;
+    *max_checkpoints = new_max;
+  }
+
+  GzipCheckpoint *cp = &fil->checkpoints[fil->num_checkpoints++];
+  cp->out = out;
+  cp->in = in;
+  cp->bits = bits;
+
+  // Unroll the circular output window so the oldest data comes first
+  if(left > 0)
+    memcpy(cp->window, &window[GZIP_WINDOW_SIZE - left], left);
+  if(left < GZIP_WINDOW_SIZE)
+    memcpy(&cp->window[left], window, GZIP_WINDOW_SIZE - left);
+
+  return EVFS_OK;
+}
+
+
+// Decompress everything once to find block boundaries for checkpoints
+static int gz__build_index(GzipFile *fil, size_t span) {
+  uint8_t *window = evfs_malloc(GZIP_WINDOW_SIZE);
+  if(MEM_CHECK(window)) return EVFS_ERR_ALLOC;
+
+  z_stream strm = {
+    .zalloc = gz__zalloc,
+    .zfree  = gz__zfree
+  };
+
+  if(inflateInit2(&strm, GZIP_WBITS_AUTO) != Z_OK) {
+    evfs_free(window);
+    return EVFS_ERR_ALLOC;
+  }
+
+  size_t max_checkpoints = 0;
+  evfs_off_t total_in = 0;
+  evfs_off_t total_out = 0;
+  evfs_off_t last_out = 0;
+  int status = EVFS_OK;
+  int zerr = Z_OK;
+
+  strm.avail_out = 0;
+
+  while(zerr != Z_STREAM_END) {
+    ptrdiff_t rval = evfs_file_read_at(fil->src, fil->in_buf, sizeof fil->in_buf, total_in);
+    if(rval < 0) {
+      status = rval;
+      break;
+    }
+    if(rval == 0) { // Truncated stream
+      status = EVFS_ERR_CORRUPTION;
+      break;
+    }
+
+    strm.next_in = fil->in_buf;
+    strm.avail_in = rval;
+
+    do {
+      if(strm.avail_out == 0) {
+        strm.next_out = window;
+        strm.avail_out = GZIP_WINDOW_SIZE;
+      }
+
+      // Z_BLOCK stops at the end of each deflate block so checkpoints can be placed
+      total_in += strm.avail_in;
+      total_out += strm.avail_out;
+      zerr = inflate(&strm, Z_BLOCK);
+      total_in -= strm.avail_in;
+      total_out -= strm.avail_out;
+
+      if(zerr != Z_OK && zerr != Z_STREAM_END && zerr != Z_BUF_ERROR) {
+        status = zerr == Z_MEM_ERROR ? EVFS_ERR_ALLOC : EVFS_ERR_CORRUPTION;
+        break;
+      }
+
+      if(zerr == Z_STREAM_END)
+        break;
+
+      // Bit 7 flags the end of a block and bit 6 flags the last block
+      if((strm.data_type & 128) && !(strm.data_type & 64) &&
+         (total_out == 0 || total_out - last_out > (evfs_off_t)span)) {
+        status = gz__add_checkpoint(fil, &max_checkpoints, strm.data_type & 7, total_in, total_out,
+                                    strm.avail_out, window);
+        if(status != EVFS_OK) break;
+        last_out = total_out;
+      }
+    } while(strm.avail_in != 0);
+
+    if(status != EVFS_OK) break;
+  }
+
+  inflateEnd(&strm);
+  evfs_free(window);
+
+  if(status == EVFS_OK && fil->num_checkpoints == 0) // No data after the header
+    status = EVFS_ERR_CORRUPTION;
+
+  fil->size = total_out;
+  return status;
+}
+
+
+static GzipCheckpoint *gz__find_checkpoint(GzipFile *fil, evfs_off_t offset) {
+  // Last checkpoint at or before offset
+  size_t lo = 0;
+  size_t hi = fil->num_checkpoints;
+
+  while(hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if(fil->checkpoints[mid].out <= offset)
+      lo = mid;
+    else
+      hi = mid;
+  }
+
+  return &fil->checkpoints[lo];
+}
+
+
+
+// ******************** Decompression ********************
+
+static void gz__stop_stream(GzipFile *fil) {
+  if(fil->strm_active) {
+    inflateEnd(&fil->strm);
+    fil->strm_active = false;
+  }
+}
+
+
+static int gz__start_stream(GzipFile *fil, const GzipCheckpoint *cp) {
+  gz__stop_stream(fil);
+
+  memset(&fil->strm, 0, sizeof fil->strm);
+  fil->strm.zalloc = gz__zalloc;
+  fil->strm.zfree = gz__zfree;
+
+  if(inflateInit2(&fil->strm, GZIP_WBITS_RAW) != Z_OK)
+    return EVFS_ERR_ALLOC;
+
+  fil->strm_active = true;
+  fil->strm_in = cp->in;
+  fil->strm_out = cp->out;
+
+  if(cp->bits > 0) { // Checkpoint is in the middle of a byte
+    uint8_t partial;
+    ptrdiff_t rval = evfs_file_read_at(fil->src, &partial, 1, cp->in - 1);
+    if(rval != 1) {
+      gz__stop_stream(fil);
+      return rval < 0 ? rval : EVFS_ERR_IO;
+    }
+
+    inflatePrime(&fil->strm, cp->bits, partial >> (8 - cp->bits));
+  }
+
+  if(cp->out > 0) {
+    uInt dict_size = cp->out < GZIP_WINDOW_SIZE ? (uInt)cp->out : GZIP_WINDOW_SIZE;
+    inflateSetDictionary(&fil->strm, &cp->window[GZIP_WINDOW_SIZE - dict_size], dict_size);
+  }
+
+  return EVFS_OK;
+}
+
+
+// Decompress from the active stream
+static ptrdiff_t gz__inflate(GzipFile *fil, uint8_t *buf, size_t size) {
+  z_stream *strm = &fil->strm;
+
+  strm->next_out = buf;
+  strm->avail_out = size;
+
+  while(strm->avail_out > 0) {
+    if(strm->avail_in == 0) {
+      ptrdiff_t rval = evfs_file_read_at(fil->src, fil->in_buf, sizeof fil->in_buf, fil->strm_in);
+      if(rval < 0) return rval;
+      if(rval == 0) return EVFS_ERR_CORRUPTION; // Truncated stream
+
+      fil->strm_in += rval;
+      strm->next_in = fil->in_buf;
+      strm->avail_in = rval;
+    }
+
+    int zerr = inflate(strm, Z_NO_FLUSH);
+    if(zerr == Z_STREAM_END)
+      break;
+    if(zerr != Z_OK)
+      return zerr == Z_MEM_ERROR ? EVFS_ERR_ALLOC : EVFS_ERR_CORRUPTION;
+  }
+
+  size_t produced = size - strm->avail_out;
+  fil->strm_out += produced;
+  return produced;
+}
+
+
+static ptrdiff_t gz__read_at(GzipFile *fil, void *buf, size_t size, evfs_off_t offset) {
+  evfs_off_t remaining = fil->size - offset;
+  if(remaining <= 0) return 0;
+
+  if((evfs_off_t)size > remaining)
+    size = remaining;
+
+  GzipCheckpoint *cp = gz__find_checkpoint(fil, offset);
+
+  // Restart unless the active stream is closer than any checkpoint
+  if(!fil->strm_active || fil->strm_out > offset || cp->out > fil->strm_out) {
+    int status = gz__start_stream(fil, cp);
+    if(status != EVFS_OK) return status;
+  }
+
+  ptrdiff_t rval;
+
+  // Discard data up to the offset
+  while(fil->strm_out < offset) {
+    evfs_off_t skip = offset - fil->strm_out;
+    if(skip > GZIP_SKIP_BUF_SIZE)
+      skip = GZIP_SKIP_BUF_SIZE;
+
+    rval = gz__inflate(fil, fil->skip_buf, skip);
+    if(rval <= 0) goto error;
+  }
+
+  rval = gz__inflate(fil, buf, size);
+  if(rval >= 0)
+    return rval;
+
+error:
+  gz__stop_stream(fil);
+  return rval < 0 ? rval : EVFS_ERR_CORRUPTION;
+}
+
+
+
+// ******************** File access methods ********************
+
+static int gz__file_ctrl(EvfsFile *fh, int cmd, void *arg) {
+  return EVFS_ERR_NO_SUPPORT;
+}
+
+static int gz__file_close(EvfsFile *fh) {
+  GzipFile *fil = (GzipFile *)fh;
+  int status = EVFS_OK;
+
+  gz__stop_stream(fil);
+
+  if(fil->checkpoints)
+    evfs_free(fil->checkpoints);
+
+#ifdef EVFS_USE_THREADING
+  evfs__lock_destroy(&fil->gz_lock);
+#endif
+
+  if(fil->src)
+    status = evfs_file_close(fil->src);
+
+  return status;
+}
+
+static ptrdiff_t gz__file_read_at(EvfsFile *fh, void *buf, size_t size, evfs_off_t offset) {
+  GzipFile *fil = (GzipFile *)fh;
+
+  LOCK();
+  ptrdiff_t rval = gz__read_at(fil, buf, size, offset);
+  UNLOCK();
+
+  return rval;
+}
+
+static ptrdiff_t gz__file_read(EvfsFile *fh, void *buf, size_t size) {
+  GzipFile *fil = (GzipFile *)fh;
+
+  LOCK();
+  ptrdiff_t rval = gz__read_at(fil, buf, size, fil->read_pos);
+  if(rval > 0)
+    fil->read_pos += rval;
+  UNLOCK();
+
+  return rval;
+}
+
+static ptrdiff_t gz__file_write(EvfsFile *fh, const void *buf, size_t size) {
+  return EVFS_ERR_NO_SUPPORT;
+}
+
+static int gz__file_truncate(EvfsFile *fh, evfs_off_t size) {
+  return EVFS_ERR_NO_SUPPORT;
+}
+
+static int gz__file_sync(EvfsFile *fh) {
+  return EVFS_OK; // Need to report as OK because evfs_file_size() syncs
+}
+
+static evfs_off_t gz__file_size(EvfsFile *fh) {
+  GzipFile *fil = (GzipFile *)fh;
+  return fil->size;
+}
+
+static int gz__file_seek(EvfsFile *fh, evfs_off_t offset, EvfsSeekDir origin) {
+  GzipFile *fil = (GzipFile *)fh;
+
+  offset = evfs__absolute_offset(fh, offset, origin);
+
+  if(ASSERT(offset >= 0, "Invalid offset")) return EVFS_ERR;
+
+  if(offset > fil->size)
+    offset = fil->size;
+
+  // Decompression is deferred until the next read
+  fil->read_pos = offset;
+
+  return EVFS_OK;
+}
+
+static evfs_off_t gz__file_tell(EvfsFile *fh) {
+  GzipFile *fil = (GzipFile *)fh;
+  return fil->read_pos;
+}
+
+static bool gz__file_eof(EvfsFile *fh) {
+  GzipFile *fil = (GzipFile *)fh;
+  return fil->read_pos >= fil->size;
+}
+
+
+static const EvfsFileMethods s_gzip_methods = {
+  .m_ctrl     = gz__file_ctrl,
+  .m_close    = gz__file_close,
+  .m_read     = gz__file_read,
+  .m_write    = gz__file_write,
+  .m_truncate = gz__file_truncate,
+  .m_sync     = gz__file_sync,
+  .m_size     = gz__file_size,
+  .m_seek     = gz__file_seek,
+  .m_tell     = gz__file_tell,
+  .m_eof      = gz__file_eof,
+  .m_read_at  = gz__file_read_at
+};
+
+
+/*
+Open a read only view of gzip compressed data
+
+The compressed data is decompressed once to build a checkpoint index. Reads at
+any offset then only decompress from the nearest checkpoint. Each checkpoint
+uses 32KiB of memory.
+
+Args:
+  gz_file:         Gzip compressed file. Closed when fh is closed.
+  fh:              New file object for the uncompressed data
+  checkpoint_span: Uncompressed bytes between checkpoints. Use 0 for EVFS_GZIP_CHECKPOINT_SPAN.
+
+Returns:
+  EVFS_OK on success. gz_file is not closed on failure.
+*/
+int evfs_open_gzip_file(EvfsFile *gz_file, EvfsFile **fh, size_t checkpoint_span) {
+  if(PTR_CHECK(gz_file) || PTR_CHECK(fh)) return EVFS_ERR_BAD_ARG;
+
+  *fh = NULL;
+
+  if(checkpoint_span == 0)
+    checkpoint_span = EVFS_GZIP_CHECKPOINT_SPAN;
+
+  GzipFile *fil = evfs__alloc_handle(NULL, NULL, sizeof(GzipFile));
+  if(MEM_CHECK(fil)) return EVFS_ERR_ALLOC;
+
+  memset(fil, 0, sizeof(*fil));
+  fil->base.methods = &s_gzip_methods;
+  fil->src = gz_file;
+
+  int status = gz__build_index(fil, checkpoint_span);
+  if(status != EVFS_OK) {
+    if(fil->checkpoints)
+      evfs_free(fil->checkpoints);
+    evfs__free_handle(fil);
+    return status;
+  }
+
+#ifdef EVFS_USE_THREADING
+  if(evfs__lock_init(&fil->gz_lock) != EVFS_OK) {
+    evfs_free(fil->checkpoints);
+    evfs__free_handle(fil);
+    THROW(EVFS_ERR_INIT);
+  }
+#endif
+
+  *fh = (EvfsFile *)fil;
+  return EVFS_OK;
+}
+
+
+/*
+Register a Tar FS instance for gzip compressed tar data
+
+Args:
+  vfs_name:      Name of new VFS
+  gz_file:       EVFS file of compressed Tar data
+  default_vfs:   Make this the default VFS when true
+
+Returns:
+  EVFS_OK on success. gz_file is not closed on failure.
+*/
+int evfs_register_tar_gz_fs(const char *vfs_name, EvfsFile *gz_file, bool default_vfs) {
+  if(PTR_CHECK(vfs_name) || PTR_CHECK(gz_file)) return EVFS_ERR_BAD_ARG;
+
+  EvfsFile *tar_file;
+  int status = evfs_open_gzip_file(gz_file, &tar_file, 0);
+  if(status != EVFS_OK) return status;
+
+  status = evfs_register_tar_fs(vfs_name, tar_file, default_vfs);
+  if(status != EVFS_OK) { // Leave gz_file open for the caller
+    ((GzipFile *)tar_file)->src = NULL;
+    evfs_file_close(tar_file);
+  }
+
+  return status;
+}
@@ -0,0 +1,864 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Write-back block cache for filesystem images hosted on another filesystem
+
+  FatFs and littlefs re-read their metadata blocks constantly. When they are
+  mounted on an image file each of those accesses becomes a host file read.
+  This cache keeps recently used blocks of the image in memory and replaces
+  the least recently used block on a miss. Writes are held in the cache until
+  the block is evicted or the cache is synced. Transfers that span at least
+  half of the cache bypass it so that bulk file data doesn't evict metadata.
+
+  A cache with zero blocks passes all I/O straight to the image file.
+  A private cache is not thread safe. It relies on the filesystem above it to
+  serialize access.
+
+  Caches created with EVFS_CACHE_SHARED draw their blocks from one global
+  pool with a fixed memory budget instead of a private array. Blocks from all
+  images are keyed by their image file and block number and compete for the
+  budget under CLOCK replacement. Each cache still keeps its own statistics
+  so that the memory held by each mount can be monitored. The shared pool is
+  protected by its own lock which is held during image I/O. An image stored
+  inside another image can't use the shared cache if its host image does.
+------------------------------------------------------------------------------
+*/
+
+#include <string.h>
+
+#include "evfs.h"
+#include "evfs_internal.h"
+#include "evfs/image_cache.h"
+
+
+struct EvfsCacheBlock {
+  evfs_off_t  block_num;
+  unsigned    last_use;
+  bool        valid;
+  bool        dirty;
+};
+
+
+// ******************** Shared cache ********************
+
+struct EvfsSharedBlock {
+  EvfsSharedBlock *hash_next;
+  EvfsSharedBlock *clock_next;  // Ring of all blocks for CLOCK replacement
+  EvfsSharedBlock *clock_prev;
+  EvfsSharedBlock *owner_next;  // List of blocks belonging to one image cache
+  EvfsSharedBlock *owner_prev;
+  EvfsImageCache  *owner;
+  evfs_off_t       block_num;
+  bool             referenced;
+  bool             dirty;
+  uint8_t          data[];
+};
+
+typedef struct SharedCache {
+  size_t            budget;       // Maximum bytes of block data
+  size_t            used;
+  EvfsSharedBlock **buckets;
+  size_t            num_buckets;  // Power of 2
+  EvfsSharedBlock  *hand;         // Next candidate for eviction
+  unsigned          num_owners;
+  EvfsCacheStats    stats;
+  EvfsLock          lock;
+} SharedCache;
+
+static SharedCache *s_shared = NULL;
+
+#define MIN_SHARED_BUCKETS  64
+#define AVG_SHARED_BLOCK    512
+
+
+static inline size_t shared_hash(EvfsFile *fh, evfs_off_t block_num) {
+  uint64_t h = ((uintptr_t)fh >> 4) ^ ((uint64_t)block_num * 0x9E3779B97F4A7C15ull);
+  h ^= h >> 29;
+  return (size_t)h & (s_shared->num_buckets - 1);
+}
+
+
+static EvfsSharedBlock *shared_find(EvfsImageCache *cache, evfs_off_t block_num) {
+  EvfsSharedBlock *blk = s_shared->buckets[shared_hash(cache->fh, block_num)];
+
+  while(blk) {
+    if(blk->owner->fh == cache->fh && blk->block_num == block_num)
+      return blk;
+    blk = blk->hash_next;
+  }
+
+  return NULL;
+}
+
+
+static void shared_link(EvfsSharedBlock *blk) {
+  EvfsImageCache *cache = blk->owner;
+
+  // Hash chain
+  EvfsSharedBlock **bucket = &s_shared->buckets[shared_hash(cache->fh, blk->block_num)];
+  blk->hash_next = *bucket;
+  *bucket = blk;
+
+  // New blocks go behind the hand so they are the last to be considered
+  EvfsSharedBlock *hand = s_shared->hand;
+  if(hand) {
+    blk->clock_next = hand;
+    blk->clock_prev = hand->clock_prev;
+    hand->clock_prev->clock_next = blk;
+    hand->clock_prev = blk;
+  } else {
+    blk->clock_next = blk;
+    blk->clock_prev = blk;
+    s_shared->hand = blk;
+  }
+
+  // Owner list
+  blk->owner_prev = NULL;
+  blk->owner_next = cache->shared_blocks;
+  if(cache->shared_blocks)
+    cache->shared_blocks->owner_prev = blk;
+  cache->shared_blocks = blk;
+
+  s_shared->used += cache->block_size;
+  cache->stats.cached_bytes += cache->block_size;
+}
+
+
+static void shared_unlink(EvfsSharedBlock *blk) {
+  EvfsImageCache *cache = blk->owner;
+
+  EvfsSharedBlock **link = &s_shared->buckets[shared_hash(cache->fh, blk->block_num)];
+  while(*link != blk)
+    link = &(*link)->hash_next;
+  *link = blk->hash_next;
+
+  if(blk->clock_next == blk) {
+    s_shared->hand = NULL;
+  } else {
+    if(s_shared->hand == blk)
+      s_shared->hand = blk->clock_next;
+    blk->clock_prev->clock_next = blk->clock_next;
+    blk->clock_next->clock_prev = blk->clock_prev;
+  }
+
+  if(blk->owner_prev)
+    blk->owner_prev->owner_next = blk->owner_next;
+  else
+    cache->shared_blocks = blk->owner_next;
+  if(blk->owner_next)
+    blk->owner_next->owner_prev = blk->owner_prev;
+
+  s_shared->used -= cache->block_size;
+  cache->stats.cached_bytes -= cache->block_size;
+}
+
+
+static int shared_write_back(EvfsSharedBlock *blk) {
+  if(!blk->dirty)
+    return EVFS_OK;
+
+  EvfsImageCache *cache = blk->owner;
+  ptrdiff_t wrote = evfs_file_write_at(cache->fh, blk->data, cache->block_size,
+                                       blk->block_num * cache->block_size);
+  if(wrote != (ptrdiff_t)cache->block_size)
+    return wrote < 0 ? wrote : EVFS_ERR_IO;
+
+  blk->dirty = false;
+  cache->stats.writebacks++;
+  s_shared->stats.writebacks++;
+  return EVFS_OK;
+}
+
+
+// Evict the first unreferenced block found by the CLOCK hand
+// The evicted block is unlinked but not freed
+static int shared_evict(EvfsSharedBlock **victim) {
+  EvfsSharedBlock *blk = s_shared->hand;
+  while(blk->referenced) { // Give referenced blocks a second chance
+    blk->referenced = false;
+    blk = blk->clock_next;
+  }
+  s_shared->hand = blk->clock_next;
+
+  int status = shared_write_back(blk);
+  if(status != EVFS_OK) return status;
+
+  shared_unlink(blk);
+  *victim = blk;
+  return EVFS_OK;
+}
+
+
+// Get a block from the shared cache, loading it from the image if necessary
+// Loading is skipped when the caller will overwrite the whole block
+static int shared_get_block(EvfsImageCache *cache, evfs_off_t block_num, bool load,
+                            EvfsSharedBlock **blk) {
+  EvfsSharedBlock *found = shared_find(cache, block_num);
+
+  if(found) {
+    cache->stats.hits++;
+    s_shared->stats.hits++;
+    found->referenced = true;
+    *blk = found;
+    return EVFS_OK;
+  }
+
+  cache->stats.misses++;
+  s_shared->stats.misses++;
+
+  // Make room in the budget. An evicted block of the same size is reused.
+  EvfsSharedBlock *spare = NULL;
+  while(s_shared->used + cache->block_size > s_shared->budget) {
+    EvfsSharedBlock *victim;
+    int status = shared_evict(&victim);
+    if(status != EVFS_OK) {
+      evfs_free(spare);
+      return status;
+    }
+
+    if(!spare && victim->owner->block_size == cache->block_size)
+      spare = victim;
+    else
+      evfs_free(victim);
+  }
+
+  if(!spare) {
+    spare = evfs_malloc(sizeof(EvfsSharedBlock) + cache->block_size);
+    if(MEM_CHECK(spare)) return EVFS_ERR_ALLOC;
+  }
+
+  if(load) {
+    ptrdiff_t read = evfs_file_read_at(cache->fh, spare->data, cache->block_size,
+                                       block_num * cache->block_size);
+    if(read < 0) {
+      evfs_free(spare);
+      return read;
+    }
+
+    // Blocks past the end of the image read as zeros
+    memset(&spare->data[read], 0, cache->block_size - read);
+  }
+
+  spare->owner = cache;
+  spare->block_num = block_num;
+  spare->referenced = true;
+  spare->dirty = false;
+  shared_link(spare);
+
+  *blk = spare;
+  return EVFS_OK;
+}
+
+
+/*
+Create the shared block cache
+
+Image caches initialized with EVFS_CACHE_SHARED allocate their blocks from
+this cache. Blocks of all sizes are charged against the same budget. This must
+be called before any shared image caches are created.
+
+Args:
+  budget: Maximum memory in bytes for cached block data
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_shared_cache_init(size_t budget) {
+  if(budget == 0) return EVFS_ERR_BAD_ARG;
+  if(s_shared) return EVFS_ERR_INIT;
+
+  // Size the hash table for an average block size with a load factor near 1
+  size_t num_buckets = MIN_SHARED_BUCKETS;
+  while(num_buckets < budget / AVG_SHARED_BLOCK)
+    num_buckets *= 2;
+
+  SharedCache *shared = evfs_malloc(sizeof(*shared) + num_buckets * sizeof(EvfsSharedBlock *));
+  if(MEM_CHECK(shared)) return EVFS_ERR_ALLOC;
+
+  memset(shared, 0, sizeof(*shared) + num_buckets * sizeof(EvfsSharedBlock *));
+  shared->budget = budget;
+  shared->buckets = (EvfsSharedBlock **)(shared + 1);
+  shared->num_buckets = num_buckets;
+
+  if(evfs__lock_init(&shared->lock) != EVFS_OK) {
+    evfs_free(shared);
+    return EVFS_ERR_INIT;
+  }
+
+  s_shared = shared;
+  return EVFS_OK;
+}
+
+
+/*
+Release the shared block cache
+
+All shared image caches must be freed first.
+
+Returns:
+  EVFS_OK on success. EVFS_ERR_BUSY if any image caches are still using it.
+*/
+int evfs_shared_cache_free(void) {
+  if(!s_shared) return EVFS_ERR_INIT;
+  if(s_shared->num_owners > 0) return EVFS_ERR_BUSY;
+
+  evfs__lock_destroy(&s_shared->lock);
+  evfs_free(s_shared);
+  s_shared = NULL;
+
+  return EVFS_OK;
+}
+
+
+/*
+Write all dirty blocks in the shared cache to their images
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_shared_cache_sync(void) {
+  if(!s_shared) return EVFS_ERR_INIT;
+
+  evfs__lock(&s_shared->lock);
+
+  int status = EVFS_OK;
+  EvfsSharedBlock *blk = s_shared->hand;
+  if(blk) {
+    do {
+      int blk_status = shared_write_back(blk);
+      if(blk_status != EVFS_OK && status == EVFS_OK)
+        status = blk_status;
+      blk = blk->clock_next;
+    } while(blk != s_shared->hand);
+  }
+
+  evfs__unlock(&s_shared->lock);
+
+  return status;
+}
+
+
+/*
+Get statistics for the shared block cache
+
+The counters combine activity from all image caches. Use the stats member
+of each EvfsImageCache for per-image accounting.
+
+Args:
+  stats:  Current cache statistics
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_shared_cache_stats(EvfsCacheStats *stats) {
+  if(PTR_CHECK(stats)) return EVFS_ERR_BAD_ARG;
+  if(!s_shared) return EVFS_ERR_INIT;
+
+  evfs__lock(&s_shared->lock);
+  *stats = s_shared->stats;
+  stats->cached_bytes = s_shared->used;
+  evfs__unlock(&s_shared->lock);
+
+  return EVFS_OK;
+}
+
+
+// ******************** Image cache ********************
+
+
+static inline uint8_t *block_data(EvfsImageCache *cache, EvfsCacheBlock *blk) {
+  return &cache->data[(blk - cache->blocks) * cache->block_size];
+}
+
+
+static EvfsCacheBlock *find_block(EvfsImageCache *cache, evfs_off_t block_num) {
+  for(unsigned i = 0; i < cache->num_blocks; i++) {
+    EvfsCacheBlock *blk = &cache->blocks[i];
+    if(blk->valid && blk->block_num == block_num)
+      return blk;
+  }
+
+  return NULL;
+}
+
+
+static int write_back(EvfsImageCache *cache, EvfsCacheBlock *blk) {
+  if(!blk->dirty)
+    return EVFS_OK;
+
+  ptrdiff_t wrote = evfs_file_write_at(cache->fh, block_data(cache, blk), cache->block_size,
+                                       blk->block_num * cache->block_size);
+  if(wrote != (ptrdiff_t)cache->block_size)
+    return wrote < 0 ? wrote : EVFS_ERR_IO;
+
+  blk->dirty = false;
+  cache->stats.writebacks++;
+  return EVFS_OK;
+}
+
+
+// Get a cached block, loading it from the image if necessary
+// Loading is skipped when the caller will overwrite the whole block
+static int get_block(EvfsImageCache *cache, evfs_off_t block_num, bool load, EvfsCacheBlock **blk) {
+  EvfsCacheBlock *found = find_block(cache, block_num);
+
+  if(found) {
+    cache->stats.hits++;
+
+  } else { // Replace the least recently used block
+    cache->stats.misses++;
+
+    found = &cache->blocks[0];
+    unsigned oldest = 0;
+    for(unsigned i = 0; i < cache->num_blocks; i++) {
+      EvfsCacheBlock *cur = &cache->blocks[i];
+      if(!cur->valid) {
+        found = cur;
+        break;
+      }
+
+      unsigned age = cache->use_count - cur->last_use; // Wrap safe
+      if(age >= oldest) {
+        oldest = age;
+        found = cur;
+      }
+    }
+
+    int status = write_back(cache, found);
+    if(status != EVFS_OK) return status;
+
+    found->valid = false;
+
+    if(load) {
+      uint8_t *data = block_data(cache, found);
+      ptrdiff_t read = evfs_file_read_at(cache->fh, data, cache->block_size,
+                                         block_num * cache->block_size);
+      if(read < 0) return read;
+
+      // Blocks past the end of the image read as zeros
+      memset(&data[read], 0, cache->block_size - read);
+    }
+
+    found->block_num = block_num;
+    found->valid = true;
+  }
+
+  found->last_use = cache->use_count++;
+  *blk = found;
+
+  return EVFS_OK;
+}
+
+
+// Get the data for a block from the private or shared cache
+static int lookup_block(EvfsImageCache *cache, evfs_off_t block_num, bool load,
+                        uint8_t **data, bool **dirty) {
+  if(cache->shared) {
+    EvfsSharedBlock *blk = NULL;
+    int status = shared_get_block(cache, block_num, load, &blk);
+    if(status != EVFS_OK) return status;
+
+    *data = blk->data;
+    *dirty = &blk->dirty;
+
+  } else {
+    EvfsCacheBlock *blk = NULL;
+    int status = get_block(cache, block_num, load, &blk);
+    if(status != EVFS_OK) return status;
+
+    *data = block_data(cache, blk);
+    *dirty = &blk->dirty;
+  }
+
+  return EVFS_OK;
+}
+
+
+// Transfers spanning this many blocks go directly to the image
+static inline bool is_bypass(EvfsImageCache *cache, size_t size) {
+  if(cache->shared)
+    return size >= s_shared->budget / 2;
+
+  return size >= (cache->num_blocks / 2 + 1) * cache->block_size;
+}
+
+
+// Reconcile one cached block with a transfer that bypassed the cache
+// Newer data flows from dirty blocks on reads and into the block on writes
+static void bypass_overlap(EvfsImageCache *cache, evfs_off_t block_num, uint8_t *data, bool dirty,
+                           evfs_off_t offset, uint8_t *buf, size_t size, bool write) {
+  evfs_off_t blk_start = block_num * cache->block_size;
+  evfs_off_t start = MAX(blk_start, offset);
+  evfs_off_t end = MIN(blk_start + (evfs_off_t)cache->block_size, offset + (evfs_off_t)size);
+  if(start >= end) return;
+
+  if(write)
+    memcpy(&data[start - blk_start], &buf[start - offset], end - start);
+  else if(dirty)
+    memcpy(&buf[start - offset], &data[start - blk_start], end - start);
+}
+
+
+static void bypass_update(EvfsImageCache *cache, evfs_off_t offset, uint8_t *buf, size_t size, bool write) {
+  if(cache->shared) {
+    for(EvfsSharedBlock *blk = cache->shared_blocks; blk; blk = blk->owner_next) {
+      bypass_overlap(cache, blk->block_num, blk->data, blk->dirty, offset, buf, size, write);
+    }
+
+  } else {
+    for(unsigned i = 0; i < cache->num_blocks; i++) {
+      EvfsCacheBlock *blk = &cache->blocks[i];
+      if(!blk->valid) continue;
+
+      bypass_overlap(cache, blk->block_num, block_data(cache, blk), blk->dirty, offset, buf, size, write);
+    }
+  }
+}
+
+
+static inline void cache_lock(EvfsImageCache *cache) {
+  if(cache->shared)
+    evfs__lock(&s_shared->lock);
+}
+
+static inline void cache_unlock(EvfsImageCache *cache) {
+  if(cache->shared)
+    evfs__unlock(&s_shared->lock);
+}
+
+
+/*
+Initialize an image cache
+
+A cache with EVFS_CACHE_SHARED for num_blocks allocates its blocks from the
+shared cache created by evfs_shared_cache_init(). Only one cache should be
+attached to an image file.
+
+Args:
+  cache:      Cache to initialize
+  fh:         Open image file
+  block_size: Size of each cached block
+  num_blocks: Number of blocks to cache. Use 0 to disable caching
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_image_cache_init(EvfsImageCache *cache, EvfsFile *fh, size_t block_size, unsigned num_blocks) {
+  if(PTR_CHECK(cache) || PTR_CHECK(fh)) return EVFS_ERR_BAD_ARG;
+  if(num_blocks > 0 && block_size == 0) return EVFS_ERR_BAD_ARG;
+
+  memset(cache, 0, sizeof(*cache));
+  cache->fh = fh;
+  cache->block_size = block_size;
+
+  if(num_blocks == EVFS_CACHE_SHARED) {
+    if(!s_shared) return EVFS_ERR_INIT;
+    if(block_size > s_shared->budget) return EVFS_ERR_BAD_ARG;
+
+    evfs__lock(&s_shared->lock);
+    s_shared->num_owners++;
+    evfs__unlock(&s_shared->lock);
+
+    cache->shared = true;
+
+  } else if(num_blocks > 0) {
+    // We have two objects allocated together [EvfsCacheBlock[]][data]
+    size_t blocks_size = num_blocks * sizeof(EvfsCacheBlock);
+    size_t data_size = num_blocks * block_size;
+    blocks_size += _Alignof(max_align_t)-1 - (blocks_size + _Alignof(max_align_t)-1) % _Alignof(max_align_t);
+
+    cache->blocks = evfs_malloc(blocks_size + data_size);
+    if(MEM_CHECK(cache->blocks)) return EVFS_ERR_ALLOC;
+
+    memset(cache->blocks, 0, blocks_size);
+    cache->data = (uint8_t *)cache->blocks + blocks_size;
+    cache->num_blocks = num_blocks;
+    cache->stats.cached_bytes = data_size;
+  }
+
+  return EVFS_OK;
+}
+
+
+/*
+Write back all dirty blocks and release an image cache
+
+The image file is not closed.
+
+Args:
+  cache:  Cache to free
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_image_cache_free(EvfsImageCache *cache) {
+  if(PTR_CHECK(cache)) return EVFS_ERR_BAD_ARG;
+
+  int status = EVFS_OK;
+  if(cache->fh)
+    status = evfs_image_cache_sync(cache);
+
+  if(cache->shared) { // Return our blocks to the shared cache
+    evfs__lock(&s_shared->lock);
+    while(cache->shared_blocks) {
+      EvfsSharedBlock *blk = cache->shared_blocks;
+      shared_unlink(blk);
+      evfs_free(blk);
+    }
+    s_shared->num_owners--;
+    evfs__unlock(&s_shared->lock);
+
+    cache->shared = false;
+  }
+
+  evfs_free(cache->blocks);
+  cache->blocks = NULL;
+  cache->data = NULL;
+  cache->num_blocks = 0;
+  cache->stats.cached_bytes = 0;
+
+  return status;
+}
+
+
+/*
+Read from an image through the cache
+
+Args:
+  cache:  Cache for the image
+  offset: Position in the image to read from
+  buf:    Buffer for read data
+  size:   Size of buf
+
+Returns:
+  Number of bytes read on success or negative error code on failure
+*/
+ptrdiff_t evfs_image_cache_read(EvfsImageCache *cache, evfs_off_t offset, void *buf, size_t size) {
+  if(PTR_CHECK(cache) || PTR_CHECK(buf)) return EVFS_ERR_BAD_ARG;
+
+  if(cache->num_blocks == 0 && !cache->shared)
+    return evfs_file_read_at(cache->fh, buf, size, offset);
+
+  uint8_t *cbuf = (uint8_t *)buf;
+
+  cache_lock(cache);
+
+  if(is_bypass(cache, size)) {
+    cache->stats.bypasses++;
+    if(cache->shared)
+      s_shared->stats.bypasses++;
+
+    ptrdiff_t read = evfs_file_read_at(cache->fh, buf, size, offset);
+
+    // Overlay newer data from any dirty blocks in the range
+    if(read > 0)
+      bypass_update(cache, offset, cbuf, read, /*write*/ false);
+
+    cache_unlock(cache);
+    return read;
+  }
+
+  ptrdiff_t status = size;
+  size_t remain = size;
+  while(remain > 0) {
+    evfs_off_t block_num = offset / cache->block_size;
+    size_t blk_offset = offset % cache->block_size;
+    size_t copy_size = MIN(remain, cache->block_size - blk_offset);
+
+    uint8_t *data;
+    bool *dirty;
+    int blk_status = lookup_block(cache, block_num, /*load*/ true, &data, &dirty);
+    if(blk_status != EVFS_OK) {
+      status = blk_status;
+      break;
+    }
+
+    memcpy(cbuf, &data[blk_offset], copy_size);
+
+    cbuf += copy_size;
+    offset += copy_size;
+    remain -= copy_size;
+  }
+
+  cache_unlock(cache);
+  return status;
+}
+
+
+/*
+Write to an image through the cache
+
+Data is not written to the image until the block is evicted or
+evfs_image_cache_sync() is called.
+
+Args:
+  cache:  Cache for the image
+  offset: Position in the image to write to
+  buf:    Buffer for write data
+  size:   Size of buf
+
+Returns:
+  Number of bytes written on success or negative error code on failure
+*/
+ptrdiff_t evfs_image_cache_write(EvfsImageCache *cache, evfs_off_t offset, const void *buf, size_t size) {
+  if(PTR_CHECK(cache) || PTR_CHECK(buf)) return EVFS_ERR_BAD_ARG;
+
+  if(cache->num_blocks == 0 && !cache->shared)
+    return evfs_file_write_at(cache->fh, buf, size, offset);
+
+  const uint8_t *cbuf = (const uint8_t *)buf;
+
+  cache_lock(cache);
+
+  if(is_bypass(cache, size)) {
+    cache->stats.bypasses++;
+    if(cache->shared)
+      s_shared->stats.bypasses++;
+
+    ptrdiff_t wrote = evfs_file_write_at(cache->fh, buf, size, offset);
+
+    // Keep cached copies of the range current
+    if(wrote > 0)
+      bypass_update(cache, offset, (uint8_t *)cbuf, wrote, /*write*/ true);
+
+    cache_unlock(cache);
+    return wrote;
+  }
+
+  ptrdiff_t status = size;
+  size_t remain = size;
+  while(remain > 0) {
+    evfs_off_t block_num = offset / cache->block_size;
+    size_t blk_offset = offset % cache->block_size;
+    size_t copy_size = MIN(remain, cache->block_size - blk_offset);
+
+    uint8_t *data;
+    bool *dirty;
+    bool whole_block = copy_size == cache->block_size;
+    int blk_status = lookup_block(cache, block_num, /*load*/ !whole_block, &data, &dirty);
+    if(blk_status != EVFS_OK) {
+      status = blk_status;
+      break;
+    }
+
+    memcpy(&data[blk_offset], cbuf, copy_size);
+    *dirty = true;
+
+    cbuf += copy_size;
+    offset += copy_size;
+    remain -= copy_size;
+  }
+
+  cache_unlock(cache);
+  return status;
+}
+
+
+/*
+Write all dirty blocks to the image
+
+Args:
+  cache:  Cache for the image
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_image_cache_sync(EvfsImageCache *cache) {
+  if(PTR_CHECK(cache)) return EVFS_ERR_BAD_ARG;
+
+  int status = EVFS_OK;
+
+  if(cache->shared) {
+    evfs__lock(&s_shared->lock);
+    for(EvfsSharedBlock *blk = cache->shared_blocks; blk; blk = blk->owner_next) {
+      int blk_status = shared_write_back(blk);
+      if(blk_status != EVFS_OK && status == EVFS_OK)
+        status = blk_status;
+    }
+    evfs__unlock(&s_shared->lock);
+    return status;
+  }
+
+  for(unsigned i = 0; i < cache->num_blocks; i++) {
+    EvfsCacheBlock *blk = &cache->blocks[i];
+    if(!blk->valid) continue;
+
+    int blk_status = write_back(cache, blk);
+    if(blk_status != EVFS_OK && status == EVFS_OK)
+      status = blk_status;
+  }
+
+  return status;
+}
+
+
+/*
+Release the image storage behind a range of blocks
+
+Cached data in the range is dropped or zeroed to match the image and the
+range is passed to evfs_file_discard(). Images on filesystems that can't
+release storage return EVFS_ERR_NO_SUPPORT.
+
+Args:
+  cache:  Cache for the image
+  offset: Start of the range in the image
+  size:   Size of the range
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_image_cache_discard(EvfsImageCache *cache, evfs_off_t offset, evfs_off_t size) {
+  if(PTR_CHECK(cache)) return EVFS_ERR_BAD_ARG;
+
+  evfs_off_t end = offset + size;
+
+  if(cache->shared) {
+    evfs__lock(&s_shared->lock);
+
+    EvfsSharedBlock *next;
+    for(EvfsSharedBlock *blk = cache->shared_blocks; blk; blk = next) {
+      next = blk->owner_next;
+
+      evfs_off_t blk_start = blk->block_num * cache->block_size;
+      evfs_off_t blk_end = blk_start + cache->block_size;
+      if(blk_end <= offset || blk_start >= end) continue;
+
+      if(blk_start >= offset && blk_end <= end) { // Whole block released
+        shared_unlink(blk);
+        evfs_free(blk);
+      } else { // Partial overlap reads back as zeros
+        evfs_off_t start = MAX(blk_start, offset);
+        memset(&blk->data[start - blk_start], 0, MIN(blk_end, end) - start);
+      }
+    }
+
+    evfs__unlock(&s_shared->lock);
+  }
+
+  for(unsigned i = 0; i < cache->num_blocks; i++) {
+    EvfsCacheBlock *blk = &cache->blocks[i];
+    if(!blk->valid) continue;
+
+    evfs_off_t blk_start = blk->block_num * cache->block_size;
+    evfs_off_t blk_end = blk_start + cache->block_size;
+    if(blk_end <= offset || blk_start >= end) continue;
+
+    if(blk_start >= offset && blk_end <= end) { // Whole block released
+      blk->valid = false;
+      blk->dirty = false;
+    } else { // Partial overlap reads back as zeros
+      evfs_off_t start = MAX(blk_start, offset);
+      memset(&block_data(cache, blk)[start - blk_start], 0, MIN(blk_end, end) - start);
+    }
+  }
+
+  return evfs_file_discard(cache->fh, offset, size);
+}
@@ -24,35 +24,25 @@ Embedded Virtual Filesystem
 
 ///////////////////////////////////////////////////////////////////////////////////
 
-// Shared buffer needs lock if threading is enabled
-#if defined EVFS_USE_LITTLEFS_SHARED_BUFFER && defined EVFS_USE_THREADING
-#  define USE_LFS_LOCK
-#endif
-
-
-#ifdef USE_LFS_LOCK
-#  define LOCK()    evfs__lock(&fs_data->lfs_lock)
-#  define UNLOCK()  evfs__unlock(&fs_data->lfs_lock)
-#else
-#  define LOCK()
-#  define UNLOCK()
-#endif
-
-
 typedef struct LittlefsData_s {
   lfs_t    *lfs;
   struct lfs_info info;
   char      cur_dir[LFS_NAME_MAX];
-#ifdef EVFS_USE_LITTLEFS_SHARED_BUFFER
-  char      abs_path[EVFS_MAX_PATH]; // Shared buffer for building absolute paths
-#endif
-#ifdef USE_LFS_LOCK
-  EvfsLock  lfs_lock; // Serialize access to shared abs_path buffer
-#endif
 
   // VFS config options
   unsigned cfg_readonly    :1; // EVFS_CMD_SET_READONLY
   unsigned cfg_no_dir_dots :1; // EVFS_CMD_SET_NO_DIR_DOTS
+
+  unsigned  maint_step;   // Next maintenance step to run
+#ifdef EVFS_USE_THREADING
+  // Background maintenance for EVFS_CMD_SET_MAINT_INTERVAL
+  EvfsLock    maint_lock;   // Serialize maintenance steps
+  EvfsCond    maint_wake;   // Signaled on config change and shutdown
+  EvfsThread  maint_thread;
+  unsigned    maint_ms;
+  bool        maint_running;
+  bool        maint_stop;
+#endif
 } LittlefsData;
 
 typedef struct LittlefsFile_s {
@@ -100,57 +90,6 @@ static ptrdiff_t translate_error(int err) {
 #define simple_error(e)  ((e) >= LFS_ERR_OK ? EVFS_OK : EVFS_ERR)
 
 
-// Helper to convert relative paths into absolute for the lfs API
-// Returned path must be freed
-static int make_absolute_path(Evfs *vfs, const char *path, char **absolute, bool force_malloc) {
-  LittlefsData *fs_data = (LittlefsData *)vfs->fs_data;
-  *absolute = NULL;
-
-  size_t abs_size;
-  char *abs_path = NULL;
-
-#ifdef EVFS_USE_LITTLEFS_SHARED_BUFFER
-  if(!force_malloc) {
-    abs_size = COUNT_OF(fs_data->abs_path);
-    LOCK();
-    abs_path = fs_data->abs_path;
-  }
-#endif
-
-  if(force_malloc || !abs_path) {
-    abs_size = strlen(path) + 1;
-    *absolute = NULL;
-
-    if(!evfs_vfs_path_is_absolute(vfs, path)) // Need space for join with cur_dir
-      abs_size += strlen(fs_data->cur_dir) + 1;
-
-    abs_path = evfs_malloc(abs_size);
-    if(MEM_CHECK(abs_path)) return EVFS_ERR_ALLOC;
-  }
-
-  AppendRange abs_path_r;
-  range_init(&abs_path_r, abs_path, abs_size);
-
-  int status = evfs_vfs_path_absolute(vfs, path, (StringRange *)&abs_path_r);
-  if(status == EVFS_OK)
-    *absolute = abs_path;
-
-  return status;
-}
-
-// Prepare a buffer for the absolute path
-#define MAKE_ABS(path, abs_path) char *abs_path; do { \
- int status_ma = make_absolute_path(vfs, path, &abs_path, false); \
- if(status_ma != EVFS_OK) \
-    return status_ma; \
-} while(0)
-
-
-#ifdef EVFS_USE_LITTLEFS_SHARED_BUFFER
-#  define FREE_ABS(abs_path)  UNLOCK()
-#else
-#  define FREE_ABS(abs_path)  evfs_free(abs_path)
-#endif
 
 
 // ******************** File access methods ********************
@@ -327,13 +266,9 @@ static int littlefs__open(Evfs *vfs, const char *path, EvfsFile *fh, int flags)
   
   int status;
   
-  if(evfs_vfs_path_is_absolute(vfs, path)) {
-    status = lfs_file_open(fil->lfs, &fil->fil, path, lfs_flags);
-  } else { // Convert relative path
-    MAKE_ABS(path, abs_path);
-    status = lfs_file_open(fil->lfs, &fil->fil, abs_path, lfs_flags);
-    FREE_ABS(abs_path);
-  }
+  MAKE_ABS(path, abs_path);
+  status = lfs_file_open(fil->lfs, &fil->fil, abs_path, lfs_flags);
+  FREE_ABS(abs_path);
 
   return translate_error(status);  
 }
@@ -344,13 +279,9 @@ static int littlefs__stat(Evfs *vfs, const char *path, EvfsInfo *info) {
 
   int status;
 
-  if(evfs_vfs_path_is_absolute(vfs, path)) {  
-    status = lfs_stat(fs_data->lfs, path, &fs_data->info);
-  } else { // Convert relative path
-    MAKE_ABS(path, abs_path);
-    status = lfs_stat(fs_data->lfs, abs_path, &fs_data->info);
-    FREE_ABS(abs_path);
-  }
+  MAKE_ABS(path, abs_path);
+  status = lfs_stat(fs_data->lfs, abs_path, &fs_data->info);
+  FREE_ABS(abs_path);
 
   memset(info, 0, sizeof(*info));
 
@@ -371,13 +302,9 @@ static int littlefs__delete(Evfs *vfs, const char *path) {
 
   int status;
 
-  if(evfs_vfs_path_is_absolute(vfs, path)) {  
-    status = lfs_remove(fs_data->lfs, path);
-  } else { // Convert relative path
-    MAKE_ABS(path, abs_path);
-    status = lfs_remove(fs_data->lfs, abs_path);
-    FREE_ABS(abs_path);
-  }
+  MAKE_ABS(path, abs_path);
+  status = lfs_remove(fs_data->lfs, abs_path);
+  FREE_ABS(abs_path);
 
   return simple_error(status);
 }
@@ -388,26 +315,20 @@ static int littlefs__rename(Evfs *vfs, const char *old_path, const char *new_pat
 
   if(fs_data->cfg_readonly) return EVFS_ERR_DISABLED;
 
-  int status;
-
-  if(evfs_vfs_path_is_absolute(vfs, old_path) && evfs_vfs_path_is_absolute(vfs, new_path)) {
-    status = lfs_rename(fs_data->lfs, old_path, new_path);
-  } else { // Convert relative path
-    MAKE_ABS(old_path, abs_old_path);
-
-    // Can't use the macro because of extra cleanup requirement
-    char *abs_new_path;
-    status = make_absolute_path(vfs, new_path, &abs_new_path, /*force_malloc*/ true);
-    if(status != EVFS_OK) {
-      FREE_ABS(abs_old_path);
-      return status;
-    }
+  MAKE_ABS(old_path, abs_old_path);
 
-    status = lfs_rename(fs_data->lfs, abs_old_path, abs_new_path);
+  // Can't use the macro because of extra cleanup requirement
+  EvfsAbsPath abs_new_path;
+  int status = evfs__path_resolve(vfs, new_path, &abs_new_path);
+  if(status != EVFS_OK) {
     FREE_ABS(abs_old_path);
-    evfs_free(abs_new_path);
+    return status;
   }
 
+  status = lfs_rename(fs_data->lfs, abs_old_path, abs_new_path.path);
+  FREE_ABS(abs_old_path);
+  evfs__path_release(&abs_new_path);
+
   return simple_error(status);
 }
 
@@ -420,13 +341,9 @@ static int littlefs__make_dir(Evfs *vfs, const char *path) {
 
   int status;
 
-  if(evfs_vfs_path_is_absolute(vfs, path)) {  
-    status = lfs_mkdir(fs_data->lfs, path);
-  } else { // Convert relative path
-    MAKE_ABS(path, abs_path);
-    status = lfs_mkdir(fs_data->lfs, abs_path);
-    FREE_ABS(abs_path);
-  }
+  MAKE_ABS(path, abs_path);
+  status = lfs_mkdir(fs_data->lfs, abs_path);
+  FREE_ABS(abs_path);
 
   return translate_error(status);
 }
@@ -443,13 +360,9 @@ static int littlefs__open_dir(Evfs *vfs, const char *path, EvfsDir *dh) {
 
   int status;
 
-  if(evfs_vfs_path_is_absolute(vfs, path)) {  
-    status = lfs_dir_open(fs_data->lfs, &dir->dir, path);
-  } else { // Convert relative path
-    MAKE_ABS(path, abs_path);
-    status = lfs_dir_open(fs_data->lfs, &dir->dir, abs_path);
-    FREE_ABS(abs_path);
-  }
+  MAKE_ABS(path, abs_path);
+  status = lfs_dir_open(fs_data->lfs, &dir->dir, abs_path);
+  FREE_ABS(abs_path);
 
   return translate_error(status);
 
@@ -471,41 +384,178 @@ static int littlefs__get_cur_dir(Evfs *vfs, StringRange *cur_dir) {
 static int littlefs__set_cur_dir(Evfs *vfs, const char *path) {
   LittlefsData *fs_data = (LittlefsData *)vfs->fs_data;
 
-  if(evfs_vfs_path_is_absolute(vfs, path)) { // Just assign absolute paths
-    // Confirm the path exists
-    if(!evfs__vfs_existing_dir(vfs, path))
-      return EVFS_ERR_NO_PATH;
-  
-    strncpy(fs_data->cur_dir, path, LFS_NAME_MAX-1);
+  MAKE_ABS(path, abs_path);
+
+  // Confirm the path exists
+  int status = EVFS_OK;
+  if(evfs__vfs_existing_dir(vfs, abs_path)) {
+    strncpy(fs_data->cur_dir, abs_path, LFS_NAME_MAX-1);
     fs_data->cur_dir[LFS_NAME_MAX-1] = '\0';
+  } else {
+    status = EVFS_ERR_NO_PATH;
+  }
 
-  } else { // Path is relative: Join it to the existing directory
-    StringRange head, tail, joined;
-    
-    range_init(&head, fs_data->cur_dir, LFS_NAME_MAX);
-    range_init(&tail, (char *)path, strlen(path));
-    
-    size_t joined_size = strlen(fs_data->cur_dir) + 1 + strlen(path) + 1;
-    char *joined_path = evfs_malloc(joined_size);
-    if(MEM_CHECK(joined_path)) return EVFS_ERR_ALLOC;
+  FREE_ABS(abs_path);
+  return status;
+}
 
-    range_init(&joined, joined_path, joined_size);
 
-    evfs_vfs_path_join(vfs, &head, &tail, &joined);
 
-    // Confirm the path exists
-    if(!evfs__vfs_existing_dir(vfs, joined_path)) {
-      evfs_free(joined_path);
-      return EVFS_ERR_NO_PATH;
-    }
+///////////////////////////////////////////////////////////////////////////////////
+// Maintenance
+
+/*
+littlefs scans for free blocks and compacts full metadata pairs inline with
+the write that needs them. Running that work ahead of time while the system
+is idle keeps it off the write path. Maintenance is divided into steps that
+each make one littlefs call:
+
+  1. lfs_fs_mkconsistent() resolves orphans and pending moves
+  2. lfs_fs_gc() refills the lookahead buffer and compacts metadata pairs
+     that have grown past compact_thresh in the lfs_config
+
+A littlefs call can't be interrupted once it starts so the work budget for
+EVFS_CMD_RUN_MAINTENANCE is a count of steps rather than a time limit.
+*/
 
-    // Overwrite old cur_dir
-    evfs_vfs_path_normalize(vfs, joined_path, &head);
+#if LFS_VERSION >= 0x00020006
+#  define HAVE_LFS_MKCONSISTENT
+#endif
+#if LFS_VERSION >= 0x00020008
+#  define HAVE_LFS_GC
+#endif
 
-    evfs_free(joined_path);
+#if defined HAVE_LFS_MKCONSISTENT || defined HAVE_LFS_GC
+#  define HAVE_LFS_MAINTENANCE
+
+enum MaintSteps {
+  MAINT_MKCONSISTENT = 0,
+  MAINT_GC,
+  MAINT_NUM_STEPS
+};
+
+#  ifdef EVFS_USE_THREADING
+#    define MAINT_LOCK()    evfs__lock(&fs_data->maint_lock)
+#    define MAINT_UNLOCK()  evfs__unlock(&fs_data->maint_lock)
+#  else
+#    define MAINT_LOCK()
+#    define MAINT_UNLOCK()
+#  endif
+
+
+// Run the next maintenance step
+// Returns EVFS_DONE when a full round of steps has finished
+static int maint_step(LittlefsData *fs_data) {
+  int err = LFS_ERR_OK;
+
+  switch(fs_data->maint_step) {
+#  ifdef HAVE_LFS_MKCONSISTENT
+    case MAINT_MKCONSISTENT:  err = lfs_fs_mkconsistent(fs_data->lfs); break;
+#  endif
+#  ifdef HAVE_LFS_GC
+    case MAINT_GC:            err = lfs_fs_gc(fs_data->lfs); break;
+#  endif
+    default: break;
   }
 
-  return EVFS_OK;
+  if(err < 0)
+    return translate_error(err);
+
+  fs_data->maint_step = (fs_data->maint_step + 1) % MAINT_NUM_STEPS;
+  return fs_data->maint_step == 0 ? EVFS_DONE : EVFS_OK;
+}
+
+
+static int run_maintenance(LittlefsData *fs_data, unsigned max_steps) {
+  if(fs_data->cfg_readonly)
+    return EVFS_ERR_DISABLED;
+
+  if(max_steps == 0)
+    max_steps = MAINT_NUM_STEPS;
+
+  int status = EVFS_OK;
+
+  MAINT_LOCK();
+  for(unsigned i = 0; i < max_steps && status == EVFS_OK; i++) {
+    status = maint_step(fs_data);
+  }
+  MAINT_UNLOCK();
+
+  return status;
+}
+
+
+#  ifdef EVFS_USE_THREADING
+// Background thread that periodically runs a full round of maintenance
+static void maint_worker(void *arg) {
+  LittlefsData *fs_data = (LittlefsData *)arg;
+
+  MAINT_LOCK();
+  while(!fs_data->maint_stop) {
+    if(fs_data->maint_ms > 0)
+      evfs__cond_timedwait(&fs_data->maint_wake, &fs_data->maint_lock, fs_data->maint_ms);
+    else // Idle until reconfigured
+      evfs__cond_wait(&fs_data->maint_wake, &fs_data->maint_lock);
+
+    if(fs_data->maint_stop)
+      break;
+
+    if(fs_data->maint_ms == 0 || fs_data->cfg_readonly)
+      continue;
+
+    while(maint_step(fs_data) == EVFS_OK) {}
+  }
+  MAINT_UNLOCK();
+}
+
+
+static int set_maint_interval(LittlefsData *fs_data, unsigned interval_ms) {
+  int status = EVFS_OK;
+
+  MAINT_LOCK();
+  fs_data->maint_ms = interval_ms;
+
+  if(fs_data->maint_running) { // Pick up the new interval
+    evfs__cond_signal(&fs_data->maint_wake);
+  } else if(interval_ms > 0) { // Start the worker the first time an interval is set
+    status = evfs__thread_create(&fs_data->maint_thread, maint_worker, fs_data);
+    if(status == EVFS_OK)
+      fs_data->maint_running = true;
+  }
+  MAINT_UNLOCK();
+
+  return status;
+}
+
+
+static void stop_maint_worker(LittlefsData *fs_data) {
+  MAINT_LOCK();
+  bool running = fs_data->maint_running;
+  fs_data->maint_stop = true;
+  evfs__cond_signal(&fs_data->maint_wake);
+  MAINT_UNLOCK();
+
+  if(running)
+    evfs__thread_join(fs_data->maint_thread);
+}
+#  endif // EVFS_USE_THREADING
+#endif // HAVE_LFS_MAINTENANCE
+
+
+// littlefs commits each operation to its metadata log on its own. Holding the
+// maintenance lock keeps background compaction from running between them.
+static int littlefs__batch(Evfs *vfs, EvfsBatchOp *ops, size_t num_ops) {
+#if defined HAVE_LFS_MAINTENANCE && defined EVFS_USE_THREADING
+  LittlefsData *fs_data = (LittlefsData *)vfs->fs_data;
+
+  MAINT_LOCK();
+  int rval = evfs_batch_generic(vfs, ops, num_ops);
+  MAINT_UNLOCK();
+
+  return rval;
+#else
+  return EVFS_ERR_NO_SUPPORT;
+#endif
 }
 
 
@@ -515,10 +565,23 @@ static int littlefs__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
 
   switch(cmd) {
     case EVFS_CMD_UNREGISTER:
-#ifdef USE_LFS_LOCK
-      evfs__lock_destroy(&fs_data->lfs_lock);
+#ifdef EVFS_USE_THREADING
+#  ifdef HAVE_LFS_MAINTENANCE
+      stop_maint_worker(fs_data);
+#  endif
+      evfs__cond_destroy(&fs_data->maint_wake);
+      evfs__lock_destroy(&fs_data->maint_lock);
+#endif
+      if(!vfs->is_static)
+        evfs_free(vfs);
+      return EVFS_OK; break;
+
+    case EVFS_CMD_STATIC_INIT:
+#ifdef EVFS_USE_THREADING
+      if(evfs__lock_init(&fs_data->maint_lock) != EVFS_OK)
+        return EVFS_ERR_INIT;
+      evfs__cond_init(&fs_data->maint_wake);
 #endif
-      evfs_free(vfs);
       return EVFS_OK; break;
 
     case EVFS_CMD_SET_READONLY:
@@ -542,6 +605,9 @@ static int littlefs__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
       }
       return EVFS_OK; break;
 
+    case EVFS_CMD_SET_DIR_STAT: // Directory entries always carry their metadata
+      return EVFS_OK; break;
+
     case EVFS_CMD_GET_DIR_FIELDS:
       {
         unsigned *v = (unsigned *)arg;
@@ -549,12 +615,62 @@ static int littlefs__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
       }
       return EVFS_OK; break;
 
+#ifdef HAVE_LFS_MAINTENANCE
+    case EVFS_CMD_RUN_MAINTENANCE:
+      {
+        unsigned *v = (unsigned *)arg;
+        return run_maintenance(fs_data, *v);
+      }
+      break;
+
+#  ifdef EVFS_USE_THREADING
+    case EVFS_CMD_SET_MAINT_INTERVAL:
+      {
+        unsigned *v = (unsigned *)arg;
+        return set_maint_interval(fs_data, *v);
+      }
+      break;
+#  endif
+#endif
+
     default: return EVFS_ERR_NO_SUPPORT; break;
   }
 }
 
 
 
+// ******************** Static VFSs ********************
+
+#ifdef EVFS_LITTLEFS_STATIC_LIST
+#  define LITTLEFS_STATIC_DATA(id, name, lfs_obj) \
+  extern lfs_t lfs_obj; \
+  static LittlefsData s_littlefs_data_##id = {.lfs = &(lfs_obj), .cur_dir = "/"};
+
+#  define LITTLEFS_STATIC_VFS(id, name, lfs_obj) \
+  Evfs evfs_littlefs_##id = { \
+    .vfs_name       = (name), \
+    .vfs_file_size  = sizeof(LittlefsFile), \
+    .vfs_dir_size   = sizeof(LittlefsDir), \
+    .fs_data        = &s_littlefs_data_##id, \
+    .m_open         = littlefs__open, \
+    .m_stat         = littlefs__stat, \
+    .m_delete       = littlefs__delete, \
+    .m_rename       = littlefs__rename, \
+    .m_make_dir     = littlefs__make_dir, \
+    .m_open_dir     = littlefs__open_dir, \
+    .m_get_cur_dir  = littlefs__get_cur_dir, \
+    .m_set_cur_dir  = littlefs__set_cur_dir, \
+    .m_vfs_ctrl     = littlefs__vfs_ctrl, \
+    .m_path_root_component = evfs_default_path_root_component, \
+    .m_copy         = evfs_default_copy, \
+    .m_batch        = littlefs__batch \
+  };
+
+EVFS_LITTLEFS_STATIC_LIST(LITTLEFS_STATIC_DATA)
+EVFS_LITTLEFS_STATIC_LIST(LITTLEFS_STATIC_VFS)
+#endif
+
+
 // Access objects allocated in a single block of memory
 #define NEXT_OBJ(o) (&(o)[1])
 
@@ -608,12 +724,14 @@ int evfs_register_littlefs(const char *vfs_name, lfs_t *lfs, bool default_vfs) {
   new_vfs->m_get_cur_dir = littlefs__get_cur_dir;
   new_vfs->m_set_cur_dir = littlefs__set_cur_dir;
   new_vfs->m_vfs_ctrl = littlefs__vfs_ctrl;
+  new_vfs->m_batch = littlefs__batch;
 
-#ifdef USE_LFS_LOCK
-  if(evfs__lock_init(&fs_data->lfs_lock) != EVFS_OK) {
+#ifdef EVFS_USE_THREADING
+  if(evfs__lock_init(&fs_data->maint_lock) != EVFS_OK) {
     evfs_free(new_vfs);
     THROW(EVFS_ERR_INIT);
   }
+  evfs__cond_init(&fs_data->maint_wake);
 #endif
 
   return evfs_register(new_vfs, default_vfs);
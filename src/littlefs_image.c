@@ -15,12 +15,79 @@ Embedded Virtual Filesystem
 ------------------------------------------------------------------------------
 */
 
+#include <string.h>
+
 #include "lfs.h"
 #include "evfs.h"
 #include "evfs_internal.h"
 #include "evfs/littlefs_image.h"
 
 
+//////////////////////////////////////////////////////////
+// Block buffer
+
+/*
+littlefs reads and programs in units as small as read_size and prog_size.
+The optional block buffer holds one whole block of the image so that reads
+within a block are served from a single block sized read and consecutive
+progs are collected into one aligned block write. The buffer is written to
+the image when another block is accessed and on littlefs_image_sync().
+*/
+
+static int lfs_buf_init(LittlefsImage *img, const struct lfs_config *cfg) {
+  img->buf = NULL;
+  img->buf_valid = false;
+  img->buf_dirty = false;
+
+  if(!img->block_buffer)
+    return EVFS_OK;
+
+  img->buf = evfs_malloc(cfg->block_size);
+  return MEM_CHECK(img->buf) ? EVFS_ERR_ALLOC : EVFS_OK;
+}
+
+static void lfs_buf_free(LittlefsImage *img) {
+  evfs_free(img->buf);
+  img->buf = NULL;
+  img->buf_valid = false;
+  img->buf_dirty = false;
+}
+
+static int lfs_buf_flush(LittlefsImage *img, const struct lfs_config *cfg) {
+  if(!img->buf_dirty)
+    return EVFS_OK;
+
+  ptrdiff_t wrote = evfs_image_cache_write(&img->cache, (evfs_off_t)img->buf_block * cfg->block_size,
+                                           img->buf, cfg->block_size);
+  if(wrote != (ptrdiff_t)cfg->block_size)
+    return wrote < 0 ? wrote : EVFS_ERR_IO;
+
+  img->buf_dirty = false;
+  return EVFS_OK;
+}
+
+// Make a block current in the buffer
+static int lfs_buf_load(LittlefsImage *img, const struct lfs_config *cfg, lfs_block_t block) {
+  if(img->buf_valid && img->buf_block == block)
+    return EVFS_OK;
+
+  int status = lfs_buf_flush(img, cfg);
+  if(status != EVFS_OK)
+    return status;
+
+  img->buf_valid = false;
+
+  ptrdiff_t read = evfs_image_cache_read(&img->cache, (evfs_off_t)block * cfg->block_size,
+                                         img->buf, cfg->block_size);
+  if(read != (ptrdiff_t)cfg->block_size)
+    return read < 0 ? read : EVFS_ERR_IO;
+
+  img->buf_block = block;
+  img->buf_valid = true;
+  return EVFS_OK;
+}
+
+
 /*
 Make a Littlefs image file if it doesn't exist
 
@@ -52,9 +119,26 @@ int littlefs_make_image(const char *img_path, struct lfs_config *cfg) {
       // Reopen for formatting
       evfs_file_close(img->fh);
       status = evfs_open(img_path, &img->fh, EVFS_READ | EVFS_WRITE);
-
-      lfs_t lfs;
-      status = (lfs_format(&lfs, cfg) == LFS_ERR_OK) ? EVFS_OK : EVFS_ERR;
+      if(status == EVFS_OK)
+        status = evfs_image_cache_init(&img->cache, img->fh, cfg->cache_size, img->cache_lines);
+
+      if(status == EVFS_OK) {
+        status = lfs_buf_init(img, cfg);
+
+        if(status == EVFS_OK) {
+          lfs_t lfs;
+          status = (lfs_format(&lfs, cfg) == LFS_ERR_OK) ? EVFS_OK : EVFS_ERR;
+
+          int buf_status = lfs_buf_flush(img, cfg);
+          if(status == EVFS_OK)
+            status = buf_status;
+        }
+        lfs_buf_free(img);
+
+        int cache_status = evfs_image_cache_free(&img->cache);
+        if(status == EVFS_OK)
+          status = cache_status;
+      }
     }
 
     evfs_file_close(img->fh);
@@ -93,11 +177,23 @@ int littlefs_mount_image(const char *img_path, struct lfs_config *cfg, lfs_t *lf
     return EVFS_ERR;
   }
 
-  status = lfs_mount(lfs, cfg); // Mount the filesystem
-  status = (status == LFS_ERR_OK) ? EVFS_OK : EVFS_ERR;
+  status = evfs_image_cache_init(&img->cache, img->fh, cfg->cache_size, img->cache_lines);
+  if(status != EVFS_OK) {
+    evfs_file_close(img->fh);
+    return status;
+  }
 
-  if(status != EVFS_OK)
+  status = lfs_buf_init(img, cfg);
+  if(status == EVFS_OK) {
+    status = lfs_mount(lfs, cfg); // Mount the filesystem
+    status = (status == LFS_ERR_OK) ? EVFS_OK : EVFS_ERR;
+  }
+
+  if(status != EVFS_OK) {
+    lfs_buf_free(img);
+    evfs_image_cache_free(&img->cache);
     evfs_file_close(img->fh);
+  }
 
   return status;
 }
@@ -114,6 +210,9 @@ void littlefs_unmount_image(lfs_t *lfs) {
   LittlefsImage *img = (LittlefsImage *)lfs->cfg->context;
 
   lfs_unmount(lfs);
+  lfs_buf_flush(img, lfs->cfg);
+  lfs_buf_free(img);
+  evfs_image_cache_free(&img->cache);
   evfs_file_close(img->fh);
 }
 
@@ -128,8 +227,15 @@ int littlefs_image_read(const struct lfs_config *cfg, lfs_block_t block,
 
   LittlefsImage *img = cfg->context;
 
-  evfs_file_seek(img->fh, block * cfg->block_size + off, EVFS_SEEK_TO);
-  ptrdiff_t read = evfs_file_read(img->fh, buffer, size);
+  if(img->buf) {
+    if(lfs_buf_load(img, cfg, block) != EVFS_OK)
+      return LFS_ERR_IO;
+
+    memcpy(buffer, &img->buf[off], size);
+    return LFS_ERR_OK;
+  }
+
+  ptrdiff_t read = evfs_image_cache_read(&img->cache, block * cfg->block_size + off, buffer, size);
 
   return read == size ? LFS_ERR_OK : LFS_ERR_IO;
 }
@@ -139,20 +245,46 @@ int littlefs_image_prog(const struct lfs_config *cfg, lfs_block_t block,
 
   LittlefsImage *img = cfg->context;
 
-  evfs_file_seek(img->fh, block * cfg->block_size + off, EVFS_SEEK_TO);
+  if(img->buf) {
+    if(lfs_buf_load(img, cfg, block) != EVFS_OK)
+      return LFS_ERR_IO;
+
+    memcpy(&img->buf[off], buffer, size);
+    img->buf_dirty = true;
+    return LFS_ERR_OK;
+  }
 
-  ptrdiff_t wrote = evfs_file_write(img->fh, buffer, size);
+  ptrdiff_t wrote = evfs_image_cache_write(&img->cache, block * cfg->block_size + off, buffer, size);
   return wrote == size ? LFS_ERR_OK : LFS_ERR_IO;
 }
 
 
-// Erase not needed without direct hardware I/O
+// There is no flash to erase. Release the block's storage in the image file
+// when the host supports it so deleted data doesn't keep using disk space.
 int littlefs_image_erase(const struct lfs_config *cfg, lfs_block_t block) {
-  return LFS_ERR_OK;
+  LittlefsImage *img = cfg->context;
+
+  // Buffered data for the block is obsolete
+  if(img->buf_valid && img->buf_block == block) {
+    img->buf_valid = false;
+    img->buf_dirty = false;
+  }
+
+  int status = evfs_image_cache_discard(&img->cache, (evfs_off_t)block * cfg->block_size,
+                                        cfg->block_size);
+  return (status == EVFS_OK || status == EVFS_ERR_NO_SUPPORT) ? LFS_ERR_OK : LFS_ERR_IO;
 }
 
 int littlefs_image_sync(const struct lfs_config *cfg) {
   LittlefsImage *img = cfg->context;
+
+  // Flush the block buffer and dirty cache lines before syncing the image
+  if(lfs_buf_flush(img, cfg) != EVFS_OK)
+    return LFS_ERR_IO;
+
+  if(evfs_image_cache_sync(&img->cache) != EVFS_OK)
+    return LFS_ERR_IO;
+
   return evfs_file_sync(img->fh) == EVFS_OK ? LFS_ERR_OK : LFS_ERR_IO;
 }
 
@@ -161,7 +293,10 @@ int littlefs_image_sync(const struct lfs_config *cfg) {
 
 // Example littlefs configuration using the image I/O callbacks
 
-LittlefsImage s_lfs_img = {0};
+LittlefsImage s_lfs_img = {
+  .cache_lines = 8,  // Optional write-back cache of cache_size lines
+  .block_buffer = true  // Optional buffer for block sized image I/O
+};
 
 #define KB  *1024UL
 #define LFS_VOL_SIZE   (512 KB)
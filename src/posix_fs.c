@@ -0,0 +1,889 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  POSIX VFS
+  A VFS wrapper for POSIX file descriptors.
+
+  This is a VFS that works directly with file descriptors. There is no libc
+  stream buffering or locking between EVFS and the kernel. The file position
+  is tracked in the handle and all transfers use pread()/pwrite().
+
+  Files can optionally be opened with O_DIRECT. A second descriptor without
+  O_DIRECT is kept for transfers that don't meet the alignment requirements
+  so callers don't need to know whether direct I/O is in effect.
+
+------------------------------------------------------------------------------
+*/
+
+#ifdef __linux__
+#  define _GNU_SOURCE   // O_DIRECT, copy_file_range(), and fallocate()
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+
+#include "evfs.h"
+#include "evfs_internal.h"
+#include "evfs/posix_fs.h"
+
+///////////////////////////////////////////////////////////////////////////////////
+
+
+#define POSIX_DEFAULT_ALIGN  4096
+#define POSIX_MAX_IOV        16
+
+typedef struct PosixData_s {
+  PosixConfig cfg;
+
+  // VFS config options
+  unsigned cfg_readonly    :1; // EVFS_CMD_SET_READONLY
+  unsigned cfg_no_dir_dots :1; // EVFS_CMD_SET_NO_DIR_DOTS
+  unsigned cfg_dir_stat    :1; // EVFS_CMD_SET_DIR_STAT
+} PosixData;
+
+typedef struct PosixFile_s {
+  EvfsFile base;
+  PosixData *fs_data;
+  int fd;
+  int direct_fd;    // O_DIRECT descriptor or -1
+  evfs_off_t pos;
+  bool append;      // Writes go to the end with O_APPEND
+  bool eof;         // Last read came up short
+  bool dirty;       // Written since the last sync
+  unsigned advice;  // EVFS_CMD_SET_FILE_ADVICE
+} PosixFile;
+
+typedef struct PosixDir_s {
+  EvfsDir base;
+  PosixData *fs_data;
+  DIR *dp;
+} PosixDir;
+
+
+// Common error code conversions
+static int translate_error(int err) {
+  switch(err) {
+    case 0:            return EVFS_OK; break;
+    case EIO:          return EVFS_ERR_IO; break;
+    case ENOENT:       return EVFS_ERR_NO_FILE; break;
+    case EEXIST:       return EVFS_ERR_EXISTS; break;
+    case ENOTDIR:      return EVFS_ERR_NO_PATH; break;
+    case EISDIR:       return EVFS_ERR_IS_DIR; break;
+    case ENOTEMPTY:    return EVFS_ERR_NOT_EMPTY; break;
+    case ERANGE:       return EVFS_ERR_OVERFLOW; break;
+    case EINVAL:       return EVFS_ERR_BAD_ARG; break;
+    case ENOSPC:       return EVFS_ERR_FS_FULL; break;
+    case ENOMEM:       return EVFS_ERR_ALLOC; break;
+    case ENAMETOOLONG: return EVFS_ERR_TOO_LONG; break;
+    case EACCES:       return EVFS_ERR_AUTH; break;
+    case EBADF:        return EVFS_ERR_DISABLED; break;
+    default:           return EVFS_ERR; break;
+  }
+}
+
+
+#define posix_error(e)  ((e) == 0 ? EVFS_OK : translate_error(errno))
+
+
+static int set_advice(int fd, unsigned advice) {
+#ifdef POSIX_FADV_NORMAL
+  int posix_advice;
+
+  switch(advice) {
+    case EVFS_ADVICE_NORMAL:      posix_advice = POSIX_FADV_NORMAL; break;
+    case EVFS_ADVICE_SEQUENTIAL:  posix_advice = POSIX_FADV_SEQUENTIAL; break;
+    case EVFS_ADVICE_RANDOM:      posix_advice = POSIX_FADV_RANDOM; break;
+    case EVFS_ADVICE_WILL_NEED:   posix_advice = POSIX_FADV_WILLNEED; break;
+    case EVFS_ADVICE_DONT_NEED:   posix_advice = POSIX_FADV_DONTNEED; break;
+    case EVFS_ADVICE_WRITE_ONCE:  posix_advice = POSIX_FADV_NOREUSE; break;
+    default: return EVFS_ERR_BAD_ARG; break;
+  }
+
+  // posix_fadvise() returns the error rather than setting errno
+  return translate_error(posix_fadvise(fd, 0, 0, posix_advice));
+#else
+  return EVFS_ERR_NO_SUPPORT;
+#endif
+}
+
+
+// Select the descriptor for a transfer. The direct descriptor is only used
+// when the buffer, size, and offset are all aligned.
+static inline int transfer_fd(PosixFile *fil, uintptr_t align_bits) {
+  if(fil->direct_fd >= 0 && (align_bits & (fil->fs_data->cfg.direct_align - 1)) == 0)
+    return fil->direct_fd;
+
+  return fil->fd;
+}
+
+
+
+// ******************** File access methods ********************
+
+static int posix__file_ctrl(EvfsFile *fh, int cmd, void *arg) {
+  PosixFile *fil = (PosixFile *)fh;
+
+  switch(cmd) {
+    case EVFS_CMD_SET_FILE_ADVICE:
+      {
+        unsigned *v = (unsigned *)arg;
+        int status = set_advice(fil->fd, *v);
+        if(status == EVFS_OK)
+          fil->advice = *v;
+        return status;
+      }
+      break;
+
+    case EVFS_CMD_PREFETCH:
+      {
+        EvfsFileRange *v = (EvfsFileRange *)arg;
+#ifdef POSIX_FADV_WILLNEED
+        return translate_error(posix_fadvise(fil->fd, v->offset, v->size, POSIX_FADV_WILLNEED));
+#else
+        (void)v;
+        return EVFS_ERR_NO_SUPPORT;
+#endif
+      }
+      break;
+
+    default: return EVFS_ERR_NO_SUPPORT; break;
+  }
+}
+
+static int posix__file_close(EvfsFile *fh) {
+  PosixFile *fil = (PosixFile *)fh;
+
+  if(fil->direct_fd >= 0)
+    close(fil->direct_fd);
+
+  close(fil->fd);
+  fil->fd = -1;
+  fil->direct_fd = -1;
+  return EVFS_OK;
+}
+
+static ptrdiff_t posix__file_read_at(EvfsFile *fh, void *buf, size_t size, evfs_off_t offset) {
+  PosixFile *fil = (PosixFile *)fh;
+  int fd = transfer_fd(fil, (uintptr_t)buf | size | (uintptr_t)offset);
+
+  ssize_t rval;
+  do {
+    rval = pread(fd, buf, size, offset);
+  } while(rval < 0 && errno == EINTR);
+
+  if(rval < 0) return translate_error(errno);
+
+  return (ptrdiff_t)rval;
+}
+
+static ptrdiff_t posix__file_write_at(EvfsFile *fh, const void *buf, size_t size, evfs_off_t offset) {
+  PosixFile *fil = (PosixFile *)fh;
+  PosixData *fs_data = (PosixData *)fil->fs_data;
+
+  if(fs_data->cfg_readonly) return EVFS_ERR_DISABLED;
+
+  int fd = transfer_fd(fil, (uintptr_t)buf | size | (uintptr_t)offset);
+
+  ssize_t rval;
+  do {
+    rval = pwrite(fd, buf, size, offset);
+  } while(rval < 0 && errno == EINTR);
+
+  if(rval < 0) return translate_error(errno);
+
+  fil->dirty = true;
+  return (ptrdiff_t)rval;
+}
+
+static ptrdiff_t posix__file_read(EvfsFile *fh, void *buf, size_t size) {
+  PosixFile *fil = (PosixFile *)fh;
+
+  ptrdiff_t rval = posix__file_read_at(fh, buf, size, fil->pos);
+  if(rval < 0) return rval;
+
+  fil->pos += rval;
+  fil->eof = (size_t)rval < size;
+  return rval;
+}
+
+static ptrdiff_t posix__file_write(EvfsFile *fh, const void *buf, size_t size) {
+  PosixFile *fil = (PosixFile *)fh;
+  PosixData *fs_data = (PosixData *)fil->fs_data;
+
+  if(fs_data->cfg_readonly) return EVFS_ERR_DISABLED;
+
+  if(fil->append) { // The kernel places the data at the end
+    ssize_t rval;
+    do {
+      rval = write(fil->fd, buf, size);
+    } while(rval < 0 && errno == EINTR);
+
+    if(rval < 0) return translate_error(errno);
+
+    fil->dirty = true;
+    fil->pos = lseek(fil->fd, 0, SEEK_CUR);
+    return (ptrdiff_t)rval;
+  }
+
+  ptrdiff_t rval = posix__file_write_at(fh, buf, size, fil->pos);
+  if(rval > 0)
+    fil->pos += rval;
+
+  return rval;
+}
+
+
+static ptrdiff_t posix__file_transfer_vec(EvfsFile *fh, const EvfsIOVec *iov, int iovcnt, bool write) {
+  PosixFile *fil = (PosixFile *)fh;
+
+  if(write && fil->fs_data->cfg_readonly) return EVFS_ERR_DISABLED;
+
+  ptrdiff_t xfer = 0;
+
+  // Large vectors are transferred in groups of POSIX_MAX_IOV
+  while(iovcnt > 0) {
+    struct iovec sys_iov[POSIX_MAX_IOV];
+    int sys_cnt = MIN(iovcnt, POSIX_MAX_IOV);
+    size_t total = 0;
+    uintptr_t align_bits = (uintptr_t)fil->pos;
+
+    for(int i = 0; i < sys_cnt; i++) {
+      sys_iov[i].iov_base = iov[i].base;
+      sys_iov[i].iov_len  = iov[i].len;
+      total += iov[i].len;
+      align_bits |= (uintptr_t)iov[i].base | iov[i].len;
+    }
+
+    int fd = transfer_fd(fil, align_bits);
+    ssize_t rval;
+    do {
+      if(!write)
+        rval = preadv(fd, sys_iov, sys_cnt, fil->pos);
+      else if(fil->append)
+        rval = writev(fil->fd, sys_iov, sys_cnt);
+      else
+        rval = pwritev(fd, sys_iov, sys_cnt, fil->pos);
+    } while(rval < 0 && errno == EINTR);
+
+    if(rval < 0)
+      return xfer > 0 ? xfer : translate_error(errno);
+
+    if(write) {
+      fil->dirty = true;
+      fil->pos = fil->append ? lseek(fil->fd, 0, SEEK_CUR) : fil->pos + rval;
+    } else {
+      fil->pos += rval;
+    }
+
+    xfer += rval;
+    if((size_t)rval < total) {
+      if(!write)
+        fil->eof = true;
+      break;
+    }
+
+    iov += sys_cnt;
+    iovcnt -= sys_cnt;
+  }
+
+  return xfer;
+}
+
+static ptrdiff_t posix__file_readv(EvfsFile *fh, const EvfsIOVec *iov, int iovcnt) {
+  return posix__file_transfer_vec(fh, iov, iovcnt, /*write*/ false);
+}
+
+static ptrdiff_t posix__file_writev(EvfsFile *fh, const EvfsIOVec *iov, int iovcnt) {
+  return posix__file_transfer_vec(fh, iov, iovcnt, /*write*/ true);
+}
+
+
+static int posix__file_map(EvfsFile *fh, evfs_off_t offset, size_t size, EvfsMapping *map) {
+  PosixFile *fil = (PosixFile *)fh;
+
+  struct stat s;
+  if(fstat(fil->fd, &s) != 0)
+    return translate_error(errno);
+
+  if(offset > s.st_size) return EVFS_ERR_OVERFLOW;
+
+  evfs_off_t remaining = s.st_size - offset;
+  if(remaining == 0) return EVFS_OK; // Empty mapping
+
+  if(size == 0 || (evfs_off_t)size > remaining)
+    size = remaining;
+
+  // Mappings must start on a page boundary
+  long page_size = sysconf(_SC_PAGESIZE);
+  off_t map_offset = offset - offset % page_size;
+  size_t map_len = size + (offset - map_offset);
+
+  void *map_base = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fil->fd, map_offset);
+  if(map_base == MAP_FAILED) // Pipes, devices, and write-only files can't be mapped
+    return errno == ENOMEM ? EVFS_ERR_ALLOC : EVFS_ERR_NO_SUPPORT;
+
+  map->data     = (const uint8_t *)map_base + (offset - map_offset);
+  map->size     = size;
+  map->map_base = map_base;
+  map->map_len  = map_len;
+
+  // Pass the access pattern on to the mapping's page faults
+  switch(fil->advice) {
+    case EVFS_ADVICE_SEQUENTIAL:  madvise(map_base, map_len, MADV_SEQUENTIAL); break;
+    case EVFS_ADVICE_RANDOM:      madvise(map_base, map_len, MADV_RANDOM); break;
+    case EVFS_ADVICE_WILL_NEED:   madvise(map_base, map_len, MADV_WILLNEED); break;
+    default: break;
+  }
+
+  return EVFS_OK;
+}
+
+static int posix__file_unmap(EvfsFile *fh, EvfsMapping *map) {
+  return posix_error(munmap(map->map_base, map->map_len));
+}
+
+
+static int posix__file_truncate(EvfsFile *fh, evfs_off_t size) {
+  PosixFile *fil = (PosixFile *)fh;
+  PosixData *fs_data = (PosixData *)fil->fs_data;
+
+  if(fs_data->cfg_readonly) return EVFS_ERR_DISABLED;
+
+  fil->dirty = true;
+  return posix_error(ftruncate(fil->fd, size));
+}
+
+static int posix__file_discard(EvfsFile *fh, evfs_off_t offset, evfs_off_t size) {
+#ifdef FALLOC_FL_PUNCH_HOLE
+  PosixFile *fil = (PosixFile *)fh;
+  PosixData *fs_data = (PosixData *)fil->fs_data;
+
+  if(fs_data->cfg_readonly) return EVFS_ERR_DISABLED;
+
+  fil->dirty = true;
+  if(fallocate(fil->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, size) == 0)
+    return EVFS_OK;
+
+  return (errno == EOPNOTSUPP) ? EVFS_ERR_NO_SUPPORT : translate_error(errno);
+#else
+  return EVFS_ERR_NO_SUPPORT;
+#endif
+}
+
+// evfs_file_size() syncs first so a clean file skips the system call
+static int posix__file_sync(EvfsFile *fh) {
+  PosixFile *fil = (PosixFile *)fh;
+
+  if(!fil->dirty)
+    return EVFS_OK;
+
+#if defined _POSIX_SYNCHRONIZED_IO && _POSIX_SYNCHRONIZED_IO > 0
+  int err = fdatasync(fil->fd);
+#else
+  int err = fsync(fil->fd);
+#endif
+  if(err != 0)
+    return translate_error(errno);
+
+  fil->dirty = false;
+
+#ifdef POSIX_FADV_DONTNEED
+  // Written pages are clean now so they can be dropped from the cache
+  if(fil->advice == EVFS_ADVICE_WRITE_ONCE)
+    posix_fadvise(fil->fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+
+  return EVFS_OK;
+}
+
+static evfs_off_t posix__file_size(EvfsFile *fh) {
+  PosixFile *fil = (PosixFile *)fh;
+  struct stat s;
+
+  if(fstat(fil->fd, &s) != 0)
+    return 0;
+
+  return s.st_size;
+}
+
+static int posix__file_seek(EvfsFile *fh, evfs_off_t offset, EvfsSeekDir origin) {
+  PosixFile *fil = (PosixFile *)fh;
+
+  // Not using evfs__absolute_offset() since evfs_file_size() would sync a dirty file
+  switch(origin) {
+    case EVFS_SEEK_TO:   break;
+    case EVFS_SEEK_REL:  offset += fil->pos; break;
+    case EVFS_SEEK_REV:  offset = posix__file_size(fh) - offset; break;
+    default:
+      break;
+  }
+
+  if(offset < 0) return EVFS_ERR_BAD_ARG;
+
+  fil->pos = offset;
+  fil->eof = false;
+  return EVFS_OK;
+}
+
+static evfs_off_t posix__file_tell(EvfsFile *fh) {
+  PosixFile *fil = (PosixFile *)fh;
+  return fil->pos;
+}
+
+static bool posix__file_eof(EvfsFile *fh) {
+  PosixFile *fil = (PosixFile *)fh;
+  return fil->eof;
+}
+
+
+
+static EvfsFileMethods s_posix_methods = {
+  .m_ctrl     = posix__file_ctrl,
+  .m_close    = posix__file_close,
+  .m_read     = posix__file_read,
+  .m_write    = posix__file_write,
+  .m_truncate = posix__file_truncate,
+  .m_sync     = posix__file_sync,
+  .m_size     = posix__file_size,
+  .m_seek     = posix__file_seek,
+  .m_tell     = posix__file_tell,
+  .m_eof      = posix__file_eof,
+  .m_read_at  = posix__file_read_at,
+  .m_write_at = posix__file_write_at,
+  .m_map      = posix__file_map,
+  .m_unmap    = posix__file_unmap,
+  .m_discard  = posix__file_discard,
+  .m_readv    = posix__file_readv,
+  .m_writev   = posix__file_writev
+};
+
+
+
+// ******************** Directory access methods ********************
+
+static int posix__dir_close(EvfsDir *dh) {
+  PosixDir *dir = (PosixDir *)dh;
+  closedir(dir->dp);
+  dir->dp = NULL;
+  return EVFS_OK;
+}
+
+
+static struct dirent *posix_next_entry(PosixDir *dir) {
+  PosixData *fs_data = (PosixData *)dir->fs_data;
+
+  struct dirent *posix_entry = readdir(dir->dp);
+
+  // Skip over dir dots if configured
+  if(fs_data->cfg_no_dir_dots) {
+    while(posix_entry && (!strcmp(posix_entry->d_name, ".") || !strcmp(posix_entry->d_name, ".."))) {
+      posix_entry = readdir(dir->dp);
+    }
+  }
+
+  return posix_entry;
+}
+
+
+static void posix_fill_info(PosixDir *dir, struct dirent *posix_entry, EvfsInfo *info) {
+  PosixData *fs_data = (PosixData *)dir->fs_data;
+
+  memset(info, 0, sizeof(*info));
+
+  if(!posix_entry)
+    return;
+
+  info->name = posix_entry->d_name;
+  if(posix_entry->d_type == DT_DIR)
+     info->type |= EVFS_FILE_DIR;
+
+  // Stat relative to the open directory so no path needs to be built
+  struct stat s;
+  if(fs_data->cfg_dir_stat && fstatat(dirfd(dir->dp), posix_entry->d_name, &s, 0) == 0) {
+    info->size = s.st_size;
+    info->mtime = s.st_mtime;
+
+    // Covers filesystems that report DT_UNKNOWN
+    if(S_ISDIR(s.st_mode))
+      info->type |= EVFS_FILE_DIR;
+  }
+}
+
+
+static int posix__dir_read(EvfsDir *dh, EvfsInfo *info) {
+  PosixDir *dir = (PosixDir *)dh;
+
+  struct dirent *posix_entry = posix_next_entry(dir);
+  posix_fill_info(dir, posix_entry, info);
+
+  return posix_entry ? EVFS_OK : EVFS_DONE;
+}
+
+
+static int posix__dir_read_many(EvfsDir *dh, EvfsInfo *entries, int max_entries, char *name_buf,
+                                size_t name_buf_size) {
+  PosixDir *dir = (PosixDir *)dh;
+  int count = 0;
+
+  while(count < max_entries) {
+    long prev_pos = telldir(dir->dp);
+    struct dirent *posix_entry = posix_next_entry(dir);
+    if(!posix_entry)
+      break;
+
+    size_t name_len = strlen(posix_entry->d_name) + 1;
+    if(name_len > name_buf_size) {
+      seekdir(dir->dp, prev_pos);
+      return count > 0 ? count : EVFS_ERR_TOO_LONG;
+    }
+
+    EvfsInfo *info = &entries[count++];
+    posix_fill_info(dir, posix_entry, info);
+
+    memcpy(name_buf, posix_entry->d_name, name_len);
+    info->name = name_buf;
+    name_buf += name_len;
+    name_buf_size -= name_len;
+  }
+
+  return count;
+}
+
+
+static int posix__dir_rewind(EvfsDir *dh) {
+  PosixDir *dir = (PosixDir *)dh;
+
+  rewinddir(dir->dp);
+  return EVFS_OK;
+}
+
+
+static EvfsDirMethods s_posix_dir_methods = {
+  .m_close    = posix__dir_close,
+  .m_read     = posix__dir_read,
+  .m_rewind   = posix__dir_rewind,
+  .m_read_many = posix__dir_read_many
+};
+
+
+
+// ******************** FS access methods ********************
+
+
+/*
+  open() flag mapping follows the fopen() modes used by the Stdio VFS
+
+  EVFS_READ                         O_RDONLY
+  EVFS_WRITE                        O_WRONLY | O_CREAT | O_TRUNC
+  EVFS_OVERWRITE                    O_WRONLY | O_CREAT | O_TRUNC
+  EVFS_APPEND                       O_WRONLY | O_CREAT | O_APPEND
+  EVFS_NO_EXIST                     O_WRONLY | O_CREAT | O_TRUNC | O_EXCL
+  EVFS_OPEN_OR_NEW                  O_RDONLY | O_CREAT
+
+  O_RDWR replaces O_RDONLY and O_WRONLY when EVFS_READ and EVFS_WRITE are both set.
+*/
+
+
+static int posix__open(Evfs *vfs, const char *path, EvfsFile *fh, int flags) {
+  PosixFile *fil = (PosixFile *)fh;
+  PosixData *fs_data = (PosixData *)vfs->fs_data;
+
+  memset(fil, 0, sizeof(*fil));
+  fh->methods = &s_posix_methods;
+  fil->fd = -1;
+  fil->direct_fd = -1;
+
+  if((flags & (EVFS_WRITE | EVFS_OPEN_OR_NEW | EVFS_OVERWRITE | EVFS_APPEND)) && fs_data->cfg_readonly)
+    return EVFS_ERR_DISABLED;
+
+  bool rdwr = (flags & EVFS_WRITE) && (flags & EVFS_READ);
+  int oflags;
+
+  if(flags & EVFS_APPEND) {
+    oflags = (rdwr ? O_RDWR : O_WRONLY) | O_CREAT | O_APPEND;
+    fil->append = true;
+  } else if((flags & EVFS_OVERWRITE) || (flags & EVFS_NO_EXIST) || ((flags & EVFS_WRITE) && !(flags & EVFS_READ))) {
+    oflags = (rdwr ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC;
+    if(flags & EVFS_NO_EXIST)
+      oflags |= O_EXCL;
+  } else { // Default to reading
+    oflags = rdwr ? O_RDWR : O_RDONLY;
+    if(flags & EVFS_OPEN_OR_NEW) // No separate step needed to create a missing file
+      oflags |= O_CREAT;
+  }
+
+  fil->fs_data = fs_data;
+
+  do {
+    fil->fd = open(path, oflags | O_CLOEXEC, 0666);
+  } while(fil->fd < 0 && errno == EINTR);
+
+  if(fil->fd < 0)
+    return translate_error(errno);
+
+  if(fs_data->cfg.direct_io) {
+    // The file exists now so the direct descriptor only needs the access mode
+    int dflags = (oflags & O_ACCMODE) | O_CLOEXEC;
+#ifdef O_DIRECT
+    fil->direct_fd = open(path, dflags | O_DIRECT);
+#elif defined F_NOCACHE // macOS bypasses the cache with a descriptor flag
+    fil->direct_fd = open(path, dflags);
+    if(fil->direct_fd >= 0 && fcntl(fil->direct_fd, F_NOCACHE, 1) != 0) {
+      close(fil->direct_fd);
+      fil->direct_fd = -1;
+    }
+#endif
+    // Filesystems without direct I/O support (tmpfs) leave direct_fd at -1
+  }
+
+  if(fs_data->cfg.advice != EVFS_ADVICE_NORMAL && set_advice(fil->fd, fs_data->cfg.advice) == EVFS_OK)
+    fil->advice = fs_data->cfg.advice;
+
+  return EVFS_OK;
+}
+
+
+static int posix__stat(Evfs *vfs, const char *path, EvfsInfo *info) {
+  struct stat s;
+
+  int err = stat(path, &s);
+
+  memset(info, 0, sizeof(*info));
+
+  if(err == 0) {
+    info->size = s.st_size;
+    info->mtime = s.st_mtime;
+
+    if(S_ISDIR(s.st_mode))
+      info->type |= EVFS_FILE_DIR;
+    if(S_ISLNK(s.st_mode))
+      info->type |= EVFS_FILE_SYM_LINK;
+
+    return EVFS_OK;
+  }
+
+  return translate_error(errno);
+}
+
+static int posix__delete(Evfs *vfs, const char *path) {
+  PosixData *fs_data = (PosixData *)vfs->fs_data;
+
+  if(fs_data->cfg_readonly) return EVFS_ERR_DISABLED;
+
+  return posix_error(remove(path));
+}
+
+
+static int posix__rename(Evfs *vfs, const char *old_path, const char *new_path) {
+  PosixData *fs_data = (PosixData *)vfs->fs_data;
+
+  if(fs_data->cfg_readonly) return EVFS_ERR_DISABLED;
+
+  return posix_error(rename(old_path, new_path));
+}
+
+
+static int posix__make_dir(Evfs *vfs, const char *path) {
+  PosixData *fs_data = (PosixData *)vfs->fs_data;
+
+  if(fs_data->cfg_readonly) return EVFS_ERR_DISABLED;
+
+  return posix_error(mkdir(path, S_IRWXU));
+}
+
+static int posix__open_dir(Evfs *vfs, const char *path, EvfsDir *dh) {
+  PosixDir *dir = (PosixDir *)dh;
+
+  memset(dir, 0, sizeof(*dir));
+  dh->methods = &s_posix_dir_methods;
+  dir->fs_data = (PosixData *)vfs->fs_data;
+
+  dir->dp = opendir(path);
+
+  return dir->dp ? EVFS_OK : translate_error(errno);
+}
+
+
+static int posix__get_cur_dir(Evfs *vfs, StringRange *cur_dir) {
+  char *status = getcwd((char *)cur_dir->start, range_size(cur_dir));
+
+  if(status) return EVFS_OK;
+
+  return translate_error(errno);
+}
+
+static int posix__set_cur_dir(Evfs *vfs, const char *path) {
+  return posix_error(chdir(path));
+}
+
+
+#ifdef __linux__
+// Copy between POSIX files in the kernel
+static int posix__copy(Evfs *vfs, EvfsFile *dest, EvfsFile *src, evfs_off_t size) {
+  PosixData *fs_data = (PosixData *)vfs->fs_data;
+
+  if(src->methods != &s_posix_methods || dest->methods != &s_posix_methods)
+    return EVFS_ERR_NO_SUPPORT;
+
+  if(fs_data->cfg_readonly) return EVFS_ERR_DISABLED;
+
+  PosixFile *src_fil = (PosixFile *)src;
+  PosixFile *dest_fil = (PosixFile *)dest;
+
+  // copy_file_range() rejects O_APPEND destinations
+  if(dest_fil->append)
+    return EVFS_ERR_NO_SUPPORT;
+
+  off_t src_pos = src_fil->pos;
+  off_t dest_pos = dest_fil->pos;
+
+  int status = EVFS_OK;
+  bool copied = false;
+  while(size > 0) {
+    ssize_t sent = copy_file_range(src_fil->fd, &src_pos, dest_fil->fd, &dest_pos, size, 0);
+    if(sent <= 0) {
+      if(sent == 0) // Source was truncated
+        status = EVFS_ERR_IO;
+      else  // Nothing has been written yet when copy_file_range() isn't supported
+        status = copied ? translate_error(errno) : EVFS_ERR_NO_SUPPORT;
+      break;
+    }
+
+    size -= sent;
+    copied = true;
+  }
+
+  src_fil->pos = src_pos;
+  dest_fil->pos = dest_pos;
+  if(copied)
+    dest_fil->dirty = true;
+
+  return status;
+}
+#endif
+
+
+static int posix__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
+  PosixData *fs_data = (PosixData *)vfs->fs_data;
+
+  switch(cmd) {
+    case EVFS_CMD_UNREGISTER: return EVFS_OK; break;
+
+    case EVFS_CMD_SET_READONLY:
+      {
+        unsigned *v = (unsigned *)arg;
+        fs_data->cfg_readonly = !!*v;
+      }
+      return EVFS_OK; break;
+
+    case EVFS_CMD_SET_NO_DIR_DOTS:
+      {
+        unsigned *v = (unsigned *)arg;
+        fs_data->cfg_no_dir_dots = !!*v;
+      }
+      return EVFS_OK; break;
+
+    case EVFS_CMD_SET_DIR_STAT:
+      {
+        unsigned *v = (unsigned *)arg;
+        fs_data->cfg_dir_stat = !!*v;
+      }
+      return EVFS_OK; break;
+
+    case EVFS_CMD_GET_STAT_FIELDS:
+      {
+        unsigned *v = (unsigned *)arg;
+        *v = EVFS_INFO_SIZE | EVFS_INFO_MTIME | EVFS_INFO_TYPE;
+      }
+      return EVFS_OK; break;
+
+    case EVFS_CMD_GET_DIR_FIELDS:
+      {
+        unsigned *v = (unsigned *)arg;
+        *v = EVFS_INFO_NAME | EVFS_INFO_TYPE;
+        if(fs_data->cfg_dir_stat)
+          *v |= EVFS_INFO_SIZE | EVFS_INFO_MTIME;
+      }
+      return EVFS_OK; break;
+
+    case EVFS_CMD_GET_CONCURRENT_WRITES: // The OS handles concurrent file operations
+      {
+        unsigned *v = (unsigned *)arg;
+        *v = 1;
+      }
+      return EVFS_OK; break;
+
+    default: return EVFS_ERR_NO_SUPPORT; break;
+  }
+}
+
+
+static PosixData s_posix_data = {0};
+
+static Evfs s_posix_vfs = {
+  .vfs_name = "posix",
+  .vfs_file_size = sizeof(PosixFile),
+  .vfs_dir_size = sizeof(PosixDir),
+
+  .fs_data = &s_posix_data,
+
+  // Required mothods
+  .m_open = posix__open,
+  .m_stat = posix__stat,
+
+  // Optional methods
+  .m_delete = posix__delete,
+  .m_rename = posix__rename,
+  .m_make_dir = posix__make_dir,
+  .m_open_dir = posix__open_dir,
+  .m_get_cur_dir = posix__get_cur_dir,
+  .m_set_cur_dir = posix__set_cur_dir,
+  .m_vfs_ctrl = posix__vfs_ctrl,
+#ifdef __linux__
+  .m_copy = posix__copy,
+#endif
+};
+
+
+/*
+Register a POSIX instance.
+
+This VFS is always named "posix". There should only be one instance per application.
+
+Args:
+  cfg:           Optional configuration settings. NULL for defaults
+  default_vfs:   Make this the default VFS when true
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_register_posix(PosixConfig *cfg, bool default_vfs) {
+  PosixConfig *fs_cfg = &s_posix_data.cfg;
+
+  memset(fs_cfg, 0, sizeof(*fs_cfg));
+  if(cfg)
+    *fs_cfg = *cfg;
+
+  if(fs_cfg->direct_align == 0)
+    fs_cfg->direct_align = POSIX_DEFAULT_ALIGN;
+
+  if(fs_cfg->direct_align & (fs_cfg->direct_align - 1)) return EVFS_ERR_BAD_ARG;
+  if(fs_cfg->advice > EVFS_ADVICE_WRITE_ONCE) return EVFS_ERR_BAD_ARG;
+
+  return evfs_register(&s_posix_vfs, default_vfs);
+}
@@ -0,0 +1,1381 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  RAM FS VFS
+  A writable filesystem kept entirely in memory
+
+  Each file and directory is a node in a tree. Nodes are found through a hash
+  keyed by their parent node and name so that a lookup is one probe per path
+  component and renaming a directory only rekeys that directory.
+
+  File data is stored in a list of fixed size chunks. Writes past the end add
+  chunks without moving existing data. Chunks released by truncation and
+  deletion are kept for reuse until the filesystem is unregistered so that an
+  arena allocator can back the file data. Bytes past the end of a file within
+  its last chunk are always zero.
+
+  Mapped ranges inside one chunk point directly at the chunk. Mapping a range
+  that spans chunks first merges the file into a single chunk.
+------------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "evfs.h"
+#include "evfs_internal.h"
+#include "evfs/ramfs_fs.h"
+#include "evfs/util/dhash.h"
+#include "evfs/util/range_strings.h"
+
+
+// Access objects allocated in a single block of memory
+#define NEXT_OBJ(o) (&(o)[1])
+
+#define DEFAULT_CHUNK_SIZE  512
+#define RAMFS_MAX_NAME      255
+
+
+// Block of file data
+typedef struct RamChunk {
+  struct RamChunk *next;
+  size_t  size;
+  uint8_t data[];
+} RamChunk;
+
+
+typedef struct RamNode {
+  struct RamNode *parent;
+  struct RamNode *prev;       // Siblings in the parent directory
+  struct RamNode *next;
+
+  uint8_t   *key;             // Parent pointer followed by the NUL terminated name
+  size_t     key_len;         // Excludes the NUL
+  time_t     mtime;
+  bool       is_dir;
+  bool       unlinked;        // Deleted while still open
+  unsigned   open_count;      // Open file and directory handles
+
+  // Directory entries
+  struct RamNode *children;
+  struct RamNode *children_tail;
+  unsigned   dir_gen;         // Changed when entries are added or removed
+
+  // File data
+  RamChunk  *chunks;
+  RamChunk  *tail;
+  evfs_off_t tail_offset;     // File offset of the tail chunk
+  evfs_off_t capacity;        // Bytes in all chunks
+  evfs_off_t size;
+  unsigned   layout_gen;      // Changed when chunks are freed or merged
+  unsigned   map_count;
+} RamNode;
+
+#define NODE_NAME(n)  ((char *)&(n)->key[sizeof(RamNode *)])
+
+
+typedef struct RamfsData {
+  dhash       nodes;          // Every node except the root
+  RamNode     root;
+  uint8_t     root_key[sizeof(RamNode *) + 1];
+
+  const EvfsAllocator *alloc;
+  size_t      chunk_size;
+  size_t      max_size;
+  size_t      data_size;      // Bytes in chunks held by files
+  RamChunk   *free_chunks;    // Released chunks of chunk_size
+
+  char        cur_dir[EVFS_MAX_PATH];
+  EvfsLock    lock;           // Protects everything above
+} RamfsData;
+
+
+// Last chunk accessed through a file handle
+typedef struct RamCursor {
+  RamChunk   *chunk;
+  evfs_off_t  offset;         // File offset of chunk
+  unsigned    layout_gen;
+} RamCursor;
+
+
+typedef struct RamfsFile {
+  EvfsFile    base;
+  RamfsData  *fs_data;
+  RamNode    *node;           // NULL when closed
+
+  RamCursor   cursor;
+  evfs_off_t  pos;
+  bool        writable;
+  bool        append;
+} RamfsFile;
+
+
+typedef struct RamfsDir {
+  EvfsDir     base;
+  RamfsData  *fs_data;
+  RamNode    *node;
+
+  RamNode    *next_entry;
+  size_t      pos;            // Entries already read
+  unsigned    dir_gen;        // Validates next_entry
+  char        name[RAMFS_MAX_NAME+1];
+} RamfsDir;
+
+
+
+// ******************** Node index ********************
+
+static bool ramfs__equal_keys(dhKey key1, dhKey key2, void *ctx) {
+  return key1.length == key2.length && !memcmp(key1.data, key2.data, key1.length);
+}
+
+
+static void ramfs__destroy_node_entry(dhKey key, void *value, void *ctx) {
+  // Nodes are freed by ramfs__free_all()
+}
+
+
+static bool ramfs__index_init(RamfsData *fs_data) {
+  dhConfig hash_cfg = {
+    .init_buckets = 32,
+    .value_size   = sizeof(RamNode *),
+
+    .destroy_item = ramfs__destroy_node_entry,
+    .gen_hash     = dh_gen_hash_string, // Hashes any bytes
+    .is_equal     = ramfs__equal_keys
+  };
+
+  return dh_init(&fs_data->nodes, &hash_cfg, NULL);
+}
+
+
+// Build a lookup key for a child of parent. Buffer must hold RAMFS_MAX_NAME+1 after the pointer.
+static inline dhKey ramfs__child_key(uint8_t *buf, RamNode *parent, const char *name, size_t name_len) {
+  memcpy(buf, &parent, sizeof parent);
+  memcpy(&buf[sizeof parent], name, name_len);
+
+  dhKey key = {.data = buf, .length = sizeof parent + name_len};
+  return key;
+}
+
+
+static RamNode *ramfs__find_child(RamfsData *fs_data, RamNode *parent, const char *name,
+                                  size_t name_len) {
+  if(name_len > RAMFS_MAX_NAME) return NULL;
+
+  uint8_t key_buf[sizeof(RamNode *) + RAMFS_MAX_NAME];
+  RamNode *node;
+
+  if(!dh_lookup(&fs_data->nodes, ramfs__child_key(key_buf, parent, name, name_len), &node))
+    return NULL;
+
+  return node;
+}
+
+
+// Split a normalized absolute path into its existing parent node and final name
+// The name is empty for the root. Lock must be held.
+static int ramfs__find_parent(RamfsData *fs_data, const char *path, RamNode **parent,
+                              const char **name, size_t *name_len) {
+  RamNode *dir = &fs_data->root;
+
+  const char *seg = path;
+  while(*seg == '/' || *seg == '\\') {
+    seg++;
+  }
+
+  while(*seg) {
+    const char *seg_end = seg;
+    while(*seg_end && *seg_end != '/' && *seg_end != '\\') {
+      seg_end++;
+    }
+
+    const char *next = seg_end;
+    while(*next == '/' || *next == '\\') {
+      next++;
+    }
+
+    if(*next == '\0') { // Final component
+      *parent = dir;
+      *name = seg;
+      *name_len = seg_end - seg;
+      return EVFS_OK;
+    }
+
+    dir = ramfs__find_child(fs_data, dir, seg, seg_end - seg);
+    if(!dir || !dir->is_dir)
+      return EVFS_ERR_NO_PATH;
+
+    seg = next;
+  }
+
+  *parent = dir; // Root
+  *name = seg;
+  *name_len = 0;
+  return EVFS_OK;
+}
+
+
+static RamNode *ramfs__find_node(RamfsData *fs_data, const char *path) {
+  RamNode *parent;
+  const char *name;
+  size_t name_len;
+
+  if(ramfs__find_parent(fs_data, path, &parent, &name, &name_len) != EVFS_OK)
+    return NULL;
+
+  if(name_len == 0)
+    return parent;
+
+  return ramfs__find_child(fs_data, parent, name, name_len);
+}
+
+
+
+// ******************** File data ********************
+
+static int ramfs__chunk_new(RamfsData *fs_data, size_t size, RamChunk **chunk) {
+  if(fs_data->max_size > 0 && fs_data->data_size + size > fs_data->max_size)
+    return EVFS_ERR_FS_FULL;
+
+  RamChunk *new_chunk;
+
+  if(size == fs_data->chunk_size && fs_data->free_chunks) {
+    new_chunk = fs_data->free_chunks;
+    fs_data->free_chunks = new_chunk->next;
+  } else {
+    new_chunk = evfs_alloc_with(fs_data->alloc, EVFS_ALLOC_GENERAL, sizeof(RamChunk) + size);
+    if(MEM_CHECK(new_chunk)) return EVFS_ERR_ALLOC;
+    new_chunk->size = size;
+  }
+
+  new_chunk->next = NULL;
+  memset(new_chunk->data, 0, size);
+  fs_data->data_size += size;
+
+  *chunk = new_chunk;
+  return EVFS_OK;
+}
+
+
+static void ramfs__chunk_free(RamfsData *fs_data, RamChunk *chunk) {
+  fs_data->data_size -= chunk->size;
+
+  if(chunk->size == fs_data->chunk_size) { // Keep for reuse
+    chunk->next = fs_data->free_chunks;
+    fs_data->free_chunks = chunk;
+  } else {
+    evfs_free_with(fs_data->alloc, EVFS_ALLOC_GENERAL, chunk);
+  }
+}
+
+
+// Add chunks until the file can hold size bytes
+static int ramfs__reserve(RamfsData *fs_data, RamNode *node, evfs_off_t size) {
+  while(node->capacity < size) {
+    RamChunk *chunk;
+    int status = ramfs__chunk_new(fs_data, fs_data->chunk_size, &chunk);
+    if(status != EVFS_OK) return status;
+
+    if(node->tail)
+      node->tail->next = chunk;
+    else
+      node->chunks = chunk;
+
+    node->tail = chunk;
+    node->tail_offset = node->capacity;
+    node->capacity += chunk->size;
+  }
+
+  return EVFS_OK;
+}
+
+
+// Find the chunk holding offset. Starts from the cursor when it is still valid.
+static RamChunk *ramfs__seek_chunk(RamNode *node, RamCursor *cur, evfs_off_t offset,
+                                   evfs_off_t *chunk_offset) {
+  RamChunk *chunk = node->chunks;
+  evfs_off_t pos = 0;
+
+  if(node->tail && offset >= node->tail_offset) {
+    chunk = node->tail;
+    pos = node->tail_offset;
+  } else if(cur->chunk && cur->layout_gen == node->layout_gen && cur->offset <= offset) {
+    chunk = cur->chunk;
+    pos = cur->offset;
+  }
+
+  while(chunk && offset >= pos + (evfs_off_t)chunk->size) {
+    pos += chunk->size;
+    chunk = chunk->next;
+  }
+
+  cur->chunk = chunk;
+  cur->offset = pos;
+  cur->layout_gen = node->layout_gen;
+
+  *chunk_offset = pos;
+  return chunk;
+}
+
+
+// Copy between a buffer and file data. The range must be within capacity.
+static void ramfs__transfer(RamNode *node, RamCursor *cur, evfs_off_t offset, uint8_t *buf,
+                            size_t size, bool write) {
+  if(size == 0) return;
+
+  evfs_off_t pos;
+  RamChunk *chunk = ramfs__seek_chunk(node, cur, offset, &pos);
+
+  while(1) {
+    size_t start = offset - pos;
+    size_t xfer = MIN(size, chunk->size - start);
+
+    if(write)
+      memcpy(&chunk->data[start], buf, xfer);
+    else
+      memcpy(buf, &chunk->data[start], xfer);
+
+    buf += xfer;
+    offset += xfer;
+    size -= xfer;
+    if(size == 0) break;
+
+    pos += chunk->size;
+    chunk = chunk->next;
+  }
+
+  cur->chunk = chunk;
+  cur->offset = pos;
+}
+
+
+static int ramfs__truncate(RamfsData *fs_data, RamNode *node, evfs_off_t size) {
+  if(size >= node->size) { // Grow with zeros
+    int status = ramfs__reserve(fs_data, node, size);
+    if(status == EVFS_OK)
+      node->size = size;
+    return status;
+  }
+
+  if(node->map_count > 0) return EVFS_ERR_BUSY;
+
+  // Keep the chunks holding the new size
+  RamChunk *keep = NULL;
+  RamChunk *chunk = node->chunks;
+  evfs_off_t pos = 0;
+
+  while(chunk && pos + (evfs_off_t)chunk->size < size) {
+    pos += chunk->size;
+    keep = chunk;
+    chunk = chunk->next;
+  }
+
+  if(chunk && size > pos) { // Chunk holds the end of the file
+    keep = chunk;
+    memset(&chunk->data[size - pos], 0, chunk->size - (size - pos));
+    pos += chunk->size;
+    chunk = chunk->next;
+  }
+
+  while(chunk) {
+    RamChunk *next = chunk->next;
+    ramfs__chunk_free(fs_data, chunk);
+    chunk = next;
+  }
+
+  if(keep) {
+    keep->next = NULL;
+    node->tail = keep;
+    node->tail_offset = pos - keep->size;
+  } else {
+    node->chunks = NULL;
+    node->tail = NULL;
+    node->tail_offset = 0;
+  }
+
+  node->capacity = pos;
+  node->size = size;
+  node->layout_gen++;
+  return EVFS_OK;
+}
+
+
+// Merge all file data into a single chunk
+static int ramfs__coalesce(RamfsData *fs_data, RamNode *node) {
+  RamChunk *merged;
+  int status = ramfs__chunk_new(fs_data, node->size, &merged);
+  if(status != EVFS_OK) return status;
+
+  RamChunk *chunk = node->chunks;
+  size_t pos = 0;
+  while(chunk) {
+    RamChunk *next = chunk->next;
+    if(pos < (size_t)node->size)
+      memcpy(&merged->data[pos], chunk->data, MIN(chunk->size, (size_t)node->size - pos));
+
+    pos += chunk->size;
+    ramfs__chunk_free(fs_data, chunk);
+    chunk = next;
+  }
+
+  node->chunks = merged;
+  node->tail = merged;
+  node->tail_offset = 0;
+  node->capacity = node->size;
+  node->layout_gen++;
+  return EVFS_OK;
+}
+
+
+
+// ******************** Tree ********************
+
+static int ramfs__node_new(RamfsData *fs_data, RamNode *parent, const char *name, size_t name_len,
+                           bool is_dir, RamNode **node) {
+  if(name_len > RAMFS_MAX_NAME) return EVFS_ERR_TOO_LONG;
+
+  RamNode *new_node = evfs_alloc_with(fs_data->alloc, EVFS_ALLOC_INDEX, sizeof(*new_node));
+  if(MEM_CHECK(new_node)) return EVFS_ERR_ALLOC;
+  memset(new_node, 0, sizeof(*new_node));
+
+  new_node->key_len = sizeof parent + name_len;
+  new_node->key = evfs_alloc_with(fs_data->alloc, EVFS_ALLOC_INDEX, new_node->key_len + 1);
+  if(MEM_CHECK(new_node->key)) {
+    evfs_free_with(fs_data->alloc, EVFS_ALLOC_INDEX, new_node);
+    return EVFS_ERR_ALLOC;
+  }
+
+  ramfs__child_key(new_node->key, parent, name, name_len);
+  new_node->key[new_node->key_len] = '\0';
+
+  // Robin Hood insertion swaps values through the argument so pass a copy
+  dhKey key = {.data = new_node->key, .length = new_node->key_len};
+  RamNode *value = new_node;
+  if(!dh_insert(&fs_data->nodes, key, &value)) {
+    evfs_free_with(fs_data->alloc, EVFS_ALLOC_INDEX, new_node->key);
+    evfs_free_with(fs_data->alloc, EVFS_ALLOC_INDEX, new_node);
+    return EVFS_ERR_ALLOC;
+  }
+
+  new_node->is_dir = is_dir;
+  new_node->mtime = time(NULL);
+
+  // Append to the parent's entries
+  new_node->parent = parent;
+  new_node->prev = parent->children_tail;
+  if(parent->children_tail)
+    parent->children_tail->next = new_node;
+  else
+    parent->children = new_node;
+  parent->children_tail = new_node;
+  parent->dir_gen++;
+  parent->mtime = new_node->mtime;
+
+  *node = new_node;
+  return EVFS_OK;
+}
+
+
+static void ramfs__node_free(RamfsData *fs_data, RamNode *node) {
+  RamChunk *chunk = node->chunks;
+  while(chunk) {
+    RamChunk *next = chunk->next;
+    ramfs__chunk_free(fs_data, chunk);
+    chunk = next;
+  }
+
+  evfs_free_with(fs_data->alloc, EVFS_ALLOC_INDEX, node->key);
+  evfs_free_with(fs_data->alloc, EVFS_ALLOC_INDEX, node);
+}
+
+
+static void ramfs__node_detach(RamNode *node) {
+  RamNode *parent = node->parent;
+
+  if(node->prev)
+    node->prev->next = node->next;
+  else
+    parent->children = node->next;
+
+  if(node->next)
+    node->next->prev = node->prev;
+  else
+    parent->children_tail = node->prev;
+
+  node->prev = NULL;
+  node->next = NULL;
+  parent->dir_gen++;
+  parent->mtime = time(NULL);
+}
+
+
+// Remove a node from the tree. Open nodes are freed when their last handle closes.
+static void ramfs__node_unlink(RamfsData *fs_data, RamNode *node) {
+  dhKey key = {.data = node->key, .length = node->key_len};
+  RamNode *removed;
+  dh_remove(&fs_data->nodes, key, &removed);
+
+  ramfs__node_detach(node);
+
+  if(node->open_count > 0)
+    node->unlinked = true;
+  else
+    ramfs__node_free(fs_data, node);
+}
+
+
+static void ramfs__node_release(RamfsData *fs_data, RamNode *node) {
+  node->open_count--;
+  if(node->unlinked && node->open_count == 0)
+    ramfs__node_free(fs_data, node);
+}
+
+
+static bool ramfs__free_visitor(dhKey key, void *value, void *ctx) {
+  ramfs__node_free((RamfsData *)ctx, *(RamNode **)value);
+  return true;
+}
+
+
+static void ramfs__free_all(RamfsData *fs_data) {
+  dh_foreach(&fs_data->nodes, ramfs__free_visitor, fs_data);
+  dh_free(&fs_data->nodes);
+
+  RamChunk *chunk = fs_data->free_chunks;
+  while(chunk) {
+    RamChunk *next = chunk->next;
+    evfs_free_with(fs_data->alloc, EVFS_ALLOC_GENERAL, chunk);
+    chunk = next;
+  }
+  fs_data->free_chunks = NULL;
+}
+
+
+
+// ******************** File access methods ********************
+
+static int ramfs__file_ctrl(EvfsFile *fh, int cmd, void *arg) {
+  return EVFS_ERR_NO_SUPPORT;
+}
+
+static int ramfs__file_close(EvfsFile *fh) {
+  RamfsFile *fil = (RamfsFile *)fh;
+  RamfsData *fs_data = fil->fs_data;
+
+  if(!fil->node) return EVFS_OK;
+
+  evfs__lock(&fs_data->lock);
+  ramfs__node_release(fs_data, fil->node);
+  evfs__unlock(&fs_data->lock);
+
+  fil->node = NULL;
+  return EVFS_OK;
+}
+
+static ptrdiff_t ramfs__file_read_at(EvfsFile *fh, void *buf, size_t size, evfs_off_t offset) {
+  RamfsFile *fil = (RamfsFile *)fh;
+  RamfsData *fs_data = fil->fs_data;
+  RamNode *node = fil->node;
+
+  if(!node) return EVFS_ERR_NOT_OPEN;
+
+  evfs__lock(&fs_data->lock);
+
+  evfs_off_t remaining = node->size - offset;
+  if(remaining <= 0) {
+    size = 0;
+  } else {
+    if((evfs_off_t)size > remaining)
+      size = remaining;
+
+    ramfs__transfer(node, &fil->cursor, offset, buf, size, /*write*/ false);
+  }
+
+  evfs__unlock(&fs_data->lock);
+  return size;
+}
+
+static ptrdiff_t ramfs__file_read(EvfsFile *fh, void *buf, size_t size) {
+  RamfsFile *fil = (RamfsFile *)fh;
+
+  ptrdiff_t rval = ramfs__file_read_at(fh, buf, size, fil->pos);
+  if(rval > 0)
+    fil->pos += rval;
+
+  return rval;
+}
+
+static ptrdiff_t ramfs__file_write_at(EvfsFile *fh, const void *buf, size_t size, evfs_off_t offset) {
+  RamfsFile *fil = (RamfsFile *)fh;
+  RamfsData *fs_data = fil->fs_data;
+  RamNode *node = fil->node;
+
+  if(!node) return EVFS_ERR_NOT_OPEN;
+  if(!fil->writable) return EVFS_ERR_DISABLED;
+
+  evfs__lock(&fs_data->lock);
+
+  evfs_off_t end = offset + size;
+  int status = ramfs__reserve(fs_data, node, end);
+  if(status == EVFS_OK) {
+    ramfs__transfer(node, &fil->cursor, offset, (uint8_t *)buf, size, /*write*/ true);
+    if(end > node->size)
+      node->size = end;
+    node->mtime = time(NULL);
+  }
+
+  evfs__unlock(&fs_data->lock);
+  return status == EVFS_OK ? (ptrdiff_t)size : status;
+}
+
+static ptrdiff_t ramfs__file_write(EvfsFile *fh, const void *buf, size_t size) {
+  RamfsFile *fil = (RamfsFile *)fh;
+
+  if(fil->append && fil->node)
+    fil->pos = fil->node->size;
+
+  ptrdiff_t rval = ramfs__file_write_at(fh, buf, size, fil->pos);
+  if(rval > 0)
+    fil->pos += rval;
+
+  return rval;
+}
+
+static int ramfs__file_truncate(EvfsFile *fh, evfs_off_t size) {
+  RamfsFile *fil = (RamfsFile *)fh;
+  RamfsData *fs_data = fil->fs_data;
+
+  if(!fil->node) return EVFS_ERR_NOT_OPEN;
+  if(!fil->writable) return EVFS_ERR_DISABLED;
+  if(size < 0) return EVFS_ERR_INVALID;
+
+  evfs__lock(&fs_data->lock);
+  int status = ramfs__truncate(fs_data, fil->node, size);
+  if(status == EVFS_OK)
+    fil->node->mtime = time(NULL);
+  evfs__unlock(&fs_data->lock);
+
+  return status;
+}
+
+static int ramfs__file_sync(EvfsFile *fh) {
+  return EVFS_OK;
+}
+
+static evfs_off_t ramfs__file_size(EvfsFile *fh) {
+  RamfsFile *fil = (RamfsFile *)fh;
+
+  if(!fil->node)
+    return 0;
+  else
+    return fil->node->size;
+}
+
+static int ramfs__file_seek(EvfsFile *fh, evfs_off_t offset, EvfsSeekDir origin) {
+  RamfsFile *fil = (RamfsFile *)fh;
+
+  if(!fil->node) return EVFS_ERR_NOT_OPEN;
+
+  offset = evfs__absolute_offset(fh, offset, origin);
+
+  if(ASSERT(offset >= 0, "Invalid offset")) return EVFS_ERR;
+
+  fil->pos = offset; // Writes past the end fill the gap with zeros
+
+  return EVFS_OK;
+}
+
+static evfs_off_t ramfs__file_tell(EvfsFile *fh) {
+  RamfsFile *fil = (RamfsFile *)fh;
+  if(!fil->node)
+    return 0;
+  else
+    return fil->pos;
+}
+
+static bool ramfs__file_eof(EvfsFile *fh) {
+  RamfsFile *fil = (RamfsFile *)fh;
+  if(!fil->node)
+    return true;
+  else
+    return fil->pos >= fil->node->size;
+}
+
+static int ramfs__file_map(EvfsFile *fh, evfs_off_t offset, size_t size, EvfsMapping *map) {
+  RamfsFile *fil = (RamfsFile *)fh;
+  RamfsData *fs_data = fil->fs_data;
+  RamNode *node = fil->node;
+
+  if(!node) return EVFS_ERR_NOT_OPEN;
+
+  int status = EVFS_OK;
+  evfs__lock(&fs_data->lock);
+
+  if(offset > node->size) {
+    status = EVFS_ERR_OVERFLOW;
+    goto cleanup;
+  }
+
+  evfs_off_t remaining = node->size - offset;
+  if(remaining == 0) goto cleanup; // Empty mapping
+
+  if(size == 0 || (evfs_off_t)size > remaining)
+    size = remaining;
+
+  evfs_off_t pos;
+  RamChunk *chunk = ramfs__seek_chunk(node, &fil->cursor, offset, &pos);
+
+  if(offset + (evfs_off_t)size > pos + (evfs_off_t)chunk->size) { // Range spans chunks
+    // Existing mappings would be left pointing at freed chunks
+    if(node->map_count > 0) {
+      status = EVFS_ERR_BUSY;
+      goto cleanup;
+    }
+
+    status = ramfs__coalesce(fs_data, node);
+    if(status != EVFS_OK) goto cleanup;
+
+    chunk = node->chunks;
+    pos = 0;
+  }
+
+  map->data = &chunk->data[offset - pos];
+  map->size = size;
+  node->map_count++;
+
+cleanup:
+  evfs__unlock(&fs_data->lock);
+  return status;
+}
+
+static int ramfs__file_unmap(EvfsFile *fh, EvfsMapping *map) {
+  RamfsFile *fil = (RamfsFile *)fh;
+  RamfsData *fs_data = fil->fs_data;
+
+  if(!fil->node) return EVFS_ERR_NOT_OPEN;
+
+  evfs__lock(&fs_data->lock);
+  if(fil->node->map_count > 0)
+    fil->node->map_count--;
+  evfs__unlock(&fs_data->lock);
+
+  return EVFS_OK;
+}
+
+
+static EvfsFileMethods s_ramfs_methods = {
+  .m_ctrl     = ramfs__file_ctrl,
+  .m_close    = ramfs__file_close,
+  .m_read     = ramfs__file_read,
+  .m_write    = ramfs__file_write,
+  .m_truncate = ramfs__file_truncate,
+  .m_sync     = ramfs__file_sync,
+  .m_size     = ramfs__file_size,
+  .m_seek     = ramfs__file_seek,
+  .m_tell     = ramfs__file_tell,
+  .m_eof      = ramfs__file_eof,
+  .m_read_at  = ramfs__file_read_at,
+  .m_write_at = ramfs__file_write_at,
+  .m_map      = ramfs__file_map,
+  .m_unmap    = ramfs__file_unmap
+};
+
+
+
+// ******************** Directory access methods ********************
+
+static int ramfs__dir_close(EvfsDir *dh) {
+  RamfsDir *dir = (RamfsDir *)dh;
+  RamfsData *fs_data = dir->fs_data;
+
+  if(!dir->node) return EVFS_OK;
+
+  evfs__lock(&fs_data->lock);
+  ramfs__node_release(fs_data, dir->node);
+  evfs__unlock(&fs_data->lock);
+
+  dir->node = NULL;
+  return EVFS_OK;
+}
+
+
+static int ramfs__dir_read(EvfsDir *dh, EvfsInfo *info) {
+  RamfsDir *dir = (RamfsDir *)dh;
+  RamfsData *fs_data = dir->fs_data;
+
+  memset(info, 0, sizeof(*info));
+
+  if(!dir->node) return EVFS_DONE;
+
+  evfs__lock(&fs_data->lock);
+
+  RamNode *entry = dir->next_entry;
+  if(dir->dir_gen != dir->node->dir_gen) { // Entries changed since the last read
+    entry = dir->node->children;
+    for(size_t i = 0; i < dir->pos && entry; i++) {
+      entry = entry->next;
+    }
+  }
+
+  int status = EVFS_DONE;
+  if(entry) {
+    memcpy(dir->name, NODE_NAME(entry), entry->key_len - sizeof(RamNode *) + 1);
+    info->name = dir->name;
+    info->mtime = entry->mtime;
+    if(entry->is_dir)
+      info->type |= EVFS_FILE_DIR;
+    else
+      info->size = entry->size;
+
+    dir->next_entry = entry->next;
+    dir->pos++;
+    status = EVFS_OK;
+  } else {
+    dir->next_entry = NULL;
+  }
+  dir->dir_gen = dir->node->dir_gen;
+
+  evfs__unlock(&fs_data->lock);
+  return status;
+}
+
+
+static int ramfs__dir_rewind(EvfsDir *dh) {
+  RamfsDir *dir = (RamfsDir *)dh;
+  RamfsData *fs_data = dir->fs_data;
+
+  if(!dir->node) return EVFS_OK;
+
+  evfs__lock(&fs_data->lock);
+  dir->next_entry = dir->node->children;
+  dir->dir_gen = dir->node->dir_gen;
+  dir->pos = 0;
+  evfs__unlock(&fs_data->lock);
+
+  return EVFS_OK;
+}
+
+
+static EvfsDirMethods s_ramfs_dir_methods = {
+  .m_close    = ramfs__dir_close,
+  .m_read     = ramfs__dir_read,
+  .m_rewind   = ramfs__dir_rewind
+};
+
+
+
+// ******************** FS access methods ********************
+
+static int ramfs__open(Evfs *vfs, const char *path, EvfsFile *fh, int flags) {
+  RamfsData *fs_data = (RamfsData *)vfs->fs_data;
+  RamfsFile *fil = (RamfsFile *)fh;
+  RamNode *parent;
+  const char *name;
+  size_t name_len;
+
+  memset(fil, 0, sizeof(*fil));
+  fh->methods = &s_ramfs_methods;
+  fil->fs_data = fs_data;
+
+  MAKE_ABS(path, abs_path);
+  evfs__lock(&fs_data->lock);
+
+  RamNode *node = NULL;
+  int status = ramfs__find_parent(fs_data, abs_path, &parent, &name, &name_len);
+  if(status != EVFS_OK) goto cleanup;
+
+  node = name_len > 0 ? ramfs__find_child(fs_data, parent, name, name_len) : parent;
+
+  if(node) {
+    if(flags & EVFS_NO_EXIST)
+      status = EVFS_ERR_EXISTS;
+    else if(node->is_dir)
+      status = EVFS_ERR_IS_DIR;
+    else if(flags & EVFS_OVERWRITE)
+      status = ramfs__truncate(fs_data, node, 0);
+
+  } else if(flags & (EVFS_OPEN_OR_NEW | EVFS_NO_EXIST | EVFS_OVERWRITE)) {
+    status = ramfs__node_new(fs_data, parent, name, name_len, /*is_dir*/ false, &node);
+
+  } else {
+    status = EVFS_ERR_NO_FILE;
+  }
+
+  if(status == EVFS_OK) {
+    node->open_count++;
+    fil->node = node;
+    fil->writable = flags & (EVFS_WRITE | EVFS_APPEND);
+    fil->append = flags & EVFS_APPEND;
+  }
+
+cleanup:
+  evfs__unlock(&fs_data->lock);
+  FREE_ABS(abs_path);
+  return status;
+}
+
+
+static int ramfs__stat(Evfs *vfs, const char *path, EvfsInfo *info) {
+  RamfsData *fs_data = (RamfsData *)vfs->fs_data;
+
+  memset(info, 0, sizeof(*info));
+
+  MAKE_ABS(path, abs_path);
+  evfs__lock(&fs_data->lock);
+
+  int status = EVFS_OK;
+  RamNode *node = ramfs__find_node(fs_data, abs_path);
+  if(node) {
+    info->mtime = node->mtime;
+    if(node->is_dir)
+      info->type |= EVFS_FILE_DIR;
+    else
+      info->size = node->size;
+  } else {
+    status = EVFS_ERR_NO_FILE;
+  }
+
+  evfs__unlock(&fs_data->lock);
+  FREE_ABS(abs_path);
+  return status;
+}
+
+
+static int ramfs__delete(Evfs *vfs, const char *path) {
+  RamfsData *fs_data = (RamfsData *)vfs->fs_data;
+
+  MAKE_ABS(path, abs_path);
+  evfs__lock(&fs_data->lock);
+
+  int status = EVFS_OK;
+  RamNode *node = ramfs__find_node(fs_data, abs_path);
+  if(!node)
+    status = EVFS_ERR_NO_FILE;
+  else if(node == &fs_data->root)
+    status = EVFS_ERR_INVALID;
+  else if(node->children)
+    status = EVFS_ERR_NOT_EMPTY;
+  else
+    ramfs__node_unlink(fs_data, node);
+
+  evfs__unlock(&fs_data->lock);
+  FREE_ABS(abs_path);
+  return status;
+}
+
+
+static int ramfs__rename(Evfs *vfs, const char *old_path, const char *new_path) {
+  RamfsData *fs_data = (RamfsData *)vfs->fs_data;
+  RamNode *parent;
+  const char *name;
+  size_t name_len;
+  uint8_t *new_key = NULL;
+
+  MAKE_ABS(old_path, abs_old);
+  EvfsAbsPath abs_new_r;
+  int status = evfs__path_resolve(vfs, new_path, &abs_new_r);
+  if(status != EVFS_OK) {
+    FREE_ABS(abs_old);
+    return status;
+  }
+
+  evfs__lock(&fs_data->lock);
+
+  RamNode *node = ramfs__find_node(fs_data, abs_old);
+  if(!node) {
+    status = EVFS_ERR_NO_FILE;
+    goto cleanup;
+  }
+
+  status = ramfs__find_parent(fs_data, abs_new_r.path, &parent, &name, &name_len);
+  if(status != EVFS_OK) goto cleanup;
+
+  if(node == &fs_data->root || name_len == 0) {
+    status = EVFS_ERR_INVALID;
+    goto cleanup;
+  }
+
+  if(name_len > RAMFS_MAX_NAME) {
+    status = EVFS_ERR_TOO_LONG;
+    goto cleanup;
+  }
+
+  // Directories can't move beneath themselves
+  for(RamNode *p = parent; p; p = p->parent) {
+    if(p == node) {
+      status = EVFS_ERR_INVALID;
+      goto cleanup;
+    }
+  }
+
+  RamNode *existing = ramfs__find_child(fs_data, parent, name, name_len);
+  if(existing == node) goto cleanup; // Same path
+
+  if(existing) { // Only a file replaces a file
+    if(existing->is_dir || node->is_dir) {
+      status = EVFS_ERR_EXISTS;
+      goto cleanup;
+    }
+  }
+
+  size_t new_key_len = sizeof parent + name_len;
+  new_key = evfs_alloc_with(fs_data->alloc, EVFS_ALLOC_INDEX, new_key_len + 1);
+  if(MEM_CHECK(new_key)) {
+    status = EVFS_ERR_ALLOC;
+    goto cleanup;
+  }
+
+  ramfs__child_key(new_key, parent, name, name_len);
+  new_key[new_key_len] = '\0';
+
+  if(existing)
+    ramfs__node_unlink(fs_data, existing);
+
+  dhKey key = {.data = new_key, .length = new_key_len};
+  RamNode *value = node;
+  if(!dh_insert(&fs_data->nodes, key, &value)) {
+    evfs_free_with(fs_data->alloc, EVFS_ALLOC_INDEX, new_key);
+    status = EVFS_ERR_ALLOC;
+    goto cleanup;
+  }
+
+  RamNode *removed;
+  key.data = node->key;
+  key.length = node->key_len;
+  dh_remove(&fs_data->nodes, key, &removed);
+  evfs_free_with(fs_data->alloc, EVFS_ALLOC_INDEX, node->key);
+
+  node->key = new_key;
+  node->key_len = new_key_len;
+
+  // Move to the end of the new parent's entries
+  ramfs__node_detach(node);
+  node->parent = parent;
+  node->prev = parent->children_tail;
+  if(parent->children_tail)
+    parent->children_tail->next = node;
+  else
+    parent->children = node;
+  parent->children_tail = node;
+  parent->dir_gen++;
+  parent->mtime = time(NULL);
+
+cleanup:
+  evfs__unlock(&fs_data->lock);
+  evfs__path_release(&abs_new_r);
+  FREE_ABS(abs_old);
+  return status;
+}
+
+
+static int ramfs__make_dir(Evfs *vfs, const char *path) {
+  RamfsData *fs_data = (RamfsData *)vfs->fs_data;
+  RamNode *parent;
+  const char *name;
+  size_t name_len;
+
+  MAKE_ABS(path, abs_path);
+  evfs__lock(&fs_data->lock);
+
+  int status = ramfs__find_parent(fs_data, abs_path, &parent, &name, &name_len);
+  if(status == EVFS_OK) {
+    RamNode *node = name_len > 0 ? ramfs__find_child(fs_data, parent, name, name_len) : parent;
+    if(node)
+      status = EVFS_ERR_EXISTS;
+    else
+      status = ramfs__node_new(fs_data, parent, name, name_len, /*is_dir*/ true, &node);
+  }
+
+  evfs__unlock(&fs_data->lock);
+  FREE_ABS(abs_path);
+  return status;
+}
+
+
+static int ramfs__open_dir(Evfs *vfs, const char *path, EvfsDir *dh) {
+  RamfsData *fs_data = (RamfsData *)vfs->fs_data;
+  RamfsDir *dir = (RamfsDir *)dh;
+
+  memset(dir, 0, sizeof(*dir));
+  dh->methods = &s_ramfs_dir_methods;
+  dir->fs_data = fs_data;
+
+  MAKE_ABS(path, abs_path);
+  evfs__lock(&fs_data->lock);
+
+  int status = EVFS_OK;
+  RamNode *node = ramfs__find_node(fs_data, abs_path);
+  if(!node || !node->is_dir) {
+    status = EVFS_ERR_NO_PATH;
+  } else {
+    node->open_count++;
+    dir->node = node;
+    dir->next_entry = node->children;
+    dir->dir_gen = node->dir_gen;
+  }
+
+  evfs__unlock(&fs_data->lock);
+  FREE_ABS(abs_path);
+  return status;
+}
+
+
+// Ramfs doesn't handle relative paths so we track the current directory in fs_data
+static int ramfs__get_cur_dir(Evfs *vfs, StringRange *cur_dir) {
+  RamfsData *fs_data = (RamfsData *)vfs->fs_data;
+  AppendRange r = *(AppendRange *)cur_dir;
+
+  evfs__lock(&fs_data->lock);
+  range_cat_str(&r, fs_data->cur_dir);
+  evfs__unlock(&fs_data->lock);
+  range_terminate(&r);
+  return EVFS_OK;
+}
+
+
+static int ramfs__set_cur_dir(Evfs *vfs, const char *path) {
+  RamfsData *fs_data = (RamfsData *)vfs->fs_data;
+
+  MAKE_ABS(path, abs_path);
+
+  // Confirm the path exists
+  int status = EVFS_OK;
+  if(evfs__vfs_existing_dir(vfs, abs_path)) {
+    evfs__lock(&fs_data->lock);
+    strncpy(fs_data->cur_dir, abs_path, EVFS_MAX_PATH-1);
+    fs_data->cur_dir[EVFS_MAX_PATH-1] = '\0';
+    evfs__unlock(&fs_data->lock);
+  } else {
+    status = EVFS_ERR_NO_PATH;
+  }
+
+  FREE_ABS(abs_path);
+  return status;
+}
+
+
+static int ramfs__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
+  RamfsData *fs_data = (RamfsData *)vfs->fs_data;
+
+  switch(cmd) {
+    case EVFS_CMD_UNREGISTER:
+      ramfs__free_all(fs_data);
+      evfs__lock_destroy(&fs_data->lock);
+      evfs_free(vfs);
+      return EVFS_OK; break;
+
+    case EVFS_CMD_GET_STAT_FIELDS:
+    case EVFS_CMD_GET_DIR_FIELDS:
+      {
+        unsigned *v = (unsigned *)arg;
+        *v = EVFS_INFO_SIZE | EVFS_INFO_MTIME | EVFS_INFO_TYPE;
+      }
+      return EVFS_OK; break;
+
+    default: return EVFS_ERR_NO_SUPPORT; break;
+  }
+}
+
+
+
+/*
+Register a RAM FS instance
+
+Args:
+  vfs_name:      Name of new VFS
+  cfg:           Optional configuration settings. NULL for defaults
+  default_vfs:   Make this the default VFS when true
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_register_ramfs(const char *vfs_name, const RamfsConfig *cfg, bool default_vfs) {
+  Evfs *new_vfs;
+  RamfsData *fs_data;
+
+  if(PTR_CHECK(vfs_name)) return EVFS_ERR_BAD_ARG;
+
+  // Construct a new VFS
+  // We have three objects allocated together [Evfs][RamfsData][char[]]
+  size_t alloc_size = sizeof(*new_vfs) + sizeof(*fs_data) + strlen(vfs_name)+1;
+  new_vfs = evfs_malloc(alloc_size);
+  if(MEM_CHECK(new_vfs)) return EVFS_ERR_ALLOC;
+  memset(new_vfs, 0, alloc_size);
+
+  // Prepare new objects
+  fs_data = (RamfsData *)NEXT_OBJ(new_vfs);
+
+  new_vfs->vfs_name = (char *)NEXT_OBJ(fs_data);
+  strcpy((char *)new_vfs->vfs_name, vfs_name);
+
+  // Init FS data
+  if(cfg) {
+    fs_data->chunk_size = cfg->chunk_size;
+    fs_data->max_size = cfg->max_size;
+    fs_data->alloc = cfg->alloc;
+  }
+
+  if(fs_data->chunk_size == 0)
+    fs_data->chunk_size = DEFAULT_CHUNK_SIZE;
+
+  fs_data->root.is_dir = true;
+  fs_data->root.mtime = time(NULL);
+  fs_data->root.key = fs_data->root_key;
+  fs_data->root.key_len = sizeof(RamNode *);
+
+  strncpy(fs_data->cur_dir, "/", 2); // Start in root dir
+
+  if(!ramfs__index_init(fs_data)) {
+    evfs_free(new_vfs);
+    THROW(EVFS_ERR_ALLOC);
+  }
+
+  if(evfs__lock_init(&fs_data->lock) != EVFS_OK) {
+    dh_free(&fs_data->nodes);
+    evfs_free(new_vfs);
+    THROW(EVFS_ERR_INIT);
+  }
+
+  // Init VFS
+  new_vfs->vfs_file_size = sizeof(RamfsFile);
+  new_vfs->vfs_dir_size = sizeof(RamfsDir);
+  new_vfs->fs_data = fs_data;
+
+  // Required methods
+  new_vfs->m_open = ramfs__open;
+  new_vfs->m_stat = ramfs__stat;
+
+  // Optional methods
+  new_vfs->m_delete = ramfs__delete;
+  new_vfs->m_rename = ramfs__rename;
+  new_vfs->m_make_dir = ramfs__make_dir;
+  new_vfs->m_open_dir = ramfs__open_dir;
+  new_vfs->m_get_cur_dir = ramfs__get_cur_dir;
+  new_vfs->m_set_cur_dir = ramfs__set_cur_dir;
+  new_vfs->m_vfs_ctrl = ramfs__vfs_ctrl;
+
+  return evfs_register(new_vfs, default_vfs);
+}
+
+
+
+// ******************** Snapshots ********************
+
+typedef struct RamfsCopyCtx {
+  const char *src_vfs;
+  const char *dest_dir;
+  const char *dest_vfs;
+  size_t      root_len;
+  bool        replace;  // Delete existing files before copying
+  char        dest_path[EVFS_MAX_PATH];
+} RamfsCopyCtx;
+
+
+static int ramfs__copy_entry(const char *path, const EvfsInfo *info, unsigned depth, void *ctx) {
+  RamfsCopyCtx *cc = (RamfsCopyCtx *)ctx;
+
+  // Paths are relative to the root of the walk
+  const char *rel_path = &path[cc->root_len];
+  while(*rel_path == '/' || *rel_path == '\\') {
+    rel_path++;
+  }
+
+  StringRange dest_r;
+  range_init(&dest_r, cc->dest_path, sizeof cc->dest_path);
+  int status = evfs_path_join_str_ex(cc->dest_dir, rel_path, &dest_r, cc->dest_vfs);
+  if(status != EVFS_OK) return status;
+
+  if(info->type & EVFS_FILE_DIR) {
+    status = evfs_make_dir_ex(cc->dest_path, cc->dest_vfs);
+    return status == EVFS_ERR_EXISTS ? EVFS_OK : status;
+  }
+
+  EvfsFile *fh;
+  status = evfs_open_ex(path, &fh, EVFS_READ, cc->src_vfs);
+  if(status != EVFS_OK) return status;
+
+  if(cc->replace)
+    evfs_delete_ex(cc->dest_path, cc->dest_vfs);
+
+  status = evfs_copy_to_file_ex(cc->dest_path, fh, NULL, 0, cc->dest_vfs);
+  evfs_file_close(fh);
+
+  return status;
+}
+
+
+static int ramfs__copy_tree(const char *src_dir, const char *src_vfs, const char *dest_dir,
+                            const char *dest_vfs, bool replace) {
+  RamfsCopyCtx cc = {
+    .src_vfs  = src_vfs,
+    .dest_dir = dest_dir,
+    .dest_vfs = dest_vfs,
+    .root_len = strlen(src_dir),
+    .replace  = replace
+  };
+
+  int status = evfs_make_path_ex(dest_dir, dest_vfs);
+  if(status != EVFS_OK) return status;
+
+  EvfsWalkConfig walk_cfg = {
+    .pre_visit = ramfs__copy_entry,
+    .max_depth = -1,
+    .ctx       = &cc
+  };
+
+  return evfs_walk_ex(src_dir, &walk_cfg, src_vfs);
+}
+
+
+/*
+Copy a directory tree into a RAM FS
+
+This can restore a snapshot from any VFS such as a mounted tar or Romfs
+image. Existing files with the same path are replaced.
+
+Args:
+  vfs_name:  Name of a registered RAM FS
+  src_dir:   Directory to copy from
+  src_vfs:   VFS to copy from. Use default VFS if NULL
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_ramfs_load(const char *vfs_name, const char *src_dir, const char *src_vfs) {
+  if(PTR_CHECK(vfs_name) || PTR_CHECK(src_dir)) return EVFS_ERR_BAD_ARG;
+
+  return ramfs__copy_tree(src_dir, src_vfs, "/", vfs_name, /*replace*/ true);
+}
+
+
+/*
+Copy the contents of a RAM FS into a directory
+
+This can snapshot the filesystem into another VFS such as a writable tar
+mount. Use romfs_build_image() with the RAM FS as its source VFS to make a
+Romfs snapshot.
+
+Args:
+  vfs_name:  Name of a registered RAM FS
+  dest_dir:  Directory to copy into. Created if it doesn't exist.
+  dest_vfs:  VFS to copy into. Use default VFS if NULL
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_ramfs_save(const char *vfs_name, const char *dest_dir, const char *dest_vfs) {
+  if(PTR_CHECK(vfs_name) || PTR_CHECK(dest_dir)) return EVFS_ERR_BAD_ARG;
+
+  return ramfs__copy_tree("/", vfs_name, dest_dir, dest_vfs, /*replace*/ false);
+}
@@ -6,9 +6,14 @@
 #include "evfs.h"
 #include "evfs_internal.h"
 #include "evfs/util/unaligned_access.h"
+#include "evfs/util/checksum.h"
 
 #ifdef EVFS_USE_ROMFS_FAST_INDEX
-#  include "evfs/util/dhash.h"
+#  ifdef EVFS_USE_PERFECT_HASH_INDEX
+#    include "evfs/util/mphash.h"
+#  else
+#    include "evfs/util/dhash.h"
+#  endif
 #endif
 
 #include "evfs/romfs_common.h"
@@ -24,8 +29,50 @@ static inline int file_header_len(RomfsFileHead *hdr) {
 }
 
 
+#if EVFS_ROMFS_HEADER_CACHE_SIZE > 0
+// Headers are 16-byte aligned so consecutive entries land in different slots
+#  define HDR_CACHE_SLOT(fs, pos)  (&(fs)->hdr_cache[((pos) >> 4) % EVFS_ROMFS_HEADER_CACHE_SIZE])
+
+#  ifdef EVFS_USE_THREADING
+#    define HDR_CACHE_LOCK(fs)    evfs__lock(&(fs)->hdr_cache_lock)
+#    define HDR_CACHE_UNLOCK(fs)  evfs__unlock(&(fs)->hdr_cache_lock)
+#  else
+#    define HDR_CACHE_LOCK(fs)
+#    define HDR_CACHE_UNLOCK(fs)
+#  endif
+
+static bool romfs__hdr_cache_get(Romfs *fs, long hdr_pos, RomfsFileHead *hdr) {
+  RomfsHeaderCacheEntry *entry = HDR_CACHE_SLOT(fs, hdr_pos);
+  bool found = false;
+
+  HDR_CACHE_LOCK(fs);
+  if(entry->pos == hdr_pos) {
+    memcpy(hdr, &entry->hdr, sizeof(*hdr));
+    found = true;
+  }
+  HDR_CACHE_UNLOCK(fs);
+
+  return found;
+}
+
+static void romfs__hdr_cache_put(Romfs *fs, long hdr_pos, RomfsFileHead *hdr) {
+  RomfsHeaderCacheEntry *entry = HDR_CACHE_SLOT(fs, hdr_pos);
+
+  HDR_CACHE_LOCK(fs);
+  entry->pos = hdr_pos;
+  memcpy(&entry->hdr, hdr, sizeof(*hdr));
+  HDR_CACHE_UNLOCK(fs);
+}
+#endif
+
+
 // Read Romfs file header from image
 bool romfs_read_file_header(Romfs *fs, long hdr_pos, RomfsFileHead *hdr) {
+#if EVFS_ROMFS_HEADER_CACHE_SIZE > 0
+  if(romfs__hdr_cache_get(fs, hdr_pos, hdr))
+    return true;
+#endif
+
   memset(hdr, 0, sizeof(*hdr));
 
   ptrdiff_t buf_len = romfs_read(fs, hdr_pos, hdr, sizeof(*hdr));
@@ -34,22 +81,65 @@ bool romfs_read_file_header(Romfs *fs, long hdr_pos, RomfsFileHead *hdr) {
 
   int header_len = file_header_len(hdr);
 
-  // Verify checksum
-  int32_t checksum = 0;
-  for(int i = 0; i < header_len / 4; i++) {
-    checksum += get_unaligned_be(&((uint32_t *)hdr)[i]);
+#ifdef EVFS_USE_ROMFS_TRUSTED_HEADERS
+  if(!fs->trusted)
+#endif
+  {
+    // Verify checksum
+    if(sum32_be(0, hdr, header_len / 4) != 0)
+      return false;
   }
 
-  if(checksum != 0)
-    return false;
-
   hdr->offset       = get_unaligned_be(&hdr->offset);
   hdr->spec_info    = get_unaligned_be(&hdr->spec_info);
   hdr->size         = get_unaligned_be(&hdr->size);
   hdr->header_len   = header_len; // Overwrite checksum
 
+#if EVFS_ROMFS_HEADER_CACHE_SIZE > 0
+  romfs__hdr_cache_put(fs, hdr_pos, hdr);
+#endif
+
+  return true;
+}
+
+#ifdef EVFS_USE_ROMFS_TRUSTED_HEADERS
+// Verify the checksum of every header reachable from a directory
+static bool romfs__verify_dir_tree(Romfs *fs, evfs_off_t cur_hdr) {
+  RomfsFileHead hdr;
+
+  while(cur_hdr != 0) {
+    if(!romfs_read_file_header(fs, cur_hdr, &hdr))
+      return false;
+
+    if(FILE_TYPE(&hdr) == FILE_TYPE_DIRECTORY && strcmp(hdr.file_name, ".") != 0 &&
+       strcmp(hdr.file_name, "..") != 0) {
+      // Directory contents always follow their header. Anything else is a loop.
+      if((evfs_off_t)hdr.spec_info <= cur_hdr || !romfs__verify_dir_tree(fs, hdr.spec_info))
+        return false;
+    }
+
+    evfs_off_t next_hdr = FILE_OFFSET(&hdr);
+    if(next_hdr != 0 && next_hdr <= cur_hdr)
+      return false;
+    cur_hdr = next_hdr;
+  }
+
   return true;
 }
+#endif
+
+
+#ifdef EVFS_USE_ROMFS_SORTED_DIRS
+static bool romfs__name_after(const char *name, StringRange *element) {
+  if(!strcmp(name, ".") || !strcmp(name, ".."))
+    return false;
+
+  size_t elem_len = range_size(element);
+  int cmp = strncmp(name, element->start, elem_len);
+  return cmp > 0 || (cmp == 0 && name[elem_len] != '\0');
+}
+#endif
+
 
 // Scan a directory for file from a path
 static bool romfs__find_path_elem(Romfs *fs, evfs_off_t dir_pos, StringRange *element, RomfsFileHead *hdr) {
@@ -64,6 +154,12 @@ static bool romfs__find_path_elem(Romfs *fs, evfs_off_t dir_pos, StringRange *el
       return true;
     }
 
+#ifdef EVFS_USE_ROMFS_SORTED_DIRS
+    // Names after the "." and ".." links are in order. Stop once we've passed the element.
+    if(romfs__name_after(hdr->file_name, element))
+      break;
+#endif
+
     cur_hdr = FILE_OFFSET(hdr);
   }
 
@@ -71,6 +167,23 @@ static bool romfs__find_path_elem(Romfs *fs, evfs_off_t dir_pos, StringRange *el
 }
 
 #ifdef EVFS_USE_ROMFS_FAST_INDEX
+// Dhash copies values in whole words so the buffers passed to it must be padded
+typedef union {
+  evfs_off_t  offset;
+  uintptr_t   pad;
+} RomfsIndexValue;
+
+#  ifdef EVFS_USE_PERFECT_HASH_INDEX
+#    define romfs__index_insert(ht, key, entry)   mph_add(&(ht)->hash_table, (key), (entry))
+#    define romfs__index_finish(ht)               mph_build(&(ht)->hash_table)
+#    define romfs__index_lookup(ht, key, entry)   mph_lookup(&(ht)->hash_table, (key), (entry))
+#  else
+#    define romfs__index_insert(ht, key, entry)   dh_insert(&(ht)->hash_table, (key), (entry))
+#    define romfs__index_finish(ht)               true
+#    define romfs__index_lookup(ht, key, entry)   dh_lookup(&(ht)->hash_table, (key), (entry))
+#  endif
+
+#  ifndef ROMFS_USE_LAZY_INDEX
 // Fast path lookups using a hash table
 static int romfs__fast_lookup_abs_path(Romfs *fs, const char *path, RomfsFileHead *hdr) {
   int status;
@@ -80,11 +193,11 @@ static int romfs__fast_lookup_abs_path(Romfs *fs, const char *path, RomfsFileHea
   key.data = &path[1]; // Skip leading '/'
   key.length = strlen(key.data);
 
-  alignas(uintptr_t) evfs_off_t entry;
-  if(dh_lookup(&fs->fast_index.hash_table, key, &entry)) {
-    romfs_read_file_header(fs, entry, hdr);
+  RomfsIndexValue entry;
+  if(romfs__index_lookup(&fs->fast_index, key, &entry)) {
+    romfs_read_file_header(fs, entry.offset, hdr);
     //DPRINT("## FAST LOOKUP: @ %08X %08X %s -> '%s'", entry, FILE_OFFSET(hdr), path, hdr->file_name);
-    hdr->offset = entry | FILE_MODE(hdr); // Replace with offset of the element
+    hdr->offset = entry.offset | FILE_MODE(hdr); // Replace with offset of the element
     status = EVFS_OK;
   } else {
     status = EVFS_ERR_NO_PATH;
@@ -92,6 +205,7 @@ static int romfs__fast_lookup_abs_path(Romfs *fs, const char *path, RomfsFileHea
 
   return status;
 }
+#  endif // ROMFS_USE_LAZY_INDEX
 #endif
 
 
@@ -193,13 +307,10 @@ static int romfs__validate(Romfs *fs) {
       return EVFS_ERR_INVALID;
 
     // Iterate over chunks to verify checksum
-    int32_t checksum = 0;
+    uint32_t checksum = 0;
 
     for(int c = 0; c < SUPERBLOCK_LEN / CHUNK_LEN; c++) {
-      buf_len /= 4;
-      for(int i = 0; i < buf_len; i++) {
-        checksum += get_unaligned_be(&buf[i]);
-      }
+      checksum = sum32_be(checksum, buf, buf_len / 4);
 
       buf_len = romfs_read(fs, chunk_pos, buf, 4*COUNT_OF(buf));
       chunk_pos += CHUNK_LEN;
@@ -217,6 +328,13 @@ static int romfs__validate(Romfs *fs) {
 
       // Root dir starts at first file header
       fs->root_dir = (16 + strnlen(vol_name, EVFS_ROMFS_MAX_NAME_LEN-1)+1 + 15) & ~0xF;
+
+#ifdef EVFS_USE_ROMFS_TRUSTED_HEADERS
+      // Checksums are skipped after every header has been checked once
+      if(!romfs__verify_dir_tree(fs, fs->root_dir))
+        return EVFS_ERR_CORRUPTION;
+      fs->trusted = true;
+#endif
       return EVFS_OK;
     }
   }
@@ -229,14 +347,47 @@ static int romfs__validate(Romfs *fs) {
 
 #ifdef EVFS_USE_ROMFS_FAST_INDEX
 
+#  ifdef EVFS_USE_PERFECT_HASH_INDEX
+static int romfs__fast_index_init(RomfsIndex *ht, int total_files, size_t total_path_len,
+                                  const EvfsIndexStorage *storage) {
+  if(storage) return EVFS_ERR_DISABLED; // The perfect hash allocates while it is built
+
+  mphConfig s_hash_init = {
+    .num_keys     = total_files,
+    .value_size   = sizeof(evfs_off_t),
+
+    .gen_hash     = mph_gen_hash_string,
+    .is_equal     = dh_equal_hash_keys_string
+  };
+
+  ht->keys_alloc = evfs_get_allocator(EVFS_ALLOC_INDEX);
+  ht->keys = evfs_alloc_with(ht->keys_alloc, EVFS_ALLOC_INDEX, total_path_len);
+  if(MEM_CHECK(ht->keys)) return EVFS_ERR_ALLOC;
+
+
+  int err = mph_init(&ht->hash_table, &s_hash_init, NULL) ? EVFS_OK : EVFS_ERR_ALLOC;
+  return err;
+}
+
+
+static void romfs__fast_index_free(RomfsIndex *ht) {
+  mph_free(&ht->hash_table);
+  evfs_free_with(ht->keys_alloc, EVFS_ALLOC_INDEX, ht->keys);
+  ht->keys = NULL;
+}
+
+#  else // Dynamic hash
+
 // Dhash callbacks
 static void destroy_hashed_file(dhKey key, void *value, void *ctx) {
 }
 
 
-static int romfs__fast_index_init(RomfsIndex *ht, int total_files, size_t total_path_len) {
+#    ifndef ROMFS_USE_LAZY_INDEX
+static int romfs__fast_index_init(RomfsIndex *ht, int total_files, size_t total_path_len,
+                                  const EvfsIndexStorage *storage) {
   dhConfig s_hash_init = {
-    .init_buckets = total_files,
+    .init_buckets = 0,  // Presized below
     .value_size   = sizeof(evfs_off_t),
 
     .destroy_item = destroy_hashed_file,
@@ -244,20 +395,43 @@ static int romfs__fast_index_init(RomfsIndex *ht, int total_files, size_t total_
     .is_equal     = dh_equal_hash_keys_string
   };
 
-  ht->keys = evfs_malloc(total_path_len);
-  if(MEM_CHECK(ht->keys)) return EVFS_ERR_ALLOC;
+  ht->keys_alloc = evfs_get_allocator(EVFS_ALLOC_INDEX);
+
+  if(storage) { // Fixed size index in caller buffers
+    if(storage->keys_size < total_path_len) return EVFS_ERR_ALLOC;
+
+    s_hash_init.ext_storage = storage->index;
+    s_hash_init.max_storage = storage->index_size;
+
+    ht->static_storage = true;
+    ht->keys = storage->keys;
+
+  } else {
+    ht->keys = evfs_alloc_with(ht->keys_alloc, EVFS_ALLOC_INDEX, total_path_len);
+    if(MEM_CHECK(ht->keys)) return EVFS_ERR_ALLOC;
+  }
+
+
+  int err = dh_init(&ht->hash_table, &s_hash_init, NULL) ? EVFS_OK : (storage ? EVFS_ERR_ALLOC : EVFS_ERR);
 
+  // Leave room for the load factor so the index never resizes while it is built
+  if(err == EVFS_OK && !dh_reserve_capacity(&ht->hash_table, total_files)) {
+    dh_free(&ht->hash_table);
+    err = EVFS_ERR_ALLOC;
+  }
 
-  int err = dh_init(&ht->hash_table, &s_hash_init, NULL) ? EVFS_OK : EVFS_ERR;
   return err;
 }
 
 
 static void romfs__fast_index_free(RomfsIndex *ht) {
   dh_free(&ht->hash_table);
-  evfs_free(ht->keys);
+  if(!ht->static_storage)
+    evfs_free_with(ht->keys_alloc, EVFS_ALLOC_INDEX, ht->keys);
   ht->keys = NULL;
 }
+#    endif
+#  endif // EVFS_USE_PERFECT_HASH_INDEX
 
 
 
@@ -270,6 +444,18 @@ static int romfs__get_next_file(Romfs *fs, RomfsFileHead *cur_file, evfs_off_t *
 }
 
 
+// Move from a directory header to its first file after the "." and ".." links
+static int romfs__dir_first_file(Romfs *fs, RomfsFileHead *hdr, evfs_off_t *cur_file_offset) {
+  romfs_read_file_header(fs, hdr->spec_info, hdr);
+
+  // Skip hard link entries
+  romfs__get_next_file(fs, hdr, cur_file_offset);
+
+  return romfs__get_next_file(fs, hdr, cur_file_offset);
+}
+
+
+#  ifndef ROMFS_USE_LAZY_INDEX
 static int romfs__get_dir(Romfs *fs, const char *path, RomfsFileHead *hdr,
                                 evfs_off_t *cur_file_offset, evfs_off_t *dir_pos) {
 
@@ -288,15 +474,8 @@ static int romfs__get_dir(Romfs *fs, const char *path, RomfsFileHead *hdr,
     status = EVFS_ERR_NO_PATH;
   }
 
-  if(status == EVFS_OK) {
-    // Get first file in directory
-    romfs_read_file_header(fs, hdr->spec_info, hdr) ? EVFS_OK : EVFS_ERR;
-
-    // Skip hard link entries
-    romfs__get_next_file(fs, hdr, cur_file_offset);
-
-    status = romfs__get_next_file(fs, hdr, cur_file_offset);
-  }
+  if(status == EVFS_OK)
+    status = romfs__dir_first_file(fs, hdr, cur_file_offset);
 
   return status;
 }
@@ -356,9 +535,9 @@ static int index_dir_tree(Romfs *fs, const char *path, size_t prefix_len, RomfsI
   evfs_off_t    cur_file_offset = 0;
   int status;
   dhKey key;
-  alignas(uintptr_t) evfs_off_t entry;
+  RomfsIndexValue entry;
 
-  status = romfs__get_dir(fs, path, &cur_file, &cur_file_offset, &entry);
+  status = romfs__get_dir(fs, path, &cur_file, &cur_file_offset, &entry.offset);
   //DPRINT("INDEX, OPEN DIR: %s %d", path, status);
 
   // Prepare key
@@ -371,7 +550,7 @@ static int index_dir_tree(Romfs *fs, const char *path, size_t prefix_len, RomfsI
     key.length += range_cat_str(keys_r, "");
   range_cat_char(keys_r,'\0');
 
-  if(!dh_insert(&ht->hash_table, key, &entry))
+  if(!romfs__index_insert(ht, key, &entry))
     return EVFS_ERR;
 
   //DPRINT("## INDEX DIR: '%s' @ %08X", key.data, entry);
@@ -410,8 +589,8 @@ static int index_dir_tree(Romfs *fs, const char *path, size_t prefix_len, RomfsI
         key.length += range_cat_str(keys_r, cur_file.file_name);
         range_cat_char(keys_r,'\0');
 
-        entry = cur_file_offset;
-        if(!dh_insert(&ht->hash_table, key, &entry))
+        entry.offset = cur_file_offset;
+        if(!romfs__index_insert(ht, key, &entry))
           return EVFS_ERR;
 
         //DPRINT("## INDEX FIL: %s @ %08X", key.data, entry);
@@ -425,7 +604,7 @@ static int index_dir_tree(Romfs *fs, const char *path, size_t prefix_len, RomfsI
 }
 
 
-static int romfs__build_index(Romfs *fs, RomfsIndex *ht) {
+static int romfs__build_index(Romfs *fs, RomfsIndex *ht, const EvfsIndexStorage *storage) {
   // Scan all files to get total storage for path keys
   int status;
 
@@ -438,12 +617,17 @@ static int romfs__build_index(Romfs *fs, RomfsIndex *ht) {
   total_path_len += 1;
 
   // Prepare the hash index
-  status = romfs__fast_index_init(ht, total_files, total_path_len);
+  ht->num_keys = total_files;
+  ht->keys_size = total_path_len;
+
+  status = romfs__fast_index_init(ht, total_files, total_path_len, storage);
   if(status == EVFS_OK) {
     AppendRange keys_r;
     range_init(&keys_r, ht->keys, total_path_len);
 
     status = index_dir_tree(fs, "", 0, ht, &keys_r);
+    if(status == EVFS_OK && !romfs__index_finish(ht))
+      status = EVFS_ERR;
     //dump_array((uint8_t *)ht->keys, total_path_len);
 
     fs->lookup_abs_path = romfs__fast_lookup_abs_path;
@@ -452,6 +636,206 @@ static int romfs__build_index(Romfs *fs, RomfsIndex *ht) {
   return status;
 }
 
+#  else // ROMFS_USE_LAZY_INDEX
+
+// Each directory is indexed the first time a path below it is resolved.
+// Directory entries are flagged in the unused low bits of their header offset
+// once their children have been added.
+#define ROMFS_DIR_INDEXED     0x01
+#define ROMFS_KEY_CHUNK_SIZE  1024
+
+typedef struct RomfsKeyChunk {
+  struct RomfsKeyChunk *next;
+  size_t  size;
+  size_t  used;
+  char    data[];
+} RomfsKeyChunk;
+
+
+static char *romfs__key_alloc(RomfsIndex *ht, size_t len) {
+  RomfsKeyChunk *chunk = ht->key_chunks;
+
+  if(!chunk || chunk->size - chunk->used < len) {
+    size_t size = len > ROMFS_KEY_CHUNK_SIZE ? len : ROMFS_KEY_CHUNK_SIZE;
+    chunk = evfs_alloc_with(ht->keys_alloc, EVFS_ALLOC_INDEX, sizeof(*chunk) + size);
+    if(MEM_CHECK(chunk)) return NULL;
+
+    chunk->next = ht->key_chunks;
+    chunk->size = size;
+    chunk->used = 0;
+    ht->key_chunks = chunk;
+  }
+
+  char *key = &chunk->data[chunk->used];
+  chunk->used += len;
+  return key;
+}
+
+
+static int romfs__lazy_index_init(Romfs *fs, RomfsIndex *ht) {
+  dhConfig s_hash_init = {
+    .init_buckets = 16, // Grows as directories are visited
+    .value_size   = sizeof(evfs_off_t),
+
+    .destroy_item = destroy_hashed_file,
+    .gen_hash     = dh_gen_hash_string,
+    .is_equal     = dh_equal_hash_keys_string
+  };
+
+  ht->keys = NULL;
+  ht->key_chunks = NULL;
+  ht->keys_alloc = evfs_get_allocator(EVFS_ALLOC_INDEX);
+
+  if(!dh_init(&ht->hash_table, &s_hash_init, NULL))
+    return EVFS_ERR_ALLOC;
+
+#    ifdef EVFS_USE_THREADING
+  if(evfs__rwlock_init(&ht->index_lock) != EVFS_OK) {
+    dh_free(&ht->hash_table);
+    return EVFS_ERR_INIT;
+  }
+#    endif
+
+  // Only the root is known at mount
+  dhKey key;
+  key.data = "";
+  key.length = 0;
+
+  RomfsIndexValue entry;
+  entry.offset = fs->root_dir;
+  return romfs__index_insert(ht, key, &entry) ? EVFS_OK : EVFS_ERR_ALLOC;
+}
+
+
+static void romfs__fast_index_free(RomfsIndex *ht) {
+  dh_free(&ht->hash_table);
+
+  RomfsKeyChunk *chunk = ht->key_chunks;
+  while(chunk) {
+    RomfsKeyChunk *next = chunk->next;
+    evfs_free_with(ht->keys_alloc, EVFS_ALLOC_INDEX, chunk);
+    chunk = next;
+  }
+  ht->key_chunks = NULL;
+
+#    ifdef EVFS_USE_THREADING
+  evfs__rwlock_destroy(&ht->index_lock);
+#    endif
+}
+
+
+// Add the children of one directory to the index
+static int romfs__index_dir(Romfs *fs, RomfsIndex *ht, dhKey dir_key, RomfsIndexValue *dir_entry) {
+  RomfsFileHead cur_file;
+  evfs_off_t    cur_file_offset;
+  dhKey key;
+  RomfsIndexValue entry;
+
+  if(!romfs_read_file_header(fs, dir_entry->offset, &cur_file))
+    return EVFS_ERR_CORRUPTION;
+
+  if(FILE_TYPE(&cur_file) != FILE_TYPE_DIRECTORY)
+    return EVFS_ERR_NO_PATH;
+
+  int status = romfs__dir_first_file(fs, &cur_file, &cur_file_offset);
+
+  while(status == EVFS_OK) {
+    size_t name_len = strlen(cur_file.file_name);
+    size_t key_len = dir_key.length + (dir_key.length > 0 ? 1 : 0) + name_len;
+
+    char *key_str = romfs__key_alloc(ht, key_len + 1);
+    if(!key_str) return EVFS_ERR_ALLOC;
+
+    char *pos = key_str;
+    if(dir_key.length > 0) {
+      memcpy(pos, dir_key.data, dir_key.length);
+      pos += dir_key.length;
+      *pos++ = '/';
+    }
+    memcpy(pos, cur_file.file_name, name_len+1);
+
+    key.data = key_str;
+    key.length = key_len;
+    entry.offset = cur_file_offset;
+    if(!romfs__index_insert(ht, key, &entry))
+      return EVFS_ERR_ALLOC;
+
+    status = romfs__get_next_file(fs, &cur_file, &cur_file_offset);
+  }
+
+  // The directory entry now covers its children
+  void *value;
+  if(dh_lookup_in_place(&ht->hash_table, dir_key, &value))
+    ((RomfsIndexValue *)value)->offset |= ROMFS_DIR_INDEXED;
+
+  return EVFS_OK;
+}
+
+
+// Index each unvisited directory along a path until the path is found
+static bool romfs__lazy_index_path(Romfs *fs, RomfsIndex *ht, dhKey key, RomfsIndexValue *entry) {
+  dhKey prefix;
+  prefix.data = key.data;
+  prefix.length = 0; // Start at root
+
+  while(1) {
+    if(!romfs__index_lookup(ht, prefix, entry))
+      return false; // Missing from an indexed parent
+
+    if(prefix.length == key.length)
+      return true;
+
+    if(!(entry->offset & ROMFS_DIR_INDEXED)) {
+      RomfsIndexValue dir_entry = *entry;
+      if(romfs__index_dir(fs, ht, prefix, &dir_entry) != EVFS_OK)
+        return false;
+    }
+
+    // Extend to the next path element
+    const char *pos = (const char *)prefix.data + prefix.length;
+    if(prefix.length > 0)
+      pos++; // Skip separator
+
+    pos = memchr(pos, '/', (const char *)key.data + key.length - pos);
+    prefix.length = pos ? (size_t)(pos - (const char *)key.data) : key.length;
+  }
+}
+
+
+// Lookups that miss the index add the directories along their path
+static int romfs__lazy_lookup_abs_path(Romfs *fs, const char *path, RomfsFileHead *hdr) {
+  RomfsIndex *ht = &fs->fast_index;
+
+  dhKey key;
+  key.data = &path[1]; // Skip leading '/'
+  key.length = strlen(key.data);
+
+  RomfsIndexValue entry;
+
+#    ifdef EVFS_USE_THREADING
+  evfs__lock_shared(&ht->index_lock);
+  bool found = romfs__index_lookup(ht, key, &entry);
+  evfs__unlock_shared(&ht->index_lock);
+
+  if(!found) {
+    evfs__lock_exclusive(&ht->index_lock);
+    found = romfs__lazy_index_path(fs, ht, key, &entry);
+    evfs__unlock_exclusive(&ht->index_lock);
+  }
+#    else
+  bool found = romfs__index_lookup(ht, key, &entry) || romfs__lazy_index_path(fs, ht, key, &entry);
+#    endif
+
+  if(!found)
+    return EVFS_ERR_NO_PATH;
+
+  evfs_off_t offset = entry.offset & ~0xF;
+  romfs_read_file_header(fs, offset, hdr);
+  hdr->offset = offset | FILE_MODE(hdr); // Replace with offset of the element
+  return EVFS_OK;
+}
+
+#  endif // ROMFS_USE_LAZY_INDEX
 #endif // EVFS_USE_ROMFS_FAST_INDEX
 
 
@@ -464,12 +848,48 @@ int romfs_init(Romfs *fs, RomfsConfig *cfg) {
 
   fs->lookup_abs_path = romfs__lookup_abs_path;
 
+#if EVFS_ROMFS_HEADER_CACHE_SIZE > 0
+  memset(fs->hdr_cache, 0, sizeof fs->hdr_cache);
+#  ifdef EVFS_USE_THREADING
+  if(evfs__lock_init(&fs->hdr_cache_lock) != EVFS_OK)
+    return EVFS_ERR_INIT;
+#  endif
+#endif
+
+#ifdef EVFS_USE_ROMFS_TRUSTED_HEADERS
+  fs->trusted = false;
+#endif
+
   int status = romfs__validate(fs);
 
-#ifdef EVFS_USE_ROMFS_FAST_INDEX
+#if defined ROMFS_USE_LAZY_INDEX
+  if(status == EVFS_OK && cfg->index_storage) // The lazy index grows after mounting
+    status = EVFS_ERR_DISABLED;
+
+  if(status == EVFS_OK) {
+    status = romfs__lazy_index_init(fs, &fs->fast_index);
+    if(status == EVFS_OK)
+      fs->lookup_abs_path = romfs__lazy_lookup_abs_path;
+  }
+#elif defined EVFS_USE_ROMFS_FAST_INDEX
   if(status == EVFS_OK) {
-    romfs__build_index(fs, &fs->fast_index);
+    int index_status = romfs__build_index(fs, &fs->fast_index, cfg->index_storage);
+
+    // Heap indices fall back to scanning the image. Caller storage that is
+    // too small fails the mount.
+    if(index_status != EVFS_OK && cfg->index_storage) {
+      romfs__fast_index_free(&fs->fast_index);
+      status = index_status;
+    }
   }
+#else
+  if(status == EVFS_OK && cfg->index_storage)
+    status = EVFS_ERR_DISABLED;
+#endif
+
+#if EVFS_ROMFS_HEADER_CACHE_SIZE > 0 && defined EVFS_USE_THREADING
+  if(status != EVFS_OK)
+    evfs__lock_destroy(&fs->hdr_cache_lock);
 #endif
 
   return status;
@@ -483,5 +903,8 @@ void romfs_unmount(Romfs *fs) {
   romfs__fast_index_free(&fs->fast_index);
 #endif
 
+#if EVFS_ROMFS_HEADER_CACHE_SIZE > 0 && defined EVFS_USE_THREADING
+  evfs__lock_destroy(&fs->hdr_cache_lock);
+#endif
 }
 
@@ -22,7 +22,11 @@ Embedded Virtual Filesystem
 #include "evfs_internal.h"
 
 #ifdef EVFS_USE_ROMFS_FAST_INDEX
-#  include "evfs/util/dhash.h"
+#  ifdef EVFS_USE_PERFECT_HASH_INDEX
+#    include "evfs/util/mphash.h"
+#  else
+#    include "evfs/util/dhash.h"
+#  endif
 #endif
 
 #include "evfs/romfs_common.h"
@@ -31,35 +35,65 @@ Embedded Virtual Filesystem
 
 ///////////////////////////////////////////////////////////////////////////////////
 
-// Shared buffer needs lock if threading is enabled
-#if defined EVFS_USE_ROMFS_SHARED_BUFFER && defined EVFS_USE_THREADING
-#  define USE_ROMFS_LOCK
+// Path lookups only read cur_dir so they can share its lock
+#ifdef EVFS_USE_THREADING
+#  define DIR_LOCK_SHARED()     evfs__lock_shared(&fs_data->dir_lock)
+#  define DIR_UNLOCK_SHARED()   evfs__unlock_shared(&fs_data->dir_lock)
+#  define DIR_LOCK_EXCL()       evfs__lock_exclusive(&fs_data->dir_lock)
+#  define DIR_UNLOCK_EXCL()     evfs__unlock_exclusive(&fs_data->dir_lock)
+#else
+#  define DIR_LOCK_SHARED()
+#  define DIR_UNLOCK_SHARED()
+#  define DIR_LOCK_EXCL()
+#  define DIR_UNLOCK_EXCL()
 #endif
 
-
-#ifdef USE_ROMFS_LOCK
-#  define LOCK()    evfs__lock(&fs_data->romfs_lock)
-#  define UNLOCK()  evfs__unlock(&fs_data->romfs_lock)
+// Handles take a reference to the current mount under a shared lock.
+// Remounting only needs the lock exclusively to swap the mount pointer.
+#ifdef EVFS_USE_THREADING
+#  include <stdatomic.h>
+typedef atomic_uint MountRefs;
+#  define MOUNT_LOCK_SHARED()     evfs__lock_shared(&fs_data->mount_lock)
+#  define MOUNT_UNLOCK_SHARED()   evfs__unlock_shared(&fs_data->mount_lock)
+#  define MOUNT_LOCK_EXCL()       evfs__lock_exclusive(&fs_data->mount_lock)
+#  define MOUNT_UNLOCK_EXCL()     evfs__unlock_exclusive(&fs_data->mount_lock)
+#  define REF_ADD(r)              atomic_fetch_add_explicit(&(r), 1, memory_order_relaxed)
+#  define REF_SUB(r)              atomic_fetch_sub_explicit(&(r), 1, memory_order_acq_rel)
 #else
-#  define LOCK()
-#  define UNLOCK()
+typedef unsigned MountRefs;
+#  define MOUNT_LOCK_SHARED()
+#  define MOUNT_UNLOCK_SHARED()
+#  define MOUNT_LOCK_EXCL()
+#  define MOUNT_UNLOCK_EXCL()
+#  define REF_ADD(r)              ((r)++)
+#  define REF_SUB(r)              ((r)--)
 #endif
 
 
 
 
+// Image and index for a mounted Romfs. The VFS and each open handle hold a
+// reference. A replaced mount stays alive until its last handle is closed.
+typedef struct RomfsMount {
+  Romfs     romfs;
+  MountRefs refs;
+
+  // Mapped image files are read as in-memory resources
+  EvfsFile   *image;
+  EvfsMapping image_map;
+} RomfsMount;
+
+
 typedef struct RomfsData {
   Evfs       *vfs;
 
   char      cur_dir[EVFS_MAX_PATH];
-#ifdef EVFS_USE_ROMFS_SHARED_BUFFER
-  char      abs_path[EVFS_MAX_PATH]; // Shared buffer for building absolute paths
-#endif
-#ifdef USE_ROMFS_LOCK
-  EvfsLock  romfs_lock; // Serialize access to shared abs_path buffer
+#ifdef EVFS_USE_THREADING
+  EvfsRwLock dir_lock; // Protects cur_dir
+  EvfsRwLock mount_lock; // Protects mount pointer
 #endif
 
-  Romfs romfs;
+  RomfsMount *mount;
 
   // VFS config options
   unsigned cfg_no_dir_dots :1; // EVFS_CMD_SET_NO_DIR_DOTS
@@ -69,6 +103,7 @@ typedef struct RomfsData {
 typedef struct RomfsFile {
   EvfsFile      base;
   RomfsData    *fs_data;
+  RomfsMount   *mount;
 
   RomfsFileHead hdr;
   evfs_off_t    read_pos;
@@ -78,6 +113,7 @@ typedef struct RomfsFile {
 typedef struct RomfsDir {
   EvfsDir       base;
   RomfsData    *fs_data;
+  RomfsMount   *mount;
 
   evfs_off_t    dir_pos;
   evfs_off_t    cur_file_offset; // Iterator position
@@ -86,82 +122,86 @@ typedef struct RomfsDir {
 } RomfsDir;
 
 
-// Helper to convert relative paths into absolute for the Romfs API
-// Returned path must be freed
-static int make_absolute_path(Evfs *vfs, const char *path, char **absolute, bool force_malloc) {
-  RomfsData *fs_data = (RomfsData *)vfs->fs_data;
-  *absolute = NULL;
+// ******************** Mount references ********************
 
-  size_t abs_size;
-  char *abs_path = NULL;
+static RomfsMount *romfs__mount_get(RomfsData *fs_data) {
+  MOUNT_LOCK_SHARED();
+  RomfsMount *mount = fs_data->mount;
+  REF_ADD(mount->refs);
+  MOUNT_UNLOCK_SHARED();
 
-#ifdef EVFS_USE_ROMFS_SHARED_BUFFER
-  if(!force_malloc) {
-    abs_size = COUNT_OF(fs_data->abs_path);
-    LOCK();
-    abs_path = fs_data->abs_path;
-  }
-#endif
-
-  if(force_malloc || !abs_path) {
-    abs_size = strlen(path) + 1;
-    *absolute = NULL;
+  return mount;
+}
 
-    if(!evfs_vfs_path_is_absolute(vfs, path)) // Need space for join with cur_dir
-      abs_size += strlen(fs_data->cur_dir) + 1;
 
-    abs_path = evfs_malloc(abs_size);
-    if(MEM_CHECK(abs_path)) return EVFS_ERR_ALLOC;
+static void romfs__mount_put(RomfsMount *mount) {
+  if(REF_SUB(mount->refs) == 1) { // Last reference
+    romfs_unmount(&mount->romfs);
+    if(mount->image) {
+      evfs_file_unmap(mount->image, &mount->image_map);
+      evfs_file_close(mount->image);
+    }
+    evfs_free(mount);
   }
+}
 
-  AppendRange abs_path_r;
-  range_init(&abs_path_r, abs_path, abs_size);
-
-  int status = evfs_vfs_path_absolute(vfs, path, (StringRange *)&abs_path_r);
-  if(status == EVFS_OK)
-    *absolute = abs_path;
 
-  return status;
-}
 
-// Prepare a buffer for the absolute path
-#define MAKE_ABS(path, abs_path) char *abs_path; do { \
- int status_ma = make_absolute_path(vfs, path, &abs_path, false); \
- if(status_ma != EVFS_OK) \
-    return status_ma; \
-} while(0)
+// ******************** File access methods ********************
 
+ptrdiff_t romfs_read_rsrc(Romfs *fs, evfs_off_t offset, void *buf, size_t size);
+static ptrdiff_t romfs_read_image(Romfs *fs, evfs_off_t offset, void *buf, size_t size);
 
-#ifdef EVFS_USE_ROMFS_SHARED_BUFFER
-#  define FREE_ABS(abs_path)  UNLOCK()
-#else
-#  define FREE_ABS(abs_path)  evfs_free(abs_path)
-#endif
+// Pass a prefetch for part of a file on to the image
+static int romfs_prefetch(RomfsFile *fil, const EvfsFileRange *file_range) {
+  Romfs *romfs = &fil->mount->romfs;
 
+  if(romfs->read_data != romfs_read_image) // Resources are already in memory
+    return EVFS_OK;
 
+  evfs_off_t remaining = fil->hdr.size - file_range->offset;
+  if(remaining <= 0) return EVFS_OK;
 
+  EvfsFileRange range = *file_range;
+  if(range.size == 0 || range.size > remaining)
+    range.size = remaining;
+  range.offset += FILE_OFFSET(&fil->hdr) + fil->hdr.header_len;
 
-// ******************** File access methods ********************
+  return evfs_file_ctrl((EvfsFile *)romfs->ctx, EVFS_CMD_PREFETCH, &range);
+}
 
-ptrdiff_t romfs_read_rsrc(Romfs *fs, evfs_off_t offset, void *buf, size_t size);
 
 static int romfs__file_ctrl(EvfsFile *fh, int cmd, void *arg) {
   RomfsFile *fil = (RomfsFile *)fh;
-  RomfsData *fs_data = fil->fs_data;
+  Romfs *romfs = &fil->mount->romfs;
 
   switch(cmd) {
     case EVFS_CMD_GET_RSRC_ADDR:
       {
         // NOTE: This is only valid for in-memory resource Romfs
-        if(fs_data->romfs.read_data != romfs_read_rsrc)
+        if(romfs->read_data != romfs_read_rsrc)
           return EVFS_ERR_NO_SUPPORT;
 
         uint8_t **v = (uint8_t **)arg;
 
-        *v = (uint8_t *)fs_data->romfs.ctx + FILE_OFFSET(&fil->hdr) + fil->hdr.header_len;
+        *v = (uint8_t *)romfs->ctx + FILE_OFFSET(&fil->hdr) + fil->hdr.header_len;
       }
       return EVFS_OK; break;
 
+    case EVFS_CMD_SET_FILE_ADVICE: // Files read all the way through are prefetched
+      {
+        unsigned *v = (unsigned *)arg;
+        if(*v != EVFS_ADVICE_SEQUENTIAL && *v != EVFS_ADVICE_WILL_NEED)
+          return EVFS_OK;
+
+        EvfsFileRange range = {0};
+        return romfs_prefetch(fil, &range);
+      }
+      break;
+
+    case EVFS_CMD_PREFETCH:
+      return romfs_prefetch(fil, (EvfsFileRange *)arg); break;
+
     default: return EVFS_ERR_NO_SUPPORT; break;
   }
 
@@ -174,30 +214,76 @@ static int romfs__file_close(EvfsFile *fh) {
   memset(&fil->hdr, 0, sizeof(fil->hdr));
   fil->read_pos = 0;
 
+  if(fil->mount) {
+    romfs__mount_put(fil->mount);
+    fil->mount = NULL;
+  }
+
   return EVFS_OK;
 }
 
-static ptrdiff_t romfs__file_read(EvfsFile *fh, void *buf, size_t size) {
+static ptrdiff_t romfs__file_read_at(EvfsFile *fh, void *buf, size_t size, evfs_off_t offset) {
   RomfsFile *fil = (RomfsFile *)fh;
-  RomfsData *fs_data = (RomfsData *)fil->fs_data;
 
-  evfs_off_t remaining = fil->hdr.size - fil->read_pos;
+  evfs_off_t remaining = fil->hdr.size - offset;
   if(remaining <= 0) return 0;
 
   if((evfs_off_t)size > remaining)
     size = remaining;
 
-  LOCK();
-  evfs_off_t data_offset = FILE_OFFSET(&fil->hdr) + fil->hdr.header_len + fil->read_pos;
-  ptrdiff_t rval = romfs_read(&fs_data->romfs, data_offset, buf, size);
-  fil->read_pos += size;
-  UNLOCK();
+  // Image reads are positional so no lock is needed
+  evfs_off_t data_offset = FILE_OFFSET(&fil->hdr) + fil->hdr.header_len + offset;
+  return romfs_read(&fil->mount->romfs, data_offset, buf, size);
+}
+
+static ptrdiff_t romfs__file_read(EvfsFile *fh, void *buf, size_t size) {
+  RomfsFile *fil = (RomfsFile *)fh;
+
+  ptrdiff_t rval = romfs__file_read_at(fh, buf, size, fil->read_pos);
+  if(rval > 0)
+    fil->read_pos += rval;
 
   //DPRINT("## READ: @ %ld,  %ld  '%02X'", fil->read_pos-size, size, *((uint8_t *)buf));
 
   return rval;
 }
 
+static int romfs__file_map(EvfsFile *fh, evfs_off_t offset, size_t size, EvfsMapping *map) {
+  RomfsFile *fil = (RomfsFile *)fh;
+  Romfs *romfs = &fil->mount->romfs;
+
+  if(offset > (evfs_off_t)fil->hdr.size) return EVFS_ERR_OVERFLOW;
+
+  evfs_off_t remaining = fil->hdr.size - offset;
+  if(remaining == 0) return EVFS_OK; // Empty mapping
+
+  if(size == 0 || (evfs_off_t)size > remaining)
+    size = remaining;
+
+  evfs_off_t data_offset = FILE_OFFSET(&fil->hdr) + fil->hdr.header_len + offset;
+
+  if(romfs->read_data == romfs_read_rsrc) { // Resource data is mapped in place
+    map->data = (const uint8_t *)romfs->ctx + data_offset;
+    map->size = size;
+    return EVFS_OK;
+
+  } else if(romfs->read_data == romfs_read_image) { // Try to map the image file
+    return evfs_file_map((EvfsFile *)romfs->ctx, data_offset, size, map);
+  }
+
+  return EVFS_ERR_NO_SUPPORT;
+}
+
+static int romfs__file_unmap(EvfsFile *fh, EvfsMapping *map) {
+  RomfsFile *fil = (RomfsFile *)fh;
+  Romfs *romfs = &fil->mount->romfs;
+
+  if(romfs->read_data == romfs_read_image)
+    return evfs_file_unmap((EvfsFile *)romfs->ctx, map);
+
+  return EVFS_OK;
+}
+
 static ptrdiff_t romfs__file_write(EvfsFile *fh, const void *buf, size_t size) {
   return EVFS_ERR_NO_SUPPORT;
 }
@@ -251,7 +337,10 @@ static EvfsFileMethods s_romfs_methods = {
   .m_size     = romfs__file_size,
   .m_seek     = romfs__file_seek,
   .m_tell     = romfs__file_tell,
-  .m_eof      = romfs__file_eof
+  .m_eof      = romfs__file_eof,
+  .m_read_at  = romfs__file_read_at,
+  .m_map      = romfs__file_map,
+  .m_unmap    = romfs__file_unmap
 };
 
 
@@ -265,6 +354,11 @@ static int romfs__dir_close(EvfsDir *dh) {
   memset(&dir->cur_file, 0, sizeof(dir->cur_file));
   dir->dir_pos = 0;
 
+  if(dir->mount) {
+    romfs__mount_put(dir->mount);
+    dir->mount = NULL;
+  }
+
   return EVFS_OK;
 }
 
@@ -272,19 +366,20 @@ static int romfs__dir_close(EvfsDir *dh) {
 static int romfs__dir_read(EvfsDir *dh, EvfsInfo *info) {
   RomfsDir *dir = (RomfsDir *)dh;
   RomfsData *fs_data = (RomfsData *)dir->fs_data;
+  Romfs *romfs = &dir->mount->romfs;
 
   int status;
   evfs_off_t next_entry;
 
   // Advance to next directory
   if(dir->is_reset) { // Init iterator
-    romfs_read_file_header(&fs_data->romfs, dir->dir_pos, &dir->cur_file);
+    romfs_read_file_header(romfs, dir->dir_pos, &dir->cur_file);
     next_entry = dir->cur_file.spec_info;
     dir->is_reset = false;
 
     if(fs_data->cfg_no_dir_dots) { // Skip over hard links
-      romfs_read_file_header(&fs_data->romfs, next_entry, &dir->cur_file); // Skip "."
-      romfs_read_file_header(&fs_data->romfs, FILE_OFFSET(&dir->cur_file), &dir->cur_file); // Skip ".."
+      romfs_read_file_header(romfs, next_entry, &dir->cur_file); // Skip "."
+      romfs_read_file_header(romfs, FILE_OFFSET(&dir->cur_file), &dir->cur_file); // Skip ".."
       next_entry = FILE_OFFSET(&dir->cur_file);
     }
 
@@ -294,7 +389,7 @@ static int romfs__dir_read(EvfsDir *dh, EvfsInfo *info) {
 
   if(next_entry > 0) {
     dir->cur_file_offset = next_entry;
-    status = romfs_read_file_header(&fs_data->romfs, next_entry, &dir->cur_file) ? EVFS_OK : EVFS_DONE;
+    status = romfs_read_file_header(romfs, next_entry, &dir->cur_file) ? EVFS_OK : EVFS_DONE;
 
   } else { // Iteration complete
     status = EVFS_DONE;
@@ -336,18 +431,13 @@ static EvfsDirMethods s_romfs_dir_methods = {
 // ******************** FS access methods ********************
 
 
-static inline int romfs__lookup_path(Evfs *vfs, RomfsData *fs_data, const char *path,
+static inline int romfs__lookup_path(Evfs *vfs, Romfs *romfs, const char *path,
                                     RomfsFileHead *hdr) {
   int status;
 
-  if(evfs_vfs_path_is_absolute(vfs, path)) {
-    status = romfs_lookup_abs_path(&fs_data->romfs, path, hdr);
-
-  } else { // Convert relative path
-    MAKE_ABS(path, abs_path);
-    status = romfs_lookup_abs_path(&fs_data->romfs, abs_path, hdr);
-    FREE_ABS(abs_path);
-  }
+  MAKE_ABS(path, abs_path);
+  status = romfs_lookup_abs_path(romfs, abs_path, hdr);
+  FREE_ABS(abs_path);
 
   return status;
 }
@@ -365,8 +455,9 @@ static int romfs__open(Evfs *vfs, const char *path, EvfsFile *fh, int flags) {
 
 
   fil->fs_data = fs_data;
+  fil->mount = romfs__mount_get(fs_data);
 
-  int status = romfs__lookup_path(vfs, fs_data, path, &fil->hdr);
+  int status = romfs__lookup_path(vfs, &fil->mount->romfs, path, &fil->hdr);
 
   // Must be a plain file
   int file_type = FILE_TYPE(&fil->hdr);
@@ -374,6 +465,11 @@ static int romfs__open(Evfs *vfs, const char *path, EvfsFile *fh, int flags) {
     status = EVFS_ERR_NO_FILE;
   }
 
+  if(status != EVFS_OK) { // Handle won't be closed
+    romfs__mount_put(fil->mount);
+    fil->mount = NULL;
+  }
+
   return status;
 }
 
@@ -383,7 +479,9 @@ static int romfs__stat(Evfs *vfs, const char *path, EvfsInfo *info) {
 
   RomfsFileHead hdr;
 
-  int status = romfs__lookup_path(vfs, fs_data, path, &hdr);
+  RomfsMount *mount = romfs__mount_get(fs_data);
+  int status = romfs__lookup_path(vfs, &mount->romfs, path, &hdr);
+  romfs__mount_put(mount);
 
   memset(info, 0, sizeof(*info));
 
@@ -407,10 +505,11 @@ static int romfs__open_dir(Evfs *vfs, const char *path, EvfsDir *dh) {
   memset(dir, 0, sizeof(*dir));
   dh->methods = &s_romfs_dir_methods;
   dir->fs_data = fs_data;
+  dir->mount = romfs__mount_get(fs_data);
 
   RomfsFileHead hdr;
 
-  int status = romfs__lookup_path(vfs, fs_data, path, &hdr);
+  int status = romfs__lookup_path(vfs, &dir->mount->romfs, path, &hdr);
 
   int file_type = FILE_TYPE(&hdr);
   if(status == EVFS_OK && file_type != FILE_TYPE_DIRECTORY) {
@@ -420,6 +519,9 @@ static int romfs__open_dir(Evfs *vfs, const char *path, EvfsDir *dh) {
   if(status == EVFS_OK) {
     dir->dir_pos = FILE_OFFSET(&hdr);
     dir->is_reset = true;
+  } else { // Handle won't be closed
+    romfs__mount_put(dir->mount);
+    dir->mount = NULL;
   }
 
   return status;
@@ -430,7 +532,9 @@ static int romfs__get_cur_dir(Evfs *vfs, StringRange *cur_dir) {
   RomfsData *fs_data = (RomfsData *)vfs->fs_data;
   AppendRange r = *(AppendRange *)cur_dir;
 
+  DIR_LOCK_SHARED();
   range_cat_str(&r, fs_data->cur_dir);
+  DIR_UNLOCK_SHARED();
   range_terminate(&r);
   return EVFS_OK;
 }
@@ -440,46 +544,21 @@ static int romfs__get_cur_dir(Evfs *vfs, StringRange *cur_dir) {
 static int romfs__set_cur_dir(Evfs *vfs, const char *path) {
   RomfsData *fs_data = (RomfsData *)vfs->fs_data;
 
-  if(evfs_vfs_path_is_absolute(vfs, path)) { // Just assign absolute paths
-    // Confirm the path exists
-    if(!evfs__vfs_existing_dir(vfs, path))
-      return EVFS_ERR_NO_PATH;
+  MAKE_ABS(path, abs_path);
 
-    strncpy(fs_data->cur_dir, path, EVFS_MAX_PATH-1);
+  // Confirm the path exists
+  int status = EVFS_OK;
+  if(evfs__vfs_existing_dir(vfs, abs_path)) {
+    DIR_LOCK_EXCL();
+    strncpy(fs_data->cur_dir, abs_path, EVFS_MAX_PATH-1);
     fs_data->cur_dir[EVFS_MAX_PATH-1] = '\0';
-
-  } else { // Path is relative: Join it to the existing directory
-    StringRange head, tail, joined;
-
-    range_init(&head, fs_data->cur_dir, EVFS_MAX_PATH);
-    range_init(&tail, (char *)path, strlen(path));
-
-    size_t joined_size = strlen(fs_data->cur_dir) + 1 + strlen(path) + 1;
-    char *joined_path = evfs_malloc(joined_size);
-    if(MEM_CHECK(joined_path)) return EVFS_ERR_ALLOC;
-
-    range_init(&joined, joined_path, joined_size);
-
-    evfs_vfs_path_join(vfs, &head, &tail, &joined);
-
-    // We must normalize now because the fast index can't handle denormal paths
-    range_init(&joined, joined_path, joined_size);
-    evfs_vfs_path_normalize(vfs, joined_path, &joined);
-
-    // Confirm the path exists
-    if(!evfs__vfs_existing_dir(vfs, joined_path)) {
-      evfs_free(joined_path);
-      return EVFS_ERR_NO_PATH;
-    }
-
-    // Overwrite old cur_dir
-    range_init(&head, fs_data->cur_dir, EVFS_MAX_PATH);
-    range_cat_str((AppendRange *)&head, joined_path);
-
-    evfs_free(joined_path);
+    DIR_UNLOCK_EXCL();
+  } else {
+    status = EVFS_ERR_NO_PATH;
   }
 
-  return EVFS_OK;
+  FREE_ABS(abs_path);
+  return status;
 }
 
 
@@ -489,9 +568,10 @@ static int romfs__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
 
   switch(cmd) {
     case EVFS_CMD_UNREGISTER:
-      romfs_unmount(&fs_data->romfs);
-#ifdef USE_ROMFS_LOCK
-      evfs__lock_destroy(&fs_data->romfs_lock);
+      romfs__mount_put(fs_data->mount);
+#ifdef EVFS_USE_THREADING
+      evfs__rwlock_destroy(&fs_data->dir_lock);
+      evfs__rwlock_destroy(&fs_data->mount_lock);
 #endif
 
       evfs_free(vfs);
@@ -528,6 +608,47 @@ static int romfs__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
 #define NEXT_OBJ(o) (&(o)[1])
 
 
+// Build a new mount with its index
+static void romfs_unmount_rsrc(Romfs *fs);
+
+static int romfs__mount_new(RomfsConfig *cfg, RomfsMount **mount) {
+  RomfsMount *new_mount = evfs_malloc(sizeof(*new_mount));
+  if(MEM_CHECK(new_mount)) return EVFS_ERR_ALLOC;
+  memset(new_mount, 0, sizeof(*new_mount));
+
+#ifdef EVFS_USE_IMAGE_MAPPING
+  // Image files that can be mapped switch to the resource access methods
+  RomfsConfig map_cfg;
+  if(cfg->read_data == romfs_read_image) {
+    EvfsFile *image = (EvfsFile *)cfg->ctx;
+    if(evfs_file_map(image, 0, 0, &new_mount->image_map) == EVFS_OK && new_mount->image_map.data) {
+      new_mount->image = image;
+      map_cfg = (RomfsConfig){
+        .ctx        = (void *)new_mount->image_map.data,
+        .total_size = new_mount->image_map.size,
+        .read_data  = romfs_read_rsrc,
+        .unmount    = romfs_unmount_rsrc,
+        .index_storage = cfg->index_storage
+      };
+      cfg = &map_cfg;
+    }
+  }
+#endif
+
+  int status = romfs_init(&new_mount->romfs, cfg);
+  if(status != EVFS_OK) {
+    if(new_mount->image) // Caller still owns the image
+      evfs_file_unmap(new_mount->image, &new_mount->image_map);
+    evfs_free(new_mount);
+    return status;
+  }
+
+  new_mount->refs = 1; // Reference for the VFS
+  *mount = new_mount;
+  return EVFS_OK;
+}
+
+
 static int evfs__register_romfs_cfg(const char *vfs_name, RomfsConfig *cfg, bool default_vfs) {
   Evfs      *new_vfs;
   RomfsData *fs_data;
@@ -565,23 +686,28 @@ static int evfs__register_romfs_cfg(const char *vfs_name, RomfsConfig *cfg, bool
   new_vfs->m_set_cur_dir = romfs__set_cur_dir;
   new_vfs->m_vfs_ctrl = romfs__vfs_ctrl;
 
-#ifdef USE_ROMFS_LOCK
-  if(evfs__lock_init(&fs_data->romfs_lock) != EVFS_OK) {
+#ifdef EVFS_USE_THREADING
+  if(evfs__rwlock_init(&fs_data->dir_lock) != EVFS_OK) {
     evfs_free(new_vfs);
     THROW(EVFS_ERR_INIT);
   }
-#endif
 
+  if(evfs__rwlock_init(&fs_data->mount_lock) != EVFS_OK) {
+    evfs__rwlock_destroy(&fs_data->dir_lock);
+    evfs_free(new_vfs);
+    THROW(EVFS_ERR_INIT);
+  }
+#endif
 
-/*  RomfsConfig cfg = {
-    .ctx        = image,
-    .total_size = evfs_file_size(image),
-    .read_data  = romfs_read_image,
-    .unmount    = romfs_unmount_image
-  };*/
-  int status = romfs_init(&fs_data->romfs, cfg);
-  if(status != EVFS_OK)
+  int status = romfs__mount_new(cfg, &fs_data->mount);
+  if(status != EVFS_OK) {
+#ifdef EVFS_USE_THREADING
+    evfs__rwlock_destroy(&fs_data->mount_lock);
+    evfs__rwlock_destroy(&fs_data->dir_lock);
+#endif
+    evfs_free(new_vfs);
     return status;
+  }
 
   return evfs_register(new_vfs, default_vfs);
 }
@@ -596,8 +722,7 @@ static void romfs_unmount_image(Romfs *fs) {
 
 static ptrdiff_t romfs_read_image(Romfs *fs, evfs_off_t offset, void *buf, size_t size) {
   EvfsFile *image = (EvfsFile *)fs->ctx;
-  evfs_file_seek(image, offset, EVFS_SEEK_TO);
-  return evfs_file_read(image, buf, size);
+  return evfs_file_read_at(image, buf, size, offset);
 }
 
 
@@ -627,6 +752,61 @@ int evfs_register_romfs(const char *vfs_name, EvfsFile *image, bool default_vfs)
 
 
 
+// Replace the mount of an existing Romfs VFS
+static int evfs__remount_romfs_cfg(const char *vfs_name, RomfsConfig *cfg) {
+  Evfs *vfs = evfs_find_vfs(vfs_name);
+  if(!vfs || vfs->m_open != romfs__open) THROW(EVFS_ERR_NO_VFS);
+
+  RomfsData *fs_data = (RomfsData *)vfs->fs_data;
+
+  // The new index is built without blocking access to the old one
+  RomfsMount *new_mount;
+  int status = romfs__mount_new(cfg, &new_mount);
+  if(status != EVFS_OK) return status;
+
+  MOUNT_LOCK_EXCL();
+  RomfsMount *old_mount = fs_data->mount;
+  fs_data->mount = new_mount;
+  MOUNT_UNLOCK_EXCL();
+
+  romfs__mount_put(old_mount); // Freed now or when its last handle closes
+
+  return EVFS_OK;
+}
+
+
+
+/*
+Replace the image of a registered Romfs
+
+The new image is validated and indexed before it is swapped in. Lookups
+continue on the old image until then. Handles opened on the old image stay
+valid and it is closed after the last of them is closed. The current
+directory is kept as is.
+
+Args:
+  vfs_name:      Name of a VFS registered with evfs_register_romfs() or
+                 evfs_register_rsrc_romfs()
+  image:         Mounted Romfs image. Left open on failure.
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_remount_romfs(const char *vfs_name, EvfsFile *image) {
+  if(PTR_CHECK(vfs_name) || PTR_CHECK(image)) return EVFS_ERR_BAD_ARG;
+
+  RomfsConfig cfg = {
+    .ctx        = image,
+    .total_size = evfs_file_size(image),
+    .read_data  = romfs_read_image,
+    .unmount    = romfs_unmount_image
+  };
+
+  return evfs__remount_romfs_cfg(vfs_name, &cfg);
+}
+
+
+
 // Callbacks for resource based Romfs
 static void romfs_unmount_rsrc(Romfs *fs) {
 }
@@ -671,3 +851,115 @@ int evfs_register_rsrc_romfs(const char *vfs_name, const uint8_t *resource, size
   return evfs__register_romfs_cfg(vfs_name, &cfg, default_vfs);
 }
 
+
+/*
+Register a Romfs instance using an in-memory resource array with its index in
+caller storage
+
+The hash index and path keys are kept in the buffers from storage and never
+grow. Use evfs_romfs_rsrc_index_size() to get the sizes needed for an image.
+The buffers must stay valid until the VFS is unregistered. A later remount
+builds its index on the heap.
+
+Args:
+  vfs_name:      Name of new VFS
+  resource:      Array of Romfs resource data
+  resource_len:  Length of the resource array
+  storage:       Buffers for the index
+  default_vfs:   Make this the default VFS when true
+
+Returns:
+  EVFS_OK on success. An error is returned if the storage is too small.
+*/
+int evfs_register_rsrc_romfs_static(const char *vfs_name, const uint8_t *resource, size_t resource_len,
+                                    const EvfsIndexStorage *storage, bool default_vfs) {
+  if(PTR_CHECK(vfs_name) || PTR_CHECK(resource) || PTR_CHECK(storage) ||
+     PTR_CHECK(storage->index) || PTR_CHECK(storage->keys)) return EVFS_ERR_BAD_ARG;
+
+  // Buckets are accessed in place
+  if((uintptr_t)storage->index % sizeof(void *))
+    return EVFS_ERR_BAD_ARG;
+
+  RomfsConfig cfg = {
+    .ctx        = (void *)resource,
+    .total_size = resource_len,
+    .read_data  = romfs_read_rsrc,
+    .unmount    = romfs_unmount_rsrc,
+    .index_storage = storage
+  };
+
+  return evfs__register_romfs_cfg(vfs_name, &cfg, default_vfs);
+}
+
+
+/*
+Get the storage needed to index a Romfs resource
+
+This builds a heap index for the image to measure it. It is meant for host
+tools that generate buffers for evfs_register_rsrc_romfs_static().
+
+Args:
+  resource:      Array of Romfs resource data
+  resource_len:  Length of the resource array
+  storage:       Sizes are returned in index_size and keys_size
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_romfs_rsrc_index_size(const uint8_t *resource, size_t resource_len, EvfsIndexStorage *storage) {
+  if(PTR_CHECK(resource) || PTR_CHECK(storage)) return EVFS_ERR_BAD_ARG;
+
+#if defined EVFS_USE_ROMFS_FAST_INDEX && !defined ROMFS_USE_LAZY_INDEX && \
+    !defined EVFS_USE_PERFECT_HASH_INDEX
+  RomfsConfig cfg = {
+    .ctx        = (void *)resource,
+    .total_size = resource_len,
+    .read_data  = romfs_read_rsrc,
+    .unmount    = romfs_unmount_rsrc
+  };
+
+  Romfs romfs = {0};
+  int status = romfs_init(&romfs, &cfg);
+  if(status != EVFS_OK) return status;
+
+  storage->index      = NULL;
+  storage->index_size = dh_storage_size(romfs.fast_index.num_keys, sizeof(evfs_off_t));
+  storage->keys       = NULL;
+  storage->keys_size  = romfs.fast_index.keys_size;
+
+  romfs_unmount(&romfs);
+
+  return storage->index_size > 0 ? EVFS_OK : EVFS_ERR_OVERFLOW;
+
+#else
+  return EVFS_ERR_DISABLED;
+#endif
+}
+
+
+/*
+Replace the image of a registered Romfs with an in-memory resource array
+
+See evfs_remount_romfs() for details.
+
+Args:
+  vfs_name:      Name of a registered Romfs VFS
+  resource:      Array of Romfs resource data
+  resource_len:  Length of the resource array
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_remount_rsrc_romfs(const char *vfs_name, const uint8_t *resource, size_t resource_len) {
+  if(PTR_CHECK(vfs_name) || PTR_CHECK(resource)) return EVFS_ERR_BAD_ARG;
+
+  RomfsConfig cfg = {
+    .ctx        = (void *)resource,
+    .total_size = resource_len,
+    .read_data  = romfs_read_rsrc,
+    .unmount    = romfs_unmount_rsrc
+  };
+
+  return evfs__remount_romfs_cfg(vfs_name, &cfg);
+}
+
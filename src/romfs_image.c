@@ -0,0 +1,518 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2021 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Romfs image builder
+
+  The source tree is read into memory and each directory is sorted by name.
+  A layout pass assigns image offsets to every header. The write pass then
+  streams the headers and file data out in offset order so the image file
+  only needs to seek once to store the superblock checksum.
+
+  Each directory is laid out as ".", "..", then its sorted children. The
+  contents of subdirectories follow after all of their siblings.
+------------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "evfs.h"
+#include "evfs_internal.h"
+
+#ifdef EVFS_USE_ROMFS_FAST_INDEX
+#  ifdef EVFS_USE_PERFECT_HASH_INDEX
+#    include "evfs/util/mphash.h"
+#  else
+#    include "evfs/util/dhash.h"
+#  endif
+#endif
+
+#include "evfs/romfs_common.h"
+#include "evfs/romfs_image.h"
+#include "evfs/util/unaligned_access.h"
+#include "evfs/util/checksum.h"
+
+
+#define ROMFS_SUPERBLOCK_SUM_LEN  512 // Bytes covered by the superblock checksum
+#define ROMFS_IMAGE_PAD           1024
+#define ROMFS_COPY_BUF_SIZE       4096
+
+
+typedef struct RomfsNode {
+  char       *name;
+  evfs_off_t  size;
+  bool        is_dir;
+
+  struct RomfsNode *children; // Sorted by name
+  size_t            num_children;
+
+  evfs_off_t  hdr_pos;    // Offset of this entry's header
+  evfs_off_t  dot_pos;    // Offset of the "." entry of a directory
+} RomfsNode;
+
+
+typedef struct RomfsBuilder {
+  const RomfsBuildConfig *cfg;
+  EvfsFile   *image;
+  evfs_off_t  pos;        // Layout or write position
+  size_t      data_align;
+  char        path[EVFS_MAX_PATH];
+  uint8_t     head[ROMFS_SUPERBLOCK_SUM_LEN]; // Copy of the checksummed bytes
+  uint8_t     copy_buf[ROMFS_COPY_BUF_SIZE];
+} RomfsBuilder;
+
+
+static inline evfs_off_t header_len(const char *name) {
+  return (16 + strlen(name)+1 + 15) & ~0xF;
+}
+
+static inline evfs_off_t align_up(evfs_off_t value, size_t align) {
+  return (value + align-1) & ~(evfs_off_t)(align-1);
+}
+
+
+// ******************** Source tree ********************
+
+// Append a name to the source path. Restore with b->path[path_len] = '\0'.
+static bool romfs__push_path(RomfsBuilder *b, size_t path_len, const char *name) {
+  const char *sep = path_len > 0 && b->path[path_len-1] != '/' ? "/" : "";
+  int len = snprintf(&b->path[path_len], sizeof b->path - path_len, "%s%s", sep, name);
+
+  if(len < 0 || (size_t)len >= sizeof b->path - path_len) {
+    b->path[path_len] = '\0';
+    return false;
+  }
+
+  return true;
+}
+
+
+static void romfs__free_tree(RomfsNode *node) {
+  for(size_t i = 0; i < node->num_children; i++) {
+    romfs__free_tree(&node->children[i]);
+  }
+
+  if(node->children)
+    evfs_free(node->children);
+  if(node->name)
+    evfs_free(node->name);
+}
+
+
+static int romfs__compare_nodes(const void *a, const void *b) {
+  return strcmp(((const RomfsNode *)a)->name, ((const RomfsNode *)b)->name);
+}
+
+
+// Read a directory and its subdirectories. The current path is in b->path.
+static int romfs__scan_dir(RomfsBuilder *b, RomfsNode *dir) {
+  EvfsDir *dh;
+  EvfsInfo info;
+  size_t alloc_children = 0;
+
+  int status = evfs_open_dir_ex(b->path, &dh, b->cfg->src_vfs);
+  if(status != EVFS_OK) return status;
+
+  while((status = evfs_dir_read(dh, &info)) == EVFS_OK) {
+    if(!strcmp(info.name, ".") || !strcmp(info.name, ".."))
+      continue;
+
+    if(info.type & EVFS_FILE_SYM_LINK)
+      continue;
+
+    if(strlen(info.name) >= EVFS_ROMFS_MAX_NAME_LEN) { // Mounts couldn't read this name
+      status = EVFS_ERR_TOO_LONG;
+      break;
+    }
+
+    if(dir->num_children == alloc_children) { // Grow child array
+      size_t new_alloc = alloc_children ? alloc_children * 2 : 8;
+      RomfsNode *children = evfs_malloc(new_alloc * sizeof(*children));
+      if(MEM_CHECK(children)) {
+        status = EVFS_ERR_ALLOC;
+        break;
+      }
+
+      if(dir->children) {
+        memcpy(children, dir->children, dir->num_children * sizeof(*children));
+        evfs_free(dir->children);
+      }
+      dir->children = children;
+      alloc_children = new_alloc;
+    }
+
+    RomfsNode *node = &dir->children[dir->num_children];
+    memset(node, 0, sizeof(*node));
+
+    node->name = evfs_malloc(strlen(info.name)+1);
+    if(MEM_CHECK(node->name)) {
+      status = EVFS_ERR_ALLOC;
+      break;
+    }
+    strcpy(node->name, info.name);
+    node->is_dir = info.type & EVFS_FILE_DIR;
+    dir->num_children++;
+  }
+
+  evfs_dir_close(dh);
+
+  if(status != EVFS_DONE)
+    return status;
+
+  if(dir->num_children > 1)
+    qsort(dir->children, dir->num_children, sizeof(*dir->children), romfs__compare_nodes);
+
+  // Get file sizes and descend into subdirectories
+  // Not every VFS reports the size from evfs_dir_read()
+  size_t path_len = strlen(b->path);
+  for(size_t i = 0; i < dir->num_children; i++) {
+    RomfsNode *node = &dir->children[i];
+
+    if(!romfs__push_path(b, path_len, node->name))
+      return EVFS_ERR_TOO_LONG;
+
+    if(node->is_dir) {
+      status = romfs__scan_dir(b, node);
+    } else {
+      status = evfs_stat_ex(b->path, &info, b->cfg->src_vfs);
+      node->size = info.size;
+    }
+    b->path[path_len] = '\0';
+    if(status != EVFS_OK) return status;
+  }
+
+  return EVFS_OK;
+}
+
+
+// ******************** Layout ********************
+
+static evfs_off_t romfs__file_header_pos(RomfsBuilder *b, RomfsNode *node) {
+  evfs_off_t hdr_len = header_len(node->name);
+
+  // Pad before the header so that the data after it is aligned
+  return align_up(b->pos + hdr_len, b->data_align) - hdr_len;
+}
+
+
+static void romfs__layout_dir(RomfsBuilder *b, RomfsNode *dir) {
+  dir->dot_pos = b->pos;
+  b->pos += header_len(".") + header_len("..");
+
+  for(size_t i = 0; i < dir->num_children; i++) {
+    RomfsNode *node = &dir->children[i];
+
+    if(node->is_dir) {
+      node->hdr_pos = b->pos;
+      b->pos += header_len(node->name);
+    } else {
+      node->hdr_pos = romfs__file_header_pos(b, node);
+      b->pos = align_up(node->hdr_pos + header_len(node->name) + node->size, 16);
+    }
+  }
+
+  for(size_t i = 0; i < dir->num_children; i++) {
+    if(dir->children[i].is_dir)
+      romfs__layout_dir(b, &dir->children[i]);
+  }
+}
+
+
+// ******************** Image output ********************
+
+static int romfs__write(RomfsBuilder *b, const void *buf, size_t size) {
+  // Keep a copy of the bytes needed for the superblock checksum
+  if(b->pos < ROMFS_SUPERBLOCK_SUM_LEN) {
+    size_t head_size = MIN(size, (size_t)(ROMFS_SUPERBLOCK_SUM_LEN - b->pos));
+    memcpy(&b->head[b->pos], buf, head_size);
+  }
+
+  ptrdiff_t wrote = evfs_file_write(b->image, buf, size);
+  if(wrote < 0) return wrote;
+  if((size_t)wrote != size) return EVFS_ERR_IO;
+
+  b->pos += size;
+  return EVFS_OK;
+}
+
+
+static int romfs__pad_to(RomfsBuilder *b, evfs_off_t pos) {
+  memset(b->copy_buf, 0, sizeof b->copy_buf);
+
+  while(b->pos < pos) {
+    size_t size = MIN((evfs_off_t)sizeof b->copy_buf, pos - b->pos);
+    int status = romfs__write(b, b->copy_buf, size);
+    if(status != EVFS_OK) return status;
+  }
+
+  return EVFS_OK;
+}
+
+
+static int romfs__write_header(RomfsBuilder *b, evfs_off_t pos, evfs_off_t next, unsigned type,
+                               evfs_off_t spec_info, evfs_off_t size, const char *name) {
+  uint8_t hdr[ROMFS_MAX_HEADER_SIZE];
+  evfs_off_t hdr_len = header_len(name);
+
+  int status = romfs__pad_to(b, pos);
+  if(status != EVFS_OK) return status;
+
+  memset(hdr, 0, sizeof hdr);
+  set_unaligned_u32be(next | type, &hdr[0]);
+  set_unaligned_u32be(spec_info, &hdr[4]);
+  set_unaligned_u32be(size, &hdr[8]);
+  strcpy((char *)&hdr[16], name);
+
+  uint32_t checksum = sum32_be(0, hdr, hdr_len / 4);
+  set_unaligned_u32be(-checksum, &hdr[12]);
+
+  return romfs__write(b, hdr, hdr_len);
+}
+
+
+static int romfs__write_file_data(RomfsBuilder *b, RomfsNode *node) {
+  EvfsFile *fh;
+  evfs_off_t remaining = node->size;
+
+  int status = evfs_open_ex(b->path, &fh, EVFS_READ, b->cfg->src_vfs);
+  if(status != EVFS_OK) return status;
+
+  while(remaining > 0) {
+    size_t size = MIN((evfs_off_t)sizeof b->copy_buf, remaining);
+    ptrdiff_t rval = evfs_file_read(fh, b->copy_buf, size);
+    if(rval <= 0) { // File shrank since the tree was scanned
+      status = rval < 0 ? rval : EVFS_ERR_IO;
+      break;
+    }
+
+    status = romfs__write(b, b->copy_buf, rval);
+    if(status != EVFS_OK) break;
+    remaining -= rval;
+  }
+
+  evfs_file_close(fh);
+  return status;
+}
+
+
+static int romfs__write_dir(RomfsBuilder *b, RomfsNode *dir, evfs_off_t parent_pos) {
+  int status;
+  evfs_off_t dotdot_pos = dir->dot_pos + header_len(".");
+  evfs_off_t first_pos = dir->num_children > 0 ? dir->children[0].hdr_pos : 0;
+
+  // The root "." is the root directory itself. Other dots are links.
+  if(dir->hdr_pos == dir->dot_pos)
+    status = romfs__write_header(b, dir->dot_pos, dotdot_pos, FILE_TYPE_DIRECTORY, dir->dot_pos, 0, ".");
+  else
+    status = romfs__write_header(b, dir->dot_pos, dotdot_pos, FILE_TYPE_HARD_LINK, dir->hdr_pos, 0, ".");
+  if(status != EVFS_OK) return status;
+
+  status = romfs__write_header(b, dotdot_pos, first_pos, FILE_TYPE_HARD_LINK, parent_pos, 0, "..");
+  if(status != EVFS_OK) return status;
+
+  size_t path_len = strlen(b->path);
+
+  for(size_t i = 0; i < dir->num_children; i++) {
+    RomfsNode *node = &dir->children[i];
+    evfs_off_t next_pos = i+1 < dir->num_children ? dir->children[i+1].hdr_pos : 0;
+
+    if(node->is_dir) {
+      status = romfs__write_header(b, node->hdr_pos, next_pos, FILE_TYPE_DIRECTORY, node->dot_pos, 0,
+                                   node->name);
+      if(status != EVFS_OK) return status;
+      continue;
+    }
+
+    status = romfs__write_header(b, node->hdr_pos, next_pos, FILE_TYPE_REGULAR_FILE, 0, node->size,
+                                 node->name);
+    if(status != EVFS_OK) return status;
+
+    if(!romfs__push_path(b, path_len, node->name))
+      return EVFS_ERR_TOO_LONG;
+    status = romfs__write_file_data(b, node);
+    b->path[path_len] = '\0';
+    if(status != EVFS_OK) return status;
+
+    status = romfs__pad_to(b, align_up(b->pos, 16));
+    if(status != EVFS_OK) return status;
+  }
+
+  for(size_t i = 0; i < dir->num_children; i++) {
+    RomfsNode *node = &dir->children[i];
+    if(!node->is_dir)
+      continue;
+
+    if(!romfs__push_path(b, path_len, node->name))
+      return EVFS_ERR_TOO_LONG;
+    status = romfs__write_dir(b, node, dir->hdr_pos);
+    b->path[path_len] = '\0';
+    if(status != EVFS_OK) return status;
+  }
+
+  return EVFS_OK;
+}
+
+
+/*
+Build a Romfs image from a directory tree
+
+Directory entries are sorted by name so images can be used with
+EVFS_USE_ROMFS_SORTED_DIRS. File data starts on a multiple of cfg->data_align
+bytes from the start of the image. Symbolic links are skipped.
+
+Args:
+  src_dir:  Root of the tree to copy into the image
+  image:    Opened file to write the image into. Must support seeking.
+  cfg:      Build options. Use NULL for defaults
+
+Returns:
+  EVFS_OK on success
+*/
+int romfs_build_image(const char *src_dir, EvfsFile *image, const RomfsBuildConfig *cfg) {
+  if(PTR_CHECK(src_dir) || PTR_CHECK(image)) return EVFS_ERR_BAD_ARG;
+
+  RomfsBuildConfig default_cfg = {0};
+  if(!cfg)
+    cfg = &default_cfg;
+
+  const char *volume_name = cfg->volume_name ? cfg->volume_name : "evfs";
+  size_t data_align = cfg->data_align ? cfg->data_align : 16;
+
+  if(data_align < 16 || (data_align & (data_align-1)) != 0)
+    THROW(EVFS_ERR_BAD_ARG);
+  if(strlen(volume_name) >= EVFS_ROMFS_MAX_NAME_LEN)
+    THROW(EVFS_ERR_TOO_LONG);
+
+  RomfsBuilder *b = evfs_malloc(sizeof(*b));
+  if(MEM_CHECK(b)) return EVFS_ERR_ALLOC;
+  memset(b, 0, sizeof(*b));
+
+  b->cfg = cfg;
+  b->image = image;
+  b->data_align = data_align;
+
+  RomfsNode root = {0};
+  int status = EVFS_OK;
+
+  if(strlen(src_dir) >= sizeof b->path)
+    status = EVFS_ERR_TOO_LONG;
+  else
+    strcpy(b->path, src_dir);
+
+  if(status == EVFS_OK)
+    status = romfs__scan_dir(b, &root);
+
+  if(status == EVFS_OK) {
+    // Root dir starts at first file header
+    b->pos = header_len(volume_name);
+    root.hdr_pos = b->pos;
+    romfs__layout_dir(b, &root);
+
+    evfs_off_t image_size = align_up(b->pos, ROMFS_IMAGE_PAD);
+    if((uint64_t)image_size > UINT32_MAX)
+      status = EVFS_ERR_OVERFLOW;
+
+    // Superblock
+    uint8_t sb[ROMFS_MAX_HEADER_SIZE] = {0};
+    memcpy(sb, "-rom1fs-", 8);
+    set_unaligned_u32be(image_size, &sb[8]);
+    strcpy((char *)&sb[16], volume_name);
+
+    b->pos = 0;
+    if(status == EVFS_OK)
+      status = evfs_file_rewind(image);
+    if(status == EVFS_OK)
+      status = romfs__write(b, sb, header_len(volume_name));
+    if(status == EVFS_OK)
+      status = romfs__write_dir(b, &root, root.hdr_pos);
+    if(status == EVFS_OK)
+      status = romfs__pad_to(b, image_size);
+
+    if(status == EVFS_OK) { // Patch in the checksum
+      uint32_t checksum = sum32_be(0, b->head, ROMFS_SUPERBLOCK_SUM_LEN / 4);
+
+      uint8_t sum_buf[4];
+      set_unaligned_u32be(-checksum, sum_buf);
+      status = evfs_file_seek(image, 12, EVFS_SEEK_TO);
+      if(status == EVFS_OK && evfs_file_write(image, sum_buf, sizeof sum_buf) != sizeof sum_buf)
+        status = EVFS_ERR_IO;
+      if(status == EVFS_OK)
+        status = evfs_file_seek(image, image_size, EVFS_SEEK_TO);
+    }
+  }
+
+  romfs__free_tree(&root);
+  evfs_free(b);
+
+  return status;
+}
+
+
+/*
+Write a Romfs image as C source for evfs_register_rsrc_romfs()
+
+The output defines "const unsigned char <array_name>[]" and
+"const unsigned int <array_name>_len" in the same form as "xxd -i".
+
+Args:
+  image:      Image to convert. Read from the start.
+  c_file:     Opened file for the C source
+  array_name: Name of the generated array
+  align:      Alignment of the array in memory. Use the data_align of the
+              image for aligned file data. 0 for no alignment attribute.
+
+Returns:
+  EVFS_OK on success
+*/
+int romfs_image_to_c_array(EvfsFile *image, EvfsFile *c_file, const char *array_name, size_t align) {
+  if(PTR_CHECK(image) || PTR_CHECK(c_file) || PTR_CHECK(array_name)) return EVFS_ERR_BAD_ARG;
+
+  uint8_t buf[12 * 64]; // Multiple of bytes per line
+  evfs_off_t offset = 0;
+  ptrdiff_t rval;
+  int status;
+
+  if(align > 0)
+    status = evfs_file_printf(c_file, "__attribute__((aligned(%u)))\nconst unsigned char %s[] = {\n",
+                              (unsigned)align, array_name);
+  else
+    status = evfs_file_printf(c_file, "const unsigned char %s[] = {\n", array_name);
+  if(status < 0) return status;
+
+  while((rval = evfs_file_read_at(image, buf, sizeof buf, offset)) > 0) {
+    for(ptrdiff_t i = 0; i < rval; i += 12) {
+      char line[12*6 + 4];
+      AppendRange line_r;
+      range_init(&line_r, line, sizeof line);
+
+      range_cat_str(&line_r, " ");
+      for(ptrdiff_t j = i; j < i+12 && j < rval; j++) {
+        range_cat_fmt(&line_r, " 0x%02x,", buf[j]);
+      }
+      range_cat_char(&line_r, '\n');
+
+      status = evfs_file_puts(c_file, line);
+      if(status < 0) return status;
+    }
+
+    offset += rval;
+  }
+
+  if(rval < 0) return rval;
+
+  status = evfs_file_printf(c_file, "};\nconst unsigned int %s_len = %lu;\n", array_name,
+                            (unsigned long)offset);
+
+  return status < 0 ? status : EVFS_OK;
+}
@@ -0,0 +1,679 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Buffer shim VFS
+
+  This adds a buffer to each open file of an underlying VFS. The buffer holds
+  either pending write data or read-ahead data, never both. Small sequential
+  writes are combined and written out when the buffer fills or the file is
+  synced, seeked, or closed. Reads that continue where the last one ended
+  double the read-ahead window up to the buffer size. Any other access resets
+  the window. Transfers larger than the buffer bypass it. Files advised as
+  sequential always read ahead a full buffer and random files never grow
+  the window.
+------------------------------------------------------------------------------
+*/
+
+#include <string.h>
+
+#include "evfs.h"
+#include "evfs_internal.h"
+#include "evfs/shim/shim_buffer.h"
+
+
+// Access objects allocated in a single block of memory
+#define NEXT_OBJ(o) (&(o)[1])
+
+#define DEFAULT_BUFFER_SIZE   512
+#define MIN_BUFFER_SIZE       16
+#define MIN_READ_AHEAD        64
+
+// Position of the base file isn't known
+#define UNKNOWN_POS   (-1)
+
+#ifdef EVFS_USE_IO_STATS
+#  define COUNT_HIT(fil)    ((fil)->hits++)
+#  define COUNT_MISS(fil)   ((fil)->misses++)
+#else
+#  define COUNT_HIT(fil)
+#  define COUNT_MISS(fil)
+#endif
+
+
+typedef struct BufferData {
+  Evfs       *base_vfs;
+  const char *vfs_name;
+  Evfs       *shim_vfs;
+
+  size_t      buf_size;   // Buffer size for new files
+} BufferData;
+
+typedef struct BufferFile {
+  EvfsFile    base;
+  BufferData *shim_data;
+  EvfsFile   *base_file;
+
+  uint8_t    *buf;
+  size_t      buf_size;
+  evfs_off_t  buf_pos;    // File offset of buf[0]
+  size_t      buf_len;    // Valid bytes in buf
+  size_t      read_ahead; // Current read-ahead window
+  unsigned    advice;     // EVFS_CMD_SET_FILE_ADVICE
+
+  evfs_off_t  pos;        // Logical file position
+  evfs_off_t  base_pos;   // Position of base_file or UNKNOWN_POS
+
+  bool        dirty;      // buf holds unwritten data
+  bool        append;
+  bool        eof;
+
+#ifdef EVFS_USE_IO_STATS
+  uint32_t    hits;       // Reads copied from buf
+  uint32_t    misses;     // Reads that went to base_file
+#endif
+} BufferFile;
+
+
+
+// ******************** Buffer management ********************
+
+static int buffer_base_seek(BufferFile *fil, evfs_off_t offset) {
+  if(fil->base_pos == offset)
+    return EVFS_OK;
+
+  int status = fil->base_file->methods->m_seek(fil->base_file, offset, EVFS_SEEK_TO);
+  fil->base_pos = (status == EVFS_OK) ? offset : UNKNOWN_POS;
+  return status;
+}
+
+
+// Write out pending data
+static int buffer_flush(BufferFile *fil) {
+  if(!fil->dirty)
+    return EVFS_OK;
+
+  EvfsFile *base_file = fil->base_file;
+  size_t len = fil->buf_len;
+
+  fil->dirty = false;
+  fil->buf_len = 0;
+
+  if(!fil->append) {
+    int status = buffer_base_seek(fil, fil->buf_pos);
+    if(status != EVFS_OK) return status;
+  }
+
+  ptrdiff_t wrote = base_file->methods->m_write(base_file, fil->buf, len);
+
+  if(fil->append) { // Writes always land at the end of the file
+    fil->base_pos = base_file->methods->m_tell(base_file);
+    fil->pos = fil->base_pos;
+  } else {
+    fil->base_pos = (wrote >= 0) ? fil->base_pos + wrote : UNKNOWN_POS;
+  }
+
+  if(wrote != (ptrdiff_t)len)
+    return wrote < 0 ? wrote : EVFS_ERR_IO;
+
+  return EVFS_OK;
+}
+
+
+// Discard read-ahead data
+static inline void buffer_invalidate(BufferFile *fil) {
+  if(!fil->dirty)
+    fil->buf_len = 0;
+}
+
+
+
+// ******************** File access methods ********************
+
+static int buffer__file_ctrl(EvfsFile *fh, int cmd, void *arg) {
+  BufferFile *fil = (BufferFile *)fh;
+
+  int status = fil->base_file->methods->m_ctrl(fil->base_file, cmd, arg);
+
+#ifdef EVFS_USE_IO_STATS
+  if(cmd == EVFS_CMD_GET_IO_STATS) {
+    EvfsIOStats *stats = (EvfsIOStats *)arg;
+    stats->cache_hits += fil->hits;
+    stats->cache_misses += fil->misses;
+    return EVFS_OK;
+  }
+#endif
+
+  if(cmd == EVFS_CMD_SET_FILE_ADVICE) {
+    unsigned *v = (unsigned *)arg;
+    fil->advice = *v;
+
+    // The hint is still used here when the base can't take it
+    if(status == EVFS_ERR_NO_SUPPORT)
+      status = EVFS_OK;
+  }
+
+  return status;
+}
+
+
+static int buffer__file_close(EvfsFile *fh) {
+  BufferFile *fil = (BufferFile *)fh;
+
+  int flush_status = buffer_flush(fil);
+  int status = fil->base_file->methods->m_close(fil->base_file);
+
+  evfs_free(fil->buf);
+  fil->buf = NULL;
+  fil->base.methods = NULL;
+
+  return flush_status != EVFS_OK ? flush_status : status;
+}
+
+
+static ptrdiff_t buffer__file_read(EvfsFile *fh, void *buf, size_t size) {
+  BufferFile *fil = (BufferFile *)fh;
+  EvfsFile *base_file = fil->base_file;
+  uint8_t *cbuf = (uint8_t *)buf;
+
+  int status = buffer_flush(fil);
+  if(status != EVFS_OK) return status;
+
+  ptrdiff_t read = 0;
+
+  while(size > 0) {
+    evfs_off_t buf_end = fil->buf_pos + fil->buf_len;
+
+    if(fil->buf_len > 0 && fil->pos >= fil->buf_pos && fil->pos < buf_end) { // Buffer hit
+      size_t offset = fil->pos - fil->buf_pos;
+      size_t copy_size = MIN(size, fil->buf_len - offset);
+      memcpy(cbuf, &fil->buf[offset], copy_size);
+      COUNT_HIT(fil);
+
+      cbuf += copy_size;
+      size -= copy_size;
+      fil->pos += copy_size;
+      read += copy_size;
+      continue;
+    }
+
+    // Grow the window while reads stay sequential
+    if(fil->advice == EVFS_ADVICE_SEQUENTIAL)
+      fil->read_ahead = fil->buf_size;
+    else if(fil->pos == buf_end && fil->advice != EVFS_ADVICE_RANDOM)
+      fil->read_ahead = MIN(fil->read_ahead * 2, fil->buf_size);
+    else
+      fil->read_ahead = MIN(MIN_READ_AHEAD, fil->buf_size);
+
+    COUNT_MISS(fil);
+    status = buffer_base_seek(fil, fil->pos);
+    if(status != EVFS_OK)
+      return read > 0 ? read : status;
+
+    ptrdiff_t rval;
+    if(size >= fil->read_ahead) { // Large reads bypass the buffer
+      rval = base_file->methods->m_read(base_file, cbuf, size);
+      if(rval < 0)
+        return read > 0 ? read : rval;
+
+      fil->base_pos += rval;
+
+      // Leave an empty buffer at the new position so the next read is seen as sequential
+      fil->pos += rval;
+      fil->buf_pos = fil->pos;
+      fil->buf_len = 0;
+      read += rval;
+
+      if((size_t)rval < size)
+        fil->eof = true;
+      break;
+    }
+
+    // Refill the buffer
+    rval = base_file->methods->m_read(base_file, fil->buf, fil->read_ahead);
+    if(rval < 0)
+      return read > 0 ? read : rval;
+
+    fil->base_pos += rval;
+    fil->buf_pos = fil->pos;
+    fil->buf_len = rval;
+
+    if(rval == 0) { // End of file
+      fil->eof = true;
+      break;
+    }
+  }
+
+  return read;
+}
+
+
+static ptrdiff_t buffer__file_write(EvfsFile *fh, const void *buf, size_t size) {
+  BufferFile *fil = (BufferFile *)fh;
+  EvfsFile *base_file = fil->base_file;
+  const uint8_t *cbuf = (const uint8_t *)buf;
+  int status;
+
+  buffer_invalidate(fil);
+
+  // Only contiguous writes are combined
+  if(fil->dirty && !fil->append && fil->pos != fil->buf_pos + (evfs_off_t)fil->buf_len) {
+    status = buffer_flush(fil);
+    if(status != EVFS_OK) return status;
+  }
+
+  ptrdiff_t wrote = 0;
+
+  while(size > 0) {
+    if(fil->buf_len == 0 && size >= fil->buf_size) { // Large writes bypass the buffer
+      if(!fil->append) {
+        status = buffer_base_seek(fil, fil->pos);
+        if(status != EVFS_OK)
+          return wrote > 0 ? wrote : status;
+      }
+
+      ptrdiff_t rval = base_file->methods->m_write(base_file, cbuf, size);
+      if(rval < 0) {
+        fil->base_pos = UNKNOWN_POS;
+        return wrote > 0 ? wrote : rval;
+      }
+
+      if(fil->append) {
+        fil->base_pos = base_file->methods->m_tell(base_file);
+        fil->pos = fil->base_pos;
+      } else {
+        fil->base_pos += rval;
+        fil->pos += rval;
+      }
+
+      wrote += rval;
+      break;
+    }
+
+    if(fil->buf_len == 0)
+      fil->buf_pos = fil->pos;
+
+    size_t copy_size = MIN(size, fil->buf_size - fil->buf_len);
+    memcpy(&fil->buf[fil->buf_len], cbuf, copy_size);
+    fil->buf_len += copy_size;
+    fil->dirty = true;
+
+    cbuf += copy_size;
+    size -= copy_size;
+    fil->pos += copy_size;
+    wrote += copy_size;
+
+    if(fil->buf_len == fil->buf_size) {
+      status = buffer_flush(fil);
+      if(status != EVFS_OK)
+        return status;
+    }
+  }
+
+  return wrote;
+}
+
+
+static ptrdiff_t buffer__file_read_at(EvfsFile *fh, void *buf, size_t size, evfs_off_t offset) {
+  BufferFile *fil = (BufferFile *)fh;
+
+  int status = buffer_flush(fil);
+  if(status != EVFS_OK) return status;
+
+  // Serve from the read-ahead buffer when it holds the whole range
+  if(fil->buf_len > 0 && offset >= fil->buf_pos &&
+      offset + (evfs_off_t)size <= fil->buf_pos + (evfs_off_t)fil->buf_len) {
+    memcpy(buf, &fil->buf[offset - fil->buf_pos], size);
+    COUNT_HIT(fil);
+    return size;
+  }
+
+  COUNT_MISS(fil);
+  ptrdiff_t rval = evfs_file_read_at(fil->base_file, buf, size, offset);
+  fil->base_pos = UNKNOWN_POS;
+  return rval;
+}
+
+
+static ptrdiff_t buffer__file_write_at(EvfsFile *fh, const void *buf, size_t size, evfs_off_t offset) {
+  BufferFile *fil = (BufferFile *)fh;
+
+  int status = buffer_flush(fil);
+  if(status != EVFS_OK) return status;
+
+  buffer_invalidate(fil);
+
+  ptrdiff_t rval = evfs_file_write_at(fil->base_file, buf, size, offset);
+  fil->base_pos = UNKNOWN_POS;
+  return rval;
+}
+
+
+static int buffer__file_truncate(EvfsFile *fh, evfs_off_t size) {
+  BufferFile *fil = (BufferFile *)fh;
+
+  int status = buffer_flush(fil);
+  if(status != EVFS_OK) return status;
+
+  buffer_invalidate(fil);
+  fil->base_pos = UNKNOWN_POS;
+
+  return fil->base_file->methods->m_truncate(fil->base_file, size);
+}
+
+
+static int buffer__file_sync(EvfsFile *fh) {
+  BufferFile *fil = (BufferFile *)fh;
+
+  int status = buffer_flush(fil);
+  if(status != EVFS_OK) return status;
+
+  return fil->base_file->methods->m_sync(fil->base_file);
+}
+
+
+static evfs_off_t buffer__file_size(EvfsFile *fh) {
+  BufferFile *fil = (BufferFile *)fh;
+
+  evfs_off_t size = fil->base_file->methods->m_size(fil->base_file);
+
+  // Include pending data that extends the file
+  if(fil->dirty && !fil->append)
+    size = MAX(size, fil->buf_pos + (evfs_off_t)fil->buf_len);
+
+  return size;
+}
+
+
+static int buffer__file_seek(EvfsFile *fh, evfs_off_t offset, EvfsSeekDir origin) {
+  BufferFile *fil = (BufferFile *)fh;
+
+  int status = buffer_flush(fil);
+  if(status != EVFS_OK) return status;
+
+  // Read-ahead data is kept in case the new position lands inside it
+  fil->pos = evfs__absolute_offset(fh, offset, origin);
+  fil->eof = false;
+
+  return EVFS_OK;
+}
+
+
+static evfs_off_t buffer__file_tell(EvfsFile *fh) {
+  BufferFile *fil = (BufferFile *)fh;
+
+  return fil->pos;
+}
+
+
+static bool buffer__file_eof(EvfsFile *fh) {
+  BufferFile *fil = (BufferFile *)fh;
+
+  return fil->eof;
+}
+
+
+static int buffer__file_map(EvfsFile *fh, evfs_off_t offset, size_t size, EvfsMapping *map) {
+  BufferFile *fil = (BufferFile *)fh;
+
+  int status = buffer_flush(fil);
+  if(status != EVFS_OK) return status;
+
+  return evfs_file_map(fil->base_file, offset, size, map);
+}
+
+
+static int buffer__file_unmap(EvfsFile *fh, EvfsMapping *map) {
+  BufferFile *fil = (BufferFile *)fh;
+
+  return evfs_file_unmap(fil->base_file, map);
+}
+
+
+static int buffer__file_discard(EvfsFile *fh, evfs_off_t offset, evfs_off_t size) {
+  BufferFile *fil = (BufferFile *)fh;
+
+  // Pending writes land before the range is released and read-ahead is dropped
+  int status = buffer_flush(fil);
+  if(status != EVFS_OK) return status;
+
+  buffer_invalidate(fil);
+
+  return evfs_file_discard(fil->base_file, offset, size);
+}
+
+
+static const EvfsFileMethods s_buffer_methods = {
+  .m_ctrl     = buffer__file_ctrl,
+  .m_close    = buffer__file_close,
+  .m_read     = buffer__file_read,
+  .m_write    = buffer__file_write,
+  .m_truncate = buffer__file_truncate,
+  .m_sync     = buffer__file_sync,
+  .m_size     = buffer__file_size,
+  .m_seek     = buffer__file_seek,
+  .m_tell     = buffer__file_tell,
+  .m_eof      = buffer__file_eof,
+  .m_read_at  = buffer__file_read_at,
+  .m_write_at = buffer__file_write_at,
+  .m_map      = buffer__file_map,
+  .m_unmap    = buffer__file_unmap,
+  .m_discard  = buffer__file_discard
+};
+
+
+
+// ******************** FS access methods ********************
+
+static int buffer__open(Evfs *vfs, const char *path, EvfsFile *fh, int flags) {
+  BufferFile *fil = (BufferFile *)fh;
+  BufferData *shim_data = (BufferData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  fil->shim_data = shim_data;
+  fil->base_file = (EvfsFile *)NEXT_OBJ(fil);  // We have two objects allocated together [BufferFile][<base VFS file size>]
+
+  fil->buf_size = shim_data->buf_size;
+  fil->buf = evfs_malloc(fil->buf_size);
+  if(MEM_CHECK(fil->buf)) {
+    fh->methods = NULL;
+    return EVFS_ERR_ALLOC;
+  }
+
+  int status = base_vfs->m_open(base_vfs, path, fil->base_file, flags);
+
+  if(status == EVFS_OK && !fil->base_file->methods)
+    status = EVFS_ERR_INIT;
+
+  if(status == EVFS_OK) {
+    fil->buf_pos    = 0;
+    fil->buf_len    = 0;
+    fil->read_ahead = MIN(MIN_READ_AHEAD, fil->buf_size);
+    fil->advice     = EVFS_ADVICE_NORMAL;
+    fil->pos        = fil->base_file->methods->m_tell(fil->base_file);
+    fil->base_pos   = fil->pos;
+    fil->dirty      = false;
+    fil->append     = flags & EVFS_APPEND;
+    fil->eof        = false;
+#ifdef EVFS_USE_IO_STATS
+    fil->hits       = 0;
+    fil->misses     = 0;
+#endif
+
+    // Add methods to make this functional
+    fh->methods = &s_buffer_methods;
+
+  } else { // Open failed
+    evfs_free(fil->buf);
+    fil->buf = NULL;
+    fh->methods = NULL;
+  }
+
+  return status;
+}
+
+
+static int buffer__stat(Evfs *vfs, const char *path, EvfsInfo *info) {
+  BufferData *shim_data = (BufferData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_stat(base_vfs, path, info);
+}
+
+
+static int buffer__delete(Evfs *vfs, const char *path) {
+  BufferData *shim_data = (BufferData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_delete(base_vfs, path);
+}
+
+
+static int buffer__rename(Evfs *vfs, const char *old_path, const char *new_path) {
+  BufferData *shim_data = (BufferData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_rename(base_vfs, old_path, new_path);
+}
+
+
+static int buffer__make_dir(Evfs *vfs, const char *path) {
+  BufferData *shim_data = (BufferData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_make_dir(base_vfs, path);
+}
+
+
+// Directories aren't buffered so the base VFS object is used directly
+static int buffer__open_dir(Evfs *vfs, const char *path, EvfsDir *dh) {
+  BufferData *shim_data = (BufferData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_open_dir(base_vfs, path, dh);
+}
+
+
+static int buffer__get_cur_dir(Evfs *vfs, StringRange *cur_dir) {
+  BufferData *shim_data = (BufferData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_get_cur_dir(base_vfs, cur_dir);
+}
+
+
+static int buffer__set_cur_dir(Evfs *vfs, const char *path) {
+  BufferData *shim_data = (BufferData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_set_cur_dir(base_vfs, path);
+}
+
+
+static int buffer__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
+  BufferData *shim_data = (BufferData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  switch(cmd) {
+    // We need special handling for EVFS_CMD_UNREGISTER.
+    // It can't pass through since we need to deallocate VFSs in the proper sequence
+    // to avoid corrupting the registered VFS linked list.
+    case EVFS_CMD_UNREGISTER:
+      evfs_free(vfs); // Free this buffer VFS
+      return EVFS_OK; break;
+
+    case EVFS_CMD_SET_BUFFER_SIZE:
+      {
+        // Only affects files opened after this
+        size_t *v = (size_t *)arg;
+        if(*v < MIN_BUFFER_SIZE)
+          return EVFS_ERR_BAD_ARG;
+
+        shim_data->buf_size = *v;
+      }
+      return EVFS_OK; break;
+
+    default: // Everything else passes to the underlying VFS
+      return base_vfs->m_vfs_ctrl(base_vfs, cmd, arg);
+      break;
+  }
+}
+
+
+static bool buffer__path_root_component(Evfs *vfs, const char *path, StringRange *root) {
+  BufferData *shim_data = (BufferData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_path_root_component(base_vfs, path, root);
+}
+
+
+/*
+Register a buffer filesystem shim
+
+Args:
+  vfs_name:      Name of new shim
+  old_vfs_name:  Existing VFS to wrap with shim
+  buf_size:      Size of the buffer for each open file. Use 0 for a default size
+  default_vfs:   Make this the default VFS when true
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_register_buffer(const char *vfs_name, const char *old_vfs_name, size_t buf_size, bool default_vfs) {
+  if(PTR_CHECK(vfs_name) || PTR_CHECK(old_vfs_name)) return EVFS_ERR_BAD_ARG;
+
+  Evfs *base_vfs, *shim_vfs;
+  BufferData *shim_data;
+
+  base_vfs = evfs_find_vfs(old_vfs_name);
+  if(PTR_CHECK(base_vfs)) return EVFS_ERR_NO_VFS;
+
+  if(buf_size == 0)
+    buf_size = DEFAULT_BUFFER_SIZE;
+  else if(buf_size < MIN_BUFFER_SIZE)
+    return EVFS_ERR_BAD_ARG;
+
+  // Construct a new VFS
+  // We have three objects allocated together [Evfs][BufferData][char[]]
+  size_t shim_size = sizeof(*shim_vfs) + sizeof(*shim_data) + strlen(vfs_name)+1;
+  shim_vfs = evfs_malloc(shim_size);
+  if(MEM_CHECK(shim_vfs)) return EVFS_ERR_ALLOC;
+
+  memset(shim_vfs, 0, shim_size);
+
+  shim_data = (BufferData *)NEXT_OBJ(shim_vfs);
+
+  shim_vfs->vfs_name = (char *)NEXT_OBJ(shim_data);
+  strcpy((char *)shim_vfs->vfs_name, vfs_name);
+
+  shim_data->base_vfs = base_vfs;
+  shim_data->vfs_name = shim_vfs->vfs_name;
+  shim_data->shim_vfs = shim_vfs;
+  shim_data->buf_size = buf_size;
+
+  shim_vfs->vfs_file_size = sizeof(BufferFile) + base_vfs->vfs_file_size;
+  shim_vfs->vfs_dir_size = base_vfs->vfs_dir_size;
+  shim_vfs->fs_data = shim_data;
+
+  shim_vfs->m_open = buffer__open;
+  shim_vfs->m_stat = buffer__stat;
+  shim_vfs->m_delete = buffer__delete;
+  shim_vfs->m_rename = buffer__rename;
+  shim_vfs->m_make_dir = buffer__make_dir;
+  shim_vfs->m_open_dir = buffer__open_dir;
+  shim_vfs->m_get_cur_dir = buffer__get_cur_dir;
+  shim_vfs->m_set_cur_dir = buffer__set_cur_dir;
+  shim_vfs->m_vfs_ctrl = buffer__vfs_ctrl;
+
+  shim_vfs->m_path_root_component = buffer__path_root_component;
+
+  return evfs_register(shim_vfs, default_vfs);
+}
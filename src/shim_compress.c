@@ -0,0 +1,958 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Compression shim VFS
+
+  Files are split into blocks of block_size logical bytes that are compressed
+  independently. Each stored block has a 4-byte header with its stored and
+  logical lengths. Blocks that don't shrink are stored raw. After the last
+  block is an index with the stored length of each block and a 16-byte footer
+  giving the block count, block size, and length of the last block:
+
+    [hdr][block 0] ... [hdr][block N-1] [index: N x u16] [footer]
+
+  Opening a file reads the footer and index to locate every block. If the
+  footer is missing because a writer was interrupted, the block headers are
+  walked to recover all complete blocks. Reads decompress one block at a time
+  into a cache. Writes collect in a tail buffer that is compressed and
+  committed as a block when it fills. The partial tail block, index, and
+  footer are written on sync and close. Committed blocks can't be rewritten
+  but truncation to any size is supported. All values are little-endian.
+
+  Data written through one handle is seen by other handles after it is
+  synced. Directory listings report stored sizes. Use evfs_stat() for the
+  logical size.
+------------------------------------------------------------------------------
+*/
+
+#include <string.h>
+
+#include "evfs.h"
+#include "evfs_internal.h"
+#include "evfs/util/lz4_block.h"
+#include "evfs/util/unaligned_access.h"
+#include "evfs/shim/shim_compress.h"
+
+
+// Access objects allocated in a single block of memory
+#define NEXT_OBJ(o) (&(o)[1])
+
+#define DEFAULT_BLOCK_SIZE  4096
+#define MIN_BLOCK_SIZE      64
+#define MAX_BLOCK_SIZE      32768
+
+#define BLOCK_HDR_SIZE      4
+#define INDEX_ENTRY_SIZE    2
+#define FOOTER_SIZE         16
+#define FOOTER_MAGIC        0x425A5645UL  // "EVZB"
+
+// No block in the cache
+#define NO_BLOCK  ((size_t)-1)
+
+
+typedef struct CompressData {
+  Evfs       *base_vfs;
+  const char *vfs_name;
+  Evfs       *shim_vfs;
+
+  size_t      block_size; // Block size for new files
+  const CompressCodec *codec;
+} CompressData;
+
+typedef struct CompressFile {
+  EvfsFile      base;
+  CompressData *shim_data;
+  EvfsFile     *base_file;
+
+  size_t        block_size;
+  evfs_off_t   *blocks;       // Stored offset of each committed block and the end of the last
+  size_t        block_count;  // Committed blocks
+  size_t        blocks_avail; // Capacity of blocks[] not counting the end offset
+
+  evfs_off_t    size;         // Logical size
+  evfs_off_t    pos;
+  evfs_off_t    stored_size;  // Size of the base file
+
+  void         *work;         // Codec scratch memory
+  uint8_t      *data;         // Decompressed block cache
+  size_t        cached_block; // Block held in data or NO_BLOCK
+  size_t        cached_len;
+  uint8_t      *stored;       // A block as stored with its header
+  uint8_t      *tail;         // Data after the committed blocks. Only for writable files
+  size_t        tail_len;
+
+  bool          writable;
+  bool          append;
+  bool          dirty;        // Footer in the base file is out of date
+  bool          eof;
+} CompressFile;
+
+typedef struct CompressFooter {
+  size_t  block_count;
+  size_t  block_size;
+  size_t  last_len;   // Logical length of the last block
+  uint32_t check;     // Checksum of the index
+} CompressFooter;
+
+
+static const CompressCodec s_lz4_codec = {
+  .work_size  = LZ4_WORK_SIZE,
+  .compress   = lz4_compress_block,
+  .decompress = lz4_decompress_block
+};
+
+
+
+// ******************** Block storage ********************
+
+static inline uint32_t index_check(uint32_t check, uint16_t entry) {
+  return check * 31 + entry;
+}
+
+
+static int compress_reserve_blocks(CompressFile *fil, size_t count) {
+  if(count <= fil->blocks_avail)
+    return EVFS_OK;
+
+  size_t avail = fil->blocks_avail ? fil->blocks_avail : 8;
+  while(avail < count)
+    avail *= 2;
+
+  evfs_off_t *blocks = evfs_malloc((avail+1) * sizeof(*blocks));
+  if(MEM_CHECK(blocks)) return EVFS_ERR_ALLOC;
+
+  if(fil->blocks) {
+    memcpy(blocks, fil->blocks, (fil->blocks_avail+1) * sizeof(*blocks));
+    evfs_free(fil->blocks);
+  } else {
+    blocks[0] = 0;
+  }
+
+  fil->blocks = blocks;
+  fil->blocks_avail = avail;
+  return EVFS_OK;
+}
+
+
+static bool compress_read_footer(EvfsFile *base_file, evfs_off_t stored_size, CompressFooter *footer) {
+  uint8_t buf[FOOTER_SIZE];
+
+  if(stored_size < FOOTER_SIZE)
+    return false;
+
+  if(evfs_file_read_at(base_file, buf, FOOTER_SIZE, stored_size - FOOTER_SIZE) != FOOTER_SIZE)
+    return false;
+
+  if(get_unaligned_u32le(&buf[0]) != FOOTER_MAGIC)
+    return false;
+
+  footer->block_count = get_unaligned_u32le(&buf[4]);
+  footer->block_size  = get_unaligned_u16le(&buf[8]);
+  footer->last_len    = get_unaligned_u16le(&buf[10]);
+  footer->check       = get_unaligned_u32le(&buf[12]);
+
+  return footer->block_count > 0 && footer->block_size >= MIN_BLOCK_SIZE &&
+          footer->block_size <= MAX_BLOCK_SIZE &&
+          footer->last_len > 0 && footer->last_len <= footer->block_size &&
+          (evfs_off_t)(footer->block_count * INDEX_ENTRY_SIZE + FOOTER_SIZE) <= stored_size;
+}
+
+
+// Load block offsets from the index
+static int compress_read_index(CompressFile *fil, CompressFooter *footer) {
+  int status = compress_reserve_blocks(fil, footer->block_count);
+  if(status != EVFS_OK) return status;
+
+  evfs_off_t index_pos = fil->stored_size - FOOTER_SIZE - footer->block_count * INDEX_ENTRY_SIZE;
+  uint8_t buf[128];
+  uint32_t check = footer->block_count;
+  evfs_off_t offset = 0;
+
+  for(size_t i = 0; i < footer->block_count; ) {
+    size_t entries = MIN(footer->block_count - i, sizeof(buf) / INDEX_ENTRY_SIZE);
+    ptrdiff_t rval = evfs_file_read_at(fil->base_file, buf, entries * INDEX_ENTRY_SIZE, index_pos);
+    if(rval != (ptrdiff_t)(entries * INDEX_ENTRY_SIZE))
+      return rval < 0 ? rval : EVFS_ERR_IO;
+
+    index_pos += rval;
+
+    for(size_t e = 0; e < entries; e++, i++) {
+      uint16_t stored_len = get_unaligned_u16le(&buf[e * INDEX_ENTRY_SIZE]);
+      check = index_check(check, stored_len);
+      fil->blocks[i] = offset;
+      offset += BLOCK_HDR_SIZE + stored_len;
+    }
+  }
+
+  fil->blocks[footer->block_count] = offset;
+
+  // Blocks must end where the index starts
+  if(check != footer->check ||
+      offset != fil->stored_size - FOOTER_SIZE - (evfs_off_t)(footer->block_count * INDEX_ENTRY_SIZE))
+    return EVFS_ERR_CORRUPTION;
+
+  fil->block_size = footer->block_size;
+  fil->block_count = footer->block_count;
+  fil->size = (evfs_off_t)(footer->block_count - 1) * footer->block_size + footer->last_len;
+
+  return EVFS_OK;
+}
+
+
+// Recover blocks from their headers when the footer is missing
+static int compress_scan_blocks(CompressFile *fil) {
+  evfs_off_t offset = 0;
+  size_t count = 0;
+  size_t block_size = 0;
+  evfs_off_t size = 0;
+
+  while(offset + BLOCK_HDR_SIZE <= fil->stored_size) {
+    uint8_t hdr[BLOCK_HDR_SIZE];
+    if(evfs_file_read_at(fil->base_file, hdr, sizeof(hdr), offset) != sizeof(hdr))
+      break;
+
+    size_t stored_len = get_unaligned_u16le(&hdr[0]);
+    size_t data_len   = get_unaligned_u16le(&hdr[2]);
+
+    if(data_len == 0 || data_len > MAX_BLOCK_SIZE || stored_len > data_len ||
+        offset + BLOCK_HDR_SIZE + (evfs_off_t)stored_len > fil->stored_size)
+      break;
+
+    if(count == 0)
+      block_size = data_len;
+    else if(data_len > block_size)
+      break;
+
+    int status = compress_reserve_blocks(fil, count+1);
+    if(status != EVFS_OK) return status;
+
+    fil->blocks[count++] = offset;
+    offset += BLOCK_HDR_SIZE + stored_len;
+    fil->blocks[count] = offset;
+    size += data_len;
+
+    if(data_len < block_size) // Only the last block is short
+      break;
+  }
+
+  if(count == 0)
+    return EVFS_ERR_CORRUPTION;
+
+  // A single block doesn't tell us the block size
+  if(count > 1 || block_size > fil->block_size)
+    fil->block_size = block_size;
+
+  fil->block_count = count;
+  fil->size = size;
+
+  return EVFS_OK;
+}
+
+
+static int compress_load_index(CompressFile *fil) {
+  fil->block_count = 0;
+  fil->size = 0;
+
+  if(fil->stored_size == 0)
+    return compress_reserve_blocks(fil, 0);
+
+  CompressFooter footer;
+  if(compress_read_footer(fil->base_file, fil->stored_size, &footer)) {
+    int status = compress_read_index(fil, &footer);
+    if(status != EVFS_ERR_CORRUPTION)
+      return status;
+  }
+
+  // Rewrite the footer if this is opened for writing
+  fil->dirty = true;
+  return compress_scan_blocks(fil);
+}
+
+
+static int compress_load_block(CompressFile *fil, size_t block) {
+  if(fil->cached_block == block)
+    return EVFS_OK;
+
+  evfs_off_t offset = fil->blocks[block];
+  size_t len = fil->blocks[block+1] - offset;
+
+  if(len < BLOCK_HDR_SIZE || len > BLOCK_HDR_SIZE + fil->block_size)
+    return EVFS_ERR_CORRUPTION;
+
+  ptrdiff_t rval = evfs_file_read_at(fil->base_file, fil->stored, len, offset);
+  if(rval != (ptrdiff_t)len)
+    return rval < 0 ? rval : EVFS_ERR_IO;
+
+  size_t stored_len = get_unaligned_u16le(&fil->stored[0]);
+  size_t data_len   = get_unaligned_u16le(&fil->stored[2]);
+
+  if(stored_len + BLOCK_HDR_SIZE != len || data_len > fil->block_size)
+    return EVFS_ERR_CORRUPTION;
+
+  fil->cached_block = NO_BLOCK;
+
+  if(stored_len == data_len) { // Raw block
+    memcpy(fil->data, &fil->stored[BLOCK_HDR_SIZE], data_len);
+  } else {
+    ptrdiff_t dlen = fil->shim_data->codec->decompress(&fil->stored[BLOCK_HDR_SIZE], stored_len,
+                                                       fil->data, fil->block_size);
+    if(dlen != (ptrdiff_t)data_len)
+      return EVFS_ERR_CORRUPTION;
+  }
+
+  fil->cached_block = block;
+  fil->cached_len = data_len;
+  return EVFS_OK;
+}
+
+
+// Store a block after the committed blocks
+static int compress_write_block(CompressFile *fil, const uint8_t *src, size_t len) {
+  int status = compress_reserve_blocks(fil, fil->block_count+1);
+  if(status != EVFS_OK) return status;
+
+  // Compressed data has to be smaller than the original or we store it raw
+  size_t stored_len = fil->shim_data->codec->compress(src, len, &fil->stored[BLOCK_HDR_SIZE],
+                                                      len-1, fil->work);
+  if(stored_len == 0) {
+    memcpy(&fil->stored[BLOCK_HDR_SIZE], src, len);
+    stored_len = len;
+  }
+
+  set_unaligned_u16le(stored_len, &fil->stored[0]);
+  set_unaligned_u16le(len, &fil->stored[2]);
+
+  evfs_off_t offset = fil->blocks[fil->block_count];
+  size_t total = BLOCK_HDR_SIZE + stored_len;
+
+  ptrdiff_t wrote = evfs_file_write_at(fil->base_file, fil->stored, total, offset);
+  if(wrote != (ptrdiff_t)total)
+    return wrote < 0 ? wrote : EVFS_ERR_IO;
+
+  fil->blocks[fil->block_count+1] = offset + total;
+  fil->stored_size = MAX(fil->stored_size, offset + (evfs_off_t)total);
+
+  return EVFS_OK;
+}
+
+
+// Commit a full tail buffer as a new block
+static int compress_commit_tail(CompressFile *fil) {
+  int status = compress_write_block(fil, fil->tail, fil->tail_len);
+  if(status != EVFS_OK) return status;
+
+  fil->block_count++;
+  fil->tail_len = 0;
+
+  // The committed data becomes the cached block
+  uint8_t *data = fil->data;
+  fil->data = fil->tail;
+  fil->tail = data;
+  fil->cached_block = fil->block_count-1;
+  fil->cached_len = fil->block_size;
+
+  return EVFS_OK;
+}
+
+
+// Write the tail block, index, and footer
+static int compress_flush(CompressFile *fil) {
+  if(!fil->dirty)
+    return EVFS_OK;
+
+  int status;
+  EvfsFile *base_file = fil->base_file;
+
+  if(fil->size == 0) { // Empty files have no footer
+    status = base_file->methods->m_truncate(base_file, 0);
+    if(status != EVFS_OK) return status;
+
+    fil->stored_size = 0;
+    fil->dirty = false;
+    return EVFS_OK;
+  }
+
+  size_t count = fil->block_count;
+  size_t last_len = fil->block_size;
+
+  if(fil->tail_len > 0) { // Stored but not committed so it can still grow
+    status = compress_write_block(fil, fil->tail, fil->tail_len);
+    if(status != EVFS_OK) return status;
+
+    count++;
+    last_len = fil->tail_len;
+  }
+
+  // The stored block buffer is free to assemble the index
+  uint8_t *buf = fil->stored;
+  size_t buf_size = fil->block_size + BLOCK_HDR_SIZE;
+  size_t buf_len = 0;
+  evfs_off_t end = fil->blocks[count];
+  uint32_t check = count;
+  ptrdiff_t wrote;
+
+  for(size_t i = 0; i < count; i++) {
+    uint16_t stored_len = fil->blocks[i+1] - fil->blocks[i] - BLOCK_HDR_SIZE;
+    check = index_check(check, stored_len);
+    set_unaligned_u16le(stored_len, &buf[buf_len]);
+    buf_len += INDEX_ENTRY_SIZE;
+
+    if(buf_len + INDEX_ENTRY_SIZE > buf_size) {
+      wrote = evfs_file_write_at(base_file, buf, buf_len, end);
+      if(wrote != (ptrdiff_t)buf_len)
+        return wrote < 0 ? wrote : EVFS_ERR_IO;
+
+      end += buf_len;
+      buf_len = 0;
+    }
+  }
+
+  if(buf_len + FOOTER_SIZE > buf_size) {
+    wrote = evfs_file_write_at(base_file, buf, buf_len, end);
+    if(wrote != (ptrdiff_t)buf_len)
+      return wrote < 0 ? wrote : EVFS_ERR_IO;
+
+    end += buf_len;
+    buf_len = 0;
+  }
+
+  uint8_t *footer = &buf[buf_len];
+  set_unaligned_u32le(FOOTER_MAGIC, &footer[0]);
+  set_unaligned_u32le(count, &footer[4]);
+  set_unaligned_u16le(fil->block_size, &footer[8]);
+  set_unaligned_u16le(last_len, &footer[10]);
+  set_unaligned_u32le(check, &footer[12]);
+  buf_len += FOOTER_SIZE;
+
+  wrote = evfs_file_write_at(base_file, buf, buf_len, end);
+  if(wrote != (ptrdiff_t)buf_len)
+    return wrote < 0 ? wrote : EVFS_ERR_IO;
+
+  end += buf_len;
+
+  // Drop anything left over from a longer version of the file
+  if(fil->stored_size > end) {
+    status = base_file->methods->m_truncate(base_file, end);
+    if(status != EVFS_OK) return status;
+  }
+
+  fil->stored_size = end;
+  fil->dirty = false;
+
+  return EVFS_OK;
+}
+
+
+// Write data at or after the committed blocks. buf is NULL to write zeros.
+static ptrdiff_t compress_write_data(CompressFile *fil, const uint8_t *buf, size_t size,
+                                     evfs_off_t offset) {
+  size_t block_size = fil->block_size;
+
+  if(offset < (evfs_off_t)(fil->block_count * block_size))
+    return EVFS_ERR_NO_SUPPORT;
+
+  // Fill a gap past the end with zeros
+  if(offset > fil->size) {
+    ptrdiff_t rval = compress_write_data(fil, NULL, offset - fil->size, fil->size);
+    if(rval < 0) return rval;
+  }
+
+  ptrdiff_t wrote = 0;
+
+  while((size_t)wrote < size) {
+    size_t block_off = offset - fil->block_count * block_size;
+    size_t copy_size = MIN(size - wrote, block_size - block_off);
+
+    if(buf)
+      memcpy(&fil->tail[block_off], &buf[wrote], copy_size);
+    else
+      memset(&fil->tail[block_off], 0, copy_size);
+
+    wrote += copy_size;
+    offset += copy_size;
+    fil->tail_len = MAX(fil->tail_len, block_off + copy_size);
+    fil->size = MAX(fil->size, offset);
+    fil->dirty = true;
+
+    if(fil->tail_len == block_size) {
+      int status = compress_commit_tail(fil);
+      if(status != EVFS_OK)
+        return wrote > 0 ? wrote : status;
+    }
+  }
+
+  return wrote;
+}
+
+
+
+// ******************** File access methods ********************
+
+static int compress__file_ctrl(EvfsFile *fh, int cmd, void *arg) {
+  CompressFile *fil = (CompressFile *)fh;
+
+  return fil->base_file->methods->m_ctrl(fil->base_file, cmd, arg);
+}
+
+
+static int compress__file_close(EvfsFile *fh) {
+  CompressFile *fil = (CompressFile *)fh;
+
+  int flush_status = fil->writable ? compress_flush(fil) : EVFS_OK;
+  int status = fil->base_file->methods->m_close(fil->base_file);
+
+  evfs_free(fil->work);
+  evfs_free(fil->blocks);
+  fil->work = NULL;
+  fil->blocks = NULL;
+  fil->base.methods = NULL;
+
+  return flush_status != EVFS_OK ? flush_status : status;
+}
+
+
+static ptrdiff_t compress__file_read_at(EvfsFile *fh, void *buf, size_t size, evfs_off_t offset) {
+  CompressFile *fil = (CompressFile *)fh;
+  uint8_t *cbuf = (uint8_t *)buf;
+
+  if(offset >= fil->size)
+    return 0;
+
+  size = MIN((evfs_off_t)size, fil->size - offset);
+  ptrdiff_t read = 0;
+
+  while((size_t)read < size) {
+    size_t block = offset / fil->block_size;
+    size_t block_off = offset % fil->block_size;
+    const uint8_t *src;
+    size_t avail;
+
+    if(block >= fil->block_count) { // Uncommitted tail
+      src = fil->tail;
+      avail = fil->tail_len;
+    } else {
+      int status = compress_load_block(fil, block);
+      if(status != EVFS_OK)
+        return read > 0 ? read : status;
+
+      src = fil->data;
+      avail = fil->cached_len;
+    }
+
+    if(block_off >= avail) // Short block before the end
+      return read > 0 ? read : EVFS_ERR_CORRUPTION;
+
+    size_t copy_size = MIN(size - read, avail - block_off);
+    memcpy(&cbuf[read], &src[block_off], copy_size);
+    read += copy_size;
+    offset += copy_size;
+  }
+
+  return read;
+}
+
+
+static ptrdiff_t compress__file_read(EvfsFile *fh, void *buf, size_t size) {
+  CompressFile *fil = (CompressFile *)fh;
+
+  ptrdiff_t read = compress__file_read_at(fh, buf, size, fil->pos);
+  if(read < 0) return read;
+
+  fil->pos += read;
+  if((size_t)read < size)
+    fil->eof = true;
+
+  return read;
+}
+
+
+static ptrdiff_t compress__file_write_at(EvfsFile *fh, const void *buf, size_t size, evfs_off_t offset) {
+  CompressFile *fil = (CompressFile *)fh;
+
+  if(!fil->writable) return EVFS_ERR_DISABLED;
+
+  return compress_write_data(fil, (const uint8_t *)buf, size, offset);
+}
+
+
+static ptrdiff_t compress__file_write(EvfsFile *fh, const void *buf, size_t size) {
+  CompressFile *fil = (CompressFile *)fh;
+
+  if(!fil->writable) return EVFS_ERR_DISABLED;
+
+  if(fil->append)
+    fil->pos = fil->size;
+
+  ptrdiff_t wrote = compress_write_data(fil, (const uint8_t *)buf, size, fil->pos);
+  if(wrote > 0)
+    fil->pos += wrote;
+
+  return wrote;
+}
+
+
+static int compress__file_truncate(EvfsFile *fh, evfs_off_t size) {
+  CompressFile *fil = (CompressFile *)fh;
+
+  if(!fil->writable) return EVFS_ERR_DISABLED;
+
+  if(size >= fil->size) { // Extend with zeros
+    ptrdiff_t rval = compress_write_data(fil, NULL, size - fil->size, fil->size);
+    return rval < 0 ? rval : EVFS_OK;
+  }
+
+  size_t block = size / fil->block_size;
+  size_t keep = size % fil->block_size;
+
+  if(block < fil->block_count) { // Reopen a committed block as the tail
+    if(keep > 0) {
+      int status = compress_load_block(fil, block);
+      if(status != EVFS_OK) return status;
+
+      memcpy(fil->tail, fil->data, keep);
+    }
+
+    fil->block_count = block;
+    if(fil->cached_block != NO_BLOCK && fil->cached_block >= block)
+      fil->cached_block = NO_BLOCK;
+  }
+
+  fil->tail_len = keep;
+  fil->size = size;
+  fil->dirty = true;
+
+  return EVFS_OK;
+}
+
+
+static int compress__file_sync(EvfsFile *fh) {
+  CompressFile *fil = (CompressFile *)fh;
+
+  if(fil->writable) {
+    int status = compress_flush(fil);
+    if(status != EVFS_OK) return status;
+  }
+
+  return fil->base_file->methods->m_sync(fil->base_file);
+}
+
+
+static evfs_off_t compress__file_size(EvfsFile *fh) {
+  CompressFile *fil = (CompressFile *)fh;
+
+  return fil->size;
+}
+
+
+static int compress__file_seek(EvfsFile *fh, evfs_off_t offset, EvfsSeekDir origin) {
+  CompressFile *fil = (CompressFile *)fh;
+
+  fil->pos = evfs__absolute_offset(fh, offset, origin);
+  fil->eof = false;
+
+  return EVFS_OK;
+}
+
+
+static evfs_off_t compress__file_tell(EvfsFile *fh) {
+  CompressFile *fil = (CompressFile *)fh;
+
+  return fil->pos;
+}
+
+
+static bool compress__file_eof(EvfsFile *fh) {
+  CompressFile *fil = (CompressFile *)fh;
+
+  return fil->eof;
+}
+
+
+static const EvfsFileMethods s_compress_methods = {
+  .m_ctrl     = compress__file_ctrl,
+  .m_close    = compress__file_close,
+  .m_read     = compress__file_read,
+  .m_write    = compress__file_write,
+  .m_truncate = compress__file_truncate,
+  .m_sync     = compress__file_sync,
+  .m_size     = compress__file_size,
+  .m_seek     = compress__file_seek,
+  .m_tell     = compress__file_tell,
+  .m_eof      = compress__file_eof,
+  .m_read_at  = compress__file_read_at,
+  .m_write_at = compress__file_write_at
+};
+
+
+
+// ******************** FS access methods ********************
+
+static int compress__open(Evfs *vfs, const char *path, EvfsFile *fh, int flags) {
+  CompressFile *fil = (CompressFile *)fh;
+  CompressData *shim_data = (CompressData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  memset(fil, 0, sizeof(*fil));
+  fil->shim_data = shim_data;
+  fil->base_file = (EvfsFile *)NEXT_OBJ(fil);  // We have two objects allocated together [CompressFile][<base VFS file size>]
+
+  // The base file is read to load the tail block and appends are handled here
+  int base_flags = flags & ~EVFS_APPEND;
+  if(flags & EVFS_WRITE)
+    base_flags |= EVFS_READ;
+
+  int status = base_vfs->m_open(base_vfs, path, fil->base_file, base_flags);
+
+  if(status == EVFS_OK && !fil->base_file->methods)
+    status = EVFS_ERR_INIT;
+
+  if(status != EVFS_OK) {
+    fh->methods = NULL;
+    return status;
+  }
+
+  fil->writable     = flags & EVFS_WRITE;
+  fil->append       = flags & EVFS_APPEND;
+  fil->block_size   = shim_data->block_size;
+  fil->cached_block = NO_BLOCK;
+  fil->stored_size  = fil->base_file->methods->m_size(fil->base_file);
+
+  status = compress_load_index(fil);
+
+  if(status == EVFS_OK) {
+    // Buffers are allocated together [work][data][stored][tail]
+    size_t work_size = fil->writable ? (shim_data->codec->work_size + 7) & ~(size_t)7 : 0;
+    size_t buf_size = work_size + fil->block_size * 2 + BLOCK_HDR_SIZE;
+    if(fil->writable)
+      buf_size += fil->block_size;
+
+    uint8_t *buf = evfs_malloc(buf_size);
+    if(MEM_CHECK(buf)) {
+      status = EVFS_ERR_ALLOC;
+    } else {
+      fil->work   = buf;
+      fil->data   = buf + work_size;
+      fil->stored = fil->data + fil->block_size;
+      fil->tail   = fil->writable ? fil->stored + fil->block_size + BLOCK_HDR_SIZE : NULL;
+    }
+  }
+
+  // A short last block becomes the tail so it can be extended
+  if(status == EVFS_OK && fil->writable && fil->block_count > 0) {
+    size_t last = fil->block_count-1;
+    size_t last_len = fil->size - (evfs_off_t)last * fil->block_size;
+
+    if(last_len < fil->block_size) {
+      status = compress_load_block(fil, last);
+      if(status == EVFS_OK) {
+        memcpy(fil->tail, fil->data, last_len);
+        fil->tail_len = last_len;
+        fil->block_count = last;
+        fil->cached_block = NO_BLOCK;
+      }
+    }
+  }
+
+  if(status != EVFS_OK) { // Open failed
+    fil->base_file->methods->m_close(fil->base_file);
+    evfs_free(fil->work);
+    evfs_free(fil->blocks);
+    fh->methods = NULL;
+    return status;
+  }
+
+  // Add methods to make this functional
+  fh->methods = &s_compress_methods;
+  return EVFS_OK;
+}
+
+
+static int compress__stat(Evfs *vfs, const char *path, EvfsInfo *info) {
+  CompressData *shim_data = (CompressData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  int status = base_vfs->m_stat(base_vfs, path, info);
+  if(status != EVFS_OK || (info->type & EVFS_FILE_DIR))
+    return status;
+
+  // Replace the stored size with the logical size
+  EvfsFile *base_file;
+  status = evfs_vfs_open(base_vfs, path, &base_file, EVFS_READ);
+  if(status != EVFS_OK) return status;
+
+  CompressFile fil = {
+    .shim_data    = shim_data,
+    .base_file    = base_file,
+    .block_size   = shim_data->block_size,
+    .stored_size  = base_file->methods->m_size(base_file)
+  };
+
+  CompressFooter footer;
+  if(fil.stored_size == 0) {
+    info->size = 0;
+  } else if(compress_read_footer(base_file, fil.stored_size, &footer)) {
+    info->size = (evfs_off_t)(footer.block_count - 1) * footer.block_size + footer.last_len;
+  } else {
+    status = compress_scan_blocks(&fil);
+    info->size = fil.size;
+    evfs_free(fil.blocks);
+  }
+
+  evfs_file_close(base_file);
+  return status;
+}
+
+
+static int compress__delete(Evfs *vfs, const char *path) {
+  CompressData *shim_data = (CompressData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_delete(base_vfs, path);
+}
+
+
+static int compress__rename(Evfs *vfs, const char *old_path, const char *new_path) {
+  CompressData *shim_data = (CompressData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_rename(base_vfs, old_path, new_path);
+}
+
+
+static int compress__make_dir(Evfs *vfs, const char *path) {
+  CompressData *shim_data = (CompressData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_make_dir(base_vfs, path);
+}
+
+
+// Directories aren't compressed so the base VFS object is used directly
+static int compress__open_dir(Evfs *vfs, const char *path, EvfsDir *dh) {
+  CompressData *shim_data = (CompressData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_open_dir(base_vfs, path, dh);
+}
+
+
+static int compress__get_cur_dir(Evfs *vfs, StringRange *cur_dir) {
+  CompressData *shim_data = (CompressData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_get_cur_dir(base_vfs, cur_dir);
+}
+
+
+static int compress__set_cur_dir(Evfs *vfs, const char *path) {
+  CompressData *shim_data = (CompressData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_set_cur_dir(base_vfs, path);
+}
+
+
+static int compress__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
+  CompressData *shim_data = (CompressData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  switch(cmd) {
+    // We need special handling for EVFS_CMD_UNREGISTER.
+    // It can't pass through since we need to deallocate VFSs in the proper sequence
+    // to avoid corrupting the registered VFS linked list.
+    case EVFS_CMD_UNREGISTER:
+      evfs_free(vfs); // Free this compress VFS
+      return EVFS_OK; break;
+
+    default: // Everything else passes to the underlying VFS
+      return base_vfs->m_vfs_ctrl(base_vfs, cmd, arg);
+      break;
+  }
+}
+
+
+static bool compress__path_root_component(Evfs *vfs, const char *path, StringRange *root) {
+  CompressData *shim_data = (CompressData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_path_root_component(base_vfs, path, root);
+}
+
+
+/*
+Register a compression filesystem shim
+
+Every file on the underlying VFS is expected to be in the compressed format.
+Files that aren't fail to open with EVFS_ERR_CORRUPTION.
+
+Args:
+  vfs_name:      Name of new shim
+  old_vfs_name:  Existing VFS to wrap with shim
+  cfg:           Block size and codec. Use NULL for defaults
+  default_vfs:   Make this the default VFS when true
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_register_compress(const char *vfs_name, const char *old_vfs_name, CompressConfig *cfg,
+                           bool default_vfs) {
+  if(PTR_CHECK(vfs_name) || PTR_CHECK(old_vfs_name)) return EVFS_ERR_BAD_ARG;
+
+  Evfs *base_vfs, *shim_vfs;
+  CompressData *shim_data;
+
+  base_vfs = evfs_find_vfs(old_vfs_name);
+  if(PTR_CHECK(base_vfs)) return EVFS_ERR_NO_VFS;
+
+  size_t block_size = (cfg && cfg->block_size) ? cfg->block_size : DEFAULT_BLOCK_SIZE;
+  if(block_size < MIN_BLOCK_SIZE || block_size > MAX_BLOCK_SIZE)
+    return EVFS_ERR_BAD_ARG;
+
+  const CompressCodec *codec = (cfg && cfg->codec) ? cfg->codec : &s_lz4_codec;
+  if(PTR_CHECK(codec->compress) || PTR_CHECK(codec->decompress)) return EVFS_ERR_BAD_ARG;
+
+  // Construct a new VFS
+  // We have three objects allocated together [Evfs][CompressData][char[]]
+  size_t shim_size = sizeof(*shim_vfs) + sizeof(*shim_data) + strlen(vfs_name)+1;
+  shim_vfs = evfs_malloc(shim_size);
+  if(MEM_CHECK(shim_vfs)) return EVFS_ERR_ALLOC;
+
+  memset(shim_vfs, 0, shim_size);
+
+  shim_data = (CompressData *)NEXT_OBJ(shim_vfs);
+
+  shim_vfs->vfs_name = (char *)NEXT_OBJ(shim_data);
+  strcpy((char *)shim_vfs->vfs_name, vfs_name);
+
+  shim_data->base_vfs   = base_vfs;
+  shim_data->vfs_name   = shim_vfs->vfs_name;
+  shim_data->shim_vfs   = shim_vfs;
+  shim_data->block_size = block_size;
+  shim_data->codec      = codec;
+
+  shim_vfs->vfs_file_size = sizeof(CompressFile) + base_vfs->vfs_file_size;
+  shim_vfs->vfs_dir_size = base_vfs->vfs_dir_size;
+  shim_vfs->fs_data = shim_data;
+
+  shim_vfs->m_open = compress__open;
+  shim_vfs->m_stat = compress__stat;
+  shim_vfs->m_delete = compress__delete;
+  shim_vfs->m_rename = compress__rename;
+  shim_vfs->m_make_dir = compress__make_dir;
+  shim_vfs->m_open_dir = compress__open_dir;
+  shim_vfs->m_get_cur_dir = compress__get_cur_dir;
+  shim_vfs->m_set_cur_dir = compress__set_cur_dir;
+  shim_vfs->m_vfs_ctrl = compress__vfs_ctrl;
+
+  shim_vfs->m_path_root_component = compress__path_root_component;
+
+  return evfs_register(shim_vfs, default_vfs);
+}
@@ -0,0 +1,1480 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Deduplication shim VFS
+
+  File data is split into chunks at positions chosen by a gear rolling hash
+  over the content, so an insertion or deletion only changes the chunks
+  around it. Each chunk is stored once in a chunk store directory on the base
+  VFS and named for a 64-bit hash of its data:
+
+    <store>/<hh>/<hash>.<seq>
+
+  hh is the first two hex digits of the hash. A chunk is only shared after
+  its stored data compares equal to the new data. A different chunk with the
+  same hash gets the next seq number.
+
+  The file on the base VFS is a manifest listing its chunks. Entries have the
+  hash, length, and seq of each chunk:
+
+    [header: 24 bytes] [entries: N x 16 bytes]
+
+  The header has a magic number, the entry count, a CRC32C of the entries,
+  and the logical size. All values are little-endian. Empty files are empty
+  on the base VFS.
+
+  Reads go through a chunk cache shared by all files on the shim. Writes
+  collect in a tail buffer and chunks are committed as boundaries are found.
+  The tail is stored as a final chunk and the manifest is rewritten on sync
+  and close. Committed chunks can't be rewritten but appends and truncation
+  to any size are supported. Copies between files on the shim only copy the
+  manifest.
+
+  Chunks are never removed when files are deleted or overwritten. Use
+  evfs_dedup_collect() to remove chunks that no manifest refers to.
+  Directory listings report manifest sizes and include the chunk store if it
+  is in the listed directory. Use evfs_stat() for the logical size.
+------------------------------------------------------------------------------
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "evfs.h"
+#include "evfs_internal.h"
+#include "evfs/util/checksum.h"
+#include "evfs/util/glob.h"
+#include "evfs/util/unaligned_access.h"
+#include "evfs/shim/shim_dedup.h"
+
+
+// Access objects allocated in a single block of memory
+#define NEXT_OBJ(o) (&(o)[1])
+
+#define DEFAULT_AVG_CHUNK     8192
+#define MIN_AVG_CHUNK         256
+#define MIN_CHUNK_SIZE        64
+#define MAX_CHUNK_SIZE        (1024UL * 1024)
+#define DEFAULT_CACHE_CHUNKS  8
+
+#define MANIFEST_HDR_SIZE     24
+#define MANIFEST_ENTRY_SIZE   16
+#define MANIFEST_MAGIC        0x4D445645UL  // "EVDM"
+#define MANIFEST_VERSION      1
+
+// Chunks with the same hash and different data
+#define MAX_COLLISIONS        16
+
+// Chunk path after the store directory: "/hh/<hash>.<seq>"
+#define CHUNK_NAME_LEN        (16 + 2)
+#define CHUNK_SUFFIX_LEN      (1 + 2 + 1 + CHUNK_NAME_LEN)
+
+
+typedef struct DedupCacheEntry {
+  uint8_t    *data;
+  uint64_t    hash;
+  uint32_t    len;
+  uint32_t    seq;
+  uint64_t    stamp;        // Last use for LRU replacement
+  bool        valid;
+} DedupCacheEntry;
+
+typedef struct DedupData {
+  Evfs       *base_vfs;
+  const char *vfs_name;
+  Evfs       *shim_vfs;
+
+  const char *store_path;   // Absolute path to the chunk store
+  size_t      path_size;    // Buffer size for chunk paths
+  size_t      min_chunk;
+  size_t      max_chunk;
+  uint64_t    cut_mask;     // Hash bits that are zero at a chunk boundary
+  uint64_t    gear[256];    // Rolling hash value for each byte
+
+  EvfsLock    lock;         // Protects everything below
+  DedupCacheEntry *cache;
+  size_t      cache_chunks;
+  uint64_t    cache_clock;
+  char       *cache_path;   // Chunk path for cache misses
+  DedupStats  stats;
+} DedupData;
+
+typedef struct DedupChunk {
+  evfs_off_t  offset;       // Logical offset in the file
+  uint64_t    hash;
+  uint32_t    len;
+  uint32_t    seq;
+} DedupChunk;
+
+typedef struct DedupFile {
+  EvfsFile      base;
+  DedupData    *shim_data;
+  EvfsFile     *base_file;
+
+  DedupChunk   *chunks;       // Committed chunks
+  size_t        chunk_count;
+  size_t        chunks_avail;
+  size_t        last_chunk;   // Most recently read chunk
+
+  evfs_off_t    size;         // Logical size
+  evfs_off_t    pos;
+  evfs_off_t    stored_size;  // Size of the manifest
+
+  uint8_t      *tail;         // Data after the committed chunks. Only for writable files
+  size_t        tail_len;
+  size_t        scan_pos;     // End of the tail searched for a boundary
+  uint64_t      scan_hash;    // Rolling hash at scan_pos
+  uint8_t      *scratch;      // Stored chunk data to compare and the manifest to write
+  char         *path;         // Chunk path for writes
+
+  bool          writable;
+  bool          append;
+  bool          dirty;        // Manifest in the base file is out of date
+  bool          eof;
+} DedupFile;
+
+typedef struct DedupHeader {
+  size_t      count;
+  uint32_t    check;        // CRC32C of the entries
+  evfs_off_t  size;
+} DedupHeader;
+
+// Chunk reference found by evfs_dedup_collect()
+typedef struct DedupKey {
+  uint64_t    hash;
+  uint32_t    seq;
+} DedupKey;
+
+typedef struct DedupKeyList {
+  DedupKey   *keys;
+  size_t      count;
+  size_t      avail;
+} DedupKeyList;
+
+typedef struct DedupCollect {
+  DedupData    *shim_data;
+  DedupKeyList  refs;       // Chunks used by manifests
+  DedupKeyList  unused;     // Chunks to remove
+} DedupCollect;
+
+
+static const EvfsFileMethods s_dedup_methods;
+
+
+// ******************** Hashing ********************
+
+static inline uint64_t mix64(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xBF58476D1CE4E5B9ULL;
+  x ^= x >> 27;
+  x *= 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+
+// Identify chunk data. Chunks with equal hashes are compared before sharing.
+static uint64_t chunk_hash(const uint8_t *data, size_t len) {
+  uint64_t hash = 0x9E3779B97F4A7C15ULL ^ len;
+
+  while(len >= 8) {
+    hash = mix64(hash ^ get_unaligned_u64le(data));
+    data += 8;
+    len -= 8;
+  }
+
+  uint64_t last = 0;
+  for(size_t i = 0; i < len; i++) {
+    last |= (uint64_t)data[i] << (i * 8);
+  }
+
+  return mix64(hash ^ last);
+}
+
+
+// Fixed values for the gear hash so chunk boundaries are the same in every run
+static void gear_init(uint64_t *gear) {
+  uint64_t x = 0;
+  for(int i = 0; i < 256; i++) {
+    x += 0x9E3779B97F4A7C15ULL;
+    gear[i] = mix64(x);
+  }
+}
+
+
+static void put_hex(char *s, uint64_t value, int digits) {
+  static const char s_hex[] = "0123456789abcdef";
+
+  while(digits-- > 0) {
+    s[digits] = s_hex[value & 0x0F];
+    value >>= 4;
+  }
+}
+
+
+static bool get_hex(const char *s, int digits, uint64_t *value) {
+  uint64_t v = 0;
+
+  for(int i = 0; i < digits; i++) {
+    char c = s[i];
+    int d;
+    if(c >= '0' && c <= '9')
+      d = c - '0';
+    else if(c >= 'a' && c <= 'f')
+      d = c - 'a' + 10;
+    else
+      return false;
+
+    v = (v << 4) | d;
+  }
+
+  *value = v;
+  return true;
+}
+
+
+static void chunk_path(const DedupData *shim_data, uint64_t hash, uint32_t seq, char *path) {
+  size_t len = strlen(shim_data->store_path);
+  memcpy(path, shim_data->store_path, len);
+
+  if(len == 0 || !char_match(path[len-1], EVFS_PATH_SEPS))
+    path[len++] = EVFS_DIR_SEP;
+
+  put_hex(&path[len], hash >> 56, 2);
+  len += 2;
+  path[len++] = EVFS_DIR_SEP;
+  put_hex(&path[len], hash, 16);
+  len += 16;
+  path[len++] = '.';
+  put_hex(&path[len], seq, 1);
+  path[len+1] = '\0';
+}
+
+
+// Parse a chunk file name
+static bool chunk_name_parse(const char *name, DedupKey *key) {
+  uint64_t seq;
+
+  if(strlen(name) != CHUNK_NAME_LEN || name[16] != '.')
+    return false;
+
+  if(!get_hex(name, 16, &key->hash) || !get_hex(&name[17], 1, &seq))
+    return false;
+
+  key->seq = seq;
+  return true;
+}
+
+
+static void dedup_count(DedupData *shim_data, bool stored, size_t len) {
+  evfs__lock(&shim_data->lock);
+  if(stored) {
+    shim_data->stats.chunks_stored++;
+    shim_data->stats.bytes_stored += len;
+  } else {
+    shim_data->stats.chunks_shared++;
+    shim_data->stats.bytes_shared += len;
+  }
+  evfs__unlock(&shim_data->lock);
+}
+
+
+
+// ******************** Chunk store ********************
+
+// Read a chunk from the store into a cache entry. Called with the lock held.
+static int dedup_load_chunk(DedupData *shim_data, const DedupChunk *chunk, DedupCacheEntry *entry) {
+  entry->valid = false;
+
+  chunk_path(shim_data, chunk->hash, chunk->seq, shim_data->cache_path);
+
+  EvfsFile *fh;
+  int status = evfs_vfs_open(shim_data->base_vfs, shim_data->cache_path, &fh, EVFS_READ);
+  if(status != EVFS_OK) // Manifest refers to a missing chunk
+    return status == EVFS_ERR_NO_FILE || status == EVFS_ERR_NO_PATH ? EVFS_ERR_CORRUPTION : status;
+
+  ptrdiff_t read = evfs_file_read_at(fh, entry->data, chunk->len, 0);
+  evfs_file_close(fh);
+
+  if(read != (ptrdiff_t)chunk->len)
+    return read < 0 ? read : EVFS_ERR_CORRUPTION;
+
+  if(chunk_hash(entry->data, chunk->len) != chunk->hash)
+    return EVFS_ERR_CORRUPTION;
+
+  entry->hash  = chunk->hash;
+  entry->len   = chunk->len;
+  entry->seq   = chunk->seq;
+  entry->valid = true;
+
+  return EVFS_OK;
+}
+
+
+// Copy part of a chunk through the cache
+static int dedup_read_chunk(DedupData *shim_data, const DedupChunk *chunk, size_t chunk_off,
+                            uint8_t *dest, size_t len) {
+  evfs__lock(&shim_data->lock);
+
+  DedupCacheEntry *entry = NULL;
+  DedupCacheEntry *victim = &shim_data->cache[0];
+
+  for(size_t i = 0; i < shim_data->cache_chunks; i++) {
+    DedupCacheEntry *e = &shim_data->cache[i];
+    if(e->valid && e->hash == chunk->hash && e->seq == chunk->seq && e->len == chunk->len) {
+      entry = e;
+      break;
+    }
+
+    if(victim->valid && (!e->valid || e->stamp < victim->stamp))
+      victim = e;
+  }
+
+  int status = EVFS_OK;
+
+  if(entry) {
+    shim_data->stats.cache_hits++;
+  } else {
+    shim_data->stats.cache_misses++;
+    entry = victim;
+    status = dedup_load_chunk(shim_data, chunk, entry);
+  }
+
+  if(status == EVFS_OK) {
+    memcpy(dest, &entry->data[chunk_off], len);
+    entry->stamp = ++shim_data->cache_clock;
+  }
+
+  evfs__unlock(&shim_data->lock);
+  return status;
+}
+
+
+// Compare a stored chunk with new data
+static int dedup_match_chunk(DedupFile *fil, const uint8_t *data, size_t len) {
+  EvfsFile *fh;
+  int status = evfs_vfs_open(fil->shim_data->base_vfs, fil->path, &fh, EVFS_READ);
+  if(status != EVFS_OK) return status;
+
+  // A chunk left short by an interrupted writer never matches
+  if(evfs_file_size(fh) != (evfs_off_t)len) {
+    status = EVFS_ERR_EXISTS;
+  } else {
+    ptrdiff_t read = evfs_file_read_at(fh, fil->scratch, len, 0);
+    if(read != (ptrdiff_t)len)
+      status = read < 0 ? read : EVFS_ERR_IO;
+    else if(memcmp(fil->scratch, data, len) != 0)
+      status = EVFS_ERR_EXISTS;
+  }
+
+  evfs_file_close(fh);
+  return status;
+}
+
+
+static int dedup_create_chunk(DedupFile *fil, const uint8_t *data, size_t len) {
+  Evfs *base_vfs = fil->shim_data->base_vfs;
+  EvfsFile *fh;
+
+  int status = evfs_vfs_open(base_vfs, fil->path, &fh, EVFS_WRITE | EVFS_NO_EXIST);
+
+  if(status == EVFS_ERR_NO_FILE || status == EVFS_ERR_NO_PATH) { // Make the store directories
+    char *sep = strrchr(fil->path, EVFS_DIR_SEP);
+    *sep = '\0';
+    status = evfs_make_path_ex(fil->path, base_vfs->vfs_name);
+    *sep = EVFS_DIR_SEP;
+
+    if(status == EVFS_OK)
+      status = evfs_vfs_open(base_vfs, fil->path, &fh, EVFS_WRITE | EVFS_NO_EXIST);
+  }
+
+  if(status != EVFS_OK) return status;
+
+  ptrdiff_t wrote = evfs_file_write(fh, data, len);
+  status = wrote == (ptrdiff_t)len ? EVFS_OK : (wrote < 0 ? wrote : EVFS_ERR_IO);
+
+  int close_status = evfs_file_close(fh);
+  if(status == EVFS_OK)
+    status = close_status;
+
+  if(status != EVFS_OK) // Don't leave a partial chunk
+    base_vfs->m_delete(base_vfs, fil->path);
+
+  return status;
+}
+
+
+// Find or add a chunk in the store
+static int dedup_store_chunk(DedupFile *fil, const uint8_t *data, size_t len, DedupChunk *chunk) {
+  uint64_t hash = chunk_hash(data, len);
+
+  for(uint32_t seq = 0; seq < MAX_COLLISIONS; seq++) {
+    chunk_path(fil->shim_data, hash, seq, fil->path);
+
+    bool stored = false;
+    int status = dedup_match_chunk(fil, data, len);
+
+    if(status == EVFS_ERR_NO_FILE || status == EVFS_ERR_NO_PATH) {
+      status = dedup_create_chunk(fil, data, len);
+      if(status == EVFS_ERR_EXISTS) // Another writer added it first
+        status = dedup_match_chunk(fil, data, len);
+      else
+        stored = true;
+    }
+
+    if(status == EVFS_ERR_EXISTS) // Different data with the same hash
+      continue;
+
+    if(status != EVFS_OK)
+      return status;
+
+    chunk->hash = hash;
+    chunk->len  = len;
+    chunk->seq  = seq;
+    dedup_count(fil->shim_data, stored, len);
+    return EVFS_OK;
+  }
+
+  return EVFS_ERR_OVERFLOW;
+}
+
+
+
+// ******************** Manifest ********************
+
+static int dedup_reserve_chunks(DedupFile *fil, size_t count) {
+  if(count <= fil->chunks_avail)
+    return EVFS_OK;
+
+  size_t avail = fil->chunks_avail ? fil->chunks_avail : 16;
+  while(avail < count)
+    avail *= 2;
+
+  DedupChunk *chunks = evfs_malloc(avail * sizeof(*chunks));
+  if(MEM_CHECK(chunks)) return EVFS_ERR_ALLOC;
+
+  if(fil->chunks) {
+    memcpy(chunks, fil->chunks, fil->chunk_count * sizeof(*chunks));
+    evfs_free(fil->chunks);
+  }
+
+  fil->chunks = chunks;
+  fil->chunks_avail = avail;
+  return EVFS_OK;
+}
+
+
+static int dedup_read_header(EvfsFile *base_file, evfs_off_t stored_size, DedupHeader *hdr) {
+  uint8_t buf[MANIFEST_HDR_SIZE];
+
+  if(stored_size < MANIFEST_HDR_SIZE)
+    return EVFS_ERR_CORRUPTION;
+
+  ptrdiff_t rval = evfs_file_read_at(base_file, buf, MANIFEST_HDR_SIZE, 0);
+  if(rval != MANIFEST_HDR_SIZE)
+    return rval < 0 ? rval : EVFS_ERR_IO;
+
+  if(get_unaligned_u32le(&buf[0]) != MANIFEST_MAGIC || get_unaligned_u16le(&buf[4]) != MANIFEST_VERSION)
+    return EVFS_ERR_CORRUPTION;
+
+  hdr->count = get_unaligned_u32le(&buf[8]);
+  hdr->check = get_unaligned_u32le(&buf[12]);
+  hdr->size  = (evfs_off_t)get_unaligned_u64le(&buf[16]);
+
+  if(hdr->size < 0 ||
+      MANIFEST_HDR_SIZE + (evfs_off_t)hdr->count * MANIFEST_ENTRY_SIZE != stored_size)
+    return EVFS_ERR_CORRUPTION;
+
+  return EVFS_OK;
+}
+
+
+static int dedup_load_manifest(DedupFile *fil) {
+  fil->chunk_count = 0;
+  fil->size = 0;
+
+  if(fil->stored_size == 0)
+    return EVFS_OK;
+
+  DedupHeader hdr;
+  int status = dedup_read_header(fil->base_file, fil->stored_size, &hdr);
+  if(status != EVFS_OK) return status;
+
+  status = dedup_reserve_chunks(fil, hdr.count);
+  if(status != EVFS_OK) return status;
+
+  uint8_t buf[MANIFEST_ENTRY_SIZE * 32];
+  evfs_off_t entry_pos = MANIFEST_HDR_SIZE;
+  evfs_off_t offset = 0;
+  uint32_t check = 0;
+
+  for(size_t i = 0; i < hdr.count; ) {
+    size_t entries = MIN(hdr.count - i, sizeof(buf) / MANIFEST_ENTRY_SIZE);
+    ptrdiff_t rval = evfs_file_read_at(fil->base_file, buf, entries * MANIFEST_ENTRY_SIZE, entry_pos);
+    if(rval != (ptrdiff_t)(entries * MANIFEST_ENTRY_SIZE))
+      return rval < 0 ? rval : EVFS_ERR_IO;
+
+    entry_pos += rval;
+    check = crc32c_update(check, buf, rval);
+
+    for(size_t e = 0; e < entries; e++, i++) {
+      const uint8_t *entry = &buf[e * MANIFEST_ENTRY_SIZE];
+      DedupChunk *chunk = &fil->chunks[i];
+
+      chunk->offset = offset;
+      chunk->hash   = get_unaligned_u64le(&entry[0]);
+      chunk->len    = get_unaligned_u32le(&entry[8]);
+      chunk->seq    = get_unaligned_u32le(&entry[12]);
+
+      if(chunk->len == 0 || chunk->len > MAX_CHUNK_SIZE || chunk->seq >= MAX_COLLISIONS)
+        return EVFS_ERR_CORRUPTION;
+
+      offset += chunk->len;
+    }
+  }
+
+  if(check != hdr.check || offset != hdr.size)
+    return EVFS_ERR_CORRUPTION;
+
+  fil->chunk_count = hdr.count;
+  fil->size = hdr.size;
+
+  return EVFS_OK;
+}
+
+
+// Write out pending entries while building the manifest
+static int dedup_write_entries(DedupFile *fil, size_t len, evfs_off_t *end, uint32_t *check) {
+  ptrdiff_t wrote = evfs_file_write_at(fil->base_file, fil->scratch, len, *end);
+  if(wrote != (ptrdiff_t)len)
+    return wrote < 0 ? wrote : EVFS_ERR_IO;
+
+  *check = crc32c_update(*check, fil->scratch, len);
+  *end += len;
+  return EVFS_OK;
+}
+
+
+// Store the tail chunk and write the manifest
+static int dedup_flush(DedupFile *fil) {
+  if(!fil->dirty)
+    return EVFS_OK;
+
+  int status;
+  EvfsFile *base_file = fil->base_file;
+
+  if(fil->size == 0) { // Empty files have no manifest
+    status = base_file->methods->m_truncate(base_file, 0);
+    if(status != EVFS_OK) return status;
+
+    fil->stored_size = 0;
+    fil->dirty = false;
+    return EVFS_OK;
+  }
+
+  size_t count = fil->chunk_count;
+  DedupChunk tail_chunk;
+
+  if(fil->tail_len > 0) { // Stored but not committed so it can still grow
+    status = dedup_store_chunk(fil, fil->tail, fil->tail_len, &tail_chunk);
+    if(status != EVFS_OK) return status;
+
+    count++;
+  }
+
+  // Entries come first so the header is only valid once they are written
+  uint8_t *buf = fil->scratch;
+  size_t buf_size = fil->shim_data->max_chunk;
+  size_t buf_len = 0;
+  evfs_off_t end = MANIFEST_HDR_SIZE;
+  uint32_t check = 0;
+
+  for(size_t i = 0; i < count; i++) {
+    const DedupChunk *chunk = i < fil->chunk_count ? &fil->chunks[i] : &tail_chunk;
+
+    set_unaligned_u64le(chunk->hash, &buf[buf_len]);
+    set_unaligned_u32le(chunk->len, &buf[buf_len+8]);
+    set_unaligned_u32le(chunk->seq, &buf[buf_len+12]);
+    buf_len += MANIFEST_ENTRY_SIZE;
+
+    if(buf_len + MANIFEST_ENTRY_SIZE > buf_size) {
+      status = dedup_write_entries(fil, buf_len, &end, &check);
+      if(status != EVFS_OK) return status;
+      buf_len = 0;
+    }
+  }
+
+  if(buf_len > 0) {
+    status = dedup_write_entries(fil, buf_len, &end, &check);
+    if(status != EVFS_OK) return status;
+  }
+
+  set_unaligned_u32le(MANIFEST_MAGIC, &buf[0]);
+  set_unaligned_u16le(MANIFEST_VERSION, &buf[4]);
+  set_unaligned_u16le(0, &buf[6]);
+  set_unaligned_u32le(count, &buf[8]);
+  set_unaligned_u32le(check, &buf[12]);
+  set_unaligned_u64le(fil->size, &buf[16]);
+
+  ptrdiff_t wrote = evfs_file_write_at(base_file, buf, MANIFEST_HDR_SIZE, 0);
+  if(wrote != MANIFEST_HDR_SIZE)
+    return wrote < 0 ? wrote : EVFS_ERR_IO;
+
+  // Drop anything left over from a longer manifest
+  if(fil->stored_size > end) {
+    status = base_file->methods->m_truncate(base_file, end);
+    if(status != EVFS_OK) return status;
+  }
+
+  fil->stored_size = end;
+  fil->dirty = false;
+
+  return EVFS_OK;
+}
+
+
+
+// ******************** Chunking ********************
+
+// Length of the first chunk in the tail or 0 if more data is needed to find its end
+static size_t dedup_find_cut(DedupFile *fil) {
+  DedupData *shim_data = fil->shim_data;
+  size_t end = MIN(fil->tail_len, shim_data->max_chunk);
+  size_t i = MAX(fil->scan_pos, shim_data->min_chunk);
+
+  if(i < end) {
+    uint64_t hash = fil->scan_hash;
+
+    for(; i < end; i++) {
+      hash = (hash << 1) + shim_data->gear[fil->tail[i]];
+      if(!(hash & shim_data->cut_mask))
+        return i+1;
+    }
+
+    fil->scan_pos = end;
+    fil->scan_hash = hash;
+  }
+
+  return fil->tail_len >= shim_data->max_chunk ? shim_data->max_chunk : 0;
+}
+
+
+// Commit chunks from the start of the tail as their boundaries are found
+static int dedup_cut_tail(DedupFile *fil) {
+  size_t len;
+
+  while((len = dedup_find_cut(fil)) > 0) {
+    int status = dedup_reserve_chunks(fil, fil->chunk_count+1);
+    if(status != EVFS_OK) return status;
+
+    DedupChunk *chunk = &fil->chunks[fil->chunk_count];
+    status = dedup_store_chunk(fil, fil->tail, len, chunk);
+    if(status != EVFS_OK) return status;
+
+    chunk->offset = fil->size - fil->tail_len;
+    fil->chunk_count++;
+
+    fil->tail_len -= len;
+    memmove(fil->tail, &fil->tail[len], fil->tail_len);
+    fil->scan_pos = 0;
+    fil->scan_hash = 0;
+  }
+
+  return EVFS_OK;
+}
+
+
+// Index of the committed chunk holding offset
+static size_t dedup_find_chunk(DedupFile *fil, evfs_off_t offset) {
+  size_t ix = fil->last_chunk;
+
+  // Check for sequential access first
+  for(size_t i = 0; i < 2 && ix < fil->chunk_count; i++, ix++) {
+    DedupChunk *chunk = &fil->chunks[ix];
+    if(offset >= chunk->offset && offset < chunk->offset + (evfs_off_t)chunk->len)
+      return ix;
+  }
+
+  size_t lo = 0;
+  size_t hi = fil->chunk_count;
+  while(hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if(fil->chunks[mid].offset <= offset)
+      lo = mid;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+
+// Write data at or after the committed chunks. buf is NULL to write zeros.
+static ptrdiff_t dedup_write_data(DedupFile *fil, const uint8_t *buf, size_t size, evfs_off_t offset) {
+  if(offset < fil->size - (evfs_off_t)fil->tail_len)
+    return EVFS_ERR_NO_SUPPORT;
+
+  // Fill a gap past the end with zeros
+  if(offset > fil->size) {
+    ptrdiff_t rval = dedup_write_data(fil, NULL, offset - fil->size, fil->size);
+    if(rval < 0) return rval;
+  }
+
+  ptrdiff_t wrote = 0;
+
+  while((size_t)wrote < size) {
+    size_t tail_off = offset - (fil->size - fil->tail_len);
+    size_t copy_size = MIN(size - wrote, fil->shim_data->max_chunk - tail_off);
+
+    if(buf)
+      memcpy(&fil->tail[tail_off], &buf[wrote], copy_size);
+    else
+      memset(&fil->tail[tail_off], 0, copy_size);
+
+    if(tail_off < fil->scan_pos) { // Searched data has changed
+      fil->scan_pos = 0;
+      fil->scan_hash = 0;
+    }
+
+    wrote += copy_size;
+    offset += copy_size;
+    fil->tail_len = MAX(fil->tail_len, tail_off + copy_size);
+    fil->size = MAX(fil->size, offset);
+    fil->dirty = true;
+
+    int status = dedup_cut_tail(fil);
+    if(status != EVFS_OK)
+      return wrote > 0 ? wrote : status;
+  }
+
+  return wrote;
+}
+
+
+
+// ******************** File access methods ********************
+
+static int dedup__file_ctrl(EvfsFile *fh, int cmd, void *arg) {
+  DedupFile *fil = (DedupFile *)fh;
+
+  return fil->base_file->methods->m_ctrl(fil->base_file, cmd, arg);
+}
+
+
+static int dedup__file_close(EvfsFile *fh) {
+  DedupFile *fil = (DedupFile *)fh;
+
+  int flush_status = fil->writable ? dedup_flush(fil) : EVFS_OK;
+  int status = fil->base_file->methods->m_close(fil->base_file);
+
+  evfs_free(fil->tail);
+  evfs_free(fil->chunks);
+  fil->tail = NULL;
+  fil->chunks = NULL;
+  fil->base.methods = NULL;
+
+  return flush_status != EVFS_OK ? flush_status : status;
+}
+
+
+static ptrdiff_t dedup__file_read_at(EvfsFile *fh, void *buf, size_t size, evfs_off_t offset) {
+  DedupFile *fil = (DedupFile *)fh;
+  uint8_t *cbuf = (uint8_t *)buf;
+
+  if(offset >= fil->size)
+    return 0;
+
+  size = MIN((evfs_off_t)size, fil->size - offset);
+  evfs_off_t committed = fil->size - fil->tail_len;
+  ptrdiff_t read = 0;
+
+  while((size_t)read < size) {
+    size_t copy_size;
+
+    if(offset >= committed) { // Uncommitted tail
+      size_t tail_off = offset - committed;
+      copy_size = MIN(size - read, fil->tail_len - tail_off);
+      memcpy(&cbuf[read], &fil->tail[tail_off], copy_size);
+
+    } else {
+      size_t ix = dedup_find_chunk(fil, offset);
+      DedupChunk *chunk = &fil->chunks[ix];
+      size_t chunk_off = offset - chunk->offset;
+
+      copy_size = MIN(size - read, chunk->len - chunk_off);
+      int status = dedup_read_chunk(fil->shim_data, chunk, chunk_off, &cbuf[read], copy_size);
+      if(status != EVFS_OK)
+        return read > 0 ? read : status;
+
+      fil->last_chunk = ix;
+    }
+
+    read += copy_size;
+    offset += copy_size;
+  }
+
+  return read;
+}
+
+
+static ptrdiff_t dedup__file_read(EvfsFile *fh, void *buf, size_t size) {
+  DedupFile *fil = (DedupFile *)fh;
+
+  ptrdiff_t read = dedup__file_read_at(fh, buf, size, fil->pos);
+  if(read < 0) return read;
+
+  fil->pos += read;
+  if((size_t)read < size)
+    fil->eof = true;
+
+  return read;
+}
+
+
+static ptrdiff_t dedup__file_write_at(EvfsFile *fh, const void *buf, size_t size, evfs_off_t offset) {
+  DedupFile *fil = (DedupFile *)fh;
+
+  if(!fil->writable) return EVFS_ERR_DISABLED;
+
+  return dedup_write_data(fil, (const uint8_t *)buf, size, offset);
+}
+
+
+static ptrdiff_t dedup__file_write(EvfsFile *fh, const void *buf, size_t size) {
+  DedupFile *fil = (DedupFile *)fh;
+
+  if(!fil->writable) return EVFS_ERR_DISABLED;
+
+  if(fil->append)
+    fil->pos = fil->size;
+
+  ptrdiff_t wrote = dedup_write_data(fil, (const uint8_t *)buf, size, fil->pos);
+  if(wrote > 0)
+    fil->pos += wrote;
+
+  return wrote;
+}
+
+
+static int dedup__file_truncate(EvfsFile *fh, evfs_off_t size) {
+  DedupFile *fil = (DedupFile *)fh;
+
+  if(!fil->writable) return EVFS_ERR_DISABLED;
+
+  if(size >= fil->size) { // Extend with zeros
+    ptrdiff_t rval = dedup_write_data(fil, NULL, size - fil->size, fil->size);
+    return rval < 0 ? rval : EVFS_OK;
+  }
+
+  evfs_off_t committed = fil->size - fil->tail_len;
+
+  if(size < committed) { // Reopen a committed chunk as the tail
+    size_t ix = dedup_find_chunk(fil, size);
+    DedupChunk *chunk = &fil->chunks[ix];
+    size_t keep = size - chunk->offset;
+
+    if(keep > 0) {
+      int status = dedup_read_chunk(fil->shim_data, chunk, 0, fil->tail, keep);
+      if(status != EVFS_OK) return status;
+    }
+
+    fil->chunk_count = ix;
+    fil->tail_len = keep;
+  } else {
+    fil->tail_len = size - committed;
+  }
+
+  fil->size = size;
+  fil->scan_pos = 0;
+  fil->scan_hash = 0;
+  fil->dirty = true;
+
+  return EVFS_OK;
+}
+
+
+static int dedup__file_sync(EvfsFile *fh) {
+  DedupFile *fil = (DedupFile *)fh;
+
+  if(fil->writable) {
+    int status = dedup_flush(fil);
+    if(status != EVFS_OK) return status;
+  }
+
+  return fil->base_file->methods->m_sync(fil->base_file);
+}
+
+
+static evfs_off_t dedup__file_size(EvfsFile *fh) {
+  DedupFile *fil = (DedupFile *)fh;
+
+  return fil->size;
+}
+
+
+static int dedup__file_seek(EvfsFile *fh, evfs_off_t offset, EvfsSeekDir origin) {
+  DedupFile *fil = (DedupFile *)fh;
+
+  fil->pos = evfs__absolute_offset(fh, offset, origin);
+  fil->eof = false;
+
+  return EVFS_OK;
+}
+
+
+static evfs_off_t dedup__file_tell(EvfsFile *fh) {
+  DedupFile *fil = (DedupFile *)fh;
+
+  return fil->pos;
+}
+
+
+static bool dedup__file_eof(EvfsFile *fh) {
+  DedupFile *fil = (DedupFile *)fh;
+
+  return fil->eof;
+}
+
+
+static const EvfsFileMethods s_dedup_methods = {
+  .m_ctrl     = dedup__file_ctrl,
+  .m_close    = dedup__file_close,
+  .m_read     = dedup__file_read,
+  .m_write    = dedup__file_write,
+  .m_truncate = dedup__file_truncate,
+  .m_sync     = dedup__file_sync,
+  .m_size     = dedup__file_size,
+  .m_seek     = dedup__file_seek,
+  .m_tell     = dedup__file_tell,
+  .m_eof      = dedup__file_eof,
+  .m_read_at  = dedup__file_read_at,
+  .m_write_at = dedup__file_write_at
+};
+
+
+
+// ******************** FS access methods ********************
+
+static int dedup__open(Evfs *vfs, const char *path, EvfsFile *fh, int flags) {
+  DedupFile *fil = (DedupFile *)fh;
+  DedupData *shim_data = (DedupData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  memset(fil, 0, sizeof(*fil));
+  fil->shim_data = shim_data;
+  fil->base_file = (EvfsFile *)NEXT_OBJ(fil);  // We have two objects allocated together [DedupFile][<base VFS file size>]
+
+  // The base file is read to load the manifest and appends are handled here
+  int base_flags = flags & ~EVFS_APPEND;
+  if(flags & EVFS_WRITE)
+    base_flags |= EVFS_READ;
+
+  int status = base_vfs->m_open(base_vfs, path, fil->base_file, base_flags);
+
+  if(status == EVFS_OK && !fil->base_file->methods)
+    status = EVFS_ERR_INIT;
+
+  if(status != EVFS_OK) {
+    fh->methods = NULL;
+    return status;
+  }
+
+  fil->writable     = flags & EVFS_WRITE;
+  fil->append       = flags & EVFS_APPEND;
+  fil->stored_size  = fil->base_file->methods->m_size(fil->base_file);
+
+  status = dedup_load_manifest(fil);
+
+  // Chunks must fit in the cache
+  for(size_t i = 0; status == EVFS_OK && i < fil->chunk_count; i++) {
+    if(fil->chunks[i].len > shim_data->max_chunk)
+      status = EVFS_ERR_NO_SUPPORT;
+  }
+
+  if(status == EVFS_OK && fil->writable) {
+    // Buffers are allocated together [tail][scratch][path]
+    size_t max_chunk = shim_data->max_chunk;
+    uint8_t *buf = evfs_malloc(max_chunk * 2 + shim_data->path_size);
+    if(MEM_CHECK(buf)) {
+      status = EVFS_ERR_ALLOC;
+    } else {
+      fil->tail     = buf;
+      fil->scratch  = buf + max_chunk;
+      fil->path     = (char *)(buf + max_chunk * 2);
+    }
+  }
+
+  // A short last chunk becomes the tail so appends rejoin the chunking
+  if(status == EVFS_OK && fil->writable && fil->chunk_count > 0) {
+    DedupChunk *last = &fil->chunks[fil->chunk_count-1];
+
+    if(last->len < shim_data->max_chunk) {
+      status = dedup_read_chunk(shim_data, last, 0, fil->tail, last->len);
+      if(status == EVFS_OK) {
+        fil->tail_len = last->len;
+        fil->chunk_count--;
+      }
+    }
+  }
+
+  if(status != EVFS_OK) { // Open failed
+    fil->base_file->methods->m_close(fil->base_file);
+    evfs_free(fil->tail);
+    evfs_free(fil->chunks);
+    fh->methods = NULL;
+    return status;
+  }
+
+  // Add methods to make this functional
+  fh->methods = &s_dedup_methods;
+  return EVFS_OK;
+}
+
+
+static int dedup__stat(Evfs *vfs, const char *path, EvfsInfo *info) {
+  DedupData *shim_data = (DedupData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  int status = base_vfs->m_stat(base_vfs, path, info);
+  if(status != EVFS_OK || (info->type & EVFS_FILE_DIR))
+    return status;
+
+  // Replace the manifest size with the logical size
+  EvfsFile *base_file;
+  status = evfs_vfs_open(base_vfs, path, &base_file, EVFS_READ);
+  if(status != EVFS_OK) return status;
+
+  evfs_off_t stored_size = base_file->methods->m_size(base_file);
+
+  if(stored_size == 0) {
+    info->size = 0;
+  } else {
+    DedupHeader hdr;
+    status = dedup_read_header(base_file, stored_size, &hdr);
+    if(status == EVFS_OK)
+      info->size = hdr.size;
+  }
+
+  evfs_file_close(base_file);
+  return status;
+}
+
+
+static int dedup__delete(Evfs *vfs, const char *path) {
+  DedupData *shim_data = (DedupData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_delete(base_vfs, path);
+}
+
+
+static int dedup__rename(Evfs *vfs, const char *old_path, const char *new_path) {
+  DedupData *shim_data = (DedupData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_rename(base_vfs, old_path, new_path);
+}
+
+
+static int dedup__make_dir(Evfs *vfs, const char *path) {
+  DedupData *shim_data = (DedupData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_make_dir(base_vfs, path);
+}
+
+
+// Directories aren't changed so the base VFS object is used directly
+static int dedup__open_dir(Evfs *vfs, const char *path, EvfsDir *dh) {
+  DedupData *shim_data = (DedupData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_open_dir(base_vfs, path, dh);
+}
+
+
+static int dedup__get_cur_dir(Evfs *vfs, StringRange *cur_dir) {
+  DedupData *shim_data = (DedupData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_get_cur_dir(base_vfs, cur_dir);
+}
+
+
+static int dedup__set_cur_dir(Evfs *vfs, const char *path) {
+  DedupData *shim_data = (DedupData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_set_cur_dir(base_vfs, path);
+}
+
+
+static int dedup__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
+  DedupData *shim_data = (DedupData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  switch(cmd) {
+    // We need special handling for EVFS_CMD_UNREGISTER.
+    // It can't pass through since we need to deallocate VFSs in the proper sequence
+    // to avoid corrupting the registered VFS linked list.
+    case EVFS_CMD_UNREGISTER:
+      evfs__lock_destroy(&shim_data->lock);
+      evfs_free(vfs); // Free this dedup VFS
+      return EVFS_OK; break;
+
+    case EVFS_CMD_GET_DEDUP_STATS:
+      if(PTR_CHECK(arg)) return EVFS_ERR_BAD_ARG;
+      evfs__lock(&shim_data->lock);
+      *(DedupStats *)arg = shim_data->stats;
+      evfs__unlock(&shim_data->lock);
+      return EVFS_OK; break;
+
+    default: // Everything else passes to the underlying VFS
+      return base_vfs->m_vfs_ctrl(base_vfs, cmd, arg);
+      break;
+  }
+}
+
+
+static bool dedup__path_root_component(Evfs *vfs, const char *path, StringRange *root) {
+  DedupData *shim_data = (DedupData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_path_root_component(base_vfs, path, root);
+}
+
+
+// Whole files are copied by sharing their chunks
+static int dedup__copy(Evfs *vfs, EvfsFile *dest, EvfsFile *src, evfs_off_t size) {
+  if(src->methods != &s_dedup_methods || dest->methods != &s_dedup_methods)
+    return EVFS_ERR_NO_SUPPORT;
+
+  DedupFile *src_fil = (DedupFile *)src;
+  DedupFile *dest_fil = (DedupFile *)dest;
+
+  // Only a new file copied from the start of a source without a tail
+  if(src_fil->shim_data != dest_fil->shim_data || !dest_fil->writable ||
+      src_fil->pos != 0 || size != src_fil->size || src_fil->tail_len > 0 ||
+      dest_fil->size != 0 || dest_fil->pos != 0)
+    return EVFS_ERR_NO_SUPPORT;
+
+  int status = dedup_reserve_chunks(dest_fil, src_fil->chunk_count);
+  if(status != EVFS_OK) return status;
+
+  memcpy(dest_fil->chunks, src_fil->chunks, src_fil->chunk_count * sizeof(*src_fil->chunks));
+  dest_fil->chunk_count = src_fil->chunk_count;
+  dest_fil->size = size;
+  dest_fil->pos = size;
+  dest_fil->dirty = true;
+  src_fil->pos = size;
+
+  DedupData *shim_data = dest_fil->shim_data;
+  evfs__lock(&shim_data->lock);
+  shim_data->stats.chunks_shared += src_fil->chunk_count;
+  shim_data->stats.bytes_shared += size;
+  evfs__unlock(&shim_data->lock);
+
+  return EVFS_OK;
+}
+
+
+
+// ******************** Chunk collection ********************
+
+static int key_list_add(DedupKeyList *list, const DedupKey *key) {
+  if(list->count == list->avail) {
+    size_t avail = list->avail ? list->avail * 2 : 256;
+    DedupKey *keys = evfs_malloc(avail * sizeof(*keys));
+    if(MEM_CHECK(keys)) return EVFS_ERR_ALLOC;
+
+    if(list->keys) {
+      memcpy(keys, list->keys, list->count * sizeof(*keys));
+      evfs_free(list->keys);
+    }
+
+    list->keys = keys;
+    list->avail = avail;
+  }
+
+  list->keys[list->count++] = *key;
+  return EVFS_OK;
+}
+
+
+static int compare_keys(const void *pa, const void *pb) {
+  const DedupKey *a = (const DedupKey *)pa;
+  const DedupKey *b = (const DedupKey *)pb;
+
+  if(a->hash != b->hash)
+    return a->hash < b->hash ? -1 : 1;
+
+  return (a->seq > b->seq) - (a->seq < b->seq);
+}
+
+
+// Walk visitor that records the chunks used by each manifest
+static int dedup_mark_visit(const char *path, const EvfsInfo *info, unsigned depth, void *ctx) {
+  DedupCollect *col = (DedupCollect *)ctx;
+  DedupData *shim_data = col->shim_data;
+
+  if(info->type & EVFS_FILE_DIR) // Skip the chunk store
+    return strcmp(path, shim_data->store_path) == 0 ? EVFS_DONE : EVFS_OK;
+
+  EvfsFile *base_file;
+  int status = evfs_vfs_open(shim_data->base_vfs, path, &base_file, EVFS_READ);
+  if(status != EVFS_OK) return status;
+
+  DedupFile fil = {
+    .shim_data    = shim_data,
+    .base_file    = base_file,
+    .stored_size  = base_file->methods->m_size(base_file)
+  };
+
+  status = dedup_load_manifest(&fil);
+
+  for(size_t i = 0; status == EVFS_OK && i < fil.chunk_count; i++) {
+    DedupKey key = {.hash = fil.chunks[i].hash, .seq = fil.chunks[i].seq};
+    status = key_list_add(&col->refs, &key);
+  }
+
+  evfs_free(fil.chunks);
+  evfs_file_close(base_file);
+
+  // Files that aren't manifests don't use any chunks
+  return status == EVFS_ERR_CORRUPTION ? EVFS_OK : status;
+}
+
+
+// Walk visitor that finds chunks without references
+static int dedup_sweep_visit(const char *path, const EvfsInfo *info, unsigned depth, void *ctx) {
+  DedupCollect *col = (DedupCollect *)ctx;
+  DedupKey key;
+
+  if((info->type & EVFS_FILE_DIR) || depth != 1 || !chunk_name_parse(info->name, &key))
+    return EVFS_OK;
+
+  if(bsearch(&key, col->refs.keys, col->refs.count, sizeof(key), compare_keys))
+    return EVFS_OK;
+
+  return key_list_add(&col->unused, &key);
+}
+
+
+/*
+Remove chunks that aren't used by any file
+
+Every manifest on the underlying VFS is expected to be under root. Chunks used
+only by files outside of it will be removed. This shouldn't run while files on
+the shim are open for writing since their new chunks aren't in a manifest yet.
+
+Args:
+  vfs_name:   Name of the dedup shim
+  root:       Directory on the underlying VFS holding all files stored through the shim
+  collected:  Number of chunks removed. Can be NULL
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_dedup_collect(const char *vfs_name, const char *root, size_t *collected) {
+  if(PTR_CHECK(vfs_name) || PTR_CHECK(root)) return EVFS_ERR_BAD_ARG;
+
+  if(collected)
+    *collected = 0;
+
+  Evfs *vfs = evfs_find_vfs(vfs_name);
+  if(PTR_CHECK(vfs)) return EVFS_ERR_NO_VFS;
+  if(vfs->m_open != dedup__open) return EVFS_ERR_BAD_ARG;
+
+  DedupData *shim_data = (DedupData *)vfs->fs_data;
+  const char *base_name = shim_data->base_vfs->vfs_name;
+
+  char *abs_root = evfs_class_malloc(EVFS_ALLOC_PATH, EVFS_MAX_PATH);
+  if(MEM_CHECK(abs_root)) return EVFS_ERR_ALLOC;
+
+  StringRange abs_r;
+  range_init(&abs_r, abs_root, EVFS_MAX_PATH);
+  int status = evfs_vfs_path_absolute(shim_data->base_vfs, root, &abs_r);
+
+  DedupCollect col = {.shim_data = shim_data};
+
+  if(status == EVFS_OK) {
+    EvfsWalkConfig walk_cfg = {
+      .pre_visit  = dedup_mark_visit,
+      .max_depth  = -1,
+      .ctx        = &col
+    };
+
+    status = evfs_walk_ex(abs_root, &walk_cfg, base_name);
+  }
+
+  if(status == EVFS_OK) {
+    qsort(col.refs.keys, col.refs.count, sizeof(DedupKey), compare_keys);
+
+    EvfsWalkConfig walk_cfg = {
+      .pre_visit  = dedup_sweep_visit,
+      .max_depth  = 1,
+      .ctx        = &col
+    };
+
+    status = evfs_walk_ex(shim_data->store_path, &walk_cfg, base_name);
+    if(status == EVFS_ERR_NO_FILE || status == EVFS_ERR_NO_PATH) // No chunks have been stored
+      status = EVFS_OK;
+  }
+
+  // Chunks are removed after the walk so directories aren't changed while they're read
+  for(size_t i = 0; status == EVFS_OK && i < col.unused.count; i++) {
+    DedupKey *key = &col.unused.keys[i];
+    chunk_path(shim_data, key->hash, key->seq, abs_root);
+
+    status = shim_data->base_vfs->m_delete(shim_data->base_vfs, abs_root);
+    if(status == EVFS_OK && collected)
+      (*collected)++;
+  }
+
+  evfs_free(col.refs.keys);
+  evfs_free(col.unused.keys);
+  evfs_class_free(EVFS_ALLOC_PATH, abs_root);
+
+  return status;
+}
+
+
+/*
+Register a deduplication filesystem shim
+
+Every file on the underlying VFS outside of the chunk store is expected to be
+a manifest. Files that aren't fail to open with EVFS_ERR_CORRUPTION. Files
+with chunks larger than max_chunk fail with EVFS_ERR_NO_SUPPORT.
+
+Args:
+  vfs_name:      Name of new shim
+  old_vfs_name:  Existing VFS to wrap with shim
+  cfg:           Chunk store location, chunk sizes, and cache size
+  default_vfs:   Make this the default VFS when true
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_register_dedup(const char *vfs_name, const char *old_vfs_name, DedupConfig *cfg,
+                        bool default_vfs) {
+  if(PTR_CHECK(vfs_name) || PTR_CHECK(old_vfs_name) || PTR_CHECK(cfg) ||
+      PTR_CHECK(cfg->store_path)) return EVFS_ERR_BAD_ARG;
+
+  Evfs *base_vfs, *shim_vfs;
+  DedupData *shim_data;
+
+  base_vfs = evfs_find_vfs(old_vfs_name);
+  if(PTR_CHECK(base_vfs)) return EVFS_ERR_NO_VFS;
+
+  size_t avg_chunk = cfg->avg_chunk ? cfg->avg_chunk : DEFAULT_AVG_CHUNK;
+  if(avg_chunk < MIN_AVG_CHUNK || avg_chunk > MAX_CHUNK_SIZE)
+    return EVFS_ERR_BAD_ARG;
+
+  unsigned avg_bits = 0;
+  while(((size_t)2 << avg_bits) <= avg_chunk)
+    avg_bits++;
+  avg_chunk = (size_t)1 << avg_bits;
+
+  size_t min_chunk = cfg->min_chunk ? cfg->min_chunk : avg_chunk / 4;
+  size_t max_chunk = cfg->max_chunk ? cfg->max_chunk : avg_chunk * 4;
+  max_chunk = MIN(max_chunk, MAX_CHUNK_SIZE);
+  if(min_chunk < MIN_CHUNK_SIZE || min_chunk >= avg_chunk || max_chunk <= avg_chunk)
+    return EVFS_ERR_BAD_ARG;
+
+  size_t cache_chunks = cfg->cache_chunks ? cfg->cache_chunks : DEFAULT_CACHE_CHUNKS;
+
+  // The store path is fixed so it doesn't follow changes to the current directory
+  char *store_path = evfs_class_malloc(EVFS_ALLOC_PATH, EVFS_MAX_PATH);
+  if(MEM_CHECK(store_path)) return EVFS_ERR_ALLOC;
+
+  StringRange store_r;
+  range_init(&store_r, store_path, EVFS_MAX_PATH);
+  int status = evfs_vfs_path_absolute(base_vfs, cfg->store_path, &store_r);
+  size_t store_len = strlen(store_path);
+
+  if(status == EVFS_OK && store_len + CHUNK_SUFFIX_LEN + 1 > EVFS_MAX_PATH)
+    status = EVFS_ERR_TOO_LONG;
+
+  if(status != EVFS_OK) {
+    evfs_class_free(EVFS_ALLOC_PATH, store_path);
+    return status;
+  }
+
+  // Construct a new VFS
+  // We have six objects allocated together
+  // [Evfs][DedupData][DedupCacheEntry[]][cache data][char[] store path][char[] cache path][char[] name]
+  size_t path_size = store_len + CHUNK_SUFFIX_LEN + 1;
+  size_t shim_size = sizeof(*shim_vfs) + sizeof(*shim_data) +
+                     cache_chunks * (sizeof(DedupCacheEntry) + max_chunk) +
+                     store_len+1 + path_size + strlen(vfs_name)+1;
+  shim_vfs = evfs_malloc(shim_size);
+  if(MEM_CHECK(shim_vfs)) {
+    evfs_class_free(EVFS_ALLOC_PATH, store_path);
+    return EVFS_ERR_ALLOC;
+  }
+
+  memset(shim_vfs, 0, shim_size);
+
+  shim_data = (DedupData *)NEXT_OBJ(shim_vfs);
+  shim_data->cache = (DedupCacheEntry *)NEXT_OBJ(shim_data);
+
+  uint8_t *cache_data = (uint8_t *)&shim_data->cache[cache_chunks];
+  for(size_t i = 0; i < cache_chunks; i++) {
+    shim_data->cache[i].data = cache_data;
+    cache_data += max_chunk;
+  }
+
+  char *strings = (char *)cache_data;
+  strcpy(strings, store_path);
+  shim_data->store_path = strings;
+  strings += store_len+1;
+
+  shim_data->cache_path = strings;
+  strings += path_size;
+
+  shim_vfs->vfs_name = strings;
+  strcpy((char *)shim_vfs->vfs_name, vfs_name);
+
+  evfs_class_free(EVFS_ALLOC_PATH, store_path);
+
+  shim_data->base_vfs     = base_vfs;
+  shim_data->vfs_name     = shim_vfs->vfs_name;
+  shim_data->shim_vfs     = shim_vfs;
+  shim_data->path_size    = path_size;
+  shim_data->min_chunk    = min_chunk;
+  shim_data->max_chunk    = max_chunk;
+  shim_data->cut_mask     = ~(uint64_t)0 << (64 - avg_bits);
+  shim_data->cache_chunks = cache_chunks;
+  gear_init(shim_data->gear);
+
+  if(evfs__lock_init(&shim_data->lock) != EVFS_OK) {
+    evfs_free(shim_vfs);
+    return EVFS_ERR_INIT;
+  }
+
+  shim_vfs->vfs_file_size = sizeof(DedupFile) + base_vfs->vfs_file_size;
+  shim_vfs->vfs_dir_size = base_vfs->vfs_dir_size;
+  shim_vfs->fs_data = shim_data;
+
+  shim_vfs->m_open = dedup__open;
+  shim_vfs->m_stat = dedup__stat;
+  shim_vfs->m_delete = dedup__delete;
+  shim_vfs->m_rename = dedup__rename;
+  shim_vfs->m_make_dir = dedup__make_dir;
+  shim_vfs->m_open_dir = dedup__open_dir;
+  shim_vfs->m_get_cur_dir = dedup__get_cur_dir;
+  shim_vfs->m_set_cur_dir = dedup__set_cur_dir;
+  shim_vfs->m_vfs_ctrl = dedup__vfs_ctrl;
+  shim_vfs->m_copy = dedup__copy;
+
+  shim_vfs->m_path_root_component = dedup__path_root_component;
+
+  return evfs_register(shim_vfs, default_vfs);
+}
@@ -0,0 +1,903 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Integrity shim VFS
+
+  Each protected file has a sidecar named with EVFS_INTEGRITY_SUFFIX that
+  holds a CRC32C for every block of block_size bytes. The sidecar starts with
+  a 20-byte header giving the block size, the file size, and a CRC of the
+  header and table. All values are little-endian:
+
+    [magic][block_size][file_size:u64][check] [crc 0] ... [crc N-1]
+
+  The table is loaded when a file is opened. A sidecar that doesn't match the
+  file size is stale and the open fails with EVFS_ERR_CORRUPTION. Reads that
+  cover whole blocks are checked in the caller's buffer so data is only read
+  once. Partial blocks are read into a cache and checked there.
+
+  Writes pass through and mark their blocks as changed. Changed blocks are
+  read back to update their CRCs and the sidecar is rewritten when the file
+  is synced or closed. Reads of changed blocks before then aren't verified.
+  Files written through the shim always get a sidecar. Files without one can
+  be read unverified unless require_checksums is set.
+
+  Sidecars are hidden from directory listings and follow their file when it
+  is renamed or deleted.
+------------------------------------------------------------------------------
+*/
+
+#include <string.h>
+
+#include "evfs.h"
+#include "evfs_internal.h"
+#include "evfs/util/checksum.h"
+#include "evfs/util/unaligned_access.h"
+#include "evfs/shim/shim_integrity.h"
+
+
+// Access objects allocated in a single block of memory
+#define NEXT_OBJ(o) (&(o)[1])
+
+#define DEFAULT_BLOCK_SIZE  4096
+#define MIN_BLOCK_SIZE      64
+#define MAX_BLOCK_SIZE      (1024 * 1024UL)
+
+#define SIDECAR_MAGIC       0x4B435645UL  // "EVCK"
+#define SIDECAR_HDR_SIZE    20
+#define SIDECAR_CHECKED     16            // Header bytes covered by the check field
+#define SUFFIX_LEN          (sizeof(EVFS_INTEGRITY_SUFFIX)-1)
+
+// No block in the cache or no changed blocks
+#define NO_BLOCK  ((size_t)-1)
+
+
+typedef struct IntegrityData {
+  Evfs       *base_vfs;
+  const char *vfs_name;
+  Evfs       *shim_vfs;
+
+  size_t      block_size; // Block size for new sidecars
+  bool        require_checksums;
+} IntegrityData;
+
+typedef struct IntegrityFile {
+  EvfsFile        base;
+  IntegrityData  *shim_data;
+  EvfsFile       *base_file;
+  char           *sidecar_path;
+
+  size_t          block_size;
+  uint32_t       *crcs;         // CRC of each block
+  size_t          crcs_avail;
+  uint8_t        *block;        // Verified block cache
+  size_t          cached_block; // Block held in cache or NO_BLOCK
+
+  evfs_off_t      size;
+  evfs_off_t      pos;
+  size_t          dirty_first;  // Range of changed blocks or NO_BLOCK
+  size_t          dirty_last;
+
+  bool            verify;       // CRCs are available
+  bool            modified;     // Sidecar is out of date
+  bool            writable;
+  bool            append;
+  bool            eof;
+} IntegrityFile;
+
+typedef struct IntegrityDir {
+  EvfsDir         base;
+  IntegrityData  *shim_data;
+  EvfsDir        *base_dir;
+} IntegrityDir;
+
+
+
+// ******************** Checksum table ********************
+
+static inline size_t integrity_block_count(IntegrityFile *fil) {
+  return (fil->size + fil->block_size - 1) / fil->block_size;
+}
+
+
+static inline size_t integrity_block_len(IntegrityFile *fil, size_t block) {
+  evfs_off_t start = (evfs_off_t)block * fil->block_size;
+  return MIN((evfs_off_t)fil->block_size, fil->size - start);
+}
+
+
+static inline bool integrity_is_dirty(IntegrityFile *fil, size_t block) {
+  return fil->dirty_first != NO_BLOCK && block >= fil->dirty_first && block <= fil->dirty_last;
+}
+
+
+static void integrity_mark_dirty(IntegrityFile *fil, size_t first, size_t last) {
+  if(fil->dirty_first == NO_BLOCK) {
+    fil->dirty_first = first;
+    fil->dirty_last = last;
+  } else {
+    fil->dirty_first = MIN(fil->dirty_first, first);
+    fil->dirty_last = MAX(fil->dirty_last, last);
+  }
+
+  if(fil->cached_block != NO_BLOCK && fil->cached_block >= first && fil->cached_block <= last)
+    fil->cached_block = NO_BLOCK;
+
+  fil->modified = true;
+}
+
+
+static int integrity_reserve_crcs(IntegrityFile *fil, size_t count) {
+  if(count <= fil->crcs_avail)
+    return EVFS_OK;
+
+  size_t avail = fil->crcs_avail ? fil->crcs_avail : 16;
+  while(avail < count)
+    avail *= 2;
+
+  uint32_t *crcs = evfs_malloc(avail * sizeof(*crcs));
+  if(MEM_CHECK(crcs)) return EVFS_ERR_ALLOC;
+
+  if(fil->crcs) {
+    memcpy(crcs, fil->crcs, fil->crcs_avail * sizeof(*crcs));
+    evfs_free(fil->crcs);
+  }
+
+  fil->crcs = crcs;
+  fil->crcs_avail = avail;
+  return EVFS_OK;
+}
+
+
+static int integrity_sidecar_path(const char *path, char *sidecar_path) {
+  size_t path_len = strlen(path);
+  if(path_len + SUFFIX_LEN + 1 > EVFS_MAX_PATH)
+    return EVFS_ERR_TOO_LONG;
+
+  memcpy(sidecar_path, path, path_len);
+  memcpy(&sidecar_path[path_len], EVFS_INTEGRITY_SUFFIX, SUFFIX_LEN+1);
+  return EVFS_OK;
+}
+
+
+static bool integrity_is_sidecar(const char *name) {
+  size_t name_len = strlen(name);
+  return name_len > SUFFIX_LEN && !strcmp(&name[name_len - SUFFIX_LEN], EVFS_INTEGRITY_SUFFIX);
+}
+
+
+static int integrity_load_sidecar(IntegrityFile *fil) {
+  Evfs *base_vfs = fil->shim_data->base_vfs;
+  EvfsFile *fh;
+
+  int status = evfs_vfs_open(base_vfs, fil->sidecar_path, &fh, EVFS_READ);
+  if(status != EVFS_OK) return status;
+
+  uint8_t hdr[SIDECAR_HDR_SIZE];
+  ptrdiff_t rval = evfs_file_read(fh, hdr, sizeof(hdr));
+  if(rval != sizeof(hdr)) {
+    status = rval < 0 ? rval : EVFS_ERR_CORRUPTION;
+    goto cleanup;
+  }
+
+  size_t block_size = get_unaligned_u32le(&hdr[4]);
+  uint64_t file_size = get_unaligned_u32le(&hdr[8]) | ((uint64_t)get_unaligned_u32le(&hdr[12]) << 32);
+
+  // A size mismatch means the file was changed without updating its sidecar
+  if(get_unaligned_u32le(&hdr[0]) != SIDECAR_MAGIC || block_size < MIN_BLOCK_SIZE ||
+      block_size > MAX_BLOCK_SIZE || file_size != (uint64_t)fil->size) {
+    status = EVFS_ERR_CORRUPTION;
+    goto cleanup;
+  }
+
+  fil->block_size = block_size;
+  size_t count = integrity_block_count(fil);
+
+  status = integrity_reserve_crcs(fil, count);
+  if(status != EVFS_OK) goto cleanup;
+
+  uint32_t check = crc32c(hdr, SIDECAR_CHECKED);
+
+  if(count > 0) { // Empty files have no table
+    rval = evfs_file_read(fh, fil->crcs, count * sizeof(uint32_t));
+    if(rval != (ptrdiff_t)(count * sizeof(uint32_t))) {
+      status = rval < 0 ? rval : EVFS_ERR_CORRUPTION;
+      goto cleanup;
+    }
+
+    check = crc32c_update(check, fil->crcs, count * sizeof(uint32_t));
+  }
+
+  if(check != get_unaligned_u32le(&hdr[16])) {
+    status = EVFS_ERR_CORRUPTION;
+    goto cleanup;
+  }
+
+  // Convert table to native order
+  for(size_t i = 0; i < count; i++)
+    fil->crcs[i] = get_unaligned_u32le(&fil->crcs[i]);
+
+cleanup:
+  evfs_file_close(fh);
+  return status;
+}
+
+
+// Serialize a range of the table into buf
+static size_t integrity_pack_crcs(IntegrityFile *fil, size_t first, size_t count, uint8_t *buf,
+                                  size_t buf_size) {
+  size_t packed = MIN(count - first, buf_size / sizeof(uint32_t));
+  for(size_t i = 0; i < packed; i++)
+    set_unaligned_u32le(fil->crcs[first + i], &buf[i * sizeof(uint32_t)]);
+
+  return packed;
+}
+
+
+static int integrity_save_sidecar(IntegrityFile *fil) {
+  size_t count = integrity_block_count(fil);
+  uint8_t hdr[SIDECAR_HDR_SIZE];
+
+  set_unaligned_u32le(SIDECAR_MAGIC, &hdr[0]);
+  set_unaligned_u32le(fil->block_size, &hdr[4]);
+  set_unaligned_u32le((uint64_t)fil->size & 0xFFFFFFFFUL, &hdr[8]);
+  set_unaligned_u32le((uint64_t)fil->size >> 32, &hdr[12]);
+
+  // The block cache is free to stage the table
+  uint8_t *buf = fil->block;
+  fil->cached_block = NO_BLOCK;
+
+  uint32_t check = crc32c(hdr, SIDECAR_CHECKED);
+  for(size_t i = 0; i < count; ) {
+    size_t packed = integrity_pack_crcs(fil, i, count, buf, fil->block_size);
+    check = crc32c_update(check, buf, packed * sizeof(uint32_t));
+    i += packed;
+  }
+  set_unaligned_u32le(check, &hdr[16]);
+
+  EvfsFile *fh;
+  int status = evfs_vfs_open(fil->shim_data->base_vfs, fil->sidecar_path, &fh,
+                             EVFS_WRITE | EVFS_OVERWRITE);
+  if(status != EVFS_OK) return status;
+
+  ptrdiff_t wrote = evfs_file_write(fh, hdr, sizeof(hdr));
+  if(wrote != sizeof(hdr))
+    status = wrote < 0 ? wrote : EVFS_ERR_IO;
+
+  for(size_t i = 0; i < count && status == EVFS_OK; ) {
+    size_t packed = integrity_pack_crcs(fil, i, count, buf, fil->block_size);
+    size_t packed_bytes = packed * sizeof(uint32_t);
+
+    wrote = evfs_file_write(fh, buf, packed_bytes);
+    if(wrote != (ptrdiff_t)packed_bytes)
+      status = wrote < 0 ? wrote : EVFS_ERR_IO;
+
+    i += packed;
+  }
+
+  int close_status = evfs_file_close(fh);
+  return status != EVFS_OK ? status : close_status;
+}
+
+
+// Read a block into the cache and check it
+static int integrity_load_block(IntegrityFile *fil, size_t block) {
+  if(fil->cached_block == block)
+    return EVFS_OK;
+
+  fil->cached_block = NO_BLOCK;
+
+  size_t len = integrity_block_len(fil, block);
+  ptrdiff_t rval = evfs_file_read_at(fil->base_file, fil->block, len, (evfs_off_t)block * fil->block_size);
+  if(rval != (ptrdiff_t)len)
+    return rval < 0 ? rval : EVFS_ERR_IO;
+
+  if(crc32c(fil->block, len) != fil->crcs[block])
+    return EVFS_ERR_CORRUPTION;
+
+  fil->cached_block = block;
+  return EVFS_OK;
+}
+
+
+// Update CRCs of changed blocks and rewrite the sidecar
+static int integrity_flush(IntegrityFile *fil) {
+  if(!fil->modified)
+    return EVFS_OK;
+
+  size_t count = integrity_block_count(fil);
+  int status = integrity_reserve_crcs(fil, count);
+  if(status != EVFS_OK) return status;
+
+  if(fil->dirty_first != NO_BLOCK) {
+    fil->cached_block = NO_BLOCK;
+    size_t last = MIN(fil->dirty_last, count-1);
+
+    for(size_t b = fil->dirty_first; b <= last && b < count; b++) {
+      size_t len = integrity_block_len(fil, b);
+      ptrdiff_t rval = evfs_file_read_at(fil->base_file, fil->block, len, (evfs_off_t)b * fil->block_size);
+      if(rval != (ptrdiff_t)len)
+        return rval < 0 ? rval : EVFS_ERR_IO;
+
+      fil->crcs[b] = crc32c(fil->block, len);
+    }
+  }
+
+  status = integrity_save_sidecar(fil);
+  if(status != EVFS_OK) return status;
+
+  fil->dirty_first = NO_BLOCK;
+  fil->modified = false;
+  return EVFS_OK;
+}
+
+
+static ptrdiff_t integrity_write_data(IntegrityFile *fil, const void *buf, size_t size, evfs_off_t offset) {
+  ptrdiff_t wrote = evfs_file_write_at(fil->base_file, buf, size, offset);
+  if(wrote <= 0) return wrote;
+
+  // Writing past the end also changes the gap the base fills with zeros
+  evfs_off_t start = MIN(offset, fil->size);
+  evfs_off_t end = offset + wrote;
+
+  integrity_mark_dirty(fil, start / fil->block_size, (end-1) / fil->block_size);
+  fil->size = MAX(fil->size, end);
+
+  return wrote;
+}
+
+
+
+// ******************** File access methods ********************
+
+static int integrity__file_ctrl(EvfsFile *fh, int cmd, void *arg) {
+  IntegrityFile *fil = (IntegrityFile *)fh;
+
+  return fil->base_file->methods->m_ctrl(fil->base_file, cmd, arg);
+}
+
+
+static int integrity__file_close(EvfsFile *fh) {
+  IntegrityFile *fil = (IntegrityFile *)fh;
+
+  int flush_status = integrity_flush(fil);
+  int status = fil->base_file->methods->m_close(fil->base_file);
+
+  evfs_free(fil->block);
+  evfs_free(fil->crcs);
+  evfs_free(fil->sidecar_path);
+  fil->block = NULL;
+  fil->crcs = NULL;
+  fil->sidecar_path = NULL;
+  fil->base.methods = NULL;
+
+  return flush_status != EVFS_OK ? flush_status : status;
+}
+
+
+static ptrdiff_t integrity__file_read_at(EvfsFile *fh, void *buf, size_t size, evfs_off_t offset) {
+  IntegrityFile *fil = (IntegrityFile *)fh;
+  uint8_t *cbuf = (uint8_t *)buf;
+
+  if(!fil->verify)
+    return evfs_file_read_at(fil->base_file, buf, size, offset);
+
+  if(offset >= fil->size)
+    return 0;
+
+  size = MIN((evfs_off_t)size, fil->size - offset);
+  size_t read = 0;
+
+  while(read < size) {
+    size_t block = offset / fil->block_size;
+    size_t block_off = offset % fil->block_size;
+    size_t block_len = integrity_block_len(fil, block);
+    size_t remaining = size - read;
+    size_t copy_size;
+
+    if(integrity_is_dirty(fil, block)) { // Changed by this handle and not checked
+      copy_size = MIN(remaining, block_len - block_off);
+      ptrdiff_t rval = evfs_file_read_at(fil->base_file, &cbuf[read], copy_size, offset);
+      if(rval != (ptrdiff_t)copy_size)
+        return read > 0 ? (ptrdiff_t)read : (rval < 0 ? rval : EVFS_ERR_IO);
+
+    } else if(block_off == 0 && remaining >= block_len && block != fil->cached_block) {
+      // Whole blocks are read and checked in the caller's buffer
+      size_t end_block = block + 1;
+      copy_size = block_len;
+      size_t count = integrity_block_count(fil);
+
+      while(end_block < count && !integrity_is_dirty(fil, end_block) &&
+            copy_size + integrity_block_len(fil, end_block) <= remaining) {
+        copy_size += integrity_block_len(fil, end_block);
+        end_block++;
+      }
+
+      ptrdiff_t rval = evfs_file_read_at(fil->base_file, &cbuf[read], copy_size, offset);
+      if(rval != (ptrdiff_t)copy_size)
+        return read > 0 ? (ptrdiff_t)read : (rval < 0 ? rval : EVFS_ERR_IO);
+
+      uint8_t *check_pos = &cbuf[read];
+      for(size_t b = block; b < end_block; b++) {
+        size_t len = integrity_block_len(fil, b);
+        if(crc32c(check_pos, len) != fil->crcs[b])
+          return EVFS_ERR_CORRUPTION;
+
+        check_pos += len;
+      }
+
+    } else {
+      int status = integrity_load_block(fil, block);
+      if(status == EVFS_ERR_CORRUPTION)
+        return status;
+      else if(status != EVFS_OK)
+        return read > 0 ? (ptrdiff_t)read : status;
+
+      copy_size = MIN(remaining, block_len - block_off);
+      memcpy(&cbuf[read], &fil->block[block_off], copy_size);
+    }
+
+    read += copy_size;
+    offset += copy_size;
+  }
+
+  return read;
+}
+
+
+static ptrdiff_t integrity__file_read(EvfsFile *fh, void *buf, size_t size) {
+  IntegrityFile *fil = (IntegrityFile *)fh;
+
+  ptrdiff_t read = integrity__file_read_at(fh, buf, size, fil->pos);
+  if(read < 0) return read;
+
+  fil->pos += read;
+  if((size_t)read < size)
+    fil->eof = true;
+
+  return read;
+}
+
+
+static ptrdiff_t integrity__file_write_at(EvfsFile *fh, const void *buf, size_t size, evfs_off_t offset) {
+  IntegrityFile *fil = (IntegrityFile *)fh;
+
+  if(!fil->writable) return EVFS_ERR_DISABLED;
+
+  return integrity_write_data(fil, buf, size, offset);
+}
+
+
+static ptrdiff_t integrity__file_write(EvfsFile *fh, const void *buf, size_t size) {
+  IntegrityFile *fil = (IntegrityFile *)fh;
+
+  if(!fil->writable) return EVFS_ERR_DISABLED;
+
+  if(fil->append)
+    fil->pos = fil->size;
+
+  ptrdiff_t wrote = integrity_write_data(fil, buf, size, fil->pos);
+  if(wrote > 0)
+    fil->pos += wrote;
+
+  return wrote;
+}
+
+
+static int integrity__file_truncate(EvfsFile *fh, evfs_off_t size) {
+  IntegrityFile *fil = (IntegrityFile *)fh;
+
+  if(!fil->writable) return EVFS_ERR_DISABLED;
+
+  int status = fil->base_file->methods->m_truncate(fil->base_file, size);
+  if(status != EVFS_OK) return status;
+
+  // The new last block changes when it is cut short or extended
+  if(size < fil->size) {
+    integrity_mark_dirty(fil, size / fil->block_size, size / fil->block_size);
+  } else if(size > fil->size) {
+    integrity_mark_dirty(fil, fil->size / fil->block_size, (size-1) / fil->block_size);
+  }
+
+  fil->size = size;
+  return EVFS_OK;
+}
+
+
+static int integrity__file_sync(EvfsFile *fh) {
+  IntegrityFile *fil = (IntegrityFile *)fh;
+
+  int status = fil->base_file->methods->m_sync(fil->base_file);
+  if(status != EVFS_OK) return status;
+
+  return integrity_flush(fil);
+}
+
+
+static evfs_off_t integrity__file_size(EvfsFile *fh) {
+  IntegrityFile *fil = (IntegrityFile *)fh;
+
+  return fil->size;
+}
+
+
+static int integrity__file_seek(EvfsFile *fh, evfs_off_t offset, EvfsSeekDir origin) {
+  IntegrityFile *fil = (IntegrityFile *)fh;
+
+  fil->pos = evfs__absolute_offset(fh, offset, origin);
+  fil->eof = false;
+
+  return EVFS_OK;
+}
+
+
+static evfs_off_t integrity__file_tell(EvfsFile *fh) {
+  IntegrityFile *fil = (IntegrityFile *)fh;
+
+  return fil->pos;
+}
+
+
+static bool integrity__file_eof(EvfsFile *fh) {
+  IntegrityFile *fil = (IntegrityFile *)fh;
+
+  return fil->eof;
+}
+
+
+static const EvfsFileMethods s_integrity_methods = {
+  .m_ctrl     = integrity__file_ctrl,
+  .m_close    = integrity__file_close,
+  .m_read     = integrity__file_read,
+  .m_write    = integrity__file_write,
+  .m_truncate = integrity__file_truncate,
+  .m_sync     = integrity__file_sync,
+  .m_size     = integrity__file_size,
+  .m_seek     = integrity__file_seek,
+  .m_tell     = integrity__file_tell,
+  .m_eof      = integrity__file_eof,
+  .m_read_at  = integrity__file_read_at,
+  .m_write_at = integrity__file_write_at
+};
+
+
+
+// ******************** Directory access methods ********************
+
+static int integrity__dir_close(EvfsDir *dh) {
+  IntegrityDir *dir = (IntegrityDir *)dh;
+
+  int status = dir->base_dir->methods->m_close(dir->base_dir);
+
+  if(status == EVFS_OK) {
+    dir->base.methods = NULL; // Disable this instance
+  }
+
+  return status;
+}
+
+
+// Sidecars are skipped
+static int integrity__dir_read(EvfsDir *dh, EvfsInfo *info) {
+  IntegrityDir *dir = (IntegrityDir *)dh;
+
+  int status;
+  do {
+    status = dir->base_dir->methods->m_read(dir->base_dir, info);
+  } while(status == EVFS_OK && info->name && integrity_is_sidecar(info->name));
+
+  return status;
+}
+
+
+static int integrity__dir_rewind(EvfsDir *dh) {
+  IntegrityDir *dir = (IntegrityDir *)dh;
+
+  return dir->base_dir->methods->m_rewind(dir->base_dir);
+}
+
+
+static const EvfsDirMethods s_integrity_dir_methods = {
+  .m_close    = integrity__dir_close,
+  .m_read     = integrity__dir_read,
+  .m_rewind   = integrity__dir_rewind
+};
+
+
+
+// ******************** FS access methods ********************
+
+static int integrity__open(Evfs *vfs, const char *path, EvfsFile *fh, int flags) {
+  IntegrityFile *fil = (IntegrityFile *)fh;
+  IntegrityData *shim_data = (IntegrityData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  memset(fil, 0, sizeof(*fil));
+  fil->shim_data = shim_data;
+  fil->base_file = (EvfsFile *)NEXT_OBJ(fil);  // We have two objects allocated together [IntegrityFile][<base VFS file size>]
+
+  // Changed blocks are read back and appends are handled here
+  int base_flags = flags & ~EVFS_APPEND;
+  if(flags & EVFS_WRITE)
+    base_flags |= EVFS_READ;
+
+  size_t path_len = strlen(path) + SUFFIX_LEN + 1;
+  if(path_len > EVFS_MAX_PATH) {
+    fh->methods = NULL;
+    return EVFS_ERR_TOO_LONG;
+  }
+
+  fil->sidecar_path = evfs_malloc(path_len);
+  if(MEM_CHECK(fil->sidecar_path)) {
+    fh->methods = NULL;
+    return EVFS_ERR_ALLOC;
+  }
+
+  integrity_sidecar_path(path, fil->sidecar_path);
+
+  int status = base_vfs->m_open(base_vfs, path, fil->base_file, base_flags);
+
+  if(status == EVFS_OK && !fil->base_file->methods)
+    status = EVFS_ERR_INIT;
+
+  if(status != EVFS_OK) {
+    evfs_free(fil->sidecar_path);
+    fh->methods = NULL;
+    return status;
+  }
+
+  fil->writable     = flags & EVFS_WRITE;
+  fil->append       = flags & EVFS_APPEND;
+  fil->block_size   = shim_data->block_size;
+  fil->cached_block = NO_BLOCK;
+  fil->dirty_first  = NO_BLOCK;
+  fil->size         = fil->base_file->methods->m_size(fil->base_file);
+
+  if(flags & EVFS_OVERWRITE) { // Old sidecar no longer applies
+    fil->verify = true;
+    fil->modified = true;
+
+  } else {
+    status = integrity_load_sidecar(fil);
+
+    if(status == EVFS_OK) {
+      fil->verify = true;
+
+    } else if(status == EVFS_ERR_NO_FILE) { // Unprotected file
+      status = EVFS_OK;
+
+      if(fil->writable) { // Build a sidecar for the whole file
+        fil->verify = true;
+        fil->block_size = shim_data->block_size;
+        if(fil->size > 0)
+          integrity_mark_dirty(fil, 0, integrity_block_count(fil)-1);
+        else
+          fil->modified = true;
+
+      } else if(shim_data->require_checksums) {
+        status = EVFS_ERR_CORRUPTION;
+      }
+    }
+  }
+
+  // The cache is sized after loading since sidecars keep their own block size
+  if(status == EVFS_OK) {
+    fil->block = evfs_malloc(fil->block_size);
+    if(MEM_CHECK(fil->block)) status = EVFS_ERR_ALLOC;
+  }
+
+  if(status != EVFS_OK) { // Open failed
+    fil->base_file->methods->m_close(fil->base_file);
+    evfs_free(fil->crcs);
+    evfs_free(fil->block);
+    evfs_free(fil->sidecar_path);
+    fh->methods = NULL;
+    return status;
+  }
+
+  // Add methods to make this functional
+  fh->methods = &s_integrity_methods;
+  return EVFS_OK;
+}
+
+
+static int integrity__stat(Evfs *vfs, const char *path, EvfsInfo *info) {
+  IntegrityData *shim_data = (IntegrityData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_stat(base_vfs, path, info);
+}
+
+
+static int integrity__delete(Evfs *vfs, const char *path) {
+  IntegrityData *shim_data = (IntegrityData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  int status = base_vfs->m_delete(base_vfs, path);
+  if(status != EVFS_OK) return status;
+
+  char sidecar_path[EVFS_MAX_PATH];
+  if(integrity_sidecar_path(path, sidecar_path) == EVFS_OK)
+    base_vfs->m_delete(base_vfs, sidecar_path); // Not all files have a sidecar
+
+  return EVFS_OK;
+}
+
+
+static int integrity__rename(Evfs *vfs, const char *old_path, const char *new_path) {
+  IntegrityData *shim_data = (IntegrityData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  char old_sidecar[EVFS_MAX_PATH];
+  char new_sidecar[EVFS_MAX_PATH];
+
+  int status = integrity_sidecar_path(old_path, old_sidecar);
+  if(status == EVFS_OK)
+    status = integrity_sidecar_path(new_path, new_sidecar);
+  if(status != EVFS_OK) return status;
+
+  status = base_vfs->m_rename(base_vfs, old_path, new_path);
+  if(status != EVFS_OK) return status;
+
+  // Replace any sidecar left at the new name
+  base_vfs->m_delete(base_vfs, new_sidecar);
+
+  EvfsInfo info;
+  if(base_vfs->m_stat(base_vfs, old_sidecar, &info) == EVFS_OK)
+    status = base_vfs->m_rename(base_vfs, old_sidecar, new_sidecar);
+
+  return status;
+}
+
+
+static int integrity__make_dir(Evfs *vfs, const char *path) {
+  IntegrityData *shim_data = (IntegrityData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_make_dir(base_vfs, path);
+}
+
+
+static int integrity__open_dir(Evfs *vfs, const char *path, EvfsDir *dh) {
+  IntegrityDir *dir = (IntegrityDir *)dh;
+  IntegrityData *shim_data = (IntegrityData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  dir->shim_data = shim_data;
+  dir->base_dir = (EvfsDir *)NEXT_OBJ(dir);   // We have two objects allocated together [IntegrityDir][<base VFS dir size>]
+
+  int status = base_vfs->m_open_dir(base_vfs, path, dir->base_dir);
+
+  if(status == EVFS_OK) {
+    // Construct a shimmed dir object
+    if(dir->base_dir->methods) {
+      dh->methods = &s_integrity_dir_methods;
+    } else {
+      dh->methods = NULL;
+      status = EVFS_ERR_INIT;
+    }
+
+  } else { // Open failed
+    dh->methods = NULL;
+  }
+
+  return status;
+}
+
+
+static int integrity__get_cur_dir(Evfs *vfs, StringRange *cur_dir) {
+  IntegrityData *shim_data = (IntegrityData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_get_cur_dir(base_vfs, cur_dir);
+}
+
+
+static int integrity__set_cur_dir(Evfs *vfs, const char *path) {
+  IntegrityData *shim_data = (IntegrityData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_set_cur_dir(base_vfs, path);
+}
+
+
+static int integrity__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
+  IntegrityData *shim_data = (IntegrityData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  switch(cmd) {
+    // We need special handling for EVFS_CMD_UNREGISTER.
+    // It can't pass through since we need to deallocate VFSs in the proper sequence
+    // to avoid corrupting the registered VFS linked list.
+    case EVFS_CMD_UNREGISTER:
+      evfs_free(vfs); // Free this integrity VFS
+      return EVFS_OK; break;
+
+    default: // Everything else passes to the underlying VFS
+      return base_vfs->m_vfs_ctrl(base_vfs, cmd, arg);
+      break;
+  }
+}
+
+
+static bool integrity__path_root_component(Evfs *vfs, const char *path, StringRange *root) {
+  IntegrityData *shim_data = (IntegrityData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_path_root_component(base_vfs, path, root);
+}
+
+
+/*
+Register an integrity filesystem shim
+
+Args:
+  vfs_name:      Name of new shim
+  old_vfs_name:  Existing VFS to wrap with shim
+  cfg:           Block size and checksum policy. Use NULL for defaults
+  default_vfs:   Make this the default VFS when true
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_register_integrity(const char *vfs_name, const char *old_vfs_name, IntegrityConfig *cfg,
+                            bool default_vfs) {
+  if(PTR_CHECK(vfs_name) || PTR_CHECK(old_vfs_name)) return EVFS_ERR_BAD_ARG;
+
+  Evfs *base_vfs, *shim_vfs;
+  IntegrityData *shim_data;
+
+  base_vfs = evfs_find_vfs(old_vfs_name);
+  if(PTR_CHECK(base_vfs)) return EVFS_ERR_NO_VFS;
+
+  size_t block_size = (cfg && cfg->block_size) ? cfg->block_size : DEFAULT_BLOCK_SIZE;
+  if(block_size < MIN_BLOCK_SIZE || block_size > MAX_BLOCK_SIZE)
+    return EVFS_ERR_BAD_ARG;
+
+  // Build CRC tables before any threads use them
+  crc32c_init();
+
+  // Construct a new VFS
+  // We have three objects allocated together [Evfs][IntegrityData][char[]]
+  size_t shim_size = sizeof(*shim_vfs) + sizeof(*shim_data) + strlen(vfs_name)+1;
+  shim_vfs = evfs_malloc(shim_size);
+  if(MEM_CHECK(shim_vfs)) return EVFS_ERR_ALLOC;
+
+  memset(shim_vfs, 0, shim_size);
+
+  shim_data = (IntegrityData *)NEXT_OBJ(shim_vfs);
+
+  shim_vfs->vfs_name = (char *)NEXT_OBJ(shim_data);
+  strcpy((char *)shim_vfs->vfs_name, vfs_name);
+
+  shim_data->base_vfs           = base_vfs;
+  shim_data->vfs_name           = shim_vfs->vfs_name;
+  shim_data->shim_vfs           = shim_vfs;
+  shim_data->block_size         = block_size;
+  shim_data->require_checksums  = cfg ? cfg->require_checksums : false;
+
+  shim_vfs->vfs_file_size = sizeof(IntegrityFile) + base_vfs->vfs_file_size;
+  shim_vfs->vfs_dir_size = sizeof(IntegrityDir) + base_vfs->vfs_dir_size;
+  shim_vfs->fs_data = shim_data;
+
+  shim_vfs->m_open = integrity__open;
+  shim_vfs->m_stat = integrity__stat;
+  shim_vfs->m_delete = integrity__delete;
+  shim_vfs->m_rename = integrity__rename;
+  shim_vfs->m_make_dir = integrity__make_dir;
+  shim_vfs->m_open_dir = integrity__open_dir;
+  shim_vfs->m_get_cur_dir = integrity__get_cur_dir;
+  shim_vfs->m_set_cur_dir = integrity__set_cur_dir;
+  shim_vfs->m_vfs_ctrl = integrity__vfs_ctrl;
+
+  shim_vfs->m_path_root_component = integrity__path_root_component;
+
+  return evfs_register(shim_vfs, default_vfs);
+}
@@ -29,21 +29,20 @@ Embedded Virtual Filesystem
 #include "evfs.h"
 #include "evfs_internal.h"
 #include "evfs/shim/shim_jail.h"
-#include "bsd/string.h"
 
 
-// Shared buffer needs lock if threading is enabled
-#if defined EVFS_USE_THREADING
-#  define USE_JAIL_LOCK
-#endif
-
-
-#ifdef USE_JAIL_LOCK
-#  define LOCK()    evfs__lock(&shim_data->jail_lock)
-#  define UNLOCK()  evfs__unlock(&shim_data->jail_lock)
+// Get a buffer for translated paths
+// Paths are translated into per-thread scratch buffers or the caller's stack
+// so jailed operations never serialize on a shared buffer.
+#ifdef EVFS_USE_SCRATCH_PATHS
+#  define GET_TMP_PATH(buf)  char *buf = evfs__scratch_path_get(); do { \
+  if(MEM_CHECK(buf)) \
+    return EVFS_ERR_ALLOC; \
+} while(0)
+#  define FREE_TMP_PATH(buf)  evfs__scratch_path_put(buf)
 #else
-#  define LOCK()
-#  define UNLOCK()
+#  define GET_TMP_PATH(buf)  char buf[EVFS_MAX_PATH]
+#  define FREE_TMP_PATH(buf)
 #endif
 
 
@@ -57,13 +56,8 @@ typedef struct JailData_s {
   const char *vfs_name;
   Evfs       *shim_vfs;
 
-  const char *jail_root;                // Absolute dir for jail in containing VFS
-  char        cur_dir[EVFS_MAX_PATH];   // CWD within jailed environment
-
-  char        tmp_path[EVFS_MAX_PATH]; // Shared buffer for unjailed paths
-#ifdef USE_JAIL_LOCK
-  EvfsLock    jail_lock; // Serialize access to shared tmp_path buffer
-#endif
+  StringRange root_prefix;              // Normalized absolute jail root with trailing separator
+  char        cur_dir[EVFS_MAX_PATH];   // Normalized CWD within jailed environment
 } JailData;
 
 typedef struct JailFile_s {
@@ -87,8 +81,14 @@ static void unjail_path(Evfs *vfs, const char *path, StringRange *real_path) {
   AppendRange real_r = *(AppendRange *)real_path;
 
   // Start with jail root
-  range_cat_str(&real_r, shim_data->jail_root);
-  range_cat_char(&real_r, EVFS_DIR_SEP);
+  range_cat_range(&real_r, &shim_data->root_prefix);
+
+  // Absolute paths that are already normalized only need their root replaced
+  StringRange root_r;
+  if(vfs->m_path_root_component(vfs, path, &root_r) && evfs__path_is_normalized_subpath(root_r.end)) {
+    range_cat_str(&real_r, root_r.end);
+    return;
+  }
 
   // Convert path to absolute within the jail subtree
   evfs_vfs_path_absolute(vfs, path, (StringRange *)&real_r);
@@ -96,7 +96,7 @@ static void unjail_path(Evfs *vfs, const char *path, StringRange *real_path) {
 //  DPRINT("Unjail: '%.*s'", RANGE_FMT(real_path));
 
   // Strip the root component from the path
-  StringRange root_r = {0};
+  root_r = (StringRange){0};
   vfs->m_path_root_component(vfs, real_r.start, &root_r);
 
   if(range_size(&root_r) > 0) {
@@ -209,6 +209,55 @@ static bool jail__file_eof(EvfsFile *fh) {
 }
 
 
+static ptrdiff_t jail__file_read_at(EvfsFile *fh, void *buf, size_t size, evfs_off_t offset) {
+  JailFile *fil = (JailFile *)fh;
+
+  return evfs_file_read_at(fil->base_file, buf, size, offset);
+}
+
+
+static ptrdiff_t jail__file_write_at(EvfsFile *fh, const void *buf, size_t size, evfs_off_t offset) {
+  JailFile *fil = (JailFile *)fh;
+
+  return evfs_file_write_at(fil->base_file, buf, size, offset);
+}
+
+
+static ptrdiff_t jail__file_readv(EvfsFile *fh, const EvfsIOVec *iov, int iovcnt) {
+  JailFile *fil = (JailFile *)fh;
+
+  return evfs_file_readv(fil->base_file, iov, iovcnt);
+}
+
+
+static ptrdiff_t jail__file_writev(EvfsFile *fh, const EvfsIOVec *iov, int iovcnt) {
+  JailFile *fil = (JailFile *)fh;
+
+  return evfs_file_writev(fil->base_file, iov, iovcnt);
+}
+
+
+static int jail__file_map(EvfsFile *fh, evfs_off_t offset, size_t size, EvfsMapping *map) {
+  JailFile *fil = (JailFile *)fh;
+
+  return evfs_file_map(fil->base_file, offset, size, map);
+}
+
+
+static int jail__file_unmap(EvfsFile *fh, EvfsMapping *map) {
+  JailFile *fil = (JailFile *)fh;
+
+  return evfs_file_unmap(fil->base_file, map);
+}
+
+
+static int jail__file_discard(EvfsFile *fh, evfs_off_t offset, evfs_off_t size) {
+  JailFile *fil = (JailFile *)fh;
+
+  return evfs_file_discard(fil->base_file, offset, size);
+}
+
+
 static const EvfsFileMethods s_jail_methods = {
   .m_ctrl     = jail__file_ctrl,
   .m_close    = jail__file_close,
@@ -219,7 +268,14 @@ static const EvfsFileMethods s_jail_methods = {
   .m_size     = jail__file_size,
   .m_seek     = jail__file_seek,
   .m_tell     = jail__file_tell,
-  .m_eof      = jail__file_eof
+  .m_eof      = jail__file_eof,
+  .m_read_at  = jail__file_read_at,
+  .m_write_at = jail__file_write_at,
+  .m_readv    = jail__file_readv,
+  .m_writev   = jail__file_writev,
+  .m_map      = jail__file_map,
+  .m_unmap    = jail__file_unmap,
+  .m_discard  = jail__file_discard
 };
 
 // ******************** Directory access methods ********************
@@ -246,6 +302,13 @@ static int jail__dir_read(EvfsDir *dh, EvfsInfo *info) {
   return status;
 }
 
+static int jail__dir_read_many(EvfsDir *dh, EvfsInfo *entries, int max_entries, char *name_buf,
+                               size_t name_buf_size) {
+  JailDir *dir = (JailDir *)dh;
+
+  return evfs_dir_read_many(dir->base_dir, entries, max_entries, name_buf, name_buf_size);
+}
+
 static int jail__dir_rewind(EvfsDir *dh) {
   JailDir *dir = (JailDir *)dh;
   //JailData *shim_data = dir->shim_data;
@@ -259,7 +322,8 @@ static int jail__dir_rewind(EvfsDir *dh) {
 static const EvfsDirMethods s_jail_dir_methods = {
   .m_close    = jail__dir_close,
   .m_read     = jail__dir_read,
-  .m_rewind   = jail__dir_rewind
+  .m_rewind   = jail__dir_rewind,
+  .m_read_many = jail__dir_read_many
 };
 
 // ******************** FS access methods ********************
@@ -274,12 +338,13 @@ static int jail__open(Evfs *vfs, const char *path, EvfsFile *fh, int flags) {
 
   fil->base_file = (EvfsFile *)NEXT_OBJ(fil);  // We have two objects allocated together [JailFile][<base VFS file size>]
 
-  LOCK();
-  StringRange real_path_r = RANGE_FROM_ARRAY(shim_data->tmp_path);
+  GET_TMP_PATH(real_path);
+  StringRange real_path_r;
+  range_init(&real_path_r, real_path, EVFS_MAX_PATH);
   unjail_path(vfs, path, &real_path_r);
 
-  int status = base_vfs->m_open(base_vfs, shim_data->tmp_path, fil->base_file, flags);
-  UNLOCK();
+  int status = base_vfs->m_open(base_vfs, real_path, fil->base_file, flags);
+  FREE_TMP_PATH(real_path);
   
   if(status == EVFS_OK) {
     // Add methods to make this functional
@@ -302,12 +367,13 @@ static int jail__stat(Evfs *vfs, const char *path, EvfsInfo *info) {
   JailData *shim_data = (JailData *)vfs->fs_data;
   Evfs *base_vfs = shim_data->base_vfs;
 
-  LOCK();
-  StringRange real_path_r = RANGE_FROM_ARRAY(shim_data->tmp_path);
+  GET_TMP_PATH(real_path);
+  StringRange real_path_r;
+  range_init(&real_path_r, real_path, EVFS_MAX_PATH);
   unjail_path(vfs, path, &real_path_r);
 
-  int status = base_vfs->m_stat(base_vfs, shim_data->tmp_path, info);
-  UNLOCK();
+  int status = base_vfs->m_stat(base_vfs, real_path, info);
+  FREE_TMP_PATH(real_path);
 
   return status;
 }
@@ -318,12 +384,13 @@ static int jail__delete(Evfs *vfs, const char *path) {
   JailData *shim_data = (JailData *)vfs->fs_data;
   Evfs *base_vfs = shim_data->base_vfs;
 
-  LOCK();
-  StringRange real_path_r = RANGE_FROM_ARRAY(shim_data->tmp_path);
+  GET_TMP_PATH(real_path);
+  StringRange real_path_r;
+  range_init(&real_path_r, real_path, EVFS_MAX_PATH);
   unjail_path(vfs, path, &real_path_r);
 
-  int status = base_vfs->m_delete(base_vfs, shim_data->tmp_path);
-  UNLOCK();
+  int status = base_vfs->m_delete(base_vfs, real_path);
+  FREE_TMP_PATH(real_path);
 
   return status;
 }
@@ -333,16 +400,17 @@ static int jail__rename(Evfs *vfs, const char *old_path, const char *new_path) {
   JailData *shim_data = (JailData *)vfs->fs_data;
   Evfs *base_vfs = shim_data->base_vfs;
 
-  LOCK();
-  StringRange real_old_path_r = RANGE_FROM_ARRAY(shim_data->tmp_path);
+  GET_TMP_PATH(real_old_path);
+  StringRange real_old_path_r;
+  range_init(&real_old_path_r, real_old_path, EVFS_MAX_PATH);
   unjail_path(vfs, old_path, &real_old_path_r);
 
   char real_new_path[EVFS_MAX_PATH];
   StringRange real_new_path_r = RANGE_FROM_ARRAY(real_new_path);
   unjail_path(vfs, new_path, &real_new_path_r);
 
-  int status = base_vfs->m_rename(base_vfs, shim_data->tmp_path, real_new_path);
-  UNLOCK();
+  int status = base_vfs->m_rename(base_vfs, real_old_path, real_new_path);
+  FREE_TMP_PATH(real_old_path);
 
   return status;
 }
@@ -352,12 +420,13 @@ static int jail__make_dir(Evfs *vfs, const char *path) {
   JailData *shim_data = (JailData *)vfs->fs_data;
   Evfs *base_vfs = shim_data->base_vfs;
 
-  LOCK();
-  StringRange real_path_r = RANGE_FROM_ARRAY(shim_data->tmp_path);
+  GET_TMP_PATH(real_path);
+  StringRange real_path_r;
+  range_init(&real_path_r, real_path, EVFS_MAX_PATH);
   unjail_path(vfs, path, &real_path_r);
 
-  int status = base_vfs->m_make_dir(base_vfs, shim_data->tmp_path);
-  UNLOCK();
+  int status = base_vfs->m_make_dir(base_vfs, real_path);
+  FREE_TMP_PATH(real_path);
 
   return status;
 }
@@ -372,12 +441,13 @@ static int jail__open_dir(Evfs *vfs, const char *path, EvfsDir *dh) {
   dir->base_dir = (EvfsDir *)NEXT_OBJ(dir);   // We have two objects allocated together [JailDir][<base VFS dir size>]
 
 
-  LOCK();
-  StringRange real_path_r = RANGE_FROM_ARRAY(shim_data->tmp_path);
+  GET_TMP_PATH(real_path);
+  StringRange real_path_r;
+  range_init(&real_path_r, real_path, EVFS_MAX_PATH);
   unjail_path(vfs, path, &real_path_r);
 
-  int status = base_vfs->m_open_dir(base_vfs, shim_data->tmp_path, dir->base_dir);
-  UNLOCK();
+  int status = base_vfs->m_open_dir(base_vfs, real_path, dir->base_dir);
+  FREE_TMP_PATH(real_path);
 
   if(status == EVFS_OK) {
     // Add methods to make this functional
@@ -416,8 +486,9 @@ static int jail__set_cur_dir(Evfs *vfs, const char *path) {
     if(!evfs__vfs_existing_dir(vfs, path))
       return EVFS_ERR_NO_PATH;
 
-    strlcpy(shim_data->cur_dir, path, sizeof(shim_data->cur_dir));
-    shim_data->cur_dir[sizeof(shim_data->cur_dir)-1] = '\0';
+    // Keep the CWD normalized so relative paths only need to be joined
+    StringRange cur_dir_r = RANGE_FROM_ARRAY(shim_data->cur_dir);
+    evfs_vfs_path_normalize(vfs, path, &cur_dir_r);
 
   } else { // Path is relative: Join it to the existing directory
     StringRange head, tail, joined;
@@ -425,10 +496,9 @@ static int jail__set_cur_dir(Evfs *vfs, const char *path) {
     range_init(&head, shim_data->cur_dir, sizeof(shim_data->cur_dir));
     range_init(&tail, (char *)path, strlen(path));
 
-    // Note: evfs__vfs_existing_dir() below is going to take the lock (via jail__stat) so
-    //       we have to malloc a buffer.
+    // The joined path can be longer than EVFS_MAX_PATH before normalization
     size_t joined_size = strlen(shim_data->cur_dir) + 1 + strlen(path) + 1;
-    char *joined_path = evfs_malloc(joined_size);
+    char *joined_path = evfs_class_malloc(EVFS_ALLOC_PATH, joined_size);
     if(MEM_CHECK(joined_path)) return EVFS_ERR_ALLOC;
 
     range_init(&joined, joined_path, joined_size);
@@ -437,14 +507,14 @@ static int jail__set_cur_dir(Evfs *vfs, const char *path) {
 
     // Confirm the path exists
     if(!evfs__vfs_existing_dir(vfs, joined_path)) {
-      evfs_free(joined_path);
+      evfs_class_free(EVFS_ALLOC_PATH, joined_path);
       return EVFS_ERR_NO_PATH;
     }
 
     // Overwrite old cur_dir
     evfs_vfs_path_normalize(vfs, joined_path, &head);
 
-    evfs_free(joined_path);
+    evfs_class_free(EVFS_ALLOC_PATH, joined_path);
   }
 
   return EVFS_OK;
@@ -459,9 +529,6 @@ static int jail__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
   // It can't pass through since we need to deallocate VFSs in the proper sequence
   // to avoid corrupting the registered VFS linked list.
   if(cmd == EVFS_CMD_UNREGISTER) {
-#ifdef USE_JAIL_LOCK
-      evfs__lock_destroy(&shim_data->jail_lock);
-#endif
       evfs_free(vfs); // Free this trace VFS
       return EVFS_OK;
   }
@@ -509,8 +576,14 @@ int evfs_register_jail(const char *vfs_name, const char *old_vfs_name, const cha
   evfs_vfs_path_absolute(base_vfs, jail_root, &abs_root_r);
 
   // Construct a new VFS
+  // Jail can be the root dir
+  size_t root_len = strlen(abs_root);
+  bool add_sep = root_len == 0 || abs_root[root_len-1] != EVFS_DIR_SEP;
+  if(add_sep)
+    root_len++;
+
   // We have four objects allocated together [Evfs][JailData][char[]][char[]]
-  size_t shim_size = sizeof(*shim_vfs) + sizeof(*shim_data) + strlen(vfs_name)+1 + strlen(abs_root)+1;
+  size_t shim_size = sizeof(*shim_vfs) + sizeof(*shim_data) + strlen(vfs_name)+1 + root_len+1;
   shim_vfs = evfs_malloc(shim_size);
   if(MEM_CHECK(shim_vfs)) return EVFS_ERR_ALLOC;
 
@@ -521,8 +594,14 @@ int evfs_register_jail(const char *vfs_name, const char *old_vfs_name, const cha
   shim_vfs->vfs_name = (char *)NEXT_OBJ(shim_data);
   strcpy((char *)shim_vfs->vfs_name, vfs_name);
 
-  shim_data->jail_root = shim_vfs->vfs_name + strlen(vfs_name)+1;
-  strcpy((char *)shim_data->jail_root, abs_root);
+  // Prefix for all unjailed paths
+  char *root_prefix = (char *)shim_vfs->vfs_name + strlen(vfs_name)+1;
+  strcpy(root_prefix, abs_root);
+  if(add_sep) {
+    root_prefix[root_len-1] = EVFS_DIR_SEP;
+    root_prefix[root_len] = '\0';
+  }
+  range_init(&shim_data->root_prefix, root_prefix, root_len);
 
   shim_data->base_vfs = base_vfs;
   shim_data->vfs_name = shim_vfs->vfs_name;
@@ -545,13 +624,6 @@ int evfs_register_jail(const char *vfs_name, const char *old_vfs_name, const cha
 
   shim_vfs->m_path_root_component = jail__path_root_component;
 
-#ifdef USE_JAIL_LOCK
-  if(evfs__lock_init(&shim_data->jail_lock) != EVFS_OK) {
-    evfs_free(shim_vfs);
-    THROW(EVFS_ERR_INIT);
-  }
-#endif
-
   return evfs_register(shim_vfs, default_vfs);
 }
 
@@ -0,0 +1,1233 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Journal shim VFS
+
+This shim turns small scattered writes into sequential appends to a log
+file on the underlying VFS. A write up to JournalConfig.max_record bytes is
+appended to the log as a record holding the path, offset, and data. It is
+complete once the record is written and the log is synced. The data is also
+kept in memory so reads through the shim see it before it reaches the file.
+
+Logged writes are checkpointed into their files in batches. This happens when
+the log grows past JournalConfig.checkpoint_size, on EVFS_CMD_RUN_MAINTENANCE,
+and periodically from a background thread started with
+EVFS_CMD_SET_MAINT_INTERVAL. Files are synced before the log is truncated so
+a crash during a checkpoint is repaired by replaying the log again. Records
+store absolute offsets so replaying them more than once is harmless. Later
+writes that cover earlier ones replace them in memory so each batch only
+writes the newest data.
+
+Each record ends with a CRC32C. The log is replayed when the shim is
+registered. Replay stops at the first damaged record so a torn append at the
+end of the log is discarded.
+
+Writes between EVFS_CMD_BEGIN_TXN and EVFS_CMD_COMMIT_TXN form a transaction.
+Their records are only marked complete by a commit record. Replay ignores
+records without a following commit so changes to several files are applied
+all together or not at all. Every write is logged while a transaction is open
+regardless of its size and checkpoints wait until it is committed. There is
+one transaction at a time for all handles. Transactions can be nested and
+complete with the outermost commit.
+
+Larger writes outside a transaction go directly to the file. Other changes
+can't be ordered with the log so pending writes are checkpointed first. This
+applies to truncation, overwriting opens, and direct writes to a file with
+pending writes and to any delete or rename. These return EVFS_ERR_BUSY when
+the checkpoint would apply part of an open transaction.
+
+Changes made to the files outside of the shim are not seen by the log. The
+log file should not be accessed through the shim.
+
+------------------------------------------------------------------------------
+*/
+
+#include <string.h>
+
+#include "evfs.h"
+#include "evfs_internal.h"
+#include "evfs/util/checksum.h"
+#include "evfs/shim/shim_journal.h"
+
+
+// Access objects allocated in a single block of memory
+#define NEXT_OBJ(o) (&(o)[1])
+
+
+#define JOURNAL_MAGIC           0x4C4A5645  // "EVJL"
+
+#define JOURNAL_WRITE           0x01
+#define JOURNAL_COMMIT          0x02
+
+#define JOURNAL_F_COMMIT        0x01  // Record ends a transaction
+
+#define DEFAULT_CHECKPOINT_SIZE (16 * 1024UL)
+#define DEFAULT_MAX_RECORD      1024
+
+// Chunk size for verifying record data during replay
+#define REPLAY_BUF_SIZE         256
+
+// MSVC
+#ifdef _MSC_VER
+#  define PACKED_BEGIN   __pragma(pack(push, 1))
+#  define PACKED_END     __pragma(pack(pop))
+
+// IAR / Keil
+#elif defined __IAR_SYSTEMS_ICC__ || defined __UVISION_VERSION
+#  define PACKED_BEGIN   __packed
+#  define PACKED_END
+
+// GCC/Clang (C11 fallback)
+#else
+#  define PACKED_BEGIN   _Pragma("pack(push, 1)")
+#  define PACKED_END     _Pragma("pack(pop)")
+#endif
+
+
+// ******************** Structs for the log file ********************
+
+// Record header. Followed by path_len bytes of path and size bytes of data.
+PACKED_BEGIN
+struct JournalRecord {
+  uint32_t  magic;
+  uint8_t   type;
+  uint8_t   flags;
+  uint16_t  path_len;
+  uint32_t  size;
+  uint64_t  offset;
+  uint32_t  crc;      // CRC32C of the header with this field zeroed, the path, and the data
+};
+PACKED_END
+
+typedef struct JournalRecord JournalRecord;
+
+
+
+// ******************** Shim structs ********************
+
+// Logged write not yet checkpointed
+typedef struct JournalExtent {
+  struct JournalExtent *next;
+  evfs_off_t  offset;
+  size_t      size;
+  uint8_t    *data;
+} JournalExtent;
+
+// Pending writes to one file in log order
+typedef struct JournalPath {
+  struct JournalPath *next;
+  JournalExtent *extents;
+  JournalExtent *tail;
+  evfs_off_t  end;      // End of the last byte written
+  char       *path;
+} JournalPath;
+
+typedef struct JournalData {
+  Evfs           *base_vfs;
+  const char     *vfs_name;
+  Evfs           *shim_vfs;
+
+  const char     *log_path;
+  EvfsFile       *log;
+  evfs_off_t      log_size;
+
+  uint32_t        checkpoint_size;
+  uint32_t        max_record;
+  bool            no_sync;
+
+  JournalPath    *pending;
+  unsigned        txn_depth;
+  unsigned        txn_records;  // Records logged in the open transaction
+
+  EvfsLock        lock;         // Protects the log and pending writes
+
+#ifdef EVFS_USE_THREADING
+  // Background checkpoints for EVFS_CMD_SET_MAINT_INTERVAL
+  EvfsLock        maint_lock;
+  EvfsCond        maint_wake;   // Signaled on config change and shutdown
+  EvfsThread      maint_thread;
+  unsigned        maint_ms;
+  bool            maint_running;
+  bool            maint_stop;
+#endif
+} JournalData;
+
+typedef struct JournalFile {
+  EvfsFile        base;
+  JournalData    *shim_data;
+  EvfsFile       *base_file;
+
+  evfs_off_t      pos;
+  bool            writable;
+  bool            append;
+  bool            eof;
+
+  char            path[EVFS_MAX_PATH];  // Absolute path used to find pending writes
+} JournalFile;
+
+typedef struct JournalDir {
+  EvfsDir         base;
+  JournalData    *shim_data;
+  EvfsDir        *base_dir;
+
+  char            path[EVFS_MAX_PATH];
+} JournalDir;
+
+
+
+// ******************** Pending writes ********************
+
+static JournalPath *find_pending(JournalData *shim_data, const char *path) {
+  for(JournalPath *jp = shim_data->pending; jp; jp = jp->next) {
+    if(!strcmp(jp->path, path))
+      return jp;
+  }
+
+  return NULL;
+}
+
+
+static void free_pending(JournalData *shim_data) {
+  while(shim_data->pending) {
+    JournalPath *jp = shim_data->pending;
+    shim_data->pending = jp->next;
+
+    while(jp->extents) {
+      JournalExtent *ext = jp->extents;
+      jp->extents = ext->next;
+      evfs_free(ext);
+    }
+
+    evfs_free(jp);
+  }
+}
+
+
+static JournalExtent *new_extent(evfs_off_t offset, size_t size) {
+  // We have two objects allocated together [JournalExtent][uint8_t[]]
+  JournalExtent *ext = evfs_malloc(sizeof(*ext) + size);
+  if(MEM_CHECK(ext)) return NULL;
+
+  ext->next = NULL;
+  ext->offset = offset;
+  ext->size = size;
+  ext->data = (uint8_t *)NEXT_OBJ(ext);
+
+  return ext;
+}
+
+
+// Add a logged write to the end of a file's pending list
+static int add_extent(JournalData *shim_data, const char *path, JournalExtent *ext) {
+  JournalPath *jp = find_pending(shim_data, path);
+
+  if(!jp) {
+    // We have two objects allocated together [JournalPath][char[]]
+    jp = evfs_malloc(sizeof(*jp) + strlen(path)+1);
+    if(MEM_CHECK(jp)) return EVFS_ERR_ALLOC;
+
+    memset(jp, 0, sizeof(*jp));
+    jp->path = (char *)NEXT_OBJ(jp);
+    strcpy(jp->path, path);
+
+    jp->next = shim_data->pending;
+    shim_data->pending = jp;
+  }
+
+  // Drop older writes that are completely replaced
+  evfs_off_t ext_end = ext->offset + (evfs_off_t)ext->size;
+  JournalExtent **cur = &jp->extents;
+  jp->tail = NULL;
+  while(*cur) {
+    JournalExtent *old = *cur;
+    if(old->offset >= ext->offset && old->offset + (evfs_off_t)old->size <= ext_end) {
+      *cur = old->next;
+      evfs_free(old);
+    } else {
+      jp->tail = old;
+      cur = &old->next;
+    }
+  }
+
+  if(jp->tail)
+    jp->tail->next = ext;
+  else
+    jp->extents = ext;
+  jp->tail = ext;
+
+  jp->end = MAX(jp->end, ext_end);
+
+  return EVFS_OK;
+}
+
+
+// Copy pending data over a range read from the file
+static void apply_extents(JournalPath *jp, uint8_t *buf, size_t size, evfs_off_t offset) {
+  evfs_off_t end = offset + (evfs_off_t)size;
+
+  for(JournalExtent *ext = jp->extents; ext; ext = ext->next) {
+    evfs_off_t ext_end = ext->offset + (evfs_off_t)ext->size;
+    if(ext_end <= offset || ext->offset >= end) continue;
+
+    evfs_off_t start = MAX(offset, ext->offset);
+    evfs_off_t stop  = MIN(end, ext_end);
+    memcpy(&buf[start - offset], &ext->data[start - ext->offset], stop - start);
+  }
+}
+
+
+
+// ******************** Log access ********************
+
+static uint32_t record_crc(JournalRecord *rec, const char *path, const void *data) {
+  uint32_t saved = rec->crc;
+  rec->crc = 0;
+  uint32_t crc = crc32c(rec, sizeof(*rec));
+  rec->crc = saved;
+
+  crc = crc32c_update(crc, path, rec->path_len);
+  return crc32c_update(crc, data, rec->size);
+}
+
+
+// Append a record to the log. Lock must be held.
+static int append_record(JournalData *shim_data, uint8_t type, uint8_t flags, const char *path,
+                         evfs_off_t offset, const void *data, size_t size) {
+  JournalRecord rec = {
+    .magic    = JOURNAL_MAGIC,
+    .type     = type,
+    .flags    = flags,
+    .path_len = path ? strlen(path) : 0,
+    .size     = size,
+    .offset   = offset
+  };
+  rec.crc = record_crc(&rec, path, data);
+
+  evfs_off_t pos = shim_data->log_size;
+  const void *parts[3] = {&rec, path, data};
+  size_t part_sizes[3] = {sizeof(rec), rec.path_len, size};
+
+  int status = EVFS_OK;
+  for(int i = 0; i < 3; i++) {
+    if(part_sizes[i] == 0) continue;
+
+    ptrdiff_t wrote = evfs_file_write_at(shim_data->log, parts[i], part_sizes[i], pos);
+    if(wrote != (ptrdiff_t)part_sizes[i]) {
+      status = wrote < 0 ? wrote : EVFS_ERR_IO;
+      break;
+    }
+    pos += wrote;
+  }
+
+  if(status != EVFS_OK) {
+    // Remove the partial record so later records aren't hidden behind it
+    evfs_file_truncate(shim_data->log, shim_data->log_size);
+    return status;
+  }
+
+  shim_data->log_size = pos;
+  return EVFS_OK;
+}
+
+
+static int sync_log(JournalData *shim_data) {
+  return shim_data->no_sync ? EVFS_OK : evfs_file_sync(shim_data->log);
+}
+
+
+// Write pending data into files and empty the log. Lock must be held.
+static int checkpoint_locked(JournalData *shim_data) {
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  if(shim_data->txn_depth > 0)
+    return EVFS_ERR_BUSY;
+
+  for(JournalPath *jp = shim_data->pending; jp; jp = jp->next) {
+    EvfsFile *fh;
+    int status = evfs_vfs_open(base_vfs, jp->path, &fh, EVFS_RDWR | EVFS_OPEN_OR_NEW);
+    if(status == EVFS_ERR_NO_PATH) // Directory is gone along with the file
+      continue;
+    if(status != EVFS_OK)
+      return status;
+
+    for(JournalExtent *ext = jp->extents; ext; ext = ext->next) {
+      ptrdiff_t wrote = evfs_file_write_at(fh, ext->data, ext->size, ext->offset);
+      if(wrote != (ptrdiff_t)ext->size) {
+        status = wrote < 0 ? wrote : EVFS_ERR_IO;
+        break;
+      }
+    }
+
+    if(status == EVFS_OK)
+      status = evfs_file_sync(fh);
+
+    int close_status = evfs_file_close(fh);
+    if(status == EVFS_OK)
+      status = close_status;
+
+    if(status != EVFS_OK) // Log is kept to retry later
+      return status;
+  }
+
+  free_pending(shim_data);
+
+  int status = evfs_file_truncate(shim_data->log, 0);
+  if(status == EVFS_OK) {
+    shim_data->log_size = 0;
+    status = evfs_file_sync(shim_data->log);
+  }
+
+  return status;
+}
+
+
+static int checkpoint(JournalData *shim_data) {
+  evfs__lock(&shim_data->lock);
+  int status = checkpoint_locked(shim_data);
+  evfs__unlock(&shim_data->lock);
+
+  return status;
+}
+
+
+// Checkpoint before a change that can't be ordered with pending writes. Lock must be held.
+// A NULL path checkpoints when anything is pending.
+static int settle_locked(JournalData *shim_data, const char *path) {
+  if(!shim_data->pending)
+    return EVFS_OK;
+
+  if(path && !find_pending(shim_data, path))
+    return EVFS_OK;
+
+  return checkpoint_locked(shim_data);
+}
+
+
+static int settle(JournalData *shim_data, const char *path) {
+  evfs__lock(&shim_data->lock);
+  int status = settle_locked(shim_data, path);
+  evfs__unlock(&shim_data->lock);
+
+  return status;
+}
+
+
+// Finish a commit by syncing the log and checkpointing when it's full. Lock must be held.
+static int commit_locked(JournalData *shim_data) {
+  int status = sync_log(shim_data);
+  if(status != EVFS_OK)
+    return status;
+
+  // The data is safe in the log so a failed checkpoint is retried later
+  if(shim_data->log_size >= (evfs_off_t)shim_data->checkpoint_size)
+    checkpoint_locked(shim_data);
+
+  return EVFS_OK;
+}
+
+
+static int begin_txn(JournalData *shim_data) {
+  evfs__lock(&shim_data->lock);
+  if(shim_data->txn_depth++ == 0)
+    shim_data->txn_records = 0;
+  evfs__unlock(&shim_data->lock);
+
+  return EVFS_OK;
+}
+
+
+static int commit_txn(JournalData *shim_data) {
+  int status = EVFS_OK;
+
+  evfs__lock(&shim_data->lock);
+  if(shim_data->txn_depth == 0) {
+    status = EVFS_ERR_INVALID;
+
+  } else if(--shim_data->txn_depth == 0 && shim_data->txn_records > 0) {
+    status = append_record(shim_data, JOURNAL_COMMIT, JOURNAL_F_COMMIT, NULL, 0, NULL, 0);
+    if(status == EVFS_OK)
+      status = commit_locked(shim_data);
+  }
+  evfs__unlock(&shim_data->lock);
+
+  return status;
+}
+
+
+// Read and verify a record at pos. Data is loaded into ext when it isn't NULL.
+static int read_record(JournalData *shim_data, evfs_off_t pos, JournalRecord *rec, char *path,
+                       JournalExtent *ext) {
+  EvfsFile *log = shim_data->log;
+
+  if(evfs_file_read_at(log, rec, sizeof(*rec), pos) != sizeof(*rec))
+    return EVFS_ERR_CORRUPTION;
+
+  // Space left in the log for the data
+  evfs_off_t avail = shim_data->log_size - pos - (evfs_off_t)sizeof(*rec) - rec->path_len;
+
+  if(rec->magic != JOURNAL_MAGIC || rec->path_len >= EVFS_MAX_PATH || avail < 0 ||
+      rec->size > (uint64_t)avail)
+    return EVFS_ERR_CORRUPTION;
+
+  pos += sizeof(*rec);
+  if(evfs_file_read_at(log, path, rec->path_len, pos) != rec->path_len)
+    return EVFS_ERR_CORRUPTION;
+  path[rec->path_len] = '\0';
+  pos += rec->path_len;
+
+  if(ext) { // Load data
+    if(evfs_file_read_at(log, ext->data, rec->size, pos) != (ptrdiff_t)rec->size)
+      return EVFS_ERR_CORRUPTION;
+
+    return EVFS_OK;
+  }
+
+  // Verify data
+  uint32_t saved = rec->crc;
+  rec->crc = 0;
+  uint32_t crc = crc32c(rec, sizeof(*rec));
+  rec->crc = saved;
+  crc = crc32c_update(crc, path, rec->path_len);
+
+  uint8_t buf[REPLAY_BUF_SIZE];
+  for(size_t remain = rec->size; remain > 0; ) {
+    size_t chunk = MIN(remain, sizeof(buf));
+    if(evfs_file_read_at(log, buf, chunk, pos) != (ptrdiff_t)chunk)
+      return EVFS_ERR_CORRUPTION;
+
+    crc = crc32c_update(crc, buf, chunk);
+    pos += chunk;
+    remain -= chunk;
+  }
+
+  return crc == rec->crc ? EVFS_OK : EVFS_ERR_CORRUPTION;
+}
+
+
+static inline evfs_off_t record_len(JournalRecord *rec) {
+  return sizeof(*rec) + rec->path_len + rec->size;
+}
+
+
+// Apply committed records left in the log
+static int replay_log(JournalData *shim_data) {
+  JournalRecord rec;
+  char path[EVFS_MAX_PATH];
+
+  shim_data->log_size = evfs_file_size(shim_data->log);
+
+  // Find the end of the last complete transaction
+  evfs_off_t pos = 0;
+  evfs_off_t committed = 0;
+  while(pos < shim_data->log_size && read_record(shim_data, pos, &rec, path, NULL) == EVFS_OK) {
+    pos += record_len(&rec);
+    if(rec.flags & JOURNAL_F_COMMIT)
+      committed = pos;
+  }
+
+  // Load the committed writes
+  pos = 0;
+  while(pos < committed) {
+    int status = read_record(shim_data, pos, &rec, path, NULL);
+    if(status != EVFS_OK) return status;
+
+    if(rec.type == JOURNAL_WRITE) {
+      JournalExtent *ext = new_extent(rec.offset, rec.size);
+      if(!ext) return EVFS_ERR_ALLOC;
+
+      status = read_record(shim_data, pos, &rec, path, ext);
+      if(status == EVFS_OK)
+        status = add_extent(shim_data, path, ext);
+
+      if(status != EVFS_OK) {
+        evfs_free(ext);
+        return status;
+      }
+    }
+
+    pos += record_len(&rec);
+  }
+
+  // Incomplete records are discarded when the log is emptied
+  return checkpoint_locked(shim_data);
+}
+
+
+#ifdef EVFS_USE_THREADING
+// Background thread that checkpoints periodically
+static void maint_worker(void *arg) {
+  JournalData *shim_data = (JournalData *)arg;
+
+  evfs__lock(&shim_data->maint_lock);
+  while(!shim_data->maint_stop) {
+    if(shim_data->maint_ms > 0)
+      evfs__cond_timedwait(&shim_data->maint_wake, &shim_data->maint_lock, shim_data->maint_ms);
+    else // Idle until reconfigured
+      evfs__cond_wait(&shim_data->maint_wake, &shim_data->maint_lock);
+
+    if(shim_data->maint_stop)
+      break;
+
+    if(shim_data->maint_ms == 0)
+      continue;
+
+    evfs__unlock(&shim_data->maint_lock);
+    checkpoint(shim_data);
+    evfs__lock(&shim_data->maint_lock);
+  }
+  evfs__unlock(&shim_data->maint_lock);
+}
+
+
+static int set_maint_interval(JournalData *shim_data, unsigned interval_ms) {
+  int status = EVFS_OK;
+
+  evfs__lock(&shim_data->maint_lock);
+  shim_data->maint_ms = interval_ms;
+
+  if(shim_data->maint_running) { // Pick up the new interval
+    evfs__cond_signal(&shim_data->maint_wake);
+  } else if(interval_ms > 0) { // Start the worker the first time an interval is set
+    status = evfs__thread_create(&shim_data->maint_thread, maint_worker, shim_data);
+    if(status == EVFS_OK)
+      shim_data->maint_running = true;
+  }
+  evfs__unlock(&shim_data->maint_lock);
+
+  return status;
+}
+
+
+static void stop_maint_worker(JournalData *shim_data) {
+  evfs__lock(&shim_data->maint_lock);
+  bool running = shim_data->maint_running;
+  shim_data->maint_stop = true;
+  evfs__cond_signal(&shim_data->maint_wake);
+  evfs__unlock(&shim_data->maint_lock);
+
+  if(running)
+    evfs__thread_join(shim_data->maint_thread);
+}
+#endif // EVFS_USE_THREADING
+
+
+
+// ******************** File access methods ********************
+
+static int journal__file_ctrl(EvfsFile *fh, int cmd, void *arg) {
+  JournalFile *fil = (JournalFile *)fh;
+
+  return fil->base_file->methods->m_ctrl(fil->base_file, cmd, arg);
+}
+
+
+static int journal__file_close(EvfsFile *fh) {
+  JournalFile *fil = (JournalFile *)fh;
+
+  // Logged writes stay pending after the file is closed
+  int status = fil->base_file->methods->m_close(fil->base_file);
+
+  fil->base.methods = NULL;
+  return status;
+}
+
+
+static evfs_off_t journal__file_size(EvfsFile *fh) {
+  JournalFile *fil = (JournalFile *)fh;
+  JournalData *shim_data = fil->shim_data;
+
+  evfs__lock(&shim_data->lock);
+  evfs_off_t size = evfs_file_size(fil->base_file);
+
+  JournalPath *jp = find_pending(shim_data, fil->path);
+  if(jp)
+    size = MAX(size, jp->end);
+  evfs__unlock(&shim_data->lock);
+
+  return size;
+}
+
+
+static ptrdiff_t journal__file_read_at(EvfsFile *fh, void *buf, size_t size, evfs_off_t offset) {
+  JournalFile *fil = (JournalFile *)fh;
+  JournalData *shim_data = fil->shim_data;
+  ptrdiff_t read;
+
+  evfs__lock(&shim_data->lock);
+  JournalPath *jp = find_pending(shim_data, fil->path);
+
+  if(!jp) {
+    read = evfs_file_read_at(fil->base_file, buf, size, offset);
+
+  } else { // Overlay pending writes
+    evfs_off_t base_size = evfs_file_size(fil->base_file);
+    evfs_off_t end = MAX(base_size, jp->end);
+
+    if(offset >= end) {
+      read = 0;
+    } else {
+      if(size > (size_t)(end - offset))
+        size = end - offset;
+
+      read = 0;
+      if(offset < base_size)
+        read = evfs_file_read_at(fil->base_file, buf, MIN(size, (size_t)(base_size - offset)), offset);
+
+      if(read >= 0) {
+        // Data past the file that isn't logged is a gap of zeros
+        memset((uint8_t *)buf + read, 0, size - read);
+        apply_extents(jp, buf, size, offset);
+        read = size;
+      }
+    }
+  }
+  evfs__unlock(&shim_data->lock);
+
+  return read;
+}
+
+
+static ptrdiff_t journal__file_read(EvfsFile *fh, void *buf, size_t size) {
+  JournalFile *fil = (JournalFile *)fh;
+
+  ptrdiff_t read = journal__file_read_at(fh, buf, size, fil->pos);
+  if(read < 0) return read;
+
+  fil->pos += read;
+  if((size_t)read < size)
+    fil->eof = true;
+
+  return read;
+}
+
+
+static ptrdiff_t journal__file_write_at(EvfsFile *fh, const void *buf, size_t size, evfs_off_t offset) {
+  JournalFile *fil = (JournalFile *)fh;
+  JournalData *shim_data = fil->shim_data;
+  ptrdiff_t status;
+
+  if(!fil->writable) return EVFS_ERR_DISABLED;
+  if(size == 0) return 0;
+
+  evfs__lock(&shim_data->lock);
+
+  if(shim_data->txn_depth == 0 && size > shim_data->max_record) { // Write directly
+    status = settle_locked(shim_data, fil->path);
+    if(status == EVFS_OK) {
+      status = evfs_file_write_at(fil->base_file, buf, size, offset);
+
+      // Flush so later checkpoints through another handle aren't overwritten
+      if(status > 0) {
+        int sync_status = evfs_file_sync(fil->base_file);
+        if(sync_status != EVFS_OK)
+          status = sync_status;
+      }
+    }
+
+  } else { // Log the write
+    JournalExtent *ext = new_extent(offset, size);
+    if(!ext) {
+      status = EVFS_ERR_ALLOC;
+    } else {
+      memcpy(ext->data, buf, size);
+
+      uint8_t flags = shim_data->txn_depth == 0 ? JOURNAL_F_COMMIT : 0;
+      status = append_record(shim_data, JOURNAL_WRITE, flags, fil->path, offset, buf, size);
+      if(status == EVFS_OK)
+        status = add_extent(shim_data, fil->path, ext);
+
+      if(status != EVFS_OK) {
+        evfs_free(ext);
+      } else {
+        if(shim_data->txn_depth > 0)
+          shim_data->txn_records++;
+        else
+          status = commit_locked(shim_data);
+
+        if(status == EVFS_OK)
+          status = size;
+      }
+    }
+  }
+
+  evfs__unlock(&shim_data->lock);
+
+  return status;
+}
+
+
+static ptrdiff_t journal__file_write(EvfsFile *fh, const void *buf, size_t size) {
+  JournalFile *fil = (JournalFile *)fh;
+
+  if(!fil->writable) return EVFS_ERR_DISABLED;
+
+  if(fil->append)
+    fil->pos = journal__file_size(fh);
+
+  ptrdiff_t wrote = journal__file_write_at(fh, buf, size, fil->pos);
+  if(wrote > 0)
+    fil->pos += wrote;
+
+  return wrote;
+}
+
+
+static int journal__file_truncate(EvfsFile *fh, evfs_off_t size) {
+  JournalFile *fil = (JournalFile *)fh;
+  JournalData *shim_data = fil->shim_data;
+
+  if(!fil->writable) return EVFS_ERR_DISABLED;
+
+  evfs__lock(&shim_data->lock);
+  int status = settle_locked(shim_data, fil->path);
+  if(status == EVFS_OK)
+    status = fil->base_file->methods->m_truncate(fil->base_file, size);
+  evfs__unlock(&shim_data->lock);
+
+  return status;
+}
+
+
+static int journal__file_sync(EvfsFile *fh) {
+  JournalFile *fil = (JournalFile *)fh;
+  JournalData *shim_data = fil->shim_data;
+
+  // Logged writes are durable once the log is synced
+  evfs__lock(&shim_data->lock);
+  int status = evfs_file_sync(shim_data->log);
+  evfs__unlock(&shim_data->lock);
+
+  if(status == EVFS_OK)
+    status = fil->base_file->methods->m_sync(fil->base_file);
+
+  return status;
+}
+
+
+static int journal__file_seek(EvfsFile *fh, evfs_off_t offset, EvfsSeekDir origin) {
+  JournalFile *fil = (JournalFile *)fh;
+
+  fil->pos = evfs__absolute_offset(fh, offset, origin);
+  fil->eof = false;
+
+  return EVFS_OK;
+}
+
+
+static evfs_off_t journal__file_tell(EvfsFile *fh) {
+  JournalFile *fil = (JournalFile *)fh;
+
+  return fil->pos;
+}
+
+
+static bool journal__file_eof(EvfsFile *fh) {
+  JournalFile *fil = (JournalFile *)fh;
+
+  return fil->eof;
+}
+
+
+static const EvfsFileMethods s_journal_methods = {
+  .m_ctrl     = journal__file_ctrl,
+  .m_close    = journal__file_close,
+  .m_read     = journal__file_read,
+  .m_write    = journal__file_write,
+  .m_truncate = journal__file_truncate,
+  .m_sync     = journal__file_sync,
+  .m_size     = journal__file_size,
+  .m_seek     = journal__file_seek,
+  .m_tell     = journal__file_tell,
+  .m_eof      = journal__file_eof,
+  .m_read_at  = journal__file_read_at,
+  .m_write_at = journal__file_write_at
+};
+
+
+
+// ******************** Directory access methods ********************
+
+static int journal__dir_close(EvfsDir *dh) {
+  JournalDir *dir = (JournalDir *)dh;
+
+  int status = dir->base_dir->methods->m_close(dir->base_dir);
+
+  if(status == EVFS_OK) {
+    dir->base.methods = NULL; // Disable this instance
+  }
+
+  return status;
+}
+
+
+// Sizes include pending writes
+static int journal__dir_read(EvfsDir *dh, EvfsInfo *info) {
+  JournalDir *dir = (JournalDir *)dh;
+  JournalData *shim_data = dir->shim_data;
+
+  int status = dir->base_dir->methods->m_read(dir->base_dir, info);
+
+  if(status == EVFS_OK && !(info->type & EVFS_FILE_DIR) && shim_data->pending) {
+    char joined[EVFS_MAX_PATH];
+    StringRange joined_r = RANGE_FROM_ARRAY(joined);
+
+    if(evfs_vfs_path_join_str(shim_data->shim_vfs, dir->path, info->name, &joined_r) == EVFS_OK) {
+      evfs__lock(&shim_data->lock);
+      JournalPath *jp = find_pending(shim_data, joined);
+      if(jp)
+        info->size = MAX(info->size, jp->end);
+      evfs__unlock(&shim_data->lock);
+    }
+  }
+
+  return status;
+}
+
+
+static int journal__dir_rewind(EvfsDir *dh) {
+  JournalDir *dir = (JournalDir *)dh;
+
+  return dir->base_dir->methods->m_rewind(dir->base_dir);
+}
+
+
+static const EvfsDirMethods s_journal_dir_methods = {
+  .m_close    = journal__dir_close,
+  .m_read     = journal__dir_read,
+  .m_rewind   = journal__dir_rewind
+};
+
+
+
+// ******************** FS access methods ********************
+
+// Appends are handled by the shim. Base files open for update so they aren't truncated.
+static inline int append_flags(int flags) {
+  if(flags & EVFS_APPEND)
+    flags = (flags & ~EVFS_APPEND) | EVFS_READ | EVFS_WRITE;
+
+  return flags;
+}
+
+
+static int journal__open(Evfs *vfs, const char *path, EvfsFile *fh, int flags) {
+  JournalFile *fil = (JournalFile *)fh;
+  JournalData *shim_data = (JournalData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  fh->methods = NULL;
+  fil->shim_data = shim_data;
+  fil->base_file = (EvfsFile *)NEXT_OBJ(fil);  // We have two objects allocated together [JournalFile][<base VFS file size>]
+  fil->pos = 0;
+  fil->writable = flags & (EVFS_WRITE | EVFS_APPEND);
+  fil->append = flags & EVFS_APPEND;
+  fil->eof = false;
+
+  MAKE_ABS(path, abs_path);
+
+  size_t path_len = strlen(abs_path);
+  if(path_len >= sizeof(fil->path)) {
+    FREE_ABS(abs_path);
+    return EVFS_ERR_TOO_LONG;
+  }
+  memcpy(fil->path, abs_path, path_len+1);
+  FREE_ABS(abs_path);
+
+  evfs__lock(&shim_data->lock);
+  // Pending writes must reach the file before it is emptied
+  int status = (flags & EVFS_OVERWRITE) ? settle_locked(shim_data, fil->path) : EVFS_OK;
+  if(status == EVFS_OK)
+    status = base_vfs->m_open(base_vfs, fil->path, fil->base_file, append_flags(flags));
+  evfs__unlock(&shim_data->lock);
+
+  if(status == EVFS_OK) {
+    // Add methods to make this functional
+    if(fil->base_file->methods) {
+      fh->methods = &s_journal_methods;
+    } else {
+      status = EVFS_ERR_INIT;
+    }
+  }
+
+  return status;
+}
+
+
+static int journal__stat(Evfs *vfs, const char *path, EvfsInfo *info) {
+  JournalData *shim_data = (JournalData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  MAKE_ABS(path, abs_path);
+
+  int status = base_vfs->m_stat(base_vfs, abs_path, info);
+
+  if(status == EVFS_OK) {
+    evfs__lock(&shim_data->lock);
+    JournalPath *jp = find_pending(shim_data, abs_path);
+    if(jp)
+      info->size = MAX(info->size, jp->end);
+    evfs__unlock(&shim_data->lock);
+  }
+
+  FREE_ABS(abs_path);
+  return status;
+}
+
+
+static int journal__delete(Evfs *vfs, const char *path) {
+  JournalData *shim_data = (JournalData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  // Deleting a directory can remove files with pending writes
+  int status = settle(shim_data, NULL);
+  if(status != EVFS_OK) return status;
+
+  return base_vfs->m_delete(base_vfs, path);
+}
+
+
+static int journal__rename(Evfs *vfs, const char *old_path, const char *new_path) {
+  JournalData *shim_data = (JournalData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  int status = settle(shim_data, NULL);
+  if(status != EVFS_OK) return status;
+
+  return base_vfs->m_rename(base_vfs, old_path, new_path);
+}
+
+
+static int journal__make_dir(Evfs *vfs, const char *path) {
+  JournalData *shim_data = (JournalData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_make_dir(base_vfs, path);
+}
+
+
+static int journal__open_dir(Evfs *vfs, const char *path, EvfsDir *dh) {
+  JournalDir *dir = (JournalDir *)dh;
+  JournalData *shim_data = (JournalData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  dh->methods = NULL;
+  dir->shim_data = shim_data;
+  dir->base_dir = (EvfsDir *)NEXT_OBJ(dir);   // We have two objects allocated together [JournalDir][<base VFS dir size>]
+
+  MAKE_ABS(path, abs_path);
+
+  size_t path_len = strlen(abs_path);
+  if(path_len >= sizeof(dir->path)) {
+    FREE_ABS(abs_path);
+    return EVFS_ERR_TOO_LONG;
+  }
+  memcpy(dir->path, abs_path, path_len+1);
+  FREE_ABS(abs_path);
+
+  int status = base_vfs->m_open_dir(base_vfs, dir->path, dir->base_dir);
+
+  if(status == EVFS_OK) {
+    // Construct a shimmed dir object
+    if(dir->base_dir->methods)
+      dh->methods = &s_journal_dir_methods;
+    else
+      status = EVFS_ERR_INIT;
+  }
+
+  return status;
+}
+
+
+static int journal__get_cur_dir(Evfs *vfs, StringRange *cur_dir) {
+  JournalData *shim_data = (JournalData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_get_cur_dir(base_vfs, cur_dir);
+}
+
+
+static int journal__set_cur_dir(Evfs *vfs, const char *path) {
+  JournalData *shim_data = (JournalData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_set_cur_dir(base_vfs, path);
+}
+
+
+static int journal__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
+  JournalData *shim_data = (JournalData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  switch(cmd) {
+    // We need special handling for EVFS_CMD_UNREGISTER.
+    // It can't pass through since we need to deallocate VFSs in the proper sequence
+    // to avoid corrupting the registered VFS linked list.
+    case EVFS_CMD_UNREGISTER:
+#ifdef EVFS_USE_THREADING
+      stop_maint_worker(shim_data);
+      evfs__cond_destroy(&shim_data->maint_wake);
+      evfs__lock_destroy(&shim_data->maint_lock);
+#endif
+      // Anything that can't be checkpointed is replayed from the log next time.
+      // An open transaction is left incomplete and discarded on replay.
+      checkpoint_locked(shim_data);
+      free_pending(shim_data);
+      evfs_file_close(shim_data->log);
+
+      evfs__lock_destroy(&shim_data->lock);
+      evfs_free(vfs); // Free this journal VFS
+      return EVFS_OK; break;
+
+    case EVFS_CMD_BEGIN_TXN:
+      return begin_txn(shim_data); break;
+
+    case EVFS_CMD_COMMIT_TXN:
+      return commit_txn(shim_data); break;
+
+    case EVFS_CMD_RUN_MAINTENANCE: // Checkpoints run as a single step
+      {
+        int status = checkpoint(shim_data);
+        return status == EVFS_OK ? EVFS_DONE : status;
+      }
+      break;
+
+#ifdef EVFS_USE_THREADING
+    case EVFS_CMD_SET_MAINT_INTERVAL:
+      {
+        unsigned *v = (unsigned *)arg;
+        return set_maint_interval(shim_data, *v);
+      }
+      break;
+#endif
+
+    default: // Everything else passes to the underlying VFS
+      return base_vfs->m_vfs_ctrl(base_vfs, cmd, arg);
+      break;
+  }
+}
+
+
+static bool journal__path_root_component(Evfs *vfs, const char *path, StringRange *root) {
+  JournalData *shim_data = (JournalData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_path_root_component(base_vfs, path, root);
+}
+
+
+/*
+Register a journal filesystem shim
+
+The log is replayed and checkpointed before the shim is registered.
+
+Args:
+  vfs_name:      Name of new shim
+  old_vfs_name:  Existing VFS to wrap with shim
+  log_path:      Path to the log file on the existing VFS
+  cfg:           Journal configuration. Use NULL for default settings
+  default_vfs:   Make this the default VFS when true
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_register_journal(const char *vfs_name, const char *old_vfs_name, const char *log_path,
+                          JournalConfig *cfg, bool default_vfs) {
+  if(PTR_CHECK(vfs_name) || PTR_CHECK(old_vfs_name) || PTR_CHECK(log_path)) return EVFS_ERR_BAD_ARG;
+
+  Evfs *base_vfs, *shim_vfs;
+  JournalData *shim_data;
+
+  base_vfs = evfs_find_vfs(old_vfs_name);
+  if(PTR_CHECK(base_vfs)) return EVFS_ERR_NO_VFS;
+
+  // The log stays in place if the current directory changes
+  char abs_log_path[EVFS_MAX_PATH];
+  StringRange abs_log_r = RANGE_FROM_ARRAY(abs_log_path);
+  int status = evfs_vfs_path_absolute(base_vfs, log_path, &abs_log_r);
+  if(status != EVFS_OK) return status;
+
+  // Construct a new VFS
+  // We have four objects allocated together [Evfs][JournalData][char[]][char[]]
+  size_t name_len = strlen(vfs_name)+1;
+  size_t shim_size = sizeof(*shim_vfs) + sizeof(*shim_data) + name_len + strlen(abs_log_path)+1;
+  shim_vfs = evfs_malloc(shim_size);
+  if(MEM_CHECK(shim_vfs)) return EVFS_ERR_ALLOC;
+
+  memset(shim_vfs, 0, shim_size);
+
+  shim_data = (JournalData *)NEXT_OBJ(shim_vfs);
+
+  shim_vfs->vfs_name = (char *)NEXT_OBJ(shim_data);
+  strcpy((char *)shim_vfs->vfs_name, vfs_name);
+
+  shim_data->log_path = shim_vfs->vfs_name + name_len;
+  strcpy((char *)shim_data->log_path, abs_log_path);
+
+  shim_data->base_vfs = base_vfs;
+  shim_data->vfs_name = shim_vfs->vfs_name;
+  shim_data->shim_vfs = shim_vfs;
+
+  shim_data->checkpoint_size = DEFAULT_CHECKPOINT_SIZE;
+  shim_data->max_record = DEFAULT_MAX_RECORD;
+
+  if(cfg) {
+    if(cfg->checkpoint_size > 0)
+      shim_data->checkpoint_size = cfg->checkpoint_size;
+    if(cfg->max_record > 0)
+      shim_data->max_record = cfg->max_record;
+    shim_data->no_sync = cfg->no_sync;
+  }
+
+  crc32c_init();
+
+  status = evfs_vfs_open(base_vfs, shim_data->log_path, &shim_data->log, EVFS_RDWR | EVFS_OPEN_OR_NEW);
+  if(status != EVFS_OK) {
+    evfs_free(shim_vfs);
+    return status;
+  }
+
+  status = replay_log(shim_data);
+  if(status != EVFS_OK) {
+    free_pending(shim_data);
+    evfs_file_close(shim_data->log);
+    evfs_free(shim_vfs);
+    return status;
+  }
+
+  if(evfs__lock_init(&shim_data->lock) != EVFS_OK) {
+    evfs_file_close(shim_data->log);
+    evfs_free(shim_vfs);
+    THROW(EVFS_ERR_INIT);
+  }
+
+#ifdef EVFS_USE_THREADING
+  evfs__lock_init(&shim_data->maint_lock);
+  evfs__cond_init(&shim_data->maint_wake);
+#endif
+
+  shim_vfs->vfs_file_size = sizeof(JournalFile) + base_vfs->vfs_file_size;
+  shim_vfs->vfs_dir_size = sizeof(JournalDir) + base_vfs->vfs_dir_size;
+  shim_vfs->fs_data = shim_data;
+
+  shim_vfs->m_open = journal__open;
+  shim_vfs->m_stat = journal__stat;
+  shim_vfs->m_delete = journal__delete;
+  shim_vfs->m_rename = journal__rename;
+  shim_vfs->m_make_dir = journal__make_dir;
+  shim_vfs->m_open_dir = journal__open_dir;
+  shim_vfs->m_get_cur_dir = journal__get_cur_dir;
+  shim_vfs->m_set_cur_dir = journal__set_cur_dir;
+  shim_vfs->m_vfs_ctrl = journal__vfs_ctrl;
+
+  shim_vfs->m_path_root_component = journal__path_root_component;
+
+  return evfs_register(shim_vfs, default_vfs);
+}
@@ -0,0 +1,682 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Metrics shim VFS
+
+  Each call through the shim updates a fixed set of counters for its method.
+  The counters are atomic when threading is enabled so that no lock is taken
+  on the I/O path. Snapshots are not taken atomically as a whole. Counters
+  for calls in progress may be ahead of or behind one another by a call.
+------------------------------------------------------------------------------
+*/
+
+#include <string.h>
+
+#include "evfs.h"
+#include "evfs_internal.h"
+#include "evfs/shim/shim_metrics.h"
+
+
+// Access objects allocated in a single block of memory
+#define NEXT_OBJ(o) (&(o)[1])
+
+
+#ifdef EVFS_USE_THREADING
+#  include <stdatomic.h>
+
+typedef atomic_uint_least32_t MetricCount;
+typedef atomic_uint_least64_t MetricBytes;
+
+#  define COUNT_ADD(c, n)       atomic_fetch_add_explicit(&(c), (n), memory_order_relaxed)
+#  define COUNT_GET(c, reset)   ((reset) ? atomic_exchange_explicit(&(c), 0, memory_order_relaxed) \
+                                         : atomic_load_explicit(&(c), memory_order_relaxed))
+// Read and clear each counter in one step so concurrent updates aren't lost
+#  define COUNTS_CLEAR(md)      do {} while(0)
+
+#else
+typedef uint32_t MetricCount;
+typedef uint64_t MetricBytes;
+
+#  define COUNT_ADD(c, n)       ((c) += (n))
+#  define COUNT_GET(c, reset)   (c)
+#  define COUNTS_CLEAR(md)      memset((md)->methods, 0, sizeof((md)->methods))
+#endif
+
+
+typedef struct MethodCounters {
+  MetricCount calls;
+  MetricCount errors;
+  MetricBytes bytes;
+  MetricCount latency[EVFS_METRICS_BUCKETS];
+} MethodCounters;
+
+typedef struct MetricsData_s {
+  Evfs *base_vfs;
+  EvfsMetricsClock clock;
+  MethodCounters methods[EVFS_METRIC_COUNT];
+} MetricsData;
+
+typedef struct MetricsFile_s {
+  EvfsFile base;
+  MetricsData *shim_data;
+  EvfsFile *base_file;
+} MetricsFile;
+
+typedef struct MetricsDir_s {
+  EvfsDir base;
+  MetricsData *shim_data;
+  EvfsDir *base_dir;
+} MetricsDir;
+
+
+// __builtin_clzll() added in GCC 3.4 and Clang 5
+#if (defined __GNUC__ && __GNUC__ >= 4) || (defined __clang__ && __clang_major__ >= 5)
+#  define HAVE_BUILTIN_CLZ
+#endif
+
+// Histogram bucket is the number of significant bits in the elapsed ticks
+static inline unsigned latency_bucket(uint64_t elapsed) {
+  unsigned bits;
+#ifdef HAVE_BUILTIN_CLZ
+  bits = elapsed ? 64 - __builtin_clzll(elapsed) : 0;
+#else
+  for(bits = 0; elapsed; bits++) {
+    elapsed >>= 1;
+  }
+#endif
+  return MIN(bits, EVFS_METRICS_BUCKETS-1);
+}
+
+
+static inline uint64_t metrics_start(MetricsData *md) {
+  return md->clock ? md->clock() : 0;
+}
+
+// Record a call returning a status code
+static void metrics_record(MetricsData *md, EvfsMetricId id, uint64_t start, ptrdiff_t status) {
+  MethodCounters *mc = &md->methods[id];
+
+  COUNT_ADD(mc->calls, 1);
+  if(status < 0)
+    COUNT_ADD(mc->errors, 1);
+
+  if(md->clock)
+    COUNT_ADD(mc->latency[latency_bucket(md->clock() - start)], 1);
+}
+
+// Record a call returning a byte count
+static void metrics_record_xfer(MetricsData *md, EvfsMetricId id, uint64_t start, ptrdiff_t xfer) {
+  if(xfer > 0)
+    COUNT_ADD(md->methods[id].bytes, xfer);
+
+  metrics_record(md, id, start, xfer);
+}
+
+
+static void metrics_collect(MetricsData *md, EvfsMetrics *metrics, bool reset) {
+  EvfsMetrics discard;
+  if(!metrics)
+    metrics = &discard;
+
+  for(int i = 0; i < EVFS_METRIC_COUNT; i++) {
+    MethodCounters *mc = &md->methods[i];
+    EvfsMethodMetrics *mm = &metrics->methods[i];
+
+    mm->calls = COUNT_GET(mc->calls, reset);
+    mm->errors = COUNT_GET(mc->errors, reset);
+    mm->bytes = COUNT_GET(mc->bytes, reset);
+    for(int b = 0; b < EVFS_METRICS_BUCKETS; b++) {
+      mm->latency[b] = COUNT_GET(mc->latency[b], reset);
+    }
+  }
+
+  metrics->bytes_read = metrics->methods[EVFS_METRIC_READ].bytes +
+                        metrics->methods[EVFS_METRIC_READ_AT].bytes +
+                        metrics->methods[EVFS_METRIC_READV].bytes;
+
+  metrics->bytes_written = metrics->methods[EVFS_METRIC_WRITE].bytes +
+                           metrics->methods[EVFS_METRIC_WRITE_AT].bytes +
+                           metrics->methods[EVFS_METRIC_WRITEV].bytes;
+
+  if(reset)
+    COUNTS_CLEAR(md);
+}
+
+
+
+// ******************** File access methods ********************
+
+static int metrics__file_ctrl(EvfsFile *fh, int cmd, void *arg) {
+  MetricsFile *fil = (MetricsFile *)fh;
+  return fil->base_file->methods->m_ctrl(fil->base_file, cmd, arg);
+}
+
+
+static int metrics__file_close(EvfsFile *fh) {
+  MetricsFile *fil = (MetricsFile *)fh;
+  MetricsData *md = fil->shim_data;
+
+  uint64_t start = metrics_start(md);
+  int status = fil->base_file->methods->m_close(fil->base_file);
+  metrics_record(md, EVFS_METRIC_CLOSE, start, status);
+
+  if(status == EVFS_OK) {
+    fil->base.methods = NULL; // Disable this instance
+  }
+
+  return status;
+}
+
+
+static ptrdiff_t metrics__file_read(EvfsFile *fh, void *buf, size_t size) {
+  MetricsFile *fil = (MetricsFile *)fh;
+  MetricsData *md = fil->shim_data;
+
+  uint64_t start = metrics_start(md);
+  ptrdiff_t read = fil->base_file->methods->m_read(fil->base_file, buf, size);
+  metrics_record_xfer(md, EVFS_METRIC_READ, start, read);
+
+  return read;
+}
+
+
+static ptrdiff_t metrics__file_write(EvfsFile *fh, const void *buf, size_t size) {
+  MetricsFile *fil = (MetricsFile *)fh;
+  MetricsData *md = fil->shim_data;
+
+  uint64_t start = metrics_start(md);
+  ptrdiff_t wrote = fil->base_file->methods->m_write(fil->base_file, buf, size);
+  metrics_record_xfer(md, EVFS_METRIC_WRITE, start, wrote);
+
+  return wrote;
+}
+
+
+static ptrdiff_t metrics__file_read_at(EvfsFile *fh, void *buf, size_t size, evfs_off_t offset) {
+  MetricsFile *fil = (MetricsFile *)fh;
+  MetricsData *md = fil->shim_data;
+
+  uint64_t start = metrics_start(md);
+  ptrdiff_t read = evfs_file_read_at(fil->base_file, buf, size, offset);
+  metrics_record_xfer(md, EVFS_METRIC_READ_AT, start, read);
+
+  return read;
+}
+
+
+static ptrdiff_t metrics__file_write_at(EvfsFile *fh, const void *buf, size_t size, evfs_off_t offset) {
+  MetricsFile *fil = (MetricsFile *)fh;
+  MetricsData *md = fil->shim_data;
+
+  uint64_t start = metrics_start(md);
+  ptrdiff_t wrote = evfs_file_write_at(fil->base_file, buf, size, offset);
+  metrics_record_xfer(md, EVFS_METRIC_WRITE_AT, start, wrote);
+
+  return wrote;
+}
+
+
+static ptrdiff_t metrics__file_readv(EvfsFile *fh, const EvfsIOVec *iov, int iovcnt) {
+  MetricsFile *fil = (MetricsFile *)fh;
+  MetricsData *md = fil->shim_data;
+
+  uint64_t start = metrics_start(md);
+  ptrdiff_t read = evfs_file_readv(fil->base_file, iov, iovcnt);
+  metrics_record_xfer(md, EVFS_METRIC_READV, start, read);
+
+  return read;
+}
+
+
+static ptrdiff_t metrics__file_writev(EvfsFile *fh, const EvfsIOVec *iov, int iovcnt) {
+  MetricsFile *fil = (MetricsFile *)fh;
+  MetricsData *md = fil->shim_data;
+
+  uint64_t start = metrics_start(md);
+  ptrdiff_t wrote = evfs_file_writev(fil->base_file, iov, iovcnt);
+  metrics_record_xfer(md, EVFS_METRIC_WRITEV, start, wrote);
+
+  return wrote;
+}
+
+
+static int metrics__file_map(EvfsFile *fh, evfs_off_t offset, size_t size, EvfsMapping *map) {
+  MetricsFile *fil = (MetricsFile *)fh;
+  return evfs_file_map(fil->base_file, offset, size, map);
+}
+
+
+static int metrics__file_unmap(EvfsFile *fh, EvfsMapping *map) {
+  MetricsFile *fil = (MetricsFile *)fh;
+  return evfs_file_unmap(fil->base_file, map);
+}
+
+
+static int metrics__file_discard(EvfsFile *fh, evfs_off_t offset, evfs_off_t size) {
+  MetricsFile *fil = (MetricsFile *)fh;
+  return evfs_file_discard(fil->base_file, offset, size);
+}
+
+
+static int metrics__file_truncate(EvfsFile *fh, evfs_off_t size) {
+  MetricsFile *fil = (MetricsFile *)fh;
+  MetricsData *md = fil->shim_data;
+
+  uint64_t start = metrics_start(md);
+  int status = fil->base_file->methods->m_truncate(fil->base_file, size);
+  metrics_record(md, EVFS_METRIC_TRUNCATE, start, status);
+
+  return status;
+}
+
+
+static int metrics__file_sync(EvfsFile *fh) {
+  MetricsFile *fil = (MetricsFile *)fh;
+  MetricsData *md = fil->shim_data;
+
+  uint64_t start = metrics_start(md);
+  int status = fil->base_file->methods->m_sync(fil->base_file);
+  metrics_record(md, EVFS_METRIC_SYNC, start, status);
+
+  return status;
+}
+
+
+static evfs_off_t metrics__file_size(EvfsFile *fh) {
+  MetricsFile *fil = (MetricsFile *)fh;
+  MetricsData *md = fil->shim_data;
+
+  uint64_t start = metrics_start(md);
+  evfs_off_t size = fil->base_file->methods->m_size(fil->base_file);
+  metrics_record(md, EVFS_METRIC_SIZE, start, size);
+
+  return size;
+}
+
+
+static int metrics__file_seek(EvfsFile *fh, evfs_off_t offset, EvfsSeekDir origin) {
+  MetricsFile *fil = (MetricsFile *)fh;
+  MetricsData *md = fil->shim_data;
+
+  uint64_t start = metrics_start(md);
+  int status = fil->base_file->methods->m_seek(fil->base_file, offset, origin);
+  metrics_record(md, EVFS_METRIC_SEEK, start, status);
+
+  return status;
+}
+
+
+static evfs_off_t metrics__file_tell(EvfsFile *fh) {
+  MetricsFile *fil = (MetricsFile *)fh;
+  return fil->base_file->methods->m_tell(fil->base_file);
+}
+
+
+static bool metrics__file_eof(EvfsFile *fh) {
+  MetricsFile *fil = (MetricsFile *)fh;
+  return fil->base_file->methods->m_eof(fil->base_file);
+}
+
+
+static const EvfsFileMethods s_metrics_methods = {
+  .m_ctrl     = metrics__file_ctrl,
+  .m_close    = metrics__file_close,
+  .m_read     = metrics__file_read,
+  .m_write    = metrics__file_write,
+  .m_truncate = metrics__file_truncate,
+  .m_sync     = metrics__file_sync,
+  .m_size     = metrics__file_size,
+  .m_seek     = metrics__file_seek,
+  .m_tell     = metrics__file_tell,
+  .m_eof      = metrics__file_eof,
+  .m_read_at  = metrics__file_read_at,
+  .m_write_at = metrics__file_write_at,
+  .m_readv    = metrics__file_readv,
+  .m_writev   = metrics__file_writev,
+  .m_map      = metrics__file_map,
+  .m_unmap    = metrics__file_unmap,
+  .m_discard  = metrics__file_discard
+};
+
+
+
+// ******************** Directory access methods ********************
+
+static int metrics__dir_close(EvfsDir *dh) {
+  MetricsDir *dir = (MetricsDir *)dh;
+  MetricsData *md = dir->shim_data;
+
+  uint64_t start = metrics_start(md);
+  int status = dir->base_dir->methods->m_close(dir->base_dir);
+  metrics_record(md, EVFS_METRIC_DIR_CLOSE, start, status);
+
+  if(status == EVFS_OK) {
+    dir->base.methods = NULL; // Disable this instance
+  }
+
+  return status;
+}
+
+static int metrics__dir_read(EvfsDir *dh, EvfsInfo *info) {
+  MetricsDir *dir = (MetricsDir *)dh;
+  MetricsData *md = dir->shim_data;
+
+  uint64_t start = metrics_start(md);
+  int status = dir->base_dir->methods->m_read(dir->base_dir, info);
+  // End of directory is the normal way to finish a listing
+  metrics_record(md, EVFS_METRIC_DIR_READ, start, status == EVFS_DONE ? EVFS_OK : status);
+
+  return status;
+}
+
+static int metrics__dir_read_many(EvfsDir *dh, EvfsInfo *entries, int max_entries, char *name_buf,
+                                  size_t name_buf_size) {
+  MetricsDir *dir = (MetricsDir *)dh;
+  MetricsData *md = dir->shim_data;
+
+  uint64_t start = metrics_start(md);
+  int count = evfs_dir_read_many(dir->base_dir, entries, max_entries, name_buf, name_buf_size);
+  metrics_record(md, EVFS_METRIC_DIR_READ_MANY, start, count);
+
+  return count;
+}
+
+static int metrics__dir_rewind(EvfsDir *dh) {
+  MetricsDir *dir = (MetricsDir *)dh;
+  return dir->base_dir->methods->m_rewind(dir->base_dir);
+}
+
+
+static const EvfsDirMethods s_metrics_dir_methods = {
+  .m_close    = metrics__dir_close,
+  .m_read     = metrics__dir_read,
+  .m_rewind   = metrics__dir_rewind,
+  .m_read_many = metrics__dir_read_many
+};
+
+
+
+// ******************** FS access methods ********************
+
+static int metrics__open(Evfs *vfs, const char *path, EvfsFile *fh, int flags) {
+  MetricsFile *fil = (MetricsFile *)fh;
+  MetricsData *md = (MetricsData *)vfs->fs_data;
+  Evfs *base_vfs = md->base_vfs;
+
+  fil->shim_data = md;
+  fil->base_file = (EvfsFile *)NEXT_OBJ(fil);  // We have two objects allocated together [MetricsFile][<base VFS file size>]
+
+  uint64_t start = metrics_start(md);
+  int status = base_vfs->m_open(base_vfs, path, fil->base_file, flags);
+  metrics_record(md, EVFS_METRIC_OPEN, start, status);
+
+  if(status == EVFS_OK) {
+    // Add methods to make this functional
+    if(fil->base_file->methods) {
+      fh->methods = &s_metrics_methods;
+    } else {
+      fh->methods = NULL;
+      status = EVFS_ERR_INIT;
+    }
+
+  } else { // Open failed
+    fh->methods = NULL;
+  }
+
+  return status;
+}
+
+
+static int metrics__stat(Evfs *vfs, const char *path, EvfsInfo *info) {
+  MetricsData *md = (MetricsData *)vfs->fs_data;
+  Evfs *base_vfs = md->base_vfs;
+
+  uint64_t start = metrics_start(md);
+  int status = base_vfs->m_stat(base_vfs, path, info);
+  metrics_record(md, EVFS_METRIC_STAT, start, status);
+
+  return status;
+}
+
+
+static int metrics__delete(Evfs *vfs, const char *path) {
+  MetricsData *md = (MetricsData *)vfs->fs_data;
+  Evfs *base_vfs = md->base_vfs;
+
+  uint64_t start = metrics_start(md);
+  int status = base_vfs->m_delete(base_vfs, path);
+  metrics_record(md, EVFS_METRIC_DELETE, start, status);
+
+  return status;
+}
+
+
+static int metrics__rename(Evfs *vfs, const char *old_path, const char *new_path) {
+  MetricsData *md = (MetricsData *)vfs->fs_data;
+  Evfs *base_vfs = md->base_vfs;
+
+  uint64_t start = metrics_start(md);
+  int status = base_vfs->m_rename(base_vfs, old_path, new_path);
+  metrics_record(md, EVFS_METRIC_RENAME, start, status);
+
+  return status;
+}
+
+
+static int metrics__make_dir(Evfs *vfs, const char *path) {
+  MetricsData *md = (MetricsData *)vfs->fs_data;
+  Evfs *base_vfs = md->base_vfs;
+
+  uint64_t start = metrics_start(md);
+  int status = base_vfs->m_make_dir(base_vfs, path);
+  metrics_record(md, EVFS_METRIC_MAKE_DIR, start, status);
+
+  return status;
+}
+
+
+static int metrics__open_dir(Evfs *vfs, const char *path, EvfsDir *dh) {
+  MetricsDir *dir = (MetricsDir *)dh;
+  MetricsData *md = (MetricsData *)vfs->fs_data;
+  Evfs *base_vfs = md->base_vfs;
+
+  dir->shim_data = md;
+  dir->base_dir = (EvfsDir *)NEXT_OBJ(dir);   // We have two objects allocated together [MetricsDir][<base VFS dir size>]
+
+  uint64_t start = metrics_start(md);
+  int status = base_vfs->m_open_dir(base_vfs, path, dir->base_dir);
+  metrics_record(md, EVFS_METRIC_OPEN_DIR, start, status);
+
+  if(status == EVFS_OK) {
+    // Add methods to make this functional
+    if(dir->base_dir->methods) {
+      dh->methods = &s_metrics_dir_methods;
+    } else {
+      dh->methods = NULL;
+      status = EVFS_ERR_INIT;
+    }
+
+  } else { // Open failed
+    dh->methods = NULL;
+  }
+
+  return status;
+}
+
+
+static int metrics__get_cur_dir(Evfs *vfs, StringRange *cur_dir) {
+  MetricsData *md = (MetricsData *)vfs->fs_data;
+  Evfs *base_vfs = md->base_vfs;
+
+  return base_vfs->m_get_cur_dir(base_vfs, cur_dir);
+}
+
+
+static int metrics__set_cur_dir(Evfs *vfs, const char *path) {
+  MetricsData *md = (MetricsData *)vfs->fs_data;
+  Evfs *base_vfs = md->base_vfs;
+
+  uint64_t start = metrics_start(md);
+  int status = base_vfs->m_set_cur_dir(base_vfs, path);
+  metrics_record(md, EVFS_METRIC_SET_CUR_DIR, start, status);
+
+  return status;
+}
+
+
+static int metrics__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
+  MetricsData *md = (MetricsData *)vfs->fs_data;
+  Evfs *base_vfs = md->base_vfs;
+
+  switch(cmd) {
+    // We need special handling for EVFS_CMD_UNREGISTER.
+    // It can't pass through since we need to deallocate VFSs in the proper sequence
+    // to avoid corrupting the registered VFS linked list.
+    case EVFS_CMD_UNREGISTER:
+      evfs_free(vfs); // Free this metrics VFS
+      return EVFS_OK; break;
+
+    case EVFS_CMD_GET_METRICS:
+      if(PTR_CHECK(arg)) return EVFS_ERR_BAD_ARG;
+      metrics_collect(md, (EvfsMetrics *)arg, /*reset*/ false);
+      return EVFS_OK; break;
+
+    case EVFS_CMD_RESET_METRICS: // Optional arg gets the final counts
+      metrics_collect(md, (EvfsMetrics *)arg, /*reset*/ true);
+      return EVFS_OK; break;
+
+    default: // Everything else passes to the underlying VFS
+      return base_vfs->m_vfs_ctrl(base_vfs, cmd, arg);
+      break;
+  }
+}
+
+
+static bool metrics__path_root_component(Evfs *vfs, const char *path, StringRange *root) {
+  MetricsData *md = (MetricsData *)vfs->fs_data;
+  Evfs *base_vfs = md->base_vfs;
+
+  return base_vfs->m_path_root_component(base_vfs, path, root);
+}
+
+
+/*
+Register a metrics filesystem shim
+
+Args:
+  vfs_name:      Name of new shim
+  old_vfs_name:  Existing VFS to wrap with shim
+  clock:         Monotonic time source for latency histograms. Use NULL to skip timing
+  default_vfs:   Make this the default VFS when true
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_register_metrics(const char *vfs_name, const char *old_vfs_name, EvfsMetricsClock clock,
+                          bool default_vfs) {
+  if(PTR_CHECK(vfs_name) || PTR_CHECK(old_vfs_name)) return EVFS_ERR_BAD_ARG;
+
+  Evfs *base_vfs, *shim_vfs;
+  MetricsData *shim_data;
+
+  base_vfs = evfs_find_vfs(old_vfs_name);
+  if(PTR_CHECK(base_vfs)) return EVFS_ERR_NO_VFS;
+
+  // Construct a new VFS
+  // We have three objects allocated together [Evfs][MetricsData][char[]]
+  size_t shim_size = sizeof(*shim_vfs) + sizeof(*shim_data) + strlen(vfs_name)+1;
+  shim_vfs = evfs_malloc(shim_size);
+  if(MEM_CHECK(shim_vfs)) return EVFS_ERR_ALLOC;
+
+  memset(shim_vfs, 0, shim_size); // All counters start at 0
+
+  shim_data = (MetricsData *)NEXT_OBJ(shim_vfs);
+
+  shim_vfs->vfs_name = (char *)NEXT_OBJ(shim_data);
+  strcpy((char *)shim_vfs->vfs_name, vfs_name);
+
+  shim_data->base_vfs = base_vfs;
+  shim_data->clock = clock;
+
+  shim_vfs->vfs_file_size = sizeof(MetricsFile) + base_vfs->vfs_file_size;
+  shim_vfs->vfs_dir_size = sizeof(MetricsDir) + base_vfs->vfs_dir_size;
+  shim_vfs->fs_data = shim_data;
+
+  shim_vfs->m_open = metrics__open;
+  shim_vfs->m_stat = metrics__stat;
+  shim_vfs->m_delete = metrics__delete;
+  shim_vfs->m_rename = metrics__rename;
+  shim_vfs->m_make_dir = metrics__make_dir;
+  shim_vfs->m_open_dir = metrics__open_dir;
+  shim_vfs->m_get_cur_dir = metrics__get_cur_dir;
+  shim_vfs->m_set_cur_dir = metrics__set_cur_dir;
+  shim_vfs->m_vfs_ctrl = metrics__vfs_ctrl;
+
+  shim_vfs->m_path_root_component = metrics__path_root_component;
+
+  return evfs_register(shim_vfs, default_vfs);
+}
+
+
+/*
+Get the current counts from a metrics shim
+
+Args:
+  vfs_name:  Name of the metrics shim. Use NULL for the default VFS
+  metrics:   Snapshot of the counters
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_metrics_snapshot(const char *vfs_name, EvfsMetrics *metrics) {
+  if(PTR_CHECK(metrics)) return EVFS_ERR_BAD_ARG;
+
+  return evfs_vfs_ctrl_ex(EVFS_CMD_GET_METRICS, metrics, vfs_name);
+}
+
+
+/*
+Clear the counters of a metrics shim
+
+Each counter is read and cleared in one step so that calls made while
+resetting are not lost between the snapshot and the reset.
+
+Args:
+  vfs_name:  Name of the metrics shim. Use NULL for the default VFS
+  metrics:   Optional snapshot of the counters before they were cleared
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_metrics_reset(const char *vfs_name, EvfsMetrics *metrics) {
+  return evfs_vfs_ctrl_ex(EVFS_CMD_RESET_METRICS, metrics, vfs_name);
+}
+
+
+#define EVFS_METRIC_NAME_CASE(E, S)  case E: return S;
+
+/*
+Translate a metric ID to the name of its method
+
+Args:
+  id:  Metric ID
+
+Returns:
+  The method name string
+*/
+const char *evfs_metric_name(EvfsMetricId id) {
+  switch(id) {
+    EVFS_METRIC_LIST(EVFS_METRIC_NAME_CASE);
+    default: break;
+  }
+
+  return "<unknown>";
+}
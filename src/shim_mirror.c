@@ -0,0 +1,1179 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Mirror shim VFS
+
+This shim keeps identical copies of the filesystem on several member VFSs.
+Every change is made on all members. Writes are issued to the members in
+parallel when threading is enabled and MirrorConfig.io_threads is nonzero.
+Otherwise the members are written one after another. A change succeeds when
+write_quorum members complete it. All members are waited on before returning
+since the operations use the caller's buffer.
+
+A member that fails a change while the quorum succeeds has fallen behind. It
+is dropped from the file handle and the path is added to a resync list when
+the handle is closed. Stale copies are not read or written until they are
+resynced. Resync copies the file from a current member or deletes it when it
+no longer exists. Entries are resynced by EVFS_CMD_RUN_MAINTENANCE. In
+threaded builds EVFS_CMD_SET_MAINT_INTERVAL starts a background thread that
+resyncs periodically and soon after a handle adds to the list. A resync is
+put off while the file is open for writing. The list is kept in memory so
+members that fall behind must be resynced before the shim is unregistered.
+
+Reads go to the member with the fewest reads in progress with ties rotated
+among the members. A read that fails is retried on another member and the
+failed member is marked as stale.
+
+Directory listings and stats come from the first member that has a current
+copy of the path.
+
+------------------------------------------------------------------------------
+*/
+
+#include <string.h>
+
+#include "evfs.h"
+#include "evfs_internal.h"
+#include "evfs/async_io.h"
+#include "evfs/shim/shim_mirror.h"
+
+
+// Access objects allocated in a single block of memory
+#define NEXT_OBJ(o) (&(o)[1])
+
+#define MEMBER_BIT(m)   (1u << (m))
+
+#define COPY_BUF_SIZE   4096
+
+
+// Path with out of date copies
+typedef struct MirrorResync {
+  struct MirrorResync *next;
+  uint32_t    stale;    // Members needing resync
+  unsigned    writers;  // Handles open for writing. Resync waits until 0
+  unsigned    round;    // Last resync run that visited this entry
+  char       *path;
+} MirrorResync;
+
+typedef struct MirrorData {
+  Evfs           *members[EVFS_MIRROR_MAX_MEMBERS];
+  unsigned        num_members;
+  unsigned        write_quorum;
+  const char     *vfs_name;
+  Evfs           *shim_vfs;
+
+  EvfsLock        lock;         // Protects load counts and resync list
+  unsigned        load[EVFS_MIRROR_MAX_MEMBERS]; // Reads in progress on each member
+  unsigned        next_read;    // First member checked for the next read
+  MirrorResync   *resync;
+  unsigned        resync_round;
+
+  EvfsAsyncQueue *queue;        // Queue for parallel writes or NULL
+  EvfsLock        io_lock;      // Only one transfer reaps from the queue at a time
+
+  EvfsLock        maint_lock;   // Serialize resync runs
+#ifdef EVFS_USE_THREADING
+  // Background resync for EVFS_CMD_SET_MAINT_INTERVAL
+  EvfsCond        maint_wake;   // Signaled on new entries, config change, and shutdown
+  EvfsThread      maint_thread;
+  unsigned        maint_ms;
+  bool            maint_running;
+  bool            maint_stop;
+#endif
+} MirrorData;
+
+typedef struct MirrorFile {
+  EvfsFile        base;
+  MirrorData     *shim_data;
+  EvfsFile       *members[EVFS_MIRROR_MAX_MEMBERS]; // NULL for members not in use
+  uint32_t        failed;       // Members dropped after an error
+  char           *path;
+
+  evfs_off_t      pos;
+
+  bool            writable;
+  bool            append;
+  bool            eof;
+  bool            pinned;       // Holding off resync of an existing entry
+} MirrorFile;
+
+typedef struct MirrorDir {
+  EvfsDir         base;
+  MirrorData     *shim_data;
+  EvfsDir        *base_dir;
+} MirrorDir;
+
+
+
+// ******************** Resync list ********************
+
+static MirrorResync *find_resync(MirrorData *shim_data, const char *path) {
+  for(MirrorResync *entry = shim_data->resync; entry; entry = entry->next) {
+    if(!strcmp(entry->path, path))
+      return entry;
+  }
+
+  return NULL;
+}
+
+
+static void wake_maint_worker(MirrorData *shim_data) {
+#ifdef EVFS_USE_THREADING
+  evfs__cond_signal(&shim_data->maint_wake);
+#endif
+}
+
+
+static int add_resync(MirrorData *shim_data, const char *path, uint32_t stale) {
+  int status = EVFS_OK;
+
+  evfs__lock(&shim_data->lock);
+  MirrorResync *entry = find_resync(shim_data, path);
+
+  if(entry) {
+    entry->stale |= stale;
+
+  } else {
+    // We have two objects allocated together [MirrorResync][char[]]
+    entry = evfs_malloc(sizeof(*entry) + strlen(path)+1);
+    if(MEM_CHECK(entry)) {
+      status = EVFS_ERR_ALLOC;
+    } else {
+      memset(entry, 0, sizeof(*entry));
+      entry->path = (char *)NEXT_OBJ(entry);
+      strcpy(entry->path, path);
+      entry->stale = stale;
+      entry->next = shim_data->resync;
+      shim_data->resync = entry;
+    }
+  }
+  evfs__unlock(&shim_data->lock);
+
+  if(status == EVFS_OK)
+    wake_maint_worker(shim_data);
+
+  return status;
+}
+
+
+// Get the stale members for a path and hold off its resync while writing
+static uint32_t pin_resync(MirrorFile *fil, const char *path) {
+  MirrorData *shim_data = fil->shim_data;
+  uint32_t stale = 0;
+
+  evfs__lock(&shim_data->lock);
+  MirrorResync *entry = find_resync(shim_data, path);
+  if(entry) {
+    stale = entry->stale;
+    if(fil->writable) {
+      entry->writers++;
+      fil->pinned = true;
+    }
+  }
+  evfs__unlock(&shim_data->lock);
+
+  return stale;
+}
+
+
+static void unpin_resync(MirrorFile *fil) {
+  MirrorData *shim_data = fil->shim_data;
+
+  if(!fil->pinned)
+    return;
+
+  // Pinned entries aren't removed so this always finds it
+  evfs__lock(&shim_data->lock);
+  MirrorResync *entry = find_resync(shim_data, fil->path);
+  if(entry)
+    entry->writers--;
+  evfs__unlock(&shim_data->lock);
+
+  fil->pinned = false;
+}
+
+
+static uint32_t stale_members(MirrorData *shim_data, const char *path) {
+  evfs__lock(&shim_data->lock);
+  MirrorResync *entry = find_resync(shim_data, path);
+  uint32_t stale = entry ? entry->stale : 0;
+  evfs__unlock(&shim_data->lock);
+
+  return stale;
+}
+
+
+static int copy_file(Evfs *src_vfs, Evfs *dest_vfs, const char *path) {
+  EvfsFile *src_fh, *dest_fh;
+
+  int status = evfs_vfs_open(src_vfs, path, &src_fh, EVFS_READ);
+  if(status != EVFS_OK) return status;
+
+  status = evfs_vfs_open(dest_vfs, path, &dest_fh, EVFS_WRITE | EVFS_OVERWRITE);
+  if(status != EVFS_OK) {
+    evfs_file_close(src_fh);
+    return status;
+  }
+
+  uint8_t *buf = evfs_malloc(COPY_BUF_SIZE);
+  if(MEM_CHECK(buf)) {
+    status = EVFS_ERR_ALLOC;
+  } else {
+    while(1) {
+      ptrdiff_t read = evfs_file_read(src_fh, buf, COPY_BUF_SIZE);
+      if(read <= 0) {
+        if(read < 0) status = read;
+        break;
+      }
+
+      ptrdiff_t wrote = evfs_file_write(dest_fh, buf, read);
+      if(wrote != read) {
+        status = wrote < 0 ? wrote : EVFS_ERR_IO;
+        break;
+      }
+    }
+
+    evfs_free(buf);
+  }
+
+  evfs_file_close(src_fh);
+  int close_status = evfs_file_close(dest_fh);
+
+  return status != EVFS_OK ? status : close_status;
+}
+
+
+// Bring stale copies of a path up to date. Returns the members that were fixed.
+static uint32_t resync_path(MirrorData *shim_data, const char *path, uint32_t stale) {
+  // Find a current copy. A missing path is current if it was deleted.
+  EvfsInfo info;
+  int src = -1;
+  int src_status = EVFS_ERR_NO_FILE;
+
+  for(unsigned i = 0; i < shim_data->num_members; i++) {
+    if(stale & MEMBER_BIT(i)) continue;
+
+    Evfs *member = shim_data->members[i];
+    src_status = member->m_stat(member, path, &info);
+    if(src_status == EVFS_OK || src_status == EVFS_ERR_NO_FILE) {
+      src = i;
+      break;
+    }
+  }
+
+  if(src < 0) // No member can be read
+    return 0;
+
+  uint32_t fixed = 0;
+
+  for(unsigned i = 0; i < shim_data->num_members; i++) {
+    if(!(stale & MEMBER_BIT(i))) continue;
+
+    Evfs *member = shim_data->members[i];
+    int status;
+
+    if(src_status == EVFS_ERR_NO_FILE) {
+      status = member->m_delete(member, path);
+      if(status == EVFS_ERR_NO_FILE || status == EVFS_ERR_NO_PATH)
+        status = EVFS_OK;
+
+    } else if(info.type & EVFS_FILE_DIR) {
+      status = member->m_make_dir(member, path);
+      if(status == EVFS_ERR_EXISTS)
+        status = EVFS_OK;
+
+    } else {
+      status = copy_file(shim_data->members[src], member, path);
+    }
+
+    if(status == EVFS_OK)
+      fixed |= MEMBER_BIT(i);
+  }
+
+  return fixed;
+}
+
+
+/*
+Resync entries from the list
+
+Each call visits entries once until all of them have been tried. Entries
+open for writing are skipped.
+
+Args:
+  shim_data:  Mirror data
+  max_steps:  Number of entries to resync. 0 to try all of them
+
+Returns:
+  EVFS_DONE when the list is empty, EVFS_OK when entries remain
+*/
+static int run_resync(MirrorData *shim_data, unsigned max_steps) {
+  char path[EVFS_MAX_PATH];
+
+  evfs__lock(&shim_data->maint_lock);
+
+  evfs__lock(&shim_data->lock);
+  unsigned round = ++shim_data->resync_round;
+  evfs__unlock(&shim_data->lock);
+
+  for(unsigned step = 0; max_steps == 0 || step < max_steps; step++) {
+    uint32_t stale = 0;
+
+    // Take the next entry for this round
+    evfs__lock(&shim_data->lock);
+    for(MirrorResync *entry = shim_data->resync; entry; entry = entry->next) {
+      if(entry->round != round && entry->writers == 0 && strlen(entry->path) < EVFS_MAX_PATH) {
+        entry->round = round;
+        stale = entry->stale;
+        strcpy(path, entry->path);
+        break;
+      }
+    }
+    evfs__unlock(&shim_data->lock);
+
+    if(!stale) // Nothing left this round
+      break;
+
+    uint32_t fixed = resync_path(shim_data, path, stale);
+
+    // Entry may have gained stale members during the resync
+    evfs__lock(&shim_data->lock);
+    for(MirrorResync **cur = &shim_data->resync; *cur; cur = &(*cur)->next) {
+      MirrorResync *entry = *cur;
+      if(!strcmp(entry->path, path)) {
+        entry->stale &= ~fixed;
+        if(!entry->stale && entry->writers == 0) {
+          *cur = entry->next;
+          evfs_free(entry);
+        }
+        break;
+      }
+    }
+    evfs__unlock(&shim_data->lock);
+  }
+
+  evfs__lock(&shim_data->lock);
+  int status = shim_data->resync ? EVFS_OK : EVFS_DONE;
+  evfs__unlock(&shim_data->lock);
+
+  evfs__unlock(&shim_data->maint_lock);
+
+  return status;
+}
+
+
+#ifdef EVFS_USE_THREADING
+// Background thread that resyncs the list periodically
+static void maint_worker(void *arg) {
+  MirrorData *shim_data = (MirrorData *)arg;
+
+  evfs__lock(&shim_data->maint_lock);
+  while(!shim_data->maint_stop) {
+    if(shim_data->maint_ms > 0)
+      evfs__cond_timedwait(&shim_data->maint_wake, &shim_data->maint_lock, shim_data->maint_ms);
+    else // Idle until reconfigured
+      evfs__cond_wait(&shim_data->maint_wake, &shim_data->maint_lock);
+
+    if(shim_data->maint_stop)
+      break;
+
+    if(shim_data->maint_ms == 0)
+      continue;
+
+    evfs__unlock(&shim_data->maint_lock);
+    run_resync(shim_data, 0);
+    evfs__lock(&shim_data->maint_lock);
+  }
+  evfs__unlock(&shim_data->maint_lock);
+}
+
+
+static int set_maint_interval(MirrorData *shim_data, unsigned interval_ms) {
+  int status = EVFS_OK;
+
+  evfs__lock(&shim_data->maint_lock);
+  shim_data->maint_ms = interval_ms;
+
+  if(shim_data->maint_running) { // Pick up the new interval
+    evfs__cond_signal(&shim_data->maint_wake);
+  } else if(interval_ms > 0) { // Start the worker the first time an interval is set
+    status = evfs__thread_create(&shim_data->maint_thread, maint_worker, shim_data);
+    if(status == EVFS_OK)
+      shim_data->maint_running = true;
+  }
+  evfs__unlock(&shim_data->maint_lock);
+
+  return status;
+}
+
+
+static void stop_maint_worker(MirrorData *shim_data) {
+  evfs__lock(&shim_data->maint_lock);
+  bool running = shim_data->maint_running;
+  shim_data->maint_stop = true;
+  evfs__cond_signal(&shim_data->maint_wake);
+  evfs__unlock(&shim_data->maint_lock);
+
+  if(running)
+    evfs__thread_join(shim_data->maint_thread);
+}
+#endif // EVFS_USE_THREADING
+
+
+
+// ******************** File data ********************
+
+static inline bool member_active(MirrorFile *fil, unsigned m) {
+  return fil->members[m] && !(fil->failed & MEMBER_BIT(m));
+}
+
+
+static unsigned active_count(MirrorFile *fil) {
+  unsigned count = 0;
+  for(unsigned i = 0; i < fil->shim_data->num_members; i++) {
+    if(member_active(fil, i))
+      count++;
+  }
+
+  return count;
+}
+
+
+// Choose the least loaded member for a read
+static int acquire_reader(MirrorFile *fil, uint32_t skip) {
+  MirrorData *shim_data = fil->shim_data;
+  int best = -1;
+
+  evfs__lock(&shim_data->lock);
+  for(unsigned n = 0; n < shim_data->num_members; n++) {
+    unsigned m = (shim_data->next_read + n) % shim_data->num_members;
+    if(!member_active(fil, m) || (skip & MEMBER_BIT(m))) continue;
+
+    if(best < 0 || shim_data->load[m] < shim_data->load[best])
+      best = m;
+  }
+
+  if(best >= 0) {
+    shim_data->load[best]++;
+    shim_data->next_read = (best + 1) % shim_data->num_members;
+  }
+  evfs__unlock(&shim_data->lock);
+
+  return best;
+}
+
+
+static void release_reader(MirrorFile *fil, int m) {
+  MirrorData *shim_data = fil->shim_data;
+
+  evfs__lock(&shim_data->lock);
+  shim_data->load[m]--;
+  evfs__unlock(&shim_data->lock);
+}
+
+
+static void write_members_parallel(MirrorFile *fil, const void *buf, size_t size, evfs_off_t offset,
+                                   ptrdiff_t *results) {
+  MirrorData *shim_data = fil->shim_data;
+  EvfsCompletion events[EVFS_MIRROR_MAX_MEMBERS];
+  unsigned in_flight = 0;
+
+  evfs__lock(&shim_data->io_lock);
+
+  for(unsigned i = 0; i < shim_data->num_members; i++) {
+    if(!member_active(fil, i)) continue;
+
+    // Completions report into the result slot for their member
+    int status = evfs_file_submit_write(shim_data->queue, fil->members[i], buf, size, offset, &results[i]);
+    if(status == EVFS_OK)
+      in_flight++;
+    else
+      results[i] = status;
+  }
+
+  while(in_flight > 0) {
+    int count = evfs_async_reap(shim_data->queue, events, COUNT_OF(events), /*wait*/ true);
+    if(count <= 0)
+      break;
+
+    for(int i = 0; i < count; i++) {
+      *(ptrdiff_t *)events[i].user_data = events[i].result;
+      in_flight--;
+    }
+  }
+
+  evfs__unlock(&shim_data->io_lock);
+}
+
+
+// Drop members that didn't complete and check the quorum
+static int check_quorum(MirrorFile *fil, int *results, int expect) {
+  MirrorData *shim_data = fil->shim_data;
+  unsigned complete = 0;
+  int first_err = EVFS_OK;
+
+  for(unsigned i = 0; i < shim_data->num_members; i++) {
+    if(!member_active(fil, i)) continue;
+
+    if(results[i] == expect) {
+      complete++;
+    } else {
+      fil->failed |= MEMBER_BIT(i);
+      if(first_err == EVFS_OK)
+        first_err = results[i] < 0 ? results[i] : EVFS_ERR_IO;
+    }
+  }
+
+  if(complete >= shim_data->write_quorum)
+    return EVFS_OK;
+
+  return first_err != EVFS_OK ? first_err : EVFS_ERR_IO;
+}
+
+
+static ptrdiff_t write_members(MirrorFile *fil, const void *buf, size_t size, evfs_off_t offset) {
+  MirrorData *shim_data = fil->shim_data;
+  ptrdiff_t results[EVFS_MIRROR_MAX_MEMBERS];
+
+  if(shim_data->queue && active_count(fil) > 1) {
+    write_members_parallel(fil, buf, size, offset, results);
+
+  } else {
+    for(unsigned i = 0; i < shim_data->num_members; i++) {
+      if(member_active(fil, i))
+        results[i] = evfs_file_write_at(fil->members[i], buf, size, offset);
+    }
+  }
+
+  // Only full writes count toward the quorum
+  int status_results[EVFS_MIRROR_MAX_MEMBERS];
+  for(unsigned i = 0; i < shim_data->num_members; i++) {
+    if(member_active(fil, i))
+      status_results[i] = results[i] == (ptrdiff_t)size ? EVFS_OK :
+                          (results[i] < 0 ? (int)results[i] : EVFS_ERR_IO);
+  }
+
+  int status = check_quorum(fil, status_results, EVFS_OK);
+  return status == EVFS_OK ? (ptrdiff_t)size : status;
+}
+
+
+
+// ******************** File access methods ********************
+
+static int mirror__file_ctrl(EvfsFile *fh, int cmd, void *arg) {
+  MirrorFile *fil = (MirrorFile *)fh;
+  int status = EVFS_ERR_NO_SUPPORT;
+
+  // Commands go to every member. The first result is returned.
+  bool first = true;
+  for(unsigned i = 0; i < fil->shim_data->num_members; i++) {
+    if(!member_active(fil, i)) continue;
+
+#ifdef EVFS_USE_IO_STATS
+    // Members hold the same data so only one adds its counts. Going through
+    // evfs_file_ctrl() would replace the counters for this handle.
+    if(cmd == EVFS_CMD_GET_IO_STATS)
+      return fil->members[i]->methods->m_ctrl(fil->members[i], cmd, arg);
+#endif
+
+    int rval = evfs_file_ctrl(fil->members[i], cmd, arg);
+    if(first)
+      status = rval;
+    first = false;
+  }
+
+  return status;
+}
+
+
+static int mirror__file_close(EvfsFile *fh) {
+  MirrorFile *fil = (MirrorFile *)fh;
+  MirrorData *shim_data = fil->shim_data;
+  int results[EVFS_MIRROR_MAX_MEMBERS];
+
+  for(unsigned i = 0; i < shim_data->num_members; i++) {
+    if(fil->members[i])
+      results[i] = evfs_file_close(fil->members[i]);
+  }
+
+  int status = fil->writable ? check_quorum(fil, results, EVFS_OK) : EVFS_OK;
+
+  unpin_resync(fil);
+
+  if(fil->failed && fil->writable) {
+    int rval = add_resync(shim_data, fil->path, fil->failed);
+    if(status == EVFS_OK)
+      status = rval;
+  }
+
+  evfs_free(fil->path);
+  fil->path = NULL;
+  fil->base.methods = NULL;
+
+  return status;
+}
+
+
+static ptrdiff_t mirror__file_read_at(EvfsFile *fh, void *buf, size_t size, evfs_off_t offset) {
+  MirrorFile *fil = (MirrorFile *)fh;
+  uint32_t tried = 0;
+  ptrdiff_t status = EVFS_ERR_IO;
+
+  // Failed reads are retried on the other members
+  while(1) {
+    int m = acquire_reader(fil, tried);
+    if(m < 0)
+      return status;
+
+    ptrdiff_t read = evfs_file_read_at(fil->members[m], buf, size, offset);
+    release_reader(fil, m);
+
+    if(read >= 0)
+      return read;
+
+    status = read;
+    tried |= MEMBER_BIT(m);
+    fil->failed |= MEMBER_BIT(m);
+  }
+}
+
+
+static evfs_off_t mirror__file_size(EvfsFile *fh) {
+  MirrorFile *fil = (MirrorFile *)fh;
+
+  for(unsigned i = 0; i < fil->shim_data->num_members; i++) {
+    if(member_active(fil, i))
+      return evfs_file_size(fil->members[i]);
+  }
+
+  return 0;
+}
+
+
+static ptrdiff_t mirror__file_read(EvfsFile *fh, void *buf, size_t size) {
+  MirrorFile *fil = (MirrorFile *)fh;
+
+  ptrdiff_t read = mirror__file_read_at(fh, buf, size, fil->pos);
+  if(read < 0) return read;
+
+  fil->pos += read;
+  if((size_t)read < size)
+    fil->eof = true;
+
+  return read;
+}
+
+
+static ptrdiff_t mirror__file_write_at(EvfsFile *fh, const void *buf, size_t size, evfs_off_t offset) {
+  MirrorFile *fil = (MirrorFile *)fh;
+
+  if(!fil->writable) return EVFS_ERR_DISABLED;
+
+  return write_members(fil, buf, size, offset);
+}
+
+
+static ptrdiff_t mirror__file_write(EvfsFile *fh, const void *buf, size_t size) {
+  MirrorFile *fil = (MirrorFile *)fh;
+
+  if(!fil->writable) return EVFS_ERR_DISABLED;
+
+  if(fil->append)
+    fil->pos = mirror__file_size(fh);
+
+  ptrdiff_t wrote = write_members(fil, buf, size, fil->pos);
+  if(wrote > 0)
+    fil->pos += wrote;
+
+  return wrote;
+}
+
+
+static int mirror__file_truncate(EvfsFile *fh, evfs_off_t size) {
+  MirrorFile *fil = (MirrorFile *)fh;
+  int results[EVFS_MIRROR_MAX_MEMBERS];
+
+  if(!fil->writable) return EVFS_ERR_DISABLED;
+
+  for(unsigned i = 0; i < fil->shim_data->num_members; i++) {
+    if(member_active(fil, i))
+      results[i] = evfs_file_truncate(fil->members[i], size);
+  }
+
+  return check_quorum(fil, results, EVFS_OK);
+}
+
+
+static int mirror__file_sync(EvfsFile *fh) {
+  MirrorFile *fil = (MirrorFile *)fh;
+  int results[EVFS_MIRROR_MAX_MEMBERS];
+
+  for(unsigned i = 0; i < fil->shim_data->num_members; i++) {
+    if(member_active(fil, i))
+      results[i] = evfs_file_sync(fil->members[i]);
+  }
+
+  if(!fil->writable) // Nothing to fall behind on
+    return EVFS_OK;
+
+  return check_quorum(fil, results, EVFS_OK);
+}
+
+
+static int mirror__file_seek(EvfsFile *fh, evfs_off_t offset, EvfsSeekDir origin) {
+  MirrorFile *fil = (MirrorFile *)fh;
+
+  fil->pos = evfs__absolute_offset(fh, offset, origin);
+  fil->eof = false;
+
+  return EVFS_OK;
+}
+
+
+static evfs_off_t mirror__file_tell(EvfsFile *fh) {
+  MirrorFile *fil = (MirrorFile *)fh;
+
+  return fil->pos;
+}
+
+
+static bool mirror__file_eof(EvfsFile *fh) {
+  MirrorFile *fil = (MirrorFile *)fh;
+
+  return fil->eof;
+}
+
+
+static const EvfsFileMethods s_mirror_methods = {
+  .m_ctrl     = mirror__file_ctrl,
+  .m_close    = mirror__file_close,
+  .m_read     = mirror__file_read,
+  .m_write    = mirror__file_write,
+  .m_truncate = mirror__file_truncate,
+  .m_sync     = mirror__file_sync,
+  .m_size     = mirror__file_size,
+  .m_seek     = mirror__file_seek,
+  .m_tell     = mirror__file_tell,
+  .m_eof      = mirror__file_eof,
+  .m_read_at  = mirror__file_read_at,
+  .m_write_at = mirror__file_write_at
+};
+
+
+
+// ******************** Directory access methods ********************
+
+static int mirror__dir_close(EvfsDir *dh) {
+  MirrorDir *dir = (MirrorDir *)dh;
+
+  int status = dir->base_dir->methods->m_close(dir->base_dir);
+
+  if(status == EVFS_OK) {
+    dir->base.methods = NULL; // Disable this instance
+  }
+
+  return status;
+}
+
+
+static int mirror__dir_read(EvfsDir *dh, EvfsInfo *info) {
+  MirrorDir *dir = (MirrorDir *)dh;
+
+  return dir->base_dir->methods->m_read(dir->base_dir, info);
+}
+
+
+static int mirror__dir_rewind(EvfsDir *dh) {
+  MirrorDir *dir = (MirrorDir *)dh;
+
+  return dir->base_dir->methods->m_rewind(dir->base_dir);
+}
+
+
+static const EvfsDirMethods s_mirror_dir_methods = {
+  .m_close    = mirror__dir_close,
+  .m_read     = mirror__dir_read,
+  .m_rewind   = mirror__dir_rewind
+};
+
+
+
+// ******************** FS access methods ********************
+
+// Appends are handled by the shim. Members open for update so they aren't truncated.
+static inline int append_flags(int flags) {
+  if(flags & EVFS_APPEND)
+    flags = (flags & ~EVFS_APPEND) | EVFS_READ | EVFS_WRITE;
+
+  return flags;
+}
+
+
+static int mirror__open(Evfs *vfs, const char *path, EvfsFile *fh, int flags) {
+  MirrorFile *fil = (MirrorFile *)fh;
+  MirrorData *shim_data = (MirrorData *)vfs->fs_data;
+
+  memset(fil, 0, sizeof(*fil));
+  fil->shim_data = shim_data;
+  fil->writable = flags & (EVFS_WRITE | EVFS_APPEND);
+  fil->append = flags & EVFS_APPEND;
+
+  fil->path = evfs_malloc(strlen(path)+1);
+  if(MEM_CHECK(fil->path)) {
+    fh->methods = NULL;
+    return EVFS_ERR_ALLOC;
+  }
+  strcpy(fil->path, path);
+
+  // Stale copies are left alone until they are resynced
+  uint32_t stale = pin_resync(fil, path);
+
+  unsigned opened = 0;
+  int status = EVFS_OK;
+
+  for(unsigned i = 0; i < shim_data->num_members; i++) {
+    if(stale & MEMBER_BIT(i)) continue;
+
+    int rval = evfs_vfs_open(shim_data->members[i], path, &fil->members[i], append_flags(flags));
+    if(rval == EVFS_OK) {
+      opened++;
+    } else {
+      fil->members[i] = NULL;
+      fil->failed |= MEMBER_BIT(i);
+      if(status == EVFS_OK)
+        status = rval;
+    }
+  }
+
+  unsigned needed = fil->writable ? shim_data->write_quorum : 1;
+  if(opened < needed) { // Open failed
+    for(unsigned i = 0; i < shim_data->num_members; i++) {
+      if(fil->members[i])
+        evfs_file_close(fil->members[i]);
+    }
+
+    unpin_resync(fil);
+    evfs_free(fil->path);
+    fh->methods = NULL;
+    return status != EVFS_OK ? status : EVFS_ERR_IO;
+  }
+
+  // Add methods to make this functional
+  fh->methods = &s_mirror_methods;
+  return EVFS_OK;
+}
+
+
+static int mirror__stat(Evfs *vfs, const char *path, EvfsInfo *info) {
+  MirrorData *shim_data = (MirrorData *)vfs->fs_data;
+  uint32_t stale = stale_members(shim_data, path);
+  int status = EVFS_ERR_IO;
+
+  for(unsigned i = 0; i < shim_data->num_members; i++) {
+    if(stale & MEMBER_BIT(i)) continue;
+
+    Evfs *member = shim_data->members[i];
+    status = member->m_stat(member, path, info);
+    if(status == EVFS_OK || status == EVFS_ERR_NO_FILE || status == EVFS_ERR_NO_PATH)
+      break;
+  }
+
+  return status;
+}
+
+
+typedef int (*MemberOp)(Evfs *member, const char *path, const char *path2);
+
+// Apply a change to all members and queue resync of those that fail when others succeed
+static int change_members(MirrorData *shim_data, MemberOp op, const char *path, const char *path2) {
+  uint32_t failed = 0;
+  unsigned complete = 0;
+  int status = EVFS_OK;
+
+  for(unsigned i = 0; i < shim_data->num_members; i++) {
+    int rval = op(shim_data->members[i], path, path2);
+    if(rval == EVFS_OK) {
+      complete++;
+    } else {
+      failed |= MEMBER_BIT(i);
+      if(status == EVFS_OK)
+        status = rval;
+    }
+  }
+
+  if(complete > 0 && failed) {
+    add_resync(shim_data, path, failed);
+    if(path2)
+      add_resync(shim_data, path2, failed);
+  }
+
+  return complete >= shim_data->write_quorum ? EVFS_OK : status;
+}
+
+
+static int delete_op(Evfs *member, const char *path, const char *path2) {
+  return member->m_delete(member, path);
+}
+
+static int rename_op(Evfs *member, const char *path, const char *path2) {
+  return member->m_rename(member, path, path2);
+}
+
+static int make_dir_op(Evfs *member, const char *path, const char *path2) {
+  return member->m_make_dir(member, path);
+}
+
+
+static int mirror__delete(Evfs *vfs, const char *path) {
+  MirrorData *shim_data = (MirrorData *)vfs->fs_data;
+
+  return change_members(shim_data, delete_op, path, NULL);
+}
+
+
+static int mirror__rename(Evfs *vfs, const char *old_path, const char *new_path) {
+  MirrorData *shim_data = (MirrorData *)vfs->fs_data;
+
+  return change_members(shim_data, rename_op, old_path, new_path);
+}
+
+
+static int mirror__make_dir(Evfs *vfs, const char *path) {
+  MirrorData *shim_data = (MirrorData *)vfs->fs_data;
+
+  return change_members(shim_data, make_dir_op, path, NULL);
+}
+
+
+static int mirror__open_dir(Evfs *vfs, const char *path, EvfsDir *dh) {
+  MirrorDir *dir = (MirrorDir *)dh;
+  MirrorData *shim_data = (MirrorData *)vfs->fs_data;
+
+  dir->shim_data = shim_data;
+  dir->base_dir = (EvfsDir *)NEXT_OBJ(dir);   // We have two objects allocated together [MirrorDir][<largest member dir size>]
+
+  uint32_t stale = stale_members(shim_data, path);
+  int status = EVFS_ERR_IO;
+
+  for(unsigned i = 0; i < shim_data->num_members; i++) {
+    if(stale & MEMBER_BIT(i)) continue;
+
+    Evfs *member = shim_data->members[i];
+    status = member->m_open_dir(member, path, dir->base_dir);
+    if(status == EVFS_OK || status == EVFS_ERR_NO_PATH)
+      break;
+  }
+
+  if(status == EVFS_OK) {
+    // Construct a shimmed dir object
+    if(dir->base_dir->methods) {
+      dh->methods = &s_mirror_dir_methods;
+    } else {
+      dh->methods = NULL;
+      status = EVFS_ERR_INIT;
+    }
+
+  } else { // Open failed
+    dh->methods = NULL;
+  }
+
+  return status;
+}
+
+
+static int mirror__get_cur_dir(Evfs *vfs, StringRange *cur_dir) {
+  MirrorData *shim_data = (MirrorData *)vfs->fs_data;
+  Evfs *primary = shim_data->members[0];
+
+  return primary->m_get_cur_dir(primary, cur_dir);
+}
+
+
+static int mirror__set_cur_dir(Evfs *vfs, const char *path) {
+  MirrorData *shim_data = (MirrorData *)vfs->fs_data;
+
+  // Keep relative paths in step on every member
+  for(unsigned i = 0; i < shim_data->num_members; i++) {
+    Evfs *member = shim_data->members[i];
+
+    int status = member->m_set_cur_dir(member, path);
+    if(status != EVFS_OK) return status;
+  }
+
+  return EVFS_OK;
+}
+
+
+static int mirror__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
+  MirrorData *shim_data = (MirrorData *)vfs->fs_data;
+
+  switch(cmd) {
+    // We need special handling for EVFS_CMD_UNREGISTER.
+    // It can't pass through since we need to deallocate VFSs in the proper sequence
+    // to avoid corrupting the registered VFS linked list.
+    case EVFS_CMD_UNREGISTER:
+#ifdef EVFS_USE_THREADING
+      stop_maint_worker(shim_data);
+      evfs__cond_destroy(&shim_data->maint_wake);
+#endif
+      if(shim_data->queue)
+        evfs_async_free(shim_data->queue);
+
+      while(shim_data->resync) {
+        MirrorResync *entry = shim_data->resync;
+        shim_data->resync = entry->next;
+        evfs_free(entry);
+      }
+
+      evfs__lock_destroy(&shim_data->maint_lock);
+      evfs__lock_destroy(&shim_data->io_lock);
+      evfs__lock_destroy(&shim_data->lock);
+      evfs_free(vfs); // Free this mirror VFS
+      return EVFS_OK; break;
+
+    case EVFS_CMD_RUN_MAINTENANCE:
+      {
+        unsigned *v = (unsigned *)arg;
+        return run_resync(shim_data, *v);
+      }
+      break;
+
+#ifdef EVFS_USE_THREADING
+    case EVFS_CMD_SET_MAINT_INTERVAL:
+      {
+        unsigned *v = (unsigned *)arg;
+        return set_maint_interval(shim_data, *v);
+      }
+      break;
+#endif
+
+    default: // Everything else goes to every member. The first result is returned.
+      {
+        int status = EVFS_OK;
+        for(unsigned i = 0; i < shim_data->num_members; i++) {
+          Evfs *member = shim_data->members[i];
+          int rval = member->m_vfs_ctrl(member, cmd, arg);
+          if(i == 0)
+            status = rval;
+        }
+        return status;
+      }
+      break;
+  }
+}
+
+
+static bool mirror__path_root_component(Evfs *vfs, const char *path, StringRange *root) {
+  MirrorData *shim_data = (MirrorData *)vfs->fs_data;
+  Evfs *primary = shim_data->members[0];
+
+  return primary->m_path_root_component(primary, path, root);
+}
+
+
+/*
+Register a mirror filesystem shim
+
+Args:
+  vfs_name:         Name of new shim
+  member_vfs_names: Existing VFSs to keep copies on
+  num_members:      Number of member VFSs. Between 1 and EVFS_MIRROR_MAX_MEMBERS
+  cfg:              Quorum and parallel I/O settings. Use NULL for defaults
+  default_vfs:      Make this the default VFS when true
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_register_mirror(const char *vfs_name, const char **member_vfs_names, unsigned num_members,
+                         MirrorConfig *cfg, bool default_vfs) {
+  if(PTR_CHECK(vfs_name) || PTR_CHECK(member_vfs_names)) return EVFS_ERR_BAD_ARG;
+  if(num_members < 1 || num_members > EVFS_MIRROR_MAX_MEMBERS) return EVFS_ERR_BAD_ARG;
+
+  Evfs *shim_vfs;
+  MirrorData *shim_data;
+
+  unsigned write_quorum = (cfg && cfg->write_quorum) ? cfg->write_quorum : num_members;
+  if(write_quorum > num_members) return EVFS_ERR_BAD_ARG;
+
+  Evfs *members[EVFS_MIRROR_MAX_MEMBERS];
+  size_t max_dir_size = 0;
+  for(unsigned i = 0; i < num_members; i++) {
+    if(PTR_CHECK(member_vfs_names[i])) return EVFS_ERR_BAD_ARG;
+
+    members[i] = evfs_find_vfs(member_vfs_names[i]);
+    if(PTR_CHECK(members[i])) return EVFS_ERR_NO_VFS;
+
+    max_dir_size = MAX(max_dir_size, members[i]->vfs_dir_size);
+  }
+
+  // Construct a new VFS
+  // We have three objects allocated together [Evfs][MirrorData][char[]]
+  size_t shim_size = sizeof(*shim_vfs) + sizeof(*shim_data) + strlen(vfs_name)+1;
+  shim_vfs = evfs_malloc(shim_size);
+  if(MEM_CHECK(shim_vfs)) return EVFS_ERR_ALLOC;
+
+  memset(shim_vfs, 0, shim_size);
+
+  shim_data = (MirrorData *)NEXT_OBJ(shim_vfs);
+
+  shim_vfs->vfs_name = (char *)NEXT_OBJ(shim_data);
+  strcpy((char *)shim_vfs->vfs_name, vfs_name);
+
+  memcpy(shim_data->members, members, num_members * sizeof(*members));
+  shim_data->num_members  = num_members;
+  shim_data->write_quorum = write_quorum;
+  shim_data->vfs_name     = shim_vfs->vfs_name;
+  shim_data->shim_vfs     = shim_vfs;
+
+  // Member files are opened separately. Directories are read from any member.
+  shim_vfs->vfs_file_size = sizeof(MirrorFile);
+  shim_vfs->vfs_dir_size = sizeof(MirrorDir) + max_dir_size;
+  shim_vfs->fs_data = shim_data;
+
+  shim_vfs->m_open = mirror__open;
+  shim_vfs->m_stat = mirror__stat;
+  shim_vfs->m_delete = mirror__delete;
+  shim_vfs->m_rename = mirror__rename;
+  shim_vfs->m_make_dir = mirror__make_dir;
+  shim_vfs->m_open_dir = mirror__open_dir;
+  shim_vfs->m_get_cur_dir = mirror__get_cur_dir;
+  shim_vfs->m_set_cur_dir = mirror__set_cur_dir;
+  shim_vfs->m_vfs_ctrl = mirror__vfs_ctrl;
+
+  shim_vfs->m_path_root_component = mirror__path_root_component;
+
+  if(evfs__lock_init(&shim_data->lock) != EVFS_OK) {
+    evfs_free(shim_vfs);
+    THROW(EVFS_ERR_INIT);
+  }
+  evfs__lock_init(&shim_data->io_lock);
+  evfs__lock_init(&shim_data->maint_lock);
+
+#ifdef EVFS_USE_THREADING
+  evfs__cond_init(&shim_data->maint_wake);
+
+  // At most one write is in flight on each member
+  if(cfg && cfg->io_threads > 0 && num_members > 1) {
+    int status = evfs_async_new(num_members, cfg->io_threads, &shim_data->queue);
+    if(status != EVFS_OK) {
+      evfs__cond_destroy(&shim_data->maint_wake);
+      evfs__lock_destroy(&shim_data->maint_lock);
+      evfs__lock_destroy(&shim_data->io_lock);
+      evfs__lock_destroy(&shim_data->lock);
+      evfs_free(shim_vfs);
+      return status;
+    }
+  }
+#endif
+
+  return evfs_register(shim_vfs, default_vfs);
+}
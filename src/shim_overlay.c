@@ -0,0 +1,1018 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Overlay shim VFS
+
+  This merges two VFSs into one view. Paths are looked up in the upper VFS
+  first and then in the lower VFS. New files and directories are always made
+  on the upper VFS. A file that only exists on the lower VFS is copied up when
+  it is opened for writing. Directory listings show the entries of both layers
+  with upper entries hiding lower entries of the same name. The lower VFS is
+  never modified.
+
+  The layer holding each path that has been looked up is kept in a cache along
+  with negative entries for paths found in neither layer. Repeated lookups of
+  lower files skip the failing stat on the upper VFS and missing files are
+  reported without touching either VFS. The cache only sees changes made
+  through the overlay. Send EVFS_CMD_CLEAR_LOOKUP_CACHE after changing a layer
+  directly.
+------------------------------------------------------------------------------
+*/
+
+#include <string.h>
+
+#include "evfs.h"
+#include "evfs_internal.h"
+#include "evfs/util/dhash.h"
+#include "evfs/shim/shim_overlay.h"
+
+
+// Access objects allocated in a single block of memory
+#define NEXT_OBJ(o) (&(o)[1])
+
+// Keep base objects that follow each other aligned
+#define OBJ_ALIGN(n)  (((n) + 7) & ~(size_t)7)
+
+#define DEFAULT_CACHE_ENTRIES   128
+#define COPY_BUF_SIZE           256
+
+// Open modes that change the file
+#define MODIFY_FLAGS  (EVFS_WRITE | EVFS_OPEN_OR_NEW | EVFS_NO_EXIST | EVFS_OVERWRITE | EVFS_APPEND)
+
+#define IS_MISSING(status)  ((status) == EVFS_ERR_NO_FILE || (status) == EVFS_ERR_NO_PATH)
+
+
+typedef enum {
+  OVL_NONE = 0, // Path is in neither layer
+  OVL_UPPER,
+  OVL_LOWER
+} OverlayLayer;
+
+// Lookup cache value
+typedef struct OverlayEntry {
+  char   *path;   // Key data owned by this entry
+  uint8_t layer;
+} OverlayEntry;
+
+typedef struct OverlayData {
+  Evfs       *upper_vfs;
+  Evfs       *lower_vfs;
+  const char *vfs_name;
+  Evfs       *shim_vfs;
+
+  dhash       cache;
+  size_t      cache_entries;  // Cache is cleared when this fills
+  unsigned    cache_gen;      // Changes whenever the overlay modifies a layer
+  EvfsLock    cache_lock;
+
+  char        cur_dir[EVFS_MAX_PATH];   // Normalized CWD for the merged view
+} OverlayData;
+
+typedef struct OverlayFile {
+  EvfsFile     base;
+  OverlayData *shim_data;
+  EvfsFile    *base_file;
+} OverlayFile;
+
+typedef struct OverlayDir {
+  EvfsDir      base;
+  OverlayData *shim_data;
+  EvfsDir     *upper_dir;   // NULL when not open on the upper VFS
+  EvfsDir     *lower_dir;   // NULL when not open on the lower VFS
+  bool         read_lower;  // Upper entries have all been read
+
+  char         path[EVFS_MAX_PATH];  // Absolute path to the directory
+} OverlayDir;
+
+
+
+// ******************** Lookup cache ********************
+
+static void destroy_cache_entry(dhKey key, void *value, void *ctx) {
+  OverlayEntry *entry = (OverlayEntry *)value;
+  evfs_class_free(EVFS_ALLOC_INDEX, entry->path);
+}
+
+
+static bool cache_init(OverlayData *shim_data) {
+  dhConfig hash_cfg = {
+    .init_buckets = 16, // Grows as paths are looked up
+    .value_size   = sizeof(OverlayEntry),
+
+    .destroy_item = destroy_cache_entry,
+    .gen_hash     = dh_gen_hash_string,
+    .is_equal     = dh_equal_hash_keys_string
+  };
+
+  return dh_init(&shim_data->cache, &hash_cfg, NULL);
+}
+
+
+// Drop all entries. Lock must be held.
+static void cache_clear_locked(OverlayData *shim_data) {
+  dh_free(&shim_data->cache);
+  shim_data->cache_gen++;
+
+  // Without a hash every lookup misses and no entries are stored
+  if(!cache_init(shim_data))
+    shim_data->cache.buckets = NULL;
+}
+
+
+static void cache_clear(OverlayData *shim_data) {
+  evfs__lock(&shim_data->cache_lock);
+  cache_clear_locked(shim_data);
+  evfs__unlock(&shim_data->cache_lock);
+}
+
+
+// Cache key for a normalized absolute path
+static dhKey cache_key(OverlayData *shim_data, const char *abs_path) {
+  Evfs *vfs = shim_data->shim_vfs;
+
+  // Ignore a trailing separator so "/a/" and "/a" share an entry
+  StringRange root;
+  vfs->m_path_root_component(vfs, abs_path, &root);
+
+  size_t len = strlen(abs_path);
+  if(len > (size_t)range_size(&root) && abs_path[len-1] == EVFS_DIR_SEP)
+    len--;
+
+  return (dhKey){.data = abs_path, .length = len};
+}
+
+
+static bool cache_lookup(OverlayData *shim_data, dhKey key, OverlayLayer *layer, unsigned *gen) {
+  OverlayEntry *entry;
+  bool found = false;
+
+  evfs__lock(&shim_data->cache_lock);
+  if(shim_data->cache.buckets && dh_lookup_in_place(&shim_data->cache, key, (void **)&entry)) {
+    *layer = entry->layer;
+    found = true;
+  }
+  *gen = shim_data->cache_gen;
+  evfs__unlock(&shim_data->cache_lock);
+
+  return found;
+}
+
+
+// Set the layer for a path. Lock must be held.
+static void cache_store_locked(OverlayData *shim_data, dhKey key, OverlayLayer layer) {
+  if(!shim_data->cache.buckets)
+    return;
+
+  OverlayEntry *entry;
+  if(dh_lookup_in_place(&shim_data->cache, key, (void **)&entry)) {
+    entry->layer = layer;
+    return;
+  }
+
+  if(dh_num_items(&shim_data->cache) >= shim_data->cache_entries) {
+    unsigned gen = shim_data->cache_gen;
+    cache_clear_locked(shim_data);
+    shim_data->cache_gen = gen;
+    if(!shim_data->cache.buckets)
+      return;
+  }
+
+  OverlayEntry new_entry;
+  new_entry.path = evfs_class_malloc(EVFS_ALLOC_INDEX, key.length+1);
+  if(MEM_CHECK(new_entry.path)) return; // Entry is just not cached
+
+  memcpy(new_entry.path, key.data, key.length);
+  new_entry.path[key.length] = '\0';
+  new_entry.layer = layer;
+
+  key.data = new_entry.path;
+  if(!dh_insert(&shim_data->cache, key, &new_entry))
+    evfs_class_free(EVFS_ALLOC_INDEX, new_entry.path);
+}
+
+
+// Save the result of a lookup unless the overlay changed a layer while it was in progress
+static void cache_store(OverlayData *shim_data, dhKey key, OverlayLayer layer, unsigned gen) {
+  evfs__lock(&shim_data->cache_lock);
+  if(gen == shim_data->cache_gen)
+    cache_store_locked(shim_data, key, layer);
+  evfs__unlock(&shim_data->cache_lock);
+}
+
+
+// Record a path the overlay created on the upper layer
+static void cache_set_upper(OverlayData *shim_data, dhKey key) {
+  evfs__lock(&shim_data->cache_lock);
+  shim_data->cache_gen++;
+  cache_store_locked(shim_data, key, OVL_UPPER);
+  evfs__unlock(&shim_data->cache_lock);
+}
+
+
+// Forget a path so the next lookup checks both layers
+static void cache_drop(OverlayData *shim_data, dhKey key) {
+  OverlayEntry entry;
+
+  evfs__lock(&shim_data->cache_lock);
+  shim_data->cache_gen++;
+  if(shim_data->cache.buckets && dh_remove(&shim_data->cache, key, &entry))
+    evfs_class_free(EVFS_ALLOC_INDEX, entry.path);
+  evfs__unlock(&shim_data->cache_lock);
+}
+
+
+/*
+Find the layer holding a path
+
+Cached entries are returned without checking the layer when info is NULL.
+
+Args:
+  shim_data:  Overlay to search
+  abs_path:   Normalized absolute path
+  info:       Optional information on the path from its layer
+  layer:      Layer holding the path
+
+Returns:
+  EVFS_OK on success. EVFS_ERR_NO_FILE with layer set to OVL_NONE when the path
+  is in neither layer.
+*/
+static int ovl_lookup(OverlayData *shim_data, const char *abs_path, EvfsInfo *info,
+                      OverlayLayer *layer) {
+  Evfs *upper_vfs = shim_data->upper_vfs;
+  Evfs *lower_vfs = shim_data->lower_vfs;
+  dhKey key = cache_key(shim_data, abs_path);
+  unsigned gen;
+  int status;
+
+  if(cache_lookup(shim_data, key, layer, &gen)) {
+    if(*layer == OVL_NONE)
+      return EVFS_ERR_NO_FILE;
+
+    if(!info)
+      return EVFS_OK;
+
+    Evfs *layer_vfs = *layer == OVL_UPPER ? upper_vfs : lower_vfs;
+    status = layer_vfs->m_stat(layer_vfs, abs_path, info);
+    if(!IS_MISSING(status))
+      return status;
+
+    // Layer was changed outside of the overlay
+  }
+
+  EvfsInfo tmp_info;
+  if(!info)
+    info = &tmp_info;
+
+  status = upper_vfs->m_stat(upper_vfs, abs_path, info);
+  if(status == EVFS_OK) {
+    *layer = OVL_UPPER;
+
+  } else if(IS_MISSING(status)) {
+    status = lower_vfs->m_stat(lower_vfs, abs_path, info);
+    if(status == EVFS_OK) {
+      *layer = OVL_LOWER;
+    } else if(IS_MISSING(status)) {
+      *layer = OVL_NONE;
+      status = EVFS_ERR_NO_FILE;
+    } else {
+      return status;
+    }
+
+  } else {
+    return status;
+  }
+
+  cache_store(shim_data, key, *layer, gen);
+  return status;
+}
+
+
+// Make the parent directories of a path on the upper VFS
+static int ovl_make_parents(OverlayData *shim_data, const char *abs_path) {
+  Evfs *upper_vfs = shim_data->upper_vfs;
+  OverlayLayer layer;
+  EvfsInfo info;
+
+  dhKey key = cache_key(shim_data, abs_path);
+
+  char parent[EVFS_MAX_PATH];
+  if(key.length >= sizeof(parent))
+    return EVFS_ERR_TOO_LONG;
+
+  memcpy(parent, abs_path, key.length);
+  parent[key.length] = '\0';
+
+  StringRange root;
+  upper_vfs->m_path_root_component(upper_vfs, parent, &root);
+  char *parent_start = (char *)root.end;
+
+  // Usually the immediate parent is already on the upper VFS
+  char *tail = strrchr(parent_start, EVFS_DIR_SEP);
+  if(!tail)
+    return EVFS_OK; // Parent is the root
+
+  *tail = '\0';
+  int status = ovl_lookup(shim_data, parent, NULL, &layer);
+  *tail = EVFS_DIR_SEP;
+  if(status == EVFS_OK && layer == OVL_UPPER)
+    return EVFS_OK;
+
+  // Copy up each directory that is only on the lower VFS
+  char *sep = parent_start;
+  while((sep = strchr(sep, EVFS_DIR_SEP)) != NULL) {
+    *sep = '\0';
+
+    status = ovl_lookup(shim_data, parent, &info, &layer);
+    if(status == EVFS_OK && layer == OVL_LOWER) {
+      if(!(info.type & EVFS_FILE_DIR))
+        return EVFS_ERR_NO_PATH;
+
+      status = upper_vfs->m_make_dir(upper_vfs, parent);
+      if(status != EVFS_OK)
+        return status;
+
+      cache_set_upper(shim_data, cache_key(shim_data, parent));
+
+    } else if(status != EVFS_OK) {
+      return status == EVFS_ERR_NO_FILE ? EVFS_ERR_NO_PATH : status;
+    }
+
+    *sep++ = EVFS_DIR_SEP;
+  }
+
+  return EVFS_OK;
+}
+
+
+/*
+Copy a file from the lower VFS to the upper VFS
+
+Args:
+  shim_data:  Overlay to copy on
+  abs_path:   Normalized absolute path to the file
+  size:       Size of the file
+  src:        Object for the lower file
+  dest:       Object for the upper file
+
+Returns:
+  EVFS_OK on success
+*/
+static int ovl_copy_up(OverlayData *shim_data, const char *abs_path, evfs_off_t size,
+                       EvfsFile *src, EvfsFile *dest) {
+  Evfs *upper_vfs = shim_data->upper_vfs;
+  Evfs *lower_vfs = shim_data->lower_vfs;
+
+  int status = ovl_make_parents(shim_data, abs_path);
+  if(status != EVFS_OK)
+    return status;
+
+  status = lower_vfs->m_open(lower_vfs, abs_path, src, EVFS_READ);
+  if(status != EVFS_OK)
+    return status;
+
+  status = upper_vfs->m_open(upper_vfs, abs_path, dest, EVFS_WRITE | EVFS_OVERWRITE);
+  if(status == EVFS_OK) {
+    status = upper_vfs->m_copy(upper_vfs, dest, src, size);
+
+    if(status == EVFS_ERR_NO_SUPPORT) { // Generic copy
+      char buf[COPY_BUF_SIZE];
+      ptrdiff_t read;
+
+      status = EVFS_OK;
+      while((read = src->methods->m_read(src, buf, sizeof(buf))) > 0) {
+        if(dest->methods->m_write(dest, buf, read) != read) {
+          status = EVFS_ERR_IO;
+          break;
+        }
+      }
+
+      if(read < 0)
+        status = read;
+    }
+
+    int close_status = dest->methods->m_close(dest);
+    if(status == EVFS_OK)
+      status = close_status;
+
+    if(status == EVFS_OK)
+      cache_set_upper(shim_data, cache_key(shim_data, abs_path));
+    else  // Don't leave a partial copy hiding the lower file
+      upper_vfs->m_delete(upper_vfs, abs_path);
+  }
+
+  src->methods->m_close(src);
+
+  return status;
+}
+
+
+
+// ******************** File access methods ********************
+
+static int overlay__file_ctrl(EvfsFile *fh, int cmd, void *arg) {
+  OverlayFile *fil = (OverlayFile *)fh;
+
+  return fil->base_file->methods->m_ctrl(fil->base_file, cmd, arg);
+}
+
+
+static int overlay__file_close(EvfsFile *fh) {
+  OverlayFile *fil = (OverlayFile *)fh;
+
+  int status = fil->base_file->methods->m_close(fil->base_file);
+
+  if(status == EVFS_OK) {
+    fil->base.methods = NULL;
+  }
+
+  return status;
+}
+
+
+static ptrdiff_t overlay__file_read(EvfsFile *fh, void *buf, size_t size) {
+  OverlayFile *fil = (OverlayFile *)fh;
+
+  return fil->base_file->methods->m_read(fil->base_file, buf, size);
+}
+
+
+static ptrdiff_t overlay__file_write(EvfsFile *fh, const void *buf, size_t size) {
+  OverlayFile *fil = (OverlayFile *)fh;
+
+  return fil->base_file->methods->m_write(fil->base_file, buf, size);
+}
+
+
+static int overlay__file_truncate(EvfsFile *fh, evfs_off_t size) {
+  OverlayFile *fil = (OverlayFile *)fh;
+
+  return fil->base_file->methods->m_truncate(fil->base_file, size);
+}
+
+
+static int overlay__file_sync(EvfsFile *fh) {
+  OverlayFile *fil = (OverlayFile *)fh;
+
+  return fil->base_file->methods->m_sync(fil->base_file);
+}
+
+
+static evfs_off_t overlay__file_size(EvfsFile *fh) {
+  OverlayFile *fil = (OverlayFile *)fh;
+
+  return fil->base_file->methods->m_size(fil->base_file);
+}
+
+
+static int overlay__file_seek(EvfsFile *fh, evfs_off_t offset, EvfsSeekDir origin) {
+  OverlayFile *fil = (OverlayFile *)fh;
+
+  return fil->base_file->methods->m_seek(fil->base_file, offset, origin);
+}
+
+
+static evfs_off_t overlay__file_tell(EvfsFile *fh) {
+  OverlayFile *fil = (OverlayFile *)fh;
+
+  return fil->base_file->methods->m_tell(fil->base_file);
+}
+
+
+static bool overlay__file_eof(EvfsFile *fh) {
+  OverlayFile *fil = (OverlayFile *)fh;
+
+  return fil->base_file->methods->m_eof(fil->base_file);
+}
+
+
+static ptrdiff_t overlay__file_read_at(EvfsFile *fh, void *buf, size_t size, evfs_off_t offset) {
+  OverlayFile *fil = (OverlayFile *)fh;
+
+  return evfs_file_read_at(fil->base_file, buf, size, offset);
+}
+
+
+static ptrdiff_t overlay__file_write_at(EvfsFile *fh, const void *buf, size_t size, evfs_off_t offset) {
+  OverlayFile *fil = (OverlayFile *)fh;
+
+  return evfs_file_write_at(fil->base_file, buf, size, offset);
+}
+
+
+static ptrdiff_t overlay__file_readv(EvfsFile *fh, const EvfsIOVec *iov, int iovcnt) {
+  OverlayFile *fil = (OverlayFile *)fh;
+
+  return evfs_file_readv(fil->base_file, iov, iovcnt);
+}
+
+
+static ptrdiff_t overlay__file_writev(EvfsFile *fh, const EvfsIOVec *iov, int iovcnt) {
+  OverlayFile *fil = (OverlayFile *)fh;
+
+  return evfs_file_writev(fil->base_file, iov, iovcnt);
+}
+
+
+static int overlay__file_map(EvfsFile *fh, evfs_off_t offset, size_t size, EvfsMapping *map) {
+  OverlayFile *fil = (OverlayFile *)fh;
+
+  return evfs_file_map(fil->base_file, offset, size, map);
+}
+
+
+static int overlay__file_unmap(EvfsFile *fh, EvfsMapping *map) {
+  OverlayFile *fil = (OverlayFile *)fh;
+
+  return evfs_file_unmap(fil->base_file, map);
+}
+
+
+static int overlay__file_discard(EvfsFile *fh, evfs_off_t offset, evfs_off_t size) {
+  OverlayFile *fil = (OverlayFile *)fh;
+
+  return evfs_file_discard(fil->base_file, offset, size);
+}
+
+
+static const EvfsFileMethods s_overlay_methods = {
+  .m_ctrl     = overlay__file_ctrl,
+  .m_close    = overlay__file_close,
+  .m_read     = overlay__file_read,
+  .m_write    = overlay__file_write,
+  .m_truncate = overlay__file_truncate,
+  .m_sync     = overlay__file_sync,
+  .m_size     = overlay__file_size,
+  .m_seek     = overlay__file_seek,
+  .m_tell     = overlay__file_tell,
+  .m_eof      = overlay__file_eof,
+  .m_read_at  = overlay__file_read_at,
+  .m_write_at = overlay__file_write_at,
+  .m_readv    = overlay__file_readv,
+  .m_writev   = overlay__file_writev,
+  .m_map      = overlay__file_map,
+  .m_unmap    = overlay__file_unmap,
+  .m_discard  = overlay__file_discard
+};
+
+// ******************** Directory access methods ********************
+
+static int overlay__dir_close(EvfsDir *dh) {
+  OverlayDir *dir = (OverlayDir *)dh;
+  int status = EVFS_OK;
+
+  if(dir->upper_dir)
+    status = dir->upper_dir->methods->m_close(dir->upper_dir);
+
+  if(dir->lower_dir) {
+    int lower_status = dir->lower_dir->methods->m_close(dir->lower_dir);
+    if(status == EVFS_OK)
+      status = lower_status;
+  }
+
+  if(status == EVFS_OK) {
+    dir->base.methods = NULL;
+  }
+
+  return status;
+}
+
+
+static bool is_dot_entry(const char *name) {
+  return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+
+// Check if a lower entry is hidden by an upper entry with the same name
+static bool hidden_by_upper(OverlayDir *dir, const char *name) {
+  if(is_dot_entry(name)) // Already listed from the upper VFS
+    return true;
+
+  char path[EVFS_MAX_PATH];
+  AppendRange path_r = RANGE_FROM_ARRAY(path);
+
+  range_cat_str(&path_r, dir->path);
+  if(path_r.start > path && path_r.start[-1] != EVFS_DIR_SEP)
+    range_cat_char(&path_r, EVFS_DIR_SEP);
+  if(range_cat_str(&path_r, name) < 0)
+    return false;
+
+  OverlayLayer layer;
+  int status = ovl_lookup(dir->shim_data, path, NULL, &layer);
+  return status == EVFS_OK && layer == OVL_UPPER;
+}
+
+
+static int overlay__dir_read(EvfsDir *dh, EvfsInfo *info) {
+  OverlayDir *dir = (OverlayDir *)dh;
+  int status;
+
+  if(!dir->read_lower) {
+    status = dir->upper_dir->methods->m_read(dir->upper_dir, info);
+    if(status != EVFS_DONE || !dir->lower_dir)
+      return status;
+
+    dir->read_lower = true;
+  }
+
+  while((status = dir->lower_dir->methods->m_read(dir->lower_dir, info)) == EVFS_OK) {
+    if(!dir->upper_dir || !info->name || !hidden_by_upper(dir, info->name))
+      break;
+  }
+
+  return status;
+}
+
+
+static int overlay__dir_rewind(EvfsDir *dh) {
+  OverlayDir *dir = (OverlayDir *)dh;
+  int status = EVFS_OK;
+
+  if(dir->upper_dir)
+    status = dir->upper_dir->methods->m_rewind(dir->upper_dir);
+
+  if(dir->lower_dir && status == EVFS_OK)
+    status = dir->lower_dir->methods->m_rewind(dir->lower_dir);
+
+  dir->read_lower = !dir->upper_dir;
+
+  return status;
+}
+
+
+static const EvfsDirMethods s_overlay_dir_methods = {
+  .m_close    = overlay__dir_close,
+  .m_read     = overlay__dir_read,
+  .m_rewind   = overlay__dir_rewind
+};
+
+// ******************** FS access methods ********************
+
+
+static int overlay__open(Evfs *vfs, const char *path, EvfsFile *fh, int flags) {
+  OverlayFile *fil = (OverlayFile *)fh;
+  OverlayData *shim_data = (OverlayData *)vfs->fs_data;
+  Evfs *upper_vfs = shim_data->upper_vfs;
+  Evfs *lower_vfs = shim_data->lower_vfs;
+
+  fh->methods = NULL;
+  fil->shim_data = shim_data;
+
+  // We have three objects allocated together [OverlayFile][<upper VFS file>][<lower VFS file>]
+  EvfsFile *upper_file = (EvfsFile *)NEXT_OBJ(fil);
+  EvfsFile *lower_file = (EvfsFile *)((uint8_t *)upper_file + OBJ_ALIGN(upper_vfs->vfs_file_size));
+
+  MAKE_ABS(path, abs_path);
+
+  OverlayLayer layer;
+  EvfsInfo info;
+  bool modify = flags & MODIFY_FLAGS;
+
+  int status = ovl_lookup(shim_data, abs_path, modify ? &info : NULL, &layer);
+
+  if(!modify) {
+    if(status == EVFS_OK) {
+      Evfs *layer_vfs = layer == OVL_UPPER ? upper_vfs : lower_vfs;
+      fil->base_file = layer == OVL_UPPER ? upper_file : lower_file;
+
+      status = layer_vfs->m_open(layer_vfs, abs_path, fil->base_file, flags);
+      if(IS_MISSING(status)) // Layer was changed outside of the overlay
+        cache_drop(shim_data, cache_key(shim_data, abs_path));
+    }
+
+  } else if(status == EVFS_OK || status == EVFS_ERR_NO_FILE) {
+    fil->base_file = upper_file;
+
+    if(layer == OVL_LOWER) {
+      if(flags & EVFS_NO_EXIST)
+        status = EVFS_ERR_EXISTS;
+      else if(info.type & EVFS_FILE_DIR)
+        status = EVFS_ERR_IS_DIR;
+      else if(flags & EVFS_OVERWRITE) // Old contents aren't needed
+        status = ovl_make_parents(shim_data, abs_path);
+      else
+        status = ovl_copy_up(shim_data, abs_path, info.size, lower_file, upper_file);
+
+    } else if(layer == OVL_NONE) {
+      status = ovl_make_parents(shim_data, abs_path);
+    }
+
+    if(status == EVFS_OK) {
+      status = upper_vfs->m_open(upper_vfs, abs_path, upper_file, flags);
+      if(status == EVFS_OK && layer != OVL_UPPER)
+        cache_set_upper(shim_data, cache_key(shim_data, abs_path));
+    }
+  }
+
+  FREE_ABS(abs_path);
+
+  if(status == EVFS_OK) {
+    // Add methods to make this functional
+    if(fil->base_file->methods) {
+      fh->methods = &s_overlay_methods;
+    } else {
+      status = EVFS_ERR_INIT;
+    }
+  }
+
+  return status;
+}
+
+
+
+static int overlay__stat(Evfs *vfs, const char *path, EvfsInfo *info) {
+  OverlayData *shim_data = (OverlayData *)vfs->fs_data;
+  OverlayLayer layer;
+
+  MAKE_ABS(path, abs_path);
+
+  int status = ovl_lookup(shim_data, abs_path, info, &layer);
+
+  FREE_ABS(abs_path);
+  return status;
+}
+
+
+
+static int overlay__delete(Evfs *vfs, const char *path) {
+  OverlayData *shim_data = (OverlayData *)vfs->fs_data;
+  Evfs *upper_vfs = shim_data->upper_vfs;
+  OverlayLayer layer;
+
+  MAKE_ABS(path, abs_path);
+
+  int status = ovl_lookup(shim_data, abs_path, NULL, &layer);
+  if(status == EVFS_OK) {
+    if(layer == OVL_LOWER) {
+      status = EVFS_ERR_DISABLED; // Lower VFS is never modified
+    } else {
+      // A lower entry with the same path becomes visible again
+      status = upper_vfs->m_delete(upper_vfs, abs_path);
+      cache_drop(shim_data, cache_key(shim_data, abs_path));
+    }
+  }
+
+  FREE_ABS(abs_path);
+  return status;
+}
+
+
+static int overlay__rename(Evfs *vfs, const char *old_path, const char *new_path) {
+  OverlayData *shim_data = (OverlayData *)vfs->fs_data;
+  Evfs *upper_vfs = shim_data->upper_vfs;
+  OverlayLayer layer;
+
+  MAKE_ABS(old_path, abs_old_path);
+
+  EvfsAbsPath abs_new_path;
+  int status = evfs__path_resolve(vfs, new_path, &abs_new_path);
+  if(status != EVFS_OK) {
+    FREE_ABS(abs_old_path);
+    return status;
+  }
+
+  status = ovl_lookup(shim_data, abs_old_path, NULL, &layer);
+  if(status == EVFS_OK) {
+    if(layer == OVL_LOWER) {
+      status = EVFS_ERR_DISABLED;
+    } else {
+      status = ovl_make_parents(shim_data, abs_new_path.path);
+      if(status == EVFS_OK)
+        status = upper_vfs->m_rename(upper_vfs, abs_old_path, abs_new_path.path);
+
+      // Every cached path below a renamed directory is stale
+      cache_clear(shim_data);
+    }
+  }
+
+  evfs__path_release(&abs_new_path);
+  FREE_ABS(abs_old_path);
+  return status;
+}
+
+
+static int overlay__make_dir(Evfs *vfs, const char *path) {
+  OverlayData *shim_data = (OverlayData *)vfs->fs_data;
+  Evfs *upper_vfs = shim_data->upper_vfs;
+  OverlayLayer layer;
+
+  MAKE_ABS(path, abs_path);
+
+  int status = ovl_lookup(shim_data, abs_path, NULL, &layer);
+  if(status == EVFS_OK) {
+    status = EVFS_ERR_EXISTS;
+
+  } else if(status == EVFS_ERR_NO_FILE) {
+    status = ovl_make_parents(shim_data, abs_path);
+    if(status == EVFS_OK)
+      status = upper_vfs->m_make_dir(upper_vfs, abs_path);
+    if(status == EVFS_OK)
+      cache_set_upper(shim_data, cache_key(shim_data, abs_path));
+  }
+
+  FREE_ABS(abs_path);
+  return status;
+}
+
+
+static int overlay__open_dir(Evfs *vfs, const char *path, EvfsDir *dh) {
+  OverlayDir *dir = (OverlayDir *)dh;
+  OverlayData *shim_data = (OverlayData *)vfs->fs_data;
+  Evfs *upper_vfs = shim_data->upper_vfs;
+  Evfs *lower_vfs = shim_data->lower_vfs;
+
+  dh->methods = NULL;
+  dir->shim_data = shim_data;
+  dir->upper_dir = NULL;
+  dir->lower_dir = NULL;
+
+  MAKE_ABS(path, abs_path);
+
+  int status = EVFS_OK;
+  if(strlen(abs_path) >= sizeof(dir->path))
+    status = EVFS_ERR_TOO_LONG;
+
+  if(status == EVFS_OK) {
+    strcpy(dir->path, abs_path);
+
+    // We have three objects allocated together [OverlayDir][<upper VFS dir>][<lower VFS dir>]
+    EvfsDir *upper_dir = (EvfsDir *)NEXT_OBJ(dir);
+    EvfsDir *lower_dir = (EvfsDir *)((uint8_t *)upper_dir + OBJ_ALIGN(upper_vfs->vfs_dir_size));
+
+    // The directory can be on either or both layers
+    status = upper_vfs->m_open_dir(upper_vfs, abs_path, upper_dir);
+    if(status == EVFS_OK && upper_dir->methods)
+      dir->upper_dir = upper_dir;
+
+    int lower_status = lower_vfs->m_open_dir(lower_vfs, abs_path, lower_dir);
+    if(lower_status == EVFS_OK && lower_dir->methods)
+      dir->lower_dir = lower_dir;
+
+    if(dir->upper_dir || dir->lower_dir)
+      status = EVFS_OK;
+    else if(IS_MISSING(status) || status == EVFS_OK)
+      status = lower_status == EVFS_OK ? EVFS_ERR_INIT : lower_status;
+  }
+
+  FREE_ABS(abs_path);
+
+  if(status == EVFS_OK) {
+    dir->read_lower = !dir->upper_dir;
+    dh->methods = &s_overlay_dir_methods;
+  }
+
+  return status;
+}
+
+
+// Track the current directory in fs_data
+static int overlay__get_cur_dir(Evfs *vfs, StringRange *cur_dir) {
+  OverlayData *shim_data = (OverlayData *)vfs->fs_data;
+  AppendRange r = *(AppendRange *)cur_dir;
+
+  range_cat_str(&r, shim_data->cur_dir);
+  range_terminate(&r);
+  return EVFS_OK;
+}
+
+
+static int overlay__set_cur_dir(Evfs *vfs, const char *path) {
+  OverlayData *shim_data = (OverlayData *)vfs->fs_data;
+
+  MAKE_ABS(path, abs_path);
+
+  // Confirm the path exists
+  int status = EVFS_OK;
+  if(evfs__vfs_existing_dir(vfs, abs_path)) {
+    strncpy(shim_data->cur_dir, abs_path, EVFS_MAX_PATH-1);
+    shim_data->cur_dir[EVFS_MAX_PATH-1] = '\0';
+  } else {
+    status = EVFS_ERR_NO_PATH;
+  }
+
+  FREE_ABS(abs_path);
+  return status;
+}
+
+
+static int overlay__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
+  OverlayData *shim_data = (OverlayData *)vfs->fs_data;
+  Evfs *upper_vfs = shim_data->upper_vfs;
+
+  switch(cmd) {
+    // We need special handling for EVFS_CMD_UNREGISTER.
+    // It can't pass through since we need to deallocate VFSs in the proper sequence
+    // to avoid corrupting the registered VFS linked list.
+    case EVFS_CMD_UNREGISTER:
+      dh_free(&shim_data->cache);
+      evfs__lock_destroy(&shim_data->cache_lock);
+      evfs_free(vfs); // Free this overlay VFS
+      return EVFS_OK; break;
+
+    case EVFS_CMD_CLEAR_LOOKUP_CACHE:
+      cache_clear(shim_data);
+      return EVFS_OK; break;
+
+    default: // Everything else passes to the upper VFS
+      return upper_vfs->m_vfs_ctrl(upper_vfs, cmd, arg);
+      break;
+  }
+}
+
+
+static bool overlay__path_root_component(Evfs *vfs, const char *path, StringRange *root) {
+  OverlayData *shim_data = (OverlayData *)vfs->fs_data;
+  Evfs *upper_vfs = shim_data->upper_vfs;
+
+  return upper_vfs->m_path_root_component(upper_vfs, path, root);
+}
+
+
+/*
+Register an overlay filesystem shim
+
+Args:
+  vfs_name:       Name of new shim
+  upper_vfs_name: Existing VFS that receives all changes
+  lower_vfs_name: Existing VFS that is only read
+  cache_entries:  Paths to keep in the lookup cache. Use 0 for a default size
+  default_vfs:    Make this the default VFS when true
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_register_overlay(const char *vfs_name, const char *upper_vfs_name, const char *lower_vfs_name,
+                          size_t cache_entries, bool default_vfs) {
+  if(PTR_CHECK(vfs_name) || PTR_CHECK(upper_vfs_name) || PTR_CHECK(lower_vfs_name))
+    return EVFS_ERR_BAD_ARG;
+
+  Evfs *upper_vfs, *lower_vfs, *shim_vfs;
+  OverlayData *shim_data;
+
+  upper_vfs = evfs_find_vfs(upper_vfs_name);
+  if(PTR_CHECK(upper_vfs)) return EVFS_ERR_NO_VFS;
+
+  lower_vfs = evfs_find_vfs(lower_vfs_name);
+  if(PTR_CHECK(lower_vfs)) return EVFS_ERR_NO_VFS;
+
+  if(cache_entries == 0)
+    cache_entries = DEFAULT_CACHE_ENTRIES;
+
+  // Construct a new VFS
+  // We have three objects allocated together [Evfs][OverlayData][char[]]
+  size_t shim_size = sizeof(*shim_vfs) + sizeof(*shim_data) + strlen(vfs_name)+1;
+  shim_vfs = evfs_malloc(shim_size);
+  if(MEM_CHECK(shim_vfs)) return EVFS_ERR_ALLOC;
+
+  memset(shim_vfs, 0, shim_size);
+
+  shim_data = (OverlayData *)NEXT_OBJ(shim_vfs);
+
+  shim_vfs->vfs_name = (char *)NEXT_OBJ(shim_data);
+  strcpy((char *)shim_vfs->vfs_name, vfs_name);
+
+  shim_data->upper_vfs = upper_vfs;
+  shim_data->lower_vfs = lower_vfs;
+  shim_data->vfs_name = shim_vfs->vfs_name;
+  shim_data->shim_vfs = shim_vfs;
+  shim_data->cache_entries = cache_entries;
+  strncpy(shim_data->cur_dir, "/", 2); // Start in root dir
+
+  if(!cache_init(shim_data)) {
+    evfs_free(shim_vfs);
+    return EVFS_ERR_ALLOC;
+  }
+
+  if(evfs__lock_init(&shim_data->cache_lock) != EVFS_OK) {
+    dh_free(&shim_data->cache);
+    evfs_free(shim_vfs);
+    return EVFS_ERR_INIT;
+  }
+
+  shim_vfs->vfs_file_size = sizeof(OverlayFile) + OBJ_ALIGN(upper_vfs->vfs_file_size) +
+                            lower_vfs->vfs_file_size;
+  shim_vfs->vfs_dir_size = sizeof(OverlayDir) + OBJ_ALIGN(upper_vfs->vfs_dir_size) +
+                           lower_vfs->vfs_dir_size;
+  shim_vfs->fs_data = shim_data;
+
+  shim_vfs->m_open = overlay__open;
+  shim_vfs->m_stat = overlay__stat;
+  shim_vfs->m_delete = overlay__delete;
+  shim_vfs->m_rename = overlay__rename;
+  shim_vfs->m_make_dir = overlay__make_dir;
+  shim_vfs->m_open_dir = overlay__open_dir;
+  shim_vfs->m_get_cur_dir = overlay__get_cur_dir;
+  shim_vfs->m_set_cur_dir = overlay__set_cur_dir;
+  shim_vfs->m_vfs_ctrl = overlay__vfs_ctrl;
+
+  shim_vfs->m_path_root_component = overlay__path_root_component;
+
+  return evfs_register(shim_vfs, default_vfs);
+}
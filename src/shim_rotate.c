@@ -31,9 +31,21 @@ excessive filesystem activity.
 When the container is accessed through this shim it will appear as a single
 continuous file of data. You can perform all normal file operations on an
 open file handle. Understand that as rotation happens the offsets of the
-file contents will change. You should not access a container simultaneously
-through multiple file handles as they will not be synchronized. Use append
-mode writes to add data to the end of the file.
+file contents will change. Use append mode writes to add data to the end of
+the file.
+
+A container can be open through multiple handles with one writer and any
+number of readers. Handles opened with the same path share the container
+state. Readers see data as soon as it's written and their positions move
+back when chunks are evicted from the start of the file. A reader can set a
+callback with EVFS_CMD_SET_ROTATE_NOTIFY to learn when the writer has
+changed the container rather than polling its size.
+
+The sync policy in RotateConfig bounds data loss without syncing every write.
+Containers can be synced after a number of bytes are written, when a chunk is
+filled, or periodically by a background thread in threaded builds. Syncs are
+only issued when the writer has unsynced data so requests from multiple
+handles collapse into a single sync of the base file.
 
 The chunking algorithm is designed to work on systems that don't record
 timestamps. When a container is opened the chunks are scanned to find the
@@ -44,7 +56,9 @@ happens.
 
 The rotation process only involves deleting the oldest chunk at the start of
 the file. This minimizes the amount of filesystem activity on flash based
-filesystems.
+filesystems. With the recycle_chunks option the oldest chunk is instead renamed
+into the next slot of the sequence and truncated in place. This replaces a
+delete and create with a single rename in the steady state.
 
 Rotation will leave portions of data spanning the chunk boundary at the new
 start of the file. For text files the first line will be missing an initial
@@ -83,12 +97,15 @@ EVFS_CMD_SET_ROTATE_CFG as the operation evfs_vfs_ctrl().
 
 
 #define MULTIPART_GEOMETRY_FILE  "geom.dat"
+#define MULTIPART_CURSOR_FILE    "cursor.dat"
 
 #define EVFS_MULTI_MAGIC         0x53465645
 #define EVFS_MULTI_ROTATE_TYPE   0x01
 
 #define CUR_MULTI_ROTATE_VERSION 1
 
+#define EVFS_ROTATE_CURSOR_MAGIC 0x52535645
+
 // If you need more chunks this is probably not a good fit for your storage needs
 #define MULTIPART_MAX_CHUNK       99999
 
@@ -135,13 +152,34 @@ PACKED_END
 
 typedef struct RotateGeometry RotateGeometry;
 
+// Chunk sequence written to cursor.dat
+PACKED_BEGIN
+struct RotateCursor {
+  uint32_t      magic;
+  uint32_t      start_chunk;
+  uint32_t      end_chunk;
+  uint8_t       start_gen;
+  uint8_t       end_gen;
+  uint16_t      reserved;
+  uint32_t      check;        // Complement of the other fields XORed together
+};
+PACKED_END
+
+typedef struct RotateCursor RotateCursor;
+
 
 
 // ******************** Shim structs ********************
 
 // Shared buffer needs lock if threading is enabled
-#if defined EVFS_USE_ROTATE_SHARED_BUFFER && defined EVFS_USE_THREADING
-#  define USE_ROT_LOCK
+// Threaded builds can replace it with per-thread scratch buffers
+#if defined EVFS_USE_ROTATE_SHARED_BUFFER && defined EVFS_USE_SCRATCH_PATHS
+#  define USE_ROT_SCRATCH
+#elif defined EVFS_USE_ROTATE_SHARED_BUFFER
+#  define USE_ROT_SHARED_BUFFER
+#  ifdef EVFS_USE_THREADING
+#    define USE_ROT_LOCK
+#  endif
 #endif
 
 
@@ -153,9 +191,30 @@ typedef struct RotateGeometry RotateGeometry;
 #  define UNLOCK(sb)
 #endif
 
+#ifdef USE_ROT_SCRATCH
+#  define FREE_TMP(sb, joined)  evfs__scratch_path_put(joined)
+#else
+#  define FREE_TMP(sb, joined)  UNLOCK(sb)
+#endif
+
+// Handles on the same container share its state. The open list lock is taken
+// before a state lock when both are needed.
+#ifdef EVFS_USE_THREADING
+#  define STATE_LOCK(rs)      evfs__lock(&(rs)->state_lock)
+#  define STATE_UNLOCK(rs)    evfs__unlock(&(rs)->state_lock)
+#  define OPEN_LOCK(sd)       evfs__lock(&(sd)->open_lock)
+#  define OPEN_UNLOCK(sd)     evfs__unlock(&(sd)->open_lock)
+#else
+#  define STATE_LOCK(rs)      ((void)(rs))
+#  define STATE_UNLOCK(rs)    ((void)(rs))
+#  define OPEN_LOCK(sd)       ((void)(sd))
+#  define OPEN_UNLOCK(sd)     ((void)(sd))
+#endif
+
 
 typedef struct SharedBuffer {
   char        tmp_path[EVFS_MAX_PATH]; // Shared buffer for building temp paths
+  char        new_path[EVFS_MAX_PATH]; // Rename target when recycling chunks
 #ifdef USE_ROT_LOCK
   EvfsLock     buf_lock; // Serialize access to shared tmp_path buffer
 #endif
@@ -168,18 +227,25 @@ typedef struct {
 
 typedef struct MultipartState {
   const char *container_path;
-  int         flags;
   evfs_off_t  chunk_size;
   evfs_off_t  total_size;
-  evfs_off_t  file_pos;     // Logical position for reads and writes in non-append mode
-  ChunkId     active_chunk;
-  EvfsFile   *active_chunk_fh;
 
-#ifdef EVFS_USE_ROTATE_SHARED_BUFFER
+#ifdef USE_ROT_SHARED_BUFFER
   SharedBuffer *buf;
 #endif
 } MultipartState;
 
+// Access state kept separately by each handle on a container
+typedef struct ChunkAccess {
+  int         flags;
+  evfs_off_t  file_pos;     // Logical position for reads and writes in non-append mode
+  ChunkId     active_chunk;
+  EvfsFile   *active_chunk_fh;
+#ifdef EVFS_USE_IO_STATS
+  uint32_t    activations;  // Chunk files opened by this handle
+#endif
+} ChunkAccess;
+
 
 typedef struct ChunkPos {
   evfs_off_t offset;
@@ -188,12 +254,37 @@ typedef struct ChunkPos {
 
 
 
+// Cached state of a chunk file
+typedef struct ChunkInfo {
+  uint32_t size;
+  int8_t   gen;   // Generation of the existing chunk file. -1 when missing.
+} ChunkInfo;
+
+
 typedef struct RotateState {
   MultipartState  base;
   RotateConfig    cfg;  // Configuration read from the geometry file
 
   ChunkId start_chunk;  // First chunk in the logical file. It always follows a gap in the chunk sequence
   ChunkId end_chunk;    // Last chunk in logical file
+
+  // Chunk sizes are tracked here after the container is scanned so that reads
+  // and writes only touch the base VFS for data I/O.
+  ChunkInfo *chunk_table; // Indexed by chunk number
+
+  // All handles open on this container. Only one can write.
+  struct RotateFile  *handles;
+  struct RotateFile  *writer;
+  struct RotateState *next;   // Open containers in the shim
+
+  evfs_off_t unsynced_size;   // Bytes written since the last sync
+#ifdef EVFS_USE_IO_STATS
+  uint32_t   evictions;       // Chunks deleted while the container was open
+#endif
+
+#ifdef EVFS_USE_THREADING
+  EvfsLock  state_lock; // Serialize access from all handles
+#endif
 } RotateState;
 
 
@@ -203,9 +294,20 @@ typedef struct RotateData {
   Evfs       *shim_vfs;
 
   RotateConfig cfg;  // Configuration for new containers
-#ifdef EVFS_USE_ROTATE_SHARED_BUFFER
+#ifdef USE_ROT_SHARED_BUFFER
   SharedBuffer buf;
 #endif
+
+  RotateState *containers;  // Shared state for open containers
+#ifdef EVFS_USE_THREADING
+  EvfsLock  open_lock;  // Protect the containers list
+
+  // Background sync for RotateConfig.sync_ms
+  EvfsThread  flusher;
+  EvfsCond    flusher_wake; // Signaled on config change and shutdown
+  bool        flusher_running;
+  bool        flusher_stop;
+#endif
 } RotateData;
 
 typedef struct RotateFile {
@@ -214,6 +316,9 @@ typedef struct RotateFile {
   EvfsFile   *base_file;
 
   RotateState *rot_state;
+  ChunkAccess  acc;
+  RotateNotify notify;            // Called when another handle changes the container
+  struct RotateFile *next_handle; // Handles sharing rot_state
 } RotateFile;
 
 typedef struct RotateDir {
@@ -227,17 +332,17 @@ typedef struct RotateDir {
 // ******************** Internal rotation API ********************
 
 
-static evfs_off_t cur_write_pos(MultipartState *ms) {
-  evfs_off_t wpos = (ms->flags & EVFS_APPEND) ? ms->total_size : ms->file_pos;
-  //DPRINT("ROT write pos %d  append:%c  (%p)", wpos, (ms->flags & EVFS_APPEND) ? 'T' :'f', ms);
+static evfs_off_t cur_write_pos(MultipartState *ms, ChunkAccess *ca) {
+  evfs_off_t wpos = (ca->flags & EVFS_APPEND) ? ms->total_size : ca->file_pos;
+  //DPRINT("ROT write pos %d  append:%c  (%p)", wpos, (ca->flags & EVFS_APPEND) ? 'T' :'f', ms);
 
   return wpos;
 }
 
 
-static void incr_write_pos(MultipartState *ms, evfs_off_t offset) {
-  if(!(ms->flags & EVFS_APPEND))
-    ms->file_pos += offset;
+static void incr_write_pos(ChunkAccess *ca, evfs_off_t offset) {
+  if(!(ca->flags & EVFS_APPEND))
+    ca->file_pos += offset;
 }
 
 
@@ -334,9 +439,45 @@ static int build_chunk_path(Evfs *base_vfs, MultipartState *ms, ChunkId chunk_nu
 }
 
 
-static bool chunk_exists(Evfs *base_vfs, MultipartState *ms, ChunkId chunk_num, evfs_off_t *chunk_size) {
+static bool chunk_exists(RotateState *rs, ChunkId chunk_num, evfs_off_t *chunk_size) {
+  ChunkInfo *ci = &rs->chunk_table[chunk_num.chunk];
+  bool exists = ci->gen == chunk_num.gen;
+
+  if(chunk_size)
+    *chunk_size = exists ? ci->size : 0;
+
+  return exists;
+}
+
+
+static inline void set_chunk_info(RotateState *rs, ChunkId chunk_num, evfs_off_t chunk_size) {
+  rs->chunk_table[chunk_num.chunk].size = chunk_size;
+  rs->chunk_table[chunk_num.chunk].gen = chunk_num.gen;
+}
+
+
+static inline void clear_chunk_info(RotateState *rs, ChunkId chunk_num) {
+  rs->chunk_table[chunk_num.chunk].size = 0;
+  rs->chunk_table[chunk_num.chunk].gen = -1;
+}
+
+
+// Extend the cached size of a chunk after writing to it
+static inline void update_chunk_size(RotateState *rs, ChunkId chunk_num, evfs_off_t end_offset) {
+  ChunkInfo *ci = &rs->chunk_table[chunk_num.chunk];
+  if(end_offset > (evfs_off_t)ci->size)
+    ci->size = end_offset;
+}
+
 
-#ifdef EVFS_USE_ROTATE_SHARED_BUFFER
+static int stat_chunk(Evfs *base_vfs, MultipartState *ms, ChunkId chunk_num, evfs_off_t *chunk_size) {
+
+#if defined USE_ROT_SCRATCH
+  char *joined = evfs__scratch_path_get();
+  if(MEM_CHECK(joined)) return EVFS_ERR_ALLOC;
+  StringRange joined_r;
+  range_init(&joined_r, joined, EVFS_MAX_PATH);
+#elif defined USE_ROT_SHARED_BUFFER
   LOCK(ms->buf);
   char *joined = ms->buf->tmp_path;
   StringRange joined_r;
@@ -349,12 +490,11 @@ static bool chunk_exists(Evfs *base_vfs, MultipartState *ms, ChunkId chunk_num,
 
   EvfsInfo info;
   int status = base_vfs->m_stat(base_vfs, joined, &info);
-  UNLOCK(ms->buf);
+  FREE_TMP(ms->buf, joined);
 
-  if(chunk_size)
-    *chunk_size = (status == EVFS_OK) ? info.size : 0;
+  *chunk_size = (status == EVFS_OK) ? info.size : 0;
 
-  return status == EVFS_OK;
+  return status;
 }
 
 
@@ -381,10 +521,92 @@ static ChunkPos get_chunk_pos(RotateState *rs, evfs_off_t logical_off) {
 
 
 
-static int evict_chunk(Evfs *base_vfs, MultipartState *ms, ChunkId chunk_num, evfs_off_t *chunk_size) {
+static inline void deactivate_chunk(ChunkAccess *ca) {
+  // Shutdown current active chunk
+  if(ca->active_chunk_fh) {
+    evfs_file_close(ca->active_chunk_fh);
+    ca->active_chunk_fh = NULL;
+    ca->active_chunk.chunk = -1;
+  }
+}
+
+
+// Close a chunk in every handle before it's removed
+static void release_chunk(RotateState *rs, ChunkId chunk_num) {
+  for(RotateFile *fil = rs->handles; fil; fil = fil->next_handle) {
+    if(fil->acc.active_chunk.chunk == chunk_num.chunk)
+      deactivate_chunk(&fil->acc);
+  }
+}
+
+
+// Move all handle positions back after data is removed from the start of the file
+static void shift_file_pos(RotateState *rs, evfs_off_t trimmed_size) {
+  for(RotateFile *fil = rs->handles; fil; fil = fil->next_handle) {
+    if(fil->acc.file_pos > trimmed_size)
+      fil->acc.file_pos -= trimmed_size;
+    else
+      fil->acc.file_pos = 0;
+  }
+}
+
+
+// Sync unsynced data from the writer
+// Any number of requests before the next write only sync the base file once.
+static int sync_container(RotateState *rs) {
+  if(rs->unsynced_size == 0)
+    return EVFS_OK;
+
+  int status = EVFS_OK;
+  RotateFile *writer = rs->writer;
+
+  // Chunks the writer has moved past were committed when they were closed
+  if(writer && writer->acc.active_chunk_fh)
+    status = evfs_file_sync(writer->acc.active_chunk_fh);
+
+  if(status == EVFS_OK)
+    rs->unsynced_size = 0;
+
+  return status;
+}
+
+
+// Apply the sync policy after a write
+static inline void check_sync_policy(RotateState *rs) {
+  if(rs->cfg.sync_bytes && rs->unsynced_size >= (evfs_off_t)rs->cfg.sync_bytes)
+    sync_container(rs);
+}
+
+
+// Report a change in the container to the other handles
+static void notify_handles(RotateState *rs, RotateFile *changed_by) {
+  for(RotateFile *fil = rs->handles; fil; fil = fil->next_handle) {
+    if(fil != changed_by && fil->notify.callback)
+      fil->notify.callback((EvfsFile *)fil, rs->base.total_size, fil->notify.ctx);
+  }
+}
+
+
+static int evict_chunk(Evfs *base_vfs, RotateState *rs, ChunkId chunk_num, evfs_off_t *chunk_size) {
   //DPRINT("EVICT: %d_%d", chunk_num.chunk, chunk_num.gen);
+  MultipartState *ms = &rs->base;
+
+  evfs_off_t size;
+  if(!chunk_exists(rs, chunk_num, &size)) {
+    if(chunk_size)
+      *chunk_size = 0;
+    return EVFS_ERR_NO_FILE;
+  }
 
-#ifdef EVFS_USE_ROTATE_SHARED_BUFFER
+  // Chunk can't stay open once it's deleted
+  release_chunk(rs, chunk_num);
+
+#if defined USE_ROT_SCRATCH
+  char *joined = evfs__scratch_path_get();
+  if(MEM_CHECK(joined)) return EVFS_ERR_ALLOC;
+  StringRange joined_r;
+  range_init(&joined_r, joined, EVFS_MAX_PATH);
+#elif defined USE_ROT_SHARED_BUFFER
   LOCK(ms->buf);
   char *joined = ms->buf->tmp_path;
   StringRange joined_r;
@@ -395,18 +617,20 @@ static int evict_chunk(Evfs *base_vfs, MultipartState *ms, ChunkId chunk_num, ev
 #endif
   build_chunk_path(base_vfs, ms, chunk_num, &joined_r);
 
-  EvfsInfo info;
-  int status = base_vfs->m_stat(base_vfs, joined, &info);
-  if(status == EVFS_OK)
-    status = base_vfs->m_delete(base_vfs, joined);
+  int status = base_vfs->m_delete(base_vfs, joined);
 
-  UNLOCK(ms->buf);
+  FREE_TMP(ms->buf, joined);
 
-  if(status == EVFS_OK)
-    ms->total_size -= info.size;
+  if(status == EVFS_OK) {
+    ms->total_size -= size;
+    clear_chunk_info(rs, chunk_num);
+#ifdef EVFS_USE_IO_STATS
+    rs->evictions++;
+#endif
+  }
 
   if(chunk_size)
-    *chunk_size = (status == EVFS_OK) ? info.size : 0;
+    *chunk_size = (status == EVFS_OK) ? size : 0;
 
   return status;
 }
@@ -429,29 +653,33 @@ static inline ChunkId next_chunk(RotateState *rs) {
 }
 
 
-static inline void deactivate_chunk(MultipartState *ms) {
-  // Shutdown current active chunk
-  if(ms->active_chunk_fh) {
-    evfs_file_close(ms->active_chunk_fh);
-    ms->active_chunk_fh = NULL;
-    ms->active_chunk.chunk = -1;
-  }
+static inline void set_active_chunk(ChunkAccess *ca, ChunkId chunk_num, EvfsFile *fh) {
+  ca->active_chunk = chunk_num;
+  ca->active_chunk_fh = fh;
+#ifdef EVFS_USE_IO_STATS
+  ca->activations++;
+#endif
 }
 
 
-static int activate_chunk(Evfs *base_vfs, MultipartState *ms, ChunkId chunk_num) {
+static int activate_chunk(Evfs *base_vfs, MultipartState *ms, ChunkAccess *ca, ChunkId chunk_num) {
   //DPRINT("ROT Activate chunk: %d_%d", chunk_num.chunk, chunk_num.gen);
 
-  if(ms->active_chunk.chunk == chunk_num.chunk) // Already opened chunk
+  if(ca->active_chunk.chunk == chunk_num.chunk) // Already opened chunk
     return EVFS_OK;
 
   // Shutdown current active chunk
-  deactivate_chunk(ms);
+  deactivate_chunk(ca);
 
   // Open new chunk
   EvfsFile *fh;
 
-#ifdef EVFS_USE_ROTATE_SHARED_BUFFER
+#if defined USE_ROT_SCRATCH
+  char *joined = evfs__scratch_path_get();
+  if(MEM_CHECK(joined)) return EVFS_ERR_ALLOC;
+  StringRange joined_r;
+  range_init(&joined_r, joined, EVFS_MAX_PATH);
+#elif defined USE_ROT_SHARED_BUFFER
   LOCK(ms->buf);
   char *joined = ms->buf->tmp_path;
   StringRange joined_r;
@@ -464,21 +692,237 @@ static int activate_chunk(Evfs *base_vfs, MultipartState *ms, ChunkId chunk_num)
 
   int status = evfs_vfs_open(base_vfs, joined, &fh, EVFS_RDWR);
 
-  UNLOCK(ms->buf);
+  FREE_TMP(ms->buf, joined);
+
+  if(status == EVFS_OK)
+    set_active_chunk(ca, chunk_num, fh);
+
+  return status;
+}
+
+
+#ifdef EVFS_USE_ROTATE_CURSOR
+static inline ChunkId prev_chunk(RotateState *rs, ChunkId id) {
+  id.chunk--;
+  if(id.chunk < 0) {
+    id.chunk = rs->cfg.max_chunks - 1;
+    id.gen = 1 - id.gen;
+  }
+  return id;
+}
+
+
+static uint32_t cursor_check(RotateCursor *cur) {
+  return ~(cur->magic ^ cur->start_chunk ^ cur->end_chunk ^
+          ((uint32_t)cur->start_gen << 8) ^ cur->end_gen);
+}
+
+
+static int open_cursor(Evfs *base_vfs, MultipartState *ms, EvfsFile **fh, int flags) {
+#if defined USE_ROT_SCRATCH
+  char *joined = evfs__scratch_path_get();
+  if(MEM_CHECK(joined)) return EVFS_ERR_ALLOC;
+  StringRange joined_r;
+  range_init(&joined_r, joined, EVFS_MAX_PATH);
+#elif defined USE_ROT_SHARED_BUFFER
+  LOCK(ms->buf);
+  char *joined = ms->buf->tmp_path;
+  StringRange joined_r;
+  range_init(&joined_r, joined, COUNT_OF(ms->buf->tmp_path));
+#else
+  char joined[EVFS_MAX_PATH];
+  StringRange joined_r = RANGE_FROM_ARRAY(joined);
+#endif
+  evfs_vfs_path_join_str(base_vfs, ms->container_path, MULTIPART_CURSOR_FILE, &joined_r);
+
+  int status = evfs_vfs_open(base_vfs, joined, fh, flags);
+  FREE_TMP(ms->buf, joined);
+
+  return status;
+}
+
+
+// Record the current chunk sequence
+// This is done after the sequence changes so a fault leaves a stale
+// cursor that fails validation on the next open.
+static int save_cursor(Evfs *base_vfs, RotateState *rs) {
+  if(!rs->writer) // Read only handles never change the sequence
+    return EVFS_OK;
+
+  RotateCursor cur = {
+    .magic        = EVFS_ROTATE_CURSOR_MAGIC,
+    .start_chunk  = rs->start_chunk.chunk,
+    .end_chunk    = rs->end_chunk.chunk,
+    .start_gen    = rs->start_chunk.gen,
+    .end_gen      = rs->end_chunk.gen
+  };
+  cur.check = cursor_check(&cur);
+
+  EvfsFile *fh;
+  int status = open_cursor(base_vfs, &rs->base, &fh, EVFS_WRITE | EVFS_OVERWRITE);
+  if(status != EVFS_OK) return status;
+
+  if(evfs_file_write(fh, &cur, sizeof(cur)) != sizeof(cur))
+    status = EVFS_ERR_IO;
+
+  evfs_file_close(fh);
+  return status;
+}
+
+
+/*
+Restore the chunk sequence from the cursor
+
+The cursor is only trusted if the start and end chunks exist, the slots
+on either side of the sequence are empty, and the start chunk is full. All
+chunks before the end are full so their sizes don't need to be read.
+
+Args:
+  base_vfs:   VFS for the container
+  rs:         Rotate state to initialize
+
+Returns:
+  EVFS_OK when the cursor is valid
+*/
+static int load_cursor(Evfs *base_vfs, RotateState *rs) {
+  EvfsFile *fh;
+  RotateCursor cur;
+
+  int status = open_cursor(base_vfs, &rs->base, &fh, EVFS_READ);
+  if(status != EVFS_OK) return status;
+
+  if(evfs_file_read(fh, &cur, sizeof(cur)) != sizeof(cur))
+    status = EVFS_ERR_INVALID;
+  evfs_file_close(fh);
+  if(status != EVFS_OK) return status;
+
+  if(cur.magic != EVFS_ROTATE_CURSOR_MAGIC || cur.check != cursor_check(&cur)
+    || cur.start_chunk >= rs->cfg.max_chunks || cur.end_chunk >= rs->cfg.max_chunks
+    || cur.start_gen > 1 || cur.end_gen > 1)
+    return EVFS_ERR_INVALID;
+
+  ChunkId start = {cur.start_chunk, cur.start_gen};
+  ChunkId end   = {cur.end_chunk, cur.end_gen};
+  evfs_off_t start_size, end_size, unused;
+
+  if(stat_chunk(base_vfs, &rs->base, start, &start_size) != EVFS_OK
+    || stat_chunk(base_vfs, &rs->base, end, &end_size) != EVFS_OK
+    || end_size == 0 || end_size > (evfs_off_t)rs->cfg.chunk_size
+    || (start.chunk != end.chunk && start_size != (evfs_off_t)rs->cfg.chunk_size))
+    return EVFS_ERR_INVALID;
+
+  // A fault during rotation can leave chunks outside the recorded sequence
+  rs->end_chunk = end;
+  if(stat_chunk(base_vfs, &rs->base, next_chunk(rs), &unused) == EVFS_OK
+    || stat_chunk(base_vfs, &rs->base, prev_chunk(rs, start), &unused) == EVFS_OK)
+    return EVFS_ERR_INVALID;
+
+  rs->start_chunk = start;
+  rs->base.total_size = 0;
+
+  for(ChunkId id = start; id.chunk != end.chunk; incr_chunk(rs, &id)) {
+    set_chunk_info(rs, id, rs->cfg.chunk_size);
+    rs->base.total_size += rs->cfg.chunk_size;
+  }
+
+  set_chunk_info(rs, end, end_size);
+  rs->base.total_size += end_size;
+
+  return EVFS_OK;
+}
+
+#else
+#  define save_cursor(base_vfs, rs)
+#endif // EVFS_USE_ROTATE_CURSOR
+
+
+/*
+Reuse an evicted chunk as a new chunk
+
+The old chunk file is renamed to the new chunk's name and reopened with
+truncation. On flash filesystems this avoids the separate metadata updates
+from deleting and creating a file. A fault after the rename leaves stale data
+in the new chunk that will appear at the end of the file.
+
+Args:
+  base_vfs:   VFS for the container
+  rs:         Rotate state for the container
+  old_chunk:  Chunk to evict
+  new_chunk:  Chunk to create
+  fh:         Open handle for the new chunk
+
+Returns:
+  EVFS_OK on success. EVFS_ERR_NO_SUPPORT when the base VFS can't rename.
+*/
+static int recycle_chunk(Evfs *base_vfs, RotateState *rs, ChunkId old_chunk, ChunkId new_chunk,
+                         EvfsFile **fh) {
+  MultipartState *ms = &rs->base;
+
+  evfs_off_t size;
+  if(!chunk_exists(rs, old_chunk, &size))
+    return EVFS_ERR_NO_FILE;
+
+  // Chunk can't stay open while it's renamed
+  release_chunk(rs, old_chunk);
+
+#if defined USE_ROT_SCRATCH
+  char *joined = evfs__scratch_path_get();
+  if(MEM_CHECK(joined)) return EVFS_ERR_ALLOC;
+  char *new_joined = evfs__scratch_path_get();
+  if(MEM_CHECK(new_joined)) {
+    evfs__scratch_path_put(joined);
+    return EVFS_ERR_ALLOC;
+  }
+  StringRange joined_r, new_joined_r;
+  range_init(&joined_r, joined, EVFS_MAX_PATH);
+  range_init(&new_joined_r, new_joined, EVFS_MAX_PATH);
+#elif defined USE_ROT_SHARED_BUFFER
+  LOCK(ms->buf);
+  char *joined = ms->buf->tmp_path;
+  char *new_joined = ms->buf->new_path;
+  StringRange joined_r, new_joined_r;
+  range_init(&joined_r, joined, COUNT_OF(ms->buf->tmp_path));
+  range_init(&new_joined_r, new_joined, COUNT_OF(ms->buf->new_path));
+#else
+  char joined[EVFS_MAX_PATH];
+  char new_joined[EVFS_MAX_PATH];
+  StringRange joined_r = RANGE_FROM_ARRAY(joined);
+  StringRange new_joined_r = RANGE_FROM_ARRAY(new_joined);
+#endif
+  build_chunk_path(base_vfs, ms, old_chunk, &joined_r);
+  build_chunk_path(base_vfs, ms, new_chunk, &new_joined_r);
+
+  int status = base_vfs->m_rename(base_vfs, joined, new_joined);
 
   if(status == EVFS_OK) {
-    ms->active_chunk_fh = fh;
-    ms->active_chunk = chunk_num;
+    // The old chunk is gone even if the reopen fails
+    ms->total_size -= size;
+    clear_chunk_info(rs, old_chunk);
+#ifdef EVFS_USE_IO_STATS
+    rs->evictions++;
+#endif
+
+    // Truncation reuses the existing directory entry
+    status = evfs_vfs_open(base_vfs, new_joined, fh, EVFS_RDWR | EVFS_OVERWRITE);
   }
 
+#ifdef USE_ROT_SCRATCH
+  evfs__scratch_path_put(new_joined);
+#endif
+  FREE_TMP(ms->buf, joined);
+
   return status;
 }
 
 
 // Method
 static int append_new_chunk(Evfs *base_vfs, RotateState *rs, EvfsFile **fh) {
+  // The writer's active chunk is full if we're here
+  if(rs->cfg.sync_on_chunk)
+    sync_container(rs);
+
   bool is_empty = rs->start_chunk.chunk == rs->end_chunk.chunk &&
-                  !chunk_exists(base_vfs, &rs->base, rs->end_chunk, NULL);
+                  !chunk_exists(rs, rs->end_chunk, NULL);
   ChunkId next = rs->end_chunk;
 
   //DPRINT("ROT append  empty:%c", is_empty ? 'T':'f');
@@ -489,25 +933,40 @@ static int append_new_chunk(Evfs *base_vfs, RotateState *rs, EvfsFile **fh) {
     if(next.chunk >= MULTIPART_MAX_CHUNK)
       return EVFS_ERR_TOO_LONG;
 
+    int status = EVFS_ERR_NO_SUPPORT;
+
     // Remove the old start chunk on wrap around
     if(next.chunk == rs->start_chunk.chunk) {
-      evict_chunk(base_vfs, &rs->base, rs->start_chunk, NULL);
+      if(rs->cfg.recycle_chunks)
+        status = recycle_chunk(base_vfs, rs, rs->start_chunk, next, fh);
+
+      // Fall back to deletion if the old chunk wasn't renamed
+      if(status != EVFS_OK && chunk_exists(rs, rs->start_chunk, NULL))
+        evict_chunk(base_vfs, rs, rs->start_chunk, NULL);
 
       incr_chunk(rs, &rs->start_chunk);
 
       // Adjust read/write pos to reflect trimmed file
-      if(rs->base.file_pos > (evfs_off_t)rs->cfg.chunk_size)
-        rs->base.file_pos -= rs->cfg.chunk_size;
-      else
-        rs->base.file_pos = 0;
+      shift_file_pos(rs, rs->cfg.chunk_size);
     }
 
     rs->end_chunk = next;
+
+    if(status == EVFS_OK) { // Chunk was recycled
+      set_chunk_info(rs, next, 0);
+      save_cursor(base_vfs, rs);
+      return EVFS_OK;
+    }
   }
 
   //DPRINT("ROT: Append new chunk: %d_%d", rs->end_chunk.chunk, rs->end_chunk.gen);
 
-#ifdef EVFS_USE_ROTATE_SHARED_BUFFER
+#if defined USE_ROT_SCRATCH
+  char *joined = evfs__scratch_path_get();
+  if(MEM_CHECK(joined)) return EVFS_ERR_ALLOC;
+  StringRange joined_r;
+  range_init(&joined_r, joined, EVFS_MAX_PATH);
+#elif defined USE_ROT_SHARED_BUFFER
   LOCK(rs->base.buf);
   char *joined = rs->base.buf->tmp_path;
   StringRange joined_r;
@@ -523,7 +982,12 @@ static int append_new_chunk(Evfs *base_vfs, RotateState *rs, EvfsFile **fh) {
   // Open file handle is returned through fh
   int status = evfs_vfs_open(base_vfs, joined, fh, EVFS_RDWR | EVFS_OVERWRITE);
 
-  UNLOCK(rs->base.buf);
+  FREE_TMP(rs->base.buf, joined);
+
+  if(status == EVFS_OK) {
+    set_chunk_info(rs, next, 0);
+    save_cursor(base_vfs, rs);
+  }
 
   return status;
 }
@@ -569,7 +1033,12 @@ static int discover_chunk_sequence(Evfs *base_vfs, RotateState *rs) {
     EvfsInfo info;
     while(evfs_dir_find(dh, "c*.cnk", &info) == EVFS_OK) {
       ChunkId id = parse_chunk_name(info.name);
-      bool exists = chunk_exists(base_vfs, &rs->base, id, &chunk_size);
+      if(id.chunk < 0 || id.chunk >= (int)rs->cfg.max_chunks || (id.gen != 0 && id.gen != 1))
+        continue;
+
+      bool exists = stat_chunk(base_vfs, &rs->base, id, &chunk_size) == EVFS_OK;
+      if(exists)
+        set_chunk_info(rs, id, chunk_size);
 
       // It's possible a 0-length chunk was leftover from a previous
       // power failure. We'll clean it up now. This should just leave
@@ -577,7 +1046,7 @@ static int discover_chunk_sequence(Evfs *base_vfs, RotateState *rs) {
       // errors have happened.
       if(exists && chunk_size == 0) {
         //DPRINT("ROT evict zero length chunk");
-        evict_chunk(base_vfs, &rs->base, id, NULL);
+        evict_chunk(base_vfs, rs, id, NULL);
         exists = false;
       }
 
@@ -626,8 +1095,26 @@ static int discover_chunk_sequence(Evfs *base_vfs, RotateState *rs) {
 }
 
 
-// Method
-static int open_rotate_container(Evfs *vfs, const char *path, RotateFile *fh, int flags) {
+#ifdef EVFS_USE_ROTATE_CURSOR
+// Use cursor when valid or fall back to a full scan
+static int restore_chunk_sequence(Evfs *base_vfs, RotateState *rs) {
+  if(load_cursor(base_vfs, rs) == EVFS_OK)
+    return EVFS_OK;
+
+  int status = discover_chunk_sequence(base_vfs, rs);
+  if(status == EVFS_OK)
+    save_cursor(base_vfs, rs); // Skip the scan next time
+
+  return status;
+}
+
+#else
+#  define restore_chunk_sequence(base_vfs, rs)  discover_chunk_sequence(base_vfs, rs)
+#endif // EVFS_USE_ROTATE_CURSOR
+
+
+// Read container geometry into a new shared state
+static int load_container_state(Evfs *vfs, const char *path, RotateState **state) {
   RotateData *shim_data = (RotateData *)vfs->fs_data;
   Evfs *base_vfs = shim_data->base_vfs;
 
@@ -644,7 +1131,15 @@ static int open_rotate_container(Evfs *vfs, const char *path, RotateFile *fh, in
 
   // Read dat settings
 
-#ifdef EVFS_USE_ROTATE_SHARED_BUFFER
+#if defined USE_ROT_SCRATCH
+  char *joined = evfs__scratch_path_get();
+  if(MEM_CHECK(joined)) {
+    evfs_free(rs);
+    return EVFS_ERR_ALLOC;
+  }
+  StringRange joined_r;
+  range_init(&joined_r, joined, EVFS_MAX_PATH);
+#elif defined USE_ROT_SHARED_BUFFER
   LOCK(&shim_data->buf);
   char *joined = shim_data->buf.tmp_path;
   StringRange joined_r;
@@ -657,7 +1152,7 @@ static int open_rotate_container(Evfs *vfs, const char *path, RotateFile *fh, in
 
   EvfsFile *dat_fh;
   int status = evfs_vfs_open(base_vfs, joined, &dat_fh, EVFS_READ);
-  UNLOCK(&shim_data->buf);
+  FREE_TMP(&shim_data->buf, joined);
 
   if(status != EVFS_OK)
     goto cleanup1;
@@ -689,6 +1184,27 @@ static int open_rotate_container(Evfs *vfs, const char *path, RotateFile *fh, in
   rs->cfg.chunk_size = geom.chunk_size;
   rs->cfg.max_chunks = geom.max_chunks;
 
+  // Options come from the shim rather than the container
+  rs->cfg.recycle_chunks = shim_data->cfg.recycle_chunks;
+  rs->cfg.sync_bytes     = shim_data->cfg.sync_bytes;
+  rs->cfg.sync_on_chunk  = shim_data->cfg.sync_on_chunk;
+
+  if(geom.max_chunks < 2 || geom.max_chunks > MULTIPART_MAX_CHUNK) {
+    status = EVFS_ERR_INVALID;
+    goto cleanup2;
+  }
+
+  rs->chunk_table = evfs_malloc(geom.max_chunks * sizeof(ChunkInfo));
+  if(MEM_CHECK(rs->chunk_table)) {
+    status = EVFS_ERR_ALLOC;
+    goto cleanup2;
+  }
+
+  for(uint32_t i = 0; i < geom.max_chunks; i++) {
+    rs->chunk_table[i].size = 0;
+    rs->chunk_table[i].gen = -1;
+  }
+
 
   // Successful read
 
@@ -698,32 +1214,230 @@ static int open_rotate_container(Evfs *vfs, const char *path, RotateFile *fh, in
   rs->base.container_path = (char *)NEXT_OBJ(rs);
   strcpy((char *)rs->base.container_path, path);
 
-  rs->base.flags = flags;
   rs->base.chunk_size = geom.chunk_size;
-  rs->base.file_pos = 0;
-  rs->base.active_chunk.chunk = -1;
-  rs->base.active_chunk.gen = 0;
-  rs->base.active_chunk_fh = NULL;
 
-#ifdef EVFS_USE_ROTATE_SHARED_BUFFER
+#ifdef USE_ROT_SHARED_BUFFER
   rs->base.buf = &shim_data->buf;
 #endif
 
-  status = discover_chunk_sequence(base_vfs, rs);
+#ifdef EVFS_USE_THREADING
+  evfs__lock_init(&rs->state_lock);
+#endif
 
-  fh->rot_state = rs;
+  status = EVFS_OK;
+  *state = rs;
 
 cleanup2:
   evfs_file_close(dat_fh);
 
 cleanup1:
-  if(status != EVFS_OK)
+  if(status != EVFS_OK) {
+    if(rs->chunk_table)
+      evfs_free(rs->chunk_table);
     evfs_free(rs);
+  }
+
+  return status;
+}
+
+
+static void free_container_state(RotateState *rs) {
+#ifdef EVFS_USE_THREADING
+  evfs__lock_destroy(&rs->state_lock);
+#endif
+  evfs_free(rs->chunk_table);
+  evfs_free(rs);
+}
+
+
+static RotateState *find_container_state(RotateData *shim_data, const char *path) {
+  for(RotateState *rs = shim_data->containers; rs; rs = rs->next) {
+    if(!strcmp(rs->base.container_path, path))
+      return rs;
+  }
+
+  return NULL;
+}
+
+
+static void detach_handle(RotateState *rs, RotateFile *fil) {
+  deactivate_chunk(&fil->acc);
+
+  for(RotateFile **cur = &rs->handles; *cur; cur = &(*cur)->next_handle) {
+    if(*cur == fil) {
+      *cur = fil->next_handle;
+      break;
+    }
+  }
+
+  if(rs->writer == fil)
+    rs->writer = NULL;
+
+  fil->next_handle = NULL;
+}
+
+
+/*
+Open a container handle
+
+Handles on the same container path share a single RotateState so that
+readers see data as it's written and have their positions adjusted when
+chunks are evicted. Only one handle can have write access.
+
+Args:
+  vfs:    Rotate VFS
+  path:   Path to the container
+  fil:    File handle to attach to the container
+  flags:  Open mode flags
+
+Returns:
+  EVFS_OK on success. EVFS_ERR_BUSY if a writer already has the container open.
+*/
+static int open_rotate_container(Evfs *vfs, const char *path, RotateFile *fil, int flags) {
+  RotateData *shim_data = (RotateData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+  int status = EVFS_OK;
+
+  OPEN_LOCK(shim_data);
+
+  RotateState *rs = find_container_state(shim_data, path);
+  bool new_state = !rs;
+
+  if(new_state) {
+    status = load_container_state(vfs, path, &rs);
+    if(status != EVFS_OK) {
+      OPEN_UNLOCK(shim_data);
+      return status;
+    }
+  }
+
+  STATE_LOCK(rs);
+  if((flags & EVFS_WRITE) && rs->writer) {
+    status = EVFS_ERR_BUSY;
+
+  } else {
+    fil->rot_state = rs;
+    fil->acc = (ChunkAccess){.flags = flags, .active_chunk = {-1, 0}};
+    fil->notify = (RotateNotify){0};
+    fil->next_handle = rs->handles;
+    rs->handles = fil;
+    if(flags & EVFS_WRITE)
+      rs->writer = fil;
+
+    if(new_state) { // Scan after the writer is known so the cursor can be saved
+      status = restore_chunk_sequence(base_vfs, rs);
+      if(status != EVFS_OK)
+        detach_handle(rs, fil);
+    }
+  }
+  STATE_UNLOCK(rs);
+
+  if(new_state) {
+    if(status == EVFS_OK) {
+      rs->next = shim_data->containers;
+      shim_data->containers = rs;
+    } else {
+      free_container_state(rs);
+    }
+  }
+
+  OPEN_UNLOCK(shim_data);
+
+  if(status != EVFS_OK)
+    fil->rot_state = NULL;
+
+  return status;
+}
+
+
+static void close_rotate_container(RotateFile *fil) {
+  RotateState *rs = fil->rot_state;
+  RotateData *shim_data = fil->shim_data;
+
+  OPEN_LOCK(shim_data);
+
+  STATE_LOCK(rs);
+  detach_handle(rs, fil);
+  bool unused = !rs->handles;
+  STATE_UNLOCK(rs);
+
+  if(unused) { // Last handle closed
+    for(RotateState **cur = &shim_data->containers; *cur; cur = &(*cur)->next) {
+      if(*cur == rs) {
+        *cur = rs->next;
+        break;
+      }
+    }
+
+    free_container_state(rs);
+  }
+
+  OPEN_UNLOCK(shim_data);
+
+  fil->rot_state = NULL;
+}
+
+
+#ifdef EVFS_USE_THREADING
+// Background thread that periodically syncs all open containers
+static void sync_flusher(void *arg) {
+  RotateData *shim_data = (RotateData *)arg;
+
+  OPEN_LOCK(shim_data);
+  while(!shim_data->flusher_stop) {
+    if(shim_data->cfg.sync_ms > 0)
+      evfs__cond_timedwait(&shim_data->flusher_wake, &shim_data->open_lock, shim_data->cfg.sync_ms);
+    else // Idle until reconfigured
+      evfs__cond_wait(&shim_data->flusher_wake, &shim_data->open_lock);
+
+    if(shim_data->flusher_stop)
+      break;
+
+    for(RotateState *rs = shim_data->containers; rs; rs = rs->next) {
+      STATE_LOCK(rs);
+      sync_container(rs);
+      STATE_UNLOCK(rs);
+    }
+  }
+  OPEN_UNLOCK(shim_data);
+}
+
+
+// Start the flusher the first time a sync interval is configured
+// Must be called with the open lock held
+static int start_flusher(RotateData *shim_data) {
+  if(shim_data->cfg.sync_ms == 0 && !shim_data->flusher_running)
+    return EVFS_OK;
+
+  if(shim_data->flusher_running) { // Pick up the new interval
+    evfs__cond_signal(&shim_data->flusher_wake);
+    return EVFS_OK;
+  }
+
+  int status = evfs__thread_create(&shim_data->flusher, sync_flusher, shim_data);
+  if(status == EVFS_OK)
+    shim_data->flusher_running = true;
 
   return status;
 }
 
 
+static void stop_flusher(RotateData *shim_data) {
+  OPEN_LOCK(shim_data);
+  bool running = shim_data->flusher_running;
+  shim_data->flusher_stop = true;
+  evfs__cond_signal(&shim_data->flusher_wake);
+  OPEN_UNLOCK(shim_data);
+
+  if(running)
+    evfs__thread_join(shim_data->flusher);
+}
+
+#else
+#  define start_flusher(shim_data)  EVFS_OK
+#endif // EVFS_USE_THREADING
+
+
 static int set_rotate_config(Evfs *vfs, RotateConfig *cfg) {
   // Validate the config settings
   if(cfg->max_chunks < 2
@@ -744,6 +1458,9 @@ static int trim_start_chunks(RotateFile *fil, evfs_off_t trim_bytes) {
   RotateData *shim_data = fil->shim_data;
   Evfs *base_vfs = shim_data->base_vfs;
 
+  if(rs->writer != fil)
+    return EVFS_ERR_DISABLED;
+
   int status = EVFS_OK;
   // We need to round down to the nearest chunk size
   int trim_chunks = trim_bytes / rs->cfg.chunk_size;
@@ -774,7 +1491,7 @@ static int trim_start_chunks(RotateFile *fil, evfs_off_t trim_bytes) {
 
   // Delete chunks
   while(1) {
-    status = evict_chunk(base_vfs, &rs->base, cur_chunk, &chunk_size);
+    status = evict_chunk(base_vfs, rs, cur_chunk, &chunk_size);
     if(status != EVFS_OK)
       break;
 
@@ -791,18 +1508,16 @@ static int trim_start_chunks(RotateFile *fil, evfs_off_t trim_bytes) {
     rs->base.total_size = 0; // Just to be sure this is correct
     rs->start_chunk = (ChunkId){0,0};
     rs->end_chunk = (ChunkId){0,0};
-    rs->base.file_pos = 0;
 
   } else { // Partial trim
     incr_chunk(rs, &cur_chunk);
     rs->start_chunk = cur_chunk;
-
-    if(rs->base.file_pos > trimmed_size)
-      rs->base.file_pos -= trimmed_size;
-    else
-      rs->base.file_pos = 0;
   }
 
+  shift_file_pos(rs, trimmed_size);
+
+  save_cursor(base_vfs, rs);
+  notify_handles(rs, fil);
 
   if(status == EVFS_OK)
     status = trimmed_size;
@@ -823,6 +1538,9 @@ static int rotate__file_ctrl(EvfsFile *fh, int cmd, void *arg) {
     status = fil->base_file->methods->m_ctrl(fil->base_file, cmd, arg);
 
   } else { // This is a rotate container
+    RotateState *rs = fil->rot_state;
+
+    STATE_LOCK(rs);
     switch(cmd) {
     case EVFS_CMD_SET_ROTATE_TRIM: // Trim chunks from start of file
       {
@@ -831,10 +1549,30 @@ static int rotate__file_ctrl(EvfsFile *fh, int cmd, void *arg) {
       }
       break;
 
+    case EVFS_CMD_SET_ROTATE_NOTIFY: // Callback for changes by other handles
+      {
+        RotateNotify *v = (RotateNotify *)arg;
+        fil->notify = v ? *v : (RotateNotify){0};
+        status = EVFS_OK;
+      }
+      break;
+
+#ifdef EVFS_USE_IO_STATS
+    case EVFS_CMD_GET_IO_STATS:
+      {
+        EvfsIOStats *v = (EvfsIOStats *)arg;
+        v->chunk_activations += fil->acc.activations;
+        v->chunk_evictions += rs->evictions;
+        status = EVFS_OK;
+      }
+      break;
+#endif
+
     default:
       status = EVFS_ERR_NO_SUPPORT;
       break;
     }
+    STATE_UNLOCK(rs);
   }
 
   return status;
@@ -850,18 +1588,7 @@ static int rotate__file_close(EvfsFile *fh) {
     status = fil->base_file->methods->m_close(fil->base_file);
 
   } else { // This is a rotate container
-    RotateState *rs = fil->rot_state;
-
-    // Shutdown current active chunk
-    if(rs->base.active_chunk_fh) {
-      evfs_file_close(rs->base.active_chunk_fh);
-      rs->base.active_chunk_fh = NULL;
-      rs->base.active_chunk.chunk = -1;
-    }
-
-    evfs_free(rs);
-
-    fil->rot_state = NULL;
+    close_rotate_container(fil);
     status = EVFS_OK;
   }
 
@@ -874,63 +1601,164 @@ static int rotate__file_close(EvfsFile *fh) {
 }
 
 
+// Readers use the writer's handle on its active chunk so they see unflushed data
+static EvfsFile *writer_chunk_fh(RotateState *rs, ChunkId chunk_num) {
+  RotateFile *writer = rs->writer;
+
+  if(writer && writer->acc.active_chunk_fh && writer->acc.active_chunk.chunk == chunk_num.chunk)
+    return writer->acc.active_chunk_fh;
+
+  return NULL;
+}
+
+
+static ptrdiff_t read_container(RotateFile *fil, uint8_t *cbuf, size_t size) {
+  RotateState *rs = fil->rot_state;
+  ChunkAccess *ca = &fil->acc;
+  Evfs *base_vfs = fil->shim_data->base_vfs;
+
+  ptrdiff_t read = 0;
+
+  // We may have more than one chunk's worth of data to read
+  while(size > 0) {
+    ChunkPos rpos = get_chunk_pos(rs, ca->file_pos);
+
+    //DPRINT("rptr: %ld, rpos: %d:%d,  active: %d", ca->file_pos, rpos.chunk_num, rpos.offset, ca->active_chunk);
+
+    // If the chunk doesn't exist we are out of chunks to read
+    evfs_off_t chunk_size;
+    if(!chunk_exists(rs, rpos.chunk_num, &chunk_size))
+      break;
+
+    if(rpos.offset >= chunk_size) // Nothing left to read
+      break;
+
+    EvfsFile *chunk_fh = writer_chunk_fh(rs, rpos.chunk_num);
+    if(!chunk_fh) {
+      int status = activate_chunk(base_vfs, &rs->base, ca, rpos.chunk_num);
+      if(status != EVFS_OK) return status;
+      chunk_fh = ca->active_chunk_fh;
+    }
+
+    // Seek into this chunk
+    evfs_file_seek(chunk_fh, rpos.offset, EVFS_SEEK_TO);
+    evfs_off_t remain_space = chunk_size - rpos.offset;
+    size_t read_size = MIN((evfs_off_t)size, remain_space);
+
+    ptrdiff_t read_chunk = evfs_file_read(chunk_fh, cbuf, read_size);
+    if(read_chunk > 0) {
+      cbuf += read_chunk;
+      size -= read_chunk;
+      ca->file_pos += read_chunk;
+      read += read_chunk;
+    } else { // Chunk is prematurely empty
+      return EVFS_ERR_IO;
+    }
+  }
+
+  return read;
+}
+
+
 static ptrdiff_t rotate__file_read(EvfsFile *fh, void *buf, size_t size) {
   RotateFile *fil = (RotateFile *)fh;
   uint8_t *cbuf = (uint8_t *)buf;
 
-  ptrdiff_t read = 0;
+  ptrdiff_t read;
   if(!fil->rot_state) { // This is a normal file
     read = fil->base_file->methods->m_read(fil->base_file, cbuf, size);
 
   } else {
     RotateState *rs = fil->rot_state;
-    RotateData *shim_data = fil->shim_data;
-    Evfs *base_vfs = shim_data->base_vfs;
 
-    int status = EVFS_OK;
+    STATE_LOCK(rs);
+    read = read_container(fil, cbuf, size);
+    STATE_UNLOCK(rs);
+  }
 
-    // We may have more than one chunk's worth of data to read
-    while(size > 0) {
-      ChunkPos rpos = get_chunk_pos(rs, rs->base.file_pos);
+  return read;
+}
 
-      //DPRINT("rptr: %ld, rpos: %d:%d,  active: %d", rs->base.file_pos, rpos.chunk_num, rpos.offset, rs->base.active_chunk);
 
-      // If the chunk doesn't exist we are out of chunks to read
-      evfs_off_t chunk_size;
-      if(!chunk_exists(base_vfs, &rs->base, rpos.chunk_num, &chunk_size))
-        break;
+// Open and seek to the chunk at the current write position
+// Returns the position and the space remaining in the chunk
+static int seek_write_chunk(Evfs *base_vfs, RotateState *rs, ChunkAccess *ca, ChunkPos *wpos,
+                            evfs_off_t *free_space) {
+  EvfsFile *new_chunk;
+  int status;
 
-      if(rpos.chunk_num.chunk != rs->base.active_chunk.chunk) {
-        status = activate_chunk(base_vfs, &rs->base, rpos.chunk_num);
-        if(status != EVFS_OK) return status;
-      }
+  // Our write position depends on whether we're in append mode
+  *wpos = get_chunk_pos(rs, cur_write_pos(&rs->base, ca));
 
-      if(rpos.offset >= chunk_size) // Nothing left to read
-        break;
+  // If the chunk doesn't exist we need to create it
+  if(!chunk_exists(rs, wpos->chunk_num, NULL)) {
+    status = append_new_chunk(base_vfs, rs, &new_chunk);
+    if(status != EVFS_OK) return status;
 
-      // Seek into this chunk
-      evfs_file_seek(rs->base.active_chunk_fh, rpos.offset, EVFS_SEEK_TO);
-      evfs_off_t remain_space = chunk_size - rpos.offset;
-      size_t read_size = MIN((evfs_off_t)size, remain_space);
-
-      ptrdiff_t read_chunk = evfs_file_read(rs->base.active_chunk_fh, cbuf, read_size);
-      if(read_chunk > 0) {
-        cbuf += read_chunk;
-        size -= read_chunk;
-        rs->base.file_pos += read_chunk;
-        read += read_chunk;
-      } else { // Chunk is prematurely empty
-        return EVFS_ERR_IO;
-      }
+    // Set new active chunk
+    deactivate_chunk(ca);
+    set_active_chunk(ca, wpos->chunk_num, new_chunk);
+  }
 
-    }
+  if(wpos->chunk_num.chunk != ca->active_chunk.chunk) {
+    status = activate_chunk(base_vfs, &rs->base, ca, wpos->chunk_num);
+    if(status != EVFS_OK) return status;
+  }
 
-    if(status != EVFS_OK)
-      read = status;
+  // Seek into this chunk
+  evfs_file_seek(ca->active_chunk_fh, wpos->offset, EVFS_SEEK_TO);
+
+  *free_space = rs->cfg.chunk_size - wpos->offset;
+  if(ASSERT(*free_space != 0, "No free space to write in chunk")) // This shouldn't happen
+    return EVFS_ERR_CORRUPTION;
+
+  return EVFS_OK;
+}
+
+
+static ptrdiff_t write_container(RotateFile *fil, const uint8_t *cbuf, size_t size) {
+  RotateState *rs = fil->rot_state;
+  ChunkAccess *ca = &fil->acc;
+  Evfs *base_vfs = fil->shim_data->base_vfs;
+
+  if(rs->writer != fil)
+    return EVFS_ERR_DISABLED;
+
+  EvfsFile *new_chunk;
+  ptrdiff_t wrote = 0;
+
+  //DPRINT("ROT: write  %d", size);
+
+  // We may have more than one chunk's worth of data to write
+  while(size > 0) {
+    ChunkPos wpos;
+    evfs_off_t free_space;
+    int status = seek_write_chunk(base_vfs, rs, ca, &wpos, &free_space);
+    if(status != EVFS_OK) return status;
+
+    size_t write_size = MIN((evfs_off_t)size, free_space);
+
+    ptrdiff_t wrote_chunk = evfs_file_write(ca->active_chunk_fh, cbuf, write_size);
+    if(wrote_chunk > 0) {
+      update_chunk_size(rs, wpos.chunk_num, wpos.offset + wrote_chunk);
+      cbuf += wrote_chunk;
+      size -= wrote_chunk;
+      incr_write_pos(ca, wrote_chunk);
+      wrote += wrote_chunk;
+      rs->base.total_size += wrote_chunk;
+      rs->unsynced_size += wrote_chunk;
+    }
 
+    // Check if we have more chunks to write
+    if(size > 0) {
+      status = append_new_chunk(base_vfs, rs, &new_chunk);
+      if(status != EVFS_OK) return status;
+      deactivate_chunk(ca);
+      set_active_chunk(ca, rs->end_chunk, new_chunk);
+    }
   }
 
-  return read;
+  return wrote;
 }
 
 
@@ -938,154 +1766,244 @@ static ptrdiff_t rotate__file_write(EvfsFile *fh, const void *buf, size_t size)
   RotateFile *fil = (RotateFile *)fh;
   uint8_t *cbuf = (uint8_t *)buf;
 
-  ptrdiff_t wrote = 0;
+  ptrdiff_t wrote;
   if(!fil->rot_state) { // This is a normal file
     wrote = fil->base_file->methods->m_write(fil->base_file, cbuf, size);
 
   } else { // Write to rotate container
     RotateState *rs = fil->rot_state;
-    RotateData *shim_data = fil->shim_data;
-    Evfs *base_vfs = shim_data->base_vfs;
-
-    EvfsFile *new_chunk;
-    int status = EVFS_OK;
 
-    //DPRINT("ROT: write  %d", size);
+    STATE_LOCK(rs);
+    wrote = write_container(fil, cbuf, size);
+    if(wrote > 0) {
+      check_sync_policy(rs);
+      notify_handles(rs, fil);
+    }
+    STATE_UNLOCK(rs);
+  }
 
-    // We may have more than one chunk's worth of data to write
-    while(size > 0) {
-      // Our write position depends on whether we're in append mode
-      ChunkPos wpos = get_chunk_pos(rs, cur_write_pos(&rs->base));
+  return wrote;
+}
 
-      // If the chunk doesn't exist we need to create it
-      if(!chunk_exists(base_vfs, &rs->base, wpos.chunk_num, NULL)) {
-        status = append_new_chunk(base_vfs, rs, &new_chunk);
-        if(status != EVFS_OK) return status;
 
-        // Set new active chunk
-        deactivate_chunk(&rs->base);
-        rs->base.active_chunk = wpos.chunk_num;
-        rs->base.active_chunk_fh = new_chunk;
-      }
+#define ROTATE_MAX_IOV  16
 
-      if(wpos.chunk_num.chunk != rs->base.active_chunk.chunk) {
-        status = activate_chunk(base_vfs, &rs->base, wpos.chunk_num);
-        if(status != EVFS_OK) return status;
-      }
+static ptrdiff_t writev_container(RotateFile *fil, const EvfsIOVec *iov, int iovcnt) {
+  RotateState *rs = fil->rot_state;
+  ChunkAccess *ca = &fil->acc;
+  Evfs *base_vfs = fil->shim_data->base_vfs;
 
-      // Seek into this chunk
-      evfs_file_seek(rs->base.active_chunk_fh, wpos.offset, EVFS_SEEK_TO);
+  if(rs->writer != fil)
+    return EVFS_ERR_DISABLED;
 
-      evfs_off_t free_space = rs->cfg.chunk_size - wpos.offset;
-      if(ASSERT(free_space != 0, "No free space to write in chunk")) // This shouldn't happen
-        return EVFS_ERR_CORRUPTION;
+  // Current position within the caller's buffers
+  int cur_iov = 0;
+  size_t cur_off = 0;
+  ptrdiff_t wrote = 0;
 
-      size_t write_size = MIN((evfs_off_t)size, free_space);
+  while(cur_iov < iovcnt) {
+    if(iov[cur_iov].len == cur_off) { // Skip exhausted and empty buffers
+      cur_iov++;
+      cur_off = 0;
+      continue;
+    }
 
-      ptrdiff_t wrote_chunk = evfs_file_write(rs->base.active_chunk_fh, cbuf, write_size);
-      if(wrote_chunk > 0) {
-        cbuf += wrote_chunk;
-        size -= wrote_chunk;
-        incr_write_pos(&rs->base, wrote_chunk);
-        wrote += wrote_chunk;
-        rs->base.total_size += wrote_chunk;
+    ChunkPos wpos;
+    evfs_off_t free_space;
+    int status = seek_write_chunk(base_vfs, rs, ca, &wpos, &free_space);
+    if(status != EVFS_OK)
+      return wrote > 0 ? wrote : status;
+
+    // Gather as many buffers as fit in the free space of this chunk
+    EvfsIOVec chunk_iov[ROTATE_MAX_IOV];
+    int chunk_iovcnt = 0;
+    size_t chunk_size = 0;
+
+    int scan_iov = cur_iov;
+    size_t scan_off = cur_off;
+    while(scan_iov < iovcnt && chunk_iovcnt < ROTATE_MAX_IOV && (evfs_off_t)chunk_size < free_space) {
+      size_t seg_len = MIN((evfs_off_t)(iov[scan_iov].len - scan_off), free_space - (evfs_off_t)chunk_size);
+      if(seg_len > 0) {
+        chunk_iov[chunk_iovcnt].base = (uint8_t *)iov[scan_iov].base + scan_off;
+        chunk_iov[chunk_iovcnt].len  = seg_len;
+        chunk_iovcnt++;
+        chunk_size += seg_len;
       }
 
-      // Check if we have more chunks to write
-      if(size > 0) {
-        status = append_new_chunk(base_vfs, rs, &new_chunk);
-        if(status != EVFS_OK) return status;
-        deactivate_chunk(&rs->base);
-        rs->base.active_chunk = wpos.chunk_num;
-        rs->base.active_chunk_fh = new_chunk;
+      scan_off += seg_len;
+      if(scan_off == iov[scan_iov].len) {
+        scan_iov++;
+        scan_off = 0;
       }
     }
 
-    if(status != EVFS_OK)
-      wrote = status;
+    ptrdiff_t wrote_chunk = evfs_file_writev(ca->active_chunk_fh, chunk_iov, chunk_iovcnt);
+    if(wrote_chunk <= 0)
+      return wrote > 0 ? wrote : wrote_chunk;
+
+    update_chunk_size(rs, wpos.chunk_num, wpos.offset + wrote_chunk);
+    incr_write_pos(ca, wrote_chunk);
+    rs->base.total_size += wrote_chunk;
+    rs->unsynced_size += wrote_chunk;
+    wrote += wrote_chunk;
+
+    if((size_t)wrote_chunk < chunk_size) // Short write
+      break;
+
+    cur_iov = scan_iov;
+    cur_off = scan_off;
   }
 
   return wrote;
 }
 
 
-static int rotate__file_truncate(EvfsFile *fh, evfs_off_t size) {
+static ptrdiff_t rotate__file_writev(EvfsFile *fh, const EvfsIOVec *iov, int iovcnt) {
+  RotateFile *fil = (RotateFile *)fh;
+
+  if(!fil->rot_state) // This is a normal file
+    return evfs_file_writev(fil->base_file, iov, iovcnt);
+
+  RotateState *rs = fil->rot_state;
+
+  STATE_LOCK(rs);
+  ptrdiff_t wrote = writev_container(fil, iov, iovcnt);
+  if(wrote > 0) {
+    check_sync_policy(rs);
+    notify_handles(rs, fil);
+  }
+  STATE_UNLOCK(rs);
+
+  return wrote;
+}
+
+
+// Only plain files are mappable. Rotate containers are split across chunks.
+static int rotate__file_map(EvfsFile *fh, evfs_off_t offset, size_t size, EvfsMapping *map) {
+  RotateFile *fil = (RotateFile *)fh;
+
+  if(fil->rot_state)
+    return EVFS_ERR_NO_SUPPORT;
+
+  return evfs_file_map(fil->base_file, offset, size, map);
+}
+
+
+static int rotate__file_unmap(EvfsFile *fh, EvfsMapping *map) {
+  RotateFile *fil = (RotateFile *)fh;
+
+  return evfs_file_unmap(fil->base_file, map);
+}
+
+
+static int rotate__file_discard(EvfsFile *fh, evfs_off_t offset, evfs_off_t size) {
   RotateFile *fil = (RotateFile *)fh;
 
+  if(fil->rot_state) // Containers are trimmed by whole chunks instead
+    return EVFS_ERR_NO_SUPPORT;
+
+  return evfs_file_discard(fil->base_file, offset, size);
+}
+
+
+static int truncate_container(RotateFile *fil, evfs_off_t size) {
+  RotateState *rs = fil->rot_state;
+  ChunkAccess *ca = &fil->acc;
+  Evfs *base_vfs = fil->shim_data->base_vfs;
+
   int status = EVFS_OK;
 
-  if(!fil->rot_state) { // This is a normal file
-    status = fil->base_file->methods->m_truncate(fil->base_file, size);
+  if(rs->writer != fil)
+    return EVFS_ERR_DISABLED;
 
-  } else { // Rotate container
-    RotateState *rs = fil->rot_state;
-    RotateData *shim_data = fil->shim_data;
-    Evfs *base_vfs = shim_data->base_vfs;
+  if(size >= rs->base.total_size) // Do nothing if larger
+    return EVFS_OK;
 
-    if(size >= rs->base.total_size) // Do nothing if larger
-      return EVFS_OK;
+  // Delete all chunks after truncation point
+
+  // The last chunk may be partially filled so it needs special handling
+  evfs_off_t delete_bytes = rs->base.total_size - size;
+
+  evfs_off_t chunk_size;
+  if(!chunk_exists(rs, rs->end_chunk, &chunk_size)) return EVFS_ERR_CORRUPTION;
+
+  int delete_chunks;
+
+  if(delete_bytes >= chunk_size)
+    delete_chunks = 1 + (delete_bytes - chunk_size) / rs->cfg.chunk_size;
+  else
+    delete_chunks = 0;
+
+  // Remove whole chunks
+  while(delete_chunks) {
+    status = evict_chunk(base_vfs, rs, rs->end_chunk, &chunk_size);
+    if(status != EVFS_OK)
+      break;
 
-    // Delete all chunks after truncation point
+    rs->end_chunk.chunk--;
+    if(rs->end_chunk.chunk < 0) {
+      rs->end_chunk.chunk = rs->cfg.max_chunks - 1;
+      rs->end_chunk.gen = 1 - rs->end_chunk.gen;
+    }
 
-    // The last chunk may be partially filled so it needs special handling
-    evfs_off_t delete_bytes = rs->base.total_size - size;
+    delete_bytes -= chunk_size;
+    delete_chunks--;
+  }
 
-    status = activate_chunk(base_vfs, &rs->base, rs->end_chunk);
+  // Remove any leftover remainder from new end chunk
+  if(delete_bytes > 0 && status == EVFS_OK) {
+    // Truncate new end chunk
+    status = activate_chunk(base_vfs, &rs->base, ca, rs->end_chunk);
     if(status != EVFS_OK) return EVFS_ERR_CORRUPTION;
 
-    evfs_off_t chunk_size = evfs_file_size(rs->base.active_chunk_fh);
-    int delete_chunks;
+    chunk_exists(rs, rs->end_chunk, &chunk_size);
 
-    if(delete_bytes >= chunk_size)
-      delete_chunks = 1 + (delete_bytes - chunk_size) / rs->cfg.chunk_size;
-    else
-      delete_chunks = 0;
+    // We should already have handled full chunks above and only
+    // have a portion less than chunk_size left to truncate.
+    if(ASSERT(delete_bytes < chunk_size, "Truncation error; Excess remainder"))
+      return EVFS_ERR_CORRUPTION;
 
-    // Remove whole chunks
-    while(delete_chunks) {
-      status = evict_chunk(base_vfs, &rs->base, rs->end_chunk, &chunk_size);
-      if(status != EVFS_OK)
-        break;
+    evfs_file_truncate(ca->active_chunk_fh, chunk_size - delete_bytes);
+    set_chunk_info(rs, rs->end_chunk, chunk_size - delete_bytes);
+    rs->base.total_size -= delete_bytes;
+  }
 
-      rs->end_chunk.chunk--;
-      if(rs->end_chunk.chunk < 0) {
-        rs->end_chunk.chunk = rs->cfg.max_chunks - 1;
-        rs->end_chunk.gen = 1 - rs->end_chunk.gen;
-      }
+  if(rs->base.total_size == 0) { // Restart chunk sequence
+    rs->start_chunk = (ChunkId){0,0};
+    rs->end_chunk = (ChunkId){0,0};
+  }
 
-      delete_bytes -= chunk_size;
-      delete_chunks--;
-    }
+  save_cursor(base_vfs, rs);
 
-    // Remove any leftover remainder from new end chunk
-    if(delete_bytes > 0 && status == EVFS_OK) {
-      // Truncate new end chunk
-      status = activate_chunk(base_vfs, &rs->base, rs->end_chunk);
-      if(status != EVFS_OK) return EVFS_ERR_CORRUPTION;
+  // Adjust positions
+  for(RotateFile *cur = rs->handles; cur; cur = cur->next_handle) {
+    if(cur->acc.file_pos > size)
+      cur->acc.file_pos = size;
+  }
 
-      chunk_size = evfs_file_size(rs->base.active_chunk_fh);
+  if(ASSERT(size == rs->base.total_size, "failed truncation: size=%ld  total=%ld", size, rs->base.total_size))
+    status = EVFS_ERR_CORRUPTION;
 
-      // We should already have handled full chunks above and only
-      // have a portion less than chunk_size left to truncate.
-      if(ASSERT(delete_bytes < chunk_size, "Truncation error; Excess remainder"))
-        return EVFS_ERR_CORRUPTION;
+  return status;
+}
 
-      evfs_file_truncate(rs->base.active_chunk_fh, chunk_size - delete_bytes);
-      rs->base.total_size -= delete_bytes;
-    }
 
-    if(rs->base.total_size == 0) { // Restart chunk sequence
-      rs->start_chunk = (ChunkId){0,0};
-      rs->end_chunk = (ChunkId){0,0};
-    }
+static int rotate__file_truncate(EvfsFile *fh, evfs_off_t size) {
+  RotateFile *fil = (RotateFile *)fh;
 
-    // Adjust position
-    if(rs->base.file_pos > size)
-      rs->base.file_pos = size;
+  int status;
+
+  if(!fil->rot_state) { // This is a normal file
+    status = fil->base_file->methods->m_truncate(fil->base_file, size);
 
-    if(ASSERT(size == rs->base.total_size, "failed truncation: size=%ld  total=%ld", size, rs->base.total_size))
-      status = EVFS_ERR_CORRUPTION;
+  } else { // Rotate container
+    RotateState *rs = fil->rot_state;
 
+    STATE_LOCK(rs);
+    status = truncate_container(fil, size);
+    if(status == EVFS_OK)
+      notify_handles(rs, fil);
+    STATE_UNLOCK(rs);
   }
 
   return status;
@@ -1102,9 +2020,9 @@ static int rotate__file_sync(EvfsFile *fh) {
   } else { // Rotate container
     RotateState *rs = fil->rot_state;
 
-    if(rs->base.active_chunk_fh)
-      status = evfs_file_sync(rs->base.active_chunk_fh);
-
+    STATE_LOCK(rs);
+    status = sync_container(rs);
+    STATE_UNLOCK(rs);
   }
 
   return status;
@@ -1120,7 +2038,9 @@ static evfs_off_t rotate__file_size(EvfsFile *fh) {
   } else { // Rotate container
     RotateState *rs = fil->rot_state;
 
+    STATE_LOCK(rs);
     size = rs->base.total_size;
+    STATE_UNLOCK(rs);
   }
 
   return size;
@@ -1140,11 +2060,12 @@ static int rotate__file_seek(EvfsFile *fh, evfs_off_t offset, EvfsSeekDir origin
     evfs_off_t new_off = evfs__absolute_offset(fh, offset, origin);
 
     // Only allow seeks up to the end of the file
+    STATE_LOCK(rs);
     if(new_off <= rs->base.total_size)
-      rs->base.file_pos = new_off;
+      fil->acc.file_pos = new_off;
     else
       status = EVFS_ERR_OVERFLOW;
-
+    STATE_UNLOCK(rs);
   }
 
   return status;
@@ -1161,7 +2082,10 @@ static evfs_off_t rotate__file_tell(EvfsFile *fh) {
 
   } else { // Rotate container
     RotateState *rs = fil->rot_state;
-    pos = rs->base.file_pos;
+
+    STATE_LOCK(rs);
+    pos = fil->acc.file_pos;
+    STATE_UNLOCK(rs);
   }
 
   return pos;
@@ -1179,7 +2103,9 @@ static bool rotate__file_eof(EvfsFile *fh) {
   } else { // Rotate container
     RotateState *rs = fil->rot_state;
 
-    eof = rs->base.file_pos >= rs->base.total_size;
+    STATE_LOCK(rs);
+    eof = fil->acc.file_pos >= rs->base.total_size;
+    STATE_UNLOCK(rs);
   }
 
   return eof;
@@ -1196,7 +2122,11 @@ static const EvfsFileMethods s_rotate_methods = {
   .m_size     = rotate__file_size,
   .m_seek     = rotate__file_seek,
   .m_tell     = rotate__file_tell,
-  .m_eof      = rotate__file_eof
+  .m_eof      = rotate__file_eof,
+  .m_writev   = rotate__file_writev,
+  .m_map      = rotate__file_map,
+  .m_unmap    = rotate__file_unmap,
+  .m_discard  = rotate__file_discard
 };
 
 
@@ -1222,6 +2152,13 @@ static int rotate__dir_read(EvfsDir *dh, EvfsInfo *info) {
   return status;
 }
 
+static int rotate__dir_read_many(EvfsDir *dh, EvfsInfo *entries, int max_entries, char *name_buf,
+                                 size_t name_buf_size) {
+  RotateDir *dir = (RotateDir *)dh;
+
+  return evfs_dir_read_many(dir->base_dir, entries, max_entries, name_buf, name_buf_size);
+}
+
 static int rotate__dir_rewind(EvfsDir *dh) {
   RotateDir *dir = (RotateDir *)dh;
 
@@ -1233,7 +2170,8 @@ static int rotate__dir_rewind(EvfsDir *dh) {
 static const EvfsDirMethods s_rotate_dir_methods = {
   .m_close    = rotate__dir_close,
   .m_read     = rotate__dir_read,
-  .m_rewind   = rotate__dir_rewind
+  .m_rewind   = rotate__dir_rewind,
+  .m_read_many = rotate__dir_read_many
 };
 
 
@@ -1397,6 +2335,11 @@ static int rotate__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
   if(cmd == EVFS_CMD_UNREGISTER) {
 #ifdef USE_ROT_LOCK
       evfs__lock_destroy(&shim_data->buf.buf_lock);
+#endif
+#ifdef EVFS_USE_THREADING
+      stop_flusher(shim_data);
+      evfs__cond_destroy(&shim_data->flusher_wake);
+      evfs__lock_destroy(&shim_data->open_lock);
 #endif
       evfs_free(vfs); // Free this trace VFS
       return EVFS_OK;
@@ -1408,7 +2351,11 @@ static int rotate__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
   case EVFS_CMD_SET_ROTATE_CFG:
     {
       RotateConfig *v = (RotateConfig *)arg;
+      OPEN_LOCK(shim_data);
       status = set_rotate_config(vfs, v);
+      if(status == EVFS_OK)
+        status = start_flusher(shim_data);
+      OPEN_UNLOCK(shim_data);
     }
     break;
 
@@ -1502,6 +2449,32 @@ int evfs_register_rotate(const char *vfs_name, const char *old_vfs_name, RotateC
   }
 #endif
 
+#ifdef EVFS_USE_THREADING
+  if(evfs__lock_init(&shim_data->open_lock) != EVFS_OK) {
+#  ifdef USE_ROT_LOCK
+    evfs__lock_destroy(&shim_data->buf.buf_lock);
+#  endif
+    evfs_free(shim_vfs);
+    THROW(EVFS_ERR_INIT);
+  }
+
+  evfs__cond_init(&shim_data->flusher_wake);
+
+  OPEN_LOCK(shim_data);
+  status = start_flusher(shim_data);
+  OPEN_UNLOCK(shim_data);
+
+  if(status != EVFS_OK) {
+#  ifdef USE_ROT_LOCK
+    evfs__lock_destroy(&shim_data->buf.buf_lock);
+#  endif
+    evfs__cond_destroy(&shim_data->flusher_wake);
+    evfs__lock_destroy(&shim_data->open_lock);
+    evfs_free(shim_vfs);
+    return status;
+  }
+#endif
+
 
   return evfs_register(shim_vfs, default_vfs);
 }
@@ -0,0 +1,675 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Stat cache shim VFS
+
+  This keeps the EvfsInfo returned by stat calls on an underlying VFS in a hash
+  keyed by normalized absolute path. Paths that don't exist are cached as
+  negative entries. Existence checks and evfs_make_path() on already existing
+  trees are then answered without calling the underlying VFS.
+
+  Entries are invalidated by changes passing through the shim. Deleting,
+  renaming, or making a path drops its entry and the entry of its parent
+  directory. Files opened for writing drop their entry on every write,
+  truncate, sync, and close. Changes made outside of EVFS are only seen after
+  the optional TTL passes or EVFS_CMD_CLEAR_LOOKUP_CACHE is sent. The cache is
+  cleared when it holds the configured number of entries.
+------------------------------------------------------------------------------
+*/
+
+#include <string.h>
+
+#include "evfs.h"
+#include "evfs_internal.h"
+#include "evfs/util/dhash.h"
+#include "evfs/shim/shim_stat_cache.h"
+
+
+// Access objects allocated in a single block of memory
+#define NEXT_OBJ(o) (&(o)[1])
+
+#define DEFAULT_MAX_ENTRIES   128
+
+// Open modes that change the file
+#define MODIFY_FLAGS  (EVFS_WRITE | EVFS_OPEN_OR_NEW | EVFS_NO_EXIST | EVFS_OVERWRITE | EVFS_APPEND)
+
+#define IS_MISSING(status)  ((status) == EVFS_ERR_NO_FILE || (status) == EVFS_ERR_NO_PATH)
+
+
+// Stat cache value
+typedef struct StatEntry {
+  char     *path;     // Key data owned by this entry
+  uint64_t  stamp;    // Clock when the entry was made
+  EvfsInfo  info;
+  int       status;   // EVFS_OK or a missing path error
+} StatEntry;
+
+typedef struct StatCacheData {
+  Evfs       *base_vfs;
+  const char *vfs_name;
+  Evfs       *shim_vfs;
+
+  dhash       cache;
+  size_t      max_entries;
+  uint64_t    ttl;
+  EvfsStatCacheClock clock;
+  unsigned    cache_gen;  // Changes whenever an entry is invalidated
+  EvfsLock    cache_lock;
+} StatCacheData;
+
+typedef struct StatCacheFile {
+  EvfsFile       base;
+  StatCacheData *shim_data;
+  EvfsFile      *base_file;
+
+  char           path[EVFS_MAX_PATH]; // Cache key when opened for writing. Empty otherwise
+} StatCacheFile;
+
+
+
+// ******************** Cache management ********************
+
+static void destroy_stat_entry(dhKey key, void *value, void *ctx) {
+  StatEntry *entry = (StatEntry *)value;
+  evfs_class_free(EVFS_ALLOC_INDEX, entry->path);
+}
+
+
+static bool cache_init(StatCacheData *shim_data) {
+  dhConfig hash_cfg = {
+    .init_buckets = 16, // Grows as paths are looked up
+    .value_size   = sizeof(StatEntry),
+
+    .destroy_item = destroy_stat_entry,
+    .gen_hash     = dh_gen_hash_string,
+    .is_equal     = dh_equal_hash_keys_string
+  };
+
+  return dh_init(&shim_data->cache, &hash_cfg, NULL);
+}
+
+
+// Drop all entries. Lock must be held.
+static void cache_clear_locked(StatCacheData *shim_data) {
+  dh_free(&shim_data->cache);
+  shim_data->cache_gen++;
+
+  // Without a hash every lookup misses and no entries are stored
+  if(!cache_init(shim_data))
+    shim_data->cache.buckets = NULL;
+}
+
+
+static void cache_clear(StatCacheData *shim_data) {
+  evfs__lock(&shim_data->cache_lock);
+  cache_clear_locked(shim_data);
+  evfs__unlock(&shim_data->cache_lock);
+}
+
+
+static inline uint64_t cache_now(StatCacheData *shim_data) {
+  return shim_data->clock ? shim_data->clock() : 0;
+}
+
+
+// Cache key for a normalized absolute path
+static dhKey cache_key(StatCacheData *shim_data, const char *abs_path) {
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  // Ignore a trailing separator so "/a/" and "/a" share an entry
+  StringRange root;
+  base_vfs->m_path_root_component(base_vfs, abs_path, &root);
+
+  size_t len = strlen(abs_path);
+  if(len > (size_t)range_size(&root) && abs_path[len-1] == EVFS_DIR_SEP)
+    len--;
+
+  return (dhKey){.data = abs_path, .length = len};
+}
+
+
+// Cache key for the parent directory of a key
+static dhKey parent_key(StatCacheData *shim_data, dhKey key) {
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  StringRange root;
+  base_vfs->m_path_root_component(base_vfs, key.data, &root);
+  size_t root_len = range_size(&root);
+
+  const char *path = key.data;
+  size_t len = key.length;
+  while(len > root_len && path[len-1] != EVFS_DIR_SEP)
+    len--;
+
+  if(len > root_len) // Remove separator
+    len--;
+
+  return (dhKey){.data = key.data, .length = len};
+}
+
+
+static bool cache_lookup(StatCacheData *shim_data, dhKey key, EvfsInfo *info, int *status,
+                         unsigned *gen) {
+  StatEntry *entry;
+  bool found = false;
+
+  evfs__lock(&shim_data->cache_lock);
+  if(shim_data->cache.buckets && dh_lookup_in_place(&shim_data->cache, key, (void **)&entry)) {
+    if(shim_data->ttl == 0 || cache_now(shim_data) - entry->stamp < shim_data->ttl) {
+      *info = entry->info;
+      *status = entry->status;
+      found = true;
+    }
+  }
+  *gen = shim_data->cache_gen;
+  evfs__unlock(&shim_data->cache_lock);
+
+  return found;
+}
+
+
+// Save a stat result unless an entry was invalidated while it was in progress
+static void cache_store(StatCacheData *shim_data, dhKey key, EvfsInfo *info, int status,
+                        unsigned gen) {
+  evfs__lock(&shim_data->cache_lock);
+  if(gen != shim_data->cache_gen || !shim_data->cache.buckets)
+    goto done;
+
+  StatEntry *entry;
+  if(dh_lookup_in_place(&shim_data->cache, key, (void **)&entry)) { // Refresh expired entry
+    entry->stamp = cache_now(shim_data);
+    entry->info = *info;
+    entry->status = status;
+    goto done;
+  }
+
+  if(dh_num_items(&shim_data->cache) >= shim_data->max_entries) {
+    cache_clear_locked(shim_data);
+    if(!shim_data->cache.buckets)
+      goto done;
+  }
+
+  StatEntry new_entry;
+  new_entry.path = evfs_class_malloc(EVFS_ALLOC_INDEX, key.length+1);
+  if(MEM_CHECK(new_entry.path)) goto done; // Entry is just not cached
+
+  memcpy(new_entry.path, key.data, key.length);
+  new_entry.path[key.length] = '\0';
+  new_entry.stamp = cache_now(shim_data);
+  new_entry.info = *info;
+  new_entry.info.name = NULL;
+  new_entry.status = status;
+
+  key.data = new_entry.path;
+  if(!dh_insert(&shim_data->cache, key, &new_entry))
+    evfs_class_free(EVFS_ALLOC_INDEX, new_entry.path);
+
+done:
+  evfs__unlock(&shim_data->cache_lock);
+}
+
+
+// Drop the entry for a path and optionally its parent directory
+static void cache_invalidate(StatCacheData *shim_data, dhKey key, bool parent) {
+  StatEntry entry;
+
+  evfs__lock(&shim_data->cache_lock);
+  shim_data->cache_gen++;
+
+  if(shim_data->cache.buckets) {
+    if(dh_remove(&shim_data->cache, key, &entry))
+      evfs_class_free(EVFS_ALLOC_INDEX, entry.path);
+
+    if(parent && dh_remove(&shim_data->cache, parent_key(shim_data, key), &entry))
+      evfs_class_free(EVFS_ALLOC_INDEX, entry.path);
+  }
+
+  evfs__unlock(&shim_data->cache_lock);
+}
+
+
+// Invalidate the entry for a file opened for writing
+static void invalidate_file(StatCacheFile *fil) {
+  StatCacheData *shim_data = fil->shim_data;
+
+  if(fil->path[0] != '\0')
+    cache_invalidate(shim_data, (dhKey){.data = fil->path, .length = strlen(fil->path)}, false);
+}
+
+
+
+// ******************** File access methods ********************
+
+static int stat_cache__file_ctrl(EvfsFile *fh, int cmd, void *arg) {
+  StatCacheFile *fil = (StatCacheFile *)fh;
+
+  return fil->base_file->methods->m_ctrl(fil->base_file, cmd, arg);
+}
+
+
+static int stat_cache__file_close(EvfsFile *fh) {
+  StatCacheFile *fil = (StatCacheFile *)fh;
+
+  int status = fil->base_file->methods->m_close(fil->base_file);
+  invalidate_file(fil); // Some filesystems only update metadata on close
+
+  if(status == EVFS_OK) {
+    fil->base.methods = NULL;
+  }
+
+  return status;
+}
+
+
+static ptrdiff_t stat_cache__file_read(EvfsFile *fh, void *buf, size_t size) {
+  StatCacheFile *fil = (StatCacheFile *)fh;
+
+  return fil->base_file->methods->m_read(fil->base_file, buf, size);
+}
+
+
+static ptrdiff_t stat_cache__file_write(EvfsFile *fh, const void *buf, size_t size) {
+  StatCacheFile *fil = (StatCacheFile *)fh;
+
+  ptrdiff_t wrote = fil->base_file->methods->m_write(fil->base_file, buf, size);
+  invalidate_file(fil);
+
+  return wrote;
+}
+
+
+static int stat_cache__file_truncate(EvfsFile *fh, evfs_off_t size) {
+  StatCacheFile *fil = (StatCacheFile *)fh;
+
+  int status = fil->base_file->methods->m_truncate(fil->base_file, size);
+  invalidate_file(fil);
+
+  return status;
+}
+
+
+static int stat_cache__file_sync(EvfsFile *fh) {
+  StatCacheFile *fil = (StatCacheFile *)fh;
+
+  int status = fil->base_file->methods->m_sync(fil->base_file);
+  invalidate_file(fil);
+
+  return status;
+}
+
+
+static evfs_off_t stat_cache__file_size(EvfsFile *fh) {
+  StatCacheFile *fil = (StatCacheFile *)fh;
+
+  return fil->base_file->methods->m_size(fil->base_file);
+}
+
+
+static int stat_cache__file_seek(EvfsFile *fh, evfs_off_t offset, EvfsSeekDir origin) {
+  StatCacheFile *fil = (StatCacheFile *)fh;
+
+  return fil->base_file->methods->m_seek(fil->base_file, offset, origin);
+}
+
+
+static evfs_off_t stat_cache__file_tell(EvfsFile *fh) {
+  StatCacheFile *fil = (StatCacheFile *)fh;
+
+  return fil->base_file->methods->m_tell(fil->base_file);
+}
+
+
+static bool stat_cache__file_eof(EvfsFile *fh) {
+  StatCacheFile *fil = (StatCacheFile *)fh;
+
+  return fil->base_file->methods->m_eof(fil->base_file);
+}
+
+
+static ptrdiff_t stat_cache__file_read_at(EvfsFile *fh, void *buf, size_t size, evfs_off_t offset) {
+  StatCacheFile *fil = (StatCacheFile *)fh;
+
+  return evfs_file_read_at(fil->base_file, buf, size, offset);
+}
+
+
+static ptrdiff_t stat_cache__file_write_at(EvfsFile *fh, const void *buf, size_t size, evfs_off_t offset) {
+  StatCacheFile *fil = (StatCacheFile *)fh;
+
+  ptrdiff_t wrote = evfs_file_write_at(fil->base_file, buf, size, offset);
+  invalidate_file(fil);
+
+  return wrote;
+}
+
+
+static ptrdiff_t stat_cache__file_readv(EvfsFile *fh, const EvfsIOVec *iov, int iovcnt) {
+  StatCacheFile *fil = (StatCacheFile *)fh;
+
+  return evfs_file_readv(fil->base_file, iov, iovcnt);
+}
+
+
+static ptrdiff_t stat_cache__file_writev(EvfsFile *fh, const EvfsIOVec *iov, int iovcnt) {
+  StatCacheFile *fil = (StatCacheFile *)fh;
+
+  ptrdiff_t wrote = evfs_file_writev(fil->base_file, iov, iovcnt);
+  invalidate_file(fil);
+
+  return wrote;
+}
+
+
+static int stat_cache__file_map(EvfsFile *fh, evfs_off_t offset, size_t size, EvfsMapping *map) {
+  StatCacheFile *fil = (StatCacheFile *)fh;
+
+  return evfs_file_map(fil->base_file, offset, size, map);
+}
+
+
+static int stat_cache__file_unmap(EvfsFile *fh, EvfsMapping *map) {
+  StatCacheFile *fil = (StatCacheFile *)fh;
+
+  return evfs_file_unmap(fil->base_file, map);
+}
+
+
+static int stat_cache__file_discard(EvfsFile *fh, evfs_off_t offset, evfs_off_t size) {
+  StatCacheFile *fil = (StatCacheFile *)fh;
+
+  return evfs_file_discard(fil->base_file, offset, size);
+}
+
+
+static const EvfsFileMethods s_stat_cache_methods = {
+  .m_ctrl     = stat_cache__file_ctrl,
+  .m_close    = stat_cache__file_close,
+  .m_read     = stat_cache__file_read,
+  .m_write    = stat_cache__file_write,
+  .m_truncate = stat_cache__file_truncate,
+  .m_sync     = stat_cache__file_sync,
+  .m_size     = stat_cache__file_size,
+  .m_seek     = stat_cache__file_seek,
+  .m_tell     = stat_cache__file_tell,
+  .m_eof      = stat_cache__file_eof,
+  .m_read_at  = stat_cache__file_read_at,
+  .m_write_at = stat_cache__file_write_at,
+  .m_readv    = stat_cache__file_readv,
+  .m_writev   = stat_cache__file_writev,
+  .m_map      = stat_cache__file_map,
+  .m_unmap    = stat_cache__file_unmap,
+  .m_discard  = stat_cache__file_discard
+};
+
+
+// ******************** FS access methods ********************
+
+static int stat_cache__open(Evfs *vfs, const char *path, EvfsFile *fh, int flags) {
+  StatCacheFile *fil = (StatCacheFile *)fh;
+  StatCacheData *shim_data = (StatCacheData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  fh->methods = NULL;
+  fil->shim_data = shim_data;
+  fil->base_file = (EvfsFile *)NEXT_OBJ(fil);  // We have two objects allocated together [StatCacheFile][<base VFS file size>]
+  fil->path[0] = '\0';
+
+  MAKE_ABS(path, abs_path);
+
+  if(flags & MODIFY_FLAGS) {
+    dhKey key = cache_key(shim_data, abs_path);
+
+    if(key.length < sizeof(fil->path)) {
+      memcpy(fil->path, key.data, key.length);
+      fil->path[key.length] = '\0';
+    }
+
+    // The file and its parent directory can change when the file is created
+    cache_invalidate(shim_data, key, /*parent*/ true);
+  }
+
+  int status = base_vfs->m_open(base_vfs, abs_path, fil->base_file, flags);
+
+  if(status == EVFS_OK && fil->path[0] == '\0' && (flags & MODIFY_FLAGS)) {
+    // Path is too long to invalidate individually
+    cache_clear(shim_data);
+  }
+
+  FREE_ABS(abs_path);
+
+  if(status == EVFS_OK) {
+    // Add methods to make this functional
+    if(fil->base_file->methods) {
+      fh->methods = &s_stat_cache_methods;
+    } else {
+      status = EVFS_ERR_INIT;
+    }
+  }
+
+  return status;
+}
+
+
+static int stat_cache__stat(Evfs *vfs, const char *path, EvfsInfo *info) {
+  StatCacheData *shim_data = (StatCacheData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+  unsigned gen;
+  int status;
+
+  MAKE_ABS(path, abs_path);
+
+  dhKey key = cache_key(shim_data, abs_path);
+  if(!cache_lookup(shim_data, key, info, &status, &gen)) {
+    status = base_vfs->m_stat(base_vfs, abs_path, info);
+
+    if(status == EVFS_OK || IS_MISSING(status))
+      cache_store(shim_data, key, info, status, gen);
+  }
+
+  FREE_ABS(abs_path);
+  return status;
+}
+
+
+static int stat_cache__delete(Evfs *vfs, const char *path) {
+  StatCacheData *shim_data = (StatCacheData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  MAKE_ABS(path, abs_path);
+
+  int status = base_vfs->m_delete(base_vfs, abs_path);
+  cache_invalidate(shim_data, cache_key(shim_data, abs_path), /*parent*/ true);
+
+  FREE_ABS(abs_path);
+  return status;
+}
+
+
+static int stat_cache__rename(Evfs *vfs, const char *old_path, const char *new_path) {
+  StatCacheData *shim_data = (StatCacheData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  MAKE_ABS(old_path, abs_old_path);
+
+  EvfsAbsPath abs_new_path;
+  int status = evfs__path_resolve(vfs, new_path, &abs_new_path);
+  if(status != EVFS_OK) {
+    FREE_ABS(abs_old_path);
+    return status;
+  }
+
+  status = base_vfs->m_rename(base_vfs, abs_old_path, abs_new_path.path);
+
+  EvfsInfo info;
+  if(status == EVFS_OK && base_vfs->m_stat(base_vfs, abs_new_path.path, &info) == EVFS_OK &&
+      (info.type & EVFS_FILE_DIR)) {
+    // Every cached path below a renamed directory is stale
+    cache_clear(shim_data);
+  } else {
+    cache_invalidate(shim_data, cache_key(shim_data, abs_old_path), /*parent*/ true);
+    cache_invalidate(shim_data, cache_key(shim_data, abs_new_path.path), /*parent*/ true);
+  }
+
+  evfs__path_release(&abs_new_path);
+  FREE_ABS(abs_old_path);
+  return status;
+}
+
+
+static int stat_cache__make_dir(Evfs *vfs, const char *path) {
+  StatCacheData *shim_data = (StatCacheData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  MAKE_ABS(path, abs_path);
+
+  int status = base_vfs->m_make_dir(base_vfs, abs_path);
+  cache_invalidate(shim_data, cache_key(shim_data, abs_path), /*parent*/ true);
+
+  FREE_ABS(abs_path);
+  return status;
+}
+
+
+static int stat_cache__open_dir(Evfs *vfs, const char *path, EvfsDir *dh) {
+  StatCacheData *shim_data = (StatCacheData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  // No need to wrap directory objects
+  return base_vfs->m_open_dir(base_vfs, path, dh);
+}
+
+
+static int stat_cache__get_cur_dir(Evfs *vfs, StringRange *cur_dir) {
+  StatCacheData *shim_data = (StatCacheData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_get_cur_dir(base_vfs, cur_dir);
+}
+
+
+static int stat_cache__set_cur_dir(Evfs *vfs, const char *path) {
+  StatCacheData *shim_data = (StatCacheData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_set_cur_dir(base_vfs, path);
+}
+
+
+static int stat_cache__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
+  StatCacheData *shim_data = (StatCacheData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  switch(cmd) {
+    // We need special handling for EVFS_CMD_UNREGISTER.
+    // It can't pass through since we need to deallocate VFSs in the proper sequence
+    // to avoid corrupting the registered VFS linked list.
+    case EVFS_CMD_UNREGISTER:
+      dh_free(&shim_data->cache);
+      evfs__lock_destroy(&shim_data->cache_lock);
+      evfs_free(vfs); // Free this stat cache VFS
+      return EVFS_OK; break;
+
+    case EVFS_CMD_CLEAR_LOOKUP_CACHE:
+      cache_clear(shim_data);
+      return EVFS_OK; break;
+
+    default: // Everything else passes to the underlying VFS
+      return base_vfs->m_vfs_ctrl(base_vfs, cmd, arg);
+      break;
+  }
+}
+
+
+static bool stat_cache__path_root_component(Evfs *vfs, const char *path, StringRange *root) {
+  StatCacheData *shim_data = (StatCacheData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_path_root_component(base_vfs, path, root);
+}
+
+
+/*
+Register a stat cache filesystem shim
+
+Args:
+  vfs_name:      Name of new shim
+  old_vfs_name:  Existing VFS to wrap with shim
+  cfg:           Cache configuration. Use NULL for default settings
+  default_vfs:   Make this the default VFS when true
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_register_stat_cache(const char *vfs_name, const char *old_vfs_name, StatCacheConfig *cfg,
+                             bool default_vfs) {
+  if(PTR_CHECK(vfs_name) || PTR_CHECK(old_vfs_name)) return EVFS_ERR_BAD_ARG;
+  if(cfg && cfg->ttl > 0 && !cfg->clock) return EVFS_ERR_BAD_ARG;
+
+  Evfs *base_vfs, *shim_vfs;
+  StatCacheData *shim_data;
+
+  base_vfs = evfs_find_vfs(old_vfs_name);
+  if(PTR_CHECK(base_vfs)) return EVFS_ERR_NO_VFS;
+
+  // Construct a new VFS
+  // We have three objects allocated together [Evfs][StatCacheData][char[]]
+  size_t shim_size = sizeof(*shim_vfs) + sizeof(*shim_data) + strlen(vfs_name)+1;
+  shim_vfs = evfs_malloc(shim_size);
+  if(MEM_CHECK(shim_vfs)) return EVFS_ERR_ALLOC;
+
+  memset(shim_vfs, 0, shim_size);
+
+  shim_data = (StatCacheData *)NEXT_OBJ(shim_vfs);
+
+  shim_vfs->vfs_name = (char *)NEXT_OBJ(shim_data);
+  strcpy((char *)shim_vfs->vfs_name, vfs_name);
+
+  shim_data->base_vfs = base_vfs;
+  shim_data->vfs_name = shim_vfs->vfs_name;
+  shim_data->shim_vfs = shim_vfs;
+  shim_data->max_entries = DEFAULT_MAX_ENTRIES;
+
+  if(cfg) {
+    if(cfg->max_entries > 0)
+      shim_data->max_entries = cfg->max_entries;
+    shim_data->ttl = cfg->ttl;
+    shim_data->clock = cfg->clock;
+  }
+
+  if(!cache_init(shim_data)) {
+    evfs_free(shim_vfs);
+    return EVFS_ERR_ALLOC;
+  }
+
+  if(evfs__lock_init(&shim_data->cache_lock) != EVFS_OK) {
+    dh_free(&shim_data->cache);
+    evfs_free(shim_vfs);
+    return EVFS_ERR_INIT;
+  }
+
+  shim_vfs->vfs_file_size = sizeof(StatCacheFile) + base_vfs->vfs_file_size;
+  shim_vfs->vfs_dir_size = base_vfs->vfs_dir_size;
+  shim_vfs->fs_data = shim_data;
+
+  shim_vfs->m_open = stat_cache__open;
+  shim_vfs->m_stat = stat_cache__stat;
+  shim_vfs->m_delete = stat_cache__delete;
+  shim_vfs->m_rename = stat_cache__rename;
+  shim_vfs->m_make_dir = stat_cache__make_dir;
+  shim_vfs->m_open_dir = stat_cache__open_dir;
+  shim_vfs->m_get_cur_dir = stat_cache__get_cur_dir;
+  shim_vfs->m_set_cur_dir = stat_cache__set_cur_dir;
+  shim_vfs->m_vfs_ctrl = stat_cache__vfs_ctrl;
+
+  shim_vfs->m_path_root_component = stat_cache__path_root_component;
+
+  return evfs_register(shim_vfs, default_vfs);
+}
@@ -0,0 +1,1065 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Striping shim VFS
+
+This shim spreads files across several member VFSs so that transfers can use
+the bandwidth of more than one device. A striped file is divided into stripes
+of stripe_size bytes. Stripe k is stored on member k % N where N is the number
+of members. Each member holds its stripes back to back so a member file is
+1/N of the logical file.
+
+Like the rotate shim, a striped file is represented as a container directory.
+The same container path is created on every member. Each holds a geometry
+file recording the stripe size, the member count, and the index of the member
+along with a data file for that member's stripes. The stripe size of existing
+files is read from their geometry so it can be changed for new files. The
+member list must stay the same and in the same order. Opening a container on
+a different member set returns EVFS_ERR_CORRUPTION.
+
+The first member holds the directory tree used for listings and stats.
+Containers are reported as regular files with their logical size. Other
+regular files on the first member can be accessed through the shim but
+aren't striped. Directories are created on all members.
+
+The logical size is derived from the size of each member file. Data never
+written in a sparse file reads as zeros. Handles refresh their size when a
+read reaches the end of the file so they see data appended by other handles.
+
+When threading is enabled and StripeConfig.io_threads is nonzero, transfers
+spanning more than one stripe are split into per-stripe operations submitted
+to an async queue so that all members work in parallel. One operation at a
+time is in flight on each member file. The queue is shared by all handles so
+parallel transfers are run one at a time.
+
+------------------------------------------------------------------------------
+*/
+
+#include <string.h>
+
+#include "evfs.h"
+#include "evfs_internal.h"
+#include "evfs/async_io.h"
+#include "evfs/shim/shim_stripe.h"
+
+
+// Access objects allocated in a single block of memory
+#define NEXT_OBJ(o) (&(o)[1])
+
+
+#define STRIPE_GEOMETRY_FILE      "geom.dat"
+#define STRIPE_DATA_FILE          "data.stp"
+
+#define EVFS_MULTI_MAGIC          0x53465645
+#define EVFS_MULTI_STRIPE_TYPE    0x02
+
+#define CUR_MULTI_STRIPE_VERSION  1
+
+#define DEFAULT_STRIPE_SIZE       (64 * 1024UL)
+
+// Protect against stripes too small and thrashing the members
+#define MIN_STRIPE_SIZE           512
+
+// MSVC
+#ifdef _MSC_VER
+#  define PACKED_BEGIN   __pragma(pack(push, 1))
+#  define PACKED_END     __pragma(pack(pop))
+
+// IAR / Keil
+#elif defined __IAR_SYSTEMS_ICC__ || defined __UVISION_VERSION
+#  define PACKED_BEGIN   __packed
+#  define PACKED_END
+
+// GCC/Clang (C11 fallback)
+#else
+#  define PACKED_BEGIN   _Pragma("pack(push, 1)")
+#  define PACKED_END     _Pragma("pack(pop)")
+#endif
+
+
+// ******************** Structs for container files ********************
+
+PACKED_BEGIN
+struct MultipartHeader {
+  uint32_t  magic;
+  uint8_t   type;
+  uint8_t   version;
+  uint16_t  reserved;
+};
+PACKED_END
+
+typedef struct MultipartHeader MultipartHeader;
+
+// Config data written to geom.dat
+PACKED_BEGIN
+struct StripeGeometry {
+  uint32_t      stripe_size;
+  uint8_t       num_members;
+  uint8_t       member_index;
+  uint16_t      reserved;
+};
+PACKED_END
+
+typedef struct StripeGeometry StripeGeometry;
+
+
+
+// ******************** Shim structs ********************
+
+typedef struct StripeData {
+  Evfs           *members[EVFS_STRIPE_MAX_MEMBERS];
+  unsigned        num_members;
+  const char     *vfs_name;
+  Evfs           *shim_vfs;
+
+  uint32_t        stripe_size;  // Stripe size for new containers
+
+  EvfsAsyncQueue *queue;        // Queue for parallel transfers or NULL
+  EvfsLock        io_lock;      // Only one transfer reaps from the queue at a time
+} StripeData;
+
+typedef struct StripeFile {
+  EvfsFile        base;
+  StripeData     *shim_data;
+  EvfsFile       *members[EVFS_STRIPE_MAX_MEMBERS]; // Data file on each member
+  unsigned        num_open;     // Open member files. Regular files only have one
+
+  uint32_t        stripe_size;
+  evfs_off_t      size;
+  evfs_off_t      pos;
+
+  bool            writable;
+  bool            append;
+  bool            eof;
+} StripeFile;
+
+typedef struct StripeDir {
+  EvfsDir         base;
+  StripeData     *shim_data;
+  EvfsDir        *base_dir;
+  char            path[EVFS_MAX_PATH]; // Needed to find containers in the listing
+} StripeDir;
+
+
+
+// ******************** Containers ********************
+
+static int join_container_path(Evfs *member, const char *path, const char *file, char *joined) {
+  StringRange joined_r;
+  range_init(&joined_r, joined, EVFS_MAX_PATH);
+
+  int status = evfs_vfs_path_join_str(member, path, file, &joined_r);
+  return status == EVFS_ERR_OVERFLOW ? EVFS_ERR_TOO_LONG : status;
+}
+
+
+static int read_geometry(Evfs *member, const char *path, StripeGeometry *geom) {
+  char joined[EVFS_MAX_PATH];
+  int status = join_container_path(member, path, STRIPE_GEOMETRY_FILE, joined);
+  if(status != EVFS_OK) return status;
+
+  EvfsFile *dat_fh;
+  status = evfs_vfs_open(member, joined, &dat_fh, EVFS_READ);
+  if(status != EVFS_OK) return status;
+
+  MultipartHeader hdr;
+  ptrdiff_t rval = evfs_file_read(dat_fh, &hdr, sizeof(hdr));
+  if(rval == sizeof(hdr))
+    rval = evfs_file_read(dat_fh, geom, sizeof(*geom));
+
+  evfs_file_close(dat_fh);
+
+  if(rval < 0) return rval;
+
+  if(rval != sizeof(*geom) || hdr.magic != EVFS_MULTI_MAGIC || hdr.type != EVFS_MULTI_STRIPE_TYPE ||
+      hdr.version != CUR_MULTI_STRIPE_VERSION || geom->stripe_size < MIN_STRIPE_SIZE)
+    return EVFS_ERR_CORRUPTION;
+
+  return EVFS_OK;
+}
+
+
+static bool is_stripe_container(Evfs *member, const char *path) {
+  // Container directory has to exist
+  EvfsInfo info;
+  int status = member->m_stat(member, path, &info);
+
+  if(status != EVFS_OK || !(info.type & EVFS_FILE_DIR))
+    return false;
+
+  // Geometry file needs to exist
+  char joined[EVFS_MAX_PATH];
+  if(join_container_path(member, path, STRIPE_GEOMETRY_FILE, joined) != EVFS_OK)
+    return false;
+
+  status = member->m_stat(member, joined, &info);
+  return status == EVFS_OK;
+}
+
+
+static int init_stripe_container(StripeData *shim_data, const char *path) {
+  char joined[EVFS_MAX_PATH];
+
+  for(unsigned i = 0; i < shim_data->num_members; i++) {
+    Evfs *member = shim_data->members[i];
+
+    // Directory may be left over from an interrupted create
+    int status = member->m_make_dir(member, path);
+    if(status != EVFS_OK && status != EVFS_ERR_EXISTS) return status;
+
+    status = join_container_path(member, path, STRIPE_GEOMETRY_FILE, joined);
+    if(status != EVFS_OK) return status;
+
+    EvfsFile *dat_fh;
+    status = evfs_vfs_open(member, joined, &dat_fh, EVFS_WRITE | EVFS_OVERWRITE);
+    if(status != EVFS_OK) return status;
+
+    MultipartHeader hdr = {
+      .magic   = EVFS_MULTI_MAGIC,
+      .type    = EVFS_MULTI_STRIPE_TYPE,
+      .version = CUR_MULTI_STRIPE_VERSION
+    };
+
+    StripeGeometry geom = {
+      .stripe_size  = shim_data->stripe_size,
+      .num_members  = shim_data->num_members,
+      .member_index = i
+    };
+
+    ptrdiff_t rval = evfs_file_write(dat_fh, &hdr, sizeof(hdr));
+    if(rval == sizeof(hdr))
+      rval = evfs_file_write(dat_fh, &geom, sizeof(geom));
+
+    evfs_file_close(dat_fh);
+
+    if(rval != sizeof(geom))
+      return rval < 0 ? rval : EVFS_ERR_IO;
+
+    // Empty data file
+    status = join_container_path(member, path, STRIPE_DATA_FILE, joined);
+    if(status != EVFS_OK) return status;
+
+    status = evfs_vfs_open(member, joined, &dat_fh, EVFS_WRITE | EVFS_OVERWRITE);
+    if(status != EVFS_OK) return status;
+
+    evfs_file_close(dat_fh);
+  }
+
+  return EVFS_OK;
+}
+
+
+static int clear_container(Evfs *member, const char *path) {
+  char joined[EVFS_MAX_PATH];
+
+  if(join_container_path(member, path, STRIPE_DATA_FILE, joined) == EVFS_OK)
+    member->m_delete(member, joined);
+
+  if(join_container_path(member, path, STRIPE_GEOMETRY_FILE, joined) == EVFS_OK)
+    member->m_delete(member, joined);
+
+  return member->m_delete(member, path);
+}
+
+
+// Logical size implied by the size of one member's data file
+static evfs_off_t logical_end(evfs_off_t local_size, uint32_t stripe_size, unsigned member,
+                              unsigned num_members) {
+  if(local_size <= 0)
+    return 0;
+
+  evfs_off_t last = local_size - 1;
+  evfs_off_t stripe = (last / stripe_size) * num_members + member;
+  return stripe * stripe_size + last % stripe_size + 1;
+}
+
+
+// Size of one member's data file holding the start of a logical file
+static evfs_off_t local_size(evfs_off_t logical_size, uint32_t stripe_size, unsigned member,
+                             unsigned num_members) {
+  evfs_off_t full_stripes = logical_size / stripe_size;
+  evfs_off_t size = (full_stripes / num_members) * stripe_size;
+  unsigned last_member = full_stripes % num_members;
+
+  if(member < last_member)
+    size += stripe_size;
+  else if(member == last_member)
+    size += logical_size % stripe_size;
+
+  return size;
+}
+
+
+static int container_size(StripeData *shim_data, const char *path, evfs_off_t *size) {
+  StripeGeometry geom;
+  int status = read_geometry(shim_data->members[0], path, &geom);
+  if(status != EVFS_OK) return status;
+
+  *size = 0;
+  char joined[EVFS_MAX_PATH];
+
+  for(unsigned i = 0; i < shim_data->num_members; i++) {
+    Evfs *member = shim_data->members[i];
+    EvfsInfo info;
+
+    status = join_container_path(member, path, STRIPE_DATA_FILE, joined);
+    if(status == EVFS_OK)
+      status = member->m_stat(member, joined, &info);
+    if(status != EVFS_OK) return status;
+
+    *size = MAX(*size, logical_end(info.size, geom.stripe_size, i, shim_data->num_members));
+  }
+
+  return EVFS_OK;
+}
+
+
+static void close_members(StripeFile *fil) {
+  for(unsigned i = 0; i < fil->num_open; i++) {
+    evfs_file_close(fil->members[i]);
+    fil->members[i] = NULL;
+  }
+
+  fil->num_open = 0;
+}
+
+
+// Appends are handled by the shim. Members open for update so they aren't truncated.
+static inline int append_flags(int flags) {
+  if(flags & EVFS_APPEND)
+    flags = (flags & ~EVFS_APPEND) | EVFS_READ | EVFS_WRITE;
+
+  return flags;
+}
+
+
+static int open_stripe_container(StripeFile *fil, const char *path, int flags) {
+  StripeData *shim_data = fil->shim_data;
+  char joined[EVFS_MAX_PATH];
+
+  // A new container already exists
+  int data_flags = append_flags(flags) & ~EVFS_NO_EXIST;
+
+  for(unsigned i = 0; i < shim_data->num_members; i++) {
+    Evfs *member = shim_data->members[i];
+
+    StripeGeometry geom;
+    int status = read_geometry(member, path, &geom);
+
+    // Every member has to agree on the stripe layout
+    if(status == EVFS_OK && (geom.num_members != shim_data->num_members || geom.member_index != i ||
+        (i > 0 && geom.stripe_size != fil->stripe_size)))
+      status = EVFS_ERR_CORRUPTION;
+
+    if(status == EVFS_OK) {
+      fil->stripe_size = geom.stripe_size;
+      status = join_container_path(member, path, STRIPE_DATA_FILE, joined);
+    }
+
+    if(status == EVFS_OK)
+      status = evfs_vfs_open(member, joined, &fil->members[i], data_flags);
+
+    if(status != EVFS_OK) {
+      close_members(fil);
+      return status;
+    }
+
+    fil->num_open++;
+  }
+
+  return EVFS_OK;
+}
+
+
+
+// ******************** File data ********************
+
+static void refresh_size(StripeFile *fil) {
+  fil->size = 0;
+
+  for(unsigned i = 0; i < fil->num_open; i++) {
+    evfs_off_t size = evfs_file_size(fil->members[i]);
+    fil->size = MAX(fil->size, logical_end(size, fil->stripe_size, i, fil->num_open));
+  }
+}
+
+
+// Find the part of a transfer in a single stripe
+static unsigned locate_segment(StripeFile *fil, evfs_off_t offset, size_t max_len,
+                               evfs_off_t *local_offset, size_t *seg_len) {
+  evfs_off_t stripe = offset / fil->stripe_size;
+  size_t stripe_off = offset % fil->stripe_size;
+
+  *local_offset = (stripe / fil->num_open) * fil->stripe_size + stripe_off;
+  *seg_len = MIN(max_len, fil->stripe_size - stripe_off);
+
+  return stripe % fil->num_open;
+}
+
+
+static ptrdiff_t transfer_parallel(StripeFile *fil, uint8_t *buf, size_t size, evfs_off_t offset,
+                                   int kind) {
+  StripeData *shim_data = fil->shim_data;
+  EvfsCompletion events[EVFS_STRIPE_MAX_MEMBERS];
+  bool busy[EVFS_STRIPE_MAX_MEMBERS] = {0};
+  unsigned in_flight = 0;
+  size_t submitted = 0;
+  ptrdiff_t status = EVFS_OK;
+
+  evfs__lock(&shim_data->io_lock);
+
+  while(in_flight > 0 || (submitted < size && status == EVFS_OK)) {
+    // Submit the next stripe when its member is idle
+    if(submitted < size && status == EVFS_OK) {
+      evfs_off_t local_offset;
+      size_t seg_len;
+      unsigned m = locate_segment(fil, offset + submitted, size - submitted, &local_offset, &seg_len);
+
+      if(!busy[m]) {
+        // The buffer position identifies the segment when it completes
+        uint8_t *seg = &buf[submitted];
+        int rval;
+        if(kind == EVFS_ASYNC_READ)
+          rval = evfs_file_submit_read(shim_data->queue, fil->members[m], seg, seg_len, local_offset, seg);
+        else
+          rval = evfs_file_submit_write(shim_data->queue, fil->members[m], seg, seg_len, local_offset, seg);
+
+        if(rval == EVFS_OK) {
+          busy[m] = true;
+          in_flight++;
+          submitted += seg_len;
+        } else {
+          status = rval;
+        }
+        continue;
+      }
+    }
+
+    int count = evfs_async_reap(shim_data->queue, events, COUNT_OF(events), /*wait*/ true);
+    if(count <= 0) { // Nothing left in flight
+      if(count < 0 && status == EVFS_OK)
+        status = count;
+      break;
+    }
+
+    for(int i = 0; i < count; i++) {
+      size_t seg_pos = (uint8_t *)events[i].user_data - buf;
+      evfs_off_t local_offset;
+      size_t seg_len;
+      unsigned m = locate_segment(fil, offset + seg_pos, size - seg_pos, &local_offset, &seg_len);
+
+      busy[m] = false;
+      in_flight--;
+
+      ptrdiff_t result = events[i].result;
+      if(result < 0) {
+        if(status == EVFS_OK)
+          status = result;
+
+      } else if((size_t)result < seg_len) {
+        if(kind == EVFS_ASYNC_READ) // Holes in sparse files
+          memset(&buf[seg_pos + result], 0, seg_len - result);
+        else if(status == EVFS_OK)
+          status = EVFS_ERR_IO;
+      }
+    }
+  }
+
+  evfs__unlock(&shim_data->io_lock);
+
+  return status == EVFS_OK ? (ptrdiff_t)size : status;
+}
+
+
+static ptrdiff_t transfer(StripeFile *fil, uint8_t *buf, size_t size, evfs_off_t offset, int kind) {
+  if(fil->shim_data->queue && fil->num_open > 1 && size > fil->stripe_size)
+    return transfer_parallel(fil, buf, size, offset, kind);
+
+  size_t done = 0;
+  while(done < size) {
+    evfs_off_t local_offset;
+    size_t seg_len;
+    unsigned m = locate_segment(fil, offset + done, size - done, &local_offset, &seg_len);
+
+    ptrdiff_t rval;
+    if(kind == EVFS_ASYNC_READ)
+      rval = evfs_file_read_at(fil->members[m], &buf[done], seg_len, local_offset);
+    else
+      rval = evfs_file_write_at(fil->members[m], &buf[done], seg_len, local_offset);
+
+    if(rval < 0)
+      return done > 0 ? (ptrdiff_t)done : rval;
+
+    if((size_t)rval < seg_len) {
+      if(kind == EVFS_ASYNC_READ) // Holes in sparse files
+        memset(&buf[done + rval], 0, seg_len - rval);
+      else
+        return done + rval;
+    }
+
+    done += seg_len;
+  }
+
+  return done;
+}
+
+
+
+// ******************** File access methods ********************
+
+static int stripe__file_ctrl(EvfsFile *fh, int cmd, void *arg) {
+  StripeFile *fil = (StripeFile *)fh;
+
+#ifdef EVFS_USE_IO_STATS
+  // Keep the counters for this handle that evfs_file_ctrl() already filled in
+  if(cmd == EVFS_CMD_GET_IO_STATS)
+    return fil->members[0]->methods->m_ctrl(fil->members[0], cmd, arg);
+#endif
+
+  return evfs_file_ctrl(fil->members[0], cmd, arg);
+}
+
+
+static int stripe__file_close(EvfsFile *fh) {
+  StripeFile *fil = (StripeFile *)fh;
+  int status = EVFS_OK;
+
+  for(unsigned i = 0; i < fil->num_open; i++) {
+    int rval = evfs_file_close(fil->members[i]);
+    if(status == EVFS_OK)
+      status = rval;
+  }
+
+  fil->num_open = 0;
+  fil->base.methods = NULL;
+
+  return status;
+}
+
+
+static ptrdiff_t stripe__file_read_at(EvfsFile *fh, void *buf, size_t size, evfs_off_t offset) {
+  StripeFile *fil = (StripeFile *)fh;
+
+  // Pick up data written by other handles
+  if(offset >= fil->size || size > (size_t)(fil->size - offset))
+    refresh_size(fil);
+
+  if(offset >= fil->size)
+    return 0;
+
+  size = MIN(size, (size_t)(fil->size - offset));
+  return transfer(fil, (uint8_t *)buf, size, offset, EVFS_ASYNC_READ);
+}
+
+
+static ptrdiff_t stripe__file_read(EvfsFile *fh, void *buf, size_t size) {
+  StripeFile *fil = (StripeFile *)fh;
+
+  ptrdiff_t read = stripe__file_read_at(fh, buf, size, fil->pos);
+  if(read < 0) return read;
+
+  fil->pos += read;
+  if((size_t)read < size)
+    fil->eof = true;
+
+  return read;
+}
+
+
+static ptrdiff_t stripe__file_write_at(EvfsFile *fh, const void *buf, size_t size, evfs_off_t offset) {
+  StripeFile *fil = (StripeFile *)fh;
+
+  if(!fil->writable) return EVFS_ERR_DISABLED;
+
+  ptrdiff_t wrote = transfer(fil, (uint8_t *)buf, size, offset, EVFS_ASYNC_WRITE);
+  if(wrote > 0)
+    fil->size = MAX(fil->size, offset + wrote);
+
+  return wrote;
+}
+
+
+static ptrdiff_t stripe__file_write(EvfsFile *fh, const void *buf, size_t size) {
+  StripeFile *fil = (StripeFile *)fh;
+
+  if(!fil->writable) return EVFS_ERR_DISABLED;
+
+  if(fil->append) {
+    refresh_size(fil);
+    fil->pos = fil->size;
+  }
+
+  ptrdiff_t wrote = stripe__file_write_at(fh, buf, size, fil->pos);
+  if(wrote > 0)
+    fil->pos += wrote;
+
+  return wrote;
+}
+
+
+static int stripe__file_truncate(EvfsFile *fh, evfs_off_t size) {
+  StripeFile *fil = (StripeFile *)fh;
+
+  if(!fil->writable) return EVFS_ERR_DISABLED;
+
+  for(unsigned i = 0; i < fil->num_open; i++) {
+    int status = evfs_file_truncate(fil->members[i],
+                                    local_size(size, fil->stripe_size, i, fil->num_open));
+    if(status != EVFS_OK) return status;
+  }
+
+  fil->size = size;
+  return EVFS_OK;
+}
+
+
+static int stripe__file_sync(EvfsFile *fh) {
+  StripeFile *fil = (StripeFile *)fh;
+  int status = EVFS_OK;
+
+  for(unsigned i = 0; i < fil->num_open; i++) {
+    int rval = evfs_file_sync(fil->members[i]);
+    if(status == EVFS_OK)
+      status = rval;
+  }
+
+  return status;
+}
+
+
+static evfs_off_t stripe__file_size(EvfsFile *fh) {
+  StripeFile *fil = (StripeFile *)fh;
+
+  refresh_size(fil);
+  return fil->size;
+}
+
+
+static int stripe__file_seek(EvfsFile *fh, evfs_off_t offset, EvfsSeekDir origin) {
+  StripeFile *fil = (StripeFile *)fh;
+
+  fil->pos = evfs__absolute_offset(fh, offset, origin);
+  fil->eof = false;
+
+  return EVFS_OK;
+}
+
+
+static evfs_off_t stripe__file_tell(EvfsFile *fh) {
+  StripeFile *fil = (StripeFile *)fh;
+
+  return fil->pos;
+}
+
+
+static bool stripe__file_eof(EvfsFile *fh) {
+  StripeFile *fil = (StripeFile *)fh;
+
+  return fil->eof;
+}
+
+
+static const EvfsFileMethods s_stripe_methods = {
+  .m_ctrl     = stripe__file_ctrl,
+  .m_close    = stripe__file_close,
+  .m_read     = stripe__file_read,
+  .m_write    = stripe__file_write,
+  .m_truncate = stripe__file_truncate,
+  .m_sync     = stripe__file_sync,
+  .m_size     = stripe__file_size,
+  .m_seek     = stripe__file_seek,
+  .m_tell     = stripe__file_tell,
+  .m_eof      = stripe__file_eof,
+  .m_read_at  = stripe__file_read_at,
+  .m_write_at = stripe__file_write_at
+};
+
+
+
+// ******************** Directory access methods ********************
+
+static int stripe__dir_close(EvfsDir *dh) {
+  StripeDir *dir = (StripeDir *)dh;
+
+  int status = dir->base_dir->methods->m_close(dir->base_dir);
+
+  if(status == EVFS_OK) {
+    dir->base.methods = NULL; // Disable this instance
+  }
+
+  return status;
+}
+
+
+// Containers are listed as files
+static int stripe__dir_read(EvfsDir *dh, EvfsInfo *info) {
+  StripeDir *dir = (StripeDir *)dh;
+  Evfs *primary = dir->shim_data->members[0];
+
+  int status = dir->base_dir->methods->m_read(dir->base_dir, info);
+
+  if(status == EVFS_OK && (info->type & EVFS_FILE_DIR) && info->name[0] != '.') {
+    char joined[EVFS_MAX_PATH];
+    evfs_off_t size;
+
+    if(join_container_path(primary, dir->path, info->name, joined) == EVFS_OK &&
+        is_stripe_container(primary, joined) &&
+        container_size(dir->shim_data, joined, &size) == EVFS_OK) {
+      info->type &= ~EVFS_FILE_DIR;
+      info->size = size;
+    }
+  }
+
+  return status;
+}
+
+
+static int stripe__dir_rewind(EvfsDir *dh) {
+  StripeDir *dir = (StripeDir *)dh;
+
+  return dir->base_dir->methods->m_rewind(dir->base_dir);
+}
+
+
+static const EvfsDirMethods s_stripe_dir_methods = {
+  .m_close    = stripe__dir_close,
+  .m_read     = stripe__dir_read,
+  .m_rewind   = stripe__dir_rewind
+};
+
+
+
+// ******************** FS access methods ********************
+
+static int stripe__open(Evfs *vfs, const char *path, EvfsFile *fh, int flags) {
+  StripeFile *fil = (StripeFile *)fh;
+  StripeData *shim_data = (StripeData *)vfs->fs_data;
+  Evfs *primary = shim_data->members[0];
+
+  memset(fil, 0, sizeof(*fil));
+  fil->shim_data = shim_data;
+
+  int status;
+
+  // Check if the path exists
+  EvfsInfo info;
+  bool exists = primary->m_stat(primary, path, &info) == EVFS_OK;
+
+  if(exists && !is_stripe_container(primary, path)) {
+    // Regular files are treated as a stripe set with one member
+    status = evfs_vfs_open(primary, path, &fil->members[0], append_flags(flags));
+    if(status == EVFS_OK) {
+      fil->num_open = 1;
+      fil->stripe_size = shim_data->stripe_size;
+    }
+
+  } else if(exists && (flags & EVFS_NO_EXIST)) {
+    status = EVFS_ERR_EXISTS;
+
+  } else if(!exists && !(flags & (EVFS_OPEN_OR_NEW | EVFS_NO_EXIST | EVFS_OVERWRITE))) {
+    status = EVFS_ERR_NO_FILE;
+
+  } else { // Open or create a container
+    status = EVFS_OK;
+    if(!exists)
+      status = init_stripe_container(shim_data, path);
+
+    if(status == EVFS_OK)
+      status = open_stripe_container(fil, path, flags);
+  }
+
+  if(status == EVFS_OK) {
+    fil->writable = flags & (EVFS_WRITE | EVFS_APPEND);
+    fil->append = flags & EVFS_APPEND;
+    refresh_size(fil);
+
+    // Add methods to make this functional
+    fh->methods = &s_stripe_methods;
+  } else { // Open failed
+    fh->methods = NULL;
+  }
+
+  return status;
+}
+
+
+static int stripe__stat(Evfs *vfs, const char *path, EvfsInfo *info) {
+  StripeData *shim_data = (StripeData *)vfs->fs_data;
+  Evfs *primary = shim_data->members[0];
+
+  int status = primary->m_stat(primary, path, info);
+
+  if(status == EVFS_OK && (info->type & EVFS_FILE_DIR) && is_stripe_container(primary, path)) {
+    status = container_size(shim_data, path, &info->size);
+    info->type &= ~EVFS_FILE_DIR;
+  }
+
+  return status;
+}
+
+
+static int stripe__delete(Evfs *vfs, const char *path) {
+  StripeData *shim_data = (StripeData *)vfs->fs_data;
+  Evfs *primary = shim_data->members[0];
+
+  if(is_stripe_container(primary, path)) {
+    int status = EVFS_OK;
+
+    for(unsigned i = 0; i < shim_data->num_members; i++) {
+      int rval = clear_container(shim_data->members[i], path);
+      if(status == EVFS_OK)
+        status = rval;
+    }
+
+    return status;
+  }
+
+  // Regular files only exist on the first member. Directories are on all of them.
+  int status = primary->m_delete(primary, path);
+
+  if(status == EVFS_OK) {
+    for(unsigned i = 1; i < shim_data->num_members; i++) {
+      Evfs *member = shim_data->members[i];
+      member->m_delete(member, path);
+    }
+  }
+
+  return status;
+}
+
+
+static int stripe__rename(Evfs *vfs, const char *old_path, const char *new_path) {
+  StripeData *shim_data = (StripeData *)vfs->fs_data;
+  Evfs *primary = shim_data->members[0];
+
+  int status = primary->m_rename(primary, old_path, new_path);
+  if(status != EVFS_OK) return status;
+
+  for(unsigned i = 1; i < shim_data->num_members; i++) {
+    Evfs *member = shim_data->members[i];
+    EvfsInfo info;
+
+    if(member->m_stat(member, old_path, &info) != EVFS_OK) // Not a container or directory
+      continue;
+
+    int rval = member->m_rename(member, old_path, new_path);
+    if(status == EVFS_OK)
+      status = rval;
+  }
+
+  return status;
+}
+
+
+static int stripe__make_dir(Evfs *vfs, const char *path) {
+  StripeData *shim_data = (StripeData *)vfs->fs_data;
+  Evfs *primary = shim_data->members[0];
+
+  int status = primary->m_make_dir(primary, path);
+  if(status != EVFS_OK) return status;
+
+  // Containers need their parent on every member
+  for(unsigned i = 1; i < shim_data->num_members; i++) {
+    Evfs *member = shim_data->members[i];
+
+    int rval = member->m_make_dir(member, path);
+    if(rval != EVFS_OK && rval != EVFS_ERR_EXISTS && status == EVFS_OK)
+      status = rval;
+  }
+
+  return status;
+}
+
+
+static int stripe__open_dir(Evfs *vfs, const char *path, EvfsDir *dh) {
+  StripeDir *dir = (StripeDir *)dh;
+  StripeData *shim_data = (StripeData *)vfs->fs_data;
+  Evfs *primary = shim_data->members[0];
+
+  dir->shim_data = shim_data;
+  dir->base_dir = (EvfsDir *)NEXT_OBJ(dir);   // We have two objects allocated together [StripeDir][<base VFS dir size>]
+
+  size_t path_len = strlen(path);
+  if(path_len >= EVFS_MAX_PATH) {
+    dh->methods = NULL;
+    return EVFS_ERR_TOO_LONG;
+  }
+
+  memcpy(dir->path, path, path_len+1);
+
+  // Prevent opening container directories
+  if(is_stripe_container(primary, path)) {
+    dh->methods = NULL;
+    return EVFS_ERR_NO_PATH;
+  }
+
+  int status = primary->m_open_dir(primary, path, dir->base_dir);
+
+  if(status == EVFS_OK) {
+    // Construct a shimmed dir object
+    if(dir->base_dir->methods) {
+      dh->methods = &s_stripe_dir_methods;
+    } else {
+      dh->methods = NULL;
+      status = EVFS_ERR_INIT;
+    }
+
+  } else { // Open failed
+    dh->methods = NULL;
+  }
+
+  return status;
+}
+
+
+static int stripe__get_cur_dir(Evfs *vfs, StringRange *cur_dir) {
+  StripeData *shim_data = (StripeData *)vfs->fs_data;
+  Evfs *primary = shim_data->members[0];
+
+  return primary->m_get_cur_dir(primary, cur_dir);
+}
+
+
+static int stripe__set_cur_dir(Evfs *vfs, const char *path) {
+  StripeData *shim_data = (StripeData *)vfs->fs_data;
+
+  // Keep relative paths in step on every member
+  for(unsigned i = 0; i < shim_data->num_members; i++) {
+    Evfs *member = shim_data->members[i];
+
+    int status = member->m_set_cur_dir(member, path);
+    if(status != EVFS_OK) return status;
+  }
+
+  return EVFS_OK;
+}
+
+
+static int stripe__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
+  StripeData *shim_data = (StripeData *)vfs->fs_data;
+  Evfs *primary = shim_data->members[0];
+
+  switch(cmd) {
+    // We need special handling for EVFS_CMD_UNREGISTER.
+    // It can't pass through since we need to deallocate VFSs in the proper sequence
+    // to avoid corrupting the registered VFS linked list.
+    case EVFS_CMD_UNREGISTER:
+      if(shim_data->queue)
+        evfs_async_free(shim_data->queue);
+      evfs__lock_destroy(&shim_data->io_lock);
+      evfs_free(vfs); // Free this stripe VFS
+      return EVFS_OK; break;
+
+    default: // Everything else passes to the first member
+      return primary->m_vfs_ctrl(primary, cmd, arg);
+      break;
+  }
+}
+
+
+static bool stripe__path_root_component(Evfs *vfs, const char *path, StringRange *root) {
+  StripeData *shim_data = (StripeData *)vfs->fs_data;
+  Evfs *primary = shim_data->members[0];
+
+  return primary->m_path_root_component(primary, path, root);
+}
+
+
+/*
+Register a striping filesystem shim
+
+The members must be listed in the same order every time the shim is
+registered.
+
+Args:
+  vfs_name:         Name of new shim
+  member_vfs_names: Existing VFSs to stripe across
+  num_members:      Number of member VFSs. Between 1 and EVFS_STRIPE_MAX_MEMBERS
+  cfg:              Stripe size and parallel I/O settings. Use NULL for defaults
+  default_vfs:      Make this the default VFS when true
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_register_stripe(const char *vfs_name, const char **member_vfs_names, unsigned num_members,
+                         StripeConfig *cfg, bool default_vfs) {
+  if(PTR_CHECK(vfs_name) || PTR_CHECK(member_vfs_names)) return EVFS_ERR_BAD_ARG;
+  if(num_members < 1 || num_members > EVFS_STRIPE_MAX_MEMBERS) return EVFS_ERR_BAD_ARG;
+
+  Evfs *shim_vfs;
+  StripeData *shim_data;
+
+  uint32_t stripe_size = (cfg && cfg->stripe_size) ? cfg->stripe_size : DEFAULT_STRIPE_SIZE;
+  if(stripe_size < MIN_STRIPE_SIZE) return EVFS_ERR_BAD_ARG;
+
+  Evfs *members[EVFS_STRIPE_MAX_MEMBERS];
+  for(unsigned i = 0; i < num_members; i++) {
+    if(PTR_CHECK(member_vfs_names[i])) return EVFS_ERR_BAD_ARG;
+
+    members[i] = evfs_find_vfs(member_vfs_names[i]);
+    if(PTR_CHECK(members[i])) return EVFS_ERR_NO_VFS;
+  }
+
+  // Construct a new VFS
+  // We have three objects allocated together [Evfs][StripeData][char[]]
+  size_t shim_size = sizeof(*shim_vfs) + sizeof(*shim_data) + strlen(vfs_name)+1;
+  shim_vfs = evfs_malloc(shim_size);
+  if(MEM_CHECK(shim_vfs)) return EVFS_ERR_ALLOC;
+
+  memset(shim_vfs, 0, shim_size);
+
+  shim_data = (StripeData *)NEXT_OBJ(shim_vfs);
+
+  shim_vfs->vfs_name = (char *)NEXT_OBJ(shim_data);
+  strcpy((char *)shim_vfs->vfs_name, vfs_name);
+
+  memcpy(shim_data->members, members, num_members * sizeof(*members));
+  shim_data->num_members  = num_members;
+  shim_data->vfs_name     = shim_vfs->vfs_name;
+  shim_data->shim_vfs     = shim_vfs;
+  shim_data->stripe_size  = stripe_size;
+
+  // Member files are opened separately
+  shim_vfs->vfs_file_size = sizeof(StripeFile);
+  shim_vfs->vfs_dir_size = sizeof(StripeDir) + members[0]->vfs_dir_size;
+  shim_vfs->fs_data = shim_data;
+
+  shim_vfs->m_open = stripe__open;
+  shim_vfs->m_stat = stripe__stat;
+  shim_vfs->m_delete = stripe__delete;
+  shim_vfs->m_rename = stripe__rename;
+  shim_vfs->m_make_dir = stripe__make_dir;
+  shim_vfs->m_open_dir = stripe__open_dir;
+  shim_vfs->m_get_cur_dir = stripe__get_cur_dir;
+  shim_vfs->m_set_cur_dir = stripe__set_cur_dir;
+  shim_vfs->m_vfs_ctrl = stripe__vfs_ctrl;
+
+  shim_vfs->m_path_root_component = stripe__path_root_component;
+
+  if(evfs__lock_init(&shim_data->io_lock) != EVFS_OK) {
+    evfs_free(shim_vfs);
+    THROW(EVFS_ERR_INIT);
+  }
+
+#ifdef EVFS_USE_THREADING
+  // At most one operation is in flight on each member
+  if(cfg && cfg->io_threads > 0 && num_members > 1) {
+    int status = evfs_async_new(num_members, cfg->io_threads, &shim_data->queue);
+    if(status != EVFS_OK) {
+      evfs__lock_destroy(&shim_data->io_lock);
+      evfs_free(shim_vfs);
+      return status;
+    }
+  }
+#endif
+
+  return evfs_register(shim_vfs, default_vfs);
+}
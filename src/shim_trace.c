@@ -90,15 +90,17 @@ typedef struct TraceDir_s {
 
 static void trace_printf(TraceData *shim_data, const char *fmt, ...) {
   va_list args;
+  char stack_buf[EVFS_PRINTF_STACK_SIZE];
   char *buf;
+  int len;
 
   va_start(args, fmt);
-  buf = evfs__vmprintf(fmt, args);
+  buf = evfs__vprintf_buf(stack_buf, sizeof(stack_buf), &len, fmt, args);
   va_end(args);
   
   if(buf) {
     shim_data->report(buf, shim_data->ctx); 
-    evfs_free(buf);
+    evfs__printf_buf_free(buf, stack_buf);
   }
 }
 
@@ -181,6 +183,108 @@ static ptrdiff_t trace__file_write(EvfsFile *fh, const void *buf, size_t size) {
 }
 
 
+static ptrdiff_t trace__file_read_at(EvfsFile *fh, void *buf, size_t size, evfs_off_t offset) {
+  TraceFile *fil = (TraceFile *)fh;
+  TraceData *shim_data = fil->shim_data;
+
+  trace_printf(shim_data, TP("%s.m_read_at(" HL_NAME ", size=%ld, offset=%ld)"), shim_data->vfs_name,
+                fil->filename, size, (long)offset);
+  ptrdiff_t read = evfs_file_read_at(fil->base_file, buf, size, offset);
+  if(read >= 0)
+    trace_printf(shim_data, TS(" -> %ld"), read);
+  else
+    trace_print_result(shim_data, evfs_err_name(read), read);
+
+  return read;
+}
+
+
+static ptrdiff_t trace__file_write_at(EvfsFile *fh, const void *buf, size_t size, evfs_off_t offset) {
+  TraceFile *fil = (TraceFile *)fh;
+  TraceData *shim_data = fil->shim_data;
+
+  trace_printf(shim_data, TP("%s.m_write_at(" HL_NAME ", size=%ld, offset=%ld)"), shim_data->vfs_name,
+                fil->filename, size, (long)offset);
+  ptrdiff_t wrote = evfs_file_write_at(fil->base_file, buf, size, offset);
+  if(wrote >= 0)
+    trace_printf(shim_data, TS(" -> %ld"), wrote);
+  else
+    trace_print_result(shim_data, evfs_err_name(wrote), wrote);
+
+  return wrote;
+}
+
+
+static ptrdiff_t trace__file_readv(EvfsFile *fh, const EvfsIOVec *iov, int iovcnt) {
+  TraceFile *fil = (TraceFile *)fh;
+  TraceData *shim_data = fil->shim_data;
+
+  trace_printf(shim_data, TP("%s.m_readv(" HL_NAME ", iovcnt=%d)"), shim_data->vfs_name,
+                fil->filename, iovcnt);
+  ptrdiff_t read = evfs_file_readv(fil->base_file, iov, iovcnt);
+  if(read >= 0)
+    trace_printf(shim_data, TS(" -> %ld"), read);
+  else
+    trace_print_result(shim_data, evfs_err_name(read), read);
+
+  return read;
+}
+
+
+static ptrdiff_t trace__file_writev(EvfsFile *fh, const EvfsIOVec *iov, int iovcnt) {
+  TraceFile *fil = (TraceFile *)fh;
+  TraceData *shim_data = fil->shim_data;
+
+  trace_printf(shim_data, TP("%s.m_writev(" HL_NAME ", iovcnt=%d)"), shim_data->vfs_name,
+                fil->filename, iovcnt);
+  ptrdiff_t wrote = evfs_file_writev(fil->base_file, iov, iovcnt);
+  if(wrote >= 0)
+    trace_printf(shim_data, TS(" -> %ld"), wrote);
+  else
+    trace_print_result(shim_data, evfs_err_name(wrote), wrote);
+
+  return wrote;
+}
+
+
+static int trace__file_map(EvfsFile *fh, evfs_off_t offset, size_t size, EvfsMapping *map) {
+  TraceFile *fil = (TraceFile *)fh;
+  TraceData *shim_data = fil->shim_data;
+
+  trace_printf(shim_data, TP("%s.m_map(" HL_NAME ", offset=%ld, size=%ld)"), shim_data->vfs_name,
+                fil->filename, (long)offset, size);
+  int status = evfs_file_map(fil->base_file, offset, size, map);
+  trace_print_result(shim_data, evfs_err_name(status), status);
+
+  return status;
+}
+
+
+static int trace__file_unmap(EvfsFile *fh, EvfsMapping *map) {
+  TraceFile *fil = (TraceFile *)fh;
+  TraceData *shim_data = fil->shim_data;
+
+  trace_printf(shim_data, TP("%s.m_unmap(" HL_NAME ")"), shim_data->vfs_name, fil->filename);
+  int status = evfs_file_unmap(fil->base_file, map);
+  trace_print_result(shim_data, evfs_err_name(status), status);
+
+  return status;
+}
+
+
+static int trace__file_discard(EvfsFile *fh, evfs_off_t offset, evfs_off_t size) {
+  TraceFile *fil = (TraceFile *)fh;
+  TraceData *shim_data = fil->shim_data;
+
+  trace_printf(shim_data, TP("%s.m_discard(" HL_NAME ", offset=%ld, size=%ld)"), shim_data->vfs_name,
+                fil->filename, (long)offset, (long)size);
+  int status = evfs_file_discard(fil->base_file, offset, size);
+  trace_print_result(shim_data, evfs_err_name(status), status);
+
+  return status;
+}
+
+
 static int trace__file_truncate(EvfsFile *fh, evfs_off_t size) {
   TraceFile *fil = (TraceFile *)fh;
   TraceData *shim_data = fil->shim_data;
@@ -273,7 +377,14 @@ static const EvfsFileMethods s_trace_methods = {
   .m_size     = trace__file_size,
   .m_seek     = trace__file_seek,
   .m_tell     = trace__file_tell,
-  .m_eof      = trace__file_eof
+  .m_eof      = trace__file_eof,
+  .m_read_at  = trace__file_read_at,
+  .m_write_at = trace__file_write_at,
+  .m_readv    = trace__file_readv,
+  .m_writev   = trace__file_writev,
+  .m_map      = trace__file_map,
+  .m_unmap    = trace__file_unmap,
+  .m_discard  = trace__file_discard
 };
 
 
@@ -307,6 +418,22 @@ static int trace__dir_read(EvfsDir *dh, EvfsInfo *info) {
   return status;
 }
 
+static int trace__dir_read_many(EvfsDir *dh, EvfsInfo *entries, int max_entries, char *name_buf,
+                                size_t name_buf_size) {
+  TraceDir *dir = (TraceDir *)dh;
+  TraceData *shim_data = dir->shim_data;
+
+  trace_printf(shim_data, TP("%s.m_dir_read_many(" HL_NAME ", max_entries=%d)"), shim_data->vfs_name,
+                dir->filename, max_entries);
+  int count = evfs_dir_read_many(dir->base_dir, entries, max_entries, name_buf, name_buf_size);
+  if(count >= 0)
+    trace_printf(shim_data, TS(" -> %d"), count);
+  else
+    trace_print_result(shim_data, evfs_err_name(count), count);
+
+  return count;
+}
+
 static int trace__dir_rewind(EvfsDir *dh) {
   TraceDir *dir = (TraceDir *)dh;
   TraceData *shim_data = dir->shim_data;
@@ -322,7 +449,8 @@ static int trace__dir_rewind(EvfsDir *dh) {
 static const EvfsDirMethods s_trace_dir_methods = {
   .m_close    = trace__dir_close,
   .m_read     = trace__dir_read,
-  .m_rewind   = trace__dir_rewind
+  .m_rewind   = trace__dir_rewind,
+  .m_read_many = trace__dir_read_many
 };
 
 
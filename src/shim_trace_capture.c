@@ -0,0 +1,737 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Capture tracing shim VFS
+
+  This is a variant of the tracing shim that writes a record of each call to
+  a capture file that can be replayed with evfs_replay(). Records hold the
+  full paths passed to the VFS along with the arguments, result, and timing
+  of each call. File and directory handles get serial numbers so later calls
+  can be matched to the open that created them.
+
+  Records are encoded into a buffer and written to the capture file when the
+  buffer fills and when the shim is unregistered. Records are appended when
+  their call completes. Calls that overlap from different threads may be out
+  of order and are sorted by their start time when replayed.
+------------------------------------------------------------------------------
+*/
+
+#include <string.h>
+
+#include "evfs.h"
+#include "evfs_internal.h"
+#include "evfs/shim/shim_trace.h"
+#include "evfs/util/unaligned_access.h"
+
+
+// Access objects allocated in a single block of memory
+#define NEXT_OBJ(o) (&(o)[1])
+
+#define CAPTURE_BUF_SIZE  4096
+
+
+typedef struct CaptureData_s {
+  Evfs *base_vfs;
+  EvfsFile *capture;
+  EvfsTraceClock clock;
+  EvfsLock lock;
+  uint32_t next_handle;
+  int status;         // First error writing the capture
+  size_t buf_fill;
+  uint8_t *buf;
+} CaptureData;
+
+typedef struct CaptureFile_s {
+  EvfsFile base;
+  CaptureData *shim_data;
+  EvfsFile *base_file;
+  uint32_t handle;
+} CaptureFile;
+
+typedef struct CaptureDir_s {
+  EvfsDir base;
+  CaptureData *shim_data;
+  EvfsDir *base_dir;
+  uint32_t handle;
+} CaptureDir;
+
+
+
+// ******************** Capture buffer ********************
+
+static inline uint64_t capture_clock(CaptureData *shim_data) {
+  return shim_data->clock ? shim_data->clock() : 0;
+}
+
+
+// Write buffered records to the capture file. Lock must be held.
+static void capture_flush(CaptureData *shim_data) {
+  if(shim_data->buf_fill > 0 && shim_data->status == EVFS_OK) {
+    ptrdiff_t wrote = evfs_file_write(shim_data->capture, shim_data->buf, shim_data->buf_fill);
+    if(wrote != (ptrdiff_t)shim_data->buf_fill)
+      shim_data->status = wrote < 0 ? wrote : EVFS_ERR_IO;
+  }
+
+  shim_data->buf_fill = 0;
+}
+
+
+static void capture_record(CaptureData *shim_data, EvfsTraceOp op, uint64_t start, uint32_t handle,
+                           int64_t size, int64_t offset, int64_t result, const char *path,
+                           const char *new_path) {
+  uint32_t elapsed = (uint32_t)(capture_clock(shim_data) - start);
+
+  size_t path_len = path ? strlen(path)+1 : 0;
+  size_t new_len = new_path ? strlen(new_path)+1 : 0;
+  size_t rec_size = EVFS_CAPTURE_RECORD_SIZE + path_len + new_len;
+
+  if(rec_size > CAPTURE_BUF_SIZE) // Paths can't be this long on any supported VFS
+    return;
+
+  evfs__lock(&shim_data->lock);
+
+  if(shim_data->buf_fill + rec_size > CAPTURE_BUF_SIZE)
+    capture_flush(shim_data);
+
+  uint8_t *rec = &shim_data->buf[shim_data->buf_fill];
+  set_unaligned_u64le(start, &rec[0]);
+  set_unaligned_u32le(elapsed, &rec[8]);
+  set_unaligned_u32le(handle, &rec[12]);
+  set_unaligned_s64le(size, &rec[16]);
+  set_unaligned_s64le(offset, &rec[24]);
+  set_unaligned_s64le(result, &rec[32]);
+  set_unaligned_u16le(op, &rec[40]);
+  set_unaligned_u16le(path_len + new_len, &rec[42]);
+
+  if(path_len > 0)
+    memcpy(&rec[EVFS_CAPTURE_RECORD_SIZE], path, path_len);
+  if(new_len > 0)
+    memcpy(&rec[EVFS_CAPTURE_RECORD_SIZE + path_len], new_path, new_len);
+
+  shim_data->buf_fill += rec_size;
+
+  evfs__unlock(&shim_data->lock);
+}
+
+
+static uint32_t next_handle(CaptureData *shim_data) {
+  evfs__lock(&shim_data->lock);
+  uint32_t handle = ++shim_data->next_handle;
+  if(handle == 0) // 0 is reserved for VFS methods
+    handle = ++shim_data->next_handle;
+  evfs__unlock(&shim_data->lock);
+
+  return handle;
+}
+
+
+/*
+Decode the next record from a capture file held in memory
+
+The header is checked when pos is 0. Paths in the decoded record point into
+buf.
+
+Args:
+  buf:       Capture file contents
+  buf_size:  Size of buf
+  pos:       Offset of the next record in buf. Updated to the following record
+  rec:       Decoded record
+
+Returns:
+  EVFS_OK on success. EVFS_DONE at the end of the capture. EVFS_ERR_CORRUPTION
+  if the capture is malformed.
+*/
+int evfs_capture_decode(const uint8_t *buf, size_t buf_size, size_t *pos, EvfsCaptureRecord *rec) {
+  if(PTR_CHECK(buf) || PTR_CHECK(pos) || PTR_CHECK(rec)) return EVFS_ERR_BAD_ARG;
+
+  if(*pos == 0) {
+    if(buf_size < EVFS_CAPTURE_HEADER_SIZE
+        || memcmp(buf, EVFS_CAPTURE_MAGIC, sizeof(EVFS_CAPTURE_MAGIC)) != 0
+        || get_unaligned_u16le(&buf[6]) != EVFS_CAPTURE_VERSION)
+      return EVFS_ERR_CORRUPTION;
+
+    *pos = EVFS_CAPTURE_HEADER_SIZE;
+  }
+
+  if(*pos == buf_size)
+    return EVFS_DONE;
+
+  if(buf_size - *pos < EVFS_CAPTURE_RECORD_SIZE)
+    return EVFS_ERR_CORRUPTION;
+
+  const uint8_t *data = &buf[*pos];
+  size_t path_len = get_unaligned_u16le(&data[42]);
+  if(buf_size - *pos - EVFS_CAPTURE_RECORD_SIZE < path_len)
+    return EVFS_ERR_CORRUPTION;
+
+  rec->timestamp  = get_unaligned_u64le(&data[0]);
+  rec->elapsed    = get_unaligned_u32le(&data[8]);
+  rec->handle     = get_unaligned_u32le(&data[12]);
+  rec->size       = (int64_t)get_unaligned_u64le(&data[16]);
+  rec->offset     = (int64_t)get_unaligned_u64le(&data[24]);
+  rec->result     = (int64_t)get_unaligned_u64le(&data[32]);
+  rec->op         = get_unaligned_u16le(&data[40]);
+  rec->path       = NULL;
+  rec->new_path   = NULL;
+
+  // Paths are NUL terminated within path_len
+  const char *paths = (const char *)&data[EVFS_CAPTURE_RECORD_SIZE];
+  if(path_len > 0) {
+    size_t len = strnlen(paths, path_len);
+    if(len == path_len) return EVFS_ERR_CORRUPTION;
+    rec->path = paths;
+
+    if(len+1 < path_len) {
+      size_t new_len = strnlen(&paths[len+1], path_len - len-1);
+      if(len+1 + new_len != path_len-1) return EVFS_ERR_CORRUPTION;
+      rec->new_path = &paths[len+1];
+    }
+  }
+
+  *pos += EVFS_CAPTURE_RECORD_SIZE + path_len;
+  return EVFS_OK;
+}
+
+
+
+// ******************** File access methods ********************
+
+#define FILE_RECORD(fil, op, start, size, offset, result) \
+  capture_record((fil)->shim_data, (op), (start), (fil)->handle, (size), (offset), (result), NULL, NULL)
+
+static int capture__file_ctrl(EvfsFile *fh, int cmd, void *arg) {
+  CaptureFile *fil = (CaptureFile *)fh;
+
+  uint64_t start = capture_clock(fil->shim_data);
+  int status = fil->base_file->methods->m_ctrl(fil->base_file, cmd, arg);
+  FILE_RECORD(fil, EVFS_TRACE_CTRL, start, cmd, 0, status);
+
+  return status;
+}
+
+
+static int capture__file_close(EvfsFile *fh) {
+  CaptureFile *fil = (CaptureFile *)fh;
+
+  uint64_t start = capture_clock(fil->shim_data);
+  int status = fil->base_file->methods->m_close(fil->base_file);
+  FILE_RECORD(fil, EVFS_TRACE_CLOSE, start, 0, 0, status);
+
+  if(status == EVFS_OK) {
+    fil->base.methods = NULL; // Disable this instance
+  }
+
+  return status;
+}
+
+
+static ptrdiff_t capture__file_read(EvfsFile *fh, void *buf, size_t size) {
+  CaptureFile *fil = (CaptureFile *)fh;
+
+  uint64_t start = capture_clock(fil->shim_data);
+  ptrdiff_t read = fil->base_file->methods->m_read(fil->base_file, buf, size);
+  FILE_RECORD(fil, EVFS_TRACE_READ, start, size, 0, read);
+
+  return read;
+}
+
+
+static ptrdiff_t capture__file_write(EvfsFile *fh, const void *buf, size_t size) {
+  CaptureFile *fil = (CaptureFile *)fh;
+
+  uint64_t start = capture_clock(fil->shim_data);
+  ptrdiff_t wrote = fil->base_file->methods->m_write(fil->base_file, buf, size);
+  FILE_RECORD(fil, EVFS_TRACE_WRITE, start, size, 0, wrote);
+
+  return wrote;
+}
+
+
+static ptrdiff_t capture__file_read_at(EvfsFile *fh, void *buf, size_t size, evfs_off_t offset) {
+  CaptureFile *fil = (CaptureFile *)fh;
+
+  uint64_t start = capture_clock(fil->shim_data);
+  ptrdiff_t read = evfs_file_read_at(fil->base_file, buf, size, offset);
+  FILE_RECORD(fil, EVFS_TRACE_READ_AT, start, size, offset, read);
+
+  return read;
+}
+
+
+static ptrdiff_t capture__file_write_at(EvfsFile *fh, const void *buf, size_t size, evfs_off_t offset) {
+  CaptureFile *fil = (CaptureFile *)fh;
+
+  uint64_t start = capture_clock(fil->shim_data);
+  ptrdiff_t wrote = evfs_file_write_at(fil->base_file, buf, size, offset);
+  FILE_RECORD(fil, EVFS_TRACE_WRITE_AT, start, size, offset, wrote);
+
+  return wrote;
+}
+
+
+static size_t iov_total(const EvfsIOVec *iov, int iovcnt) {
+  size_t total = 0;
+  for(int i = 0; i < iovcnt; i++) {
+    total += iov[i].len;
+  }
+
+  return total;
+}
+
+
+// Vectored calls record their total size with the vector count in offset
+static ptrdiff_t capture__file_readv(EvfsFile *fh, const EvfsIOVec *iov, int iovcnt) {
+  CaptureFile *fil = (CaptureFile *)fh;
+
+  uint64_t start = capture_clock(fil->shim_data);
+  ptrdiff_t read = evfs_file_readv(fil->base_file, iov, iovcnt);
+  FILE_RECORD(fil, EVFS_TRACE_READV, start, iov_total(iov, iovcnt), iovcnt, read);
+
+  return read;
+}
+
+
+static ptrdiff_t capture__file_writev(EvfsFile *fh, const EvfsIOVec *iov, int iovcnt) {
+  CaptureFile *fil = (CaptureFile *)fh;
+
+  uint64_t start = capture_clock(fil->shim_data);
+  ptrdiff_t wrote = evfs_file_writev(fil->base_file, iov, iovcnt);
+  FILE_RECORD(fil, EVFS_TRACE_WRITEV, start, iov_total(iov, iovcnt), iovcnt, wrote);
+
+  return wrote;
+}
+
+
+static int capture__file_map(EvfsFile *fh, evfs_off_t offset, size_t size, EvfsMapping *map) {
+  CaptureFile *fil = (CaptureFile *)fh;
+
+  uint64_t start = capture_clock(fil->shim_data);
+  int status = evfs_file_map(fil->base_file, offset, size, map);
+  FILE_RECORD(fil, EVFS_TRACE_MAP, start, size, offset, status);
+
+  return status;
+}
+
+
+static int capture__file_unmap(EvfsFile *fh, EvfsMapping *map) {
+  CaptureFile *fil = (CaptureFile *)fh;
+
+  uint64_t start = capture_clock(fil->shim_data);
+  int status = evfs_file_unmap(fil->base_file, map);
+  FILE_RECORD(fil, EVFS_TRACE_UNMAP, start, 0, 0, status);
+
+  return status;
+}
+
+
+static int capture__file_discard(EvfsFile *fh, evfs_off_t offset, evfs_off_t size) {
+  CaptureFile *fil = (CaptureFile *)fh;
+
+  uint64_t start = capture_clock(fil->shim_data);
+  int status = evfs_file_discard(fil->base_file, offset, size);
+  FILE_RECORD(fil, EVFS_TRACE_DISCARD, start, size, offset, status);
+
+  return status;
+}
+
+
+static int capture__file_truncate(EvfsFile *fh, evfs_off_t size) {
+  CaptureFile *fil = (CaptureFile *)fh;
+
+  uint64_t start = capture_clock(fil->shim_data);
+  int status = fil->base_file->methods->m_truncate(fil->base_file, size);
+  FILE_RECORD(fil, EVFS_TRACE_TRUNCATE, start, size, 0, status);
+
+  return status;
+}
+
+
+static int capture__file_sync(EvfsFile *fh) {
+  CaptureFile *fil = (CaptureFile *)fh;
+
+  uint64_t start = capture_clock(fil->shim_data);
+  int status = fil->base_file->methods->m_sync(fil->base_file);
+  FILE_RECORD(fil, EVFS_TRACE_SYNC, start, 0, 0, status);
+
+  return status;
+}
+
+
+static evfs_off_t capture__file_size(EvfsFile *fh) {
+  CaptureFile *fil = (CaptureFile *)fh;
+
+  uint64_t start = capture_clock(fil->shim_data);
+  evfs_off_t size = fil->base_file->methods->m_size(fil->base_file);
+  FILE_RECORD(fil, EVFS_TRACE_SIZE, start, 0, 0, size);
+
+  return size;
+}
+
+
+static int capture__file_seek(EvfsFile *fh, evfs_off_t offset, EvfsSeekDir origin) {
+  CaptureFile *fil = (CaptureFile *)fh;
+
+  uint64_t start = capture_clock(fil->shim_data);
+  int status = fil->base_file->methods->m_seek(fil->base_file, offset, origin);
+  FILE_RECORD(fil, EVFS_TRACE_SEEK, start, origin, offset, status);
+
+  return status;
+}
+
+
+static evfs_off_t capture__file_tell(EvfsFile *fh) {
+  CaptureFile *fil = (CaptureFile *)fh;
+
+  uint64_t start = capture_clock(fil->shim_data);
+  evfs_off_t pos = fil->base_file->methods->m_tell(fil->base_file);
+  FILE_RECORD(fil, EVFS_TRACE_TELL, start, 0, 0, pos);
+
+  return pos;
+}
+
+
+static bool capture__file_eof(EvfsFile *fh) {
+  CaptureFile *fil = (CaptureFile *)fh;
+
+  uint64_t start = capture_clock(fil->shim_data);
+  bool eof = fil->base_file->methods->m_eof(fil->base_file);
+  FILE_RECORD(fil, EVFS_TRACE_EOF, start, 0, 0, eof);
+
+  return eof;
+}
+
+
+static const EvfsFileMethods s_capture_methods = {
+  .m_ctrl     = capture__file_ctrl,
+  .m_close    = capture__file_close,
+  .m_read     = capture__file_read,
+  .m_write    = capture__file_write,
+  .m_truncate = capture__file_truncate,
+  .m_sync     = capture__file_sync,
+  .m_size     = capture__file_size,
+  .m_seek     = capture__file_seek,
+  .m_tell     = capture__file_tell,
+  .m_eof      = capture__file_eof,
+  .m_read_at  = capture__file_read_at,
+  .m_write_at = capture__file_write_at,
+  .m_readv    = capture__file_readv,
+  .m_writev   = capture__file_writev,
+  .m_map      = capture__file_map,
+  .m_unmap    = capture__file_unmap,
+  .m_discard  = capture__file_discard
+};
+
+
+
+// ******************** Directory access methods ********************
+
+static int capture__dir_close(EvfsDir *dh) {
+  CaptureDir *dir = (CaptureDir *)dh;
+
+  uint64_t start = capture_clock(dir->shim_data);
+  int status = dir->base_dir->methods->m_close(dir->base_dir);
+  FILE_RECORD(dir, EVFS_TRACE_DIR_CLOSE, start, 0, 0, status);
+
+  if(status == EVFS_OK) {
+    dir->base.methods = NULL; // Disable this instance
+  }
+
+  return status;
+}
+
+static int capture__dir_read(EvfsDir *dh, EvfsInfo *info) {
+  CaptureDir *dir = (CaptureDir *)dh;
+
+  uint64_t start = capture_clock(dir->shim_data);
+  int status = dir->base_dir->methods->m_read(dir->base_dir, info);
+  FILE_RECORD(dir, EVFS_TRACE_DIR_READ, start, 0, 0, status);
+
+  return status;
+}
+
+static int capture__dir_read_many(EvfsDir *dh, EvfsInfo *entries, int max_entries, char *name_buf,
+                                  size_t name_buf_size) {
+  CaptureDir *dir = (CaptureDir *)dh;
+
+  uint64_t start = capture_clock(dir->shim_data);
+  int count = evfs_dir_read_many(dir->base_dir, entries, max_entries, name_buf, name_buf_size);
+  FILE_RECORD(dir, EVFS_TRACE_DIR_READ_MANY, start, max_entries, name_buf_size, count);
+
+  return count;
+}
+
+static int capture__dir_rewind(EvfsDir *dh) {
+  CaptureDir *dir = (CaptureDir *)dh;
+
+  uint64_t start = capture_clock(dir->shim_data);
+  int status = dir->base_dir->methods->m_rewind(dir->base_dir);
+  FILE_RECORD(dir, EVFS_TRACE_DIR_REWIND, start, 0, 0, status);
+
+  return status;
+}
+
+
+static const EvfsDirMethods s_capture_dir_methods = {
+  .m_close    = capture__dir_close,
+  .m_read     = capture__dir_read,
+  .m_rewind   = capture__dir_rewind,
+  .m_read_many = capture__dir_read_many
+};
+
+
+
+// ******************** FS access methods ********************
+
+#define VFS_RECORD(sd, op, start, path, size, result) \
+  capture_record((sd), (op), (start), 0, (size), 0, (result), (path), NULL)
+
+
+static int capture__open(Evfs *vfs, const char *path, EvfsFile *fh, int flags) {
+  CaptureFile *fil = (CaptureFile *)fh;
+  CaptureData *shim_data = (CaptureData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  fil->shim_data = shim_data;
+  fil->handle = next_handle(shim_data);
+  fil->base_file = (EvfsFile *)NEXT_OBJ(fil);  // We have two objects allocated together [CaptureFile][<base VFS file size>]
+
+  uint64_t start = capture_clock(shim_data);
+  int status = base_vfs->m_open(base_vfs, path, fil->base_file, flags);
+  capture_record(shim_data, EVFS_TRACE_OPEN, start, fil->handle, flags, 0, status, path, NULL);
+
+  if(status == EVFS_OK) {
+    // Add methods to make this functional
+    if(fil->base_file->methods) {
+      fh->methods = &s_capture_methods;
+    } else {
+      fh->methods = NULL;
+      status = EVFS_ERR_INIT;
+    }
+
+  } else { // Open failed
+    fh->methods = NULL;
+  }
+
+  return status;
+}
+
+
+static int capture__stat(Evfs *vfs, const char *path, EvfsInfo *info) {
+  CaptureData *shim_data = (CaptureData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  uint64_t start = capture_clock(shim_data);
+  int status = base_vfs->m_stat(base_vfs, path, info);
+  VFS_RECORD(shim_data, EVFS_TRACE_STAT, start, path, 0, status);
+
+  return status;
+}
+
+
+static int capture__delete(Evfs *vfs, const char *path) {
+  CaptureData *shim_data = (CaptureData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  uint64_t start = capture_clock(shim_data);
+  int status = base_vfs->m_delete(base_vfs, path);
+  VFS_RECORD(shim_data, EVFS_TRACE_DELETE, start, path, 0, status);
+
+  return status;
+}
+
+
+static int capture__rename(Evfs *vfs, const char *old_path, const char *new_path) {
+  CaptureData *shim_data = (CaptureData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  uint64_t start = capture_clock(shim_data);
+  int status = base_vfs->m_rename(base_vfs, old_path, new_path);
+  capture_record(shim_data, EVFS_TRACE_RENAME, start, 0, 0, 0, status, old_path, new_path);
+
+  return status;
+}
+
+
+static int capture__make_dir(Evfs *vfs, const char *path) {
+  CaptureData *shim_data = (CaptureData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  uint64_t start = capture_clock(shim_data);
+  int status = base_vfs->m_make_dir(base_vfs, path);
+  VFS_RECORD(shim_data, EVFS_TRACE_MAKE_DIR, start, path, 0, status);
+
+  return status;
+}
+
+
+static int capture__open_dir(Evfs *vfs, const char *path, EvfsDir *dh) {
+  CaptureDir *dir = (CaptureDir *)dh;
+  CaptureData *shim_data = (CaptureData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  dir->shim_data = shim_data;
+  dir->handle = next_handle(shim_data);
+  dir->base_dir = (EvfsDir *)NEXT_OBJ(dir);   // We have two objects allocated together [CaptureDir][<base VFS dir size>]
+
+  uint64_t start = capture_clock(shim_data);
+  int status = base_vfs->m_open_dir(base_vfs, path, dir->base_dir);
+  capture_record(shim_data, EVFS_TRACE_OPEN_DIR, start, dir->handle, 0, 0, status, path, NULL);
+
+  if(status == EVFS_OK) {
+    // Add methods to make this functional
+    if(dir->base_dir->methods) {
+      dh->methods = &s_capture_dir_methods;
+    } else {
+      dh->methods = NULL;
+      status = EVFS_ERR_INIT;
+    }
+
+  } else { // Open failed
+    dh->methods = NULL;
+  }
+
+  return status;
+}
+
+
+static int capture__get_cur_dir(Evfs *vfs, StringRange *cur_dir) {
+  CaptureData *shim_data = (CaptureData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  uint64_t start = capture_clock(shim_data);
+  int status = base_vfs->m_get_cur_dir(base_vfs, cur_dir);
+  VFS_RECORD(shim_data, EVFS_TRACE_GET_CUR_DIR, start, NULL, 0, status);
+
+  return status;
+}
+
+
+static int capture__set_cur_dir(Evfs *vfs, const char *path) {
+  CaptureData *shim_data = (CaptureData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  uint64_t start = capture_clock(shim_data);
+  int status = base_vfs->m_set_cur_dir(base_vfs, path);
+  VFS_RECORD(shim_data, EVFS_TRACE_SET_CUR_DIR, start, path, 0, status);
+
+  return status;
+}
+
+
+static int capture__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
+  CaptureData *shim_data = (CaptureData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  // We need special handling for EVFS_CMD_UNREGISTER.
+  // It can't pass through since we need to deallocate VFSs in the proper sequence
+  // to avoid corrupting the registered VFS linked list.
+  if(cmd == EVFS_CMD_UNREGISTER) {
+    evfs__lock(&shim_data->lock);
+    capture_flush(shim_data);
+    evfs__unlock(&shim_data->lock);
+
+    int status = shim_data->status;
+    evfs__lock_destroy(&shim_data->lock);
+    evfs_free(vfs); // Free this capture VFS
+    return status;
+  }
+
+  uint64_t start = capture_clock(shim_data);
+  int status = base_vfs->m_vfs_ctrl(base_vfs, cmd, arg);
+  VFS_RECORD(shim_data, EVFS_TRACE_VFS_CTRL, start, NULL, cmd, status);
+
+  return status;
+}
+
+
+static bool capture__path_root_component(Evfs *vfs, const char *path, StringRange *root) {
+  CaptureData *shim_data = (CaptureData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_path_root_component(base_vfs, path, root);
+}
+
+
+/*
+Register a capture tracing filesystem shim
+
+The capture file must stay open until the shim is unregistered. It should not
+be accessed through this shim.
+
+Args:
+  vfs_name:      Name of new shim
+  old_vfs_name:  Existing VFS to wrap with shim
+  capture:       Open file to write the capture into
+  clock:         Monotonic time source for timestamps. Use NULL to skip timing
+  default_vfs:   Make this the default VFS when true
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_register_trace_capture(const char *vfs_name, const char *old_vfs_name, EvfsFile *capture,
+                                EvfsTraceClock clock, bool default_vfs) {
+  if(PTR_CHECK(vfs_name) || PTR_CHECK(old_vfs_name) || PTR_CHECK(capture)) return EVFS_ERR_BAD_ARG;
+
+  Evfs *base_vfs, *shim_vfs;
+  CaptureData *shim_data;
+
+  base_vfs = evfs_find_vfs(old_vfs_name);
+  if(PTR_CHECK(base_vfs)) return EVFS_ERR_NO_VFS;
+
+  uint8_t header[EVFS_CAPTURE_HEADER_SIZE];
+  memcpy(header, EVFS_CAPTURE_MAGIC, sizeof(EVFS_CAPTURE_MAGIC));
+  set_unaligned_u16le(EVFS_CAPTURE_VERSION, &header[6]);
+
+  ptrdiff_t wrote = evfs_file_write(capture, header, sizeof(header));
+  if(wrote != sizeof(header))
+    return wrote < 0 ? wrote : EVFS_ERR_IO;
+
+  // Construct a new VFS
+  // We have four objects allocated together [Evfs][CaptureData][uint8_t[]][char[]]
+  size_t shim_size = sizeof(*shim_vfs) + sizeof(*shim_data) + CAPTURE_BUF_SIZE + strlen(vfs_name)+1;
+  shim_vfs = evfs_malloc(shim_size);
+  if(MEM_CHECK(shim_vfs)) return EVFS_ERR_ALLOC;
+
+  memset(shim_vfs, 0, shim_size);
+
+  shim_data = (CaptureData *)NEXT_OBJ(shim_vfs);
+  shim_data->buf = (uint8_t *)NEXT_OBJ(shim_data);
+
+  shim_vfs->vfs_name = (char *)&shim_data->buf[CAPTURE_BUF_SIZE];
+  strcpy((char *)shim_vfs->vfs_name, vfs_name);
+
+  shim_data->base_vfs = base_vfs;
+  shim_data->capture = capture;
+  shim_data->clock = clock;
+
+  if(evfs__lock_init(&shim_data->lock) != EVFS_OK) {
+    evfs_free(shim_vfs);
+    return EVFS_ERR_INIT;
+  }
+
+  shim_vfs->vfs_file_size = sizeof(CaptureFile) + base_vfs->vfs_file_size;
+  shim_vfs->vfs_dir_size = sizeof(CaptureDir) + base_vfs->vfs_dir_size;
+  shim_vfs->fs_data = shim_data;
+
+  shim_vfs->m_open = capture__open;
+  shim_vfs->m_stat = capture__stat;
+  shim_vfs->m_delete = capture__delete;
+  shim_vfs->m_rename = capture__rename;
+  shim_vfs->m_make_dir = capture__make_dir;
+  shim_vfs->m_open_dir = capture__open_dir;
+  shim_vfs->m_get_cur_dir = capture__get_cur_dir;
+  shim_vfs->m_set_cur_dir = capture__set_cur_dir;
+  shim_vfs->m_vfs_ctrl = capture__vfs_ctrl;
+
+  shim_vfs->m_path_root_component = capture__path_root_component;
+
+  return evfs_register(shim_vfs, default_vfs);
+}
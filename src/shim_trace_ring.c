@@ -0,0 +1,968 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Binary tracing shim VFS
+
+  This is a variant of the tracing shim that stores a fixed size record for
+  each call in a preallocated ring buffer instead of formatting text. Nothing
+  is allocated or formatted while tracing. Paths are reduced to a hash when
+  they're seen and file handles are given serial numbers so that later calls
+  can be matched to the path they were opened with. Records are collected
+  with evfs_trace_ring_read() and rendered to text by evfs_trace_format().
+
+  Writers claim slots with an atomic increment and never wait. When the ring
+  is full the oldest records are overwritten. Each slot has a sequence number
+  so the reader can detect records that are incomplete or were overwritten
+  while being copied. Only one thread may read from a ring.
+------------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "evfs.h"
+#include "evfs_internal.h"
+#include "evfs/shim/shim_trace.h"
+#include "evfs/util/dhash.h"
+
+
+// Access objects allocated in a single block of memory
+#define NEXT_OBJ(o) (&(o)[1])
+
+
+#ifdef EVFS_USE_THREADING
+#  include <stdatomic.h>
+
+typedef atomic_size_t         RingIndex;
+typedef atomic_uint_least32_t RingWord;
+typedef atomic_uint           RingCount;
+
+#  define RING_LOAD(v, mo)        atomic_load_explicit(&(v), memory_order_##mo)
+#  define RING_STORE(v, x, mo)    atomic_store_explicit(&(v), (x), memory_order_##mo)
+#  define RING_FETCH_ADD(v, x)    atomic_fetch_add_explicit(&(v), (x), memory_order_relaxed)
+#  define RING_FENCE(mo)          atomic_thread_fence(memory_order_##mo)
+#else
+typedef size_t    RingIndex;
+typedef uint32_t  RingWord;
+typedef unsigned  RingCount;
+
+#  define RING_LOAD(v, mo)        (v)
+#  define RING_STORE(v, x, mo)    ((v) = (x))
+#  define RING_FETCH_ADD(v, x)    (((v) += (x)) - (x))
+#  define RING_FENCE(mo)
+#endif
+
+
+#define RECORD_WORDS  (sizeof(EvfsTraceRecord) / sizeof(uint32_t))
+
+// Records are stored as words so they can be copied atomically piece by piece
+typedef struct TraceSlot {
+  RingIndex seq;    // 2*index+1 while record index is being written, 2*index+2 when complete
+  RingWord  words[RECORD_WORDS];
+} TraceSlot;
+
+struct EvfsTraceRing {
+  EvfsTraceClock clock;
+  size_t      mask;       // Number of slots - 1
+  RingIndex   head;       // Index of the next record to write
+  size_t      tail;       // Index of the next record to read
+  RingCount   layers;     // Number of shims attached
+  TraceSlot  *slots;
+};
+
+
+typedef struct TraceRingData_s {
+  Evfs *base_vfs;
+  EvfsTraceRing *ring;
+  uint16_t layer;
+  RingCount next_handle;
+} TraceRingData;
+
+typedef struct TraceRingFile_s {
+  EvfsFile base;
+  TraceRingData *shim_data;
+  EvfsFile *base_file;
+  uint32_t handle;
+  uint32_t name_hash;
+} TraceRingFile;
+
+typedef struct TraceRingDir_s {
+  EvfsDir base;
+  TraceRingData *shim_data;
+  EvfsDir *base_dir;
+  uint32_t handle;
+  uint32_t name_hash;
+} TraceRingDir;
+
+
+
+// ******************** Ring buffer ********************
+
+/*
+Create a ring buffer for binary traces
+
+Args:
+  num_records:  Minimum number of records to hold. This is rounded up to a power of 2
+  clock:        Monotonic time source for timestamps. Use NULL to skip timing
+  ring:         New ring buffer
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_trace_ring_new(size_t num_records, EvfsTraceClock clock, EvfsTraceRing **ring) {
+  if(PTR_CHECK(ring) || num_records == 0) return EVFS_ERR_BAD_ARG;
+
+  *ring = NULL;
+
+  size_t num_slots = 1;
+  while(num_slots < num_records) {
+    num_slots <<= 1;
+  }
+
+  // We have two objects allocated together [EvfsTraceRing][TraceSlot[]]
+  EvfsTraceRing *new_ring = evfs_malloc(sizeof(*new_ring) + num_slots * sizeof(TraceSlot));
+  if(MEM_CHECK(new_ring)) return EVFS_ERR_ALLOC;
+
+  memset(new_ring, 0, sizeof(*new_ring) + num_slots * sizeof(TraceSlot));
+  new_ring->clock = clock;
+  new_ring->mask = num_slots - 1;
+  new_ring->slots = (TraceSlot *)NEXT_OBJ(new_ring);
+
+  *ring = new_ring;
+  return EVFS_OK;
+}
+
+
+/*
+Free a ring buffer for binary traces
+
+All shims attached to the ring must be unregistered first.
+
+Args:
+  ring:  Ring to free
+*/
+void evfs_trace_ring_free(EvfsTraceRing *ring) {
+  evfs_free(ring);
+}
+
+
+static inline uint64_t ring_clock(EvfsTraceRing *ring) {
+  return ring->clock ? ring->clock() : 0;
+}
+
+
+static void ring_write(EvfsTraceRing *ring, const EvfsTraceRecord *rec) {
+  uint32_t words[RECORD_WORDS];
+  memcpy(words, rec, sizeof(words));
+
+  size_t index = RING_FETCH_ADD(ring->head, 1);
+  TraceSlot *slot = &ring->slots[index & ring->mask];
+
+  // Mark the slot busy before any of its words change
+  RING_STORE(slot->seq, 2*index + 1, relaxed);
+  RING_FENCE(release);
+
+  for(size_t i = 0; i < RECORD_WORDS; i++) {
+    RING_STORE(slot->words[i], words[i], relaxed);
+  }
+
+  RING_STORE(slot->seq, 2*index + 2, release);
+}
+
+
+/*
+Collect records from a ring buffer
+
+Records are returned in the order their calls started. Reading stops early
+at a record that is still being written. Records lost to overwriting are
+counted in dropped.
+
+Args:
+  ring:         Ring to read from
+  records:      Array of records
+  max_records:  Size of the records array
+  dropped:      Optional number of records skipped since the last read
+
+Returns:
+  Number of records copied into records
+*/
+size_t evfs_trace_ring_read(EvfsTraceRing *ring, EvfsTraceRecord *records, size_t max_records,
+                            size_t *dropped) {
+  if(PTR_CHECK(ring) || PTR_CHECK(records)) return 0;
+
+  size_t lost = 0;
+  size_t count = 0;
+  size_t head = RING_LOAD(ring->head, acquire);
+
+  // Skip anything the writers have lapped
+  if(head - ring->tail > ring->mask + 1) {
+    lost = head - ring->tail - (ring->mask + 1);
+    ring->tail = head - (ring->mask + 1);
+  }
+
+  while(count < max_records && ring->tail != head) {
+    TraceSlot *slot = &ring->slots[ring->tail & ring->mask];
+    size_t done_seq = 2*ring->tail + 2;
+    size_t seq = RING_LOAD(slot->seq, acquire);
+
+    if((ptrdiff_t)(seq - done_seq) < 0) // Not finished yet
+      break;
+
+    if(seq == done_seq) {
+      uint32_t words[RECORD_WORDS];
+      for(size_t i = 0; i < RECORD_WORDS; i++) {
+        words[i] = RING_LOAD(slot->words[i], relaxed);
+      }
+
+      // Discard the copy if a writer took the slot while we read it
+      RING_FENCE(acquire);
+      if(RING_LOAD(slot->seq, relaxed) == seq) {
+        memcpy(&records[count++], words, sizeof(words));
+        ring->tail++;
+        continue;
+      }
+    }
+
+    // Overwritten by a later record
+    lost++;
+    ring->tail++;
+  }
+
+  if(dropped)
+    *dropped = lost;
+
+  return count;
+}
+
+
+static void trace_record(TraceRingData *shim_data, EvfsTraceOp op, uint64_t start, uint32_t handle,
+                         uint32_t name_hash, int32_t size, int32_t offset, int32_t result) {
+  EvfsTraceRing *ring = shim_data->ring;
+
+  EvfsTraceRecord rec = {
+    .timestamp  = start,
+    .elapsed    = (uint32_t)(ring_clock(ring) - start),
+    .handle     = handle,
+    .name_hash  = name_hash,
+    .size       = size,
+    .offset     = offset,
+    .result     = result,
+    .op         = op,
+    .layer      = shim_data->layer
+  };
+
+  ring_write(ring, &rec);
+}
+
+
+/*
+Hash a path for matching against binary trace records
+
+Args:
+  name:  Path to hash
+
+Returns:
+  Hash of name
+*/
+uint32_t evfs_trace_name_hash(const char *name) {
+  if(!name)
+    return 0;
+
+  dhKey key = {.data = name, .length = strlen(name)};
+  return dh_gen_hash_string(key);
+}
+
+
+static uint32_t next_handle(TraceRingData *shim_data) {
+  uint32_t handle = RING_FETCH_ADD(shim_data->next_handle, 1) + 1;
+  return handle ? handle : 1; // 0 is reserved for VFS methods
+}
+
+
+
+// ******************** File access methods ********************
+
+#define FILE_RECORD(fil, op, start, size, offset, result) \
+  trace_record((fil)->shim_data, (op), (start), (fil)->handle, (fil)->name_hash, \
+               (int32_t)(size), (int32_t)(offset), (int32_t)(result))
+
+static int trace_ring__file_ctrl(EvfsFile *fh, int cmd, void *arg) {
+  TraceRingFile *fil = (TraceRingFile *)fh;
+
+  uint64_t start = ring_clock(fil->shim_data->ring);
+  int status = fil->base_file->methods->m_ctrl(fil->base_file, cmd, arg);
+  FILE_RECORD(fil, EVFS_TRACE_CTRL, start, cmd, 0, status);
+
+  return status;
+}
+
+
+static int trace_ring__file_close(EvfsFile *fh) {
+  TraceRingFile *fil = (TraceRingFile *)fh;
+
+  uint64_t start = ring_clock(fil->shim_data->ring);
+  int status = fil->base_file->methods->m_close(fil->base_file);
+  FILE_RECORD(fil, EVFS_TRACE_CLOSE, start, 0, 0, status);
+
+  if(status == EVFS_OK) {
+    fil->base.methods = NULL; // Disable this instance
+  }
+
+  return status;
+}
+
+
+static ptrdiff_t trace_ring__file_read(EvfsFile *fh, void *buf, size_t size) {
+  TraceRingFile *fil = (TraceRingFile *)fh;
+
+  uint64_t start = ring_clock(fil->shim_data->ring);
+  ptrdiff_t read = fil->base_file->methods->m_read(fil->base_file, buf, size);
+  FILE_RECORD(fil, EVFS_TRACE_READ, start, size, 0, read);
+
+  return read;
+}
+
+
+static ptrdiff_t trace_ring__file_write(EvfsFile *fh, const void *buf, size_t size) {
+  TraceRingFile *fil = (TraceRingFile *)fh;
+
+  uint64_t start = ring_clock(fil->shim_data->ring);
+  ptrdiff_t wrote = fil->base_file->methods->m_write(fil->base_file, buf, size);
+  FILE_RECORD(fil, EVFS_TRACE_WRITE, start, size, 0, wrote);
+
+  return wrote;
+}
+
+
+static ptrdiff_t trace_ring__file_read_at(EvfsFile *fh, void *buf, size_t size, evfs_off_t offset) {
+  TraceRingFile *fil = (TraceRingFile *)fh;
+
+  uint64_t start = ring_clock(fil->shim_data->ring);
+  ptrdiff_t read = evfs_file_read_at(fil->base_file, buf, size, offset);
+  FILE_RECORD(fil, EVFS_TRACE_READ_AT, start, size, offset, read);
+
+  return read;
+}
+
+
+static ptrdiff_t trace_ring__file_write_at(EvfsFile *fh, const void *buf, size_t size, evfs_off_t offset) {
+  TraceRingFile *fil = (TraceRingFile *)fh;
+
+  uint64_t start = ring_clock(fil->shim_data->ring);
+  ptrdiff_t wrote = evfs_file_write_at(fil->base_file, buf, size, offset);
+  FILE_RECORD(fil, EVFS_TRACE_WRITE_AT, start, size, offset, wrote);
+
+  return wrote;
+}
+
+
+static ptrdiff_t trace_ring__file_readv(EvfsFile *fh, const EvfsIOVec *iov, int iovcnt) {
+  TraceRingFile *fil = (TraceRingFile *)fh;
+
+  uint64_t start = ring_clock(fil->shim_data->ring);
+  ptrdiff_t read = evfs_file_readv(fil->base_file, iov, iovcnt);
+  FILE_RECORD(fil, EVFS_TRACE_READV, start, iovcnt, 0, read);
+
+  return read;
+}
+
+
+static ptrdiff_t trace_ring__file_writev(EvfsFile *fh, const EvfsIOVec *iov, int iovcnt) {
+  TraceRingFile *fil = (TraceRingFile *)fh;
+
+  uint64_t start = ring_clock(fil->shim_data->ring);
+  ptrdiff_t wrote = evfs_file_writev(fil->base_file, iov, iovcnt);
+  FILE_RECORD(fil, EVFS_TRACE_WRITEV, start, iovcnt, 0, wrote);
+
+  return wrote;
+}
+
+
+static int trace_ring__file_map(EvfsFile *fh, evfs_off_t offset, size_t size, EvfsMapping *map) {
+  TraceRingFile *fil = (TraceRingFile *)fh;
+
+  uint64_t start = ring_clock(fil->shim_data->ring);
+  int status = evfs_file_map(fil->base_file, offset, size, map);
+  FILE_RECORD(fil, EVFS_TRACE_MAP, start, size, offset, status);
+
+  return status;
+}
+
+
+static int trace_ring__file_unmap(EvfsFile *fh, EvfsMapping *map) {
+  TraceRingFile *fil = (TraceRingFile *)fh;
+
+  uint64_t start = ring_clock(fil->shim_data->ring);
+  int status = evfs_file_unmap(fil->base_file, map);
+  FILE_RECORD(fil, EVFS_TRACE_UNMAP, start, 0, 0, status);
+
+  return status;
+}
+
+
+static int trace_ring__file_discard(EvfsFile *fh, evfs_off_t offset, evfs_off_t size) {
+  TraceRingFile *fil = (TraceRingFile *)fh;
+
+  uint64_t start = ring_clock(fil->shim_data->ring);
+  int status = evfs_file_discard(fil->base_file, offset, size);
+  FILE_RECORD(fil, EVFS_TRACE_DISCARD, start, size, offset, status);
+
+  return status;
+}
+
+
+static int trace_ring__file_truncate(EvfsFile *fh, evfs_off_t size) {
+  TraceRingFile *fil = (TraceRingFile *)fh;
+
+  uint64_t start = ring_clock(fil->shim_data->ring);
+  int status = fil->base_file->methods->m_truncate(fil->base_file, size);
+  FILE_RECORD(fil, EVFS_TRACE_TRUNCATE, start, size, 0, status);
+
+  return status;
+}
+
+
+static int trace_ring__file_sync(EvfsFile *fh) {
+  TraceRingFile *fil = (TraceRingFile *)fh;
+
+  uint64_t start = ring_clock(fil->shim_data->ring);
+  int status = fil->base_file->methods->m_sync(fil->base_file);
+  FILE_RECORD(fil, EVFS_TRACE_SYNC, start, 0, 0, status);
+
+  return status;
+}
+
+
+static evfs_off_t trace_ring__file_size(EvfsFile *fh) {
+  TraceRingFile *fil = (TraceRingFile *)fh;
+
+  uint64_t start = ring_clock(fil->shim_data->ring);
+  evfs_off_t size = fil->base_file->methods->m_size(fil->base_file);
+  FILE_RECORD(fil, EVFS_TRACE_SIZE, start, 0, 0, size);
+
+  return size;
+}
+
+
+static int trace_ring__file_seek(EvfsFile *fh, evfs_off_t offset, EvfsSeekDir origin) {
+  TraceRingFile *fil = (TraceRingFile *)fh;
+
+  uint64_t start = ring_clock(fil->shim_data->ring);
+  int status = fil->base_file->methods->m_seek(fil->base_file, offset, origin);
+  FILE_RECORD(fil, EVFS_TRACE_SEEK, start, origin, offset, status);
+
+  return status;
+}
+
+
+static evfs_off_t trace_ring__file_tell(EvfsFile *fh) {
+  TraceRingFile *fil = (TraceRingFile *)fh;
+
+  uint64_t start = ring_clock(fil->shim_data->ring);
+  evfs_off_t pos = fil->base_file->methods->m_tell(fil->base_file);
+  FILE_RECORD(fil, EVFS_TRACE_TELL, start, 0, 0, pos);
+
+  return pos;
+}
+
+
+static bool trace_ring__file_eof(EvfsFile *fh) {
+  TraceRingFile *fil = (TraceRingFile *)fh;
+
+  uint64_t start = ring_clock(fil->shim_data->ring);
+  bool eof = fil->base_file->methods->m_eof(fil->base_file);
+  FILE_RECORD(fil, EVFS_TRACE_EOF, start, 0, 0, eof);
+
+  return eof;
+}
+
+
+static const EvfsFileMethods s_trace_ring_methods = {
+  .m_ctrl     = trace_ring__file_ctrl,
+  .m_close    = trace_ring__file_close,
+  .m_read     = trace_ring__file_read,
+  .m_write    = trace_ring__file_write,
+  .m_truncate = trace_ring__file_truncate,
+  .m_sync     = trace_ring__file_sync,
+  .m_size     = trace_ring__file_size,
+  .m_seek     = trace_ring__file_seek,
+  .m_tell     = trace_ring__file_tell,
+  .m_eof      = trace_ring__file_eof,
+  .m_read_at  = trace_ring__file_read_at,
+  .m_write_at = trace_ring__file_write_at,
+  .m_readv    = trace_ring__file_readv,
+  .m_writev   = trace_ring__file_writev,
+  .m_map      = trace_ring__file_map,
+  .m_unmap    = trace_ring__file_unmap,
+  .m_discard  = trace_ring__file_discard
+};
+
+
+
+// ******************** Directory access methods ********************
+
+static int trace_ring__dir_close(EvfsDir *dh) {
+  TraceRingDir *dir = (TraceRingDir *)dh;
+
+  uint64_t start = ring_clock(dir->shim_data->ring);
+  int status = dir->base_dir->methods->m_close(dir->base_dir);
+  FILE_RECORD(dir, EVFS_TRACE_DIR_CLOSE, start, 0, 0, status);
+
+  if(status == EVFS_OK) {
+    dir->base.methods = NULL; // Disable this instance
+  }
+
+  return status;
+}
+
+static int trace_ring__dir_read(EvfsDir *dh, EvfsInfo *info) {
+  TraceRingDir *dir = (TraceRingDir *)dh;
+
+  uint64_t start = ring_clock(dir->shim_data->ring);
+  int status = dir->base_dir->methods->m_read(dir->base_dir, info);
+  FILE_RECORD(dir, EVFS_TRACE_DIR_READ, start, 0, 0, status);
+
+  return status;
+}
+
+static int trace_ring__dir_read_many(EvfsDir *dh, EvfsInfo *entries, int max_entries, char *name_buf,
+                                     size_t name_buf_size) {
+  TraceRingDir *dir = (TraceRingDir *)dh;
+
+  uint64_t start = ring_clock(dir->shim_data->ring);
+  int count = evfs_dir_read_many(dir->base_dir, entries, max_entries, name_buf, name_buf_size);
+  FILE_RECORD(dir, EVFS_TRACE_DIR_READ_MANY, start, max_entries, 0, count);
+
+  return count;
+}
+
+static int trace_ring__dir_rewind(EvfsDir *dh) {
+  TraceRingDir *dir = (TraceRingDir *)dh;
+
+  uint64_t start = ring_clock(dir->shim_data->ring);
+  int status = dir->base_dir->methods->m_rewind(dir->base_dir);
+  FILE_RECORD(dir, EVFS_TRACE_DIR_REWIND, start, 0, 0, status);
+
+  return status;
+}
+
+
+static const EvfsDirMethods s_trace_ring_dir_methods = {
+  .m_close    = trace_ring__dir_close,
+  .m_read     = trace_ring__dir_read,
+  .m_rewind   = trace_ring__dir_rewind,
+  .m_read_many = trace_ring__dir_read_many
+};
+
+
+
+// ******************** FS access methods ********************
+
+#define VFS_RECORD(sd, op, start, path, size, offset, result) \
+  trace_record((sd), (op), (start), 0, evfs_trace_name_hash(path), \
+               (int32_t)(size), (int32_t)(offset), (int32_t)(result))
+
+
+static int trace_ring__open(Evfs *vfs, const char *path, EvfsFile *fh, int flags) {
+  TraceRingFile *fil = (TraceRingFile *)fh;
+  TraceRingData *shim_data = (TraceRingData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  fil->shim_data = shim_data;
+  fil->handle = next_handle(shim_data);
+  fil->name_hash = evfs_trace_name_hash(path);
+  fil->base_file = (EvfsFile *)NEXT_OBJ(fil);  // We have two objects allocated together [TraceRingFile][<base VFS file size>]
+
+  uint64_t start = ring_clock(shim_data->ring);
+  int status = base_vfs->m_open(base_vfs, path, fil->base_file, flags);
+  FILE_RECORD(fil, EVFS_TRACE_OPEN, start, flags, 0, status);
+
+  if(status == EVFS_OK) {
+    // Add methods to make this functional
+    if(fil->base_file->methods) {
+      fh->methods = &s_trace_ring_methods;
+    } else {
+      fh->methods = NULL;
+      status = EVFS_ERR_INIT;
+    }
+
+  } else { // Open failed
+    fh->methods = NULL;
+  }
+
+  return status;
+}
+
+
+static int trace_ring__stat(Evfs *vfs, const char *path, EvfsInfo *info) {
+  TraceRingData *shim_data = (TraceRingData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  uint64_t start = ring_clock(shim_data->ring);
+  int status = base_vfs->m_stat(base_vfs, path, info);
+  VFS_RECORD(shim_data, EVFS_TRACE_STAT, start, path, 0, 0, status);
+
+  return status;
+}
+
+
+static int trace_ring__delete(Evfs *vfs, const char *path) {
+  TraceRingData *shim_data = (TraceRingData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  uint64_t start = ring_clock(shim_data->ring);
+  int status = base_vfs->m_delete(base_vfs, path);
+  VFS_RECORD(shim_data, EVFS_TRACE_DELETE, start, path, 0, 0, status);
+
+  return status;
+}
+
+
+static int trace_ring__rename(Evfs *vfs, const char *old_path, const char *new_path) {
+  TraceRingData *shim_data = (TraceRingData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  uint64_t start = ring_clock(shim_data->ring);
+  int status = base_vfs->m_rename(base_vfs, old_path, new_path);
+  // The new path hash goes in the offset field
+  VFS_RECORD(shim_data, EVFS_TRACE_RENAME, start, old_path, 0, evfs_trace_name_hash(new_path), status);
+
+  return status;
+}
+
+
+static int trace_ring__make_dir(Evfs *vfs, const char *path) {
+  TraceRingData *shim_data = (TraceRingData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  uint64_t start = ring_clock(shim_data->ring);
+  int status = base_vfs->m_make_dir(base_vfs, path);
+  VFS_RECORD(shim_data, EVFS_TRACE_MAKE_DIR, start, path, 0, 0, status);
+
+  return status;
+}
+
+
+static int trace_ring__open_dir(Evfs *vfs, const char *path, EvfsDir *dh) {
+  TraceRingDir *dir = (TraceRingDir *)dh;
+  TraceRingData *shim_data = (TraceRingData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  dir->shim_data = shim_data;
+  dir->handle = next_handle(shim_data);
+  dir->name_hash = evfs_trace_name_hash(path);
+  dir->base_dir = (EvfsDir *)NEXT_OBJ(dir);   // We have two objects allocated together [TraceRingDir][<base VFS dir size>]
+
+  uint64_t start = ring_clock(shim_data->ring);
+  int status = base_vfs->m_open_dir(base_vfs, path, dir->base_dir);
+  FILE_RECORD(dir, EVFS_TRACE_OPEN_DIR, start, 0, 0, status);
+
+  if(status == EVFS_OK) {
+    // Add methods to make this functional
+    if(dir->base_dir->methods) {
+      dh->methods = &s_trace_ring_dir_methods;
+    } else {
+      dh->methods = NULL;
+      status = EVFS_ERR_INIT;
+    }
+
+  } else { // Open failed
+    dh->methods = NULL;
+  }
+
+  return status;
+}
+
+
+static int trace_ring__get_cur_dir(Evfs *vfs, StringRange *cur_dir) {
+  TraceRingData *shim_data = (TraceRingData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  uint64_t start = ring_clock(shim_data->ring);
+  int status = base_vfs->m_get_cur_dir(base_vfs, cur_dir);
+  VFS_RECORD(shim_data, EVFS_TRACE_GET_CUR_DIR, start, NULL, 0, 0, status);
+
+  return status;
+}
+
+
+static int trace_ring__set_cur_dir(Evfs *vfs, const char *path) {
+  TraceRingData *shim_data = (TraceRingData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  uint64_t start = ring_clock(shim_data->ring);
+  int status = base_vfs->m_set_cur_dir(base_vfs, path);
+  VFS_RECORD(shim_data, EVFS_TRACE_SET_CUR_DIR, start, path, 0, 0, status);
+
+  return status;
+}
+
+
+static int trace_ring__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
+  TraceRingData *shim_data = (TraceRingData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  // We need special handling for EVFS_CMD_UNREGISTER.
+  // It can't pass through since we need to deallocate VFSs in the proper sequence
+  // to avoid corrupting the registered VFS linked list.
+  if(cmd == EVFS_CMD_UNREGISTER) {
+      evfs_free(vfs); // Free this trace VFS
+      return EVFS_OK;
+  }
+
+  uint64_t start = ring_clock(shim_data->ring);
+  int status = base_vfs->m_vfs_ctrl(base_vfs, cmd, arg);
+  VFS_RECORD(shim_data, EVFS_TRACE_VFS_CTRL, start, NULL, cmd, 0, status);
+
+  return status;
+}
+
+
+static bool trace_ring__path_root_component(Evfs *vfs, const char *path, StringRange *root) {
+  TraceRingData *shim_data = (TraceRingData *)vfs->fs_data;
+  Evfs *base_vfs = shim_data->base_vfs;
+
+  return base_vfs->m_path_root_component(base_vfs, path, root);
+}
+
+
+/*
+Register a binary tracing filesystem shim
+
+Several shims can share a ring. Each is given a layer number in the order
+they are registered.
+
+Args:
+  vfs_name:      Name of new shim
+  old_vfs_name:  Existing VFS to wrap with shim
+  ring:          Ring buffer for trace records
+  default_vfs:   Make this the default VFS when true
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_register_trace_ring(const char *vfs_name, const char *old_vfs_name, EvfsTraceRing *ring,
+                             bool default_vfs) {
+  if(PTR_CHECK(vfs_name) || PTR_CHECK(old_vfs_name) || PTR_CHECK(ring)) return EVFS_ERR_BAD_ARG;
+
+  Evfs *base_vfs, *shim_vfs;
+  TraceRingData *shim_data;
+
+  base_vfs = evfs_find_vfs(old_vfs_name);
+  if(PTR_CHECK(base_vfs)) return EVFS_ERR_NO_VFS;
+
+  // Construct a new VFS
+  // We have three objects allocated together [Evfs][TraceRingData][char[]]
+  size_t shim_size = sizeof(*shim_vfs) + sizeof(*shim_data) + strlen(vfs_name)+1;
+  shim_vfs = evfs_malloc(shim_size);
+  if(MEM_CHECK(shim_vfs)) return EVFS_ERR_ALLOC;
+
+  memset(shim_vfs, 0, shim_size);
+
+  shim_data = (TraceRingData *)NEXT_OBJ(shim_vfs);
+
+  shim_vfs->vfs_name = (char *)NEXT_OBJ(shim_data);
+  strcpy((char *)shim_vfs->vfs_name, vfs_name);
+
+  shim_data->base_vfs = base_vfs;
+  shim_data->ring = ring;
+  shim_data->layer = RING_FETCH_ADD(ring->layers, 1);
+
+  shim_vfs->vfs_file_size = sizeof(TraceRingFile) + base_vfs->vfs_file_size;
+  shim_vfs->vfs_dir_size = sizeof(TraceRingDir) + base_vfs->vfs_dir_size;
+  shim_vfs->fs_data = shim_data;
+
+  shim_vfs->m_open = trace_ring__open;
+  shim_vfs->m_stat = trace_ring__stat;
+  shim_vfs->m_delete = trace_ring__delete;
+  shim_vfs->m_rename = trace_ring__rename;
+  shim_vfs->m_make_dir = trace_ring__make_dir;
+  shim_vfs->m_open_dir = trace_ring__open_dir;
+  shim_vfs->m_get_cur_dir = trace_ring__get_cur_dir;
+  shim_vfs->m_set_cur_dir = trace_ring__set_cur_dir;
+  shim_vfs->m_vfs_ctrl = trace_ring__vfs_ctrl;
+
+  shim_vfs->m_path_root_component = trace_ring__path_root_component;
+
+  return evfs_register(shim_vfs, default_vfs);
+}
+
+
+
+// ******************** Decoding ********************
+
+#define EVFS_TRACE_NAME_CASE(E, S)  case E: return S;
+
+/*
+Translate a trace op code to the name of its method
+
+Args:
+  op:  Trace op code
+
+Returns:
+  The method name string
+*/
+const char *evfs_trace_op_name(EvfsTraceOp op) {
+  switch(op) {
+    EVFS_TRACE_OP_LIST(EVFS_TRACE_NAME_CASE);
+    default: break;
+  }
+
+  return "<unknown>";
+}
+
+
+// Render a name hash as a path when the decoder knows it
+static const char *decode_name(const EvfsTraceDecoder *decoder, uint32_t name_hash, char *buf, size_t buf_size) {
+  if(decoder && decoder->lookup_name) {
+    const char *name = decoder->lookup_name(name_hash, decoder->ctx);
+    if(name)
+      return name;
+  }
+
+  snprintf(buf, buf_size, "@%08" PRIX32, name_hash);
+  return buf;
+}
+
+
+/*
+Render a binary trace record as text
+
+The output matches the format of the text trace shim with the timestamp and
+elapsed time of the call added.
+
+Args:
+  rec:       Record to format
+  decoder:   Optional names for layers and paths
+  buf:       Destination for the formatted string
+  buf_size:  Size of buf
+
+Returns:
+  Length of the formatted string like snprintf()
+*/
+int evfs_trace_format(const EvfsTraceRecord *rec, const EvfsTraceDecoder *decoder, char *buf,
+                      size_t buf_size) {
+  if(PTR_CHECK(rec) || PTR_CHECK(buf)) return EVFS_ERR_BAD_ARG;
+
+  char layer_buf[12];
+  const char *layer_name;
+  if(decoder && decoder->layer_names && rec->layer < decoder->num_layers) {
+    layer_name = decoder->layer_names[rec->layer];
+  } else {
+    snprintf(layer_buf, sizeof(layer_buf), "L%u", (unsigned)rec->layer);
+    layer_name = layer_buf;
+  }
+
+  char name_buf[12];
+  const char *name = decode_name(decoder, rec->name_hash, name_buf, sizeof(name_buf));
+
+  char args[80];
+  args[0] = '\0';
+
+  // Arguments depend on the method
+  switch(rec->op) {
+  case EVFS_TRACE_OPEN:
+    snprintf(args, sizeof(args), "%s#%" PRIu32 ", flags=0x%02" PRIX32, name, rec->handle,
+             (uint32_t)rec->size);
+    break;
+
+  case EVFS_TRACE_RENAME:
+    {
+      char new_buf[12];
+      const char *new_name = decode_name(decoder, (uint32_t)rec->offset, new_buf, sizeof(new_buf));
+      snprintf(args, sizeof(args), "%s, %s", name, new_name);
+    }
+    break;
+
+  case EVFS_TRACE_STAT:
+  case EVFS_TRACE_DELETE:
+  case EVFS_TRACE_MAKE_DIR:
+  case EVFS_TRACE_SET_CUR_DIR:
+    snprintf(args, sizeof(args), "%s", name);
+    break;
+
+  case EVFS_TRACE_VFS_CTRL:
+    snprintf(args, sizeof(args), "cmd=%s", evfs_cmd_name(rec->size));
+    break;
+
+  case EVFS_TRACE_GET_CUR_DIR:
+    break;
+
+  case EVFS_TRACE_CTRL:
+    snprintf(args, sizeof(args), "%s#%" PRIu32 ", cmd=%s", name, rec->handle, evfs_cmd_name(rec->size));
+    break;
+
+  case EVFS_TRACE_READ:
+  case EVFS_TRACE_WRITE:
+  case EVFS_TRACE_TRUNCATE:
+    snprintf(args, sizeof(args), "%s#%" PRIu32 ", size=%" PRId32, name, rec->handle, rec->size);
+    break;
+
+  case EVFS_TRACE_READ_AT:
+  case EVFS_TRACE_WRITE_AT:
+  case EVFS_TRACE_MAP:
+    snprintf(args, sizeof(args), "%s#%" PRIu32 ", size=%" PRId32 ", offset=%" PRId32, name,
+             rec->handle, rec->size, rec->offset);
+    break;
+
+  case EVFS_TRACE_READV:
+  case EVFS_TRACE_WRITEV:
+    snprintf(args, sizeof(args), "%s#%" PRIu32 ", iovcnt=%" PRId32, name, rec->handle, rec->size);
+    break;
+
+  case EVFS_TRACE_SEEK:
+    snprintf(args, sizeof(args), "%s#%" PRIu32 ", offset=%" PRId32 ", origin=%" PRId32, name,
+             rec->handle, rec->offset, rec->size);
+    break;
+
+  case EVFS_TRACE_DIR_READ_MANY:
+    snprintf(args, sizeof(args), "%s#%" PRIu32 ", max_entries=%" PRId32, name, rec->handle, rec->size);
+    break;
+
+  default: // Handle only
+    snprintf(args, sizeof(args), "%s#%" PRIu32, name, rec->handle);
+    break;
+  }
+
+  // Results are counts for some methods and status codes for the rest
+  char result_buf[12];
+  const char *result;
+  switch(rec->op) {
+  case EVFS_TRACE_READ:
+  case EVFS_TRACE_WRITE:
+  case EVFS_TRACE_READ_AT:
+  case EVFS_TRACE_WRITE_AT:
+  case EVFS_TRACE_READV:
+  case EVFS_TRACE_WRITEV:
+  case EVFS_TRACE_SIZE:
+  case EVFS_TRACE_TELL:
+  case EVFS_TRACE_DIR_READ_MANY:
+    if(rec->result >= 0) {
+      snprintf(result_buf, sizeof(result_buf), "%" PRId32, rec->result);
+      result = result_buf;
+    } else {
+      result = evfs_err_name(rec->result);
+    }
+    break;
+
+  case EVFS_TRACE_EOF:
+    result = rec->result ? "T" : "f";
+    break;
+
+  default:
+    result = evfs_err_name(rec->result);
+    break;
+  }
+
+  return snprintf(buf, buf_size, "[[ %" PRIu64 " %s.%s(%s) -> %s  +%" PRIu32 " ]]", rec->timestamp,
+                  layer_name, evfs_trace_op_name(rec->op), args, result, rec->elapsed);
+}
@@ -21,6 +21,10 @@ Embedded Virtual Filesystem
 ------------------------------------------------------------------------------
 */
 
+#if defined __linux__ && !defined _GNU_SOURCE
+#  define _GNU_SOURCE   // fallocate()
+#endif
+
 #include <stdio.h>
 #include <string.h>
 
@@ -32,22 +36,38 @@ Embedded Virtual Filesystem
 
 
 #ifdef EVFS_USE_STDIO_POSIX
+# include <fcntl.h>
 # include <sys/stat.h>
 # include <unistd.h>
 # include <dirent.h>
 # include <errno.h>
+# include <sys/uio.h>
+# include <sys/mman.h>
+# ifdef __linux__
+#   include <sys/sendfile.h>
+# endif
+#endif
+
+#if defined EVFS_USE_STDIO_IO_URING && defined EVFS_USE_STDIO_POSIX && defined __linux__ \
+    && defined EVFS_USE_THREADING
+# define USE_IO_URING
+# include <sys/syscall.h>
+# include <linux/io_uring.h>
 #endif
 
 typedef struct StdioData_s {
   // VFS config options
   unsigned cfg_readonly    :1; // EVFS_CMD_SET_READONLY
   unsigned cfg_no_dir_dots :1; // EVFS_CMD_SET_NO_DIR_DOTS
+  unsigned cfg_dir_stat    :1; // EVFS_CMD_SET_DIR_STAT
 } StdioData;
 
 typedef struct StdioFile_s {
   EvfsFile base;
   StdioData *fs_data;
   FILE *fp;
+  bool writable;    // Opened with a mode that can buffer writes
+  unsigned advice;  // EVFS_CMD_SET_FILE_ADVICE
 } StdioFile;
 
 
@@ -89,9 +109,55 @@ static int translate_error(int err) {
 
 // ******************** File access methods ********************
 
+#if defined EVFS_USE_STDIO_POSIX && defined POSIX_FADV_NORMAL
+static int set_advice(StdioFile *fil, unsigned advice) {
+  int posix_advice;
+
+  switch(advice) {
+    case EVFS_ADVICE_NORMAL:      posix_advice = POSIX_FADV_NORMAL; break;
+    case EVFS_ADVICE_SEQUENTIAL:  posix_advice = POSIX_FADV_SEQUENTIAL; break;
+    case EVFS_ADVICE_RANDOM:      posix_advice = POSIX_FADV_RANDOM; break;
+    case EVFS_ADVICE_WILL_NEED:   posix_advice = POSIX_FADV_WILLNEED; break;
+    case EVFS_ADVICE_DONT_NEED:   posix_advice = POSIX_FADV_DONTNEED; break;
+    case EVFS_ADVICE_WRITE_ONCE:  posix_advice = POSIX_FADV_NOREUSE; break;
+    default: return EVFS_ERR_BAD_ARG; break;
+  }
+
+  // posix_fadvise() returns the error rather than setting errno
+  int status = translate_error(posix_fadvise(fileno(fil->fp), 0, 0, posix_advice));
+  if(status == EVFS_OK)
+    fil->advice = advice;
+
+  return status;
+}
+#endif
+
+
 static int stdio__file_ctrl(EvfsFile *fh, int cmd, void *arg) {
-  //StdioFile *fil = (StdioFile *)fh;
-  
+  StdioFile *fil = (StdioFile *)fh;
+
+  switch(cmd) {
+#if defined EVFS_USE_STDIO_POSIX && defined POSIX_FADV_NORMAL
+    case EVFS_CMD_SET_FILE_ADVICE:
+      {
+        unsigned *v = (unsigned *)arg;
+        return set_advice(fil, *v);
+      }
+      break;
+
+    case EVFS_CMD_PREFETCH:
+      {
+        EvfsFileRange *v = (EvfsFileRange *)arg;
+        return translate_error(posix_fadvise(fileno(fil->fp), v->offset, v->size, POSIX_FADV_WILLNEED));
+      }
+      break;
+#endif
+
+    default:
+      (void)fil;
+      break;
+  }
+
   return EVFS_OK;
 }
 
@@ -117,6 +183,174 @@ static ptrdiff_t stdio__file_write(EvfsFile *fh, const void *buf, size_t size) {
   return (ptrdiff_t)fwrite(buf, 1, size, fil->fp);
 }
 
+#ifdef EVFS_USE_STDIO_POSIX
+// Push out any buffered writes before accessing the fd directly
+// Read only files skip the flush. It takes the FILE lock and would serialize
+// concurrent positional reads on a shared handle.
+static inline void stdio__flush_writes(StdioFile *fil) {
+  if(fil->writable)
+    fflush(fil->fp);
+}
+
+static ptrdiff_t stdio__file_read_at(EvfsFile *fh, void *buf, size_t size, evfs_off_t offset) {
+  StdioFile *fil = (StdioFile *)fh;
+
+  stdio__flush_writes(fil);
+
+  ssize_t rval = pread(fileno(fil->fp), buf, size, offset);
+  if(rval < 0) return translate_error(errno);
+
+  return (ptrdiff_t)rval;
+}
+
+static ptrdiff_t stdio__file_write_at(EvfsFile *fh, const void *buf, size_t size, evfs_off_t offset) {
+  StdioFile *fil = (StdioFile *)fh;
+  StdioData *fs_data = (StdioData *)fil->fs_data;
+
+  if(fs_data->cfg_readonly) return EVFS_ERR_DISABLED;
+
+  fflush(fil->fp);
+
+  ssize_t rval = pwrite(fileno(fil->fp), buf, size, offset);
+  if(rval < 0) return translate_error(errno);
+
+  return (ptrdiff_t)rval;
+}
+#endif
+
+// Vectored I/O with the stdio buffer for small transfers and readv()/writev()
+// for large transfers that would bypass the buffer anyway
+static ptrdiff_t stdio__file_transfer_vec(EvfsFile *fh, const EvfsIOVec *iov, int iovcnt, bool write) {
+  StdioFile *fil = (StdioFile *)fh;
+
+  if(write && fil->fs_data->cfg_readonly) return EVFS_ERR_DISABLED;
+
+#ifdef EVFS_USE_STDIO_POSIX
+#  define STDIO_MAX_IOV  16
+  size_t total = 0;
+  for(int i = 0; i < iovcnt; i++) {
+    total += iov[i].len;
+  }
+
+  if(total >= BUFSIZ && iovcnt <= STDIO_MAX_IOV) {
+    struct iovec sys_iov[STDIO_MAX_IOV];
+    for(int i = 0; i < iovcnt; i++) {
+      sys_iov[i].iov_base = iov[i].base;
+      sys_iov[i].iov_len  = iov[i].len;
+    }
+
+    // Sync the descriptor with the stream position before bypassing the buffer
+    off_t pos = ftell(fil->fp);
+    if(pos < 0 || fflush(fil->fp) != 0) return EVFS_ERR_IO;
+
+    int fd = fileno(fil->fp);
+    lseek(fd, pos, SEEK_SET);
+
+    ssize_t rval = write ? writev(fd, sys_iov, iovcnt) : readv(fd, sys_iov, iovcnt);
+    int err = errno;
+
+    // Resync the stream with the descriptor
+    fseek(fil->fp, lseek(fd, 0, SEEK_CUR), SEEK_SET);
+
+    if(rval < 0) return translate_error(err);
+    return (ptrdiff_t)rval;
+  }
+#endif
+
+  // Hold the stream lock so the buffers are transferred as one operation
+  ptrdiff_t xfer = 0;
+#ifdef EVFS_USE_STDIO_POSIX
+  flockfile(fil->fp);
+#endif
+  for(int i = 0; i < iovcnt; i++) {
+    size_t rval = write ? fwrite(iov[i].base, 1, iov[i].len, fil->fp) :
+                          fread(iov[i].base, 1, iov[i].len, fil->fp);
+    xfer += rval;
+    if(rval < iov[i].len)
+      break;
+  }
+#ifdef EVFS_USE_STDIO_POSIX
+  funlockfile(fil->fp);
+#endif
+
+  return xfer;
+}
+
+static ptrdiff_t stdio__file_readv(EvfsFile *fh, const EvfsIOVec *iov, int iovcnt) {
+  return stdio__file_transfer_vec(fh, iov, iovcnt, /*write*/ false);
+}
+
+static ptrdiff_t stdio__file_writev(EvfsFile *fh, const EvfsIOVec *iov, int iovcnt) {
+  return stdio__file_transfer_vec(fh, iov, iovcnt, /*write*/ true);
+}
+
+#ifdef EVFS_USE_STDIO_POSIX
+static int stdio__file_map(EvfsFile *fh, evfs_off_t offset, size_t size, EvfsMapping *map) {
+  StdioFile *fil = (StdioFile *)fh;
+
+  stdio__flush_writes(fil);
+
+  int fd = fileno(fil->fp);
+  struct stat s;
+  if(fstat(fd, &s) != 0)
+    return translate_error(errno);
+
+  if(offset > s.st_size) return EVFS_ERR_OVERFLOW;
+
+  evfs_off_t remaining = s.st_size - offset;
+  if(remaining == 0) return EVFS_OK; // Empty mapping
+
+  if(size == 0 || (evfs_off_t)size > remaining)
+    size = remaining;
+
+  // Mappings must start on a page boundary
+  long page_size = sysconf(_SC_PAGESIZE);
+  off_t map_offset = offset - offset % page_size;
+  size_t map_len = size + (offset - map_offset);
+
+  void *map_base = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, map_offset);
+  if(map_base == MAP_FAILED) // Pipes, devices, and write-only files can't be mapped
+    return errno == ENOMEM ? EVFS_ERR_ALLOC : EVFS_ERR_NO_SUPPORT;
+
+  map->data     = (const uint8_t *)map_base + (offset - map_offset);
+  map->size     = size;
+  map->map_base = map_base;
+  map->map_len  = map_len;
+
+  // Pass the access pattern on to the mapping's page faults
+  switch(fil->advice) {
+    case EVFS_ADVICE_SEQUENTIAL:  madvise(map_base, map_len, MADV_SEQUENTIAL); break;
+    case EVFS_ADVICE_RANDOM:      madvise(map_base, map_len, MADV_RANDOM); break;
+    case EVFS_ADVICE_WILL_NEED:   madvise(map_base, map_len, MADV_WILLNEED); break;
+    default: break;
+  }
+
+  return EVFS_OK;
+}
+
+static int stdio__file_unmap(EvfsFile *fh, EvfsMapping *map) {
+  return simple_error(munmap(map->map_base, map->map_len));
+}
+
+static int stdio__file_discard(EvfsFile *fh, evfs_off_t offset, evfs_off_t size) {
+#ifdef FALLOC_FL_PUNCH_HOLE
+  StdioFile *fil = (StdioFile *)fh;
+  StdioData *fs_data = (StdioData *)fil->fs_data;
+
+  if(fs_data->cfg_readonly) return EVFS_ERR_DISABLED;
+
+  fflush(fil->fp); // Also drops buffered input that may now be stale
+
+  if(fallocate(fileno(fil->fp), FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, size) == 0)
+    return EVFS_OK;
+
+  return (errno == EOPNOTSUPP) ? EVFS_ERR_NO_SUPPORT : translate_error(errno);
+#else
+  return EVFS_ERR_NO_SUPPORT;
+#endif
+}
+#endif
+
 static int stdio__file_truncate(EvfsFile *fh, evfs_off_t size) {
 #ifdef EVFS_USE_STDIO_POSIX  
   StdioFile *fil = (StdioFile *)fh;
@@ -194,11 +428,297 @@ static EvfsFileMethods s_stdio_methods = {
   .m_size     = stdio__file_size,
   .m_seek     = stdio__file_seek,
   .m_tell     = stdio__file_tell,
-  .m_eof      = stdio__file_eof
+  .m_eof      = stdio__file_eof,
+#ifdef EVFS_USE_STDIO_POSIX
+  .m_read_at  = stdio__file_read_at,
+  .m_write_at = stdio__file_write_at,
+  .m_map      = stdio__file_map,
+  .m_unmap    = stdio__file_unmap,
+  .m_discard  = stdio__file_discard,
+#endif
+  .m_readv    = stdio__file_readv,
+  .m_writev   = stdio__file_writev
 };
 
 
 
+// ******************** io_uring async engine ********************
+
+#ifdef USE_IO_URING
+typedef struct UringEngine {
+  EvfsAsyncEngine base;
+  int         ring_fd;
+  EvfsThread  reaper;       // Moves CQEs to the queue's completion list
+  EvfsLock    lock;         // Protects the SQ ring, inflight, and shutdown
+  unsigned    inflight;
+  bool        shutdown;
+
+  // Submission ring
+  uint8_t    *sq_ring;
+  size_t      sq_ring_size;
+  unsigned   *sq_head;
+  unsigned   *sq_tail;
+  unsigned   *sq_array;
+  unsigned    sq_mask;
+  unsigned    sq_entries;
+  struct io_uring_sqe *sqes;
+  size_t      sqes_size;
+
+  // Completion ring
+  uint8_t    *cq_ring;
+  size_t      cq_ring_size;
+  unsigned   *cq_head;
+  unsigned   *cq_tail;
+  unsigned    cq_mask;
+  unsigned    cq_entries;
+  struct io_uring_cqe *cqes;
+} UringEngine;
+
+
+static int uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+
+// Add an SQE to the ring and submit it. Called with the engine lock held.
+static int uring_push_sqe(UringEngine *eng, uint8_t opcode, int fd, void *buf, size_t size,
+                          evfs_off_t offset, uint64_t user_data) {
+  unsigned tail = *eng->sq_tail;
+  unsigned head = __atomic_load_n(eng->sq_head, __ATOMIC_ACQUIRE);
+
+  if(tail - head >= eng->sq_entries)
+    return EVFS_ERR_NO_SUPPORT;
+
+  unsigned ix = tail & eng->sq_mask;
+  struct io_uring_sqe *sqe = &eng->sqes[ix];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->addr = (uintptr_t)buf;
+  sqe->len = (uint32_t)MIN(size, UINT32_MAX); // Larger requests complete short
+  sqe->off = (uint64_t)offset;
+  sqe->user_data = user_data;
+
+  eng->sq_array[ix] = ix;
+  __atomic_store_n(eng->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  int rval;
+  do {
+    rval = uring_enter(eng->ring_fd, 1, 0, 0);
+  } while(rval < 0 && errno == EINTR);
+
+  if(rval < 1) { // Kernel didn't take the SQE
+    __atomic_store_n(eng->sq_tail, tail, __ATOMIC_RELEASE);
+    return EVFS_ERR_NO_SUPPORT;
+  }
+
+  return EVFS_OK;
+}
+
+
+static int uring__submit(EvfsAsyncEngine *engine, EvfsAsyncOp *op) {
+  UringEngine *eng = (UringEngine *)engine;
+
+  // Files from other VFSs and shims are left for the thread pool
+  if(op->fh->methods != &s_stdio_methods)
+    return EVFS_ERR_NO_SUPPORT;
+
+  StdioFile *fil = (StdioFile *)op->fh;
+  bool write = op->kind == EVFS_ASYNC_WRITE;
+
+  if(write && fil->fs_data->cfg_readonly) return EVFS_ERR_DISABLED;
+
+  stdio__flush_writes(fil);
+
+  evfs__lock(&eng->lock);
+  int status = EVFS_ERR_NO_SUPPORT;
+
+  // Don't let completions overrun the CQ ring
+  if(eng->inflight < eng->cq_entries) {
+    status = uring_push_sqe(eng, write ? IORING_OP_WRITE : IORING_OP_READ, fileno(fil->fp),
+                            op->buf, op->size, op->offset, (uintptr_t)op);
+    if(status == EVFS_OK)
+      eng->inflight++;
+  }
+  evfs__unlock(&eng->lock);
+
+  return status;
+}
+
+
+static void uring_reaper(void *arg) {
+  UringEngine *eng = (UringEngine *)arg;
+
+  while(1) {
+    unsigned head = *eng->cq_head;
+    unsigned tail = __atomic_load_n(eng->cq_tail, __ATOMIC_ACQUIRE);
+
+    if(head == tail) {
+      evfs__lock(&eng->lock);
+      bool done = eng->shutdown && eng->inflight == 0;
+      evfs__unlock(&eng->lock);
+
+      if(done)
+        break;
+
+      uring_enter(eng->ring_fd, 0, 1, IORING_ENTER_GETEVENTS);
+      continue;
+    }
+
+    struct io_uring_cqe *cqe = &eng->cqes[head & eng->cq_mask];
+    EvfsAsyncOp *op = (EvfsAsyncOp *)(uintptr_t)cqe->user_data;
+    int res = cqe->res;
+
+    __atomic_store_n(eng->cq_head, head + 1, __ATOMIC_RELEASE);
+
+    if(!op) // Shutdown wakeup
+      continue;
+
+    evfs__lock(&eng->lock);
+    eng->inflight--;
+    evfs__unlock(&eng->lock);
+
+    evfs_async_complete(op, res < 0 ? translate_error(-res) : res);
+  }
+}
+
+
+static void uring_unmap(UringEngine *eng) {
+  if(eng->sqes)
+    munmap(eng->sqes, eng->sqes_size);
+  if(eng->cq_ring && eng->cq_ring != eng->sq_ring)
+    munmap(eng->cq_ring, eng->cq_ring_size);
+  if(eng->sq_ring)
+    munmap(eng->sq_ring, eng->sq_ring_size);
+}
+
+
+static void uring__free(EvfsAsyncEngine *engine) {
+  UringEngine *eng = (UringEngine *)engine;
+
+  // Wake the reaper so it can see the shutdown once everything completes
+  evfs__lock(&eng->lock);
+  eng->shutdown = true;
+  uring_push_sqe(eng, IORING_OP_NOP, -1, NULL, 0, 0, 0);
+  evfs__unlock(&eng->lock);
+
+  evfs__thread_join(eng->reaper);
+
+  uring_unmap(eng);
+  close(eng->ring_fd);
+  evfs__lock_destroy(&eng->lock);
+  evfs_free(eng);
+}
+
+
+static void *uring_mmap(int ring_fd, size_t size, off_t offset) {
+  void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, offset);
+  return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+
+static int uring_setup(UringEngine *eng, unsigned entries) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+
+  eng->ring_fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+  if(eng->ring_fd < 0)
+    return EVFS_ERR_NO_SUPPORT;
+
+  eng->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  eng->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+  if(params.features & IORING_FEAT_SINGLE_MMAP) { // Both rings share one mapping
+    eng->sq_ring_size = MAX(eng->sq_ring_size, eng->cq_ring_size);
+    eng->sq_ring = uring_mmap(eng->ring_fd, eng->sq_ring_size, IORING_OFF_SQ_RING);
+    eng->cq_ring = eng->sq_ring;
+  } else {
+    eng->sq_ring = uring_mmap(eng->ring_fd, eng->sq_ring_size, IORING_OFF_SQ_RING);
+    eng->cq_ring = uring_mmap(eng->ring_fd, eng->cq_ring_size, IORING_OFF_CQ_RING);
+  }
+
+  eng->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  eng->sqes = uring_mmap(eng->ring_fd, eng->sqes_size, IORING_OFF_SQES);
+
+  if(!eng->sq_ring || !eng->cq_ring || !eng->sqes) {
+    uring_unmap(eng);
+    close(eng->ring_fd);
+    return EVFS_ERR_NO_SUPPORT;
+  }
+
+  eng->sq_head  = (unsigned *)(eng->sq_ring + params.sq_off.head);
+  eng->sq_tail  = (unsigned *)(eng->sq_ring + params.sq_off.tail);
+  eng->sq_array = (unsigned *)(eng->sq_ring + params.sq_off.array);
+  eng->sq_mask  = *(unsigned *)(eng->sq_ring + params.sq_off.ring_mask);
+  eng->sq_entries = params.sq_entries;
+
+  eng->cq_head  = (unsigned *)(eng->cq_ring + params.cq_off.head);
+  eng->cq_tail  = (unsigned *)(eng->cq_ring + params.cq_off.tail);
+  eng->cqes     = (struct io_uring_cqe *)(eng->cq_ring + params.cq_off.cqes);
+  eng->cq_mask  = *(unsigned *)(eng->cq_ring + params.cq_off.ring_mask);
+  eng->cq_entries = params.cq_entries;
+
+  return EVFS_OK;
+}
+#endif // USE_IO_URING
+
+
+/*
+Attach an io_uring engine to an async queue
+
+Reads and writes submitted for Stdio files will be handled by the kernel
+without using the queue's thread pool. Operations on files from other VFSs
+still go to the thread pool. The engine is freed with the queue.
+
+Args:
+  queue:    Queue to attach to
+  entries:  Size of the io_uring submission ring
+
+Returns:
+  EVFS_OK on success. EVFS_ERR_NO_SUPPORT if io_uring is unavailable.
+*/
+int evfs_stdio_attach_uring(EvfsAsyncQueue *queue, unsigned entries) {
+  if(PTR_CHECK(queue) || entries == 0) return EVFS_ERR_BAD_ARG;
+
+#ifdef USE_IO_URING
+  UringEngine *eng = evfs_malloc(sizeof(*eng));
+  if(MEM_CHECK(eng)) return EVFS_ERR_ALLOC;
+
+  memset(eng, 0, sizeof(*eng));
+  eng->base.m_submit = uring__submit;
+  eng->base.m_free = uring__free;
+
+  int status = uring_setup(eng, entries);
+  if(status != EVFS_OK) {
+    evfs_free(eng);
+    return status;
+  }
+
+  evfs__lock_init(&eng->lock);
+
+  status = evfs__thread_create(&eng->reaper, uring_reaper, eng);
+  if(status == EVFS_OK) {
+    status = evfs_async_set_engine(queue, &eng->base);
+    if(status == EVFS_OK)
+      return EVFS_OK;
+
+    uring__free(&eng->base); // Stops the reaper
+    return status;
+  }
+
+  uring_unmap(eng);
+  close(eng->ring_fd);
+  evfs__lock_destroy(&eng->lock);
+  evfs_free(eng);
+  return status;
+
+#else
+  return EVFS_ERR_NO_SUPPORT;
+#endif
+}
+
+
+
 // ******************** Directory access methods ********************
 
 #ifdef EVFS_USE_STDIO_POSIX
@@ -210,8 +730,7 @@ static int stdio__dir_close(EvfsDir *dh) {
 }
 
 
-static int stdio__dir_read(EvfsDir *dh, EvfsInfo *info) {
-  StdioDir *dir = (StdioDir *)dh;
+static struct dirent *stdio_next_entry(StdioDir *dir) {
   StdioData *fs_data = (StdioData *)dir->fs_data;
 
   struct dirent *posix_entry;
@@ -225,20 +744,80 @@ static int stdio__dir_read(EvfsDir *dh, EvfsInfo *info) {
     }
   }
 
+  return posix_entry;
+}
+
+
+static void stdio_fill_info(StdioDir *dir, struct dirent *posix_entry, EvfsInfo *info) {
+  StdioData *fs_data = (StdioData *)dir->fs_data;
+
   memset(info, 0, sizeof(*info));
 
   if(posix_entry) {
     info->name = posix_entry->d_name;
     if(posix_entry->d_type == DT_DIR)
        info->type |= EVFS_FILE_DIR;
+
+    // Stat relative to the open directory so no path needs to be built
+    struct stat s;
+    if(fs_data->cfg_dir_stat && fstatat(dirfd(dir->dp), posix_entry->d_name, &s, 0) == 0) {
+      info->size = s.st_size;
+      info->mtime = s.st_mtime;
+
+      // Covers filesystems that report DT_UNKNOWN
+      if(S_ISDIR(s.st_mode))
+        info->type |= EVFS_FILE_DIR;
+    }
   } else {
     info->name = NULL;
   }
+}
+
+
+static int stdio__dir_read(EvfsDir *dh, EvfsInfo *info) {
+  StdioDir *dir = (StdioDir *)dh;
+
+  struct dirent *posix_entry = stdio_next_entry(dir);
+  stdio_fill_info(dir, posix_entry, info);
 
   return posix_entry ? EVFS_OK : EVFS_DONE;
 }
 
 
+// readdir() already fetches entries in bulk with getdents() so this just
+// avoids a method dispatch per entry. An entry whose name doesn't fit is
+// pushed back with seekdir() for the next call.
+static int stdio__dir_read_many(EvfsDir *dh, EvfsInfo *entries, int max_entries, char *name_buf,
+                                size_t name_buf_size) {
+  StdioDir *dir = (StdioDir *)dh;
+  int count = 0;
+
+  while(count < max_entries) {
+    long prev_pos = telldir(dir->dp);
+    struct dirent *posix_entry = stdio_next_entry(dir);
+    if(!posix_entry)
+      break;
+
+    size_t name_len = strlen(posix_entry->d_name) + 1;
+    if(name_len > name_buf_size) {
+      seekdir(dir->dp, prev_pos);
+      // Buffer is at least EVFS_MAX_PATH so only an oversize name can get here first
+      return count > 0 ? count : EVFS_ERR_TOO_LONG;
+    }
+
+    EvfsInfo *info = &entries[count++];
+    stdio_fill_info(dir, posix_entry, info);
+
+    memcpy(name_buf, posix_entry->d_name, name_len);
+    info->name = name_buf;
+    name_buf += name_len;
+    name_buf_size -= name_len;
+  }
+
+  return count;
+}
+
+
 static int stdio__dir_rewind(EvfsDir *dh) {
   StdioDir *dir = (StdioDir *)dh;
 
@@ -250,7 +829,8 @@ static int stdio__dir_rewind(EvfsDir *dh) {
 static EvfsDirMethods s_stdio_dir_methods = {
   .m_close    = stdio__dir_close,
   .m_read     = stdio__dir_read,
-  .m_rewind   = stdio__dir_rewind
+  .m_rewind   = stdio__dir_rewind,
+  .m_read_many = stdio__dir_read_many
 };
 #endif
 
@@ -324,6 +904,7 @@ static int stdio__open(Evfs *vfs, const char *path, EvfsFile *fh, int flags) {
   }
 
   fil->fs_data = fs_data;
+  fil->writable = mode[0] != 'r' || mode[1] == '+';
   fil->fp = fopen(path, mode);
 
   if(fil->fp)
@@ -422,6 +1003,53 @@ static int stdio__set_cur_dir(Evfs *vfs, const char *path) {
 #endif
 
 
+#if defined EVFS_USE_STDIO_POSIX && defined __linux__
+// Copy between stdio files in the kernel
+static int stdio__copy(Evfs *vfs, EvfsFile *dest, EvfsFile *src, evfs_off_t size) {
+  StdioData *fs_data = (StdioData *)vfs->fs_data;
+
+  if(src->methods != &s_stdio_methods || dest->methods != &s_stdio_methods)
+    return EVFS_ERR_NO_SUPPORT;
+
+  if(fs_data->cfg_readonly) return EVFS_ERR_DISABLED;
+
+  FILE *src_fp = ((StdioFile *)src)->fp;
+  FILE *dest_fp = ((StdioFile *)dest)->fp;
+
+  // Sync the descriptors with the stream positions before bypassing the buffers
+  off_t src_pos = ftell(src_fp);
+  off_t dest_pos = ftell(dest_fp);
+  if(src_pos < 0 || dest_pos < 0 || fflush(src_fp) != 0 || fflush(dest_fp) != 0)
+    return EVFS_ERR_NO_SUPPORT;
+
+  int dest_fd = fileno(dest_fp);
+  lseek(dest_fd, dest_pos, SEEK_SET);
+
+  int status = EVFS_OK;
+  bool copied = false;
+  while(size > 0) {
+    ssize_t sent = sendfile(dest_fd, fileno(src_fp), &src_pos, size);
+    if(sent <= 0) {
+      if(sent == 0) // Source was truncated
+        status = EVFS_ERR_IO;
+      else  // Nothing has been written yet when sendfile() isn't supported
+        status = copied ? translate_error(errno) : EVFS_ERR_NO_SUPPORT;
+      break;
+    }
+
+    size -= sent;
+    copied = true;
+  }
+
+  // Resync the streams with the descriptors
+  fseek(src_fp, src_pos, SEEK_SET);
+  fseek(dest_fp, lseek(dest_fd, 0, SEEK_CUR), SEEK_SET);
+
+  return status;
+}
+#endif
+
+
 static int stdio__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
   StdioData *fs_data = (StdioData *)vfs->fs_data;
 
@@ -442,6 +1070,13 @@ static int stdio__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
       }
       return EVFS_OK; break;
 
+    case EVFS_CMD_SET_DIR_STAT:
+      {
+        unsigned *v = (unsigned *)arg;
+        fs_data->cfg_dir_stat = !!*v;
+      }
+      return EVFS_OK; break;
+
     case EVFS_CMD_GET_STAT_FIELDS:
       {
         unsigned *v = (unsigned *)arg;
@@ -453,6 +1088,17 @@ static int stdio__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
       {
         unsigned *v = (unsigned *)arg;
         *v = EVFS_INFO_NAME | EVFS_INFO_TYPE;
+#ifdef EVFS_USE_STDIO_POSIX
+        if(fs_data->cfg_dir_stat)
+          *v |= EVFS_INFO_SIZE | EVFS_INFO_MTIME;
+#endif
+      }
+      return EVFS_OK; break;
+
+    case EVFS_CMD_GET_CONCURRENT_WRITES: // The OS handles concurrent file operations
+      {
+        unsigned *v = (unsigned *)arg;
+        *v = 1;
       }
       return EVFS_OK; break;
 
@@ -488,6 +1134,9 @@ static Evfs s_stdio_vfs = {
   .m_set_cur_dir = stdio__set_cur_dir,
 #endif  
   .m_vfs_ctrl = stdio__vfs_ctrl,
+#if defined EVFS_USE_STDIO_POSIX && defined __linux__
+  .m_copy = stdio__copy,
+#endif
 
 };
 
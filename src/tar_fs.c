@@ -18,32 +18,70 @@ Embedded Virtual Filesystem
 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "evfs.h"
 #include "evfs_internal.h"
 #include "evfs/tar_iter.h"
 #include "evfs/tar_fs.h"
 
-#include "evfs/util/dhash.h"
+#ifdef EVFS_USE_PERFECT_HASH_INDEX
+#  include "evfs/util/mphash.h"
+#else
+#  include "evfs/util/dhash.h"
+#endif
 #include "evfs/util/range_strings.h"
 
 
 ///////////////////////////////////////////////////////////////////////////////////
 
-// Shared buffer needs lock if threading is enabled
-// We also need a lock for normal read operations in a threaded system
-#if defined EVFS_USE_THREADING
-#  define USE_TARFS_LOCK
+// Path lookups only read cur_dir so they can share its lock
+#ifdef EVFS_USE_THREADING
+#  define DIR_LOCK_SHARED()     evfs__lock_shared(&fs_data->dir_lock)
+#  define DIR_UNLOCK_SHARED()   evfs__unlock_shared(&fs_data->dir_lock)
+#  define DIR_LOCK_EXCL()       evfs__lock_exclusive(&fs_data->dir_lock)
+#  define DIR_UNLOCK_EXCL()     evfs__unlock_exclusive(&fs_data->dir_lock)
+#else
+#  define DIR_LOCK_SHARED()
+#  define DIR_UNLOCK_SHARED()
+#  define DIR_LOCK_EXCL()
+#  define DIR_UNLOCK_EXCL()
 #endif
 
+// Writable mounts change the index while it is being read
+#ifdef EVFS_USE_THREADING
+#  define INDEX_LOCK_SHARED()   do { if(fs_data->writable) evfs__lock_shared(&fs_data->index_lock); } while(0)
+#  define INDEX_UNLOCK_SHARED() do { if(fs_data->writable) evfs__unlock_shared(&fs_data->index_lock); } while(0)
+#  define INDEX_LOCK_EXCL()     evfs__lock_exclusive(&fs_data->index_lock)
+#  define INDEX_UNLOCK_EXCL()   evfs__unlock_exclusive(&fs_data->index_lock)
+#else
+#  define INDEX_LOCK_SHARED()
+#  define INDEX_UNLOCK_SHARED()
+#  define INDEX_LOCK_EXCL()
+#  define INDEX_UNLOCK_EXCL()
+#endif
 
-#ifdef USE_TARFS_LOCK
-#  define LOCK()    evfs__lock(&fs_data->tfs_lock)
-#  define UNLOCK()  evfs__unlock(&fs_data->tfs_lock)
+// Handles take a reference to the current mount under a shared lock.
+// Remounting only needs the lock exclusively to swap the mount pointer.
+#ifdef EVFS_USE_THREADING
+#  include <stdatomic.h>
+typedef atomic_uint MountRefs;
+#  define MOUNT_LOCK_SHARED()     evfs__lock_shared(&fs_data->mount_lock)
+#  define MOUNT_UNLOCK_SHARED()   evfs__unlock_shared(&fs_data->mount_lock)
+#  define MOUNT_LOCK_EXCL()       evfs__lock_exclusive(&fs_data->mount_lock)
+#  define MOUNT_UNLOCK_EXCL()     evfs__unlock_exclusive(&fs_data->mount_lock)
+#  define REF_ADD(r)              atomic_fetch_add_explicit(&(r), 1, memory_order_relaxed)
+#  define REF_SUB(r)              atomic_fetch_sub_explicit(&(r), 1, memory_order_acq_rel)
 #else
-#  define LOCK()
-#  define UNLOCK()
+typedef unsigned MountRefs;
+#  define MOUNT_LOCK_SHARED()
+#  define MOUNT_UNLOCK_SHARED()
+#  define MOUNT_LOCK_EXCL()
+#  define MOUNT_UNLOCK_EXCL()
+#  define REF_ADD(r)              ((r)++)
+#  define REF_SUB(r)              ((r)--)
 #endif
 
 
@@ -53,109 +91,213 @@ typedef struct EvfsTarEntry {
 } EvfsTarEntry;
 
 
+// Chunk of storage for path keys. Keys never span chunks.
+typedef struct TarKeyChunk {
+  struct TarKeyChunk *next;
+  size_t  size;
+  size_t  used;
+  char    data[];
+} TarKeyChunk;
+
+
+// Directory listing entry
+// The listing is sorted by parent path and then name so that the children of
+// a directory are a contiguous range.
+typedef struct TarDirEntry {
+  const char *key;        // Full path in key storage
+  evfs_off_t  file_size;  // -1 for directories
+  uint32_t    seq;        // Insertion order. 0 for implied directories.
+  uint16_t    key_len;
+  uint16_t    parent_len; // Length of parent path prefix in key
+} TarDirEntry;
+
+
 typedef struct EvfsTarIndex {
+#ifdef EVFS_USE_PERFECT_HASH_INDEX
+  mphash hash_table; // Immutable index of hashed key/value pairs
+#else
   dhash hash_table; // Manages index of hashed key/value pairs
+#endif
 
   // Storage for file path keys
-  char *keys;
+  TarKeyChunk *keys;
+  TarKeyChunk *keys_tail;
+  size_t keys_size;   // Bytes used in all chunks
+  size_t num_files;
+  const EvfsAllocator *keys_alloc;
+
+  // Parent to children index for directory listings
+  TarDirEntry *dir_entries;
+  size_t num_dir_entries;
+  size_t max_dir_entries;
 } EvfsTarIndex;
 
 
-
-typedef struct TarfsData {
+// Archive and index for a mounted tar. The VFS and each open handle hold a
+// reference. A replaced mount stays alive until its last handle is closed.
+typedef struct TarfsMount {
   EvfsFile *tar_file;
+  EvfsMapping tar_map;  // Whole archive when the tar file can be mapped
   EvfsTarIndex tar_index;
+  EvfsIndexStats index_stats;
+  uint32_t header_reads;  // Headers scanned to build the index. 0 when loaded from a sidecar.
+  MountRefs refs;
+} TarfsMount;
+
+
+
+typedef struct TarfsFile TarfsFile;
+
+typedef struct TarfsData {
+  TarfsMount *mount;  // Writable mounts are never replaced
+
+  // Append mode
+  bool        writable;
+  evfs_off_t  archive_end;  // Offset of the end of archive marker
+  TarfsFile  *writer;       // Member being written
 
   char      cur_dir[EVFS_MAX_PATH];
-#ifdef EVFS_USE_TARFS_SHARED_BUFFER
-  char      abs_path[EVFS_MAX_PATH]; // Shared buffer for building absolute paths
-#endif
-#ifdef USE_TARFS_LOCK
-  EvfsLock  tfs_lock; // Serialize access to shared abs_path buffer
+#ifdef EVFS_USE_THREADING
+  EvfsRwLock dir_lock; // Protects cur_dir
+  EvfsRwLock index_lock; // Protects tar_index and writer state in append mode
+  EvfsRwLock mount_lock; // Protects mount pointer
 #endif
 
 } TarfsData;
 
-typedef struct TarfsFile {
+struct TarfsFile {
   EvfsFile base;
   TarfsData *fs_data;
+  TarfsMount *mount;
 
   evfs_off_t header_offset;   // Offset within tar file
   evfs_off_t file_size;       // Size of current archived file
   evfs_off_t read_pos;        // Current read position
 
+  const char *key;            // Index key for a member being written
+  size_t      key_len;
+
   bool      is_open;
-} TarfsFile;
+  bool      writing;
+};
 
 
+typedef struct TarfsDir {
+  EvfsDir     base;
+  TarfsData  *fs_data;
+  TarfsMount *mount;
 
-// Helper to convert relative paths into absolute for the tfs API
-// Returned path must be freed
+  size_t      start;  // Range of children in dir_entries
+  size_t      end;
+  size_t      pos;
+} TarfsDir;
 
-static int make_absolute_path(Evfs *vfs, const char *path, char **absolute, bool force_malloc) {
-  TarfsData *fs_data = (TarfsData *)vfs->fs_data;
-  *absolute = NULL;
 
-  size_t abs_size;
-  char *abs_path = NULL;
 
-#ifdef EVFS_USE_TARFS_SHARED_BUFFER
-  if(!force_malloc) {
-    abs_size = COUNT_OF(fs_data->abs_path);
-    LOCK(); // Unlocked by FREE_ABS() macro
-    abs_path = fs_data->abs_path;
-  }
+// ******************** Tar index ********************
+
+// Wall clock for mount statistics
+static uint64_t tarfs__time_usec(void) {
+#ifdef TIME_UTC
+  struct timespec ts;
+  if(timespec_get(&ts, TIME_UTC) == TIME_UTC)
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 #endif
+  return 0;
+}
 
-  if(force_malloc || !abs_path) {
-    abs_size = strlen(path) + 1;
-    *absolute = NULL;
 
-    if(!evfs_vfs_path_is_absolute(vfs, path)) // Need space for join with cur_dir
-      abs_size += strlen(fs_data->cur_dir) + 1;
+// Keys are stored in chunks so the index can be built in one pass without
+// knowing the total path length in advance
+#define TARFS_KEY_CHUNK_SIZE  2048
 
-    abs_path = evfs_malloc(abs_size);
-    if(MEM_CHECK(abs_path)) return EVFS_ERR_ALLOC;
+static char *tarfs__key_alloc(EvfsTarIndex *ht, size_t len) {
+  TarKeyChunk *chunk = ht->keys_tail;
+
+  if(!chunk || chunk->size - chunk->used < len) {
+    size_t size = len > TARFS_KEY_CHUNK_SIZE ? len : TARFS_KEY_CHUNK_SIZE;
+    chunk = evfs_alloc_with(ht->keys_alloc, EVFS_ALLOC_INDEX, sizeof(*chunk) + size);
+    if(MEM_CHECK(chunk)) return NULL;
+
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+
+    if(ht->keys_tail)
+      ht->keys_tail->next = chunk;
+    else
+      ht->keys = chunk;
+    ht->keys_tail = chunk;
   }
 
+  char *key = &chunk->data[chunk->used];
+  chunk->used += len;
+  ht->keys_size += len;
+  return key;
+}
 
-  AppendRange abs_path_r;
-  range_init(&abs_path_r, abs_path, abs_size);
 
-  int status = evfs_vfs_path_absolute(vfs, path, (StringRange *)&abs_path_r);
-  if(status == EVFS_OK)
-    *absolute = abs_path;
+static void tarfs__keys_free(EvfsTarIndex *ht) {
+  TarKeyChunk *chunk = ht->keys;
+  while(chunk) {
+    TarKeyChunk *next = chunk->next;
+    evfs_free_with(ht->keys_alloc, EVFS_ALLOC_INDEX, chunk);
+    chunk = next;
+  }
 
-  return status;
+  ht->keys = NULL;
+  ht->keys_tail = NULL;
+  ht->keys_size = 0;
 }
 
 
-// Prepare a buffer for the absolute path
-#define MAKE_ABS(path, abs_path) char *abs_path; do { \
- int status = make_absolute_path(vfs, path, &abs_path, false); \
- if(status != EVFS_OK) \
-    return status; \
-} while(0)
+static void tarfs__dirs_free(EvfsTarIndex *ht) {
+  if(ht->dir_entries)
+    evfs_free_with(ht->keys_alloc, EVFS_ALLOC_INDEX, ht->dir_entries);
 
+  ht->dir_entries = NULL;
+  ht->num_dir_entries = 0;
+  ht->max_dir_entries = 0;
+}
 
-#ifdef EVFS_USE_TARFS_SHARED_BUFFER
-#  define FREE_ABS(abs_path)  UNLOCK()
-#else
-#  define FREE_ABS(abs_path)  evfs_free(abs_path)
-#endif
 
+#ifdef EVFS_USE_PERFECT_HASH_INDEX
+static int tarfs__index_hash_init(EvfsTarIndex *ht, size_t expected_files) {
+  mphConfig s_hash_init = {
+    .num_keys     = expected_files,
+    .value_size   = sizeof(EvfsTarEntry),
 
-// ******************** Tar index ********************
+    .gen_hash     = mph_gen_hash_string,
+    .is_equal     = dh_equal_hash_keys_string
+  };
+
+  memset(ht, 0, sizeof(*ht));
+  ht->keys_alloc = evfs_get_allocator(EVFS_ALLOC_INDEX);
 
+  int err = mph_init(&ht->hash_table, &s_hash_init, NULL) ? EVFS_OK : EVFS_ERR_ALLOC;
+  return err;
+}
 
 
+static void tarfs__index_hash_free(EvfsTarIndex *ht) {
+  mph_free(&ht->hash_table);
+  tarfs__keys_free(ht);
+  tarfs__dirs_free(ht);
+}
+
+#  define tarfs__index_insert(ht, key, entry)   mph_add(&(ht)->hash_table, (key), (entry))
+#  define tarfs__index_finish(ht)               mph_build(&(ht)->hash_table)
+#  define tarfs__index_lookup(ht, key, entry)   mph_lookup(&(ht)->hash_table, (key), (entry))
+
+#else // Dynamic hash
+
 static void destroy_hashed_file(dhKey key, void *value, void *ctx) {
 }
 
 
-static int tarfs__index_hash_init(EvfsTarIndex *ht, int total_files, size_t total_path_len) {
+static int tarfs__index_hash_init(EvfsTarIndex *ht, size_t expected_files) {
   dhConfig s_hash_init = {
-    .init_buckets = total_files,
+    .init_buckets = 0,  // Presized below
     .value_size   = sizeof(EvfsTarEntry),
 
     .destroy_item = destroy_hashed_file,
@@ -163,66 +305,417 @@ static int tarfs__index_hash_init(EvfsTarIndex *ht, int total_files, size_t tota
     .is_equal     = dh_equal_hash_keys_string
   };
 
-  ht->keys = evfs_malloc(total_path_len);
-  if(MEM_CHECK(ht->keys)) return EVFS_ERR_ALLOC;
+  memset(ht, 0, sizeof(*ht));
+  ht->keys_alloc = evfs_get_allocator(EVFS_ALLOC_INDEX);
 
+  if(!dh_init(&ht->hash_table, &s_hash_init, NULL))
+    return EVFS_ERR;
 
-  int err = dh_init(&ht->hash_table, &s_hash_init, NULL) ? EVFS_OK : EVFS_ERR;
-  return err;
+  // Leave room for the load factor so a known file count never resizes the hash
+  if(!dh_reserve_capacity(&ht->hash_table, expected_files)) {
+    dh_free(&ht->hash_table);
+    return EVFS_ERR_ALLOC;
+  }
+
+  return EVFS_OK;
 }
 
 
 static void tarfs__index_hash_free(EvfsTarIndex *ht) {
   dh_free(&ht->hash_table);
-  evfs_free(ht->keys);
-  ht->keys = NULL;
+  tarfs__keys_free(ht);
+  tarfs__dirs_free(ht);
 }
 
+#  define tarfs__index_insert(ht, key, entry)   dh_insert(&(ht)->hash_table, (key), (entry))
+#  define tarfs__index_finish(ht)               true
+#  define tarfs__index_lookup(ht, key, entry)   dh_lookup(&(ht)->hash_table, (key), (entry))
+#endif // EVFS_USE_PERFECT_HASH_INDEX
 
-static int tarfs__build_index(TarFileIterator *tar_it, EvfsTarIndex *ht) {
-  if(!tar_iter_begin(tar_it)) return EVFS_ERR;
 
-  size_t total_path_len = 0;
-  int total_files = 0;
-  // Scan the tar file to count files and determine total string storage for keys
-  do {
-    // Only index plain files and directories
-    if(tar_it->cur_header.type_flag != TAR_TYPE_NORMAL_FILE &&
-       tar_it->cur_header.type_flag != TAR_TYPE_DIRECTORY) continue;
+// ******************** Directory index ********************
 
-    total_files++;
-    total_path_len += strlen((char *)tar_it->cur_header.file_name) +
-                      strlen((char *)tar_it->cur_header.file_prefix) + 1;
+static TarDirEntry *tarfs__dir_entry_new(EvfsTarIndex *ht) {
+  if(ht->num_dir_entries >= ht->max_dir_entries) { // Grow the array
+    size_t max_entries = ht->max_dir_entries < 16 ? 16 : ht->max_dir_entries + ht->max_dir_entries/2;
+    TarDirEntry *entries = evfs_alloc_with(ht->keys_alloc, EVFS_ALLOC_INDEX,
+                                           max_entries * sizeof(*entries));
+    if(MEM_CHECK(entries)) return NULL;
 
-  } while(tar_iter_next(tar_it));
+    if(ht->dir_entries) {
+      memcpy(entries, ht->dir_entries, ht->num_dir_entries * sizeof(*entries));
+      evfs_free_with(ht->keys_alloc, EVFS_ALLOC_INDEX, ht->dir_entries);
+    }
 
+    ht->dir_entries = entries;
+    ht->max_dir_entries = max_entries;
+  }
 
-  // Prepare the hash index
-  int err = tarfs__index_hash_init(ht, total_files, total_path_len);
-  if(err != EVFS_OK) return err;
+  return &ht->dir_entries[ht->num_dir_entries++];
+}
+
+
+// Length of the parent directory prefix in a path key
+static inline size_t tarfs__parent_len(const char *key, size_t key_len) {
+  while(key_len > 0 && key[key_len-1] != '/') {
+    key_len--;
+  }
+
+  return key_len > 0 ? key_len-1 : 0;
+}
+
+
+#define DIR_NAME_OFFSET(e)  ((e)->parent_len > 0 ? (e)->parent_len+1 : 0)
+#define DIR_NAME(e)         (&(e)->key[DIR_NAME_OFFSET(e)])
+#define DIR_NAME_LEN(e)     ((e)->key_len - DIR_NAME_OFFSET(e))
+
+
+static inline int tarfs__compare_str(const char *a, size_t a_len, const char *b, size_t b_len) {
+  int delta = memcmp(a, b, a_len < b_len ? a_len : b_len);
+  if(delta != 0) return delta;
+
+  return (a_len > b_len) - (a_len < b_len);
+}
+
+
+// Order by parent then name with the newest duplicate first
+static int tarfs__compare_dir_entries(const void *pa, const void *pb) {
+  const TarDirEntry *a = (const TarDirEntry *)pa;
+  const TarDirEntry *b = (const TarDirEntry *)pb;
+
+  int delta = tarfs__compare_str(a->key, a->parent_len, b->key, b->parent_len);
+  if(delta == 0)
+    delta = tarfs__compare_str(DIR_NAME(a), DIR_NAME_LEN(a), DIR_NAME(b), DIR_NAME_LEN(b));
+  if(delta == 0)
+    delta = (a->seq < b->seq) - (a->seq > b->seq);
+
+  return delta;
+}
 
 
-  AppendRange keys_r;
-  range_init(&keys_r, ht->keys, total_path_len);
+/*
+Find the bounds of a parent directory in the sorted listing
+
+Args:
+  entries:      Sorted directory entries
+  num_entries:  Number of entries
+  parent:       Parent path
+  parent_len:   Length of parent
+  name:         Name to match within parent. NULL to only compare the parent.
+  name_len:     Length of name
+  upper:        Return the upper bound when true
+
+Returns:
+  Index of the first entry not less than the parent and name when upper is false.
+  Index of the first entry greater than them when upper is true.
+*/
+static size_t tarfs__dir_bound(const TarDirEntry *entries, size_t num_entries, const char *parent,
+                               size_t parent_len, const char *name, size_t name_len, bool upper) {
+  size_t low = 0;
+  size_t high = num_entries;
+
+  while(low < high) {
+    size_t mid = low + (high-low)/2;
+    const TarDirEntry *e = &entries[mid];
+
+    int delta = tarfs__compare_str(e->key, e->parent_len, parent, parent_len);
+    if(delta == 0 && name)
+      delta = tarfs__compare_str(DIR_NAME(e), DIR_NAME_LEN(e), name, name_len);
+
+    if(delta < 0 || (upper && delta == 0))
+      low = mid+1;
+    else
+      high = mid;
+  }
+
+  return low;
+}
+
+
+static bool tarfs__dir_exists(const TarDirEntry *entries, size_t num_entries, const char *key,
+                              size_t key_len) {
+  size_t parent_len = tarfs__parent_len(key, key_len);
+  size_t name_offset = parent_len > 0 ? parent_len+1 : 0;
+
+  size_t pos = tarfs__dir_bound(entries, num_entries, key, parent_len, &key[name_offset],
+                                key_len - name_offset, /*upper*/ false);
+
+  return pos < num_entries && entries[pos].key_len == key_len &&
+          !memcmp(entries[pos].key, key, key_len);
+}
+
+
+// Sort the listing and drop older duplicates
+static void tarfs__dir_sort(EvfsTarIndex *ht) {
+  TarDirEntry *entries = ht->dir_entries;
+  size_t num_entries = 0;
+
+  if(ht->num_dir_entries == 0) return;
+
+  qsort(entries, ht->num_dir_entries, sizeof(*entries), tarfs__compare_dir_entries);
+
+  for(size_t i = 0; i < ht->num_dir_entries; i++) {
+    if(num_entries > 0 && entries[num_entries-1].key_len == entries[i].key_len &&
+        !memcmp(entries[num_entries-1].key, entries[i].key, entries[i].key_len))
+      continue;
+
+    entries[num_entries++] = entries[i];
+  }
+
+  ht->num_dir_entries = num_entries;
+}
+
+
+// Add a file or directory to the index and the directory listing
+static bool tarfs__index_add(EvfsTarIndex *ht, dhKey key, EvfsTarEntry *entry) {
+  if(key.length > 0) { // Root isn't listed
+    TarDirEntry *de = tarfs__dir_entry_new(ht);
+    if(!de) return false;
+
+    de->key         = (const char *)key.data;
+    de->key_len     = key.length;
+    de->file_size   = entry->header_offset >= 0 ? entry->file_size : -1;
+    de->seq         = ht->num_files + 1;
+    de->parent_len  = tarfs__parent_len(de->key, key.length);
+  }
 
-  // Build the index
-  tar_iter_begin(tar_it);
+  // The hash may reuse entry as scratch space so it is inserted last
+  if(!tarfs__index_insert(ht, key, entry))
+    return false;
+
+  ht->num_files++;
+  return true;
+}
+
+
+/*
+Complete the directory listing after all entries are added
+
+Archives don't need entries for every directory so any parent that is missing
+is added as an implied directory. These are also inserted into the hash so
+they can be opened and used as the current directory.
+
+Args:
+  ht: Index to complete
+
+Returns:
+  EVFS_OK on success
+*/
+static int tarfs__index_dirs(EvfsTarIndex *ht) {
+  tarfs__dir_sort(ht);
+
+  // Children of the same parent are adjacent so each parent is checked once
+  size_t num_entries = ht->num_dir_entries;
+  size_t num_implied = 0;
+  const char *prev_parent = NULL;
+  size_t prev_parent_len = 0;
+
+  for(size_t i = 0; i < num_entries; i++) {
+    const char *key = ht->dir_entries[i].key;
+    size_t key_len = ht->dir_entries[i].parent_len;
+
+    if(key_len == 0) continue;
+    if(prev_parent && !tarfs__compare_str(prev_parent, prev_parent_len, key, key_len)) continue;
+
+    prev_parent = key;
+    prev_parent_len = key_len;
+
+    // Add the parent and its missing ancestors. Implied keys point into the child
+    // key until they are copied below.
+    while(key_len > 0 && !tarfs__dir_exists(ht->dir_entries, num_entries, key, key_len)) {
+      TarDirEntry *de = tarfs__dir_entry_new(ht);
+      if(!de) return EVFS_ERR_ALLOC;
+
+      de->key         = key;
+      de->key_len     = key_len;
+      de->file_size   = -1;
+      de->seq         = 0;
+      de->parent_len  = tarfs__parent_len(key, key_len);
+
+      key_len = de->parent_len;
+      num_implied++;
+    }
+  }
+
+  if(num_implied == 0) return EVFS_OK;
+
+  // Ancestors shared by different parents were added more than once
+  tarfs__dir_sort(ht);
+
+  for(size_t i = 0; i < ht->num_dir_entries; i++) {
+    TarDirEntry *de = &ht->dir_entries[i];
+    if(de->seq != 0) continue;
+
+    char *key_str = tarfs__key_alloc(ht, de->key_len + 1);
+    if(!key_str) return EVFS_ERR_ALLOC;
+
+    memcpy(key_str, de->key, de->key_len);
+    key_str[de->key_len] = '\0';
+    de->key = key_str;
+
+    dhKey key;
+    key.data = key_str;
+    key.length = de->key_len;
+
+    EvfsTarEntry entry;
+    entry.header_offset = -1;
+    entry.file_size = -1;
+
+    if(!tarfs__index_insert(ht, key, &entry))
+      return EVFS_ERR;
+
+    ht->num_files++;
+  }
+
+  return EVFS_OK;
+}
+
+
+// Insert into the sorted listing or return the existing entry for the same key
+static TarDirEntry *tarfs__dir_insert(EvfsTarIndex *ht, const char *key, size_t key_len, bool *is_new) {
+  size_t parent_len = tarfs__parent_len(key, key_len);
+  size_t name_offset = parent_len > 0 ? parent_len+1 : 0;
+
+  size_t pos = tarfs__dir_bound(ht->dir_entries, ht->num_dir_entries, key, parent_len,
+                                &key[name_offset], key_len - name_offset, /*upper*/ false);
+
+  *is_new = !(pos < ht->num_dir_entries && ht->dir_entries[pos].key_len == key_len &&
+              !memcmp(ht->dir_entries[pos].key, key, key_len));
+
+  if(*is_new) {
+    if(!tarfs__dir_entry_new(ht)) return NULL;
+
+    memmove(&ht->dir_entries[pos+1], &ht->dir_entries[pos],
+            (ht->num_dir_entries-1 - pos) * sizeof(*ht->dir_entries));
+  }
+
+  TarDirEntry *de = &ht->dir_entries[pos];
+  de->key         = key;
+  de->key_len     = key_len;
+  de->parent_len  = parent_len;
+  return de;
+}
+
+
+/*
+Add an entry to a completed index
+
+The listing is kept sorted and any missing parents are added as implied
+directories so a full rebuild isn't needed after each new member.
+
+Args:
+  ht:       Index to update
+  key_str:  Path key in key storage
+  key_len:  Length of key_str
+  entry:    Location of the member. header_offset is -1 for directories.
+  implied:  Entry is an implied directory
+
+Returns:
+  EVFS_OK on success
+*/
+static int tarfs__index_update(EvfsTarIndex *ht, const char *key_str, size_t key_len,
+                               const EvfsTarEntry *entry, bool implied) {
+  size_t parent_len = tarfs__parent_len(key_str, key_len);
+
+  if(parent_len > 0 && !tarfs__dir_exists(ht->dir_entries, ht->num_dir_entries, key_str, parent_len)) {
+    char *parent = tarfs__key_alloc(ht, parent_len + 1);
+    if(!parent) return EVFS_ERR_ALLOC;
+
+    memcpy(parent, key_str, parent_len);
+    parent[parent_len] = '\0';
+
+    EvfsTarEntry dir_entry;
+    dir_entry.header_offset = -1;
+    dir_entry.file_size = -1;
+
+    int status = tarfs__index_update(ht, parent, parent_len, &dir_entry, /*implied*/ true);
+    if(status != EVFS_OK) return status;
+  }
+
+  bool is_new;
+  TarDirEntry *de = tarfs__dir_insert(ht, key_str, key_len, &is_new);
+  if(!de) return EVFS_ERR_ALLOC;
+
+  de->file_size = entry->header_offset >= 0 ? entry->file_size : -1;
+  de->seq       = implied ? 0 : ht->num_files + 1;
+
+  dhKey key;
+  key.data = key_str;
+  key.length = key_len;
+
+  // The hash may reuse the value as scratch space
+  EvfsTarEntry value = *entry;
+  if(!tarfs__index_insert(ht, key, &value))
+    return EVFS_ERR;
+
+  if(is_new)
+    ht->num_files++;
+
+  return EVFS_OK;
+}
+
+
+static int tarfs__dir_range(EvfsTarIndex *ht, const char *path, size_t *start, size_t *end) {
+  if(path[0] != '/') return EVFS_ERR_NO_PATH; // All paths must be absolute
+
+  const char *key_str = &path[1];
+  dhKey key;
+  key.data = key_str;
+  key.length = strlen(key_str);
+
+  if(key.length > 0 && key_str[key.length-1] == '/') // Trailing separator
+    key.length--;
+
+  if(key.length > 0) { // Everything except root must be an indexed directory
+    EvfsTarEntry entry;
+    if(!tarfs__index_lookup(ht, key, &entry) || entry.header_offset >= 0)
+      return EVFS_ERR_NO_PATH;
+  }
+
+  *start = tarfs__dir_bound(ht->dir_entries, ht->num_dir_entries, key_str, key.length,
+                            NULL, 0, /*upper*/ false);
+  *end = tarfs__dir_bound(ht->dir_entries, ht->num_dir_entries, key_str, key.length,
+                          NULL, 0, /*upper*/ true);
+  return EVFS_OK;
+}
+
+
+// Index all files and directories in one pass over the tar headers
+// archive_end is set to the offset following the last member
+static int tarfs__build_index(TarFileIterator *tar_it, EvfsTarIndex *ht, evfs_off_t *archive_end,
+                              uint32_t *header_reads) {
+  // The hash grows as files are added
+  int err = tarfs__index_hash_init(ht, 0);
+  if(err != EVFS_OK) return err;
+
+  *archive_end = 0;
+
+  if(!tar_iter_begin(tar_it)) return EVFS_ERR;
 
   do {
+    (*header_reads)++;
+
+    evfs_off_t file_blocks = (tar_it->file_size + TAR_BLOCK_SIZE-1) / TAR_BLOCK_SIZE;
+    *archive_end = tar_it->header_offset + (file_blocks+1) * TAR_BLOCK_SIZE;
+
     // Only index plain files and directories
     if(tar_it->cur_header.type_flag != TAR_TYPE_NORMAL_FILE &&
        tar_it->cur_header.type_flag != TAR_TYPE_DIRECTORY) continue;
 
+    size_t prefix_len = strnlen((char *)tar_it->cur_header.file_prefix, TAR_FILE_PREFIX_LEN);
+    size_t name_len = strnlen((char *)tar_it->cur_header.file_name, TAR_FILE_NAME_LEN);
 
-    dhKey key;
+    char *key_str = tarfs__key_alloc(ht, prefix_len + name_len + 1);
+    if(!key_str) return EVFS_ERR_ALLOC;
 
-    key.data = keys_r.start;
-    key.length = 0;
-    if(tar_it->cur_header.file_prefix[0] != '\0')
-      key.length += range_cat_str(&keys_r, (char *)tar_it->cur_header.file_prefix);
 // FIXME: Add path sep
-    key.length += range_cat_str(&keys_r, (char *)tar_it->cur_header.file_name);
-    range_cat_char(&keys_r,'\0');
+    memcpy(key_str, tar_it->cur_header.file_prefix, prefix_len);
+    memcpy(&key_str[prefix_len], tar_it->cur_header.file_name, name_len);
+    key_str[prefix_len + name_len] = '\0';
+
+    dhKey key;
+    key.data = key_str;
+    key.length = prefix_len + name_len;
 
     EvfsTarEntry entry;
 
@@ -234,68 +727,722 @@ static int tarfs__build_index(TarFileIterator *tar_it, EvfsTarIndex *ht) {
       entry.file_size = -1;
 
       // Removing trailing slash
-      ((char *)key.data)[--key.length] = '\0';
+      if(key.length > 0 && key_str[key.length-1] == '/')
+        key_str[--key.length] = '\0';
     }
 
-    if(!dh_insert(&ht->hash_table, key, &entry))
+    if(!tarfs__index_add(ht, key, &entry))
       return EVFS_ERR;
 
   } while(tar_iter_next(tar_it));
 
+  err = tarfs__index_dirs(ht);
+  if(err != EVFS_OK) return err;
+
+  if(!tarfs__index_finish(ht))
+    return EVFS_ERR;
+
+  return EVFS_OK;
+}
+
+
+static inline bool tarfs__lookup_path(EvfsTarIndex *ht, const char *path, EvfsTarEntry *entry) {
+  if(path[0] != '/') return false; // All paths must be absolute
+
+  dhKey key;
+
+  key.data = &path[1];
+  key.length = strlen(key.data);
+
+  if(key.length == 0) { // Root is always present
+    entry->header_offset = -1;
+    entry->file_size = -1;
+    return true;
+  }
+
+  return tarfs__index_lookup(ht, key, entry);
+}
+
+
+// ******************** Archive writer ********************
+
+// New members are written over the end of archive marker and the marker is
+// rewritten after them. Member headers use the GNU magic accepted by
+// tar_iter so appended archives can be remounted.
+
+// Largest size that fits in the 11 digit octal size field
+#define TARFS_MAX_MEMBER_SIZE  077777777777ULL
+
+
+// Zero padded and NUL terminated octal
+static void tarfs__octal_field(uint8_t *field, size_t field_size, uint64_t value) {
+  field[--field_size] = '\0';
+  while(field_size > 0) {
+    field[--field_size] = '0' + (value & 0x07);
+    value >>= 3;
+  }
+}
+
+
+static void tarfs__init_header(TarHeader *header, const char *key, size_t key_len, uint8_t type_flag) {
+  memset(header, 0, sizeof(*header));
+
+  memcpy(header->file_name, key, key_len);
+  if(type_flag == TAR_TYPE_DIRECTORY)
+    header->file_name[key_len] = '/';
+
+  tarfs__octal_field(header->mode, sizeof header->mode, type_flag == TAR_TYPE_DIRECTORY ? 0755 : 0644);
+  tarfs__octal_field(header->uid, sizeof header->uid, 0);
+  tarfs__octal_field(header->gid, sizeof header->gid, 0);
+  tarfs__octal_field(header->size, sizeof header->size, 0);
+  tarfs__octal_field(header->mtime, sizeof header->mtime, tarfs__time_usec() / 1000000);
+  header->type_flag = type_flag;
+
+  memcpy(header->magic, "ustar ", sizeof header->magic);
+  memcpy(header->version, " ", sizeof header->version);
+}
+
+
+static void tarfs__seal_header(TarHeader *header, evfs_off_t size) {
+  tarfs__octal_field(header->size, sizeof header->size, size);
+
+  // Six digits, NUL, and a space
+  uint32_t checksum = tar_header_checksum(header);
+  tarfs__octal_field(header->checksum, sizeof header->checksum - 1, checksum);
+  header->checksum[sizeof header->checksum - 1] = ' ';
+}
+
+
+static int tarfs__write_zeros(EvfsFile *tar_file, evfs_off_t offset, size_t size) {
+  static const uint8_t zeros[TAR_BLOCK_SIZE] = {0};
+
+  while(size > 0) {
+    size_t chunk = size < sizeof zeros ? size : sizeof zeros;
+    if(evfs_file_write_at(tar_file, zeros, chunk, offset) != (ptrdiff_t)chunk)
+      return EVFS_ERR_IO;
+
+    offset += chunk;
+    size -= chunk;
+  }
+
+  return EVFS_OK;
+}
+
+
+/*
+Start a new member at the end of the archive
+
+Directories are complete once the header is written. Files are completed by
+tarfs__end_member() when their handle is closed.
+
+Args:
+  fs_data:    Writable Tar FS
+  fil:        Handle for a new file. NULL for directories.
+  path:       Absolute path of new member
+  type_flag:  TAR_TYPE_NORMAL_FILE or TAR_TYPE_DIRECTORY
+  flags:      Open flags for files
+
+Returns:
+  EVFS_OK on success
+*/
+static int tarfs__begin_member(TarfsData *fs_data, TarfsFile *fil, const char *path, uint8_t type_flag,
+                               int flags) {
+  if(path[0] != '/') return EVFS_ERR_NO_PATH; // All paths must be absolute
+
+  const char *key_str = &path[1];
+  size_t key_len = strlen(key_str);
+  bool is_dir = type_flag == TAR_TYPE_DIRECTORY;
+
+  if(is_dir && key_len > 0 && key_str[key_len-1] == '/') // Trailing separator
+    key_len--;
+
+  if(key_len == 0) return is_dir ? EVFS_ERR_EXISTS : EVFS_ERR_IS_DIR; // Root
+  if(key_str[key_len-1] == '/') return EVFS_ERR_BAD_NAME;
+
+  // Only the name field is used so that GNU tar reads the same path
+  if(key_len + (is_dir ? 1 : 0) > TAR_FILE_NAME_LEN) return EVFS_ERR_TOO_LONG;
+
+  EvfsFile *tar_file = fs_data->mount->tar_file;
+  EvfsTarIndex *ht = &fs_data->mount->tar_index;
+  EvfsTarEntry entry;
+  dhKey key;
+  int status = EVFS_OK;
+
+  INDEX_LOCK_EXCL();
+
+  if(fs_data->writer) { // Only one member can be appended at a time
+    status = EVFS_ERR_BUSY;
+    goto cleanup;
+  }
+
+  key.data = key_str;
+  key.length = key_len;
+  if(tarfs__index_lookup(ht, key, &entry)) {
+    if(is_dir || (flags & EVFS_NO_EXIST))
+      status = EVFS_ERR_EXISTS;
+    else if(entry.header_offset < 0)
+      status = EVFS_ERR_IS_DIR;
+    else if(!(flags & EVFS_OVERWRITE)) // Members can't be modified in place
+      status = EVFS_ERR_NO_SUPPORT;
+
+    if(status != EVFS_OK) goto cleanup;
+
+  } else if(!is_dir && !(flags & (EVFS_OPEN_OR_NEW | EVFS_NO_EXIST | EVFS_OVERWRITE))) {
+    status = EVFS_ERR_NO_FILE;
+    goto cleanup;
+  }
+
+  // Parents can be implied but not files
+  for(key.length = tarfs__parent_len(key_str, key_len); key.length > 0;
+      key.length = tarfs__parent_len(key_str, key.length)) {
+    if(tarfs__index_lookup(ht, key, &entry)) {
+      if(entry.header_offset >= 0)
+        status = EVFS_ERR_NO_PATH;
+      break;
+    }
+  }
+  if(status != EVFS_OK) goto cleanup;
+
+  char *member_key = tarfs__key_alloc(ht, key_len + 1);
+  if(!member_key) {
+    status = EVFS_ERR_ALLOC;
+    goto cleanup;
+  }
+
+  memcpy(member_key, key_str, key_len);
+  member_key[key_len] = '\0';
+
+  // Header is sealed with a size of 0 in case the file is never closed
+  uint8_t block[TAR_BLOCK_SIZE] = {0};
+  TarHeader *header = (TarHeader *)block;
+  tarfs__init_header(header, member_key, key_len, type_flag);
+  tarfs__seal_header(header, 0);
+
+  evfs_off_t header_offset = fs_data->archive_end;
+  if(evfs_file_write_at(tar_file, block, sizeof block, header_offset) != sizeof block) {
+    status = EVFS_ERR_IO;
+    goto cleanup;
+  }
+
+  if(is_dir) {
+    status = tarfs__write_zeros(tar_file, header_offset + TAR_BLOCK_SIZE, 2*TAR_BLOCK_SIZE);
+    if(status == EVFS_OK)
+      status = evfs_file_sync(tar_file);
+    if(status != EVFS_OK) goto cleanup;
+
+    entry.header_offset = -1;
+    entry.file_size = -1;
+    status = tarfs__index_update(ht, member_key, key_len, &entry, /*implied*/ false);
+    if(status == EVFS_OK)
+      fs_data->archive_end = header_offset + TAR_BLOCK_SIZE;
+
+  } else {
+    fil->header_offset = header_offset;
+    fil->file_size = 0;
+    fil->read_pos = 0;
+    fil->key = member_key;
+    fil->key_len = key_len;
+    fil->writing = true;
+    fil->is_open = true;
+    fs_data->writer = fil;
+  }
+
+cleanup:
+  INDEX_UNLOCK_EXCL();
+  return status;
+}
+
+
+// Complete a file member and add it to the index
+static int tarfs__end_member(TarfsFile *fil) {
+  TarfsData *fs_data = fil->fs_data;
+  EvfsFile *tar_file = fil->mount->tar_file;
+
+  evfs_off_t data_end = fil->header_offset + TAR_BLOCK_SIZE + fil->file_size;
+  size_t pad = (TAR_BLOCK_SIZE - (fil->file_size % TAR_BLOCK_SIZE)) % TAR_BLOCK_SIZE;
+
+  // Fill out the last block and restore the end of archive marker
+  int status = tarfs__write_zeros(tar_file, data_end, pad + 2*TAR_BLOCK_SIZE);
+
+  // Back-patch the final size
+  if(status == EVFS_OK) {
+    uint8_t block[TAR_BLOCK_SIZE];
+    TarHeader *header = (TarHeader *)block;
+
+    if(evfs_file_read_at(tar_file, block, sizeof block, fil->header_offset) == sizeof block) {
+      tarfs__seal_header(header, fil->file_size);
+      if(evfs_file_write_at(tar_file, block, sizeof block, fil->header_offset) != sizeof block)
+        status = EVFS_ERR_IO;
+    } else {
+      status = EVFS_ERR_IO;
+    }
+  }
+
+  if(status == EVFS_OK)
+    status = evfs_file_sync(tar_file);
+
+  INDEX_LOCK_EXCL();
+  if(status == EVFS_OK) {
+    EvfsTarEntry entry;
+    entry.header_offset = fil->header_offset;
+    entry.file_size = fil->file_size;
+
+    status = tarfs__index_update(&fil->mount->tar_index, fil->key, fil->key_len, &entry, /*implied*/ false);
+    if(status == EVFS_OK)
+      fs_data->archive_end = data_end + pad;
+  }
+
+  // A failed member is overwritten by the next one
+  fs_data->writer = NULL;
+  INDEX_UNLOCK_EXCL();
+
+  fil->writing = false;
+  return status;
+}
+
+
+
+// ******************** Sidecar index ********************
+
+// Persisted copy of the index so that remounting doesn't scan the archive.
+// The file has a header followed by entries and then the key strings in the
+// same order. Everything is in native byte order. Indices written on a
+// different platform fail validation and are rebuilt.
+
+#define SIDECAR_MAGIC       "EVFSTIX1"
+#define SIDECAR_BYTE_ORDER  0x01020304UL
+
+typedef struct TarSidecarHeader {
+  char      magic[8];
+  uint32_t  byte_order;
+  uint16_t  entry_size;     // sizeof(EvfsTarEntry)
+  uint16_t  reserved;
+  uint32_t  num_entries;
+  uint32_t  keys_size;      // Key strings including separating NULs
+  uint64_t  archive_size;
+  uint64_t  last_header;    // Offset of the last indexed file header
+  uint64_t  archive_check;  // Hash of first and last header blocks
+  uint64_t  index_check;    // Hash of entries and keys
+} TarSidecarHeader;
+
+
+// FNV-1a
+static uint64_t tarfs__checksum(uint64_t h, const void *data, size_t len) {
+  const uint8_t *bytes = (const uint8_t *)data;
+
+  if(h == 0)
+    h = 0xCBF29CE484222325ULL;
+
+  for(size_t i = 0; i < len; i++) {
+    h ^= bytes[i];
+    h *= 0x100000001B3ULL;
+  }
+
+  return h;
+}
+
+
+// Hash the archive headers that are most likely to change when the tar is rebuilt
+// The last header is read from the tar so it doesn't need a full scan
+static int tarfs__archive_check(EvfsFile *tar_file, evfs_off_t last_header, uint64_t *check) {
+  uint8_t block[TAR_BLOCK_SIZE];
+  uint64_t h = 0;
+
+  if(evfs_file_read_at(tar_file, block, sizeof block, 0) != sizeof block)
+    return EVFS_ERR_IO;
+  h = tarfs__checksum(h, block, sizeof block);
+
+  if(last_header > 0) {
+    if(evfs_file_read_at(tar_file, block, sizeof block, last_header) != sizeof block)
+      return EVFS_ERR_IO;
+    h = tarfs__checksum(h, block, sizeof block);
+  }
+
+  *check = h;
+  return EVFS_OK;
+}
+
+
+// Keys are NUL terminated and directories leave an extra NUL where their
+// trailing slash was removed. Empty strings are skipped.
+static inline const char *tarfs__next_key(const char *key, const char *keys_end) {
+  while(key < keys_end && *key == '\0') {
+    key++;
+  }
+
+  return key < keys_end ? key : NULL;
+}
+
+
+// Load a sidecar index
+// Returns an error if the sidecar is missing or doesn't match the tar file
+static int tarfs__load_index(EvfsTarIndex *ht, EvfsFile *tar_file, EvfsFile *index_file) {
+  TarSidecarHeader hdr;
+  evfs_off_t index_size = evfs_file_size(index_file);
+
+  if(index_size < (evfs_off_t)sizeof hdr)
+    return EVFS_ERR_NO_FILE;
+
+  if(evfs_file_read_at(index_file, &hdr, sizeof hdr, 0) != sizeof hdr)
+    return EVFS_ERR_IO;
+
+  size_t entries_size = (size_t)hdr.num_entries * sizeof(EvfsTarEntry);
+  size_t data_size = entries_size + hdr.keys_size;
+
+  if(memcmp(hdr.magic, SIDECAR_MAGIC, sizeof hdr.magic) != 0 ||
+     hdr.byte_order != SIDECAR_BYTE_ORDER || hdr.entry_size != sizeof(EvfsTarEntry) ||
+     (uint64_t)index_size != sizeof hdr + data_size || hdr.keys_size == 0)
+    return EVFS_ERR_INVALID;
+
+  // Confirm it was built from this tar
+  uint64_t archive_check;
+  if((uint64_t)evfs_file_size(tar_file) != hdr.archive_size)
+    return EVFS_ERR_INVALID;
+
+  int status = tarfs__archive_check(tar_file, (evfs_off_t)hdr.last_header, &archive_check);
+  if(status != EVFS_OK) return status;
+  if(archive_check != hdr.archive_check)
+    return EVFS_ERR_INVALID;
+
+
+  // Map the index data or read it in one pass
+  EvfsMapping map;
+  uint8_t *data_buf = NULL;
+  const uint8_t *data;
+
+  if(evfs_file_map(index_file, sizeof hdr, data_size, &map) == EVFS_OK && map.size == data_size) {
+    data = map.data;
+  } else {
+    evfs_file_unmap(index_file, &map);
+    data_buf = evfs_malloc(data_size);
+    if(MEM_CHECK(data_buf)) return EVFS_ERR_ALLOC;
+
+    if(evfs_file_read_at(index_file, data_buf, data_size, sizeof hdr) != (ptrdiff_t)data_size) {
+      evfs_free(data_buf);
+      return EVFS_ERR_IO;
+    }
+    data = data_buf;
+  }
+
+  const char *keys = (const char *)&data[entries_size];
+
+  if(tarfs__checksum(0, data, data_size) != hdr.index_check || keys[hdr.keys_size-1] != '\0') {
+    status = EVFS_ERR_CORRUPTION;
+    goto cleanup;
+  }
+
+
+  // Rebuild the hash from saved entries
+  status = tarfs__index_hash_init(ht, hdr.num_entries);
+  if(status != EVFS_OK) goto cleanup;
+
+  // Saved keys go into a single chunk
+  char *saved_keys = tarfs__key_alloc(ht, hdr.keys_size);
+  if(!saved_keys) {
+    tarfs__index_hash_free(ht);
+    status = EVFS_ERR_ALLOC;
+    goto cleanup;
+  }
+  memcpy(saved_keys, keys, hdr.keys_size);
+
+  const char *keys_end = saved_keys + hdr.keys_size;
+  const char *key_str = tarfs__next_key(saved_keys, keys_end);
+  uint32_t i;
+  for(i = 0; i < hdr.num_entries && key_str; i++) {
+    dhKey key;
+    EvfsTarEntry entry;
+
+    key.data = key_str;
+    key.length = strlen(key_str);
+    memcpy(&entry, &data[i * sizeof(EvfsTarEntry)], sizeof entry);
+
+    if(!tarfs__index_add(ht, key, &entry)) {
+      status = EVFS_ERR;
+      break;
+    }
+
+    key_str = tarfs__next_key(key_str + key.length + 1, keys_end);
+  }
+
+  if(status == EVFS_OK && (i != hdr.num_entries || key_str))
+    status = EVFS_ERR_CORRUPTION;
+
+  if(status == EVFS_OK)
+    status = tarfs__index_dirs(ht);
+
+  if(status == EVFS_OK && !tarfs__index_finish(ht))
+    status = EVFS_ERR;
+
+  if(status != EVFS_OK)
+    tarfs__index_hash_free(ht);
+
+cleanup:
+  if(data_buf)
+    evfs_free(data_buf);
+  else
+    evfs_file_unmap(index_file, &map);
+
+  return status;
+}
+
+
+// Save the index built from a tar file into a sidecar
+static int tarfs__save_index(EvfsTarIndex *ht, EvfsFile *tar_file, EvfsFile *index_file) {
+  TarSidecarHeader hdr = {0};
+
+  size_t entries_size = ht->num_files * sizeof(EvfsTarEntry);
+  EvfsTarEntry *entries = evfs_malloc(entries_size + 1);
+  if(MEM_CHECK(entries)) return EVFS_ERR_ALLOC;
+
+  // Entries are saved in the same order as their keys
+  evfs_off_t last_header = 0;
+  size_t num_entries = 0;
+  for(TarKeyChunk *chunk = ht->keys; chunk && num_entries < ht->num_files; chunk = chunk->next) {
+    const char *keys_end = &chunk->data[chunk->used];
+
+    for(const char *k = tarfs__next_key(chunk->data, keys_end); k && num_entries < ht->num_files;
+        k = tarfs__next_key(k + strlen(k) + 1, keys_end)) {
+      dhKey key = {.data = k, .length = strlen(k)};
+      EvfsTarEntry *entry = &entries[num_entries++];
+
+      tarfs__index_lookup(ht, key, entry);
+      if(entry->header_offset > last_header)
+        last_header = entry->header_offset;
+    }
+  }
+
+  entries_size = num_entries * sizeof(EvfsTarEntry);
+
+  memcpy(hdr.magic, SIDECAR_MAGIC, sizeof hdr.magic);
+  hdr.byte_order    = SIDECAR_BYTE_ORDER;
+  hdr.entry_size    = sizeof(EvfsTarEntry);
+  hdr.num_entries   = num_entries;
+  hdr.keys_size     = ht->keys_size;
+  hdr.archive_size  = evfs_file_size(tar_file);
+  hdr.last_header   = last_header;
+  hdr.index_check   = tarfs__checksum(0, entries, entries_size);
+
+  for(TarKeyChunk *chunk = ht->keys; chunk; chunk = chunk->next) {
+    hdr.index_check = tarfs__checksum(hdr.index_check, chunk->data, chunk->used);
+  }
+
+  int status = tarfs__archive_check(tar_file, last_header, &hdr.archive_check);
+  if(status != EVFS_OK) goto cleanup;
+
+  status = EVFS_ERR_IO;
+  if(evfs_file_write_at(index_file, &hdr, sizeof hdr, 0) != sizeof hdr ||
+     evfs_file_write_at(index_file, entries, entries_size, sizeof hdr) != (ptrdiff_t)entries_size)
+    goto cleanup;
+
+  evfs_off_t offset = sizeof hdr + entries_size;
+  for(TarKeyChunk *chunk = ht->keys; chunk; chunk = chunk->next) {
+    if(evfs_file_write_at(index_file, chunk->data, chunk->used, offset) != (ptrdiff_t)chunk->used)
+      goto cleanup;
+    offset += chunk->used;
+  }
+
+  // Discard anything left from a larger index
+  evfs_file_truncate(index_file, offset);
+  status = evfs_file_sync(index_file);
+
+cleanup:
+  evfs_free(entries);
+  return status;
+}
+
+
+
+// ******************** Mount references ********************
+
+static TarfsMount *tarfs__mount_get(TarfsData *fs_data) {
+  MOUNT_LOCK_SHARED();
+  TarfsMount *mount = fs_data->mount;
+  REF_ADD(mount->refs);
+  MOUNT_UNLOCK_SHARED();
+
+  return mount;
+}
+
+
+// Free a mount without closing its tar file
+static void tarfs__mount_free(TarfsMount *mount) {
+  evfs_file_unmap(mount->tar_file, &mount->tar_map);
+  tarfs__index_hash_free(&mount->tar_index);
+  evfs_free(mount);
+}
+
+
+static void tarfs__mount_put(TarfsMount *mount) {
+  if(REF_SUB(mount->refs) == 1) { // Last reference
+    EvfsFile *tar_file = mount->tar_file;
+    tarfs__mount_free(mount);
+    evfs_file_close(tar_file);
+  }
+}
+
+
+
+// ******************** File access methods ********************
+
+static int tarfs__file_ctrl(EvfsFile *fh, int cmd, void *arg) {
+  TarfsFile *fil = (TarfsFile *)fh;
+  EvfsFileRange range = {0};
+
+  switch(cmd) {
+    case EVFS_CMD_GET_RSRC_ADDR: // Only valid when the archive is mapped
+      {
+        if(!fil->is_open) return EVFS_ERR_NOT_OPEN;
+        if(!fil->mount->tar_map.data || fil->writing) return EVFS_ERR_NO_SUPPORT;
+
+        uint8_t **v = (uint8_t **)arg;
+        *v = (uint8_t *)fil->mount->tar_map.data + fil->header_offset + TAR_BLOCK_SIZE;
+      }
+      return EVFS_OK; break;
+
+    case EVFS_CMD_SET_FILE_ADVICE: // Members read all the way through are prefetched
+      {
+        unsigned *v = (unsigned *)arg;
+        if(*v != EVFS_ADVICE_SEQUENTIAL && *v != EVFS_ADVICE_WILL_NEED)
+          return EVFS_OK;
+      }
+      break;
+
+    case EVFS_CMD_PREFETCH:
+      range = *(EvfsFileRange *)arg;
+      break;
+
+#ifdef EVFS_USE_IO_STATS
+    case EVFS_CMD_GET_IO_STATS:
+      {
+        if(!fil->is_open) return EVFS_ERR_NOT_OPEN;
+
+        EvfsIOStats *v = (EvfsIOStats *)arg;
+        v->header_reads += fil->mount->header_reads;
+      }
+      return EVFS_OK; break;
+#endif
+
+    default: return EVFS_ERR_NO_SUPPORT; break;
+  }
+
+  if(!fil->is_open) return EVFS_ERR_NOT_OPEN;
+
+  // Limit the range to the member and pass it on to the archive
+  evfs_off_t remaining = fil->file_size - range.offset;
+  if(fil->writing || remaining <= 0) return EVFS_OK;
+
+  if(range.size == 0 || range.size > remaining)
+    range.size = remaining;
+  range.offset += fil->header_offset + TAR_BLOCK_SIZE;
 
-  return EVFS_OK;
+  return evfs_file_ctrl(fil->mount->tar_file, EVFS_CMD_PREFETCH, &range);
 }
 
+static int tarfs__file_close(EvfsFile *fh) {
+  TarfsFile *fil = (TarfsFile *)fh;
+  int status = EVFS_OK;
 
-static inline bool tarfs__lookup_path(EvfsTarIndex *ht, const char *path, EvfsTarEntry *entry) {
-  if(path[0] != '/') return false; // All paths must be absolute
+  if(fil->writing)
+    status = tarfs__end_member(fil);
 
-  dhKey key;
+  fil->is_open = false;
 
-  key.data = &path[1];
-  key.length = strlen(key.data);
+  if(fil->mount) {
+    tarfs__mount_put(fil->mount);
+    fil->mount = NULL;
+  }
 
-  return dh_lookup(&ht->hash_table, key, entry);
+  return status;
 }
 
+static ptrdiff_t tarfs__file_read_at(EvfsFile *fh, void *buf, size_t size, evfs_off_t offset) {
+  TarfsFile *fil = (TarfsFile *)fh;
 
+  if(!fil->is_open) return EVFS_ERR_NOT_OPEN;
 
-// ******************** File access methods ********************
+  evfs_off_t remaining = fil->file_size - offset;
+  if(remaining <= 0) return 0;
 
-static int tarfs__file_ctrl(EvfsFile *fh, int cmd, void *arg) {
-  return EVFS_ERR_NO_SUPPORT;
+  if((evfs_off_t)size > remaining)
+    size = remaining;
+
+  evfs_off_t data_offset = fil->header_offset + TAR_BLOCK_SIZE + offset;
+  EvfsMapping *tar_map = &fil->mount->tar_map;
+
+  if(tar_map->data) { // Copy directly from the mapped archive
+    if(data_offset >= (evfs_off_t)tar_map->size) return 0; // Truncated archive
+    size = MIN(size, tar_map->size - (size_t)data_offset);
+    memcpy(buf, tar_map->data + data_offset, size);
+    return size;
+  }
+
+  return evfs_file_read_at(fil->mount->tar_file, buf, size, data_offset);
 }
 
-static int tarfs__file_close(EvfsFile *fh) {
+static ptrdiff_t tarfs__file_read(EvfsFile *fh, void *buf, size_t size) {
   TarfsFile *fil = (TarfsFile *)fh;
 
-  fil->is_open = false;
-  return EVFS_OK;
+  ptrdiff_t rval = tarfs__file_read_at(fh, buf, size, fil->read_pos);
+  if(rval > 0)
+    fil->read_pos += rval;
+
+  return rval;
 }
 
-static ptrdiff_t tarfs__file_read(EvfsFile *fh, void *buf, size_t size) {
+// Archived files are mapped through the tar file when it supports mapping
+static int tarfs__file_map(EvfsFile *fh, evfs_off_t offset, size_t size, EvfsMapping *map) {
   TarfsFile *fil = (TarfsFile *)fh;
-  TarfsData *fs_data = (TarfsData *)fil->fs_data;
 
   if(!fil->is_open) return EVFS_ERR_NOT_OPEN;
+  if(offset > fil->file_size) return EVFS_ERR_OVERFLOW;
 
-  evfs_off_t remaining = fil->file_size - fil->read_pos;
-  if(remaining <= 0) return 0;
+  evfs_off_t remaining = fil->file_size - offset;
+  if(remaining == 0) return EVFS_OK; // Empty mapping
 
-  if((evfs_off_t)size > remaining)
+  if(size == 0 || (evfs_off_t)size > remaining)
     size = remaining;
 
-  LOCK();
-  evfs_file_seek(fs_data->tar_file, fil->header_offset + TAR_BLOCK_SIZE + fil->read_pos, EVFS_SEEK_TO);
-  fil->read_pos += size;
-  ptrdiff_t rval = evfs_file_read(fs_data->tar_file, buf, size);
-  UNLOCK();
+  evfs_off_t data_offset = fil->header_offset + TAR_BLOCK_SIZE + offset;
+  EvfsMapping *tar_map = &fil->mount->tar_map;
 
-  return rval;
+  if(tar_map->data) { // Slice of the mapped archive
+    if(data_offset + (evfs_off_t)size > (evfs_off_t)tar_map->size) return EVFS_ERR_OVERFLOW;
+    map->data = tar_map->data + data_offset;
+    map->size = size;
+    return EVFS_OK;
+  }
+
+  return evfs_file_map(fil->mount->tar_file, data_offset, size, map);
+}
+
+static int tarfs__file_unmap(EvfsFile *fh, EvfsMapping *map) {
+  TarfsFile *fil = (TarfsFile *)fh;
+
+  if(fil->mount->tar_map.data) // Slices are released with the mount
+    return EVFS_OK;
+
+  return evfs_file_unmap(fil->mount->tar_file, map);
 }
 
+// Only new members in a writable mount accept data
 static ptrdiff_t tarfs__file_write(EvfsFile *fh, const void *buf, size_t size) {
-  return EVFS_ERR_NO_SUPPORT;
+  TarfsFile *fil = (TarfsFile *)fh;
+
+  if(!fil->is_open) return EVFS_ERR_NOT_OPEN;
+  if(!fil->writing) return EVFS_ERR_NO_SUPPORT;
+
+  if((uint64_t)fil->read_pos + size > TARFS_MAX_MEMBER_SIZE)
+    return EVFS_ERR_OVERFLOW;
+
+  ptrdiff_t rval = evfs_file_write_at(fil->mount->tar_file, buf, size,
+                                      fil->header_offset + TAR_BLOCK_SIZE + fil->read_pos);
+  if(rval > 0) {
+    fil->read_pos += rval;
+    if(fil->read_pos > fil->file_size)
+      fil->file_size = fil->read_pos;
+  }
+
+  return rval;
 }
 
 static int tarfs__file_truncate(EvfsFile *fh, evfs_off_t size) {
@@ -303,6 +1450,11 @@ static int tarfs__file_truncate(EvfsFile *fh, evfs_off_t size) {
 }
 
 static int tarfs__file_sync(EvfsFile *fh) {
+  TarfsFile *fil = (TarfsFile *)fh;
+
+  if(fil->writing)
+    return evfs_file_sync(fil->mount->tar_file);
+
   return EVFS_OK; // Need to report as OK because evfs_file_size() syncs
 }
 
@@ -360,13 +1512,86 @@ static EvfsFileMethods s_tarfs_methods = {
   .m_size     = tarfs__file_size,
   .m_seek     = tarfs__file_seek,
   .m_tell     = tarfs__file_tell,
-  .m_eof      = tarfs__file_eof
+  .m_eof      = tarfs__file_eof,
+  .m_read_at  = tarfs__file_read_at,
+  .m_map      = tarfs__file_map,
+  .m_unmap    = tarfs__file_unmap
+};
+
+
+
+// ******************** Directory access methods ********************
+
+static int tarfs__dir_close(EvfsDir *dh) {
+  TarfsDir *dir = (TarfsDir *)dh;
+
+  dir->pos = dir->end;
+
+  if(dir->mount) {
+    tarfs__mount_put(dir->mount);
+    dir->mount = NULL;
+  }
+
+  return EVFS_OK;
+}
+
+
+static int tarfs__dir_read(EvfsDir *dh, EvfsInfo *info) {
+  TarfsDir *dir = (TarfsDir *)dh;
+#ifdef EVFS_USE_THREADING
+  TarfsData *fs_data = dir->fs_data;
+#endif
+  EvfsTarIndex *ht = &dir->mount->tar_index;
+
+  memset(info, 0, sizeof(*info));
+
+  if(dir->pos >= dir->end)
+    return EVFS_DONE;
+
+  INDEX_LOCK_SHARED();
+  TarDirEntry *de = &ht->dir_entries[dir->pos++];
+
+  // Keys are NUL terminated so the name can be returned in place
+  info->name = (char *)DIR_NAME(de);
+
+  if(de->file_size >= 0)
+    info->size = de->file_size;
+  else
+    info->type |= EVFS_FILE_DIR;
+  INDEX_UNLOCK_SHARED();
+
+  return EVFS_OK;
+}
+
+
+static int tarfs__dir_rewind(EvfsDir *dh) {
+  TarfsDir *dir = (TarfsDir *)dh;
+
+  dir->pos = dir->start;
+  return EVFS_OK;
+}
+
+
+static EvfsDirMethods s_tarfs_dir_methods = {
+  .m_close    = tarfs__dir_close,
+  .m_read     = tarfs__dir_read,
+  .m_rewind   = tarfs__dir_rewind
 };
 
 
 
 // ******************** FS access methods ********************
 
+static int tarfs__find_path(TarfsData *fs_data, TarfsMount *mount, const char *path,
+                            EvfsTarEntry *entry) {
+  INDEX_LOCK_SHARED();
+  bool found = tarfs__lookup_path(&mount->tar_index, path, entry);
+  INDEX_UNLOCK_SHARED();
+
+  return found ? EVFS_OK : EVFS_ERR_NO_FILE;
+}
+
+
 static int tarfs__open(Evfs *vfs, const char *path, EvfsFile *fh, int flags) {
   int err = EVFS_OK;
   TarfsData *fs_data = (TarfsData *)vfs->fs_data;
@@ -375,21 +1600,29 @@ static int tarfs__open(Evfs *vfs, const char *path, EvfsFile *fh, int flags) {
 
   memset(fil, 0, sizeof(*fil));
   fh->methods = &s_tarfs_methods;
+  fil->fs_data = fs_data;
+  fil->mount = tarfs__mount_get(fs_data);
 
-  if(flags & (EVFS_WRITE | EVFS_OPEN_OR_NEW | EVFS_OVERWRITE | EVFS_APPEND))
-    return EVFS_ERR_NO_SUPPORT;
-
-
-  if(evfs_vfs_path_is_absolute(vfs, path)) {
-    err = tarfs__lookup_path(&fs_data->tar_index, path, &entry) ? EVFS_OK : EVFS_ERR;
+  if(flags & (EVFS_WRITE | EVFS_OPEN_OR_NEW | EVFS_OVERWRITE | EVFS_APPEND)) {
+    // Writes always add a new member. It can only replace an older one with EVFS_OVERWRITE.
+    if(!fs_data->writable || (flags & EVFS_APPEND)) {
+      err = EVFS_ERR_NO_SUPPORT;
+      goto cleanup;
+    }
 
-  } else { // Convert relative path
+    // Normalize so that "." and ".." don't appear in the key
     MAKE_ABS(path, abs_path);
-    err = tarfs__lookup_path(&fs_data->tar_index, abs_path, &entry) ? EVFS_OK : EVFS_ERR;
+    err = tarfs__begin_member(fs_data, fil, abs_path, TAR_TYPE_NORMAL_FILE, flags);
     FREE_ABS(abs_path);
+    goto cleanup;
   }
 
-  if(entry.header_offset < 0)
+
+  MAKE_ABS(path, abs_path);
+  err = tarfs__find_path(fs_data, fil->mount, abs_path, &entry);
+  FREE_ABS(abs_path);
+
+  if(err == EVFS_OK && entry.header_offset < 0)
     err = EVFS_ERR_IS_DIR;
 
   if(err == EVFS_OK) {
@@ -401,7 +1634,11 @@ static int tarfs__open(Evfs *vfs, const char *path, EvfsFile *fh, int flags) {
     fil->is_open = false;
   }
 
-  fil->fs_data = fs_data;
+cleanup:
+  if(err != EVFS_OK) { // Handle won't be closed
+    tarfs__mount_put(fil->mount);
+    fil->mount = NULL;
+  }
 
   return err;
 }
@@ -412,13 +1649,11 @@ static int tarfs__stat(Evfs *vfs, const char *path, EvfsInfo *info) {
   EvfsTarEntry entry;
   int err;
 
-  if(evfs_vfs_path_is_absolute(vfs, path)) {  
-    err = tarfs__lookup_path(&fs_data->tar_index, path, &entry) ? EVFS_OK : EVFS_ERR;
-  } else { // Convert relative path
-    MAKE_ABS(path, abs_path);
-    err = tarfs__lookup_path(&fs_data->tar_index, abs_path, &entry) ? EVFS_OK : EVFS_ERR;
-    FREE_ABS(abs_path);
-  }
+  TarfsMount *mount = tarfs__mount_get(fs_data);
+  MAKE_ABS(path, abs_path);
+  err = tarfs__find_path(fs_data, mount, abs_path, &entry);
+  FREE_ABS(abs_path);
+  tarfs__mount_put(mount);
 
   memset(info, 0, sizeof(*info));
 
@@ -434,13 +1669,53 @@ static int tarfs__stat(Evfs *vfs, const char *path, EvfsInfo *info) {
 }
 
 
+static int tarfs__open_dir(Evfs *vfs, const char *path, EvfsDir *dh) {
+  TarfsData *fs_data = (TarfsData *)vfs->fs_data;
+  TarfsDir *dir = (TarfsDir *)dh;
+
+  memset(dir, 0, sizeof(*dir));
+  dh->methods = &s_tarfs_dir_methods;
+  dir->fs_data = fs_data;
+  dir->mount = tarfs__mount_get(fs_data);
+
+  // Normalize so that "." and ".." don't appear in the key
+  MAKE_ABS(path, abs_path);
+  INDEX_LOCK_SHARED();
+  int status = tarfs__dir_range(&dir->mount->tar_index, abs_path, &dir->start, &dir->end);
+  INDEX_UNLOCK_SHARED();
+  FREE_ABS(abs_path);
+
+  dir->pos = dir->start;
+
+  if(status != EVFS_OK) { // Handle won't be closed
+    tarfs__mount_put(dir->mount);
+    dir->mount = NULL;
+  }
+
+  return status;
+}
+
+
+static int tarfs__make_dir(Evfs *vfs, const char *path) {
+  TarfsData *fs_data = (TarfsData *)vfs->fs_data;
+
+  MAKE_ABS(path, abs_path);
+  int status = tarfs__begin_member(fs_data, NULL, abs_path, TAR_TYPE_DIRECTORY, 0);
+  FREE_ABS(abs_path);
+
+  return status;
+}
+
+
 
 // Tarfs doesn't handle relative paths so we track the current directory in fs_data
 static int tarfs__get_cur_dir(Evfs *vfs, StringRange *cur_dir) {
   TarfsData *fs_data = (TarfsData *)vfs->fs_data;
   AppendRange r = *(AppendRange *)cur_dir;
 
+  DIR_LOCK_SHARED();
   range_cat_str(&r, fs_data->cur_dir);
+  DIR_UNLOCK_SHARED();
   range_terminate(&r);
   return EVFS_OK;
 }
@@ -450,41 +1725,21 @@ static int tarfs__get_cur_dir(Evfs *vfs, StringRange *cur_dir) {
 static int tarfs__set_cur_dir(Evfs *vfs, const char *path) {
   TarfsData *fs_data = (TarfsData *)vfs->fs_data;
 
-  if(evfs_vfs_path_is_absolute(vfs, path)) { // Just assign absolute paths
-    // Confirm the path exists
-    if(!evfs__vfs_existing_dir(vfs, path))
-      return EVFS_ERR_NO_PATH;
-  
-    strncpy(fs_data->cur_dir, path, EVFS_MAX_PATH-1);
-    fs_data->cur_dir[EVFS_MAX_PATH-1] = '\0';
-
-  } else { // Path is relative: Join it to the existing directory
-    StringRange head, tail, joined;
-    
-    range_init(&head, fs_data->cur_dir, EVFS_MAX_PATH);
-    range_init(&tail, (char *)path, strlen(path));
-    
-    size_t joined_size = strlen(fs_data->cur_dir) + 1 + strlen(path) + 1;
-    char *joined_path = evfs_malloc(joined_size);
-    if(MEM_CHECK(joined_path)) return EVFS_ERR_ALLOC;
+  MAKE_ABS(path, abs_path);
 
-    range_init(&joined, joined_path, joined_size);
-
-    evfs_vfs_path_join(vfs, &head, &tail, &joined);
-
-    // Confirm the path exists
-    if(!evfs__vfs_existing_dir(vfs, joined_path)) {
-      evfs_free(joined_path);
-      return EVFS_ERR_NO_PATH;
-    }
-
-    // Overwrite old cur_dir
-    evfs_vfs_path_normalize(vfs, joined_path, &head);
-
-    evfs_free(joined_path);
+  // Confirm the path exists
+  int status = EVFS_OK;
+  if(evfs__vfs_existing_dir(vfs, abs_path)) {
+    DIR_LOCK_EXCL();
+    strncpy(fs_data->cur_dir, abs_path, EVFS_MAX_PATH-1);
+    fs_data->cur_dir[EVFS_MAX_PATH-1] = '\0';
+    DIR_UNLOCK_EXCL();
+  } else {
+    status = EVFS_ERR_NO_PATH;
   }
 
-  return EVFS_OK;
+  FREE_ABS(abs_path);
+  return status;
 }
 
 
@@ -495,10 +1750,11 @@ static int tarfs__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
 
   switch(cmd) {
     case EVFS_CMD_UNREGISTER:
-      evfs_file_close(fs_data->tar_file);
-      tarfs__index_hash_free(&fs_data->tar_index);
-#ifdef USE_TARFS_LOCK
-      evfs__lock_destroy(&fs_data->tfs_lock);
+      tarfs__mount_put(fs_data->mount);
+#ifdef EVFS_USE_THREADING
+      evfs__rwlock_destroy(&fs_data->dir_lock);
+      evfs__rwlock_destroy(&fs_data->index_lock);
+      evfs__rwlock_destroy(&fs_data->mount_lock);
 #endif
       evfs_free(vfs);
       return EVFS_OK; break;
@@ -513,7 +1769,15 @@ static int tarfs__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
     case EVFS_CMD_GET_DIR_FIELDS:
       {
         unsigned *v = (unsigned *)arg;
-        *v = 0;
+        *v = EVFS_INFO_SIZE | EVFS_INFO_TYPE;
+      }
+      return EVFS_OK; break;
+
+    case EVFS_CMD_GET_INDEX_STATS:
+      {
+        TarfsMount *mount = tarfs__mount_get(fs_data);
+        *(EvfsIndexStats *)arg = mount->index_stats;
+        tarfs__mount_put(mount);
       }
       return EVFS_OK; break;
 
@@ -526,19 +1790,85 @@ static int tarfs__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
 // Access objects allocated in a single block of memory
 #define NEXT_OBJ(o) (&(o)[1])
 
-/*
-Register a Tar FS instance
+// An archive with no members can be overwritten by a writable mount
+static bool tarfs__archive_empty(EvfsFile *tar_file) {
+  uint8_t block[TAR_BLOCK_SIZE];
 
-Args:
-  vfs_name:      Name of new VFS
-  tar_file:      EVFS file of Tar data
-  default_vfs:   Make this the default VFS when true
+  ptrdiff_t rval = evfs_file_read_at(tar_file, block, sizeof block, 0);
+  if(rval == 0) return true;
+  if(rval != sizeof block) return false;
 
-Returns:
-  EVFS_OK on success
-*/
-int evfs_register_tar_fs(const char *vfs_name, EvfsFile *tar_file, bool default_vfs) {
-  if(PTR_CHECK(vfs_name) || PTR_CHECK(tar_file)) return EVFS_ERR_BAD_ARG;
+  for(size_t i = 0; i < sizeof block; i++) {
+    if(block[i] != 0) return false;
+  }
+
+  return true; // Only an end of archive marker
+}
+
+
+// Build a new mount with its index
+static int tarfs__mount_new(EvfsFile *tar_file, EvfsFile *index_file, bool writable,
+                            TarfsMount **mount, evfs_off_t *archive_end) {
+  TarfsMount *new_mount = evfs_malloc(sizeof(*new_mount));
+  if(MEM_CHECK(new_mount)) return EVFS_ERR_ALLOC;
+  memset(new_mount, 0, sizeof(*new_mount));
+
+  new_mount->tar_file = tar_file;
+
+#ifdef EVFS_USE_IMAGE_MAPPING
+  // Read-only archives that can be mapped are accessed in place
+  if(!writable && evfs_file_map(tar_file, 0, 0, &new_mount->tar_map) != EVFS_OK)
+    memset(&new_mount->tar_map, 0, sizeof(new_mount->tar_map));
+#endif
+
+  uint64_t start = tarfs__time_usec();
+
+  if(index_file && tarfs__load_index(&new_mount->tar_index, tar_file, index_file) == EVFS_OK) {
+    new_mount->index_stats.from_sidecar = true;
+  } else {
+    TarFileIterator tar_it;
+    tar_iter_init(&tar_it, tar_file);
+
+#if EVFS_TARFS_READ_AHEAD_SIZE > 0
+    // Scanning works without read-ahead if this fails
+    uint8_t *read_ahead = NULL;
+    if(!new_mount->tar_map.data) {
+      read_ahead = evfs_malloc(EVFS_TARFS_READ_AHEAD_SIZE);
+      tar_iter_set_buffer(&tar_it, read_ahead, EVFS_TARFS_READ_AHEAD_SIZE);
+    }
+#endif
+    if(new_mount->tar_map.data)
+      tar_iter_set_mapping(&tar_it, new_mount->tar_map.data, new_mount->tar_map.size);
+
+    int status = tarfs__build_index(&tar_it, &new_mount->tar_index, archive_end,
+                                    &new_mount->header_reads);
+    if(status == EVFS_OK && index_file)
+      tarfs__save_index(&new_mount->tar_index, tar_file, index_file); // Mount still works if this fails
+
+#if EVFS_TARFS_READ_AHEAD_SIZE > 0
+    if(read_ahead)
+      evfs_free(read_ahead);
+#endif
+
+    // Appending to something that isn't a tar would overwrite it
+    if(status != EVFS_OK && writable && !tarfs__archive_empty(tar_file)) {
+      tarfs__mount_free(new_mount);
+      return EVFS_ERR_CORRUPTION;
+    }
+  }
+
+  new_mount->index_stats.files      = new_mount->tar_index.num_files;
+  new_mount->index_stats.key_bytes  = new_mount->tar_index.keys_size;
+  new_mount->index_stats.build_usec = tarfs__time_usec() - start;
+
+  new_mount->refs = 1; // Reference for the VFS
+  *mount = new_mount;
+  return EVFS_OK;
+}
+
+
+static int tarfs__register(const char *vfs_name, EvfsFile *tar_file, EvfsFile *index_file, bool writable,
+                           bool default_vfs) {
   Evfs *new_vfs;
   TarfsData *fs_data;
 
@@ -558,15 +1888,18 @@ int evfs_register_tar_fs(const char *vfs_name, EvfsFile *tar_file, bool default_
   // Init FS data
 
   strncpy(fs_data->cur_dir, "/", 2); // Start in root dir
-  fs_data->tar_file = tar_file;
 
-  TarFileIterator tar_it;
-  tar_iter_init(&tar_it, fs_data->tar_file);
-  tarfs__build_index(&tar_it, &fs_data->tar_index);
+  int status = tarfs__mount_new(tar_file, index_file, writable, &fs_data->mount, &fs_data->archive_end);
+  if(status != EVFS_OK) {
+    evfs_free(new_vfs);
+    return status;
+  }
+
+  fs_data->writable = writable;
 
   // Init VFS
   new_vfs->vfs_file_size = sizeof(TarfsFile);
-  new_vfs->vfs_dir_size = 0;
+  new_vfs->vfs_dir_size = sizeof(TarfsDir);
   new_vfs->fs_data = fs_data;
 
   // Required methods
@@ -574,13 +1907,19 @@ int evfs_register_tar_fs(const char *vfs_name, EvfsFile *tar_file, bool default_
   new_vfs->m_stat = tarfs__stat;
   
   // Optional methods
+  new_vfs->m_open_dir = tarfs__open_dir;
   new_vfs->m_get_cur_dir = tarfs__get_cur_dir;
   new_vfs->m_set_cur_dir = tarfs__set_cur_dir;
   new_vfs->m_vfs_ctrl = tarfs__vfs_ctrl;
+  if(writable)
+    new_vfs->m_make_dir = tarfs__make_dir;
 
 
-#ifdef USE_TARFS_LOCK
-  if(evfs__lock_init(&fs_data->tfs_lock) != EVFS_OK) {
+#ifdef EVFS_USE_THREADING
+  if(evfs__rwlock_init(&fs_data->dir_lock) != EVFS_OK ||
+     evfs__rwlock_init(&fs_data->index_lock) != EVFS_OK ||
+     evfs__rwlock_init(&fs_data->mount_lock) != EVFS_OK) {
+    tarfs__mount_free(fs_data->mount); // Caller still owns tar_file
     evfs_free(new_vfs);
     THROW(EVFS_ERR_INIT);
   }
@@ -590,3 +1929,134 @@ int evfs_register_tar_fs(const char *vfs_name, EvfsFile *tar_file, bool default_
 }
 
 
+
+
+/*
+Register a Tar FS instance
+
+Args:
+  vfs_name:      Name of new VFS
+  tar_file:      EVFS file of Tar data
+  default_vfs:   Make this the default VFS when true
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_register_tar_fs(const char *vfs_name, EvfsFile *tar_file, bool default_vfs) {
+  return evfs_register_tar_fs_with_index(vfs_name, tar_file, NULL, default_vfs);
+}
+
+
+/*
+Register a Tar FS instance using a sidecar index
+
+The index is loaded from index_file when it matches tar_file. Otherwise the
+tar is scanned as usual and the new index is saved into index_file for the
+next mount. The index file should be opened with EVFS_RDWR | EVFS_OPEN_OR_NEW.
+It is only used during registration and remains owned by the caller.
+
+Args:
+  vfs_name:      Name of new VFS
+  tar_file:      EVFS file of Tar data
+  index_file:    EVFS file for the sidecar index. Can be NULL to always scan the tar.
+  default_vfs:   Make this the default VFS when true
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_register_tar_fs_with_index(const char *vfs_name, EvfsFile *tar_file, EvfsFile *index_file,
+                                    bool default_vfs) {
+  if(PTR_CHECK(vfs_name) || PTR_CHECK(tar_file)) return EVFS_ERR_BAD_ARG;
+  return tarfs__register(vfs_name, tar_file, index_file, /*writable*/ false, default_vfs);
+}
+
+
+/*
+Register a Tar FS instance that can append to the archive
+
+Files opened for writing are added as new members at the end of the archive.
+A member replaces any older one with the same path when its file is closed.
+Only one file can be written at a time. New directories can also be added.
+An empty tar file is treated as an empty archive.
+
+The tar file should be opened with EVFS_RDWR | EVFS_OPEN_OR_NEW.
+
+Args:
+  vfs_name:      Name of new VFS
+  tar_file:      EVFS file of Tar data
+  default_vfs:   Make this the default VFS when true
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_register_tar_fs_writable(const char *vfs_name, EvfsFile *tar_file, bool default_vfs) {
+  if(PTR_CHECK(vfs_name) || PTR_CHECK(tar_file)) return EVFS_ERR_BAD_ARG;
+
+#ifdef EVFS_USE_PERFECT_HASH_INDEX
+  return EVFS_ERR_NO_SUPPORT; // Perfect hash can't be updated after it is built
+#else
+  return tarfs__register(vfs_name, tar_file, NULL, /*writable*/ true, default_vfs);
+#endif
+}
+
+
+
+
+/*
+Replace the archive of a registered Tar FS
+
+The new archive is indexed before it is swapped in. Lookups continue on the
+old archive until then. Handles opened on the old archive stay valid and it
+is closed after the last of them is closed. The current directory is kept as
+is. Writable mounts can't be remounted.
+
+Args:
+  vfs_name:      Name of a VFS registered with evfs_register_tar_fs() or
+                 evfs_register_tar_fs_with_index()
+  tar_file:      EVFS file of new Tar data. Left open on failure.
+  index_file:    EVFS file for the sidecar index. Can be NULL to always scan the tar.
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_remount_tar_fs_with_index(const char *vfs_name, EvfsFile *tar_file, EvfsFile *index_file) {
+  if(PTR_CHECK(vfs_name) || PTR_CHECK(tar_file)) return EVFS_ERR_BAD_ARG;
+
+  Evfs *vfs = evfs_find_vfs(vfs_name);
+  if(!vfs || vfs->m_open != tarfs__open) THROW(EVFS_ERR_NO_VFS);
+
+  TarfsData *fs_data = (TarfsData *)vfs->fs_data;
+  if(fs_data->writable) return EVFS_ERR_NO_SUPPORT; // Writer is tied to its archive
+
+  // The new index is built without blocking access to the old one
+  TarfsMount *new_mount;
+  evfs_off_t archive_end;
+  int status = tarfs__mount_new(tar_file, index_file, /*writable*/ false, &new_mount, &archive_end);
+  if(status != EVFS_OK) return status;
+
+  MOUNT_LOCK_EXCL();
+  TarfsMount *old_mount = fs_data->mount;
+  fs_data->mount = new_mount;
+  MOUNT_UNLOCK_EXCL();
+
+  tarfs__mount_put(old_mount); // Freed now or when its last handle closes
+
+  return EVFS_OK;
+}
+
+
+/*
+Replace the archive of a registered Tar FS
+
+See evfs_remount_tar_fs_with_index().
+
+Args:
+  vfs_name:      Name of a VFS registered with evfs_register_tar_fs()
+  tar_file:      EVFS file of new Tar data. Left open on failure.
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_remount_tar_fs(const char *vfs_name, EvfsFile *tar_file) {
+  return evfs_remount_tar_fs_with_index(vfs_name, tar_file, NULL);
+}
@@ -41,23 +41,56 @@ void tar_iter_close(TarFileIterator *tar_it) {
 }
 
 
+/*
+Set a read-ahead buffer for the iterator
+
+Headers are read from the tar file in runs of buf_size bytes so that
+consecutive small files are scanned from memory rather than with a read
+call per header. The buffer must remain valid while the iterator is in use.
+
+Args:
+  tar_it:   Iterator to modify
+  buf:      Buffer for read-ahead data. Use NULL to read each header directly.
+  buf_size: Size of buf
+*/
+void tar_iter_set_buffer(TarFileIterator *tar_it, uint8_t *buf, size_t buf_size) {
+  if(buf_size < TAR_BLOCK_SIZE)
+    buf = NULL;
+
+  tar_it->buf = buf;
+  tar_it->buf_size = buf ? buf_size : 0;
+  tar_it->buf_offset = 0;
+  tar_it->buf_len = 0;
+  tar_it->buf_mapped = false;
+}
+
+
+/*
+Scan headers from a memory mapped archive
+
+The mapping must cover the whole tar file and remain valid while the
+iterator is in use. Headers are read from it in place and nothing is read
+through the file.
+
+Args:
+  tar_it: Iterator to modify
+  data:   Mapped tar file data
+  size:   Size of the mapping
+*/
+void tar_iter_set_mapping(TarFileIterator *tar_it, const uint8_t *data, size_t size) {
+  tar_it->buf = (uint8_t *)data; // Never written when mapped
+  tar_it->buf_size = size;
+  tar_it->buf_offset = 0;
+  tar_it->buf_len = size;
+  tar_it->buf_mapped = true;
+}
+
+
 static bool tar__valid_header(TarHeader *header) {
   // Only support ustar format
   if(strcmp((const char *)header->magic, "ustar  ") != 0) return false;
   
-  // Compute the checksum
-  uint8_t *raw_header = (uint8_t *)header;
-  uint32_t checksum = 0;
-  for(size_t i = 0; i < offsetof(TarHeader, checksum); i++) {
-    checksum += raw_header[i];
-  }
-  // Replace checksum with spaces
-  for(size_t i = offsetof(TarHeader, checksum); i < offsetof(TarHeader, type_flag); i++) {
-    checksum += ' ';
-  }
-  for(size_t i = offsetof(TarHeader, type_flag); i < TAR_HEADER_SIZE; i++) {
-    checksum += raw_header[i];
-  }
+  uint32_t checksum = tar_header_checksum(header);
 
   // Validate  
   // Only supporting NUL terminated octal with '0' padding
@@ -67,17 +100,44 @@ static bool tar__valid_header(TarHeader *header) {
 }
 
 
-static bool tar__get_header(TarFileIterator *tar_it, TarHeader *header) {
-  tar_it->header_offset = evfs_file_tell(tar_it->fd);
+// Reads after skipping over file data are limited to this size. Large files
+// are often not followed by runs of small ones.
+#define TAR_SKIP_READ_SIZE  (8 * TAR_BLOCK_SIZE)
+
+static bool tar__read_header(TarFileIterator *tar_it, evfs_off_t offset, TarHeader *header) {
+  if(!tar_it->buf)
+    return evfs_file_read_at(tar_it->fd, header, TAR_HEADER_SIZE, offset) == TAR_HEADER_SIZE;
+
+  evfs_off_t buf_end = tar_it->buf_offset + (evfs_off_t)tar_it->buf_len;
+
+  if(offset < tar_it->buf_offset || offset + TAR_HEADER_SIZE > buf_end) { // Refill
+    if(tar_it->buf_mapped) // Past the end of the archive
+      return false;
+
+    size_t read_size = tar_it->buf_size;
+    if(tar_it->buf_len > 0 && offset != buf_end && read_size > TAR_SKIP_READ_SIZE)
+      read_size = TAR_SKIP_READ_SIZE;
+
+    ptrdiff_t rval = evfs_file_read_at(tar_it->fd, tar_it->buf, read_size, offset);
+    tar_it->buf_offset = offset;
+    tar_it->buf_len = rval > 0 ? (size_t)rval : 0;
+
+    if(tar_it->buf_len < TAR_HEADER_SIZE)
+      return false;
+  }
 
-  if(evfs_file_read(tar_it->fd, header, TAR_HEADER_SIZE) != TAR_HEADER_SIZE)
+  memcpy(header, &tar_it->buf[offset - tar_it->buf_offset], TAR_HEADER_SIZE);
+  return true;
+}
+
+
+static bool tar__get_header(TarFileIterator *tar_it, evfs_off_t offset, TarHeader *header) {
+  tar_it->header_offset = offset;
+
+  if(!tar__read_header(tar_it, offset, header))
     goto fail;
 
   if(tar__valid_header(header)) {
-    // Seek to start of next 512 byte TAR block for file data
-    if(evfs_file_seek(tar_it->fd, TAR_BLOCK_SIZE - TAR_HEADER_SIZE, EVFS_SEEK_REL) != EVFS_OK)
-      goto fail;
-
     // Extract fields
     // Only supporting NUL terminated octal with '0' padding
     tar_it->file_size = strtol((const char *)header->size, NULL, 8);
@@ -93,10 +153,7 @@ fail:
 
 
 bool tar_iter_seek(TarFileIterator *tar_it, evfs_off_t offset) {
-  if(evfs_file_seek(tar_it->fd, offset, EVFS_SEEK_TO) != EVFS_OK)
-    return false;
-
-  return tar__get_header(tar_it, &tar_it->cur_header);
+  return tar__get_header(tar_it, offset, &tar_it->cur_header);
 }
 
 
@@ -105,10 +162,7 @@ bool tar_iter_next(TarFileIterator *tar_it) {
   evfs_off_t file_blocks = (tar_it->file_size + TAR_BLOCK_SIZE-1) / TAR_BLOCK_SIZE;
   evfs_off_t next_header = tar_it->header_offset + (file_blocks+1) * TAR_BLOCK_SIZE;
 
-  if(evfs_file_seek(tar_it->fd, next_header, EVFS_SEEK_TO) != EVFS_OK)
-    return false;
-
-  return tar__get_header(tar_it, &tar_it->cur_header);
+  return tar__get_header(tar_it, next_header, &tar_it->cur_header);
 }
 
 
@@ -41,19 +41,7 @@ static bool tar__valid_header(TarHeader *header) {
   // Only support ustar format
   if(strcmp((const char *)header->magic, "ustar  ") != 0) return false;
   
-  // Compute the checksum
-  uint8_t *raw_header = (uint8_t *)header;
-  uint32_t checksum = 0;
-  for(size_t i = 0; i < offsetof(TarHeader, checksum); i++) {
-    checksum += raw_header[i];
-  }
-  // Replace checksum with spaces
-  for(size_t i = offsetof(TarHeader, checksum); i < offsetof(TarHeader, type_flag); i++) {
-    checksum += ' ';
-  }
-  for(size_t i = offsetof(TarHeader, type_flag); i < TAR_HEADER_SIZE; i++) {
-    checksum += raw_header[i];
-  }
+  uint32_t checksum = tar_header_checksum(header);
 
   // Validate  
   // Only supporting NUL terminated octal with '0' padding
@@ -27,31 +27,36 @@ Embedded Virtual Filesystem
 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "evfs.h"
 #include "evfs_internal.h"
 #include "evfs/tar_iter_rsrc.h"
 #include "evfs/tar_rsrc_fs.h"
 
-#include "evfs/util/dhash.h"
+#ifdef EVFS_USE_PERFECT_HASH_INDEX
+#  include "evfs/util/mphash.h"
+#else
+#  include "evfs/util/dhash.h"
+#endif
 #include "evfs/util/range_strings.h"
 
 
 ///////////////////////////////////////////////////////////////////////////////////
 
-// Shared buffer needs lock if threading is enabled
-#if defined EVFS_USE_TARFS_SHARED_BUFFER && defined EVFS_USE_THREADING
-#  define USE_TARFS_LOCK
-#endif
-
-
-#ifdef USE_TARFS_LOCK
-#  define LOCK()    evfs__lock(&fs_data->tfs_lock)
-#  define UNLOCK()  evfs__unlock(&fs_data->tfs_lock)
+// Path lookups only read cur_dir so they can share its lock
+#ifdef EVFS_USE_THREADING
+#  define DIR_LOCK_SHARED()     evfs__lock_shared(&fs_data->dir_lock)
+#  define DIR_UNLOCK_SHARED()   evfs__unlock_shared(&fs_data->dir_lock)
+#  define DIR_LOCK_EXCL()       evfs__lock_exclusive(&fs_data->dir_lock)
+#  define DIR_UNLOCK_EXCL()     evfs__unlock_exclusive(&fs_data->dir_lock)
 #else
-#  define LOCK()
-#  define UNLOCK()
+#  define DIR_LOCK_SHARED()
+#  define DIR_UNLOCK_SHARED()
+#  define DIR_LOCK_EXCL()
+#  define DIR_UNLOCK_EXCL()
 #endif
 
 
@@ -61,11 +66,52 @@ typedef struct EvfsTarEntry {
 } EvfsTarEntry;
 
 
+// Chunk of storage for path keys. Keys never span chunks.
+typedef struct TarKeyChunk {
+  struct TarKeyChunk *next;
+  size_t  size;
+  size_t  used;
+  char    data[];
+} TarKeyChunk;
+
+
+// Directory listing entry
+// The listing is sorted by parent path and then name so that the children of
+// a directory are a contiguous range.
+typedef struct TarDirEntry {
+  const char *key;        // Full path in key storage
+  ptrdiff_t   file_size;  // -1 for directories
+  uint32_t    seq;        // Insertion order. 0 for implied directories.
+  uint16_t    key_len;
+  uint16_t    parent_len; // Length of parent path prefix in key
+} TarDirEntry;
+
+
 typedef struct EvfsTarIndex {
+#ifdef EVFS_USE_PERFECT_HASH_INDEX
+  mphash hash_table; // Immutable index of hashed key/value pairs
+#else
   dhash hash_table; // Manages index of hashed key/value pairs
+#endif
 
   // Storage for file path keys
-  char *keys;
+  TarKeyChunk *keys;
+  TarKeyChunk *keys_tail;
+  size_t keys_size;   // Bytes used in all chunks
+  size_t num_files;
+  const EvfsAllocator *keys_alloc;
+
+  // Parent to children index for directory listings
+  TarDirEntry *dir_entries;
+  size_t num_dir_entries;
+  size_t max_dir_entries;
+  size_t peak_dir_entries; // Most entries held before duplicates are dropped
+
+  // Caller owned storage. Directory entries fill the keys buffer from the
+  // start and keys from the end.
+  bool   static_storage;
+  char  *key_buf;
+  size_t key_buf_size;
 } EvfsTarIndex;
 
 
@@ -75,13 +121,12 @@ typedef struct TarfsData {
   size_t    resource_len;
 
   EvfsTarIndex tar_index;
+  EvfsIndexStats index_stats;
+  uint32_t  header_reads; // Headers scanned to build the index
 
   char      cur_dir[EVFS_MAX_PATH];
-#ifdef EVFS_USE_TARFS_SHARED_BUFFER
-  char      abs_path[EVFS_MAX_PATH]; // Shared buffer for building absolute paths
-#endif
-#ifdef USE_TARFS_LOCK
-  EvfsLock  tfs_lock; // Serialize access to shared abs_path buffer
+#ifdef EVFS_USE_THREADING
+  EvfsRwLock dir_lock; // Protects cur_dir
 #endif
 
 } TarfsData;
@@ -98,74 +143,133 @@ typedef struct TarfsFile {
 } TarfsFile;
 
 
+typedef struct TarfsDir {
+  EvfsDir     base;
+  TarfsData  *fs_data;
 
-// Helper to convert relative paths into absolute for the tfs API
-// Returned path must be freed
+  size_t      start;  // Range of children in dir_entries
+  size_t      end;
+  size_t      pos;
+} TarfsDir;
 
-static int make_absolute_path(Evfs *vfs, const char *path, char **absolute, bool force_malloc) {
-  TarfsData *fs_data = (TarfsData *)vfs->fs_data;
-  *absolute = NULL;
 
-  size_t abs_size;
-  char *abs_path = NULL;
 
-#ifdef EVFS_USE_TARFS_SHARED_BUFFER
-  if(!force_malloc) {
-    abs_size = COUNT_OF(fs_data->abs_path);
-    LOCK(); // Unlocked by FREE_ABS() macro
-    abs_path = fs_data->abs_path;
-  }
+// ******************** Tar index ********************
+
+// Wall clock for mount statistics
+static uint64_t tarfs__time_usec(void) {
+#ifdef TIME_UTC
+  struct timespec ts;
+  if(timespec_get(&ts, TIME_UTC) == TIME_UTC)
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 #endif
+  return 0;
+}
+
 
-  if(force_malloc || !abs_path) {
-    abs_size = strlen(path) + 1;
-    *absolute = NULL;
+// Keys are stored in chunks so the index can be built in one pass without
+// knowing the total path length in advance
+#define TARFS_KEY_CHUNK_SIZE  2048
 
-    if(!evfs_vfs_path_is_absolute(vfs, path)) // Need space for join with cur_dir
-      abs_size += strlen(fs_data->cur_dir) + 1;
+static char *tarfs__key_alloc(EvfsTarIndex *ht, size_t len) {
+  if(ht->static_storage) {
+    size_t free_bytes = ht->key_buf_size - ht->keys_size - ht->peak_dir_entries * sizeof(TarDirEntry);
+    if(len > free_bytes) return NULL;
 
-    abs_path = evfs_malloc(abs_size);
-    if(MEM_CHECK(abs_path)) return EVFS_ERR_ALLOC;
+    ht->keys_size += len;
+    return &ht->key_buf[ht->key_buf_size - ht->keys_size];
   }
 
+  TarKeyChunk *chunk = ht->keys_tail;
 
-  AppendRange abs_path_r;
-  range_init(&abs_path_r, abs_path, abs_size);
+  if(!chunk || chunk->size - chunk->used < len) {
+    size_t size = len > TARFS_KEY_CHUNK_SIZE ? len : TARFS_KEY_CHUNK_SIZE;
+    chunk = evfs_alloc_with(ht->keys_alloc, EVFS_ALLOC_INDEX, sizeof(*chunk) + size);
+    if(MEM_CHECK(chunk)) return NULL;
 
-  int status = evfs_vfs_path_absolute(vfs, path, (StringRange *)&abs_path_r);
-  if(status == EVFS_OK)
-    *absolute = abs_path;
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
 
-  return status;
+    if(ht->keys_tail)
+      ht->keys_tail->next = chunk;
+    else
+      ht->keys = chunk;
+    ht->keys_tail = chunk;
+  }
+
+  char *key = &chunk->data[chunk->used];
+  chunk->used += len;
+  ht->keys_size += len;
+  return key;
 }
 
 
-// Prepare a buffer for the absolute path
-#define MAKE_ABS(path, abs_path) char *abs_path; do { \
- int status = make_absolute_path(vfs, path, &abs_path, false); \
- if(status != EVFS_OK) \
-    return status; \
-} while(0)
+static void tarfs__keys_free(EvfsTarIndex *ht) {
+  TarKeyChunk *chunk = ht->keys;
+  while(chunk) {
+    TarKeyChunk *next = chunk->next;
+    evfs_free_with(ht->keys_alloc, EVFS_ALLOC_INDEX, chunk);
+    chunk = next;
+  }
 
+  ht->keys = NULL;
+  ht->keys_tail = NULL;
+  ht->keys_size = 0;
+}
 
-#ifdef EVFS_USE_TARFS_SHARED_BUFFER
-#  define FREE_ABS(abs_path)  UNLOCK()
-#else
-#  define FREE_ABS(abs_path)  evfs_free(abs_path)
-#endif
 
+static void tarfs__dirs_free(EvfsTarIndex *ht) {
+  if(ht->dir_entries && !ht->static_storage)
+    evfs_free_with(ht->keys_alloc, EVFS_ALLOC_INDEX, ht->dir_entries);
+
+  ht->dir_entries = NULL;
+  ht->num_dir_entries = 0;
+  ht->max_dir_entries = 0;
+}
+
+
+#ifdef EVFS_USE_PERFECT_HASH_INDEX
+static int tarfs__index_hash_init(EvfsTarIndex *ht, size_t expected_files,
+                                  const EvfsIndexStorage *storage) {
+  if(storage) return EVFS_ERR_DISABLED; // The perfect hash allocates while it is built
+
+  mphConfig s_hash_init = {
+    .num_keys     = expected_files,
+    .value_size   = sizeof(EvfsTarEntry),
+
+    .gen_hash     = mph_gen_hash_string,
+    .is_equal     = dh_equal_hash_keys_string
+  };
+
+  memset(ht, 0, sizeof(*ht));
+  ht->keys_alloc = evfs_get_allocator(EVFS_ALLOC_INDEX);
+
+  int err = mph_init(&ht->hash_table, &s_hash_init, NULL) ? EVFS_OK : EVFS_ERR_ALLOC;
+  return err;
+}
 
-// ******************** Tar index ********************
 
+static void tarfs__index_hash_free(EvfsTarIndex *ht) {
+  mph_free(&ht->hash_table);
+  tarfs__keys_free(ht);
+  tarfs__dirs_free(ht);
+}
+
+#  define tarfs__index_insert(ht, key, entry)   mph_add(&(ht)->hash_table, (key), (entry))
+#  define tarfs__index_finish(ht)               mph_build(&(ht)->hash_table)
+#  define tarfs__index_lookup(ht, key, entry)   mph_lookup(&(ht)->hash_table, (key), (entry))
 
+#else // Dynamic hash
 
 static void destroy_hashed_file(dhKey key, void *value, void *ctx) {
 }
 
 
-static int tarfs__index_hash_init(EvfsTarIndex *ht, int total_files, size_t total_path_len) {
+static int tarfs__index_hash_init(EvfsTarIndex *ht, size_t expected_files,
+                                  const EvfsIndexStorage *storage) {
   dhConfig s_hash_init = {
-    .init_buckets = total_files,
+    .init_buckets = 0,  // Presized below
     .value_size   = sizeof(EvfsTarEntry),
 
     .destroy_item = destroy_hashed_file,
@@ -173,66 +277,344 @@ static int tarfs__index_hash_init(EvfsTarIndex *ht, int total_files, size_t tota
     .is_equal     = dh_equal_hash_keys_string
   };
 
-  ht->keys = evfs_malloc(total_path_len);
-  if(MEM_CHECK(ht->keys)) return EVFS_ERR_ALLOC;
+  memset(ht, 0, sizeof(*ht));
+  ht->keys_alloc = evfs_get_allocator(EVFS_ALLOC_INDEX);
 
+  if(storage) { // Fixed size index in caller buffers
+    s_hash_init.ext_storage = storage->index;
+    s_hash_init.max_storage = storage->index_size;
 
-  int err = dh_init(&ht->hash_table, &s_hash_init, NULL) ? EVFS_OK : EVFS_ERR;
-  return err;
+    ht->static_storage  = true;
+    ht->key_buf         = storage->keys;
+    ht->key_buf_size    = storage->keys_size;
+    ht->dir_entries     = (TarDirEntry *)storage->keys;
+  }
+
+  if(!dh_init(&ht->hash_table, &s_hash_init, NULL))
+    return storage ? EVFS_ERR_ALLOC : EVFS_ERR;
+
+  // Leave room for the load factor so a known file count never resizes the hash
+  if(!dh_reserve_capacity(&ht->hash_table, expected_files)) {
+    dh_free(&ht->hash_table);
+    return EVFS_ERR_ALLOC;
+  }
+
+  return EVFS_OK;
 }
 
 
 static void tarfs__index_hash_free(EvfsTarIndex *ht) {
   dh_free(&ht->hash_table);
-  evfs_free(ht->keys);
-  ht->keys = NULL;
+  tarfs__keys_free(ht);
+  tarfs__dirs_free(ht);
 }
 
+#  define tarfs__index_insert(ht, key, entry)   dh_insert(&(ht)->hash_table, (key), (entry))
+#  define tarfs__index_finish(ht)               true
+#  define tarfs__index_lookup(ht, key, entry)   dh_lookup(&(ht)->hash_table, (key), (entry))
+#endif // EVFS_USE_PERFECT_HASH_INDEX
 
-static int tarfs__build_index(TarRsrcIterator *tar_it, EvfsTarIndex *ht) {
-  if(!tar_rsrc_iter_begin(tar_it)) return EVFS_ERR;
 
-  size_t total_path_len = 0;
-  int total_files = 0;
-  // Scan the tar file to count files and determine total string storage for keys
-  do {
-    // Only index plain files and directories
-    if(tar_it->cur_header->type_flag != TAR_TYPE_NORMAL_FILE &&
-       tar_it->cur_header->type_flag != TAR_TYPE_DIRECTORY) continue;
+// ******************** Directory index ********************
 
-    total_files++;
-    total_path_len += strlen((char *)tar_it->cur_header->file_name) +
-                      strlen((char *)tar_it->cur_header->file_prefix) + 1;
+static TarDirEntry *tarfs__dir_entry_new(EvfsTarIndex *ht) {
+  if(ht->static_storage) { // Take the next entry if it doesn't overlap the keys
+    if(ht->key_buf_size - ht->keys_size < (ht->num_dir_entries+1) * sizeof(TarDirEntry))
+      return NULL;
 
-  } while(tar_rsrc_iter_next(tar_it));
+  } else if(ht->num_dir_entries >= ht->max_dir_entries) { // Grow the array
+    size_t max_entries = ht->max_dir_entries < 16 ? 16 : ht->max_dir_entries + ht->max_dir_entries/2;
+    TarDirEntry *entries = evfs_alloc_with(ht->keys_alloc, EVFS_ALLOC_INDEX,
+                                           max_entries * sizeof(*entries));
+    if(MEM_CHECK(entries)) return NULL;
 
+    if(ht->dir_entries) {
+      memcpy(entries, ht->dir_entries, ht->num_dir_entries * sizeof(*entries));
+      evfs_free_with(ht->keys_alloc, EVFS_ALLOC_INDEX, ht->dir_entries);
+    }
 
-  // Prepare the hash index
-  int err = tarfs__index_hash_init(ht, total_files, total_path_len);
-  if(err != EVFS_OK) return err;
+    ht->dir_entries = entries;
+    ht->max_dir_entries = max_entries;
+  }
 
+  if(ht->num_dir_entries >= ht->peak_dir_entries)
+    ht->peak_dir_entries = ht->num_dir_entries+1;
 
-  AppendRange keys_r;
-  range_init(&keys_r, ht->keys, total_path_len);
+  return &ht->dir_entries[ht->num_dir_entries++];
+}
+
+
+// Length of the parent directory prefix in a path key
+static inline size_t tarfs__parent_len(const char *key, size_t key_len) {
+  while(key_len > 0 && key[key_len-1] != '/') {
+    key_len--;
+  }
+
+  return key_len > 0 ? key_len-1 : 0;
+}
+
+
+#define DIR_NAME_OFFSET(e)  ((e)->parent_len > 0 ? (e)->parent_len+1 : 0)
+#define DIR_NAME(e)         (&(e)->key[DIR_NAME_OFFSET(e)])
+#define DIR_NAME_LEN(e)     ((e)->key_len - DIR_NAME_OFFSET(e))
+
+
+static inline int tarfs__compare_str(const char *a, size_t a_len, const char *b, size_t b_len) {
+  int delta = memcmp(a, b, a_len < b_len ? a_len : b_len);
+  if(delta != 0) return delta;
+
+  return (a_len > b_len) - (a_len < b_len);
+}
+
+
+// Order by parent then name with the newest duplicate first
+static int tarfs__compare_dir_entries(const void *pa, const void *pb) {
+  const TarDirEntry *a = (const TarDirEntry *)pa;
+  const TarDirEntry *b = (const TarDirEntry *)pb;
+
+  int delta = tarfs__compare_str(a->key, a->parent_len, b->key, b->parent_len);
+  if(delta == 0)
+    delta = tarfs__compare_str(DIR_NAME(a), DIR_NAME_LEN(a), DIR_NAME(b), DIR_NAME_LEN(b));
+  if(delta == 0)
+    delta = (a->seq < b->seq) - (a->seq > b->seq);
+
+  return delta;
+}
 
-  // Build the index
-  tar_rsrc_iter_begin(tar_it);
+
+/*
+Find the bounds of a parent directory in the sorted listing
+
+Args:
+  entries:      Sorted directory entries
+  num_entries:  Number of entries
+  parent:       Parent path
+  parent_len:   Length of parent
+  name:         Name to match within parent. NULL to only compare the parent.
+  name_len:     Length of name
+  upper:        Return the upper bound when true
+
+Returns:
+  Index of the first entry not less than the parent and name when upper is false.
+  Index of the first entry greater than them when upper is true.
+*/
+static size_t tarfs__dir_bound(const TarDirEntry *entries, size_t num_entries, const char *parent,
+                               size_t parent_len, const char *name, size_t name_len, bool upper) {
+  size_t low = 0;
+  size_t high = num_entries;
+
+  while(low < high) {
+    size_t mid = low + (high-low)/2;
+    const TarDirEntry *e = &entries[mid];
+
+    int delta = tarfs__compare_str(e->key, e->parent_len, parent, parent_len);
+    if(delta == 0 && name)
+      delta = tarfs__compare_str(DIR_NAME(e), DIR_NAME_LEN(e), name, name_len);
+
+    if(delta < 0 || (upper && delta == 0))
+      low = mid+1;
+    else
+      high = mid;
+  }
+
+  return low;
+}
+
+
+static bool tarfs__dir_exists(const TarDirEntry *entries, size_t num_entries, const char *key,
+                              size_t key_len) {
+  size_t parent_len = tarfs__parent_len(key, key_len);
+  size_t name_offset = parent_len > 0 ? parent_len+1 : 0;
+
+  size_t pos = tarfs__dir_bound(entries, num_entries, key, parent_len, &key[name_offset],
+                                key_len - name_offset, /*upper*/ false);
+
+  return pos < num_entries && entries[pos].key_len == key_len &&
+          !memcmp(entries[pos].key, key, key_len);
+}
+
+
+// Sort the listing and drop older duplicates
+static void tarfs__dir_sort(EvfsTarIndex *ht) {
+  TarDirEntry *entries = ht->dir_entries;
+  size_t num_entries = 0;
+
+  if(ht->num_dir_entries == 0) return;
+
+  qsort(entries, ht->num_dir_entries, sizeof(*entries), tarfs__compare_dir_entries);
+
+  for(size_t i = 0; i < ht->num_dir_entries; i++) {
+    if(num_entries > 0 && entries[num_entries-1].key_len == entries[i].key_len &&
+        !memcmp(entries[num_entries-1].key, entries[i].key, entries[i].key_len))
+      continue;
+
+    entries[num_entries++] = entries[i];
+  }
+
+  ht->num_dir_entries = num_entries;
+}
+
+
+// Add a file or directory to the index and the directory listing
+static bool tarfs__index_add(EvfsTarIndex *ht, dhKey key, EvfsTarEntry *entry) {
+  if(key.length > 0) { // Root isn't listed
+    TarDirEntry *de = tarfs__dir_entry_new(ht);
+    if(!de) return false;
+
+    de->key         = (const char *)key.data;
+    de->key_len     = key.length;
+    de->file_size   = entry->header_offset >= 0 ? entry->file_size : -1;
+    de->seq         = ht->num_files + 1;
+    de->parent_len  = tarfs__parent_len(de->key, key.length);
+  }
+
+  // The hash may reuse entry as scratch space so it is inserted last
+  if(!tarfs__index_insert(ht, key, entry))
+    return false;
+
+  ht->num_files++;
+  return true;
+}
+
+
+/*
+Complete the directory listing after all entries are added
+
+Archives don't need entries for every directory so any parent that is missing
+is added as an implied directory. These are also inserted into the hash so
+they can be opened and used as the current directory.
+
+Args:
+  ht: Index to complete
+
+Returns:
+  EVFS_OK on success
+*/
+static int tarfs__index_dirs(EvfsTarIndex *ht) {
+  tarfs__dir_sort(ht);
+
+  // Children of the same parent are adjacent so each parent is checked once
+  size_t num_entries = ht->num_dir_entries;
+  size_t num_implied = 0;
+  const char *prev_parent = NULL;
+  size_t prev_parent_len = 0;
+
+  for(size_t i = 0; i < num_entries; i++) {
+    const char *key = ht->dir_entries[i].key;
+    size_t key_len = ht->dir_entries[i].parent_len;
+
+    if(key_len == 0) continue;
+    if(prev_parent && !tarfs__compare_str(prev_parent, prev_parent_len, key, key_len)) continue;
+
+    prev_parent = key;
+    prev_parent_len = key_len;
+
+    // Add the parent and its missing ancestors. Implied keys point into the child
+    // key until they are copied below.
+    while(key_len > 0 && !tarfs__dir_exists(ht->dir_entries, num_entries, key, key_len)) {
+      TarDirEntry *de = tarfs__dir_entry_new(ht);
+      if(!de) return EVFS_ERR_ALLOC;
+
+      de->key         = key;
+      de->key_len     = key_len;
+      de->file_size   = -1;
+      de->seq         = 0;
+      de->parent_len  = tarfs__parent_len(key, key_len);
+
+      key_len = de->parent_len;
+      num_implied++;
+    }
+  }
+
+  if(num_implied == 0) return EVFS_OK;
+
+  // Ancestors shared by different parents were added more than once
+  tarfs__dir_sort(ht);
+
+  for(size_t i = 0; i < ht->num_dir_entries; i++) {
+    TarDirEntry *de = &ht->dir_entries[i];
+    if(de->seq != 0) continue;
+
+    char *key_str = tarfs__key_alloc(ht, de->key_len + 1);
+    if(!key_str) return EVFS_ERR_ALLOC;
+
+    memcpy(key_str, de->key, de->key_len);
+    key_str[de->key_len] = '\0';
+    de->key = key_str;
+
+    dhKey key;
+    key.data = key_str;
+    key.length = de->key_len;
+
+    EvfsTarEntry entry;
+    entry.header_offset = -1;
+    entry.file_size = -1;
+
+    if(!tarfs__index_insert(ht, key, &entry))
+      return EVFS_ERR;
+
+    ht->num_files++;
+  }
+
+  return EVFS_OK;
+}
+
+
+static int tarfs__dir_range(EvfsTarIndex *ht, const char *path, size_t *start, size_t *end) {
+  if(path[0] != '/') return EVFS_ERR_NO_PATH; // All paths must be absolute
+
+  const char *key_str = &path[1];
+  dhKey key;
+  key.data = key_str;
+  key.length = strlen(key_str);
+
+  if(key.length > 0 && key_str[key.length-1] == '/') // Trailing separator
+    key.length--;
+
+  if(key.length > 0) { // Everything except root must be an indexed directory
+    EvfsTarEntry entry;
+    if(!tarfs__index_lookup(ht, key, &entry) || entry.header_offset >= 0)
+      return EVFS_ERR_NO_PATH;
+  }
+
+  *start = tarfs__dir_bound(ht->dir_entries, ht->num_dir_entries, key_str, key.length,
+                            NULL, 0, /*upper*/ false);
+  *end = tarfs__dir_bound(ht->dir_entries, ht->num_dir_entries, key_str, key.length,
+                          NULL, 0, /*upper*/ true);
+  return EVFS_OK;
+}
+
+
+
+// Index all files and directories in one pass over the tar headers
+static int tarfs__build_index(TarRsrcIterator *tar_it, EvfsTarIndex *ht, uint32_t *header_reads,
+                              const EvfsIndexStorage *storage) {
+  if(!tar_rsrc_iter_begin(tar_it)) return EVFS_ERR;
+
+  // The hash grows as files are added unless it is in caller storage
+  int err = tarfs__index_hash_init(ht, 0, storage);
+  if(err != EVFS_OK) return err;
 
   do {
+    (*header_reads)++;
+
     // Only index plain files and directories
     if(tar_it->cur_header->type_flag != TAR_TYPE_NORMAL_FILE &&
        tar_it->cur_header->type_flag != TAR_TYPE_DIRECTORY) continue;
 
+    size_t prefix_len = strnlen((char *)tar_it->cur_header->file_prefix, TAR_FILE_PREFIX_LEN);
+    size_t name_len = strnlen((char *)tar_it->cur_header->file_name, TAR_FILE_NAME_LEN);
 
-    dhKey key;
+    char *key_str = tarfs__key_alloc(ht, prefix_len + name_len + 1);
+    if(!key_str) return EVFS_ERR_ALLOC;
 
-    key.data = keys_r.start;
-    key.length = 0;
-    if(tar_it->cur_header->file_prefix[0] != '\0')
-      key.length += range_cat_str(&keys_r, (char *)tar_it->cur_header->file_prefix);
+    memcpy(key_str, tar_it->cur_header->file_prefix, prefix_len);
+    memcpy(&key_str[prefix_len], tar_it->cur_header->file_name, name_len);
+    key_str[prefix_len + name_len] = '\0';
 
-    key.length += range_cat_str(&keys_r, (char *)tar_it->cur_header->file_name);
-    range_cat_char(&keys_r,'\0');
+    dhKey key;
+    key.data = key_str;
+    key.length = prefix_len + name_len;
 
     EvfsTarEntry entry;
 
@@ -244,14 +626,20 @@ static int tarfs__build_index(TarRsrcIterator *tar_it, EvfsTarIndex *ht) {
       entry.file_size = -1;
 
       // Removing trailing slash
-      ((char *)key.data)[--key.length] = '\0';
+      if(key.length > 0 && key_str[key.length-1] == '/')
+        key_str[--key.length] = '\0';
     }
 
-    if(!dh_insert(&ht->hash_table, key, &entry))
+    if(!tarfs__index_add(ht, key, &entry))
       return EVFS_ERR;
 
   } while(tar_rsrc_iter_next(tar_it));
 
+  err = tarfs__index_dirs(ht);
+  if(err != EVFS_OK) return err;
+
+  if(!tarfs__index_finish(ht))
+    return EVFS_ERR;
 
   return EVFS_OK;
 }
@@ -265,7 +653,13 @@ static inline bool tarfs__lookup_path(EvfsTarIndex *ht, const char *path, EvfsTa
   key.data = &path[1];
   key.length = strlen(key.data);
 
-  return dh_lookup(&ht->hash_table, key, entry);
+  if(key.length == 0) { // Root is always present
+    entry->header_offset = -1;
+    entry->file_size = -1;
+    return true;
+  }
+
+  return tarfs__index_lookup(ht, key, entry);
 }
 
 
@@ -284,6 +678,15 @@ static int tarfs__file_ctrl(EvfsFile *fh, int cmd, void *arg) {
       }
       return EVFS_OK; break;
 
+#ifdef EVFS_USE_IO_STATS
+    case EVFS_CMD_GET_IO_STATS:
+      {
+        EvfsIOStats *v = (EvfsIOStats *)arg;
+        v->header_reads += fs_data->header_reads;
+      }
+      return EVFS_OK; break;
+#endif
+
     default: return EVFS_ERR_NO_SUPPORT; break;
   }
 
@@ -296,25 +699,51 @@ static int tarfs__file_close(EvfsFile *fh) {
   return EVFS_OK;
 }
 
-static ptrdiff_t tarfs__file_read(EvfsFile *fh, void *buf, size_t size) {
+static ptrdiff_t tarfs__file_read_at(EvfsFile *fh, void *buf, size_t size, evfs_off_t offset) {
   TarfsFile *fil = (TarfsFile *)fh;
   TarfsData *fs_data = (TarfsData *)fil->fs_data;
 
   if(!fil->is_open) return EVFS_ERR_NOT_OPEN;
 
-  size_t remaining = fil->file_size - fil->read_pos;
+  evfs_off_t remaining = fil->file_size - offset;
   if(remaining <= 0) return 0;
 
-  if(size > remaining)
+  if((evfs_off_t)size > remaining)
     size = remaining;
 
-  uint8_t *rsrc_pos = fs_data->resource + fil->header_offset + TAR_BLOCK_SIZE + fil->read_pos;
-  fil->read_pos += size;
+  uint8_t *rsrc_pos = fs_data->resource + fil->header_offset + TAR_BLOCK_SIZE + offset;
   memcpy(buf, rsrc_pos, size);
 
   return size;
 }
 
+static ptrdiff_t tarfs__file_read(EvfsFile *fh, void *buf, size_t size) {
+  TarfsFile *fil = (TarfsFile *)fh;
+
+  ptrdiff_t rval = tarfs__file_read_at(fh, buf, size, fil->read_pos);
+  if(rval > 0)
+    fil->read_pos += rval;
+
+  return rval;
+}
+
+static int tarfs__file_map(EvfsFile *fh, evfs_off_t offset, size_t size, EvfsMapping *map) {
+  TarfsFile *fil = (TarfsFile *)fh;
+  TarfsData *fs_data = (TarfsData *)fil->fs_data;
+
+  if(!fil->is_open) return EVFS_ERR_NOT_OPEN;
+  if(offset > (evfs_off_t)fil->file_size) return EVFS_ERR_OVERFLOW;
+
+  evfs_off_t remaining = fil->file_size - offset;
+  if(size == 0 || (evfs_off_t)size > remaining)
+    size = remaining;
+
+  // Resource data is mapped in place
+  map->data = fs_data->resource + fil->header_offset + TAR_BLOCK_SIZE + offset;
+  map->size = size;
+  return EVFS_OK;
+}
+
 static ptrdiff_t tarfs__file_write(EvfsFile *fh, const void *buf, size_t size) {
   return EVFS_ERR_NO_SUPPORT;
 }
@@ -381,11 +810,62 @@ static EvfsFileMethods s_tarfs_methods = {
   .m_size     = tarfs__file_size,
   .m_seek     = tarfs__file_seek,
   .m_tell     = tarfs__file_tell,
-  .m_eof      = tarfs__file_eof
+  .m_eof      = tarfs__file_eof,
+  .m_read_at  = tarfs__file_read_at,
+  .m_map      = tarfs__file_map
+};
+
+
+// ******************** Directory access methods ********************
+
+static int tarfs__dir_close(EvfsDir *dh) {
+  TarfsDir *dir = (TarfsDir *)dh;
+
+  dir->pos = dir->end;
+  return EVFS_OK;
+}
+
+
+static int tarfs__dir_read(EvfsDir *dh, EvfsInfo *info) {
+  TarfsDir *dir = (TarfsDir *)dh;
+  EvfsTarIndex *ht = &dir->fs_data->tar_index;
+
+  memset(info, 0, sizeof(*info));
+
+  if(dir->pos >= dir->end)
+    return EVFS_DONE;
+
+  TarDirEntry *de = &ht->dir_entries[dir->pos++];
+
+  // Keys are NUL terminated so the name can be returned in place
+  info->name = (char *)DIR_NAME(de);
+
+  if(de->file_size >= 0)
+    info->size = de->file_size;
+  else
+    info->type |= EVFS_FILE_DIR;
+
+  return EVFS_OK;
+}
+
+
+static int tarfs__dir_rewind(EvfsDir *dh) {
+  TarfsDir *dir = (TarfsDir *)dh;
+
+  dir->pos = dir->start;
+  return EVFS_OK;
+}
+
+
+static EvfsDirMethods s_tarfs_dir_methods = {
+  .m_close    = tarfs__dir_close,
+  .m_read     = tarfs__dir_read,
+  .m_rewind   = tarfs__dir_rewind
 };
 
 
 
+
 // ******************** FS access methods ********************
 
 static int tarfs__open(Evfs *vfs, const char *path, EvfsFile *fh, int flags) {
@@ -401,14 +881,9 @@ static int tarfs__open(Evfs *vfs, const char *path, EvfsFile *fh, int flags) {
     return EVFS_ERR_NO_SUPPORT;
 
 
-  if(evfs_vfs_path_is_absolute(vfs, path)) {
-    err = tarfs__lookup_path(&fs_data->tar_index, path, &entry) ? EVFS_OK : EVFS_ERR;
-
-  } else { // Convert relative path
-    MAKE_ABS(path, abs_path);
-    err = tarfs__lookup_path(&fs_data->tar_index, abs_path, &entry) ? EVFS_OK : EVFS_ERR;
-    FREE_ABS(abs_path);
-  }
+  MAKE_ABS(path, abs_path);
+  err = tarfs__lookup_path(&fs_data->tar_index, abs_path, &entry) ? EVFS_OK : EVFS_ERR;
+  FREE_ABS(abs_path);
 
   if(entry.header_offset < 0)
     err = EVFS_ERR_IS_DIR;
@@ -433,13 +908,9 @@ static int tarfs__stat(Evfs *vfs, const char *path, EvfsInfo *info) {
   EvfsTarEntry entry;
   int err;
 
-  if(evfs_vfs_path_is_absolute(vfs, path)) {  
-    err = tarfs__lookup_path(&fs_data->tar_index, path, &entry) ? EVFS_OK : EVFS_ERR;
-  } else { // Convert relative path
-    MAKE_ABS(path, abs_path);
-    err = tarfs__lookup_path(&fs_data->tar_index, abs_path, &entry) ? EVFS_OK : EVFS_ERR;
-    FREE_ABS(abs_path);
-  }
+  MAKE_ABS(path, abs_path);
+  err = tarfs__lookup_path(&fs_data->tar_index, abs_path, &entry) ? EVFS_OK : EVFS_ERR;
+  FREE_ABS(abs_path);
 
   memset(info, 0, sizeof(*info));
 
@@ -455,13 +926,34 @@ static int tarfs__stat(Evfs *vfs, const char *path, EvfsInfo *info) {
 }
 
 
+static int tarfs__open_dir(Evfs *vfs, const char *path, EvfsDir *dh) {
+  TarfsData *fs_data = (TarfsData *)vfs->fs_data;
+  TarfsDir *dir = (TarfsDir *)dh;
+
+  memset(dir, 0, sizeof(*dir));
+  dh->methods = &s_tarfs_dir_methods;
+  dir->fs_data = fs_data;
+
+  // Normalize so that "." and ".." don't appear in the key
+  MAKE_ABS(path, abs_path);
+  int status = tarfs__dir_range(&fs_data->tar_index, abs_path, &dir->start, &dir->end);
+  FREE_ABS(abs_path);
+
+  dir->pos = dir->start;
+  return status;
+}
+
+
+
 
 // Tarfs doesn't handle relative paths so we track the current directory in fs_data
 static int tarfs__get_cur_dir(Evfs *vfs, StringRange *cur_dir) {
   TarfsData *fs_data = (TarfsData *)vfs->fs_data;
   AppendRange r = *(AppendRange *)cur_dir;
 
+  DIR_LOCK_SHARED();
   range_cat_str(&r, fs_data->cur_dir);
+  DIR_UNLOCK_SHARED();
   range_terminate(&r);
   return EVFS_OK;
 }
@@ -471,41 +963,21 @@ static int tarfs__get_cur_dir(Evfs *vfs, StringRange *cur_dir) {
 static int tarfs__set_cur_dir(Evfs *vfs, const char *path) {
   TarfsData *fs_data = (TarfsData *)vfs->fs_data;
 
-  if(evfs_vfs_path_is_absolute(vfs, path)) { // Just assign absolute paths
-    // Confirm the path exists
-    if(!evfs__vfs_existing_dir(vfs, path))
-      return EVFS_ERR_NO_PATH;
-  
-    strncpy(fs_data->cur_dir, path, EVFS_MAX_PATH-1);
-    fs_data->cur_dir[EVFS_MAX_PATH-1] = '\0';
-
-  } else { // Path is relative: Join it to the existing directory
-    StringRange head, tail, joined;
-    
-    range_init(&head, fs_data->cur_dir, EVFS_MAX_PATH);
-    range_init(&tail, (char *)path, strlen(path));
-    
-    size_t joined_size = strlen(fs_data->cur_dir) + 1 + strlen(path) + 1;
-    char *joined_path = evfs_malloc(joined_size);
-    if(MEM_CHECK(joined_path)) return EVFS_ERR_ALLOC;
-
-    range_init(&joined, joined_path, joined_size);
-
-    evfs_vfs_path_join(vfs, &head, &tail, &joined);
+  MAKE_ABS(path, abs_path);
 
-    // Confirm the path exists
-    if(!evfs__vfs_existing_dir(vfs, joined_path)) {
-      evfs_free(joined_path);
-      return EVFS_ERR_NO_PATH;
-    }
-
-    // Overwrite old cur_dir
-    evfs_vfs_path_normalize(vfs, joined_path, &head);
-
-    evfs_free(joined_path);
+  // Confirm the path exists
+  int status = EVFS_OK;
+  if(evfs__vfs_existing_dir(vfs, abs_path)) {
+    DIR_LOCK_EXCL();
+    strncpy(fs_data->cur_dir, abs_path, EVFS_MAX_PATH-1);
+    fs_data->cur_dir[EVFS_MAX_PATH-1] = '\0';
+    DIR_UNLOCK_EXCL();
+  } else {
+    status = EVFS_ERR_NO_PATH;
   }
 
-  return EVFS_OK;
+  FREE_ABS(abs_path);
+  return status;
 }
 
 
@@ -517,8 +989,8 @@ static int tarfs__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
   switch(cmd) {
     case EVFS_CMD_UNREGISTER:
       tarfs__index_hash_free(&fs_data->tar_index);
-#ifdef USE_TARFS_LOCK
-      evfs__lock_destroy(&fs_data->tfs_lock);
+#ifdef EVFS_USE_THREADING
+      evfs__rwlock_destroy(&fs_data->dir_lock);
 #endif
       evfs_free(vfs);
       return EVFS_OK; break;
@@ -533,10 +1005,14 @@ static int tarfs__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
     case EVFS_CMD_GET_DIR_FIELDS:
       {
         unsigned *v = (unsigned *)arg;
-        *v = 0;
+        *v = EVFS_INFO_SIZE | EVFS_INFO_TYPE;
       }
       return EVFS_OK; break;
 
+    case EVFS_CMD_GET_INDEX_STATS:
+      *(EvfsIndexStats *)arg = fs_data->index_stats;
+      return EVFS_OK; break;
+
     default: return EVFS_ERR_NO_SUPPORT; break;
   }
 }
@@ -546,21 +1022,9 @@ static int tarfs__vfs_ctrl(Evfs *vfs, int cmd, void *arg) {
 // Access objects allocated in a single block of memory
 #define NEXT_OBJ(o) (&(o)[1])
 
-/*
-Register a Tar resource FS instance
-
-Args:
-  vfs_name:       Name of new VFS
-  resource:       Array of Tar resource data
-  resource_len:   Length of the resource array
-  default_vfs:    Make this the default VFS when true
-
-Returns:
-  EVFS_OK on success
-*/
-int evfs_register_tar_rsrc_fs(const char *vfs_name, uint8_t *resource, size_t resource_len,
-                              bool default_vfs) {
-  if(PTR_CHECK(vfs_name) || PTR_CHECK(resource)) return EVFS_ERR_BAD_ARG;
+// Build a new VFS with its index on the heap or in caller storage
+static int tarfs__register(const char *vfs_name, uint8_t *resource, size_t resource_len,
+                           const EvfsIndexStorage *storage, bool default_vfs) {
   Evfs *new_vfs;
   TarfsData *fs_data;
 
@@ -586,11 +1050,24 @@ int evfs_register_tar_rsrc_fs(const char *vfs_name, uint8_t *resource, size_t re
 
   TarRsrcIterator tar_it;
   tar_rsrc_iter_init(&tar_it, resource, resource_len);
-  tarfs__build_index(&tar_it, &fs_data->tar_index);
+  uint64_t start = tarfs__time_usec();
+  int err = tarfs__build_index(&tar_it, &fs_data->tar_index, &fs_data->header_reads, storage);
+
+  // Heap indices keep whatever was added before an error. Caller storage
+  // that is too small fails the mount.
+  if(err != EVFS_OK && storage) {
+    tarfs__index_hash_free(&fs_data->tar_index);
+    evfs_free(new_vfs);
+    return err;
+  }
+
+  fs_data->index_stats.files      = fs_data->tar_index.num_files;
+  fs_data->index_stats.key_bytes  = fs_data->tar_index.keys_size;
+  fs_data->index_stats.build_usec = tarfs__time_usec() - start;
 
   // Init VFS
   new_vfs->vfs_file_size = sizeof(TarfsFile);
-  new_vfs->vfs_dir_size = 0;
+  new_vfs->vfs_dir_size = sizeof(TarfsDir);
   new_vfs->fs_data = fs_data;
 
   // Required methods
@@ -598,13 +1075,15 @@ int evfs_register_tar_rsrc_fs(const char *vfs_name, uint8_t *resource, size_t re
   new_vfs->m_stat = tarfs__stat;
   
   // Optional methods
+  new_vfs->m_open_dir = tarfs__open_dir;
   new_vfs->m_get_cur_dir = tarfs__get_cur_dir;
   new_vfs->m_set_cur_dir = tarfs__set_cur_dir;
   new_vfs->m_vfs_ctrl = tarfs__vfs_ctrl;
 
 
-#ifdef USE_TARFS_LOCK
-  if(evfs__lock_init(&fs_data->tfs_lock) != EVFS_OK) {
+#ifdef EVFS_USE_THREADING
+  if(evfs__rwlock_init(&fs_data->dir_lock) != EVFS_OK) {
+    tarfs__index_hash_free(&fs_data->tar_index);
     evfs_free(new_vfs);
     THROW(EVFS_ERR_INIT);
   }
@@ -614,3 +1093,96 @@ int evfs_register_tar_rsrc_fs(const char *vfs_name, uint8_t *resource, size_t re
 }
 
 
+
+
+/*
+Register a Tar resource FS instance
+
+Args:
+  vfs_name:       Name of new VFS
+  resource:       Array of Tar resource data
+  resource_len:   Length of the resource array
+  default_vfs:    Make this the default VFS when true
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_register_tar_rsrc_fs(const char *vfs_name, uint8_t *resource, size_t resource_len,
+                              bool default_vfs) {
+  if(PTR_CHECK(vfs_name) || PTR_CHECK(resource)) return EVFS_ERR_BAD_ARG;
+
+  return tarfs__register(vfs_name, resource, resource_len, NULL, default_vfs);
+}
+
+
+/*
+Register a Tar resource FS instance with its index in caller storage
+
+The hash index, path keys, and directory listing are kept in the buffers
+from storage and never grow. Use evfs_tar_rsrc_index_size() to get the sizes
+needed for an archive. The buffers must stay valid until the VFS is
+unregistered.
+
+Args:
+  vfs_name:       Name of new VFS
+  resource:       Array of Tar resource data
+  resource_len:   Length of the resource array
+  storage:        Buffers for the index
+  default_vfs:    Make this the default VFS when true
+
+Returns:
+  EVFS_OK on success. An error is returned if the storage is too small.
+*/
+int evfs_register_tar_rsrc_fs_static(const char *vfs_name, uint8_t *resource, size_t resource_len,
+                                     const EvfsIndexStorage *storage, bool default_vfs) {
+  if(PTR_CHECK(vfs_name) || PTR_CHECK(resource) || PTR_CHECK(storage) ||
+     PTR_CHECK(storage->index) || PTR_CHECK(storage->keys)) return EVFS_ERR_BAD_ARG;
+
+  // Buckets and directory entries are accessed in place
+  if((uintptr_t)storage->index % sizeof(void *) || (uintptr_t)storage->keys % sizeof(void *))
+    return EVFS_ERR_BAD_ARG;
+
+  return tarfs__register(vfs_name, resource, resource_len, storage, default_vfs);
+}
+
+
+/*
+Get the storage needed to index a Tar resource
+
+This builds a heap index for the archive to measure it. It is meant for host
+tools that generate buffers for evfs_register_tar_rsrc_fs_static().
+
+Args:
+  resource:       Array of Tar resource data
+  resource_len:   Length of the resource array
+  storage:        Sizes are returned in index_size and keys_size
+
+Returns:
+  EVFS_OK on success
+*/
+int evfs_tar_rsrc_index_size(uint8_t *resource, size_t resource_len, EvfsIndexStorage *storage) {
+  if(PTR_CHECK(resource) || PTR_CHECK(storage)) return EVFS_ERR_BAD_ARG;
+
+#ifdef EVFS_USE_PERFECT_HASH_INDEX
+  return EVFS_ERR_DISABLED;
+#else
+  EvfsTarIndex ht = {0};
+  uint32_t header_reads = 0;
+  TarRsrcIterator tar_it;
+  tar_rsrc_iter_init(&tar_it, resource, resource_len);
+
+  int err = tarfs__build_index(&tar_it, &ht, &header_reads, NULL);
+  if(err == EVFS_OK) {
+    storage->index      = NULL;
+    storage->index_size = dh_storage_size(ht.num_files, sizeof(EvfsTarEntry));
+    storage->keys       = NULL;
+    storage->keys_size  = ht.keys_size + ht.peak_dir_entries * sizeof(TarDirEntry);
+
+    if(storage->index_size == 0)
+      err = EVFS_ERR_OVERFLOW;
+  }
+
+  tarfs__index_hash_free(&ht);
+  return err;
+#endif
+}
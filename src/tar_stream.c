@@ -0,0 +1,388 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2021 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Streaming TAR reader
+
+  Headers and data are consumed in order with evfs_file_read() so the source
+  never needs to seek. Data is handed to the caller through a bounded buffer
+  as it arrives.
+------------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "evfs.h"
+#include "evfs_internal.h"
+#include "evfs/tar_stream.h"
+#include "evfs/util/range_strings.h"
+
+
+void tar_stream_init(TarStreamIterator *tar_it, EvfsFile *fd) {
+  memset(tar_it, 0, sizeof(TarStreamIterator));
+  tar_it->fd = fd;
+}
+
+
+// Read until size bytes arrive or the stream ends
+// Pipes and sockets can return short reads before the end of data
+static ptrdiff_t tar__read_full(TarStreamIterator *tar_it, void *buf, size_t size) {
+  uint8_t *pos = (uint8_t *)buf;
+  size_t total = 0;
+
+  while(total < size) {
+    ptrdiff_t rval = evfs_file_read(tar_it->fd, &pos[total], size - total);
+    if(rval < 0) return rval;
+    if(rval == 0) break;
+
+    total += rval;
+  }
+
+  tar_it->stream_pos += total;
+  return total;
+}
+
+
+// Discard data that isn't needed
+static int tar__skip(TarStreamIterator *tar_it, evfs_off_t size) {
+  uint8_t block[TAR_BLOCK_SIZE];
+
+  while(size > 0) {
+    size_t chunk = size < (evfs_off_t)sizeof block ? (size_t)size : sizeof block;
+    ptrdiff_t rval = tar__read_full(tar_it, block, chunk);
+    if(rval < 0) return rval;
+    if((size_t)rval != chunk) return EVFS_ERR_IO; // Truncated stream
+
+    size -= chunk;
+  }
+
+  return EVFS_OK;
+}
+
+
+static bool tar__block_is_zero(const uint8_t *block) {
+  for(size_t i = 0; i < TAR_BLOCK_SIZE; i++) {
+    if(block[i] != 0) return false;
+  }
+
+  return true;
+}
+
+
+static bool tar__valid_stream_header(const TarHeader *header) {
+  // Accept POSIX "ustar\0" and GNU "ustar  " magic
+  if(memcmp(header->magic, "ustar", 5) != 0) return false;
+
+  uint32_t orig_checksum_value = strtol((const char *)&header->checksum, NULL, 8);
+  return orig_checksum_value == tar_header_checksum(header);
+}
+
+
+/*
+Advance to the next member in a tar stream
+
+Any unread data from the current member is skipped.
+
+Args:
+  tar_it: Iterator to advance
+
+Returns:
+  true when a new member header was read. false at the end of the archive or on
+  error. The error is left in tar_it->status.
+*/
+bool tar_stream_next(TarStreamIterator *tar_it) {
+  if(tar_it->status != EVFS_OK) return false;
+
+  int status = tar__skip(tar_it, tar_it->data_remaining + tar_it->pad_remaining);
+  tar_it->data_remaining = 0;
+  tar_it->pad_remaining = 0;
+  tar_it->file_size = 0;
+
+  if(status != EVFS_OK) {
+    tar_it->status = status;
+    return false;
+  }
+
+  uint8_t block[TAR_BLOCK_SIZE];
+  ptrdiff_t rval = tar__read_full(tar_it, block, sizeof block);
+
+  if(rval == 0) // Stream ended without end of archive blocks
+    return false;
+
+  if(rval != sizeof block) {
+    tar_it->status = rval < 0 ? rval : EVFS_ERR_IO;
+    return false;
+  }
+
+  if(tar__block_is_zero(block)) // End of archive
+    return false;
+
+  memcpy(&tar_it->cur_header, block, sizeof tar_it->cur_header);
+  TarHeader *header = &tar_it->cur_header;
+
+  if(!tar__valid_stream_header(header)) {
+    tar_it->status = EVFS_ERR_CORRUPTION;
+    return false;
+  }
+
+  // Only supporting NUL terminated octal with '0' padding
+  tar_it->file_size = strtol((const char *)header->size, NULL, 8);
+
+  // Directories and links have no data even if a size is recorded
+  if(header->type_flag == TAR_TYPE_DIRECTORY || header->type_flag == TAR_TYPE_HARD_LINK ||
+     header->type_flag == TAR_TYPE_SYM_LINK)
+    tar_it->file_size = 0;
+
+  tar_it->data_remaining = tar_it->file_size;
+  tar_it->pad_remaining = (TAR_BLOCK_SIZE - (tar_it->file_size % TAR_BLOCK_SIZE)) % TAR_BLOCK_SIZE;
+
+  // Build path from ustar prefix and name
+  size_t prefix_len = strnlen((const char *)header->file_prefix, TAR_FILE_PREFIX_LEN);
+  size_t name_len = strnlen((const char *)header->file_name, TAR_FILE_NAME_LEN);
+  char *path = tar_it->cur_path;
+
+  memcpy(path, header->file_prefix, prefix_len);
+  if(prefix_len > 0)
+    path[prefix_len++] = '/';
+  memcpy(&path[prefix_len], header->file_name, name_len);
+  path[prefix_len + name_len] = '\0';
+
+  return true;
+}
+
+
+/*
+Read data from the current member of a tar stream
+
+Args:
+  tar_it: Iterator positioned on a member
+  buf:    Buffer for read data
+  size:   Size of buf
+
+Returns:
+  Number of bytes read on success or negative error code on failure. 0 when
+  all member data has been read.
+*/
+ptrdiff_t tar_stream_read(TarStreamIterator *tar_it, void *buf, size_t size) {
+  if(tar_it->status != EVFS_OK) return tar_it->status;
+
+  if((evfs_off_t)size > tar_it->data_remaining)
+    size = tar_it->data_remaining;
+
+  if(size == 0) return 0;
+
+  ptrdiff_t rval = tar__read_full(tar_it, buf, size);
+  if(rval >= 0 && (size_t)rval != size)
+    rval = EVFS_ERR_IO; // Truncated stream
+
+  if(rval < 0) {
+    tar_it->status = rval;
+    return rval;
+  }
+
+  tar_it->data_remaining -= rval;
+  return rval;
+}
+
+
+/*
+Visit each member of a tar stream
+
+Member data is read into buf and passed to the visitor as it arrives. At most
+buf_size bytes are held in memory at once.
+
+Args:
+  fd:       Tar stream to read. Only evfs_file_read() is used.
+  buf:      Buffer for member data. Use NULL to allocate one of buf_size bytes.
+  buf_size: Size of buf
+  visitor:  Callback for member data
+  ctx:      User context passed to visitor
+
+Returns:
+  EVFS_OK when the whole stream was read. EVFS_DONE if the visitor stopped
+  iteration. Negative error values from the stream or the visitor.
+*/
+int tar_stream_each(EvfsFile *fd, uint8_t *buf, size_t buf_size, TarStreamVisitor visitor, void *ctx) {
+  if(PTR_CHECK(fd) || PTR_CHECK(visitor)) return EVFS_ERR_BAD_ARG;
+  if(buf_size == 0) THROW(EVFS_ERR_BAD_ARG);
+
+  uint8_t *alloc_buf = NULL;
+  if(!buf) {
+    alloc_buf = evfs_malloc(buf_size);
+    if(MEM_CHECK(alloc_buf)) return EVFS_ERR_ALLOC;
+    buf = alloc_buf;
+  }
+
+  TarStreamIterator tar_it;
+  tar_stream_init(&tar_it, fd);
+
+  int status = EVFS_OK;
+
+  while(status == EVFS_OK && tar_stream_next(&tar_it)) {
+    TarStreamMember member = {
+      .path       = tar_it.cur_path,
+      .size       = tar_it.file_size,
+      .type_flag  = tar_it.cur_header.type_flag,
+      .header     = &tar_it.cur_header
+    };
+
+    evfs_off_t offset = 0;
+    do {
+      ptrdiff_t rval = tar_stream_read(&tar_it, buf, buf_size);
+      if(rval < 0) {
+        status = rval;
+        break;
+      }
+
+      status = visitor(&member, buf, rval, offset, ctx);
+      offset += rval;
+    } while(status == EVFS_OK && offset < member.size);
+  }
+
+  if(status == EVFS_OK)
+    status = tar_it.status;
+
+  if(alloc_buf)
+    evfs_free(alloc_buf);
+
+  return status;
+}
+
+
+
+// ******************** Extraction ********************
+
+typedef struct TarExtractCtx {
+  const char *dest_dir;
+  const char *vfs_name;
+  EvfsFile   *fh;
+  char        dest_path[EVFS_MAX_PATH];
+} TarExtractCtx;
+
+
+// Reject members that would land outside of the destination
+static bool tar__safe_member_path(const char *path) {
+  if(path[0] == '\0') return false;
+
+  const char *seg = path;
+  while(*seg) {
+    const char *seg_end = seg;
+    while(*seg_end && *seg_end != '/' && *seg_end != '\\') {
+      seg_end++;
+    }
+
+    if(seg_end - seg == 2 && seg[0] == '.' && seg[1] == '.')
+      return false;
+
+    seg = *seg_end ? seg_end+1 : seg_end;
+  }
+
+  return true;
+}
+
+
+static int tar__extract_member(const TarStreamMember *member, const uint8_t *data, size_t size,
+                               evfs_off_t offset, void *ctx) {
+  TarExtractCtx *ex = (TarExtractCtx *)ctx;
+  int status;
+
+  if(offset == 0) { // New member
+    if(member->type_flag != TAR_TYPE_NORMAL_FILE && member->type_flag != TAR_TYPE_CONTIG_FILE &&
+       member->type_flag != TAR_TYPE_DIRECTORY)
+      return EVFS_OK; // Skip links and special files
+
+    // Paths are always relative to dest_dir
+    const char *path = member->path;
+    while(*path == '/') {
+      path++;
+    }
+
+    if(!tar__safe_member_path(path))
+      return EVFS_ERR_BAD_NAME;
+
+    StringRange dest_r;
+    range_init(&dest_r, ex->dest_path, sizeof ex->dest_path);
+    status = evfs_path_join_str_ex(ex->dest_dir, path, &dest_r, ex->vfs_name);
+    if(status != EVFS_OK) return status;
+
+    if(member->type_flag == TAR_TYPE_DIRECTORY)
+      return evfs_make_path_ex(ex->dest_path, ex->vfs_name);
+
+    // Archives don't need entries for every parent directory
+    StringRange dir_r;
+    evfs_path_dirname_ex(ex->dest_path, &dir_r, ex->vfs_name);
+    if(range_size(&dir_r) > 0) {
+      status = evfs_make_path_range_ex(&dir_r, ex->vfs_name);
+      if(status != EVFS_OK) return status;
+    }
+
+    status = evfs_open_ex(ex->dest_path, &ex->fh, EVFS_WRITE | EVFS_OVERWRITE, ex->vfs_name);
+    if(status != EVFS_OK) {
+      ex->fh = NULL;
+      return status;
+    }
+  }
+
+  if(!ex->fh) return EVFS_OK; // Skipped member
+
+  if(size > 0 && evfs_file_write(ex->fh, data, size) != (ptrdiff_t)size)
+    return EVFS_ERR_IO;
+
+  if(offset + (evfs_off_t)size >= member->size) { // Member complete
+    status = evfs_file_close(ex->fh);
+    ex->fh = NULL;
+    if(status != EVFS_OK) return status;
+  }
+
+  return EVFS_OK;
+}
+
+
+/*
+Extract a tar stream into a directory
+
+Files and directories are written into dest_dir as they are read from the
+stream. Missing parent directories are created. Links and special files are
+skipped. Members with ".." path segments abort extraction with EVFS_ERR_BAD_NAME.
+
+Args:
+  fd:       Tar stream to read. Only evfs_file_read() is used.
+  dest_dir: Directory to extract into
+  buf:      Buffer for member data. Use NULL to allocate one of buf_size bytes.
+  buf_size: Size of buf
+  vfs_name: VFS to write into. Use default VFS if NULL
+
+Returns:
+  EVFS_OK on success
+*/
+int tar_stream_extract_ex(EvfsFile *fd, const char *dest_dir, uint8_t *buf, size_t buf_size,
+                          const char *vfs_name) {
+  if(PTR_CHECK(fd) || PTR_CHECK(dest_dir)) return EVFS_ERR_BAD_ARG;
+
+  TarExtractCtx ex = {
+    .dest_dir = dest_dir,
+    .vfs_name = vfs_name,
+    .fh       = NULL
+  };
+
+  int status = evfs_make_path_ex(dest_dir, vfs_name);
+  if(status != EVFS_OK) return status;
+
+  status = tar_stream_each(fd, buf, buf_size, tar__extract_member, &ex);
+
+  if(ex.fh) // Aborted in the middle of a file
+    evfs_file_close(ex.fh);
+
+  return status;
+}
@@ -0,0 +1,818 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Workload replay
+
+  A capture from the capture tracing shim is loaded into memory, sorted by
+  the start time of each call, and issued again through the public API on a
+  chosen VFS. Handles in the capture are mapped to the files and directories
+  opened during the replay. Calls that depend on state the capture doesn't
+  hold such as ctrl commands and mappings are skipped.
+
+  The replay can run as fast as possible or follow the captured timing scaled
+  by a speedup factor. Several streams can replay the same workload
+  concurrently, each under its own path prefix. The latency of every call is
+  kept so percentiles can be reported for the whole run.
+
+  Files the workload reads without creating them must exist for the replay
+  to be meaningful. The optional prepare pass creates them, sized to cover
+  the reads in the capture, along with the directories the workload expects.
+------------------------------------------------------------------------------
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "evfs.h"
+#include "evfs_internal.h"
+#include "evfs/trace_replay.h"
+#include "evfs/util/dhash.h"
+
+
+#define MAX_REPLAY_BUF    (1024ul * 1024)
+#define REPLAY_DIR_ENTRIES  16
+
+
+typedef struct ReplayRecord {
+  EvfsCaptureRecord rec;
+  size_t            seq;    // Order in the capture for a stable sort
+} ReplayRecord;
+
+typedef struct ReplayJob ReplayJob;
+
+typedef struct ReplayStream {
+  ReplayJob        *job;
+  char              prefix[EVFS_MAX_PATH];
+  EvfsFile        **files;    // Indexed by captured handle
+  EvfsDir         **dirs;
+  uint32_t         *latency;  // Latency of each replayed call
+  uint8_t          *buf;      // Transfer data. Contents are never checked.
+  EvfsReplayStats   stats;
+  int               status;
+} ReplayStream;
+
+struct ReplayJob {
+  const EvfsReplayConfig *cfg;
+  ReplayRecord     *records;
+  size_t            num_records;
+  uint32_t          max_handle;
+  size_t            buf_size;   // Transfer buffer size for each stream
+  uint64_t          start;    // Clock at the start of the replay
+  ReplayStream     *streams;
+};
+
+
+// Prepare pass state for each captured path
+typedef struct PrepPath {
+  const char *path;
+  int         open_flags;   // Flags of the first successful open
+  evfs_off_t  extent;       // End of the furthest read
+  bool        opened;
+  bool        is_dir;       // Opened as a directory
+  bool        made_dir;     // Created by the workload with make_dir
+} PrepPath;
+
+
+static void *replay_zalloc(size_t count, size_t size) {
+  void *mem = evfs_malloc(MAX(count * size, 1));
+  if(mem)
+    memset(mem, 0, MAX(count * size, 1));
+  return mem;
+}
+
+
+static inline uint64_t replay_clock(ReplayJob *job) {
+  return job->cfg->clock ? job->cfg->clock() : 0;
+}
+
+
+static int record_compare(const void *a, const void *b) {
+  const ReplayRecord *ra = a;
+  const ReplayRecord *rb = b;
+
+  if(ra->rec.timestamp != rb->rec.timestamp)
+    return ra->rec.timestamp < rb->rec.timestamp ? -1 : 1;
+
+  return ra->seq < rb->seq ? -1 : (ra->seq > rb->seq);
+}
+
+
+static int latency_compare(const void *a, const void *b) {
+  uint32_t la = *(const uint32_t *)a;
+  uint32_t lb = *(const uint32_t *)b;
+
+  return la < lb ? -1 : (la > lb);
+}
+
+
+static inline bool is_transfer(uint16_t op) {
+  switch(op) {
+  case EVFS_TRACE_READ:
+  case EVFS_TRACE_WRITE:
+  case EVFS_TRACE_READ_AT:
+  case EVFS_TRACE_WRITE_AT:
+  case EVFS_TRACE_READV:
+  case EVFS_TRACE_WRITEV:
+    return true;
+  default:
+    return false;
+  }
+}
+
+
+// Decode all records in a capture and sort them into call order
+static int replay_load(ReplayJob *job, const uint8_t *capture, size_t capture_size) {
+  EvfsCaptureRecord rec;
+  size_t pos = 0;
+  size_t count = 0;
+  int status;
+
+  while((status = evfs_capture_decode(capture, capture_size, &pos, &rec)) == EVFS_OK) {
+    count++;
+  }
+  if(status != EVFS_DONE) return status;
+
+  if(count > 0) {
+    job->records = evfs_malloc(count * sizeof(*job->records));
+    if(MEM_CHECK(job->records)) return EVFS_ERR_ALLOC;
+  }
+
+  pos = 0;
+  size_t max_transfer = 0;
+  while(evfs_capture_decode(capture, capture_size, &pos, &rec) == EVFS_OK) {
+    ReplayRecord *rr = &job->records[job->num_records];
+    rr->rec = rec;
+    rr->seq = job->num_records++;
+
+    job->max_handle = MAX(job->max_handle, rec.handle);
+    if(is_transfer(rec.op) && rec.size > 0)
+      max_transfer = MAX(max_transfer, (size_t)rec.size);
+  }
+
+  qsort(job->records, job->num_records, sizeof(*job->records), record_compare);
+
+  // Larger transfers are split into pieces of this size
+  job->buf_size = MIN(MAX(max_transfer, (size_t)4096), MAX_REPLAY_BUF);
+
+  return EVFS_OK;
+}
+
+
+// Map a captured path into a stream
+static const char *stream_path(ReplayStream *stream, const char *path, char *buf, size_t buf_size) {
+  if(!path || stream->prefix[0] == '\0')
+    return path;
+
+  int len = snprintf(buf, buf_size, "%s%s%s", stream->prefix, path[0] == '/' ? "" : "/", path);
+  if(len < 0 || (size_t)len >= buf_size) // Fails in the VFS like any invalid path
+    return "";
+
+  return buf;
+}
+
+
+
+// ******************** Prepare pass ********************
+
+static void prep_destroy_item(dhKey key, void *value, void *ctx) {
+  // Entries are stored in the PrepPath array
+}
+
+
+static bool prep_equal_keys(dhKey key1, dhKey key2, void *ctx) {
+  return key1.length == key2.length && memcmp(key1.data, key2.data, key1.length) == 0;
+}
+
+
+static PrepPath *prep_lookup(dhash *index, PrepPath *paths, size_t *num_paths, const char *path) {
+  dhKey key = {.data = path, .length = strlen(path)};
+  size_t ix;
+
+  if(dh_lookup(index, key, &ix))
+    return &paths[ix];
+
+  ix = (*num_paths)++;
+  memset(&paths[ix], 0, sizeof(paths[ix]));
+  paths[ix].path = path;
+
+  // Robin Hood insertion swaps values through the argument so pass a copy
+  size_t value = ix;
+  dh_insert(index, key, &value);
+
+  return &paths[ix];
+}
+
+
+// Make the parent of path unless the workload creates it
+static int prep_parent(ReplayStream *stream, dhash *index, PrepPath *paths, const char *path) {
+  const char *vfs_name = stream->job->cfg->vfs_name;
+
+  StringRange head;
+  evfs_path_dirname_ex(path, &head, vfs_name);
+
+  // Skip directories made by the workload
+  dhKey key = {.data = head.start, .length = range_size(&head)};
+  size_t ix;
+  if(dh_lookup(index, key, &ix) && paths[ix].made_dir)
+    return EVFS_OK;
+
+  char pbuf[EVFS_MAX_PATH];
+  size_t head_len = range_size(&head);
+  if(head_len >= sizeof(pbuf)) return EVFS_ERR_TOO_LONG;
+  memcpy(pbuf, head.start, head_len);
+  pbuf[head_len] = '\0';
+
+  char sbuf[EVFS_MAX_PATH];
+  int status = evfs_make_path_ex(stream_path(stream, pbuf, sbuf, sizeof(sbuf)), vfs_name);
+  return status == EVFS_ERR_EXISTS ? EVFS_OK : status;
+}
+
+
+// Create a file read by the workload and extend it to cover its reads
+static int prep_file(ReplayStream *stream, PrepPath *pp) {
+  ReplayJob *job = stream->job;
+  const char *vfs_name = job->cfg->vfs_name;
+
+  char sbuf[EVFS_MAX_PATH];
+  EvfsFile *fh;
+  int status = evfs_open_ex(stream_path(stream, pp->path, sbuf, sizeof(sbuf)), &fh,
+                            EVFS_WRITE | EVFS_OPEN_OR_NEW, vfs_name);
+  if(status != EVFS_OK) return status;
+
+  evfs_off_t size = evfs_file_size(fh);
+  while(size >= 0 && size < pp->extent) {
+    size_t chunk = MIN(job->buf_size, (size_t)(pp->extent - size));
+    ptrdiff_t wrote = evfs_file_write_at(fh, stream->buf, chunk, size);
+    if(wrote <= 0) {
+      status = wrote < 0 ? wrote : EVFS_ERR_IO;
+      break;
+    }
+    size += wrote;
+  }
+
+  int close_status = evfs_file_close(fh);
+  return status == EVFS_OK ? close_status : status;
+}
+
+
+// Build the files and directories the workload expects to exist
+static int stream_prepare(ReplayStream *stream) {
+  ReplayJob *job = stream->job;
+  int status = EVFS_OK;
+
+  if(stream->prefix[0] != '\0') {
+    status = evfs_make_path_ex(stream->prefix, job->cfg->vfs_name);
+    if(status != EVFS_OK && status != EVFS_ERR_EXISTS) return status;
+  }
+
+  if(job->num_records == 0)
+    return EVFS_OK;
+
+  // Every record could name a new path
+  PrepPath *paths = evfs_malloc(job->num_records * sizeof(*paths));
+  if(MEM_CHECK(paths)) return EVFS_ERR_ALLOC;
+
+  // Path and position for each open handle
+  PrepPath **handle_paths = replay_zalloc(job->max_handle+1, sizeof(*handle_paths));
+  evfs_off_t *handle_pos = replay_zalloc(job->max_handle+1, sizeof(*handle_pos));
+
+  dhash index;
+  dhConfig hash_cfg = {
+    .init_buckets = 64,
+    .value_size   = sizeof(size_t),
+
+    .destroy_item = prep_destroy_item,
+    .gen_hash     = dh_gen_hash_string,
+    .is_equal     = prep_equal_keys
+  };
+
+  if(MEM_CHECK(handle_paths) || MEM_CHECK(handle_pos) || !dh_init(&index, &hash_cfg, NULL)) {
+    evfs_free(handle_pos);
+    evfs_free(handle_paths);
+    evfs_free(paths);
+    return EVFS_ERR_ALLOC;
+  }
+
+  size_t num_paths = 0;
+
+  // Simulate file positions to find the extent of the reads on each path
+  for(size_t i = 0; i < job->num_records; i++) {
+    EvfsCaptureRecord *rec = &job->records[i].rec;
+    PrepPath *pp = rec->handle <= job->max_handle ? handle_paths[rec->handle] : NULL;
+    evfs_off_t *pos = &handle_pos[rec->handle];
+
+    switch(rec->op) {
+    case EVFS_TRACE_OPEN:
+    case EVFS_TRACE_OPEN_DIR:
+      if(!rec->path || rec->result != EVFS_OK) break;
+
+      pp = prep_lookup(&index, paths, &num_paths, rec->path);
+      if(!pp->opened) {
+        pp->opened = true;
+        pp->open_flags = (int)rec->size;
+        pp->is_dir = rec->op == EVFS_TRACE_OPEN_DIR;
+      }
+      handle_paths[rec->handle] = pp;
+      *pos = (rec->size & EVFS_APPEND) ? pp->extent : 0;
+      break;
+
+    case EVFS_TRACE_MAKE_DIR:
+      if(rec->path)
+        prep_lookup(&index, paths, &num_paths, rec->path)->made_dir = true;
+      break;
+
+    case EVFS_TRACE_READ:
+    case EVFS_TRACE_READV:
+      if(pp && rec->result > 0) {
+        *pos += rec->result;
+        pp->extent = MAX(pp->extent, *pos);
+      }
+      break;
+
+    case EVFS_TRACE_WRITE:
+    case EVFS_TRACE_WRITEV:
+      if(rec->result > 0)
+        *pos += rec->result;
+      break;
+
+    case EVFS_TRACE_READ_AT:
+      if(pp && rec->result > 0)
+        pp->extent = MAX(pp->extent, rec->offset + rec->result);
+      break;
+
+    case EVFS_TRACE_SEEK:
+      if(pp && rec->result == EVFS_OK) {
+        switch(rec->size) {
+        case EVFS_SEEK_TO:  *pos = rec->offset; break;
+        case EVFS_SEEK_REL: *pos += rec->offset; break;
+        case EVFS_SEEK_REV: *pos = MAX(pp->extent - rec->offset, 0); break;
+        default: break;
+        }
+      }
+      break;
+
+    case EVFS_TRACE_TELL:
+      if(rec->result >= 0)
+        *pos = rec->result;
+      break;
+
+    case EVFS_TRACE_SIZE:
+      if(pp && rec->result > 0)
+        pp->extent = MAX(pp->extent, rec->result);
+      break;
+
+    case EVFS_TRACE_CLOSE:
+    case EVFS_TRACE_DIR_CLOSE:
+      if(rec->handle <= job->max_handle)
+        handle_paths[rec->handle] = NULL;
+      break;
+
+    default:
+      break;
+    }
+  }
+
+  for(size_t i = 0; i < num_paths && status == EVFS_OK; i++) {
+    PrepPath *pp = &paths[i];
+    if(!pp->opened || pp->made_dir) continue;
+
+    if(pp->is_dir) {
+      char sbuf[EVFS_MAX_PATH];
+      status = evfs_make_path_ex(stream_path(stream, pp->path, sbuf, sizeof(sbuf)), job->cfg->vfs_name);
+      if(status == EVFS_ERR_EXISTS)
+        status = EVFS_OK;
+      continue;
+    }
+
+    status = prep_parent(stream, &index, paths, pp->path);
+
+    // Files the workload opened without creating them
+    bool created = pp->open_flags & (EVFS_NO_EXIST | EVFS_OVERWRITE);
+    bool pre_existing = !(pp->open_flags & EVFS_OPEN_OR_NEW) || pp->extent > 0;
+    if(status == EVFS_OK && !created && pre_existing)
+      status = prep_file(stream, pp);
+  }
+
+  dh_free(&index);
+  evfs_free(handle_pos);
+  evfs_free(handle_paths);
+  evfs_free(paths);
+
+  return status;
+}
+
+
+
+// ******************** Replay ********************
+
+#define REPLAY_SKIP  INT64_MIN
+
+// Split a transfer into pieces that fit the shared buffer
+static int64_t replay_transfer(ReplayStream *stream, EvfsFile *fh, uint16_t op, int64_t size,
+                               evfs_off_t offset) {
+  ReplayJob *job = stream->job;
+  uint8_t *buf = stream->buf;
+  int64_t total = 0;
+
+  do {
+    size_t chunk = (size_t)MIN(size - total, (int64_t)job->buf_size);
+    EvfsIOVec iov = {.base = buf, .len = chunk};
+    ptrdiff_t rval;
+
+    switch(op) {
+    case EVFS_TRACE_READ:     rval = evfs_file_read(fh, buf, chunk); break;
+    case EVFS_TRACE_WRITE:    rval = evfs_file_write(fh, buf, chunk); break;
+    case EVFS_TRACE_READ_AT:  rval = evfs_file_read_at(fh, buf, chunk, offset + total); break;
+    case EVFS_TRACE_WRITE_AT: rval = evfs_file_write_at(fh, buf, chunk, offset + total); break;
+    case EVFS_TRACE_READV:    rval = evfs_file_readv(fh, &iov, 1); break;
+    default:                  rval = evfs_file_writev(fh, &iov, 1); break;
+    }
+
+    if(rval < 0)
+      return total > 0 ? total : rval;
+
+    total += rval;
+    if((size_t)rval < chunk)
+      break;
+  } while(total < size);
+
+  switch(op) {
+  case EVFS_TRACE_READ:
+  case EVFS_TRACE_READ_AT:
+  case EVFS_TRACE_READV:
+    stream->stats.bytes_read += total;
+    break;
+  default:
+    stream->stats.bytes_written += total;
+    break;
+  }
+
+  return total;
+}
+
+
+// Issue one captured call
+static int64_t replay_call(ReplayStream *stream, const EvfsCaptureRecord *rec) {
+  ReplayJob *job = stream->job;
+  const char *vfs_name = job->cfg->vfs_name;
+  char sbuf[EVFS_MAX_PATH];
+  const char *path = stream_path(stream, rec->path, sbuf, sizeof(sbuf));
+
+  EvfsFile *fh = NULL;
+  EvfsDir *dh = NULL;
+  if(rec->handle > 0 && rec->handle <= job->max_handle) {
+    fh = stream->files[rec->handle];
+    dh = stream->dirs[rec->handle];
+  }
+
+  switch(rec->op) {
+  case EVFS_TRACE_OPEN:
+    if(!path) return REPLAY_SKIP;
+    {
+      int status = evfs_open_ex(path, &fh, (int)rec->size, vfs_name);
+      if(status == EVFS_OK)
+        stream->files[rec->handle] = fh;
+      return status;
+    }
+
+  case EVFS_TRACE_OPEN_DIR:
+    if(!path) return REPLAY_SKIP;
+    {
+      int status = evfs_open_dir_ex(path, &dh, vfs_name);
+      if(status == EVFS_OK)
+        stream->dirs[rec->handle] = dh;
+      return status;
+    }
+
+  case EVFS_TRACE_STAT:
+    if(!path) return REPLAY_SKIP;
+    {
+      EvfsInfo info;
+      return evfs_stat_ex(path, &info, vfs_name);
+    }
+
+  case EVFS_TRACE_DELETE:
+    return path ? evfs_delete_ex(path, vfs_name) : REPLAY_SKIP;
+
+  case EVFS_TRACE_MAKE_DIR:
+    return path ? evfs_make_dir_ex(path, vfs_name) : REPLAY_SKIP;
+
+  case EVFS_TRACE_RENAME:
+    if(!path || !rec->new_path) return REPLAY_SKIP;
+    {
+      char nbuf[EVFS_MAX_PATH];
+      return evfs_rename_ex(path, stream_path(stream, rec->new_path, nbuf, sizeof(nbuf)), vfs_name);
+    }
+
+  // Directory handles
+  case EVFS_TRACE_DIR_READ:
+    if(!dh) return REPLAY_SKIP;
+    {
+      EvfsInfo info;
+      return evfs_dir_read(dh, &info);
+    }
+
+  case EVFS_TRACE_DIR_READ_MANY:
+    if(!dh) return REPLAY_SKIP;
+    {
+      EvfsInfo entries[REPLAY_DIR_ENTRIES];
+      char names[REPLAY_DIR_ENTRIES * 32];
+      int max_entries = (int)MIN(MAX(rec->size, 1), REPLAY_DIR_ENTRIES);
+      return evfs_dir_read_many(dh, entries, max_entries, names, sizeof(names));
+    }
+
+  case EVFS_TRACE_DIR_REWIND:
+    return dh ? evfs_dir_rewind(dh) : REPLAY_SKIP;
+
+  case EVFS_TRACE_DIR_CLOSE:
+    if(!dh) return REPLAY_SKIP;
+    stream->dirs[rec->handle] = NULL;
+    return evfs_dir_close(dh);
+
+  // File handles
+  case EVFS_TRACE_READ:
+  case EVFS_TRACE_WRITE:
+  case EVFS_TRACE_READ_AT:
+  case EVFS_TRACE_WRITE_AT:
+  case EVFS_TRACE_READV:
+  case EVFS_TRACE_WRITEV:
+    if(!fh || rec->size < 0) return REPLAY_SKIP;
+    return replay_transfer(stream, fh, rec->op, rec->size, rec->offset);
+
+  case EVFS_TRACE_CLOSE:
+    if(!fh) return REPLAY_SKIP;
+    stream->files[rec->handle] = NULL;
+    return evfs_file_close(fh);
+
+  case EVFS_TRACE_TRUNCATE:
+    return fh ? evfs_file_truncate(fh, rec->size) : REPLAY_SKIP;
+
+  case EVFS_TRACE_SYNC:
+    return fh ? evfs_file_sync(fh) : REPLAY_SKIP;
+
+  case EVFS_TRACE_SIZE:
+    return fh ? evfs_file_size(fh) : REPLAY_SKIP;
+
+  case EVFS_TRACE_SEEK:
+    return fh ? evfs_file_seek(fh, rec->offset, (EvfsSeekDir)rec->size) : REPLAY_SKIP;
+
+  case EVFS_TRACE_TELL:
+    return fh ? evfs_file_tell(fh) : REPLAY_SKIP;
+
+  case EVFS_TRACE_EOF:
+    return fh ? evfs_file_eof(fh) : REPLAY_SKIP;
+
+  case EVFS_TRACE_DISCARD:
+    return fh ? evfs_file_discard(fh, rec->offset, rec->size) : REPLAY_SKIP;
+
+  // Ctrl arguments and mappings aren't captured. The current directory
+  // doesn't affect the absolute paths the VFS receives.
+  default:
+    return REPLAY_SKIP;
+  }
+}
+
+
+static void replay_stream(void *ctx) {
+  ReplayStream *stream = (ReplayStream *)ctx;
+  ReplayJob *job = stream->job;
+  const EvfsReplayConfig *cfg = job->cfg;
+
+  bool timed = cfg->speed > 0 && cfg->clock && cfg->delay;
+  uint64_t first_ts = job->num_records > 0 ? job->records[0].rec.timestamp : 0;
+
+  for(size_t i = 0; i < job->num_records; i++) {
+    EvfsCaptureRecord *rec = &job->records[i].rec;
+
+    if(timed) { // Wait until the call is due
+      uint64_t due = (rec->timestamp - first_ts) / cfg->speed;
+      uint64_t now = replay_clock(job) - job->start;
+      if(now < due)
+        cfg->delay(due - now);
+    }
+
+    uint64_t start = replay_clock(job);
+    int64_t result = replay_call(stream, rec);
+    uint64_t elapsed = replay_clock(job) - start;
+
+    if(result == REPLAY_SKIP) {
+      stream->stats.skipped++;
+      continue;
+    }
+
+    stream->latency[stream->stats.ops++] = (uint32_t)MIN(elapsed, UINT32_MAX);
+
+    if((result < 0) != (rec->result < 0))
+      stream->stats.mismatches++;
+  }
+
+  // Close anything the capture left open
+  for(uint32_t h = 0; h <= job->max_handle; h++) {
+    if(stream->files[h])
+      evfs_file_close(stream->files[h]);
+    if(stream->dirs[h])
+      evfs_dir_close(stream->dirs[h]);
+    stream->files[h] = NULL;
+    stream->dirs[h] = NULL;
+  }
+}
+
+
+static void replay_free(ReplayJob *job, unsigned num_streams) {
+  if(job->streams) {
+    for(unsigned i = 0; i < num_streams; i++) {
+      evfs_free(job->streams[i].files);
+      evfs_free(job->streams[i].dirs);
+      evfs_free(job->streams[i].latency);
+      evfs_free(job->streams[i].buf);
+    }
+    evfs_free(job->streams);
+  }
+
+  evfs_free(job->records);
+}
+
+
+static inline uint32_t percentile(const uint32_t *sorted, size_t count, unsigned per_mille) {
+  return count > 0 ? sorted[(count-1) * per_mille / 1000] : 0;
+}
+
+
+/*
+Replay a captured workload
+
+The capture is read from the start of the file. Calls are issued in the order
+they started in the capture. With more than one stream, each stream replays
+the whole capture concurrently under "<path_prefix>/<stream number>".
+
+Args:
+  capture:  Capture file from the capture tracing shim
+  cfg:      Replay settings. Use NULL for an untimed replay on the default VFS
+  stats:    Results of the replay
+
+Returns:
+  EVFS_OK on success. Calls that fail in the replay are counted in the stats
+  and don't cause an error.
+*/
+int evfs_replay(EvfsFile *capture, const EvfsReplayConfig *cfg, EvfsReplayStats *stats) {
+  if(PTR_CHECK(capture) || PTR_CHECK(stats)) return EVFS_ERR_BAD_ARG;
+
+  EvfsReplayConfig default_cfg = {0};
+  if(!cfg)
+    cfg = &default_cfg;
+
+  unsigned num_streams = MAX(cfg->num_streams, 1);
+  if(num_streams > 1 && !cfg->path_prefix) return EVFS_ERR_BAD_ARG;
+#ifndef EVFS_USE_THREADING
+  if(num_streams > 1) return EVFS_ERR_NO_SUPPORT;
+#endif
+
+  memset(stats, 0, sizeof(*stats));
+
+  // Load the whole capture
+  evfs_off_t capture_size = evfs_file_size(capture);
+  if(capture_size < 0) return capture_size;
+  if((uint64_t)capture_size > SIZE_MAX) return EVFS_ERR_OVERFLOW;
+
+  uint8_t *capture_buf = evfs_malloc(MAX(capture_size, 1));
+  if(MEM_CHECK(capture_buf)) return EVFS_ERR_ALLOC;
+
+  ptrdiff_t read = evfs_file_read_at(capture, capture_buf, capture_size, 0);
+  if(read != capture_size) {
+    evfs_free(capture_buf);
+    return read < 0 ? read : EVFS_ERR_IO;
+  }
+
+  ReplayJob job = {.cfg = cfg};
+  int status = replay_load(&job, capture_buf, capture_size);
+
+  if(status == EVFS_OK) {
+    job.streams = replay_zalloc(num_streams, sizeof(*job.streams));
+    if(MEM_CHECK(job.streams))
+      status = EVFS_ERR_ALLOC;
+  }
+
+  for(unsigned i = 0; i < num_streams && status == EVFS_OK; i++) {
+    ReplayStream *stream = &job.streams[i];
+    stream->job = &job;
+
+    int len = 0;
+    if(num_streams > 1)
+      len = snprintf(stream->prefix, sizeof(stream->prefix), "%s/%u", cfg->path_prefix, i);
+    else if(cfg->path_prefix)
+      len = snprintf(stream->prefix, sizeof(stream->prefix), "%s", cfg->path_prefix);
+    if(len < 0 || (size_t)len >= sizeof(stream->prefix)) {
+      status = EVFS_ERR_TOO_LONG;
+      break;
+    }
+
+    stream->files = replay_zalloc(job.max_handle+1, sizeof(*stream->files));
+    stream->dirs = replay_zalloc(job.max_handle+1, sizeof(*stream->dirs));
+    stream->latency = evfs_malloc(MAX(job.num_records, 1) * sizeof(*stream->latency));
+    stream->buf = replay_zalloc(job.buf_size, 1);
+    if(MEM_CHECK(stream->files) || MEM_CHECK(stream->dirs) || MEM_CHECK(stream->latency)
+        || MEM_CHECK(stream->buf)) {
+      status = EVFS_ERR_ALLOC;
+      break;
+    }
+
+    if(cfg->prepare)
+      status = stream_prepare(stream);
+  }
+
+  if(status == EVFS_OK) {
+    job.start = replay_clock(&job);
+
+#ifdef EVFS_USE_THREADING
+    EvfsThread *threads = NULL;
+    bool *started = NULL;
+    if(num_streams > 1) {
+      threads = evfs_malloc((num_streams-1) * sizeof(*threads));
+      started = replay_zalloc(num_streams, sizeof(*started));
+      if(MEM_CHECK(threads) || MEM_CHECK(started))
+        status = EVFS_ERR_ALLOC;
+
+      // The calling thread runs the first stream
+      for(unsigned i = 1; i < num_streams && status == EVFS_OK; i++) {
+        started[i] = evfs__thread_create(&threads[i-1], replay_stream, &job.streams[i]) == EVFS_OK;
+      }
+    }
+
+    if(status == EVFS_OK) {
+      replay_stream(&job.streams[0]);
+
+      for(unsigned i = 1; i < num_streams; i++) {
+        if(started[i])
+          evfs__thread_join(threads[i-1]);
+        else // Couldn't get a thread
+          replay_stream(&job.streams[i]);
+      }
+    }
+
+    evfs_free(started);
+    evfs_free(threads);
+#else
+    replay_stream(&job.streams[0]);
+#endif
+
+    stats->elapsed = replay_clock(&job) - job.start;
+  }
+
+  if(status == EVFS_OK) { // Combine results from all streams
+    size_t total_ops = 0;
+    for(unsigned i = 0; i < num_streams; i++) {
+      total_ops += job.streams[i].stats.ops;
+    }
+
+    uint32_t *latency = evfs_malloc(MAX(total_ops, 1) * sizeof(*latency));
+    if(MEM_CHECK(latency)) {
+      status = EVFS_ERR_ALLOC;
+
+    } else {
+      size_t count = 0;
+      for(unsigned i = 0; i < num_streams; i++) {
+        ReplayStream *stream = &job.streams[i];
+        stats->ops += stream->stats.ops;
+        stats->skipped += stream->stats.skipped;
+        stats->mismatches += stream->stats.mismatches;
+        stats->bytes_read += stream->stats.bytes_read;
+        stats->bytes_written += stream->stats.bytes_written;
+
+        memcpy(&latency[count], stream->latency, stream->stats.ops * sizeof(*latency));
+        count += stream->stats.ops;
+      }
+
+      qsort(latency, count, sizeof(*latency), latency_compare);
+      stats->latency_p50  = percentile(latency, count, 500);
+      stats->latency_p90  = percentile(latency, count, 900);
+      stats->latency_p99  = percentile(latency, count, 990);
+      stats->latency_p999 = percentile(latency, count, 999);
+      stats->latency_max  = count > 0 ? latency[count-1] : 0;
+      evfs_free(latency);
+    }
+
+    // Span of the capture from the first call to the end of the last
+    if(job.num_records > 0) {
+      uint64_t first_ts = job.records[0].rec.timestamp;
+      uint64_t last_end = first_ts;
+      for(size_t i = 0; i < job.num_records; i++) {
+        EvfsCaptureRecord *rec = &job.records[i].rec;
+        last_end = MAX(last_end, rec->timestamp + rec->elapsed);
+      }
+      stats->captured = last_end - first_ts;
+    }
+  }
+
+  replay_free(&job, num_streams);
+  evfs_free(capture_buf);
+
+  return status;
+}
@@ -0,0 +1,236 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2021 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice (including the next
+paragraph) shall be included in all copies or substantial portions of the
+Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+------------------------------------------------------------------------------
+checksum
+
+The slicing-by-8 tables are built by crc32c_init(). It is called on first use
+but should be called once before using CRCs from multiple threads. The
+hardware implementations process 8 bytes at a time after aligning the data
+pointer.
+------------------------------------------------------------------------------
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "util/checksum.h"
+#include "util/unaligned_access.h"
+
+
+#define CRC32C_POLY   0x82F63B78UL  // Reflected Castagnoli polynomial
+
+#if (defined __x86_64__ || defined __i386__) && (defined __GNUC__ || defined __clang__)
+#  define USE_CRC_SSE42
+#  include <nmmintrin.h>
+#elif defined __ARM_FEATURE_CRC32
+#  define USE_CRC_ARM
+#  include <arm_acle.h>
+#endif
+
+
+static uint32_t s_crc_table[8][256];
+static bool s_crc_ready = false;
+
+typedef uint32_t (*CrcImpl)(uint32_t crc, const uint8_t *data, size_t len);
+
+
+// Slicing-by-8 software CRC
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *data, size_t len) {
+  while(len > 0 && ((uintptr_t)data & 7)) {
+    crc = s_crc_table[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    len--;
+  }
+
+  while(len >= 8) {
+    uint32_t lo = get_unaligned_u32le(&data[0]) ^ crc;
+    uint32_t hi = get_unaligned_u32le(&data[4]);
+
+    crc = s_crc_table[7][lo & 0xFF] ^ s_crc_table[6][(lo >> 8) & 0xFF] ^
+          s_crc_table[5][(lo >> 16) & 0xFF] ^ s_crc_table[4][lo >> 24] ^
+          s_crc_table[3][hi & 0xFF] ^ s_crc_table[2][(hi >> 8) & 0xFF] ^
+          s_crc_table[1][(hi >> 16) & 0xFF] ^ s_crc_table[0][hi >> 24];
+
+    data += 8;
+    len -= 8;
+  }
+
+  while(len > 0) {
+    crc = s_crc_table[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    len--;
+  }
+
+  return crc;
+}
+
+
+#if defined USE_CRC_SSE42
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t *data, size_t len) {
+  while(len > 0 && ((uintptr_t)data & 7)) {
+    crc = _mm_crc32_u8(crc, *data++);
+    len--;
+  }
+
+#  if defined __x86_64__
+  uint64_t crc64 = crc;
+  while(len >= 8) {
+    crc64 = _mm_crc32_u64(crc64, get_unaligned_u64(data));
+    data += 8;
+    len -= 8;
+  }
+  crc = crc64;
+#  endif
+
+  while(len >= 4) {
+    crc = _mm_crc32_u32(crc, get_unaligned_u32(data));
+    data += 4;
+    len -= 4;
+  }
+
+  while(len > 0) {
+    crc = _mm_crc32_u8(crc, *data++);
+    len--;
+  }
+
+  return crc;
+}
+
+#elif defined USE_CRC_ARM
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t *data, size_t len) {
+  while(len > 0 && ((uintptr_t)data & 7)) {
+    crc = __crc32cb(crc, *data++);
+    len--;
+  }
+
+  while(len >= 8) {
+    crc = __crc32cd(crc, get_unaligned_u64(data));
+    data += 8;
+    len -= 8;
+  }
+
+  while(len > 0) {
+    crc = __crc32cb(crc, *data++);
+    len--;
+  }
+
+  return crc;
+}
+#endif
+
+
+static CrcImpl s_crc_impl = crc32c_sw;
+
+
+/*
+Prepare the CRC32C implementation
+
+This builds the software tables and selects hardware support if present.
+*/
+void crc32c_init(void) {
+  if(s_crc_ready)
+    return;
+
+  for(unsigned i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for(int b = 0; b < 8; b++)
+      crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+
+    s_crc_table[0][i] = crc;
+  }
+
+  for(unsigned i = 0; i < 256; i++) {
+    for(int t = 1; t < 8; t++)
+      s_crc_table[t][i] = s_crc_table[0][s_crc_table[t-1][i] & 0xFF] ^ (s_crc_table[t-1][i] >> 8);
+  }
+
+#if defined USE_CRC_SSE42
+  if(__builtin_cpu_supports("sse4.2"))
+    s_crc_impl = crc32c_hw;
+#elif defined USE_CRC_ARM
+  s_crc_impl = crc32c_hw;
+#endif
+
+  s_crc_ready = true;
+}
+
+
+/*
+Update a running CRC32C
+
+Args:
+  crc:  CRC of previous data. Use 0 to start a new CRC
+  data: Data to add to the CRC
+  len:  Length of data
+
+Returns:
+  Updated CRC
+*/
+uint32_t crc32c_update(uint32_t crc, const void *data, size_t len) {
+  if(!s_crc_ready)
+    crc32c_init();
+
+  return ~s_crc_impl(~crc, (const uint8_t *)data, len);
+}
+
+
+/*
+Sum big-endian 32-bit words
+
+Romfs headers sum to 0 when their checksum field is correct.
+
+Args:
+  sum:    Sum of previous data. Use 0 to start a new sum
+  data:   Data to sum
+  words:  Number of 32-bit words in data
+
+Returns:
+  Updated sum
+*/
+uint32_t sum32_be(uint32_t sum, const void *data, size_t words) {
+  const uint8_t *bdata = (const uint8_t *)data;
+
+  // Independent accumulators let the compiler vectorize the byte swaps
+  uint32_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+  while(words >= 4) {
+    s0 += get_unaligned_u32be(&bdata[0]);
+    s1 += get_unaligned_u32be(&bdata[4]);
+    s2 += get_unaligned_u32be(&bdata[8]);
+    s3 += get_unaligned_u32be(&bdata[12]);
+    bdata += 16;
+    words -= 4;
+  }
+
+  sum += s0 + s1 + s2 + s3;
+
+  while(words > 0) {
+    sum += get_unaligned_u32be(bdata);
+    bdata += 4;
+    words--;
+  }
+
+  return sum;
+}
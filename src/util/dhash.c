@@ -81,13 +81,24 @@ Reference:
 #define DH_USE_MODULUS_FUNCS
 
 
+#ifndef DH_USE_SWISS_TABLE
 // Robinhood hash lets us have high load factors so we can minimize wasted space.
 // Limit load factor to ~93%
-#define MAX_LOAD_FACTOR(b) ((b) * 15UL / 16UL)
+#  define MAX_LOAD_FACTOR(b) ((b) * 15UL / 16UL)
+#else
+// Group probing doesn't rebalance chains so keep more buckets free
+#  define MAX_LOAD_FACTOR(b) ((b) * 7UL / 8UL)
+#endif
 
 
 
 
+#ifdef DH_USE_INCREMENTAL_GROW
+// Fewest old buckets moved on each write while a grow is in progress
+#  define MIN_MIGRATE_STEP  8
+#endif
+
+
 #define PROBE_COUNT_BITS    15
 #define MAX_PROBE_COUNT     ((1UL << PROBE_COUNT_BITS) - 1)
 
@@ -108,6 +119,7 @@ typedef struct dhBucketEntry {
 
 #define DH_ERR_KEY_NOT_FOUND    -1
 #define DH_ERR_TOO_MANY_PROBES  -2
+#define DH_ERR_RETRY            -3  // Concurrent reader overlapped a write
 
 
 
@@ -120,6 +132,28 @@ typedef struct dhBucketEntry {
 #define SET_PROBE_COUNT(entry, probes)  ((entry)->probe_count = (probes))
 
 
+#ifdef DH_USE_SWISS_TABLE
+// Fingerprint bytes in the ctrl array. Empty is zero so new bucket arrays from
+// calloc() are ready to use. Used buckets have the high bit set with the upper
+// 7 bits of the ikey in the rest.
+#  define CTRL_EMPTY      0x00
+#  define CTRL_DELETED    0x7F
+#  define CTRL_FULL(ikey) (0x80 | ((ikey) >> (sizeof(dhIKey)*8 - 7)))
+
+#  define GROUP_WIDTH     16
+
+// The ctrl array has a copy of its first group at the end so that groups
+// starting near the end can be loaded without wrapping.
+#  define CTRL_SIZE(n)    ((size_t)(n) + GROUP_WIDTH)
+#  define BUCKETS_SIZE(n, bucket_size)  ((size_t)(n) * ((bucket_size) + 1) + GROUP_WIDTH)
+#  define BUCKETS_IN(bytes, bucket_size)  \
+    ((bytes) > GROUP_WIDTH ? ((bytes) - GROUP_WIDTH) / ((bucket_size) + 1) : 0)
+#else
+#  define BUCKETS_SIZE(n, bucket_size)    ((size_t)(n) * (bucket_size))
+#  define BUCKETS_IN(bytes, bucket_size)  ((bytes) / (bucket_size))
+#endif
+
+
 // Round up object size to match alignment of a type
 #define ROUND_UP_ALIGN(n, T)  ((n) + _Alignof(T)-1 - ((n) + _Alignof(T)-1) % _Alignof(T))
 
@@ -128,6 +162,10 @@ typedef struct dhBucketEntry {
 #  define MAX(x, y) ((x) >= (y) ? (x) : (y))
 #endif
 
+#ifndef MIN
+#  define MIN(x, y) ((x) <= (y) ? (x) : (y))
+#endif
+
 
 
 // ******************** Prime modulus tables ********************
@@ -295,6 +333,193 @@ static inline dhBucketIndex next_bucket(dhash *hash, dhBucketIndex b) {
 
 
 
+#ifdef DH_USE_SWISS_TABLE
+// ******************** Group probing ********************
+
+#if defined __SSE2__
+#  include <emmintrin.h>
+#  define GROUP_SLOT_BITS 1
+#elif defined __ARM_NEON
+#  include <arm_neon.h>
+#  define GROUP_SLOT_BITS 4
+#else
+#  define GROUP_SLOT_BITS 1
+#endif
+
+// Bit mask of matching slots in a group with GROUP_SLOT_BITS for each slot
+typedef uint64_t dhGroupMask;
+
+static inline dhGroupMask group_match(const uint8_t *group, uint8_t ctrl) {
+#if defined __SSE2__
+  __m128i g = _mm_loadu_si128((const __m128i *)group);
+  return (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)ctrl)));
+
+#elif defined __ARM_NEON
+  // Narrow the byte compare result into a nibble per slot
+  uint8x16_t eq = vceqq_u8(vld1q_u8(group), vdupq_n_u8(ctrl));
+  uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+  return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0) & 0x8888888888888888ULL;
+
+#else
+  dhGroupMask mask = 0;
+  for(int i = 0; i < GROUP_WIDTH; i++) {
+    if(group[i] == ctrl)
+      mask |= 1u << i;
+  }
+  return mask;
+#endif
+}
+
+
+#if (defined __GNUC__ && __GNUC__ >= 4) || (defined __clang__ && __clang_major__ >= 5)
+#  define HAVE_BUILTIN_CTZ
+#endif
+
+// Index of the lowest matching slot in a non-zero mask
+static inline int group_first_slot(dhGroupMask mask) {
+#ifdef HAVE_BUILTIN_CTZ
+  return __builtin_ctzll(mask) / GROUP_SLOT_BITS;
+#else
+  int n = 0;
+  while(!(mask & 1)) {
+    mask >>= 1;
+    n++;
+  }
+  return n / GROUP_SLOT_BITS;
+#endif
+}
+
+#define GROUP_NEXT_MATCH(mask)  ((mask) &= (mask) - 1)
+
+
+// Number of groups that covers every bucket
+static inline dhBucketIndex max_group_probes(dhash *hash) {
+  return (hash->num_buckets + GROUP_WIDTH-1) / GROUP_WIDTH;
+}
+
+// Bucket index of a slot in the group starting at bucket b
+static inline dhBucketIndex group_bucket(dhash *hash, dhBucketIndex b, int slot) {
+  b += slot;
+  while(b >= hash->num_buckets)
+    b -= hash->num_buckets;
+
+  return b;
+}
+
+static inline dhBucketIndex next_group(dhash *hash, dhBucketIndex b) {
+  return group_bucket(hash, b, GROUP_WIDTH);
+}
+
+
+// Update the fingerprint for a bucket and its mirror past the end of the array
+static inline void dh__set_ctrl(dhash *hash, dhBucketIndex b, uint8_t ctrl) {
+  size_t ctrl_size = CTRL_SIZE(hash->num_buckets);
+
+  for(size_t i = b; i < ctrl_size; i += hash->num_buckets) {
+    hash->ctrl[i] = ctrl;
+  }
+}
+#endif // DH_USE_SWISS_TABLE
+
+
+
+// ******************** Concurrent access ********************
+
+// Items and bucket arrays that may still be seen by a concurrent reader are
+// held in a list until dh_reclaim().
+typedef struct dhRetired {
+  struct dhRetired *next;
+  void     *buckets;    // Old bucket array or NULL for a removed item
+  dhKey     key;
+  uintptr_t value_obj[];
+} dhRetired;
+
+// Position of a lockless reader
+typedef struct dhReader dhReader;
+
+#ifdef DH_USE_CONCURRENT
+struct dhReader {
+  dhash    *live;   // Hash being read from a snapshot
+  unsigned  seq;
+};
+
+// Writers hold the lock and keep seq odd while they change the table. Readers
+// retry when seq was odd or changed over their search.
+static inline void dh__write_begin(dhash *hash) {
+  while(atomic_exchange_explicit(&hash->write_lock, true, memory_order_acquire)) {}
+
+  unsigned seq = atomic_load_explicit(&hash->seq, memory_order_relaxed);
+  atomic_store_explicit(&hash->seq, seq+1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+}
+
+static inline void dh__write_end(dhash *hash) {
+  unsigned seq = atomic_load_explicit(&hash->seq, memory_order_relaxed);
+  atomic_store_explicit(&hash->seq, seq+1, memory_order_release);
+  atomic_store_explicit(&hash->write_lock, false, memory_order_release);
+}
+
+static inline unsigned dh__read_begin(dhash *hash) {
+  unsigned seq;
+  while((seq = atomic_load_explicit(&hash->seq, memory_order_acquire)) & 1) {}
+  return seq;
+}
+
+static inline bool dh__read_valid(dhash *hash, unsigned seq) {
+  atomic_thread_fence(memory_order_acquire);
+  return atomic_load_explicit(&hash->seq, memory_order_relaxed) == seq;
+}
+
+#  define WRITE_BEGIN(h)  do { if((h)->concurrent) dh__write_begin(h); } while(0)
+#  define WRITE_END(h)    do { if((h)->concurrent) dh__write_end(h); } while(0)
+#else
+#  define WRITE_BEGIN(h)
+#  define WRITE_END(h)
+#endif
+
+
+// Get a retired list node before changing the table so a failed allocation
+// leaves it intact. The node is NULL for non-concurrent hashes.
+static inline bool dh__retire_prep(dhash *hash, size_t value_size, dhRetired **node) {
+  *node = NULL;
+#ifdef DH_USE_CONCURRENT
+  if(hash->concurrent) {
+    *node = dh__malloc(sizeof(dhRetired) + value_size);
+    return *node != NULL;
+  }
+#endif
+  return true;
+}
+
+// Destroy an item now or hold it until dh_reclaim() when a node is provided
+static inline void dh__destroy_item(dhash *hash, dhKey key, void *value_obj, dhRetired *node) {
+#ifdef DH_USE_CONCURRENT
+  if(node) {
+    node->key = key;
+    memcpy(node->value_obj, value_obj, hash->value_size);
+    node->next = hash->retired;
+    hash->retired = node;
+    return;
+  }
+#endif
+  hash->destroy_item(key, value_obj, hash->ctx);
+}
+
+// Free a bucket array now or hold it until dh_reclaim() when a node is provided
+static inline void dh__free_buckets(dhash *hash, void *buckets, dhRetired *node) {
+#ifdef DH_USE_CONCURRENT
+  if(node) {
+    node->buckets = buckets;
+    node->next = hash->retired;
+    hash->retired = node;
+    return;
+  }
+#endif
+  dh__free(buckets);
+}
+
+
+
 // ******************** Resource management ********************
 
 
@@ -313,6 +538,22 @@ static inline dhBucketEntry *dh__get_entry(dhash *hash, dhBucketIndex b) {
 }
 
 
+#ifdef DH_USE_INCREMENTAL_GROW
+// Set up a hash view that searches the old bucket array of a grow in progress
+static inline void dh__old_view(dhash *hash, dhash *view) {
+  memcpy(view, hash, offsetof(dhash, static_buckets));
+  view->buckets     = hash->old_buckets;
+  view->num_buckets = hash->old_num_buckets;
+#  ifndef DH_USE_2X_GROWTH
+  view->prime_ix    = hash->old_prime_ix;
+#  endif
+#  ifdef DH_USE_SWISS_TABLE
+  view->ctrl        = hash->old_ctrl;
+#  endif
+}
+#endif
+
+
 // Allocate new bucket array 
 static bool dh__alloc_buckets(dhash *hash, size_t new_num_buckets) {
 
@@ -325,9 +566,9 @@ static bool dh__alloc_buckets(dhash *hash, size_t new_num_buckets) {
   new_num_buckets = MAX(new_num_buckets, (size_t)DH_MIN_BUCKETS);
 
   size_t bucket_size = sizeof(dhBucketEntry) + hash->value_size;
-  size_t new_size = new_num_buckets * bucket_size;
+  size_t new_size = BUCKETS_SIZE(new_num_buckets, bucket_size);
 
-  if(new_size / bucket_size != new_num_buckets) // Overflow in new_size
+  if(BUCKETS_IN(new_size, bucket_size) != new_num_buckets) // Overflow in new_size
     return false;
 
   void *new_buckets = dh__malloc(new_size); // calloc() wrapper so already zeroed
@@ -336,6 +577,9 @@ static bool dh__alloc_buckets(dhash *hash, size_t new_num_buckets) {
 //    printf("## ALLOC BKT:  %u  sz:%u\n", new_num_buckets, bucket_size);
     hash->num_buckets = new_num_buckets;
     hash->buckets = new_buckets;
+#ifdef DH_USE_SWISS_TABLE
+    hash->ctrl = (uint8_t *)new_buckets + new_num_buckets * bucket_size;
+#endif
 
     return true;
   }
@@ -360,9 +604,13 @@ static inline bool dh__init(dhash *hash, dhConfig *config, void *ctx, bool new_h
   // Bucket entries need to stay aligned so we pad out the value object
   size_t value_size = ROUND_UP_ALIGN(config->value_size, uintptr_t);
 
+  // External storage must fit the smallest hash
+  if(new_hash && config->ext_storage && config->max_storage < dh_storage_size(0, config->value_size))
+    return false;
+
   // Restrict memory usage
   if(config->max_storage > 0 && !config->ext_storage) {
-    size_t max_buckets = config->max_storage / (sizeof(dhBucketEntry) + value_size);
+    size_t max_buckets = BUCKETS_IN(config->max_storage, sizeof(dhBucketEntry) + value_size);
 
     if((size_t)num_buckets > max_buckets)
       return false;
@@ -397,7 +645,10 @@ static inline bool dh__init(dhash *hash, dhConfig *config, void *ctx, bool new_h
       .gen_hash     = config->gen_hash,
       .is_equal     = config->is_equal,
       .replace_item = config->replace_item,
-      .grow_hash    = config->grow_hash
+      .grow_hash    = config->grow_hash,
+#ifdef DH_USE_CONCURRENT
+      .concurrent   = config->concurrent
+#endif
     };
 
     if(config->ext_storage) {
@@ -406,7 +657,7 @@ static inline bool dh__init(dhash *hash, dhConfig *config, void *ctx, bool new_h
       hash->buckets = config->ext_storage;
 
       size_t bucket_size = sizeof(dhBucketEntry) + value_size;
-      size_t ext_buckets = config->max_storage / bucket_size;
+      size_t ext_buckets = BUCKETS_IN(config->max_storage, bucket_size);
 
       // Set largest bucket count for our growth scheme
 #ifndef DH_USE_2X_GROWTH
@@ -414,6 +665,9 @@ static inline bool dh__init(dhash *hash, dhConfig *config, void *ctx, bool new_h
       hash->num_buckets = get_prime(hash->prime_ix);
 #else
       hash->num_buckets = prev_po2(ext_buckets);
+#endif
+#ifdef DH_USE_SWISS_TABLE
+      hash->ctrl = (uint8_t *)hash->buckets + (size_t)hash->num_buckets * bucket_size;
 #endif
       hash->static_buckets = true;
 
@@ -438,6 +692,9 @@ static inline bool dh__init(dhash *hash, dhConfig *config, void *ctx, bool new_h
   }
 
   hash->used_buckets = 0;
+#ifdef DH_USE_SWISS_TABLE
+  hash->deleted_buckets = 0;
+#endif
   return true;
 }
 
@@ -457,6 +714,11 @@ bool dh_init(dhash *hash, dhConfig *config, void *ctx) {
   if(!hash || !config || !config->destroy_item || !config->gen_hash || !config->is_equal)
     return false;
 
+#ifndef DH_USE_CONCURRENT
+  if(config->concurrent)  // Not built with support
+    return false;
+#endif
+
   return dh__init(hash, config, ctx, /*new_hash*/true);
 }
 
@@ -472,6 +734,28 @@ Args:
 void dh_free(dhash *hash) {
   dhBucketEntry *entry;
 
+  dh_reclaim(hash);
+
+#ifdef DH_USE_INCREMENTAL_GROW
+  if(hash->old_buckets) { // Entries from a grow in progress
+    dhash old;
+    dh__old_view(hash, &old);
+
+    for(dhBucketIndex b = 0; b < old.num_buckets; b++) {
+      entry = dh__get_entry_unsafe(&old, b);
+
+      if(IN_USE(entry) && !WAS_DELETED(entry))
+        hash->destroy_item(entry->key, &entry->value_obj, hash->ctx);
+    }
+
+    dh__free(hash->old_buckets);
+    dh__free(hash->old_node);
+    hash->old_buckets = NULL;
+    hash->old_node = NULL;
+    hash->old_used = 0;
+  }
+#endif
+
   if(!hash->buckets)
     return;
 
@@ -492,10 +776,49 @@ void dh_free(dhash *hash) {
     dh__free(hash->buckets);
 
   hash->buckets = NULL;
+#ifdef DH_USE_SWISS_TABLE
+  hash->ctrl = NULL;
+#endif
   hash->num_buckets = 0;
 }
 
 
+/*
+Release items and bucket arrays retired by a concurrent hash
+
+Removed and replaced items are destroyed and old bucket arrays are freed. The
+caller must ensure no dh_lookup() or dh_lookup_in_place() calls that started
+before now are still running and that no pointers from dh_lookup_in_place()
+are in use. This does nothing for hashes without the concurrent option.
+
+Args:
+  hash: Hash to reclaim memory from
+*/
+void dh_reclaim(dhash *hash) {
+#ifdef DH_USE_CONCURRENT
+  if(!hash->concurrent)
+    return;
+
+  WRITE_BEGIN(hash);
+  dhRetired *node = hash->retired;
+  hash->retired = NULL;
+  WRITE_END(hash);
+
+  while(node) {
+    dhRetired *next = node->next;
+
+    if(node->buckets)
+      dh__free(node->buckets);
+    else
+      hash->destroy_item(node->key, &node->value_obj, hash->ctx);
+
+    dh__free(node);
+    node = next;
+  }
+#endif
+}
+
+
 
 // Hash for integer key probes
 // This is applied on top of any user supplied hash function
@@ -640,11 +963,32 @@ bool dh_equal_hash_keys_int(dhKey key1, dhKey key2, void *ctx) {
 // ******************** Retrieval ********************
 
 
+// Compare the key in a bucket with a search key
+// Concurrent readers only pass a copy of the bucket key to is_equal() after
+// checking that it wasn't torn by a writer.
+// Returns 1 on match, 0 on mismatch, or DH_ERR_RETRY if a writer intervened
+static inline int dh__match_key(dhash *hash, dhBucketEntry *entry, dhKey key,
+                                const dhReader *reader) {
+#ifdef DH_USE_CONCURRENT
+  if(reader) {
+    dhKey entry_key = entry->key;
+    if(!dh__read_valid(reader->live, reader->seq))
+      return DH_ERR_RETRY;
+
+    return hash->is_equal(entry_key, key, hash->ctx);
+  }
+#endif
+  return hash->is_equal(entry->key, key, hash->ctx);
+}
+
+
 // Search for a bucket with a given key
 // Returns DH_ERR_KEY_NOT_FOUND if the key was not found
 //         DH_ERR_TOO_MANY_PROBES if probe count exceeded
-static inline dhBucketIndex dh__find_bucket(dhash *hash, dhKey key, dhBucketEntry **found_entry) {
-  dhIKey ikey = dh__hash(hash, key);
+//         DH_ERR_RETRY if a concurrent reader must start over
+#ifndef DH_USE_SWISS_TABLE
+static inline dhBucketIndex dh__find_bucket_ex(dhash *hash, dhKey key, dhIKey ikey,
+                                               const dhReader *reader, dhBucketEntry **found_entry) {
   dhBucketIndex b = dh__initial_probe(hash, ikey);
   dhBucketEntry *entry = dh__get_entry_unsafe(hash, b);
   uint16_t probes = 1;
@@ -655,15 +999,19 @@ static inline dhBucketIndex dh__find_bucket(dhash *hash, dhKey key, dhBucketEntr
     if(!IN_USE(entry) || (probes > PROBE_COUNT(entry))) {
       return DH_ERR_KEY_NOT_FOUND; // Key not found, invalid bucket
 
-    } else if(!WAS_DELETED(entry) &&
+    } else if(!WAS_DELETED(entry)
 #ifdef DH_USE_MEMOIZED_HASH
-              entry->ikey == ikey && 
+              && entry->ikey == ikey
 #endif
-                                     hash->is_equal(entry->key, key, hash->ctx)) {
-      // Key match found
-      *found_entry = entry;
-      return b;
-    } 
+              ) {
+      int match = dh__match_key(hash, entry, key, reader);
+      if(match == 1) { // Key match found
+        *found_entry = entry;
+        return b;
+      } else if(match < 0) {
+        return DH_ERR_RETRY;
+      }
+    }
 
 
     b = next_bucket(hash, b);
@@ -677,6 +1025,112 @@ static inline dhBucketIndex dh__find_bucket(dhash *hash, dhKey key, dhBucketEntr
   return DH_ERR_KEY_NOT_FOUND;
 }
 
+#else // Swiss table
+static inline dhBucketIndex dh__find_bucket_ex(dhash *hash, dhKey key, dhIKey ikey,
+                                               const dhReader *reader, dhBucketEntry **found_entry) {
+  dhBucketIndex b = dh__initial_probe(hash, ikey);
+  dhBucketIndex max_groups = max_group_probes(hash);
+  uint8_t fingerprint = CTRL_FULL(ikey);
+
+  *found_entry = NULL;
+
+  for(dhBucketIndex g = 0; g < max_groups; g++) {
+    const uint8_t *group = &hash->ctrl[b];
+
+    // Only entries with a matching fingerprint are accessed
+    dhGroupMask match = group_match(group, fingerprint);
+    while(match) {
+      dhBucketIndex mb = group_bucket(hash, b, group_first_slot(match));
+      dhBucketEntry *entry = dh__get_entry_unsafe(hash, mb);
+
+      if(entry->ikey == ikey) {
+        int key_match = dh__match_key(hash, entry, key, reader);
+        if(key_match == 1) {
+          *found_entry = entry;
+          return mb;
+        } else if(key_match < 0) {
+          return DH_ERR_RETRY;
+        }
+      }
+
+      GROUP_NEXT_MATCH(match);
+    }
+
+    // Insertion never passes a group with an empty bucket
+    if(group_match(group, CTRL_EMPTY))
+      return DH_ERR_KEY_NOT_FOUND;
+
+    b = next_group(hash, b);
+  }
+
+  return DH_ERR_KEY_NOT_FOUND;
+}
+
+#endif
+
+static inline dhBucketIndex dh__find_bucket(dhash *hash, dhKey key, dhBucketEntry **found_entry) {
+  return dh__find_bucket_ex(hash, key, dh__hash(hash, key), NULL, found_entry);
+}
+
+
+// Search for a key in the bucket array and any old array not yet moved
+static inline dhBucketIndex dh__find_bucket_all(dhash *hash, dhKey key, dhIKey ikey,
+                                                const dhReader *reader, dhBucketEntry **found_entry) {
+  dhBucketIndex b = dh__find_bucket_ex(hash, key, ikey, reader, found_entry);
+
+#ifdef DH_USE_INCREMENTAL_GROW
+  if(!*found_entry && b != DH_ERR_RETRY && hash->old_buckets) {
+    dhash old;
+    dh__old_view(hash, &old);
+    b = dh__find_bucket_ex(&old, key, ikey, reader, found_entry);
+  }
+#endif
+
+  return b;
+}
+
+
+#ifdef DH_USE_CONCURRENT
+// Search a concurrent hash without taking the write lock
+// The table geometry is copied into a snapshot so a grow can't leave us with
+// a mismatched bucket array and size. Old arrays stay allocated until
+// dh_reclaim() so the snapshot is always safe to read. Any overlap with a
+// writer is detected by the sequence counter and the search is repeated.
+// The geometry, buckets, keys, and values are read with plain loads on
+// purpose. This is a seqlock so a read racing a writer may see torn data but
+// nothing from it is used until the sequence check passes. Only the copied
+// bucket key is passed to is_equal() and only after it has been validated.
+// ThreadSanitizer reports these reads as races.
+static bool dh__lookup_concurrent(dhash *hash, dhKey key, void *value, void **value_ptr) {
+  dhash snap;
+  dhReader reader = {.live = hash};
+  dhIKey ikey = dh__hash(hash, key);
+
+  while(1) {
+    reader.seq = dh__read_begin(hash);
+    memcpy(&snap, hash, offsetof(dhash, concurrent));
+    if(!dh__read_valid(hash, reader.seq))
+      continue;
+
+    dhBucketEntry *entry = NULL;
+    if(dh__find_bucket_all(&snap, key, ikey, &reader, &entry) == DH_ERR_RETRY)
+      continue;
+
+    bool found = entry && !WAS_DELETED(entry);
+    if(found && value)
+      memcpy(value, &entry->value_obj, snap.value_size);
+
+    if(!dh__read_valid(hash, reader.seq))
+      continue;
+
+    if(value_ptr)
+      *value_ptr = found ? &entry->value_obj : NULL;
+
+    return found;
+  }
+}
+#endif
+
 
 /*
 Search for a hash entry
@@ -684,6 +1138,9 @@ Search for a hash entry
 Entry data is copied into the value destination. This is the safest
 lookup method as you are not granted a pointer into the dhash data structure.
 
+This can run alongside writers on a hash configured as concurrent. The search
+is repeated when a writer changes the table under it.
+
 Args:
   hash:   Hash to search
   key:    Key to search
@@ -693,9 +1150,13 @@ Returns:
   true if item exists and non-NULL in value
 */
 bool dh_lookup(dhash *hash, dhKey key, void *value) {
+#ifdef DH_USE_CONCURRENT
+  if(hash->concurrent)
+    return dh__lookup_concurrent(hash, key, value, NULL);
+#endif
 
   dhBucketEntry *entry = NULL;
-  dh__find_bucket(hash, key, &entry);
+  dh__find_bucket_all(hash, key, dh__hash(hash, key), NULL, &entry);
   //dhBucketIndex b = dh__find_bucket(hash, key, &entry);
   //printf("## GOT BUCKET: %d\n", b);
 
@@ -716,6 +1177,9 @@ This version of dh_lookup() returns a direct pointer to the bucket value data
 rather than a copy. Never save the pointer returned for the value since it
 will become invalid when the dhash grows or the entry is removed.
 
+On a concurrent hash the pointer stays valid until dh_reclaim() but the value
+can be changed by a writer while it is being read.
+
 Args:
   hash:   Hash to search
   key:    Key to search
@@ -725,9 +1189,13 @@ Returns:
   true if item exists and non-NULL in value
 */
 bool dh_lookup_in_place(dhash *hash, dhKey key, void **value) {
+#ifdef DH_USE_CONCURRENT
+  if(hash->concurrent)
+    return dh__lookup_concurrent(hash, key, NULL, value);
+#endif
 
   dhBucketEntry *entry = NULL;
-  dh__find_bucket(hash, key, &entry);
+  dh__find_bucket_all(hash, key, dh__hash(hash, key), NULL, &entry);
   //printf("## GOT BUCKET: %d\n", b);
 
   if(entry && !WAS_DELETED(entry)) { // Found match
@@ -762,6 +1230,29 @@ static inline void swap_values(uintptr_t * restrict v1, uintptr_t * restrict v2,
 }
 
 
+// Update the value for a key that is already in the hash
+static inline bool dh__replace_value(dhash *hash, dhBucketEntry *entry, dhKey key, void *value) {
+  dhRetired *old_item;
+  if(!dh__retire_prep(hash, hash->value_size, &old_item))
+    return false;
+
+  bool replace_ok = true;
+  if(hash->replace_item)
+    replace_ok = hash->replace_item(entry->key, &entry->value_obj, value, hash->ctx);
+
+  if(!replace_ok) {
+    dh__free(old_item);
+    return false;
+  }
+
+  dh__destroy_item(hash, entry->key, &entry->value_obj, old_item);
+  entry->key = key;
+  memcpy(&entry->value_obj, value, hash->value_size);
+  return true;
+}
+
+
+#ifndef DH_USE_SWISS_TABLE
 static inline bool dh__insert_ex(dhash *hash, dhKey key, void *value, dhIKey ikey) {
   dhBucketEntry titem;
   dhBucketEntry *entry;
@@ -794,17 +1285,7 @@ static inline bool dh__insert_ex(dhash *hash, dhKey key, void *value, dhIKey ike
 #endif
                                 hash->is_equal(entry->key, key, hash->ctx)) {
        // Match to existing key: Replace value
-      bool replace_ok = true;
-      if(hash->replace_item)
-        replace_ok = hash->replace_item(entry->key, &entry->value_obj, value, hash->ctx);
-
-      if(!replace_ok)
-        return false;
-
-      hash->destroy_item(entry->key, &entry->value_obj, hash->ctx);
-      entry->key = key;
-      memcpy(&entry->value_obj, value, hash->value_size);
-      return true;
+      return dh__replace_value(hash, entry, key, value);
     }
 
     if(PROBE_COUNT(entry) < probes) {
@@ -854,6 +1335,48 @@ static inline bool dh__insert_ex(dhash *hash, dhKey key, void *value, dhIKey ike
 
 }
 
+#else // Swiss table
+static inline bool dh__insert_ex(dhash *hash, dhKey key, void *value, dhIKey ikey) {
+  dhBucketEntry *entry;
+
+  // Replace value on an existing key
+  dh__find_bucket_ex(hash, key, ikey, NULL, &entry);
+  if(entry)
+    return dh__replace_value(hash, entry, key, value);
+
+  // Add new entry in the first empty or deleted bucket
+  dhBucketIndex b = dh__initial_probe(hash, ikey);
+  dhBucketIndex max_groups = max_group_probes(hash);
+
+  for(dhBucketIndex g = 0; g < max_groups; g++) {
+    const uint8_t *group = &hash->ctrl[b];
+
+    dhGroupMask avail = group_match(group, CTRL_EMPTY) | group_match(group, CTRL_DELETED);
+    if(avail) {
+      b = group_bucket(hash, b, group_first_slot(avail));
+      entry = dh__get_entry_unsafe(hash, b);
+
+      if(hash->ctrl[b] == CTRL_DELETED)
+        hash->deleted_buckets--;
+
+      entry->ikey = ikey;
+      entry->key  = key;
+      memcpy(&entry->value_obj, value, hash->value_size);
+
+      CLEAR_DELETED(entry);
+      SET_PROBE_COUNT(entry, g < (dhBucketIndex)MAX_PROBE_COUNT ? g+1 : (dhBucketIndex)MAX_PROBE_COUNT);
+      dh__set_ctrl(hash, b, CTRL_FULL(ikey));
+      hash->used_buckets++;
+      return true;
+    }
+
+    b = next_group(hash, b);
+  }
+
+  return false;
+}
+#endif
+
 
 // Insert without existing ikey
 static inline bool dh__insert(dhash *hash, dhKey key, void *value) {
@@ -862,22 +1385,115 @@ static inline bool dh__insert(dhash *hash, dhKey key, void *value) {
 
 
 
+#ifdef DH_USE_INCREMENTAL_GROW
+// ******************** Incremental grow ********************
+
+// Move one entry from the old bucket array into the new one
+// A tombstone is left behind so the probe chains of the entries still in the
+// old array stay intact for lookups.
+static inline void dh__migrate_entry(dhash *hash, dhash *old, dhBucketEntry *item, dhBucketIndex b) {
+#  ifdef DH_USE_MEMOIZED_HASH
+  dh__insert_ex(hash, item->key, &item->value_obj, item->ikey); // Skip rehash of key
+#  else
+  dh__insert(hash, item->key, &item->value_obj);
+#  endif
+
+  SET_DELETED(item);
+#  ifdef DH_USE_SWISS_TABLE
+  dh__set_ctrl(old, b, CTRL_DELETED);
+#  endif
+  hash->old_used--;
+}
+
+
+// Move entries from the next steps buckets of the old array
+// The old array is released once it is empty.
+static void dh__migrate_step(dhash *hash, dhBucketIndex steps) {
+  dhash old;
+  dh__old_view(hash, &old);
+
+  steps = MIN(steps, hash->old_num_buckets - hash->migrate_pos);
+  dhBucketIndex end = hash->migrate_pos + steps;
+
+  for(; hash->migrate_pos < end && hash->old_used > 0; hash->migrate_pos++) {
+    dhBucketEntry *item = dh__get_entry_unsafe(&old, hash->migrate_pos);
+
+    if(IN_USE(item) && !WAS_DELETED(item))
+      dh__migrate_entry(hash, &old, item, hash->migrate_pos);
+  }
+
+  if(hash->old_used == 0 || hash->migrate_pos >= hash->old_num_buckets) {
+    dh__free_buckets(hash, hash->old_buckets, hash->old_node);
+    hash->old_buckets = NULL;
+    hash->old_node    = NULL;
+    hash->old_used    = 0;
+  }
+}
+
+
+// Finish a grow in progress
+static inline void dh__migrate_all(dhash *hash) {
+  if(hash->old_buckets)
+    dh__migrate_step(hash, hash->old_num_buckets);
+}
+
+
+// Continue a grow in progress on each write
+// The key being written is moved first so it is only ever in one array.
+static inline void dh__migrate(dhash *hash, dhKey key, dhIKey ikey) {
+  if(!hash->old_buckets)
+    return;
+
+  dhash old;
+  dh__old_view(hash, &old);
+
+  dhBucketEntry *item;
+  dhBucketIndex b = dh__find_bucket_ex(&old, key, ikey, NULL, &item);
+  if(item)
+    dh__migrate_entry(hash, &old, item, b);
+
+  dh__migrate_step(hash, hash->migrate_step);
+}
+#endif // DH_USE_INCREMENTAL_GROW
+
+
+
 // Expand size of hash bucket array
-static inline bool dh__grow(dhash *hash, dhBucketIndex new_buckets) {
+// With DH_USE_INCREMENTAL_GROW an incremental grow leaves the old entries to be
+// moved on later writes.
+static inline bool dh__grow(dhash *hash, dhBucketIndex new_buckets, bool incremental) {
   if(hash->static_buckets)
     return false;
 
+#ifdef DH_USE_INCREMENTAL_GROW
+  dh__migrate_all(hash); // Finish any previous grow
+#endif
+
   dhBucketIndex num_old_buckets = hash->num_buckets;
 
-  if(new_buckets <= num_old_buckets)
+  if(new_buckets < num_old_buckets || new_buckets == 0)
     new_buckets = num_old_buckets+1; // This will round up to the next prime size
 
   //printf("## GROW HASH: %lu\n", new_buckets);
 
+  dhRetired *old_node;
+  if(!dh__retire_prep(hash, 0, &old_node))
+    return false;
+
   // Disconnect bucket array so we can restore it if grow fails
   dhBucketEntry *old_buckets = hash->buckets;
   hash->buckets = NULL;
 
+#ifdef DH_USE_INCREMENTAL_GROW
+  dhBucketIndex old_used = hash->used_buckets;
+#  ifndef DH_USE_2X_GROWTH
+  dhBucketIndex old_prime_ix = hash->prime_ix;
+#  endif
+#  ifdef DH_USE_SWISS_TABLE
+  uint8_t *old_ctrl = hash->ctrl;
+#  endif
+#endif
+
   dhConfig cfg = {
     .init_buckets = new_buckets,
     .value_size   = hash->value_size,
@@ -892,6 +1508,7 @@ static inline bool dh__grow(dhash *hash, dhBucketIndex new_buckets) {
   // Grow to next prime size
   if(!dh__init(hash, &cfg, hash->ctx, /*new_hash*/false)) {
     hash->buckets = old_buckets; // Restore and abort attempt to grow
+    dh__free(old_node);
     printf("\t Hash grow failed\n");
     return false;
   }
@@ -899,6 +1516,28 @@ static inline bool dh__grow(dhash *hash, dhBucketIndex new_buckets) {
 //  printf("## GROW: %lu %u + %u -> %u\n", hash->num_buckets, hash->value_size, 
 //    sizeof(dhBucketEntry), sizeof(dhBucketEntry) + hash->value_size);
 
+#ifdef DH_USE_INCREMENTAL_GROW
+  if(incremental) {
+    hash->old_buckets     = old_buckets;
+    hash->old_num_buckets = num_old_buckets;
+#  ifndef DH_USE_2X_GROWTH
+    hash->old_prime_ix    = old_prime_ix;
+#  endif
+#  ifdef DH_USE_SWISS_TABLE
+    hash->old_ctrl        = old_ctrl;
+#  endif
+    hash->old_used        = old_used;
+    hash->old_node        = old_node;
+    hash->migrate_pos     = 0;
+
+    // Pace the move to finish before half of the free space is used up
+    dhBucketIndex free_buckets = MAX_LOAD_FACTOR(hash->num_buckets) - old_used;
+    hash->migrate_step = num_old_buckets / MAX(free_buckets / 2, 1) + 1;
+    hash->migrate_step = MAX(hash->migrate_step, MIN_MIGRATE_STEP);
+    return true;
+  }
+#endif
+
   // Copy old items
   size_t bkt_off = 0;
   for(dhBucketIndex b = 0; b < num_old_buckets; b++) {
@@ -917,60 +1556,84 @@ static inline bool dh__grow(dhash *hash, dhBucketIndex new_buckets) {
     bkt_off += sizeof(dhBucketEntry) + hash->value_size;
   }
 
-  dh__free(old_buckets);
+  dh__free_buckets(hash, old_buckets, old_node);
   return true;
 }
 
 
 
-/*
-Add a new hash entry
-
-If the key already exists the configured destroy_item callback will be
-called with the old value and then replaced with the new value.
-
-Args:
-  hash:   Hash to insert into
-  key:    Key for new value
-  value:  value object to associate with the key
+// Insert with writers already excluded, growing the hash if needed
+static inline bool dh__insert_checked(dhash *hash, dhKey key, void *value) {
+  dhIKey ikey = dh__hash(hash, key);
 
-Returns:
-  true on success
-*/
-bool dh_insert(dhash *hash, dhKey key, void *value) {
   // Check if we have too much load
   dhBucketIndex max_buckets = MAX_LOAD_FACTOR(hash->num_buckets); // ~ 90%
+  dhBucketIndex num_items = dh_num_items(hash);
+
+#ifdef DH_USE_SWISS_TABLE
+  // Tombstones lengthen probes until they are cleared by a rehash. Keep the same
+  // size when they make up most of the load.
+  if(!hash->static_buckets && num_items < max_buckets &&
+      hash->used_buckets + hash->deleted_buckets >= max_buckets) {
+    if(!dh__grow(hash, num_items < max_buckets/2 ? hash->num_buckets : 0, /*incremental*/true))
+      return false;
+  }
+#endif
 
-  if(hash->used_buckets >= max_buckets) { // Load is too high
+  if(num_items >= max_buckets) { // Load is too high
     //printf("#### REHASH %d\n", hash->used_buckets);
     //dh_dump(hash);
-    if(!dh__grow(hash, 0)) return false;
+    if(!dh__grow(hash, 0, /*incremental*/true)) return false;
   }
 
-  return dh__insert(hash, key, value);
-}
+#ifdef DH_USE_INCREMENTAL_GROW
+  // A grow moves everything into the old array so this comes after it
+  dh__migrate(hash, key, ikey);
+#endif
 
+  return dh__insert_ex(hash, key, value, ikey);
+}
 
 
 /*
-Remove a hash entry
+Add a new hash entry
 
-If the value parameter is provided the removed entry is returned.
-Otherwise it is destroyed via the destroy_item() callback.
+If the key already exists the configured destroy_item callback will be
+called with the old value and then replaced with the new value. On a
+concurrent hash the old value is destroyed by dh_reclaim().
 
 Args:
-  hash:   Hash to remove from
-  key:    Key for item to remove
-  value:  Optional found value matching the key on success
+  hash:   Hash to insert into
+  key:    Key for new value
+  value:  value object to associate with the key
 
 Returns:
   true on success
 */
-bool dh_remove(dhash *hash, dhKey key, void *value) {
+bool dh_insert(dhash *hash, dhKey key, void *value) {
+  WRITE_BEGIN(hash);
+  bool status = dh__insert_checked(hash, key, value);
+  WRITE_END(hash);
+  return status;
+}
+
+
+
+// Remove an entry with writers already excluded
+static inline bool dh__remove(dhash *hash, dhKey key, void *value) {
+#ifdef DH_USE_INCREMENTAL_GROW
+  if(hash->old_buckets)
+    dh__migrate(hash, key, dh__hash(hash, key));
+#endif
+
   dhBucketEntry *entry = NULL;
-  dh__find_bucket(hash, key, &entry);
+  dhBucketIndex b = dh__find_bucket(hash, key, &entry);
 
   if(entry) { // Bucket found with matching key
+    dhRetired *old_item = NULL;
+    if(!value && !dh__retire_prep(hash, hash->value_size, &old_item))
+      return false;
+
     // Return removed value if caller wants to manage it, otherwise destroy it
     // after we finish internal bookkeeping.
     if(value)
@@ -982,15 +1645,39 @@ bool dh_remove(dhash *hash, dhKey key, void *value) {
     entry->key.data = NULL;
     entry->key.length = 0;
 
-    // We need to preserve the probe count so turn this into a tombstone
+    // Turn this into a tombstone. Robin Hood chains are shifted back over it below.
     SET_DELETED(entry);
     hash->used_buckets--;
+#ifdef DH_USE_SWISS_TABLE
+    dh__set_ctrl(hash, b, CTRL_DELETED); // Lookups must continue past this bucket
+    hash->deleted_buckets++;
+#endif
 
     if(!value)
-      hash->destroy_item(entry->key, &entry->value_obj, hash->ctx);
+      dh__destroy_item(hash, entry->key, &entry->value_obj, old_item);
 
     memset(&entry->value_obj, 0, hash->value_size);
 
+#ifndef DH_USE_SWISS_TABLE
+    // A tombstone reused by a key with a shorter probe sequence would end lookups
+    // early for the keys after it. Shift the rest of the chain back over the
+    // removed entry instead so no tombstones are left behind.
+    size_t bucket_size = sizeof(dhBucketEntry) + hash->value_size;
+    dhBucketIndex next_b = next_bucket(hash, b);
+    dhBucketEntry *next_entry = dh__get_entry_unsafe(hash, next_b);
+
+    while(IN_USE(next_entry) && !WAS_DELETED(next_entry) && PROBE_COUNT(next_entry) > 1) {
+      memcpy(entry, next_entry, bucket_size);
+      SET_PROBE_COUNT(entry, PROBE_COUNT(entry) - 1);
+
+      entry = next_entry;
+      next_b = next_bucket(hash, next_b);
+      next_entry = dh__get_entry_unsafe(hash, next_b);
+    }
+
+    memset(entry, 0, bucket_size); // End of the chain is now unused
+#endif
+
     return true;
   }
 
@@ -998,6 +1685,30 @@ bool dh_remove(dhash *hash, dhKey key, void *value) {
 }
 
 
+/*
+Remove a hash entry
+
+If the value parameter is provided the removed entry is returned.
+Otherwise it is destroyed via the destroy_item() callback. On a concurrent
+hash the destroy is deferred to dh_reclaim(). Callers taking the value must
+likewise keep the key storage alive until readers are done with it.
+
+Args:
+  hash:   Hash to remove from
+  key:    Key for item to remove
+  value:  Optional found value matching the key on success
+
+Returns:
+  true on success
+*/
+bool dh_remove(dhash *hash, dhKey key, void *value) {
+  WRITE_BEGIN(hash);
+  bool status = dh__remove(hash, key, value);
+  WRITE_END(hash);
+  return status;
+}
+
+
 // ******************** Resource utilization ********************
 
 /*
@@ -1010,7 +1721,11 @@ Returns:
   Number of key/value entrys in the hash
 */
 size_t dh_num_items(dhash *hash) {
+#ifdef DH_USE_INCREMENTAL_GROW
+  return hash->used_buckets + hash->old_used;
+#else
   return hash->used_buckets;
+#endif
 }
 
 
@@ -1028,6 +1743,45 @@ size_t dh_cur_capacity(dhash *hash) {
 }
 
 
+/*
+Size of an external bucket array for a fixed number of items
+
+The result can be passed as dhConfig.max_storage with an ext_storage buffer
+of the same size. The hash will hold num_items entries without growing.
+
+Args:
+  num_items:  Number of key/value entries to support
+  value_size: Bytes per entry value
+
+Returns:
+  Bytes needed for the bucket array. 0 if num_items exceeds the largest hash.
+*/
+size_t dh_storage_size(size_t num_items, size_t value_size) {
+  size_t bucket_size = sizeof(dhBucketEntry) + ROUND_UP_ALIGN(value_size, uintptr_t);
+
+#ifndef DH_USE_2X_GROWTH
+  dhBucketIndex n = num_items;
+  if((size_t)n != num_items) return 0;
+
+  size_t prime_ix = get_closest_prime_index(n);
+  while(prime_ix < PRIME_LIST_LEN && MAX_LOAD_FACTOR((size_t)get_prime(prime_ix)) < num_items)
+    prime_ix++;
+
+  if(prime_ix >= PRIME_LIST_LEN) return 0;
+  size_t num_buckets = get_prime(prime_ix);
+
+#else
+  size_t num_buckets = num_items < 2 ? 2 : next_po2(num_items);
+  while(MAX_LOAD_FACTOR(num_buckets) < num_items)
+    num_buckets <<= 1;
+
+  if((size_t)(dhBucketIndex)num_buckets != num_buckets) return 0;
+#endif
+
+  return BUCKETS_SIZE(num_buckets, bucket_size);
+}
+
+
 /*
 Load factor of the hash table
 
@@ -1041,26 +1795,14 @@ int dh_load_factor(dhash *hash) {
   if(hash->num_buckets == 0)
     return 0;
 
-  return (hash->used_buckets * 100 + 50) / hash->num_buckets;
+  return (dh_num_items(hash) * 100 + 50) / hash->num_buckets;
 }
 
 
 
 
-/*
-Reserve extra entry space for future use
-
-This bypasses the slow growth of the bucket array when a known
-number of insertions are about to be performed.
-
-Args:
-  hash:         Hash to increase capacity
-  add_capacity: Number of additional entries to support
-
-Returns:
-  true on success
-*/
-bool dh_reserve_capacity(dhash *hash, size_t add_capacity) {
+// Grow for more entries with writers already excluded
+static inline bool dh__reserve_capacity(dhash *hash, size_t add_capacity) {
   if(add_capacity == 0)
     return true;
 
@@ -1079,7 +1821,28 @@ bool dh_reserve_capacity(dhash *hash, size_t add_capacity) {
   const size_t lfactor = MAX_LOAD_FACTOR(128UL); // Get the numerator
   size_t new_buckets = (hash_capacity + add_capacity) * 128UL / lfactor;
 
-  return dh__grow(hash, new_buckets);
+  return dh__grow(hash, new_buckets, /*incremental*/false); // Caller expects no more resizing
+}
+
+
+/*
+Reserve extra entry space for future use
+
+This bypasses the slow growth of the bucket array when a known
+number of insertions are about to be performed.
+
+Args:
+  hash:         Hash to increase capacity
+  add_capacity: Number of additional entries to support
+
+Returns:
+  true on success
+*/
+bool dh_reserve_capacity(dhash *hash, size_t add_capacity) {
+  WRITE_BEGIN(hash);
+  bool status = dh__reserve_capacity(hash, add_capacity);
+  WRITE_END(hash);
+  return status;
 }
 
 
@@ -1143,6 +1906,41 @@ int dh_max_probe_count(dhash *hash) {
 }
 
 
+/*
+Get the distribution of probe counts for the used hash buckets
+
+Args:
+  hash:       Hash to scan for probe count
+  histogram:  Array of counts. Entry i is items found after i+1 probes.
+              The last entry also collects all longer probe sequences.
+  num_bins:   Number of entries in histogram
+
+Returns:
+  Number of items counted
+*/
+size_t dh_probe_histogram(dhash *hash, size_t *histogram, size_t num_bins) {
+  size_t total = 0;
+  dhBucketIndex num_buckets = hash->num_buckets;
+  dhBucketEntry *entry;
+
+  if(num_bins == 0)
+    return 0;
+
+  memset(histogram, 0, num_bins * sizeof(*histogram));
+
+  for(dhBucketIndex b = 0; b < num_buckets; b++ ) {
+    entry = dh__get_entry_unsafe(hash, b);
+    if(!IN_USE(entry) || WAS_DELETED(entry)) continue; // Skip unused and tombstones
+
+    size_t bin = (size_t)PROBE_COUNT(entry) - 1;
+    histogram[MIN(bin, num_bins-1)]++;
+    total++;
+  }
+
+  return total;
+}
+
+
 static void dh__dump_entry(dhash *hash, dhBucketEntry *entry, dhBucketIndex b) {
     printf("  %3" PRIBkt ": k=%08" PRIX32 " v=%p (%08" PRIXPTR "), flag=%01X probes=%d init=%" PRIBkt "\n", b, 
 #ifdef DH_USE_MEMOIZED_HASH
@@ -1197,12 +1995,21 @@ void dh_dump(dhash *hash, HashVisitor print_item, void *ctx) {
 /*
 Iterate over all occupied buckets in a hash
 
+This is not protected from writers on a concurrent hash.
+
 Args:
   hash:     Hash to iterate
   visitor:  Callback for each used bucket
   ctx:      Optional user data for the callback
 */
 void dh_foreach(dhash *hash, HashVisitor visitor, void *ctx) {
+#ifdef DH_USE_INCREMENTAL_GROW
+  // Iteration is O(n) anyway so finish moving entries into one array
+  WRITE_BEGIN(hash);
+  dh__migrate_all(hash);
+  WRITE_END(hash);
+#endif
+
   dhBucketIndex num_buckets = hash->num_buckets;
   dhBucketEntry *entry;
   for(dhBucketIndex b = 0; b < num_buckets; b++) {
@@ -1220,13 +2027,20 @@ void dh_foreach(dhash *hash, HashVisitor visitor, void *ctx) {
 /*
 Start iterator for hash
 
-You must call dh_iter_next() to get the first item in the sequence
+You must call dh_iter_next() to get the first item in the sequence.
+Iteration is not protected from writers on a concurrent hash.
 
 Args:
   hash: Hash to iterate
   it:   Iterator to init
 */
 void dh_iter_init(dhash *hash, dhIter *it) {
+#ifdef DH_USE_INCREMENTAL_GROW
+  WRITE_BEGIN(hash);
+  dh__migrate_all(hash);
+  WRITE_END(hash);
+#endif
+
   it->hash = hash;
   it->bucket = 0;
   it->bucket--;
@@ -27,6 +27,11 @@ DEALINGS IN THE SOFTWARE.
 String globbing
 
   General purpose glob pattern matcher
+
+  Patterns can be compiled with glob_compile() when they will be matched
+  against many strings. Compiled patterns have their character sets parsed
+  into bitmaps and keep their leading and trailing literals so that most
+  mismatches are rejected without running the matcher.
 ------------------------------------------------------------------------------
 */
 
@@ -38,6 +43,10 @@ String globbing
 #include "util/glob.h"
 
 
+#define glob__malloc(s)     malloc(s)
+#define glob__free(p)       free(p)
+
+
 /*
 Test if a character is a member of a set
 
@@ -62,8 +71,8 @@ typedef struct {
   uint32_t chars[8]; // 256 bits
 } CharSet;
 
-#define ADD_TO_SET(cs, c)      ((cs)->chars[((uint8_t)(c)) / 32] |= (1 << ( ((uint8_t)(c)) % 32)) )
-#define CHAR_IS_IN_SET(cs, c)  ((cs)->chars[((uint8_t)(c)) / 32] & (1 << ( ((uint8_t)(c)) % 32)) )
+#define ADD_TO_SET(cs, c)      ((cs)->chars[((uint8_t)(c)) / 32] |= (1u << ( ((uint8_t)(c)) % 32)) )
+#define CHAR_IS_IN_SET(cs, c)  ((cs)->chars[((uint8_t)(c)) / 32] & (1u << ( ((uint8_t)(c)) % 32)) )
 #define COUNT_OF(a)            (sizeof(a) / sizeof(*a))
 
 static const char *parse_range_def(const char *pat_pos, CharSet *cs) {
@@ -170,7 +179,8 @@ bool glob_match(const char *pattern, const char *str, const char *dir_separators
         pat_pos = parse_range_def(pat_pos, &cs);
         if(CHAR_IS_IN_SET(&cs, s_ch)) {
           str_pos++;
-          pat_pos++;
+          if(*pat_pos != '\0') // Unterminated range ends the pattern
+            pat_pos++;
           continue;
         }
         break;
@@ -213,3 +223,291 @@ bool is_glob(const char *str) {
   return strcspn(str, "*?[") != strlen(str);
 }
 
+
+
+// ******************** Compiled patterns ********************
+
+enum GlobTokKind {
+  TOK_LITERAL,  // Run of literal chars
+  TOK_ANY,      // ?
+  TOK_SET,      // [...]
+  TOK_STAR,     // *
+  TOK_GLOBSTAR  // ** or **/
+};
+
+typedef struct {
+  uint8_t   kind;
+  bool      dir_slash;  // Globstar is followed by a separator and matches whole components
+  uint16_t  len;        // Literal length
+  uint32_t  arg;        // Offset to literal or index of char set
+} GlobToken;
+
+struct GlobPattern {
+  CharSet     separators;
+  GlobToken  *tokens;
+  CharSet    *sets;
+  char       *literals;
+  size_t      num_tokens;
+  size_t      min_len;      // Length of all fixed size tokens
+  size_t      prefix_len;   // Literal that must begin a match
+  size_t      suffix_len;   // Literal that must end a match
+  bool        has_star;
+};
+
+
+#define IS_SEP(gp, c)  CHAR_IS_IN_SET(&(gp)->separators, c)
+
+// Convert a pattern into tokens
+// This is called twice. First with a NULL gp to count an upper bound on the
+// storage needed.
+static void tokenize_pattern(const char *pattern, GlobPattern *gp, size_t *num_tokens,
+                             size_t *num_sets, size_t *lit_size) {
+  GlobToken *tok = NULL;
+  size_t tcount = 0, scount = 0, lcount = 0;
+  CharSet cs;
+
+  for(const char *pat_pos = pattern; *pat_pos != '\0'; pat_pos++) {
+    switch(*pat_pos) {
+    case '*':
+      if(*(pat_pos+1) == '*') { // Globstar
+        while(*(pat_pos+1) == '*')
+          pat_pos++;
+
+        bool dir_slash = gp && *(pat_pos+1) != '\0' && IS_SEP(gp, *(pat_pos+1));
+        if(dir_slash)
+          pat_pos++;
+
+        if(gp)
+          gp->tokens[tcount] = (GlobToken){.kind = TOK_GLOBSTAR, .dir_slash = dir_slash};
+      } else if(gp) {
+        gp->tokens[tcount] = (GlobToken){.kind = TOK_STAR};
+      }
+      tok = NULL;
+      tcount++;
+      break;
+
+    case '?':
+      if(gp)
+        gp->tokens[tcount] = (GlobToken){.kind = TOK_ANY};
+      tok = NULL;
+      tcount++;
+      break;
+
+    case '[':
+      memset(&cs, 0, sizeof(cs));
+      pat_pos = parse_range_def(pat_pos, &cs);
+      if(gp) {
+        gp->sets[scount] = cs;
+        gp->tokens[tcount] = (GlobToken){.kind = TOK_SET, .arg = scount};
+      }
+      tok = NULL;
+      tcount++;
+      scount++;
+      if(*pat_pos == '\0') // Unterminated range
+        pat_pos--;
+      break;
+
+    default: // Literal
+      if(gp) {
+        if(!tok || tok->len == UINT16_MAX) {
+          tok = &gp->tokens[tcount];
+          *tok = (GlobToken){.kind = TOK_LITERAL, .arg = lcount};
+        }
+        gp->literals[lcount] = *pat_pos;
+        tok->len++;
+      }
+      if(!gp || tok->len == 1)
+        tcount++; // Overestimate while counting
+      lcount++;
+      break;
+    }
+  }
+
+  *num_tokens = tcount;
+  *num_sets = scount;
+  *lit_size = lcount;
+}
+
+
+/*
+Compile a glob pattern for repeated matching
+
+The pattern syntax is the same as glob_match() with the addition of "**".
+A globstar matches zero or more characters including directory separators.
+When followed by a separator it matches zero or more whole path components
+with their trailing separators. It can then match nothing so that a
+globstar between two names also matches when they are adjacent.
+
+Args:
+  pattern:         Glob pattern to compile
+  dir_separators:  Characters to treat as directory separators
+
+Returns:
+  A compiled pattern on success or NULL on failure. Release with glob_free().
+*/
+GlobPattern *glob_compile(const char *pattern, const char *dir_separators) {
+  if(!pattern || !dir_separators) return NULL;
+
+  size_t num_tokens, num_sets, lit_size;
+  tokenize_pattern(pattern, NULL, &num_tokens, &num_sets, &lit_size);
+
+  // We have four objects allocated together [GlobPattern][CharSet[]][GlobToken[]][literals]
+  size_t alloc_size = sizeof(GlobPattern) + num_sets * sizeof(CharSet) +
+                      num_tokens * sizeof(GlobToken) + lit_size;
+  GlobPattern *gp = glob__malloc(alloc_size);
+  if(!gp) return NULL;
+
+  memset(gp, 0, sizeof(*gp));
+  gp->sets = (CharSet *)(gp + 1);
+  gp->tokens = (GlobToken *)(gp->sets + num_sets);
+  gp->literals = (char *)(gp->tokens + num_tokens);
+
+  for(const char *pos = dir_separators; *pos != '\0'; pos++) {
+    ADD_TO_SET(&gp->separators, *pos);
+  }
+
+  tokenize_pattern(pattern, gp, &num_tokens, &num_sets, &lit_size);
+  gp->num_tokens = num_tokens;
+
+  for(size_t i = 0; i < gp->num_tokens; i++) {
+    GlobToken *tok = &gp->tokens[i];
+    switch(tok->kind) {
+    case TOK_LITERAL: gp->min_len += tok->len; break;
+    case TOK_ANY:
+    case TOK_SET:     gp->min_len++; break;
+    default:          gp->has_star = true; break;
+    }
+  }
+
+  // Fast reject literals
+  if(gp->num_tokens > 0) {
+    if(gp->tokens[0].kind == TOK_LITERAL)
+      gp->prefix_len = gp->tokens[0].len;
+
+    GlobToken *last = &gp->tokens[gp->num_tokens-1];
+    if(last->kind == TOK_LITERAL && (gp->num_tokens > 1 || gp->prefix_len == 0))
+      gp->suffix_len = last->len;
+  }
+
+  return gp;
+}
+
+
+/*
+Release a compiled glob pattern
+
+Args:
+  gp:  Pattern to free
+*/
+void glob_free(GlobPattern *gp) {
+  glob__free(gp);
+}
+
+
+/*
+Perform a compiled glob pattern match on a string
+
+Args:
+  gp:   Compiled glob pattern from glob_compile()
+  str:  String to perform match on
+
+Returns:
+  true when a match is found
+*/
+bool glob_match_compiled(const GlobPattern *gp, const char *str) {
+  if(!gp || !str) return false;
+
+  size_t len = strlen(str);
+  if(len < gp->min_len || (!gp->has_star && len != gp->min_len))
+    return false;
+
+  // Reject on the fixed literals before running the matcher
+  if(gp->prefix_len > 0 && memcmp(str, gp->literals, gp->prefix_len))
+    return false;
+
+  if(gp->suffix_len > 0) {
+    const GlobToken *last = &gp->tokens[gp->num_tokens-1];
+    if(memcmp(&str[len - gp->suffix_len], &gp->literals[last->arg], gp->suffix_len))
+      return false;
+  }
+
+  size_t ti = gp->prefix_len > 0 ? 1 : 0;
+  size_t si = gp->prefix_len;
+
+  // Backtracking positions for the last star and globstar
+  size_t star_ti = 0, star_si = 0;
+  size_t gstar_ti = 0, gstar_si = 0;
+  bool in_star = false, in_gstar = false, gstar_slash = false;
+
+  while(1) {
+    if(ti < gp->num_tokens) {
+      const GlobToken *tok = &gp->tokens[ti];
+
+      switch(tok->kind) {
+      case TOK_LITERAL:
+        if(len - si >= tok->len && !memcmp(&str[si], &gp->literals[tok->arg], tok->len)) {
+          si += tok->len;
+          ti++;
+          continue;
+        }
+        break;
+
+      case TOK_ANY:
+        if(si < len && !IS_SEP(gp, str[si])) {
+          si++;
+          ti++;
+          continue;
+        }
+        break;
+
+      case TOK_SET:
+        if(si < len && CHAR_IS_IN_SET(&gp->sets[tok->arg], str[si])) {
+          si++;
+          ti++;
+          continue;
+        }
+        break;
+
+      case TOK_STAR: // Start by matching 0 chars
+        in_star = true;
+        star_ti = ++ti;
+        star_si = si;
+        continue;
+
+      case TOK_GLOBSTAR: // Start by matching 0 chars or components
+        in_star = false; // Earlier stars never need to backtrack past a globstar
+        in_gstar = true;
+        gstar_slash = tok->dir_slash;
+        gstar_ti = ++ti;
+        gstar_si = si;
+        continue;
+      }
+
+    } else if(si == len) {
+      return true;
+    }
+
+    // Mismatch; Recover with backtracking or fail
+    if(in_star && star_si < len && !IS_SEP(gp, str[star_si])) { // Extend star by one char
+      si = ++star_si;
+      ti = star_ti;
+      continue;
+    }
+
+    if(in_gstar && gstar_si < len) {
+      if(gstar_slash) { // Extend globstar by one component
+        while(gstar_si < len && !IS_SEP(gp, str[gstar_si]))
+          gstar_si++;
+        if(gstar_si == len)
+          return false;
+      }
+
+      si = ++gstar_si;
+      ti = gstar_ti;
+      in_star = false;
+      continue;
+    }
+
+    return false;
+  }
+}
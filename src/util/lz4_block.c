@@ -0,0 +1,250 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2021 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice (including the next
+paragraph) shall be included in all copies or substantial portions of the
+Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+------------------------------------------------------------------------------
+lz4_block
+
+Each sequence is a token byte holding a 4-bit literal length and a 4-bit
+match length, followed by extended literal length bytes, the literals, a
+16-bit little-endian match offset, and extended match length bytes. Lengths
+of 15 continue into bytes that are summed until one is less than 255. The
+last sequence only has literals.
+
+The format requires the last 5 bytes of a block to be literals and the last
+match to start at least 12 bytes before the end. The decoder relies on this
+for its fast paths so we follow it here even though our own decoder doesn't.
+------------------------------------------------------------------------------
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "util/lz4_block.h"
+#include "util/unaligned_access.h"
+
+
+#define MIN_MATCH       4
+#define LAST_LITERALS   5   // Bytes at the end that are always literals
+#define MF_LIMIT        12  // Last match starts this many bytes before the end
+
+#define RUN_MASK        0x0F
+
+
+static inline unsigned lz4_hash(uint32_t seq) {
+  return (uint32_t)(seq * 2654435761UL) >> (32 - LZ4_HASH_LOG);
+}
+
+
+// Bytes needed to encode a length with a 4-bit token field
+static inline size_t length_bytes(size_t len) {
+  return (len >= RUN_MASK) ? 1 + (len - RUN_MASK) / 255 : 0;
+}
+
+
+static uint8_t *put_length(uint8_t *op, size_t len) {
+  len -= RUN_MASK;
+  while(len >= 255) {
+    *op++ = 255;
+    len -= 255;
+  }
+  *op++ = len;
+  return op;
+}
+
+
+/*
+Compress a block of data
+
+Args:
+  src:        Data to compress
+  src_len:    Length of src. Must not exceed LZ4_MAX_BLOCK_SIZE
+  dest:       Destination for compressed data
+  dest_size:  Size of dest
+  work:       Hash table of LZ4_WORK_SIZE bytes. Contents don't need to be initialized.
+
+Returns:
+  Size of the compressed data or 0 if it doesn't fit in dest
+*/
+size_t lz4_compress_block(const uint8_t *src, size_t src_len, uint8_t *dest, size_t dest_size,
+                          void *work) {
+  if(src_len > LZ4_MAX_BLOCK_SIZE)
+    return 0;
+
+  uint16_t *hash_table = (uint16_t *)work;
+  memset(hash_table, 0, LZ4_WORK_SIZE);
+
+  uint8_t *op = dest;
+  uint8_t *oend = dest + dest_size;
+  size_t anchor = 0;
+
+  if(src_len > MF_LIMIT) {
+    size_t match_limit = src_len - MF_LIMIT;
+    size_t ip = 1;
+
+    while(ip < match_limit) {
+      uint32_t seq = get_unaligned_u32(&src[ip]);
+      unsigned h = lz4_hash(seq);
+      size_t ref = hash_table[h];
+      hash_table[h] = ip;
+
+      if(get_unaligned_u32(&src[ref]) != seq) {
+        // Skip ahead faster through data that isn't matching
+        ip += 1 + ((ip - anchor) >> 6);
+        continue;
+      }
+
+      // Extend the match backward over pending literals
+      while(ip > anchor && ref > 0 && src[ip-1] == src[ref-1]) {
+        ip--;
+        ref--;
+      }
+
+      size_t match_len = MIN_MATCH;
+      while(ip + match_len < src_len - LAST_LITERALS && src[ref + match_len] == src[ip + match_len])
+        match_len++;
+
+      size_t lit_len = ip - anchor;
+      size_t seq_size = 1 + length_bytes(lit_len) + lit_len + 2 + length_bytes(match_len - MIN_MATCH);
+      if(seq_size > (size_t)(oend - op))
+        return 0;
+
+      uint8_t *token = op++;
+      *token = (lit_len >= RUN_MASK ? RUN_MASK : lit_len) << 4;
+      if(lit_len >= RUN_MASK)
+        op = put_length(op, lit_len);
+
+      memcpy(op, &src[anchor], lit_len);
+      op += lit_len;
+
+      size_t offset = ip - ref;
+      *op++ = offset & 0xFF;
+      *op++ = offset >> 8;
+
+      size_t ml = match_len - MIN_MATCH;
+      *token |= (ml >= RUN_MASK ? RUN_MASK : ml);
+      if(ml >= RUN_MASK)
+        op = put_length(op, ml);
+
+      ip += match_len;
+      anchor = ip;
+
+      // Prime the table with a position inside the match
+      if(ip < match_limit)
+        hash_table[lz4_hash(get_unaligned_u32(&src[ip-2]))] = ip-2;
+    }
+  }
+
+  // Final literals
+  size_t lit_len = src_len - anchor;
+  if(1 + length_bytes(lit_len) + lit_len > (size_t)(oend - op))
+    return 0;
+
+  *op++ = (lit_len >= RUN_MASK ? RUN_MASK : lit_len) << 4;
+  if(lit_len >= RUN_MASK)
+    op = put_length(op, lit_len);
+
+  memcpy(op, &src[anchor], lit_len);
+  op += lit_len;
+
+  return op - dest;
+}
+
+
+// Read extended length bytes
+static inline bool get_length(const uint8_t **ip, const uint8_t *iend, size_t *len) {
+  unsigned b;
+  do {
+    if(*ip >= iend)
+      return false;
+    b = *(*ip)++;
+    *len += b;
+  } while(b == 255);
+
+  return true;
+}
+
+
+/*
+Decompress a block of data
+
+Args:
+  src:        Compressed data
+  src_len:    Length of src
+  dest:       Destination for decompressed data
+  dest_size:  Size of dest
+
+Returns:
+  Size of the decompressed data or -1 if src is malformed or doesn't fit in dest
+*/
+ptrdiff_t lz4_decompress_block(const uint8_t *src, size_t src_len, uint8_t *dest, size_t dest_size) {
+  const uint8_t *ip = src;
+  const uint8_t *iend = src + src_len;
+  size_t op = 0;
+
+  while(ip < iend) {
+    unsigned token = *ip++;
+
+    size_t lit_len = token >> 4;
+    if(lit_len == RUN_MASK && !get_length(&ip, iend, &lit_len))
+      return -1;
+
+    if(lit_len > (size_t)(iend - ip) || lit_len > dest_size - op)
+      return -1;
+
+    memcpy(&dest[op], ip, lit_len);
+    ip += lit_len;
+    op += lit_len;
+
+    if(ip == iend) // Last sequence has no match
+      break;
+
+    if(iend - ip < 2)
+      return -1;
+
+    size_t offset = get_unaligned_u16le(ip);
+    ip += 2;
+    if(offset == 0 || offset > op)
+      return -1;
+
+    size_t match_len = token & RUN_MASK;
+    if(match_len == RUN_MASK && !get_length(&ip, iend, &match_len))
+      return -1;
+    match_len += MIN_MATCH;
+
+    if(match_len > dest_size - op)
+      return -1;
+
+    // Matches can overlap their own output so copy bytewise
+    uint8_t *mp = &dest[op - offset];
+    uint8_t *dp = &dest[op];
+    for(size_t i = 0; i < match_len; i++)
+      dp[i] = mp[i];
+
+    op += match_len;
+  }
+
+  return op;
+}
@@ -0,0 +1,646 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2021 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice (including the next
+paragraph) shall be included in all copies or substantial portions of the
+Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+
+/*
+------------------------------------------------------------------------------
+mphash
+
+This implements a static minimal perfect hash using hash and displace (CHD).
+
+Each key is hashed once into 64 bits. The upper half selects a bucket. The
+buckets average MPH_BUCKET_KEYS keys and are placed largest first. For every
+bucket we search for a seed that remaps all of its keys onto unoccupied slots.
+Buckets with a single key are placed last and store their slot directly in the
+seed. The entries are then permuted in place into their final slots so the
+table has exactly one slot per key with no empty buckets.
+
+Lookups never probe. The bucket seed selects one slot and the key stored there
+is compared with is_equal() to reject keys that weren't in the set.
+------------------------------------------------------------------------------
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stddef.h>
+
+#include "util/mphash.h"
+
+
+// ******************** Configuration ********************
+
+#define mph__malloc(s)      calloc(1, s)
+#define mph__realloc(p, s)  realloc((p), (s))
+#define mph__free(p)        free(p)
+
+// Average keys per bucket. Larger values use less memory for seeds but take
+// longer to build.
+#define MPH_BUCKET_KEYS   4
+
+// Give up on a bucket after this many seeds. The build fails and the caller
+// can fall back to an ordinary hash table.
+#define MPH_MAX_SEED      (1UL << 24)
+
+
+// Seeds with this bit set hold the slot for a single key bucket
+#define SEED_DIRECT       0x80000000UL
+
+#define ROUND_UP_ALIGN(n)  (((n) + sizeof(uintptr_t)-1) & ~(sizeof(uintptr_t)-1))
+
+#define BIT_IS_SET(bm, b)  ((bm)[(b) / 8] & (1u << ((b) % 8)))
+#define SET_BIT(bm, b)     ((bm)[(b) / 8] |= (uint8_t)(1u << ((b) % 8)))
+#define CLEAR_BIT(bm, b)   ((bm)[(b) / 8] &= (uint8_t)~(1u << ((b) % 8)))
+
+
+// ******************** Hashing ********************
+
+// Finalizer from SplitMix64. Spreads entropy into all bits of the result.
+static inline uint64_t mph__mix(uint64_t h) {
+  h ^= h >> 30;
+  h *= 0xBF58476D1CE4E5B9ULL;
+  h ^= h >> 27;
+  h *= 0x94D049BB133111EBULL;
+  h ^= h >> 31;
+  return h;
+}
+
+
+// Map a 32-bit hash onto [0, n) without division
+static inline uint32_t mph__reduce(uint32_t h, size_t n) {
+  return (uint32_t)(((uint64_t)h * n) >> 32);
+}
+
+
+static inline uint64_t mph__hash(mphash *mph, dhKey key) {
+  return mph__mix(mph->gen_hash(key));
+}
+
+
+static inline uint32_t mph__bucket(mphash *mph, uint64_t h) {
+  return mph__reduce((uint32_t)(h >> 32), mph->num_buckets);
+}
+
+
+static inline uint32_t mph__slot(uint64_t h, uint32_t seed, size_t num_slots) {
+  return mph__reduce((uint32_t)mph__mix(h ^ (seed * 0x9E3779B97F4A7C15ULL)), num_slots);
+}
+
+
+static inline uint8_t *mph__value(mphash *mph, size_t slot) {
+  return &mph->values[slot * mph->value_stride];
+}
+
+
+/*
+Hash a string into a 64-bit key
+
+This is a helper function that can be used as the gen_hash member in a
+mphConfig struct.
+
+Args:
+  key:  The key to be hashed
+
+Returns:
+  Hashed value of key
+*/
+uint64_t mph_gen_hash_string(dhKey key) {
+  const uint8_t *str = (const uint8_t *)key.data;
+  // FNV-1a
+  uint64_t h = 0xCBF29CE484222325ULL;
+
+  for(size_t i = 0; i < key.length; i++) {
+    h ^= str[i];
+    h *= 0x100000001B3ULL;
+  }
+
+  return h;
+}
+
+
+/*
+Hash an integer key
+
+This is a helper function that can be used as the gen_hash member in a
+mphConfig struct.
+
+Args:
+  key:  The key to be hashed. The data pointer is the integer value.
+
+Returns:
+  Hashed value of key
+*/
+uint64_t mph_gen_hash_int(dhKey key) {
+  // This will be mixed by mph__hash()
+  return (uintptr_t)key.data;
+}
+
+
+// ******************** Resource management ********************
+
+/*
+Initialize a perfect hash object
+
+Staging storage is allocated for config->num_keys entries. It grows if more
+keys are added and is trimmed to the final number of keys by mph_build().
+
+Args:
+  mph:    Hash to initialize
+  config: Configuration settings for the new hash
+  ctx:    User context passed to callbacks
+
+Returns:
+  true on success
+*/
+bool mph_init(mphash *mph, mphConfig *config, void *ctx) {
+  memset(mph, 0, sizeof(*mph));
+
+  if(!config->gen_hash || !config->is_equal || config->num_keys > DH_MAX_HASH_ENTRIES)
+    return false;
+
+  mph->max_keys     = config->num_keys;
+  mph->value_size   = config->value_size;
+  mph->value_stride = ROUND_UP_ALIGN(config->value_size);
+  mph->ctx          = ctx;
+  mph->gen_hash     = config->gen_hash;
+  mph->is_equal     = config->is_equal;
+
+  if(mph->max_keys == 0) // Nothing to allocate
+    return true;
+
+  mph->keys       = mph__malloc(mph->max_keys * sizeof(dhKey));
+  mph->values     = mph__malloc(mph->max_keys * mph->value_stride + 1);
+  mph->key_hashes = mph__malloc(mph->max_keys * sizeof(uint64_t));
+
+  if(!mph->keys || !mph->values || !mph->key_hashes) {
+    mph_free(mph);
+    return false;
+  }
+
+  return true;
+}
+
+
+/*
+Free a perfect hash object
+
+Args:
+  mph: Hash to free
+*/
+void mph_free(mphash *mph) {
+  mph__free(mph->keys);
+  mph__free(mph->values);
+  mph__free(mph->key_hashes);
+  mph__free(mph->seeds);
+
+  mph->keys       = NULL;
+  mph->values     = NULL;
+  mph->key_hashes = NULL;
+  mph->seeds      = NULL;
+  mph->num_keys   = 0;
+  mph->max_keys   = 0;
+  mph->built      = false;
+}
+
+
+// ******************** Storage ********************
+
+// Enlarge staging storage for more keys
+static bool mph__grow(mphash *mph) {
+  size_t new_max = mph->max_keys < 8 ? 16 : mph->max_keys + mph->max_keys / 2;
+  if(new_max > DH_MAX_HASH_ENTRIES)
+    new_max = DH_MAX_HASH_ENTRIES;
+  if(new_max <= mph->max_keys)
+    return false;
+
+  dhKey *keys = mph__realloc(mph->keys, new_max * sizeof(dhKey));
+  if(!keys) return false;
+  mph->keys = keys;
+
+  uint8_t *values = mph__realloc(mph->values, new_max * mph->value_stride + 1);
+  if(!values) return false;
+  mph->values = values;
+  memset(&values[mph->max_keys * mph->value_stride], 0, (new_max - mph->max_keys) * mph->value_stride);
+
+  uint64_t *key_hashes = mph__realloc(mph->key_hashes, new_max * sizeof(uint64_t));
+  if(!key_hashes) return false;
+  mph->key_hashes = key_hashes;
+
+  mph->max_keys = new_max;
+  return true;
+}
+
+
+/*
+Add an entry to a perfect hash
+
+Entries are staged until mph_build() is called. Adding a key that was already
+added replaces its value when the table is built.
+
+Args:
+  mph:    Hash to add into
+  key:    Key for the entry
+  value:  Value to associate with key. Can be NULL to leave the value zeroed.
+
+Returns:
+  true on success. false when out of memory or the table is already built.
+*/
+bool mph_add(mphash *mph, dhKey key, void *value) {
+  if(mph->built)
+    return false;
+
+  if(mph->num_keys >= mph->max_keys && !mph__grow(mph))
+    return false;
+
+  size_t slot = mph->num_keys++;
+  mph->keys[slot] = key;
+  mph->key_hashes[slot] = mph__hash(mph, key);
+  if(value)
+    memcpy(mph__value(mph, slot), value, mph->value_size);
+
+  return true;
+}
+
+
+// Sort staged key indices by bucket
+// bucket_start has num_buckets+1 entries so each bucket spans [start[b], start[b+1])
+static void mph__sort_buckets(mphash *mph, uint32_t *bucket_start, uint32_t *order) {
+  memset(bucket_start, 0, (mph->num_buckets+1) * sizeof(*bucket_start));
+
+  for(size_t i = 0; i < mph->num_keys; i++) {
+    bucket_start[mph__bucket(mph, mph->key_hashes[i]) + 1]++;
+  }
+
+  for(size_t b = 0; b < mph->num_buckets; b++) {
+    bucket_start[b+1] += bucket_start[b];
+  }
+
+  // Use the start of each bucket as its fill position then shift back after.
+  // Keys stay in the order they were added within each bucket.
+  for(size_t i = 0; i < mph->num_keys; i++) {
+    uint32_t b = mph__bucket(mph, mph->key_hashes[i]);
+    order[bucket_start[b]++] = (uint32_t)i;
+  }
+
+  for(size_t b = mph->num_buckets; b > 0; b--) {
+    bucket_start[b] = bucket_start[b-1];
+  }
+  bucket_start[0] = 0;
+}
+
+
+// Remove repeated keys keeping the last one added
+// Returns false if two different keys have the same 64-bit hash
+static bool mph__remove_duplicates(mphash *mph, uint32_t *bucket_start, uint32_t *order,
+                                   uint8_t *dropped) {
+  bool have_dups = false;
+
+  for(size_t b = 0; b < mph->num_buckets; b++) {
+    for(uint32_t i = bucket_start[b]; i < bucket_start[b+1]; i++) {
+      uint32_t ki = order[i];
+      for(uint32_t j = i+1; j < bucket_start[b+1]; j++) {
+        uint32_t kj = order[j];
+        if(mph->key_hashes[ki] != mph->key_hashes[kj])
+          continue;
+
+        if(!mph->is_equal(mph->keys[ki], mph->keys[kj], mph->ctx))
+          return false; // Can never be separated
+
+        SET_BIT(dropped, ki); // Later key wins
+        have_dups = true;
+        break;
+      }
+    }
+  }
+
+  if(!have_dups)
+    return true;
+
+  // Compact remaining entries
+  size_t dest = 0;
+  for(size_t i = 0; i < mph->num_keys; i++) {
+    if(BIT_IS_SET(dropped, i))
+      continue;
+
+    if(dest != i) {
+      mph->keys[dest] = mph->keys[i];
+      mph->key_hashes[dest] = mph->key_hashes[i];
+      memcpy(mph__value(mph, dest), mph__value(mph, i), mph->value_stride);
+    }
+    dest++;
+  }
+
+  mph->num_keys = dest;
+  mph__sort_buckets(mph, bucket_start, order);
+  return true;
+}
+
+
+// Find seeds that place every bucket into free slots
+// Returns the final slot for each staged key in positions
+static bool mph__place_buckets(mphash *mph, uint32_t *bucket_start, uint32_t *order,
+                               uint8_t *taken, uint32_t *positions) {
+  size_t num_slots = mph->num_keys;
+
+  // Sort buckets by descending size
+  uint32_t max_size = 0;
+  for(size_t b = 0; b < mph->num_buckets; b++) {
+    uint32_t size = bucket_start[b+1] - bucket_start[b];
+    if(size > max_size)
+      max_size = size;
+  }
+
+  uint32_t *size_start = mph__malloc((max_size+2) * sizeof(uint32_t));
+  uint32_t *by_size = mph__malloc(mph->num_buckets * sizeof(uint32_t));
+  if(!size_start || !by_size) {
+    mph__free(size_start);
+    mph__free(by_size);
+    return false;
+  }
+
+  for(size_t b = 0; b < mph->num_buckets; b++) {
+    uint32_t size = bucket_start[b+1] - bucket_start[b];
+    size_start[max_size - size + 1]++;
+  }
+  for(uint32_t s = 0; s <= max_size; s++) {
+    size_start[s+1] += size_start[s];
+  }
+  for(size_t b = 0; b < mph->num_buckets; b++) {
+    uint32_t size = bucket_start[b+1] - bucket_start[b];
+    by_size[size_start[max_size - size]++] = (uint32_t)b;
+  }
+
+  mph__free(size_start);
+
+
+  bool status = true;
+  size_t next_free = 0; // Scan position for single key buckets
+
+  for(size_t bi = 0; bi < mph->num_buckets; bi++) {
+    uint32_t b = by_size[bi];
+    uint32_t first = bucket_start[b];
+    uint32_t size = bucket_start[b+1] - first;
+
+    if(size == 0) {
+      mph->seeds[b] = 0;
+
+    } else if(size == 1) {  // Take the next free slot without searching for a seed
+      while(BIT_IS_SET(taken, next_free)) {
+        next_free++;
+      }
+
+      SET_BIT(taken, next_free);
+      positions[order[first]] = (uint32_t)next_free;
+      mph->seeds[b] = SEED_DIRECT | (uint32_t)next_free;
+
+    } else {
+      uint32_t seed;
+      for(seed = 0; seed < MPH_MAX_SEED; seed++) {
+        uint32_t k;
+        for(k = 0; k < size; k++) {
+          uint32_t ki = order[first + k];
+          uint32_t slot = mph__slot(mph->key_hashes[ki], seed, num_slots);
+          if(BIT_IS_SET(taken, slot))
+            break;
+
+          SET_BIT(taken, slot);
+          positions[ki] = slot;
+        }
+
+        if(k == size) // All keys placed
+          break;
+
+        while(k > 0) {  // Release partial placement
+          k--;
+          CLEAR_BIT(taken, positions[order[first + k]]);
+        }
+      }
+
+      if(seed == MPH_MAX_SEED) {
+        status = false;
+        break;
+      }
+
+      mph->seeds[b] = seed;
+    }
+  }
+
+  mph__free(by_size);
+  return status;
+}
+
+
+/*
+Build a perfect hash from the added entries
+
+After this returns successfully the table is ready for lookups and no further
+entries can be added. If it fails the hash remains unusable and should be
+freed.
+
+Args:
+  mph:  Hash to build
+
+Returns:
+  true on success
+*/
+bool mph_build(mphash *mph) {
+  if(mph->built)
+    return true;
+
+  if(mph->num_keys == 0) {
+    mph__free(mph->key_hashes);
+    mph->key_hashes = NULL;
+    mph->built = true;
+    return true;
+  }
+
+  mph->num_buckets = mph->num_keys / MPH_BUCKET_KEYS + 1;
+  mph->seeds = mph__malloc(mph->num_buckets * sizeof(uint32_t));
+
+  uint32_t *bucket_start  = mph__malloc((mph->num_buckets+1) * sizeof(uint32_t));
+  uint32_t *order         = mph__malloc(mph->num_keys * sizeof(uint32_t));
+  uint32_t *positions     = mph__malloc(mph->num_keys * sizeof(uint32_t));
+  uint8_t  *bitmap        = mph__malloc((mph->num_keys + 7) / 8);
+  uint8_t  *swap_value    = mph__malloc(mph->value_stride + 1);
+
+  bool status = mph->seeds && bucket_start && order && positions && bitmap && swap_value;
+  if(!status)
+    goto cleanup;
+
+  mph__sort_buckets(mph, bucket_start, order);
+
+  status = mph__remove_duplicates(mph, bucket_start, order, bitmap);
+  if(!status)
+    goto cleanup;
+
+  memset(bitmap, 0, (mph->num_keys + 7) / 8);
+  status = mph__place_buckets(mph, bucket_start, order, bitmap, positions);
+  if(!status)
+    goto cleanup;
+
+  // Move entries into their final slots by following permutation cycles
+  for(size_t i = 0; i < mph->num_keys; i++) {
+    while(positions[i] != i) {
+      uint32_t j = positions[i];
+
+      dhKey key = mph->keys[j];
+      mph->keys[j] = mph->keys[i];
+      mph->keys[i] = key;
+
+      memcpy(swap_value, mph__value(mph, j), mph->value_stride);
+      memcpy(mph__value(mph, j), mph__value(mph, i), mph->value_stride);
+      memcpy(mph__value(mph, i), swap_value, mph->value_stride);
+
+      positions[i] = positions[j];
+      positions[j] = j;
+    }
+  }
+
+  // Release slots left over from duplicate keys and staging growth
+  if(mph->num_keys < mph->max_keys) {
+    void *keys = mph__realloc(mph->keys, mph->num_keys * sizeof(dhKey));
+    if(keys)
+      mph->keys = keys;
+    void *values = mph__realloc(mph->values, mph->num_keys * mph->value_stride + 1);
+    if(values)
+      mph->values = values;
+  }
+
+  mph__free(mph->key_hashes);
+  mph->key_hashes = NULL;
+  mph->built = true;
+
+cleanup:
+  mph__free(bucket_start);
+  mph__free(order);
+  mph__free(positions);
+  mph__free(bitmap);
+  mph__free(swap_value);
+
+  return status;
+}
+
+
+// ******************** Retrieval ********************
+
+// Find the only slot that can hold a key
+// Returns -1 if the key isn't in the table
+static inline dhBucketIndex mph__find_slot(mphash *mph, dhKey key) {
+  if(!mph->built || mph->num_keys == 0)
+    return -1;
+
+  uint64_t h = mph__hash(mph, key);
+  uint32_t seed = mph->seeds[mph__bucket(mph, h)];
+  uint32_t slot = (seed & SEED_DIRECT) ? (uint32_t)(seed & ~SEED_DIRECT) :
+                                         mph__slot(h, seed, mph->num_keys);
+
+  if(slot >= mph->num_keys || !mph->is_equal(mph->keys[slot], key, mph->ctx))
+    return -1;
+
+  return (dhBucketIndex)slot;
+}
+
+
+/*
+Lookup an entry in a perfect hash
+
+Args:
+  mph:    Hash to search
+  key:    Key to lookup
+  value:  Optional destination for value associated with key
+
+Returns:
+  true when the key is found
+*/
+bool mph_lookup(mphash *mph, dhKey key, void *value) {
+  dhBucketIndex slot = mph__find_slot(mph, key);
+  if(slot < 0)
+    return false;
+
+  if(value)
+    memcpy(value, mph__value(mph, slot), mph->value_size);
+
+  return true;
+}
+
+
+/*
+Lookup an entry in a perfect hash without copying
+
+Args:
+  mph:    Hash to search
+  key:    Key to lookup
+  value:  Pointer to value stored in the table
+
+Returns:
+  true when the key is found
+*/
+bool mph_lookup_in_place(mphash *mph, dhKey key, void **value) {
+  dhBucketIndex slot = mph__find_slot(mph, key);
+  if(slot < 0)
+    return false;
+
+  *value = mph__value(mph, slot);
+  return true;
+}
+
+
+// ******************** Resource utilization ********************
+
+/*
+Get the number of items in a perfect hash
+
+Args:
+  mph:  Hash to inspect
+
+Returns:
+  Number of keys
+*/
+size_t mph_num_items(mphash *mph) {
+  return mph->num_keys;
+}
+
+
+/*
+Get the memory used by a perfect hash
+
+Args:
+  mph:  Hash to inspect
+
+Returns:
+  Number of bytes allocated for the table
+*/
+size_t mph_storage_size(mphash *mph) {
+  size_t slots = mph->built ? mph->num_keys : mph->max_keys;
+  size_t total = slots * (sizeof(dhKey) + mph->value_stride);
+
+  if(mph->seeds)
+    total += mph->num_buckets * sizeof(uint32_t);
+  if(mph->key_hashes)
+    total += mph->max_keys * sizeof(uint64_t);
+
+  return total;
+}
+
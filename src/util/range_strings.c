@@ -137,6 +137,13 @@ You can also use the PRISR format macro:
 
 Tokenizer functions range_token() and range_token_limit() serve as substitutes
 for strtok_r() with the benefit that the input string is not altered.
+
+Delimiter sets of one or two characters, such as path separators, are
+searched a machine word at a time with SWAR bit tricks. This is skipped with
+glibc where strcspn() is already vectorized. Define RANGE_USE_SWAR_SCAN to
+use it anyway. Lengths and comparisons use memchr() and memcmp() so they get
+the C library's optimized versions. Define RANGE_USE_SCALAR_SCAN to scan one
+byte at a time on targets where code size matters more.
 ------------------------------------------------------------------------------
 */
 
@@ -164,6 +171,7 @@ Returns:
   If there is no NUL the result is the same as range_size().
 */
 size_t range_strlen(StringRange *rng) {
+#ifdef RANGE_USE_SCALAR_SCAN
   const char *pos = rng->start;
 
   while(pos < rng->end) {
@@ -172,6 +180,14 @@ size_t range_strlen(StringRange *rng) {
   }
 
   return pos - rng->start;
+
+#else
+  if(rng->start >= rng->end)
+    return 0;
+
+  const char *nul = memchr(rng->start, '\0', range_size(rng));
+  return nul ? (size_t)(nul - rng->start) : (size_t)range_size(rng);
+#endif
 }
 
 
@@ -939,6 +955,7 @@ void range_fputs(StringRange *rng, FILE *stream) {
 // ******************** Comparison ********************
 
 bool range_eq(StringRange *rng, const char *str) {
+#ifdef RANGE_USE_SCALAR_SCAN
   const char *rpos = rng->start;
   const char *spos = str;
 
@@ -949,10 +966,19 @@ bool range_eq(StringRange *rng, const char *str) {
   }
 
   return (rpos == rng->end && *spos == '\0');
+
+#else
+  size_t len = range_size(rng);
+
+  // memchr() stops at the first NUL so it won't read past the end of a shorter str
+  const char *nul = memchr(str, '\0', len+1);
+  return nul == str + len && memcmp(rng->start, str, len) == 0;
+#endif
 }
 
 
 bool range_eq_range(StringRange *rng, StringRange *rng2) {
+#ifdef RANGE_USE_SCALAR_SCAN
   const char *rpos = rng->start;
   const char *r2pos = rng2->start;
 
@@ -963,6 +989,11 @@ bool range_eq_range(StringRange *rng, StringRange *rng2) {
   }
 
   return (rpos == rng->end && r2pos == rng2->end);
+
+#else
+  return range_size(rng) == range_size(rng2) &&
+         memcmp(rng->start, rng2->start, range_size(rng)) == 0;
+#endif
 }
 
 
@@ -979,6 +1010,96 @@ bool range_is_int(StringRange *rng) {
 
 // ******************** Tokenizing ********************
 
+#if !defined RANGE_USE_SCALAR_SCAN && (defined RANGE_USE_SWAR_SCAN || !defined __GLIBC__)
+#  define USE_SWAR_SCAN
+#endif
+
+#ifdef USE_SWAR_SCAN
+// Aligned word reads can look past the end of a string without crossing
+// into another page. They are hidden from the address sanitizer.
+#  if defined __GNUC__
+typedef uintptr_t __attribute__((may_alias)) ScanWord;
+#    define NO_SANITIZE_ADDRESS  __attribute__((no_sanitize_address))
+#  else
+typedef uintptr_t ScanWord;
+#    define NO_SANITIZE_ADDRESS
+#  endif
+
+#  define WORD_ONES     ((uintptr_t)-1 / 0xFF)
+#  define WORD_HIGHS    (WORD_ONES * 0x80)
+#  define SPLAT(ch)     (WORD_ONES * (uint8_t)(ch))
+
+// Nonzero when any byte in w is zero
+#  define HAS_ZERO(w)   (((w) - WORD_ONES) & ~(w) & WORD_HIGHS)
+
+
+// Find the first NUL, d0, or d1 in str
+NO_SANITIZE_ADDRESS static size_t cspan2(const char *str, char d0, char d1) {
+  const char *pos = str;
+
+  // Scan bytes up to word alignment
+  while((uintptr_t)pos % sizeof(ScanWord) != 0) {
+    if(*pos == '\0' || *pos == d0 || *pos == d1)
+      return pos - str;
+    pos++;
+  }
+
+  uintptr_t m0 = SPLAT(d0);
+  uintptr_t m1 = SPLAT(d1);
+
+  // Skip whole words without a match
+  while(1) {
+    uintptr_t w = *(const ScanWord *)pos;
+    if(HAS_ZERO(w) | HAS_ZERO(w ^ m0) | HAS_ZERO(w ^ m1))
+      break;
+    pos += sizeof(ScanWord);
+  }
+
+  while(*pos != '\0' && *pos != d0 && *pos != d1)
+    pos++;
+
+  return pos - str;
+}
+#endif
+
+
+/*
+Get the length of the leading part of a string without any delimiters
+
+This is equivalent to strcspn(). Sets of one or two delimiters can be searched
+a word at a time.
+
+Args:
+  str:   C string to scan
+  delim: Delimiter characters
+
+Returns:
+  Number of characters before the first delimiter or NUL
+*/
+size_t str_cspan(const char *str, const char *delim) {
+#ifdef USE_SWAR_SCAN
+  if(delim[0] != '\0' && (delim[1] == '\0' || delim[2] == '\0'))
+    return cspan2(str, delim[0], delim[1] != '\0' ? delim[1] : delim[0]);
+#endif
+
+  return strcspn(str, delim);
+}
+
+
+// Skip leading delimiters. Runs are short so this scans bytes.
+static size_t span_delims(const char *str, const char *delim) {
+  if(delim[0] != '\0' && (delim[1] == '\0' || delim[2] == '\0')) {
+    const char *pos = str;
+    while(*pos != '\0' && (*pos == delim[0] || *pos == delim[1]))
+      pos++;
+
+    return pos - str;
+  }
+
+  return strspn(str, delim);
+}
+
+
 /*
 Extract tokens from a string.
 
@@ -1005,12 +1126,12 @@ bool range_token(const char *str, const char *delim, StringRange *token) {
 
 
   // Skip leading delimiters
-  str += strspn(str, delim);
+  str += span_delims(str, delim);
   if(*str == '\0') // No more tokens
     return false;
 
   // Get token length
-  size_t tok_len = strcspn(str, delim);
+  size_t tok_len = str_cspan(str, delim);
 
   // Save token
   token->start = (char *)str;
@@ -1054,13 +1175,13 @@ bool range_token_limit(const char *str, const char *delim, StringRange *token, s
 
 
   // Skip leading delimiters
-  size_t consumed = strspn(str, delim);
+  size_t consumed = span_delims(str, delim);
   str += consumed;
   if(*str == '\0') // No more tokens
     return false;
 
   // Get token length
-  size_t tok_len = strcspn(str, delim);
+  size_t tok_len = str_cspan(str, delim);
   if(consumed + tok_len > *limit) {// Truncate token
     if(consumed <= *limit)
       tok_len = *limit - consumed;
@@ -0,0 +1,583 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Benchmark for the dhash table
+
+  This measures insert, lookup and remove throughput and the distribution
+  of probe counts as the table fills. The bucket growth scheme and layout
+  are fixed at compile time so this is built once with the defaults and again
+  with DH_USE_2X_GROWTH or DH_USE_SWISS_TABLE to compare them. Builds with
+  DH_USE_CONCURRENT measure the cost of lockless lookups. The worst case
+  insert time shows the cost of resizing with and without DH_USE_INCREMENTAL_GROW.
+  Each run also builds an mphash over the same keys as a baseline for the
+  read-only indices.
+------------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "util/dhash.h"
+#include "util/mphash.h"
+#include "util/getopt_r.h"
+#include "util/range_strings.h"
+
+
+#ifdef DH_USE_2X_GROWTH
+#  define GROWTH_NAME   "po2"
+#else
+#  define GROWTH_NAME   "prime"
+#endif
+
+#ifdef DH_USE_SWISS_TABLE
+#  define TABLE_NAME    "swiss"
+#else
+#  define TABLE_NAME    "robin_hood"
+#endif
+
+#ifdef DH_USE_CONCURRENT
+#  define LAYOUT_NAME   TABLE_NAME "_concurrent"
+#else
+#  define LAYOUT_NAME   TABLE_NAME
+#endif
+
+#ifdef DH_USE_INCREMENTAL_GROW
+#  define RESIZE_NAME   "incremental"
+#else
+#  define RESIZE_NAME   "full"
+#endif
+
+#define PATH_KEY_LEN    40
+#define PROBE_BINS      9   // Last bin collects everything longer
+
+static const int s_load_factors[] = {25, 50, 75, 85, 90, 93};
+
+
+typedef enum {
+  KEY_PATH,
+  KEY_INT_SEQ,
+  KEY_INT_RAND
+} KeyType;
+
+static const char *s_key_names[] = {"path", "int_seq", "int_rand"};
+
+
+// Keys for a test. The first half is inserted and the second half is for missed lookups.
+typedef struct KeySet {
+  KeyType   type;
+  size_t    num_keys;
+  char     *paths;    // Fixed width path strings
+  uint32_t *ints;
+} KeySet;
+
+
+static struct {
+  bool json;
+  size_t items;
+  int key_type;     // Run only this key type when >= 0
+  FILE *out;
+} s_options;
+
+static bool s_first_row;
+
+
+// ******************** Timing ********************
+
+static uint64_t get_nsec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+// ******************** Keys ********************
+
+// Murmur3 finalizer. This is a bijection so distinct inputs give distinct keys.
+static uint32_t mix32(uint32_t h) {
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return h;
+}
+
+
+static bool keys_init(KeySet *keys, KeyType type, size_t num_keys) {
+  *keys = (KeySet){
+    .type     = type,
+    .num_keys = num_keys
+  };
+
+  if(type == KEY_PATH) {
+    keys->paths = malloc(num_keys * PATH_KEY_LEN);
+    if(!keys->paths)
+      return false;
+
+    // Shaped like the paths in a typical resource image
+    for(size_t i = 0; i < num_keys; i++) {
+      snprintf(&keys->paths[i * PATH_KEY_LEN], PATH_KEY_LEN, "assets/dir%02u/sub%02u/file%06u.bin",
+               (unsigned)(i % 37), (unsigned)(i % 11), (unsigned)i);
+    }
+
+  } else {
+    keys->ints = malloc(num_keys * sizeof(*keys->ints));
+    if(!keys->ints)
+      return false;
+
+    for(size_t i = 0; i < num_keys; i++) {
+      keys->ints[i] = type == KEY_INT_SEQ ? (uint32_t)i : mix32((uint32_t)i);
+    }
+  }
+
+  return true;
+}
+
+
+static void keys_free(KeySet *keys) {
+  free(keys->paths);
+  free(keys->ints);
+}
+
+
+static inline dhKey get_key(KeySet *keys, size_t i) {
+  dhKey key;
+
+  if(keys->type == KEY_PATH) {
+    key.data = &keys->paths[i * PATH_KEY_LEN];
+    key.length = strlen(key.data);
+  } else {
+    key.data = (void *)(uintptr_t)keys->ints[i];
+    key.length = sizeof(keys->ints[i]);
+  }
+
+  return key;
+}
+
+
+// ******************** Hash setup ********************
+
+static void destroy_item(dhKey key, void *value, void *ctx) {
+}
+
+
+static bool hash_init(dhash *hash, KeyType type, size_t init_buckets) {
+  dhConfig cfg = {
+    .init_buckets = init_buckets,
+    .value_size   = sizeof(uintptr_t),
+    .destroy_item = destroy_item,
+#ifdef DH_USE_CONCURRENT
+    .concurrent   = true  // Lookups take the lockless path
+#endif
+  };
+
+  if(type == KEY_PATH) {
+    cfg.gen_hash = dh_gen_hash_string;
+    cfg.is_equal = dh_equal_hash_keys_string;
+  } else {
+    cfg.gen_hash = dh_gen_hash_int;
+    cfg.is_equal = dh_equal_hash_keys_int;
+  }
+
+  return dh_init(hash, &cfg, NULL);
+}
+
+
+// ******************** Output ********************
+
+static void print_row_start(void) {
+  if(s_options.json)
+    fprintf(s_options.out, "%s    {", s_first_row ? "" : ",\n");
+  s_first_row = false;
+}
+
+
+static void print_row_end(void) {
+  fputc(s_options.json ? '}' : '\n', s_options.out);
+  fflush(s_options.out);
+}
+
+
+static void print_section(const char *name, const char *csv_header, bool first) {
+  if(s_options.json) {
+    if(!first)
+      fputs("\n  ],\n", s_options.out);
+    fprintf(s_options.out, "  \"%s\": [\n", name);
+  } else {
+    if(!first)
+      fputc('\n', s_options.out);
+    fputs(csv_header, s_options.out);
+  }
+
+  s_first_row = true;
+}
+
+
+static void print_throughput(const char *layout, const char *growth, KeySet *keys, const char *test,
+                             size_t ops, uint64_t nsec, size_t failed,
+                             size_t items, size_t capacity, int load_factor) {
+  double ns_per_op = ops > 0 ? (double)nsec / ops : 0.0;
+  double mops = nsec > 0 ? (double)ops * 1000.0 / nsec : 0.0;
+
+  print_row_start();
+
+  if(s_options.json) {
+    fprintf(s_options.out, "\"layout\": \"%s\", \"growth\": \"%s\", \"keys\": \"%s\", \"test\": \"%s\", "
+            "\"ops\": %zu, \"ns_per_op\": %.1f, \"mops_per_sec\": %.3f, \"failed\": %zu, \"items\": %zu, "
+            "\"capacity\": %zu, \"load_factor\": %d",
+            layout, growth, s_key_names[keys->type], test, ops, ns_per_op, mops, failed,
+            items, capacity, load_factor);
+  } else {
+    fprintf(s_options.out, "%s,%s,%s,%s,%zu,%.1f,%.3f,%zu,%zu,%zu,%d", layout, growth,
+            s_key_names[keys->type], test, ops, ns_per_op, mops, failed, items,
+            capacity, load_factor);
+  }
+
+  print_row_end();
+}
+
+
+static void print_probes(KeySet *keys, dhash *hash, int target_load) {
+  size_t histogram[PROBE_BINS];
+  dh_probe_histogram(hash, histogram, PROBE_BINS);
+
+  // Scaled by 100
+  int mean = dh_mean_probe_count(hash);
+
+  print_row_start();
+
+  if(s_options.json) {
+    fprintf(s_options.out, "\"layout\": \"%s\", \"growth\": \"%s\", \"keys\": \"%s\", \"target_load\": %d, "
+            "\"load_factor\": %d, \"items\": %zu, \"capacity\": %zu, \"mean_probes\": %d.%02d, "
+            "\"max_probes\": %d, \"histogram\": [",
+            LAYOUT_NAME, GROWTH_NAME, s_key_names[keys->type], target_load, dh_load_factor(hash),
+            dh_num_items(hash), dh_cur_capacity(hash), mean / 100, mean % 100,
+            dh_max_probe_count(hash));
+    for(int i = 0; i < PROBE_BINS; i++) {
+      fprintf(s_options.out, "%s%zu", i > 0 ? ", " : "", histogram[i]);
+    }
+    fputc(']', s_options.out);
+
+  } else {
+    fprintf(s_options.out, "%s,%s,%s,%d,%d,%zu,%zu,%d.%02d,%d", LAYOUT_NAME, GROWTH_NAME,
+            s_key_names[keys->type],
+            target_load, dh_load_factor(hash), dh_num_items(hash), dh_cur_capacity(hash),
+            mean / 100, mean % 100, dh_max_probe_count(hash));
+    for(int i = 0; i < PROBE_BINS; i++) {
+      fprintf(s_options.out, ",%zu", histogram[i]);
+    }
+  }
+
+  print_row_end();
+}
+
+
+static void print_dh_throughput(KeySet *keys, const char *test, size_t ops, uint64_t nsec,
+                                size_t failed, dhash *hash) {
+  print_throughput(LAYOUT_NAME, GROWTH_NAME, keys, test, ops, nsec, failed,
+                   dh_num_items(hash), dh_cur_capacity(hash), dh_load_factor(hash));
+}
+
+
+// ******************** Tests ********************
+
+// Time each operation over all keys with the hash growing from its minimum size
+static void bench_throughput(KeySet *keys) {
+  dhash hash;
+  size_t items = keys->num_keys / 2;
+  uint64_t start;
+  size_t failed;
+  uintptr_t value;
+
+  if(!hash_init(&hash, keys->type, 0)) {
+    fprintf(stderr, "Failed to create hash\n");
+    return;
+  }
+
+  failed = 0;
+  start = get_nsec();
+  for(size_t i = 0; i < items; i++) {
+    value = i;
+    if(!dh_insert(&hash, get_key(keys, i), &value))
+      failed++;
+  }
+  print_dh_throughput(keys, "insert", items, get_nsec() - start, failed, &hash);
+
+  failed = 0;
+  start = get_nsec();
+  for(size_t i = 0; i < items; i++) {
+    if(!dh_lookup(&hash, get_key(keys, i), &value) || value != i)
+      failed++;
+  }
+  print_dh_throughput(keys, "lookup_hit", items, get_nsec() - start, failed, &hash);
+
+  failed = 0;
+  start = get_nsec();
+  for(size_t i = items; i < keys->num_keys; i++) {
+    if(dh_lookup(&hash, get_key(keys, i), &value))
+      failed++;
+  }
+  print_dh_throughput(keys, "lookup_miss", items, get_nsec() - start, failed, &hash);
+
+  failed = 0;
+  start = get_nsec();
+  for(size_t i = 0; i < items; i++) {
+    if(!dh_remove(&hash, get_key(keys, i), &value))
+      failed++;
+  }
+  print_dh_throughput(keys, "remove", items, get_nsec() - start, failed, &hash);
+
+  dh_free(&hash);
+}
+
+
+// Time each insert on its own to find the stalls from resizing
+// The reserved test presizes the hash so it never resizes.
+static void bench_insert_latency(KeySet *keys, bool reserve) {
+  dhash hash;
+  size_t items = keys->num_keys / 2;
+  uint64_t total = 0;
+  uint64_t worst = 0;
+  uintptr_t value;
+
+  if(!hash_init(&hash, keys->type, 0)) {
+    fprintf(stderr, "Failed to create hash\n");
+    return;
+  }
+
+  if(reserve && !dh_reserve_capacity(&hash, items)) {
+    fprintf(stderr, "Failed to reserve hash capacity\n");
+    dh_free(&hash);
+    return;
+  }
+
+  for(size_t i = 0; i < items; i++) {
+    value = i;
+    uint64_t start = get_nsec();
+    dh_insert(&hash, get_key(keys, i), &value);
+    uint64_t elapsed = get_nsec() - start;
+
+    total += elapsed;
+    if(elapsed > worst)
+      worst = elapsed;
+  }
+
+  double mean_ns = items > 0 ? (double)total / items : 0.0;
+  const char *test = reserve ? "reserved" : "grow";
+
+  print_row_start();
+
+  if(s_options.json) {
+    fprintf(s_options.out, "\"layout\": \"%s\", \"growth\": \"%s\", \"resize\": \"%s\", "
+            "\"keys\": \"%s\", \"test\": \"%s\", \"ops\": %zu, \"mean_ns\": %.1f, \"max_ns\": %" PRIu64,
+            LAYOUT_NAME, GROWTH_NAME, RESIZE_NAME, s_key_names[keys->type], test, items, mean_ns, worst);
+  } else {
+    fprintf(s_options.out, "%s,%s,%s,%s,%s,%zu,%.1f,%" PRIu64, LAYOUT_NAME, GROWTH_NAME, RESIZE_NAME,
+            s_key_names[keys->type], test, items, mean_ns, worst);
+  }
+
+  print_row_end();
+
+  dh_free(&hash);
+}
+
+
+// Time building a perfect hash and looking up keys in it
+// These rows give a read-only baseline for the dhash results
+static void bench_mph_throughput(KeySet *keys) {
+  mphash mph;
+  size_t items = keys->num_keys / 2;
+  uint64_t start;
+  size_t failed;
+  uintptr_t value;
+
+  mphConfig cfg = {
+    .num_keys   = items,
+    .value_size = sizeof(uintptr_t),
+    .gen_hash   = keys->type == KEY_PATH ? mph_gen_hash_string : mph_gen_hash_int,
+    .is_equal   = keys->type == KEY_PATH ? dh_equal_hash_keys_string : dh_equal_hash_keys_int
+  };
+
+  if(!mph_init(&mph, &cfg, NULL)) {
+    fprintf(stderr, "Failed to create perfect hash\n");
+    return;
+  }
+
+  failed = 0;
+  start = get_nsec();
+  for(size_t i = 0; i < items; i++) {
+    value = i;
+    if(!mph_add(&mph, get_key(keys, i), &value))
+      failed++;
+  }
+  if(!mph_build(&mph))
+    failed = items;
+  print_throughput("mph", "none", keys, "build", items, get_nsec() - start, failed,
+                   mph_num_items(&mph), mph_num_items(&mph), 100);
+
+  failed = 0;
+  start = get_nsec();
+  for(size_t i = 0; i < items; i++) {
+    if(!mph_lookup(&mph, get_key(keys, i), &value) || value != i)
+      failed++;
+  }
+  print_throughput("mph", "none", keys, "lookup_hit", items, get_nsec() - start, failed,
+                   mph_num_items(&mph), mph_num_items(&mph), 100);
+
+  failed = 0;
+  start = get_nsec();
+  for(size_t i = items; i < keys->num_keys; i++) {
+    if(mph_lookup(&mph, get_key(keys, i), &value))
+      failed++;
+  }
+  print_throughput("mph", "none", keys, "lookup_miss", items, get_nsec() - start, failed,
+                   mph_num_items(&mph), mph_num_items(&mph), 100);
+
+  mph_free(&mph);
+}
+
+
+// Fill a fixed size hash and sample the probe counts at increasing load factors
+static void bench_probes(KeySet *keys) {
+  dhash hash;
+  size_t items = keys->num_keys / 2;
+
+  if(!hash_init(&hash, keys->type, items)) {
+    fprintf(stderr, "Failed to create hash\n");
+    return;
+  }
+
+  size_t capacity = dh_cur_capacity(&hash);
+  size_t next_key = 0;
+  uintptr_t value;
+
+  for(size_t i = 0; i < COUNT_OF(s_load_factors); i++) {
+    while(dh_load_factor(&hash) < s_load_factors[i] && dh_num_items(&hash) < capacity &&
+          next_key < keys->num_keys) {
+
+      value = next_key;
+      if(!dh_insert(&hash, get_key(keys, next_key++), &value))
+        break;
+    }
+
+    // Don't report after growth or beyond the maximum load
+    if(dh_cur_capacity(&hash) != capacity || dh_load_factor(&hash) < s_load_factors[i])
+      break;
+
+    print_probes(keys, &hash, s_load_factors[i]);
+  }
+
+  dh_free(&hash);
+}
+
+
+int main(int argc, char *argv[]) {
+  s_options.json = false;
+  s_options.items = 100000;
+  s_options.key_type = -1;
+  s_options.out = stdout;
+
+  GetoptState state = {.report_errors = true};
+
+  int c;
+  while((c = getopt_r(argv, "f:o:n:k:h", &state)) != -1) {
+    switch(c) {
+    case 'f':
+      s_options.json = !strcmp(state.optarg, "json");
+      break;
+    case 'o':
+      s_options.out = fopen(state.optarg, "w");
+      if(!s_options.out) {
+        fprintf(stderr, "Can't open '%s'\n", state.optarg);
+        return 1;
+      }
+      break;
+    case 'n':
+      s_options.items = strtoul(state.optarg, NULL, 10);
+      break;
+    case 'k':
+      for(size_t i = 0; i < COUNT_OF(s_key_names); i++) {
+        if(!strcmp(state.optarg, s_key_names[i]))
+          s_options.key_type = i;
+      }
+      break;
+    default:
+    case 'h':
+    case ':':
+    case '?':
+      printf("Usage: %s [-f csv|json] [-o file] [-n items] [-k keys] [-h]\n", argv[0]);
+      puts("  -f <fmt>  \toutput format");
+      puts("  -o <file> \tresult file. Default is stdout");
+      puts("  -n <items>\tnumber of items to insert");
+      puts("  -k <keys> \trun only one key type: path, int_seq, int_rand");
+      puts("  -h        \tdisplay this help and exit");
+      return 0;
+      break;
+    }
+  }
+
+  if(s_options.items == 0)
+    s_options.items = 1;
+
+  KeySet key_sets[COUNT_OF(s_key_names)];
+  size_t num_sets = 0;
+
+  for(size_t i = 0; i < COUNT_OF(s_key_names); i++) {
+    if(s_options.key_type >= 0 && s_options.key_type != (int)i)
+      continue;
+
+    if(!keys_init(&key_sets[num_sets], (KeyType)i, s_options.items * 2)) {
+      fprintf(stderr, "Failed to allocate keys\n");
+      return 1;
+    }
+    num_sets++;
+  }
+
+
+  if(s_options.json)
+    fputs("{\n", s_options.out);
+
+  print_section("throughput", "layout,growth,keys,test,ops,ns_per_op,mops_per_sec,failed,items,capacity,load_factor\n",
+                /*first*/ true);
+  for(size_t i = 0; i < num_sets; i++) {
+    bench_throughput(&key_sets[i]);
+    bench_mph_throughput(&key_sets[i]);
+  }
+
+  print_section("probes", "layout,growth,keys,target_load,load_factor,items,capacity,mean_probes,max_probes,"
+                "p1,p2,p3,p4,p5,p6,p7,p8,p9_up\n", /*first*/ false);
+  for(size_t i = 0; i < num_sets; i++) {
+    bench_probes(&key_sets[i]);
+  }
+
+  print_section("insert_latency", "layout,growth,resize,keys,test,ops,mean_ns,max_ns\n", /*first*/ false);
+  for(size_t i = 0; i < num_sets; i++) {
+    bench_insert_latency(&key_sets[i], /*reserve*/ false);
+    bench_insert_latency(&key_sets[i], /*reserve*/ true);
+  }
+
+  if(s_options.json)
+    fputs("\n  ]\n}\n", s_options.out);
+
+
+  for(size_t i = 0; i < num_sets; i++) {
+    keys_free(&key_sets[i]);
+  }
+
+  if(s_options.out != stdout)
+    fclose(s_options.out);
+
+  return 0;
+}
@@ -0,0 +1,682 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Benchmark for VFS backends and shim stacks
+
+  Each backend is registered bare and under a set of shims. The same tests
+  are run through every stack and the results are printed as CSV or JSON so
+  that they can be compared between releases. Each test repeats for a fixed
+  time rather than a fixed count so fast and slow backends both give stable
+  rates.
+------------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "evfs.h"
+
+#include "evfs/stdio_fs.h"
+#include "evfs/posix_fs.h"
+#include "evfs/tar_fs.h"
+#include "evfs/tar_rsrc_fs.h"
+#include "evfs/romfs_fs.h"
+#include "evfs/shim/shim_trace.h"
+#include "evfs/shim/shim_jail.h"
+#include "evfs/shim/shim_rotate.h"
+#include "evfs/shim/shim_metrics.h"
+
+#include "ff.h"
+#include "evfs/fatfs_image.h"
+#include "evfs/fatfs_fs.h"
+
+#include "lfs.h"
+#include "evfs/littlefs_image.h"
+#include "evfs/littlefs_fs.h"
+
+#include "evfs/util/getopt_r.h"
+
+// Resources with test data
+#include "test_tar.h"
+#include "test_romfs.h"
+
+
+#define KB  *1024UL
+#define IMAGE_SIZE      (2048 KB)
+#define BENCH_FILE_SIZE (256 KB)
+#define LFS_BLOCK_SIZE  4096
+#define MAX_BUF_SIZE    (32 KB)
+
+static const size_t s_buf_sizes[] = {64, 512, 4096, 32768};
+
+
+typedef struct BenchTarget {
+  const char *backend;
+  const char *stack;
+  char        vfs_name[32];         // Top of the shim stack
+  bool        writable;
+  char        dir[EVFS_MAX_PATH];   // Directory for listings and new files
+  char        file[EVFS_MAX_PATH];  // File for read tests
+  evfs_off_t  file_size;
+} BenchTarget;
+
+typedef struct BenchResult {
+  const char   *test;
+  size_t        buf_size;
+  unsigned long ops;
+  uint64_t      bytes;
+  double        seconds;
+  unsigned long errors;
+} BenchResult;
+
+
+static struct {
+  bool json;
+  double min_time;
+  const char *backend;  // Run only this backend when not NULL
+  const char *stack;    // Run only this stack when not NULL
+  const char *work_dir;
+  FILE *out;            // Destination for results
+} s_options;
+
+static bool s_first_row = true;
+static uint8_t s_buf[MAX_BUF_SIZE];
+static EvfsTraceRing *s_ring = NULL;
+
+
+// ******************** Timing ********************
+
+static uint64_t get_nsec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline double elapsed_sec(uint64_t start) {
+  return (double)(get_nsec() - start) / 1.0e9;
+}
+
+// xorshift32 for random offsets
+static uint32_t s_rand_state = 0x12345678;
+
+static uint32_t bench_rand(void) {
+  uint32_t x = s_rand_state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  s_rand_state = x;
+  return x;
+}
+
+
+// ******************** Output ********************
+
+static void print_header(void) {
+  if(s_options.json)
+    fputs("[\n", s_options.out);
+  else
+    fputs("backend,stack,test,buf_size,ops,bytes,seconds,ops_per_sec,mib_per_sec,errors\n", s_options.out);
+}
+
+static void print_footer(void) {
+  if(s_options.json)
+    fputs("\n]\n", s_options.out);
+}
+
+static void print_result(BenchTarget *tgt, BenchResult *res) {
+  double ops_per_sec = res->seconds > 0.0 ? (double)res->ops / res->seconds : 0.0;
+  double mib_per_sec = res->seconds > 0.0 ? (double)res->bytes / res->seconds / (1024.0*1024.0) : 0.0;
+
+  if(s_options.json) {
+    fprintf(s_options.out, "%s  {\"backend\": \"%s\", \"stack\": \"%s\", \"test\": \"%s\", \"buf_size\": %zu, "
+           "\"ops\": %lu, \"bytes\": %llu, \"seconds\": %.6f, \"ops_per_sec\": %.1f, "
+           "\"mib_per_sec\": %.3f, \"errors\": %lu}",
+           s_first_row ? "" : ",\n", tgt->backend, tgt->stack, res->test, res->buf_size,
+           res->ops, (unsigned long long)res->bytes, res->seconds, ops_per_sec, mib_per_sec, res->errors);
+  } else {
+    fprintf(s_options.out, "%s,%s,%s,%zu,%lu,%llu,%.6f,%.1f,%.3f,%lu\n", tgt->backend, tgt->stack, res->test,
+           res->buf_size, res->ops, (unsigned long long)res->bytes, res->seconds, ops_per_sec,
+           mib_per_sec, res->errors);
+  }
+
+  fflush(s_options.out);
+  s_first_row = false;
+}
+
+
+// ******************** Tests ********************
+
+// Write the test file from start to end repeatedly
+static void bench_seq_write(BenchTarget *tgt, BenchResult *res) {
+  uint64_t start = get_nsec();
+
+  do {
+    EvfsFile *fh;
+    if(evfs_open_ex(tgt->file, &fh, EVFS_WRITE | EVFS_OPEN_OR_NEW | EVFS_OVERWRITE, tgt->vfs_name) != EVFS_OK) {
+      res->errors++;
+      break;
+    }
+
+    for(size_t pos = 0; pos < BENCH_FILE_SIZE; pos += res->buf_size) {
+      ptrdiff_t wrote = evfs_file_write(fh, s_buf, res->buf_size);
+      if(wrote != (ptrdiff_t)res->buf_size) {
+        res->errors++;
+        break;
+      }
+      res->bytes += wrote;
+      res->ops++;
+    }
+
+    evfs_file_close(fh);
+  } while(res->errors == 0 && elapsed_sec(start) < s_options.min_time);
+
+  res->seconds = elapsed_sec(start);
+  tgt->file_size = BENCH_FILE_SIZE;
+}
+
+
+// Read the test file from start to end repeatedly
+static void bench_seq_read(BenchTarget *tgt, BenchResult *res) {
+  uint64_t start = get_nsec();
+
+  do {
+    EvfsFile *fh;
+    if(evfs_open_ex(tgt->file, &fh, EVFS_READ, tgt->vfs_name) != EVFS_OK) {
+      res->errors++;
+      break;
+    }
+
+    ptrdiff_t read;
+    while((read = evfs_file_read(fh, s_buf, res->buf_size)) > 0) {
+      res->bytes += read;
+      res->ops++;
+    }
+    if(read < 0)
+      res->errors++;
+
+    evfs_file_close(fh);
+  } while(res->errors == 0 && elapsed_sec(start) < s_options.min_time);
+
+  res->seconds = elapsed_sec(start);
+}
+
+
+static evfs_off_t random_offset(BenchTarget *tgt, size_t buf_size) {
+  if(tgt->file_size <= (evfs_off_t)buf_size)
+    return 0;
+
+  // Keep offsets aligned to the transfer size
+  evfs_off_t slots = tgt->file_size / buf_size;
+  return (bench_rand() % slots) * buf_size;
+}
+
+
+static void bench_rand_read(BenchTarget *tgt, BenchResult *res) {
+  EvfsFile *fh;
+  if(evfs_open_ex(tgt->file, &fh, EVFS_READ, tgt->vfs_name) != EVFS_OK) {
+    res->errors++;
+    return;
+  }
+
+  uint64_t start = get_nsec();
+
+  do {
+    for(int i = 0; i < 16; i++) {
+      ptrdiff_t read = evfs_file_read_at(fh, s_buf, res->buf_size, random_offset(tgt, res->buf_size));
+      if(read < 0) {
+        res->errors++;
+        break;
+      }
+      res->bytes += read;
+      res->ops++;
+    }
+  } while(res->errors == 0 && elapsed_sec(start) < s_options.min_time);
+
+  res->seconds = elapsed_sec(start);
+  evfs_file_close(fh);
+}
+
+
+static void bench_rand_write(BenchTarget *tgt, BenchResult *res) {
+  EvfsFile *fh;
+  if(evfs_open_ex(tgt->file, &fh, EVFS_RDWR, tgt->vfs_name) != EVFS_OK) {
+    res->errors++;
+    return;
+  }
+
+  uint64_t start = get_nsec();
+
+  do {
+    for(int i = 0; i < 16; i++) {
+      ptrdiff_t wrote = evfs_file_write_at(fh, s_buf, res->buf_size, random_offset(tgt, res->buf_size));
+      if(wrote < 0) {
+        res->errors++;
+        break;
+      }
+      res->bytes += wrote;
+      res->ops++;
+    }
+  } while(res->errors == 0 && elapsed_sec(start) < s_options.min_time);
+
+  res->seconds = elapsed_sec(start);
+  evfs_file_close(fh);
+}
+
+
+static void bench_open_close(BenchTarget *tgt, BenchResult *res) {
+  uint64_t start = get_nsec();
+
+  do {
+    for(int i = 0; i < 16; i++) {
+      EvfsFile *fh;
+      if(evfs_open_ex(tgt->file, &fh, EVFS_READ, tgt->vfs_name) != EVFS_OK) {
+        res->errors++;
+        break;
+      }
+      evfs_file_close(fh);
+      res->ops++;
+    }
+  } while(res->errors == 0 && elapsed_sec(start) < s_options.min_time);
+
+  res->seconds = elapsed_sec(start);
+}
+
+
+static void bench_stat(BenchTarget *tgt, BenchResult *res) {
+  uint64_t start = get_nsec();
+
+  do {
+    for(int i = 0; i < 16; i++) {
+      EvfsInfo info;
+      if(evfs_stat_ex(tgt->file, &info, tgt->vfs_name) != EVFS_OK) {
+        res->errors++;
+        break;
+      }
+      res->ops++;
+    }
+  } while(res->errors == 0 && elapsed_sec(start) < s_options.min_time);
+
+  res->seconds = elapsed_sec(start);
+}
+
+
+// List the whole test directory. Each entry is counted as an op
+static void bench_dir_list(BenchTarget *tgt, BenchResult *res) {
+  uint64_t start = get_nsec();
+
+  do {
+    EvfsDir *dh;
+    if(evfs_open_dir_ex(tgt->dir, &dh, tgt->vfs_name) != EVFS_OK) {
+      res->errors++;
+      break;
+    }
+
+    EvfsInfo info;
+    while(evfs_dir_read(dh, &info) == EVFS_OK) {
+      res->ops++;
+    }
+
+    evfs_dir_close(dh);
+  } while(elapsed_sec(start) < s_options.min_time);
+
+  res->seconds = elapsed_sec(start);
+}
+
+
+static void run_test(BenchTarget *tgt, const char *test, size_t buf_size,
+                     void (*bench)(BenchTarget *tgt, BenchResult *res)) {
+  BenchResult res = {
+    .test = test,
+    .buf_size = buf_size
+  };
+
+  bench(tgt, &res);
+  print_result(tgt, &res);
+}
+
+
+static void run_target(BenchTarget *tgt) {
+  if(s_options.backend && strcmp(s_options.backend, tgt->backend))
+    return;
+  if(s_options.stack && strcmp(s_options.stack, tgt->stack))
+    return;
+
+  // Writable targets benchmark their own file. It's created by the first write test.
+  if(tgt->writable) {
+    for(size_t i = 0; i < COUNT_OF(s_buf_sizes); i++) {
+      run_test(tgt, "seq_write", s_buf_sizes[i], bench_seq_write);
+    }
+  }
+
+  for(size_t i = 0; i < COUNT_OF(s_buf_sizes); i++) {
+    run_test(tgt, "seq_read", s_buf_sizes[i], bench_seq_read);
+  }
+
+  for(size_t i = 0; i < COUNT_OF(s_buf_sizes); i++) {
+    run_test(tgt, "rand_read", s_buf_sizes[i], bench_rand_read);
+  }
+
+  if(tgt->writable) {
+    for(size_t i = 0; i < COUNT_OF(s_buf_sizes); i++) {
+      run_test(tgt, "rand_write", s_buf_sizes[i], bench_rand_write);
+    }
+  }
+
+  run_test(tgt, "open_close", 0, bench_open_close);
+  run_test(tgt, "stat", 0, bench_stat);
+  run_test(tgt, "dir_list", 0, bench_dir_list);
+}
+
+
+// ******************** Targets ********************
+
+// Callback for trace shim that discards the output
+static int null_report(const char *buf, void *ctx) {
+  return 0;
+}
+
+
+typedef struct LargestFile {
+  char path[EVFS_MAX_PATH];
+  evfs_off_t size;
+} LargestFile;
+
+static int find_largest(const char *path, const EvfsInfo *info, unsigned depth, void *ctx) {
+  LargestFile *largest = (LargestFile *)ctx;
+
+  if(!(info->type & EVFS_FILE_DIR) && info->size > largest->size) {
+    largest->size = info->size;
+    strncpy(largest->path, path, sizeof(largest->path)-1);
+  }
+
+  return EVFS_OK;
+}
+
+
+// Benchmark a backend bare and then under each shim
+static void run_backend(const char *backend, const char *dir, bool writable) {
+  BenchTarget tgt = {
+    .backend = backend,
+    .writable = writable
+  };
+
+  // Read tests on read only backends use the largest file available
+  LargestFile largest = {0};
+  if(!writable) {
+    EvfsWalkConfig cfg = {
+      .pre_visit = find_largest,
+      .max_depth = -1,
+      .ctx = &largest
+    };
+    if(evfs_walk_ex(dir, &cfg, backend) != EVFS_OK || largest.size == 0) {
+      // No directory support on this backend. Use a file known to be in the test images.
+      EvfsInfo info;
+      StringRange file_r = RANGE_FROM_ARRAY(largest.path);
+      evfs_path_join_str_ex(dir, "littlefs_fs.c", &file_r, backend);
+      if(evfs_stat_ex(largest.path, &info, backend) == EVFS_OK)
+        largest.size = info.size;
+    }
+  }
+
+  static const char *stacks[] = {"bare", "trace", "trace_ring", "metrics", "jail", "rotate"};
+
+  for(size_t i = 0; i < COUNT_OF(stacks); i++) {
+    const char *stack = stacks[i];
+    const char *target_dir = dir;
+    const char *file_name = "bench.bin";
+    int status = EVFS_OK;
+
+    tgt.stack = stack;
+    snprintf(tgt.vfs_name, sizeof(tgt.vfs_name), "%s.%s", backend, stack);
+
+    if(!strcmp(stack, "bare")) {
+      snprintf(tgt.vfs_name, sizeof(tgt.vfs_name), "%s", backend);
+
+    } else if(!strcmp(stack, "trace")) {
+      status = evfs_register_trace(tgt.vfs_name, backend, null_report, NULL, /*default_vfs*/ false);
+
+    } else if(!strcmp(stack, "trace_ring")) {
+      status = evfs_register_trace_ring(tgt.vfs_name, backend, s_ring, /*default_vfs*/ false);
+
+    } else if(!strcmp(stack, "metrics")) {
+      status = evfs_register_metrics(tgt.vfs_name, backend, get_nsec, /*default_vfs*/ false);
+
+    } else if(!strcmp(stack, "jail")) {
+      status = evfs_register_jail(tgt.vfs_name, backend, dir, /*default_vfs*/ false);
+      target_dir = "/";
+
+    } else if(!strcmp(stack, "rotate")) {
+      if(!writable) // Rotated files only exist on writable filesystems
+        continue;
+
+      RotateConfig cfg = {
+        .chunk_size = 32 KB,
+        .max_chunks = 2 * BENCH_FILE_SIZE / (32 KB)
+      };
+      status = evfs_register_rotate(tgt.vfs_name, backend, &cfg, /*default_vfs*/ false);
+      file_name = "bench.rot";
+    }
+
+    if(status != EVFS_OK) {
+      fprintf(stderr, "Failed to register %s: %s\n", tgt.vfs_name, evfs_err_name(status));
+      continue;
+    }
+
+    snprintf(tgt.dir, sizeof(tgt.dir), "%s", target_dir);
+
+    if(writable) {
+      StringRange file_r = RANGE_FROM_ARRAY(tgt.file);
+      evfs_path_join_str_ex(tgt.dir, file_name, &file_r, tgt.vfs_name);
+      tgt.file_size = 0;
+
+    } else {
+      // Translate the file found on the backend into the jail
+      const char *file = largest.path;
+      if(!strcmp(stack, "jail"))
+        file += strlen(dir) - 1;
+      snprintf(tgt.file, sizeof(tgt.file), "%s", file);
+      tgt.file_size = largest.size;
+    }
+
+    run_target(&tgt);
+  }
+}
+
+
+static int write_resource(const char *path, const uint8_t *data, size_t len) {
+  EvfsFile *fh;
+  int status = evfs_open_ex(path, &fh, EVFS_WRITE | EVFS_OPEN_OR_NEW | EVFS_OVERWRITE, "stdio");
+  if(status != EVFS_OK)
+    return status;
+
+  ptrdiff_t wrote = evfs_file_write(fh, data, len);
+  evfs_file_close(fh);
+
+  return wrote == (ptrdiff_t)len ? EVFS_OK : EVFS_ERR_IO;
+}
+
+
+int main(int argc, char *argv[]) {
+  evfs_init();
+
+  // Process command line
+  s_options.json = false;
+  s_options.min_time = 0.2;
+  s_options.work_dir = "bench_data";
+  s_options.out = stdout;
+
+  GetoptState state = {.report_errors = true};
+
+  int c;
+  while((c = getopt_r(argv, "f:o:t:b:s:d:h", &state)) != -1) {
+    switch(c) {
+    case 'f':
+      s_options.json = !strcmp(state.optarg, "json");
+      break;
+    case 'o':
+      s_options.out = fopen(state.optarg, "w");
+      if(!s_options.out) {
+        fprintf(stderr, "Can't open '%s'\n", state.optarg);
+        return 1;
+      }
+      break;
+    case 't':
+      s_options.min_time = atof(state.optarg);
+      break;
+    case 'b':
+      s_options.backend = state.optarg;
+      break;
+    case 's':
+      s_options.stack = state.optarg;
+      break;
+    case 'd':
+      s_options.work_dir = state.optarg;
+      break;
+    default:
+    case 'h':
+    case ':':
+    case '?':
+      {
+        // Get the base name for the executable
+        StringRange base;
+        evfs_path_basename(argv[0], &base);
+
+        printf("Usage: %.*s [-f csv|json] [-o file] [-t sec] [-b backend] [-s stack] [-d dir] [-h]\n", RANGE_FMT(&base));
+        puts("  -f <fmt> \toutput format");
+        puts("  -o <file>\tresult file. Default is stdout");
+        puts("  -t <sec> \tminimum time for each test");
+        puts("  -b <name>\trun only one backend: stdio, posix, fatfs, littlefs, tar, tar_rsrc, romfs, romfs_rsrc");
+        puts("  -s <name>\trun only one stack: bare, trace, trace_ring, metrics, jail, rotate");
+        puts("  -d <dir> \tdirectory for test files and images");
+        puts("  -h       \tdisplay this help and exit");
+      }
+      return 0;
+      break;
+    }
+  }
+
+  evfs_register_stdio(/*default*/ true);
+
+  memset(s_buf, 0xA5, sizeof(s_buf));
+
+  int status = evfs_trace_ring_new(4096, get_nsec, &s_ring);
+  if(status != EVFS_OK) {
+    fprintf(stderr, "Failed to create trace ring: %s\n", evfs_err_name(status));
+    return 1;
+  }
+
+  // Everything on stdio lives under an absolute work dir so the jail can use it
+  char work_dir[EVFS_MAX_PATH];
+  StringRange work_dir_r = RANGE_FROM_ARRAY(work_dir);
+  evfs_make_path(s_options.work_dir);
+  evfs_path_absolute(s_options.work_dir, &work_dir_r);
+
+  char img_path[EVFS_MAX_PATH];
+  StringRange img_path_r = RANGE_FROM_ARRAY(img_path);
+
+
+  print_header();
+
+  // Stdio
+  run_backend("stdio", work_dir, /*writable*/ true);
+
+  // POSIX
+  evfs_register_posix(/*cfg*/ NULL, /*default*/ false);
+  run_backend("posix", work_dir, /*writable*/ true);
+
+
+  // FatFs image
+  uint8_t pdrv = 0;
+  evfs_path_join_str(work_dir, "bench_fatfs.img", &img_path_r);
+  fatfs_make_image(img_path, pdrv, IMAGE_SIZE);
+  if(fatfs_mount_image(img_path, pdrv) == EVFS_OK) {
+    evfs_register_fatfs("fatfs", pdrv, /*default*/ false);
+    run_backend("fatfs", "/", /*writable*/ true);
+  } else {
+    fprintf(stderr, "Failed to mount FatFs image\n");
+  }
+
+
+  // littlefs image
+  lfs_t lfs;
+  LittlefsImage lfs_img = {0};
+  struct lfs_config lfs_cfg = {
+      .context = &lfs_img,
+
+      .read  = littlefs_image_read,
+      .prog  = littlefs_image_prog,
+      .erase = littlefs_image_erase,
+      .sync  = littlefs_image_sync,
+
+      .read_size      = 16,
+      .prog_size      = 16,
+      .block_size     = LFS_BLOCK_SIZE,
+      .block_count    = IMAGE_SIZE / LFS_BLOCK_SIZE,
+      .cache_size     = 1024,
+      .lookahead_size = 16,
+      .block_cycles   = -1
+  };
+
+  range_init(&img_path_r, img_path, sizeof(img_path));
+  evfs_path_join_str(work_dir, "bench_littlefs.img", &img_path_r);
+  littlefs_make_image(img_path, &lfs_cfg);
+  if(littlefs_mount_image(img_path, &lfs_cfg, &lfs) == EVFS_OK) {
+    evfs_register_littlefs("littlefs", &lfs, /*default*/ false);
+    run_backend("littlefs", "/", /*writable*/ true);
+  } else {
+    fprintf(stderr, "Failed to mount littlefs image\n");
+  }
+
+
+  // Tar file and resource
+  EvfsFile *tar_file = NULL;
+  range_init(&img_path_r, img_path, sizeof(img_path));
+  evfs_path_join_str(work_dir, "bench.tar", &img_path_r);
+  if(write_resource(img_path, test_tar, test_tar_len) == EVFS_OK &&
+     evfs_open_ex(img_path, &tar_file, EVFS_READ, "stdio") == EVFS_OK) {
+    evfs_register_tar_fs("tar", tar_file, /*default*/ false);
+    run_backend("tar", "/", /*writable*/ false);
+  }
+
+  evfs_register_tar_rsrc_fs("tar_rsrc", test_tar, test_tar_len, /*default*/ false);
+  run_backend("tar_rsrc", "/", /*writable*/ false);
+
+
+  // Romfs image and resource
+  EvfsFile *romfs_file = NULL;
+  range_init(&img_path_r, img_path, sizeof(img_path));
+  evfs_path_join_str(work_dir, "bench.romfs", &img_path_r);
+  if(write_resource(img_path, test_romfs, test_romfs_len) == EVFS_OK &&
+     evfs_open_ex(img_path, &romfs_file, EVFS_READ, "stdio") == EVFS_OK) {
+    evfs_register_romfs("romfs", romfs_file, /*default*/ false);
+    run_backend("romfs", "/", /*writable*/ false);
+  }
+
+  evfs_register_rsrc_romfs("romfs_rsrc", test_romfs, test_romfs_len, /*default*/ false);
+  run_backend("romfs_rsrc", "/", /*writable*/ false);
+
+  print_footer();
+
+
+  // Cleanup
+  littlefs_unmount_image(&lfs);
+  fatfs_unmount_image(pdrv);
+  evfs_unregister_all(); // Tar and romfs close their image files
+  evfs_trace_ring_free(s_ring);
+
+  if(s_options.out != stdout)
+    fclose(s_options.out);
+
+  return 0;
+}
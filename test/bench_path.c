@@ -0,0 +1,524 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Benchmark for path string handling
+
+  This generates sets of paths shaped like those seen by the VFS layer and
+  times the string kernels from range_strings against byte-at-a-time
+  reference versions. The path resolution functions built on them are timed
+  through the stdio VFS. Build with RANGE_USE_SCALAR_SCAN to compare the
+  library's scalar fallbacks or RANGE_USE_SWAR_SCAN to time the word scan
+  that glibc builds otherwise skip.
+------------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "evfs.h"
+
+#include "evfs/stdio_fs.h"
+#include "evfs/util/getopt_r.h"
+
+
+#define PATH_LEN    128
+
+
+typedef enum {
+  PATHS_ABS,
+  PATHS_REL,
+  PATHS_DOTS,
+  PATHS_DOS,
+  PATHS_DEEP
+} PathSetType;
+
+static const char *s_set_names[] = {"abs", "rel", "dots", "dos", "deep"};
+
+
+typedef struct PathSet {
+  PathSetType type;
+  size_t      num_paths;
+  char       *paths;      // Fixed width path strings
+  size_t      total_len;  // Sum of all path lengths
+} PathSet;
+
+typedef struct BenchResult {
+  const char   *test;
+  unsigned long ops;
+  uint64_t      bytes;
+  double        seconds;
+  unsigned long errors;
+} BenchResult;
+
+
+static struct {
+  bool json;
+  double min_time;
+  size_t items;
+  int set_type;     // Run only this path set when >= 0
+  FILE *out;
+} s_options;
+
+static bool s_first_row = true;
+static volatile size_t s_sink;  // Keeps results from being optimized away
+
+
+// ******************** Timing ********************
+
+static uint64_t get_nsec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline double elapsed_sec(uint64_t start) {
+  return (double)(get_nsec() - start) / 1.0e9;
+}
+
+// xorshift32 for path shapes
+static uint32_t s_rand_state = 0x12345678;
+
+static uint32_t bench_rand(void) {
+  uint32_t x = s_rand_state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  s_rand_state = x;
+  return x;
+}
+
+
+// ******************** Paths ********************
+
+static const char *s_dir_names[] = {
+  "usr", "local", "share", "assets", "config", "data", "log", "images", "fonts",
+  "build", "src", "lib", "a", "tmp", "cache", "firmware_update", "sd0"
+};
+
+static const char *s_file_names[] = {
+  "settings.json", "boot.cfg", "index.html", "logo.png", "a.txt", "data_0001.bin",
+  "readme", "calibration_table.csv", "font_12px.bdf", "x"
+};
+
+
+static const char *rand_dir(void) {
+  return s_dir_names[bench_rand() % COUNT_OF(s_dir_names)];
+}
+
+
+static void make_path(PathSetType type, char *buf) {
+  AppendRange r = {.start = buf, .end = buf + PATH_LEN};
+  unsigned depth;
+
+  switch(type) {
+  case PATHS_ABS:
+    depth = 1 + bench_rand() % 4;
+    for(unsigned i = 0; i < depth; i++) {
+      range_cat_str(&r, "/");
+      range_cat_str(&r, rand_dir());
+    }
+    break;
+
+  case PATHS_REL:
+    depth = bench_rand() % 3;
+    for(unsigned i = 0; i < depth; i++) {
+      range_cat_str(&r, rand_dir());
+      range_cat_str(&r, "/");
+    }
+    break;
+
+  case PATHS_DOTS: // Dot segments and redundant separators
+    depth = 2 + bench_rand() % 4;
+    for(unsigned i = 0; i < depth; i++) {
+      static const char *segs[] = {"/./", "/../", "//", "/"};
+      range_cat_str(&r, segs[bench_rand() % COUNT_OF(segs)]);
+      range_cat_str(&r, rand_dir());
+    }
+    break;
+
+  case PATHS_DOS: // Mixed separators
+    depth = 1 + bench_rand() % 4;
+    for(unsigned i = 0; i < depth; i++) {
+      range_cat_str(&r, (bench_rand() & 1) ? "\\" : "/");
+      range_cat_str(&r, rand_dir());
+    }
+    break;
+
+  case PATHS_DEEP:
+    depth = 6 + bench_rand() % 5;
+    for(unsigned i = 0; i < depth; i++) {
+      range_cat_str(&r, "/");
+      range_cat_str(&r, rand_dir());
+    }
+    break;
+  }
+
+  if(type != PATHS_REL) // Relative dirs already end with a separator
+    range_cat_str(&r, "/");
+  range_cat_str(&r, s_file_names[bench_rand() % COUNT_OF(s_file_names)]);
+}
+
+
+static bool paths_init(PathSet *set, PathSetType type, size_t num_paths) {
+  *set = (PathSet){
+    .type      = type,
+    .num_paths = num_paths
+  };
+
+  set->paths = malloc(num_paths * PATH_LEN);
+  if(!set->paths)
+    return false;
+
+  for(size_t i = 0; i < num_paths; i++) {
+    char *path = &set->paths[i * PATH_LEN];
+    make_path(type, path);
+    set->total_len += strlen(path);
+  }
+
+  return true;
+}
+
+
+static inline const char *path_at(PathSet *set, size_t i) {
+  return &set->paths[i * PATH_LEN];
+}
+
+
+// ******************** Reference kernels ********************
+
+// Byte-at-a-time versions of the range_strings kernels
+
+static size_t ref_cspan(const char *str, const char *delim) {
+  const char *pos = str;
+  while(*pos != '\0' && !strchr(delim, *pos))
+    pos++;
+
+  return pos - str;
+}
+
+
+static size_t ref_strlen(StringRange *rng) {
+  const char *pos = rng->start;
+  while(pos < rng->end && *pos != '\0')
+    pos++;
+
+  return pos - rng->start;
+}
+
+
+static bool ref_eq(StringRange *rng, const char *str) {
+  const char *rpos = rng->start;
+  const char *spos = str;
+
+  while(rpos < rng->end && *spos != '\0') {
+    if(*rpos != *spos) return false;
+    rpos++;
+    spos++;
+  }
+
+  return (rpos == rng->end && *spos == '\0');
+}
+
+
+// ******************** Output ********************
+
+static void print_header(void) {
+  if(s_options.json)
+    fputs("[\n", s_options.out);
+  else
+    fputs("paths,test,ops,bytes,seconds,ns_per_op,mib_per_sec,errors\n", s_options.out);
+}
+
+static void print_footer(void) {
+  if(s_options.json)
+    fputs("\n]\n", s_options.out);
+}
+
+static void print_result(PathSet *set, BenchResult *res) {
+  double ns_per_op   = res->ops > 0 ? res->seconds * 1.0e9 / (double)res->ops : 0.0;
+  double mib_per_sec = res->seconds > 0.0 ? (double)res->bytes / res->seconds / (1024.0*1024.0) : 0.0;
+
+  if(s_options.json) {
+    fprintf(s_options.out, "%s  {\"paths\": \"%s\", \"test\": \"%s\", \"ops\": %lu, \"bytes\": %llu, "
+           "\"seconds\": %.6f, \"ns_per_op\": %.2f, \"mib_per_sec\": %.3f, \"errors\": %lu}",
+           s_first_row ? "" : ",\n", s_set_names[set->type], res->test, res->ops,
+           (unsigned long long)res->bytes, res->seconds, ns_per_op, mib_per_sec, res->errors);
+  } else {
+    fprintf(s_options.out, "%s,%s,%lu,%llu,%.6f,%.2f,%.3f,%lu\n", s_set_names[set->type], res->test,
+           res->ops, (unsigned long long)res->bytes, res->seconds, ns_per_op, mib_per_sec, res->errors);
+  }
+
+  fflush(s_options.out);
+  s_first_row = false;
+}
+
+
+// ******************** Tests ********************
+
+// Each pass covers the whole path set. Every path is counted as an op.
+#define BENCH_LOOP(set, res, ...) do { \
+  uint64_t start = get_nsec(); \
+  do { \
+    for(size_t i = 0; i < (set)->num_paths; i++) { \
+      const char *path = path_at((set), i); \
+      __VA_ARGS__ \
+    } \
+    (res)->ops += (set)->num_paths; \
+    (res)->bytes += (set)->total_len; \
+  } while(elapsed_sec(start) < s_options.min_time); \
+  (res)->seconds = elapsed_sec(start); \
+} while(0)
+
+
+// Find every separator in each path
+static void bench_cspan(PathSet *set, BenchResult *res) {
+  size_t sum = 0;
+  BENCH_LOOP(set, res, {
+    const char *pos = path;
+    while(*pos != '\0') {
+      pos += str_cspan(pos, EVFS_PATH_SEPS);
+      sum += pos - path;
+      if(*pos != '\0') pos++;
+    }
+  });
+  s_sink = sum;
+}
+
+static void bench_cspan_ref(PathSet *set, BenchResult *res) {
+  size_t sum = 0;
+  BENCH_LOOP(set, res, {
+    const char *pos = path;
+    while(*pos != '\0') {
+      pos += ref_cspan(pos, EVFS_PATH_SEPS);
+      sum += pos - path;
+      if(*pos != '\0') pos++;
+    }
+  });
+  s_sink = sum;
+}
+
+static void bench_strcspn(PathSet *set, BenchResult *res) {
+  size_t sum = 0;
+  BENCH_LOOP(set, res, {
+    const char *pos = path;
+    while(*pos != '\0') {
+      pos += strcspn(pos, EVFS_PATH_SEPS);
+      sum += pos - path;
+      if(*pos != '\0') pos++;
+    }
+  });
+  s_sink = sum;
+}
+
+
+static void bench_token(PathSet *set, BenchResult *res) {
+  size_t sum = 0;
+  BENCH_LOOP(set, res, {
+    StringRange tok;
+    bool more = range_token(path, EVFS_PATH_SEPS, &tok);
+    while(more) {
+      sum += range_size(&tok);
+      more = range_token(NULL, EVFS_PATH_SEPS, &tok);
+    }
+  });
+  s_sink = sum;
+}
+
+
+// Ranges cover the whole fixed width slot so the NUL must be found
+static void bench_strlen(PathSet *set, BenchResult *res) {
+  size_t sum = 0;
+  BENCH_LOOP(set, res, {
+    StringRange r = {.start = path, .end = path + PATH_LEN};
+    sum += range_strlen(&r);
+  });
+  s_sink = sum;
+}
+
+static void bench_strlen_ref(PathSet *set, BenchResult *res) {
+  size_t sum = 0;
+  BENCH_LOOP(set, res, {
+    StringRange r = {.start = path, .end = path + PATH_LEN};
+    sum += ref_strlen(&r);
+  });
+  s_sink = sum;
+}
+
+
+// Compare each path with its neighbor. Generated sets share long prefixes.
+static void bench_eq(PathSet *set, BenchResult *res) {
+  size_t sum = 0;
+  BENCH_LOOP(set, res, {
+    const char *other = path_at(set, (i+1) % set->num_paths);
+    StringRange r = {.start = path, .end = path + strlen(path)};
+    sum += range_eq(&r, path) + range_eq(&r, other);
+  });
+  s_sink = sum;
+}
+
+static void bench_eq_ref(PathSet *set, BenchResult *res) {
+  size_t sum = 0;
+  BENCH_LOOP(set, res, {
+    const char *other = path_at(set, (i+1) % set->num_paths);
+    StringRange r = {.start = path, .end = path + strlen(path)};
+    sum += ref_eq(&r, path) + ref_eq(&r, other);
+  });
+  s_sink = sum;
+}
+
+
+static Evfs *s_vfs;
+
+static void bench_scan_path(PathSet *set, BenchResult *res) {
+  size_t sum = 0;
+  BENCH_LOOP(set, res, {
+    StringRange elem;
+    int status = evfs_vfs_scan_path(s_vfs, path, &elem);
+    while(status == EVFS_OK) {
+      sum += range_size(&elem);
+      status = evfs_vfs_scan_path(s_vfs, NULL, &elem);
+    }
+  });
+  s_sink = sum;
+}
+
+
+static void bench_normalize(PathSet *set, BenchResult *res) {
+  char buf[EVFS_MAX_PATH];
+  BENCH_LOOP(set, res, {
+    StringRange r = RANGE_FROM_ARRAY(buf);
+    if(evfs_vfs_path_normalize(s_vfs, path, &r) != EVFS_OK)
+      res->errors++;
+  });
+}
+
+
+static void bench_absolute(PathSet *set, BenchResult *res) {
+  char buf[EVFS_MAX_PATH];
+  BENCH_LOOP(set, res, {
+    StringRange r = RANGE_FROM_ARRAY(buf);
+    if(evfs_vfs_path_absolute(s_vfs, path, &r) != EVFS_OK)
+      res->errors++;
+  });
+}
+
+
+static void run_test(PathSet *set, const char *test, void (*bench)(PathSet *set, BenchResult *res)) {
+  BenchResult res = {
+    .test = test
+  };
+
+  bench(set, &res);
+  print_result(set, &res);
+}
+
+
+static void run_set(PathSet *set) {
+  run_test(set, "cspan",      bench_cspan);
+  run_test(set, "cspan_ref",  bench_cspan_ref);
+  run_test(set, "strcspn",    bench_strcspn);
+  run_test(set, "token",      bench_token);
+  run_test(set, "strlen",     bench_strlen);
+  run_test(set, "strlen_ref", bench_strlen_ref);
+  run_test(set, "eq",         bench_eq);
+  run_test(set, "eq_ref",     bench_eq_ref);
+  run_test(set, "scan_path",  bench_scan_path);
+  run_test(set, "normalize",  bench_normalize);
+  run_test(set, "absolute",   bench_absolute);
+}
+
+
+int main(int argc, char *argv[]) {
+  s_options.json = false;
+  s_options.min_time = 0.25;
+  s_options.items = 1000;
+  s_options.set_type = -1;
+  s_options.out = stdout;
+
+  GetoptState state = {.report_errors = true};
+
+  int c;
+  while((c = getopt_r(argv, "f:o:t:n:p:h", &state)) != -1) {
+    switch(c) {
+    case 'f':
+      s_options.json = !strcmp(state.optarg, "json");
+      break;
+    case 'o':
+      s_options.out = fopen(state.optarg, "w");
+      if(!s_options.out) {
+        fprintf(stderr, "Can't open '%s'\n", state.optarg);
+        return 1;
+      }
+      break;
+    case 't':
+      s_options.min_time = strtod(state.optarg, NULL);
+      break;
+    case 'n':
+      s_options.items = strtoul(state.optarg, NULL, 10);
+      break;
+    case 'p':
+      for(size_t i = 0; i < COUNT_OF(s_set_names); i++) {
+        if(!strcmp(state.optarg, s_set_names[i]))
+          s_options.set_type = i;
+      }
+      break;
+    default:
+    case 'h':
+    case ':':
+    case '?':
+      printf("Usage: %s [-f csv|json] [-o file] [-t sec] [-n paths] [-p paths] [-h]\n", argv[0]);
+      puts("  -f <fmt>  \toutput format");
+      puts("  -o <file> \tresult file. Default is stdout");
+      puts("  -t <sec>  \tminimum time for each test");
+      puts("  -n <paths>\tnumber of paths in each set");
+      puts("  -p <paths>\trun only one path set: abs, rel, dots, dos, deep");
+      puts("  -h        \tdisplay this help and exit");
+      return 0;
+      break;
+    }
+  }
+
+  if(s_options.items == 0)
+    s_options.items = 1;
+
+  evfs_init();
+  evfs_register_stdio(/*default*/ true);
+  s_vfs = evfs_find_vfs("stdio");
+
+  print_header();
+
+  for(size_t i = 0; i < COUNT_OF(s_set_names); i++) {
+    if(s_options.set_type >= 0 && s_options.set_type != (int)i)
+      continue;
+
+    PathSet set;
+    if(!paths_init(&set, i, s_options.items)) {
+      fprintf(stderr, "Failed to allocate paths\n");
+      break;
+    }
+
+    run_set(&set);
+    free(set.paths);
+  }
+
+  print_footer();
+
+  evfs_unregister_all();
+
+  if(s_options.out != stdout)
+    fclose(s_options.out);
+
+  return 0;
+}
@@ -0,0 +1,185 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Workload replay tool
+
+  This replays a capture from the capture tracing shim on the host filesystem
+  and reports throughput and latency percentiles. Captures can also be dumped
+  as text. Timestamps in the capture are assumed to be in microseconds unless
+  another clock rate is given.
+------------------------------------------------------------------------------
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "evfs.h"
+
+#include "evfs/stdio_fs.h"
+#include "evfs/trace_replay.h"
+#include "evfs/util/getopt_r.h"
+
+
+static uint64_t s_ticks_per_sec = 1000000;
+
+
+static uint64_t get_ticks(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * s_ticks_per_sec + (uint64_t)ts.tv_nsec * s_ticks_per_sec / 1000000000ull;
+}
+
+static void delay_ticks(uint64_t ticks) {
+  uint64_t nsec = ticks * 1000000000ull / s_ticks_per_sec;
+  struct timespec ts = {.tv_sec = nsec / 1000000000ull, .tv_nsec = nsec % 1000000000ull};
+  nanosleep(&ts, NULL);
+}
+
+static inline double tick_usec(uint64_t ticks) {
+  return (double)ticks * 1.0e6 / s_ticks_per_sec;
+}
+
+
+static int dump_capture(EvfsFile *capture) {
+  evfs_off_t size = evfs_file_size(capture);
+  if(size < 0) return size;
+
+  uint8_t *buf = malloc(size > 0 ? size : 1);
+  if(!buf) return EVFS_ERR_ALLOC;
+
+  int status = EVFS_OK;
+  if(evfs_file_read_at(capture, buf, size, 0) != size)
+    status = EVFS_ERR_IO;
+
+  EvfsCaptureRecord rec;
+  size_t pos = 0;
+  while(status == EVFS_OK && (status = evfs_capture_decode(buf, size, &pos, &rec)) == EVFS_OK) {
+    printf("%" PRIu64 " +%" PRIu32 " %s #%" PRIu32 " size=%" PRId64 " offset=%" PRId64 " -> %" PRId64,
+           rec.timestamp, rec.elapsed, evfs_trace_op_name(rec.op), rec.handle, rec.size, rec.offset,
+           rec.result);
+    if(rec.path)
+      printf("  '%s'", rec.path);
+    if(rec.new_path)
+      printf(" '%s'", rec.new_path);
+    putchar('\n');
+  }
+
+  free(buf);
+  return status == EVFS_DONE ? EVFS_OK : status;
+}
+
+
+static void print_stats(EvfsReplayStats *stats) {
+  double seconds = tick_usec(stats->elapsed) / 1.0e6;
+
+  printf("Calls:       %zu replayed, %zu skipped, %zu mismatched\n", stats->ops, stats->skipped,
+         stats->mismatches);
+  printf("Elapsed:     %.3f s (captured %.3f s)\n", seconds, tick_usec(stats->captured) / 1.0e6);
+  if(seconds > 0.0) {
+    printf("Throughput:  %.1f calls/s, read %.3f MiB/s, write %.3f MiB/s\n", stats->ops / seconds,
+           stats->bytes_read / seconds / (1024.0*1024.0), stats->bytes_written / seconds / (1024.0*1024.0));
+  }
+  printf("Latency us:  p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+         tick_usec(stats->latency_p50), tick_usec(stats->latency_p90), tick_usec(stats->latency_p99),
+         tick_usec(stats->latency_p999), tick_usec(stats->latency_max));
+}
+
+
+int main(int argc, char *argv[]) {
+  bool dump = false;
+  EvfsReplayConfig cfg = {
+    .clock    = get_ticks,
+    .delay    = delay_ticks,
+    .prepare  = true
+  };
+
+  GetoptState state = {.report_errors = true};
+
+  int c;
+  while((c = getopt_r(argv, "c:dnp:s:t:h", &state)) != -1) {
+    switch(c) {
+    case 'c':
+      s_ticks_per_sec = strtoull(state.optarg, NULL, 0);
+      if(s_ticks_per_sec == 0)
+        s_ticks_per_sec = 1000000;
+      break;
+    case 'd':
+      dump = true;
+      break;
+    case 'n':
+      cfg.prepare = false;
+      break;
+    case 'p':
+      cfg.path_prefix = state.optarg;
+      break;
+    case 's':
+      cfg.speed = strtoul(state.optarg, NULL, 0);
+      break;
+    case 't':
+      cfg.num_streams = strtoul(state.optarg, NULL, 0);
+      break;
+    default:
+    case 'h':
+    case ':':
+    case '?':
+      printf("Usage: %s [-c rate] [-d] [-n] [-p prefix] [-s speed] [-t streams] [-h] <capture>\n", argv[0]);
+      puts("  -c <rate>    \tclock ticks per second in the capture. Default is 1000000");
+      puts("  -d           \tdump the capture as text instead of replaying it");
+      puts("  -n           \tdon't create files the workload expects to exist");
+      puts("  -p <prefix>  \tdirectory prepended to captured paths");
+      puts("  -s <speed>   \tspeedup over the captured timing. Default is 0 for no delays");
+      puts("  -t <streams> \tnumber of concurrent replays. Needs a prefix");
+      puts("  -h           \tdisplay this help and exit");
+      return 0;
+      break;
+    }
+  }
+
+  if(state.optind >= argc) {
+    fprintf(stderr, "Missing capture file\n");
+    return 1;
+  }
+
+  const char *capture_path = argv[state.optind];
+
+  evfs_init();
+  evfs_register_stdio(/*default_vfs*/ true);
+
+  EvfsFile *capture;
+  int status = evfs_open(capture_path, &capture, EVFS_READ);
+  if(status == EVFS_OK) {
+    if(dump) {
+      status = dump_capture(capture);
+
+    } else {
+      EvfsReplayStats stats;
+      status = evfs_replay(capture, &cfg, &stats);
+      if(status == EVFS_OK)
+        print_stats(&stats);
+    }
+
+    evfs_file_close(capture);
+  }
+
+  if(status != EVFS_OK)
+    fprintf(stderr, "Can't replay '%s': %s\n", capture_path, evfs_err_name(status));
+
+  evfs_unregister_all();
+
+  return status == EVFS_OK ? 0 : 1;
+}
@@ -0,0 +1,135 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Index storage calculator
+
+  This reads a tar or Romfs image and prints the buffer sizes it needs for
+  evfs_register_tar_rsrc_fs_static() or evfs_register_rsrc_romfs_static().
+  The output is a set of C macros that can be included in a firmware build.
+  The sizes depend on the hash configuration and pointer width so build
+  this with the same dhash options and word size as the target.
+------------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "evfs.h"
+
+#include "evfs/tar_rsrc_fs.h"
+#include "evfs/romfs_fs.h"
+#include "evfs/util/getopt_r.h"
+
+
+#define ROMFS_MAGIC   "-rom1fs-"
+
+
+static uint8_t *read_image(const char *path, size_t *image_len) {
+  FILE *fh = fopen(path, "rb");
+  if(!fh) return NULL;
+
+  uint8_t *image = NULL;
+  long len = -1;
+
+  if(fseek(fh, 0, SEEK_END) == 0)
+    len = ftell(fh);
+
+  if(len > 0 && fseek(fh, 0, SEEK_SET) == 0) {
+    image = malloc(len);
+    if(image && fread(image, 1, len, fh) != (size_t)len) {
+      free(image);
+      image = NULL;
+    }
+  }
+
+  fclose(fh);
+  *image_len = len;
+  return image;
+}
+
+
+int main(int argc, char *argv[]) {
+  const char *name = "RSRC";
+  const char *fs_type = NULL;
+
+  GetoptState state = {.report_errors = true};
+
+  int c;
+  while((c = getopt_r(argv, "n:t:h", &state)) != -1) {
+    switch(c) {
+    case 'n':
+      name = state.optarg;
+      break;
+    case 't':
+      fs_type = state.optarg;
+      break;
+    default:
+    case 'h':
+    case ':':
+    case '?':
+      printf("Usage: %s [-n name] [-t tar|romfs] [-h] <image>\n", argv[0]);
+      puts("  -n <name> \tprefix for the generated macros. Default is RSRC");
+      puts("  -t <type> \timage format. Detected when omitted");
+      puts("  -h        \tdisplay this help and exit");
+      return 0;
+      break;
+    }
+  }
+
+  if(state.optind >= argc) {
+    fprintf(stderr, "Missing image file\n");
+    return 1;
+  }
+
+  const char *image_path = argv[state.optind];
+  size_t image_len;
+  uint8_t *image = read_image(image_path, &image_len);
+  if(!image) {
+    fprintf(stderr, "Can't read '%s'\n", image_path);
+    return 1;
+  }
+
+  if(!fs_type) {
+    bool is_romfs = image_len >= strlen(ROMFS_MAGIC) &&
+                    !memcmp(image, ROMFS_MAGIC, strlen(ROMFS_MAGIC));
+    fs_type = is_romfs ? "romfs" : "tar";
+  }
+
+  evfs_init();
+
+  EvfsIndexStorage storage;
+  int status;
+
+  if(!strcmp(fs_type, "romfs")) {
+    status = evfs_romfs_rsrc_index_size(image, image_len, &storage);
+  } else if(!strcmp(fs_type, "tar")) {
+    status = evfs_tar_rsrc_index_size(image, image_len, &storage);
+  } else {
+    fprintf(stderr, "Unknown image type '%s'\n", fs_type);
+    status = EVFS_ERR_BAD_ARG;
+  }
+
+  if(status == EVFS_OK) {
+    printf("// Index storage for %s image '%s'\n", fs_type, image_path);
+    printf("#define %s_INDEX_SIZE  %zu\n", name, storage.index_size);
+    printf("#define %s_KEYS_SIZE   %zu\n", name, storage.keys_size);
+  } else {
+    fprintf(stderr, "Can't index '%s': %s\n", image_path, evfs_err_name(status));
+  }
+
+  evfs_unregister_all();
+  free(image);
+
+  return status == EVFS_OK ? 0 : 1;
+}
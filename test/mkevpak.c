@@ -0,0 +1,110 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2021 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  Evpak image builder
+
+  This packs a directory tree into an evpak archive. The image can also be
+  written as C source for evfs_register_rsrc_evpak().
+------------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "evfs.h"
+
+#include "evfs/stdio_fs.h"
+#include "evfs/evpak_image.h"
+#include "evfs/romfs_image.h"
+#include "evfs/util/getopt_r.h"
+
+
+int main(int argc, char *argv[]) {
+  const char *c_array = NULL;
+  EvpakBuildConfig cfg = {0};
+
+  GetoptState state = {.report_errors = true};
+
+  int c;
+  while((c = getopt_r(argv, "a:c:h", &state)) != -1) {
+    switch(c) {
+    case 'a':
+      cfg.data_align = strtoul(state.optarg, NULL, 0);
+      break;
+    case 'c':
+      c_array = state.optarg;
+      break;
+    default:
+    case 'h':
+    case ':':
+    case '?':
+      printf("Usage: %s [-a align] [-c name] [-h] <dir> <image>\n", argv[0]);
+      puts("  -a <align>\talignment of file data. Default is 4096");
+      puts("  -c <name> \twrite the image as C source with an array of this name");
+      puts("  -h        \tdisplay this help and exit");
+      return 0;
+      break;
+    }
+  }
+
+  if(state.optind + 2 > argc) {
+    fprintf(stderr, "Missing source directory or image file\n");
+    return 1;
+  }
+
+  const char *src_dir = argv[state.optind];
+  const char *image_path = argv[state.optind+1];
+
+  evfs_init();
+  evfs_register_stdio(/*default_vfs*/ true);
+
+  EvfsFile *image;
+  int status;
+
+  if(c_array) { // Build in a temporary file and convert it
+    char tmp_path[EVFS_MAX_PATH];
+    snprintf(tmp_path, sizeof tmp_path, "%s.evpak", image_path);
+
+    status = evfs_open(tmp_path, &image, EVFS_READ | EVFS_WRITE | EVFS_OVERWRITE);
+    if(status == EVFS_OK) {
+      status = evpak_build_image(src_dir, image, &cfg);
+
+      EvfsFile *c_file;
+      if(status == EVFS_OK)
+        status = evfs_open(image_path, &c_file, EVFS_WRITE | EVFS_OVERWRITE);
+      if(status == EVFS_OK) {
+        // The converter is format agnostic
+        status = romfs_image_to_c_array(image, c_file, c_array, cfg.data_align ? cfg.data_align : 4096);
+        evfs_file_close(c_file);
+      }
+
+      evfs_file_close(image);
+      evfs_delete(tmp_path);
+    }
+
+  } else {
+    status = evfs_open(image_path, &image, EVFS_WRITE | EVFS_OVERWRITE);
+    if(status == EVFS_OK) {
+      status = evpak_build_image(src_dir, image, &cfg);
+      evfs_file_close(image);
+    }
+  }
+
+  if(status != EVFS_OK)
+    fprintf(stderr, "Can't build '%s': %s\n", image_path, evfs_err_name(status));
+
+  evfs_unregister_all();
+
+  return status == EVFS_OK ? 0 : 1;
+}
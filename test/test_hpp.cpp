@@ -0,0 +1,192 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  C++ binding test
+
+  A small read only backend written with VfsAdapter serves a fixed set of
+  files. They are read back through the File and Dir handles so the binding
+  is compiled with the project's warning flags.
+------------------------------------------------------------------------------
+*/
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+
+#include "evfs.hpp"
+
+
+namespace {
+
+struct MemEntry {
+  const char *name;
+  const char *data;
+};
+
+const MemEntry s_entries[] = {
+  {"hello.txt",   "Hello, world\n"},
+  {"digits.txt",  "0123456789"},
+  {"empty.txt",   ""}
+};
+
+
+const MemEntry *find_entry(const char *path) {
+  while(*path == '/')
+    path++;
+
+  for(const MemEntry &entry : s_entries) {
+    if(!strcmp(entry.name, path))
+      return &entry;
+  }
+
+  return nullptr;
+}
+
+
+class MemFs : public evfs::VfsBase<MemFs> {
+public:
+  class File : public evfs::FileBase<File> {
+  public:
+    ptrdiff_t read(void *buf, size_t size) {
+      ptrdiff_t rval = read_at(buf, size, m_pos);
+      if(rval > 0)
+        m_pos += rval;
+      return rval;
+    }
+
+    ptrdiff_t read_at(void *buf, size_t size, evfs_off_t offset) {
+      evfs_off_t avail = this->size() - offset;
+      if(avail <= 0) return 0;
+
+      size = std::min(size, (size_t)avail);
+      memcpy(buf, &m_entry->data[offset], size);
+      return size;
+    }
+
+    evfs_off_t size() { return (evfs_off_t)strlen(m_entry->data); }
+
+    int seek(evfs_off_t offset, EvfsSeekDir origin) {
+      if(origin == EVFS_SEEK_REL)
+        offset += m_pos;
+      else if(origin == EVFS_SEEK_REV)
+        offset = size() - offset;
+
+      if(offset < 0 || offset > size()) return EVFS_ERR_INVALID;
+      m_pos = offset;
+      return EVFS_OK;
+    }
+
+    evfs_off_t tell() { return m_pos; }
+    bool eof() { return m_pos >= size(); }
+
+    const MemEntry *m_entry = nullptr;
+    evfs_off_t      m_pos = 0;
+  };
+
+
+  class Dir : public evfs::DirBase<Dir> {
+  public:
+    int read(EvfsInfo *info) {
+      if(m_next >= std::size(s_entries)) return EVFS_DONE;
+
+      const MemEntry &entry = s_entries[m_next++];
+      *info = {};
+      info->name = (char *)entry.name;
+      info->size = (evfs_off_t)strlen(entry.data);
+      return EVFS_OK;
+    }
+
+    int rewind() {
+      m_next = 0;
+      return EVFS_OK;
+    }
+
+    size_t m_next = 0;
+  };
+
+
+  int open(const char *path, File *fil, int flags) {
+    if(flags & (EVFS_WRITE | EVFS_OVERWRITE | EVFS_APPEND)) return EVFS_ERR_DISABLED;
+
+    fil->m_entry = find_entry(path);
+    return fil->m_entry ? EVFS_OK : EVFS_ERR_NO_FILE;
+  }
+
+  int stat(const char *path, EvfsInfo *info) {
+    const MemEntry *entry = find_entry(path);
+    if(!entry) return EVFS_ERR_NO_FILE;
+
+    *info = {};
+    info->size = (evfs_off_t)strlen(entry->data);
+    return EVFS_OK;
+  }
+
+  int open_dir(const char *path, Dir *dir) {
+    return EVFS_OK;
+  }
+};
+
+} // namespace
+
+
+int main() {
+  printf("C++ binding test\n");
+
+  evfs_init();
+
+  MemFs mem_fs;
+  Evfs vfs = evfs::VfsAdapter<MemFs>::make_vfs("memfs", &mem_fs);
+  int status = evfs_register(&vfs, /*make_default*/ true);
+  if(status != EVFS_OK) {
+    printf("Register failed: %s\n", evfs_err_name(status));
+    return 1;
+  }
+
+
+  printf("\nDirectory:\n");
+  {
+    evfs::Dir dir;
+    dir.open("/");
+    for(const EvfsInfo &info : dir) {
+      printf("  '%s'  %ld\n", info.name, (long)info.size);
+    }
+    printf("Status: %s\n", evfs_err_name(dir.status()));
+  }
+
+
+  printf("\nPositional read:\n");
+  {
+    evfs::File fh;
+    status = fh.open("digits.txt", EVFS_READ);
+    printf("Open: %s\n", evfs_err_name(status));
+
+    std::array<char, 4> buf = {};
+    ptrdiff_t read = fh.read_at(evfs::Span<char>(buf.data(), buf.size() - 1), 6);
+    printf("Read %ld at 6: '%s'  pos: %ld\n", (long)read, buf.data(), (long)fh.tell());
+
+    char line[20] = {};
+    read = fh.read(evfs::Span<char>(line, sizeof(line) - 1));
+    printf("Read %ld: '%s'  eof: %d\n", (long)read, line, fh.eof());
+  }
+
+
+  printf("\nMissing file:\n");
+  {
+    evfs::File fh;
+    status = fh.open("missing.txt", EVFS_READ);
+    printf("Open: %s\n", evfs_err_name(status));
+  }
+
+  evfs_unregister(&vfs);
+
+  return 0;
+}
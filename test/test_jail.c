@@ -114,6 +114,12 @@ int main(int argc, char *argv[]) {
     evfs_get_cur_dir(&path_r);
     printf("Current dir: '%s'\n", path);
 
+    // Normalized absolute paths skip normalization in the jail
+    const char *check_paths[] = {"/hello.txt", "/subdir/../hello.txt", "//hello.txt", "../hello.txt"};
+    for(size_t i = 0; i < COUNT_OF(check_paths); i++) {
+      printf("Exists '%s': %c\n", check_paths[i], evfs_existing_file(check_paths[i]) ? 'T' : 'f');
+    }
+
   }
 
   return 0;
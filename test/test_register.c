@@ -0,0 +1,104 @@
+/* SPDX-License-Identifier: MIT
+Copyright 2020 Kevin Thibedeau
+(kevin 'period' thibedeau 'at' gmail 'punto' com)
+
+See LICENSE in the EVFS project root for details
+*/
+
+/*
+------------------------------------------------------------------------------
+Embedded Virtual Filesystem
+
+  VFS registration test
+
+  Registers enough VFSs to force collisions in the name index and checks that
+  every name is still found. Then a subset are unregistered and the lookups
+  are repeated against the rebuilt index.
+------------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "evfs.h"
+#include "evfs/ramfs_fs.h"
+
+
+#define NUM_VFS  40
+
+
+static void vfs_name(int i, char *name, size_t name_size) {
+  snprintf(name, name_size, "r%d", i);
+}
+
+
+// Check each VFS is found when expected and missing otherwise
+static int check_lookups(const bool registered[NUM_VFS]) {
+  int errors = 0;
+  char name[16];
+
+  for(int i = 0; i < NUM_VFS; i++) {
+    vfs_name(i, name, sizeof name);
+    Evfs *vfs = evfs_find_vfs(name);
+
+    if(registered[i]) {
+      if(!vfs || strcmp(evfs_vfs_name(vfs), name)) {
+        printf("  '%s' not found\n", name);
+        errors++;
+      }
+    } else if(vfs) {
+      printf("  '%s' found after unregister\n", name);
+      errors++;
+    }
+  }
+
+  return errors;
+}
+
+
+int main(void) {
+  printf("Registration test\n");
+
+  evfs_init();
+
+  bool registered[NUM_VFS] = {0};
+  char name[16];
+  int errors = 0;
+
+  for(int i = 0; i < NUM_VFS; i++) {
+    vfs_name(i, name, sizeof name);
+    int status = evfs_register_ramfs(name, NULL, /*default_vfs*/ i == 0);
+    if(status != EVFS_OK) {
+      printf("  Register '%s' failed: %s\n", name, evfs_err_name(status));
+      errors++;
+      continue;
+    }
+    registered[i] = true;
+  }
+
+  errors += check_lookups(registered);
+  printf("Registered %d VFSs\n", NUM_VFS);
+
+
+  // Remove every third VFS including the default
+  int removed = 0;
+  for(int i = 0; i < NUM_VFS; i += 3) {
+    vfs_name(i, name, sizeof name);
+    int status = evfs_unregister(evfs_find_vfs(name));
+    if(status != EVFS_OK) {
+      printf("  Unregister '%s' failed: %s\n", name, evfs_err_name(status));
+      errors++;
+      continue;
+    }
+    registered[i] = false;
+    removed++;
+  }
+
+  errors += check_lookups(registered);
+  printf("Unregistered %d VFSs\n", removed);
+
+  evfs_unregister_all();
+
+  printf("%s\n", errors == 0 ? "PASS" : "FAIL");
+  return errors == 0 ? 0 : 1;
+}
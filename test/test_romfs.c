@@ -5,6 +5,7 @@
 
 #include "evfs/stdio_fs.h"
 #include "evfs/romfs_fs.h"
+#include "evfs/romfs_image.h"
 #include "evfs/shim/shim_trace.h"
 
 #include "evfs/util/getopt_r.h"
@@ -32,16 +33,18 @@ int main(int argc, char *argv[]) {
   struct s_options {
     bool show_trace;
     const char *image_file;
+    const char *build_dir;
   } options;
 
 
   options.show_trace = false;
   options.image_file = NULL;
+  options.build_dir = NULL;
 
   GetoptState state = {.report_errors = true};
 
   int c;
-  while((c = getopt_r(argv, "tf:h", &state)) != -1) {
+  while((c = getopt_r(argv, "tf:b:h", &state)) != -1) {
     switch(c) {
     case 't':
       options.show_trace = true;
@@ -49,6 +52,9 @@ int main(int argc, char *argv[]) {
     case 'f':
       options.image_file = state.optarg;
       break;
+    case 'b':
+      options.build_dir = state.optarg;
+      break;
     default:
     case 'h':
     case ':':
@@ -58,8 +64,10 @@ int main(int argc, char *argv[]) {
         StringRange base;
         evfs_path_basename(argv[0], &base);
 
-        printf("Usage: %.*s [-t] [-h]\n", RANGE_FMT(&base));
+        printf("Usage: %.*s [-t] [-f <image>] [-b <dir>] [-h]\n", RANGE_FMT(&base));
         puts("  -t     \tshow EVFS tracing");
+        puts("  -f     \tload Romfs image file");
+        puts("  -b     \tbuild image file from directory before loading");
         puts("  -h     \tdisplay this help and exit");
       }
       return 0;
@@ -82,6 +90,22 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
+  if(options.image_file && options.build_dir) {
+    printf("Building image from: %s\n", options.build_dir);
+    EvfsFile *image;
+    status = evfs_open(options.image_file, &image, EVFS_WRITE | EVFS_OVERWRITE);
+    if(status == EVFS_OK) {
+      RomfsBuildConfig cfg = { .data_align = 64 };
+      status = romfs_build_image(options.build_dir, image, &cfg);
+      evfs_file_close(image);
+    }
+
+    if(status != EVFS_OK) {
+      printf("Failed to build image: %s\n", evfs_err_name(status));
+      return 1;
+    }
+  }
+
   if(options.image_file) {
     printf("Loading file: %s\n", options.image_file);
     EvfsFile *image;
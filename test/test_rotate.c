@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "evfs.h"
@@ -17,6 +18,12 @@ static int treport(const char *buf, void *ctx) {
 }
 
 
+// Callback for rotate reader notification
+static void tail_notify(EvfsFile *fh, evfs_off_t total_size, void *ctx) {
+  *(evfs_off_t *)ctx = total_size;
+}
+
+
 int main(int argc, char *argv[]) {
   printf("Rotate test\n");
 
@@ -26,21 +33,27 @@ int main(int argc, char *argv[]) {
   struct s_options {
     char operation;
     bool show_trace;
+    bool recycle;
+    uint32_t sync_bytes;
   } options;
 
 
   options.operation = 'w';
   options.show_trace = false;
+  options.recycle = false;
+  options.sync_bytes = 0;
 
   GetoptState state = {.report_errors = true};
 
   int c;
-  while((c = getopt_r(argv, "o:th", &state)) != -1) {
+  while((c = getopt_r(argv, "o:tRs:h", &state)) != -1) {
     switch(c) {
     case 'o':
       if(state.optarg) {
         if(!strcmp(state.optarg, "trim")) {
           options.operation = 'x';
+        } else if(!strcmp(state.optarg, "tail")) {
+          options.operation = 'f';
         } else {
           options.operation = state.optarg[0];
         }
@@ -49,6 +62,13 @@ int main(int argc, char *argv[]) {
     case 't':
       options.show_trace = true;
       break;
+    case 'R':
+      options.recycle = true;
+      break;
+    case 's':
+      if(state.optarg)
+        options.sync_bytes = strtoul(state.optarg, NULL, 10);
+      break;
     default:
     case 'h':
     case ':':
@@ -58,9 +78,11 @@ int main(int argc, char *argv[]) {
         StringRange base;
         evfs_path_basename(argv[0], &base);
 
-        printf("Usage: %.*s [-o write|read|trunc|r] [-t] [-h]\n", RANGE_FMT(&base));
+        printf("Usage: %.*s [-o write|read|trunc|trim|tail] [-t] [-R] [-s <bytes>] [-h]\n", RANGE_FMT(&base));
         puts("  -o <op>\ttest operation on container");
         puts("  -t     \tshow EVFS tracing");
+        puts("  -R     \trecycle evicted chunks");
+        puts("  -s <n> \tsync every n bytes");
         puts("  -h     \tdisplay this help and exit");
       }
       return 0;
@@ -76,7 +98,9 @@ int main(int argc, char *argv[]) {
 
   RotateConfig cfg = {
     .chunk_size = 40,
-    .max_chunks = 4
+    .max_chunks = 4,
+    .recycle_chunks = options.recycle,
+    .sync_bytes = options.sync_bytes
   };
 
 
@@ -151,6 +175,40 @@ int main(int argc, char *argv[]) {
     }
 
 
+    // Tail with a second handle while writing
+    if(options.operation == 'f') {
+      printf("**** TAILING\n");
+      EvfsFile *rh;
+      status = evfs_open("test.log", &rh, EVFS_READ);
+      printf("Opened reader: %s\n", evfs_err_name(status));
+
+      if(status == EVFS_OK) {
+        evfs_off_t notify_size = -1;
+        RotateNotify notify = {.callback = tail_notify, .ctx = &notify_size};
+        evfs_file_ctrl(rh, EVFS_CMD_SET_ROTATE_NOTIFY, &notify);
+
+        EvfsFile *wh;
+        status = evfs_open("test.log", &wh, EVFS_WRITE);
+        printf("Second writer: %s\n", evfs_err_name(status));
+
+        evfs_file_seek(rh, 0, EVFS_SEEK_REV);
+
+        for(int i = 0; i < 6; i++) {
+          sprintf(buf, "|%04d,tail\n", i);
+          evfs_file_write(fh, buf, strlen(buf));
+
+          ptrdiff_t read = evfs_file_read(rh, buf, COUNT_OF(buf)-1);
+          buf[read > 0 ? read : 0] = '\0';
+          printf("Notified size: %d  Reader pos: %d  Read: %s", notify_size, evfs_file_tell(rh), buf);
+        }
+
+        evfs_file_close(rh);
+        if(status == EVFS_OK)
+          evfs_file_close(wh);
+      }
+    }
+
+
    // Trim
     if(options.operation == 'x') {
       printf("**** TRIMMING\n");
@@ -182,11 +240,13 @@ int main(int argc, char *argv[]) {
 
     evfs_file_close(fh);
 
-    evfs_open("copy.txt", &fh, EVFS_READ);
-    evfs_off_t copy_size = evfs_file_size(fh);
-    printf("File sizes: log: %d  copy: %d\n", log_size, copy_size);
+    status = evfs_open_ex("copy.txt", &fh, EVFS_READ, "stdio");
+    if(status == EVFS_OK) {
+      evfs_off_t copy_size = evfs_file_size(fh);
+      printf("File sizes: log: %d  copy: %d\n", log_size, copy_size);
 
-    evfs_file_close(fh);
+      evfs_file_close(fh);
+    }
 
     //evfs_delete("test.log");
   }
@@ -1,11 +1,17 @@
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
 
 #include "evfs.h"
 
 #include "evfs/stdio_fs.h"
+#include "evfs/ramfs_fs.h"
 #include "evfs/tar_fs.h"
 #include "evfs/tar_rsrc_fs.h"
+#include "evfs/tar_stream.h"
+#ifdef USE_ZLIB
+#  include "evfs/gzip_file.h"
+#endif
 #include "evfs/shim/shim_trace.h"
 
 #include "evfs/util/getopt_r.h"
@@ -22,6 +28,85 @@ static int treport(const char *buf, void *ctx) {
 }
 
 
+// Check the open flags for new and existing members of a writable archive
+static int test_writable_open(void) {
+  static const struct {
+    const char *path;
+    int         flags;
+    int         expect;
+  } cases[] = {
+    {"/new.txt",    EVFS_WRITE,                     EVFS_ERR_NO_FILE},
+    {"/new.txt",    EVFS_WRITE | EVFS_OPEN_OR_NEW,  EVFS_OK},
+    {"/new.txt",    EVFS_WRITE,                     EVFS_ERR_NO_SUPPORT},
+    {"/new.txt",    EVFS_WRITE | EVFS_OPEN_OR_NEW,  EVFS_ERR_NO_SUPPORT},
+    {"/new.txt",    EVFS_WRITE | EVFS_NO_EXIST,     EVFS_ERR_EXISTS},
+    {"/new.txt",    EVFS_WRITE | EVFS_OVERWRITE,    EVFS_OK},
+    {"/other.txt",  EVFS_WRITE | EVFS_OVERWRITE,    EVFS_OK},
+    {"/third.txt",  EVFS_WRITE | EVFS_NO_EXIST,     EVFS_OK},
+    {"/dir",        EVFS_WRITE | EVFS_OVERWRITE,    EVFS_ERR_IS_DIR}
+  };
+
+  puts("\nWritable archive:");
+
+  EvfsFile *tar_file;
+  int status = evfs_register_ramfs("tar_ram", NULL, /*default*/ false);
+  if(status == EVFS_OK)
+    status = evfs_open_ex("/bundle.tar", &tar_file, EVFS_RDWR | EVFS_OVERWRITE, "tar_ram");
+  if(status == EVFS_OK) {
+    status = evfs_register_tar_fs_writable("bundle", tar_file, /*default*/ false);
+    if(status != EVFS_OK)
+      evfs_file_close(tar_file);
+  }
+
+  if(status == EVFS_ERR_NO_SUPPORT) {
+    puts("  Skipped. Not supported in this build.");
+    return 0;
+  } else if(status != EVFS_OK) {
+    printf("  Setup failed: %s\n", evfs_err_name(status));
+    return 1;
+  }
+
+  evfs_make_dir_ex("/dir", "bundle");
+
+  int errors = 0;
+  char buf[16];
+
+  for(size_t i = 0; i < COUNT_OF(cases); i++) {
+    EvfsFile *fh;
+    status = evfs_open_ex(cases[i].path, &fh, cases[i].flags, "bundle");
+    if(status == EVFS_OK) {
+      snprintf(buf, sizeof buf, "case %zu", i);
+      evfs_file_write(fh, buf, strlen(buf));
+      evfs_file_close(fh);
+    }
+
+    bool pass = status == cases[i].expect;
+    printf("  %-10s 0x%02X  %-20s %s\n", cases[i].path, cases[i].flags, evfs_err_name(status),
+           pass ? "" : "FAIL");
+    if(!pass)
+      errors++;
+  }
+
+  // The overwrite should have replaced the first version
+  EvfsFile *fh;
+  memset(buf, 0, sizeof buf);
+  status = evfs_open_ex("/new.txt", &fh, EVFS_READ, "bundle");
+  if(status == EVFS_OK) {
+    evfs_file_read(fh, buf, sizeof buf - 1);
+    evfs_file_close(fh);
+  }
+  bool pass = !strcmp(buf, "case 5");
+  printf("  /new.txt contains '%s' %s\n", buf, pass ? "" : "FAIL");
+  if(!pass)
+    errors++;
+
+  evfs_unregister(evfs_find_vfs("bundle"));
+  evfs_unregister(evfs_find_vfs("tar_ram"));
+
+  return errors;
+}
+
+
 
 
 int main(int argc, char *argv[]) {
@@ -34,16 +119,22 @@ int main(int argc, char *argv[]) {
   struct s_options {
     bool show_trace;
     const char *tar_file;
+    const char *index_file;
+    const char *extract_dir;
+    bool gzip;
   } options;
 
 
   options.show_trace = false;
   options.tar_file = NULL;
+  options.index_file = NULL;
+  options.extract_dir = NULL;
+  options.gzip = false;
 
   GetoptState state = {.report_errors = true};
 
   int c;
-  while((c = getopt_r(argv, "tf:h", &state)) != -1) {
+  while((c = getopt_r(argv, "tf:i:x:zh", &state)) != -1) {
     switch(c) {
     case 't':
       options.show_trace = true;
@@ -51,6 +142,15 @@ int main(int argc, char *argv[]) {
     case 'f':
       options.tar_file = state.optarg;
       break;
+    case 'i':
+      options.index_file = state.optarg;
+      break;
+    case 'x':
+      options.extract_dir = state.optarg;
+      break;
+    case 'z':
+      options.gzip = true;
+      break;
     default:
     case 'h':
     case ':':
@@ -60,7 +160,11 @@ int main(int argc, char *argv[]) {
         StringRange base;
         evfs_path_basename(argv[0], &base);
 
-        printf("Usage: %.*s [-t] [-h]\n", RANGE_FMT(&base));
+        printf("Usage: %.*s [-f tar_file] [-i index_file] [-x dir] [-z] [-t] [-h]\n", RANGE_FMT(&base));
+        puts("  -f <file>\tload tar file in place of compiled resource");
+        puts("  -i <file>\tsidecar index for tar file");
+        puts("  -x <dir>\tstream tar file into dir and exit");
+        puts("  -z     \ttar file is gzip compressed");
         puts("  -t     \tshow EVFS tracing");
         puts("  -h     \tdisplay this help and exit");
       }
@@ -84,18 +188,64 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
+  if(options.tar_file && options.extract_dir) {
+    // Only reads forward so this also works with pipes
+    printf("Extracting %s into %s\n", options.tar_file, options.extract_dir);
+    EvfsFile *tar_file;
+    status = evfs_open(options.tar_file, &tar_file, EVFS_READ);
+    if(status == EVFS_OK) {
+      status = tar_stream_extract(tar_file, options.extract_dir, NULL, 4096);
+      evfs_file_close(tar_file);
+    }
+
+    printf("Extract: %s\n", evfs_err_name(status));
+    return status == EVFS_OK ? 0 : 1;
+  }
+
   if(options.tar_file) {
     printf("Loading file: %s\n", options.tar_file);
     EvfsFile *tar_file;
     status = evfs_open(options.tar_file, &tar_file, EVFS_READ);
 
-    evfs_register_tar_fs("tarfs", tar_file, /*default*/ true);
+    if(options.gzip) {
+#ifdef USE_ZLIB
+      EvfsFile *gz_file = tar_file;
+      status = evfs_open_gzip_file(gz_file, &tar_file, 0);
+      if(status != EVFS_OK) {
+        printf("Failed to open gzip file: %s\n", evfs_err_name(status));
+        return 1;
+      }
+#else
+      puts("Gzip support requires USE_ZLIB");
+      return 1;
+#endif
+    }
+
+    if(options.index_file) {
+      EvfsFile *index_file;
+      status = evfs_open(options.index_file, &index_file, EVFS_RDWR | EVFS_OPEN_OR_NEW);
+      if(status != EVFS_OK) {
+        printf("Failed to open index: %s\n", evfs_err_name(status));
+        return 1;
+      }
+
+      evfs_register_tar_fs_with_index("tarfs", tar_file, index_file, /*default*/ true);
+      evfs_file_close(index_file);
+    } else {
+      evfs_register_tar_fs("tarfs", tar_file, /*default*/ true);
+    }
 
   } else { // Use compiled resource
     puts("Loading resource");
     evfs_register_tar_rsrc_fs("tarfs", test_tar, test_tar_len, /*default*/ true);
   }
 
+  EvfsIndexStats index_stats;
+  if(evfs_vfs_ctrl_ex(EVFS_CMD_GET_INDEX_STATS, &index_stats, "tarfs") == EVFS_OK) {
+    printf("Indexed %zu files, %zu key bytes in %" PRIu64 " us%s\n", index_stats.files,
+            index_stats.key_bytes, index_stats.build_usec, index_stats.from_sidecar ? " from sidecar" : "");
+  }
+
   evfs_register_trace("t_tarfs", "tarfs", treport, stderr, /*default*/ true);
 
 
@@ -117,6 +267,5 @@ int main(int argc, char *argv[]) {
 
   evfs_file_close(fh);
 
-
-  return 0;
+  return test_writable_open() == 0 ? 0 : 1;
 }